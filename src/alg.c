@@ -25,24 +25,30 @@
 #include "util.h"
 #include "draw.h"
 #include "alg.h"
-
-#ifdef __MMX__
-    #define HAVE_MMX
-    #include "mmx.h"
-#endif
+#include "alg_simd.h"
+#include "alg_opencl.h"
+#include "metrics.h"
 
 #define MAX2(x, y) ((x) > (y) ? (x) : (y))
+#define MIN2(x, y) ((x) < (y) ? (x) : (y))
 #define MAX3(x, y, z) ((x) > (y) ? ((x) > (z) ? (x) : (z)) : ((y) > (z) ? (y) : (z)))
 
 /**
  * alg_locate_center_size
  *      Locates the center and size of the movement.
+ *
+ *   The center and size only depend on the number of motion pixels in each
+ *   column and row so these are counted first in a single pass.  Rows that
+ *   alg_diff and alg_despeckle left without changed pixels are skipped.
  */
 void alg_locate_center_size(struct images *imgs, int width, int height, struct coord *cent)
 {
-    unsigned char *out = imgs->img_motion.image_norm;
-    int *labels = imgs->labels;
-    int x, y, centc = 0, xdist = 0, ydist = 0;
+    unsigned char *out;
+    int *labels;
+    int *cols = imgs->locate_counts;
+    int *rows = imgs->locate_counts + width;
+    int x, y, line;
+    long sumx = 0, sumy = 0, centc = 0, xdist = 0, ydist = 0;
 
     cent->x = 0;
     cent->y = 0;
@@ -51,84 +57,50 @@ void alg_locate_center_size(struct images *imgs, int width, int height, struct c
     cent->minx = width;
     cent->miny = height;
 
-    /* If Labeling enabled - locate center of largest labelgroup. */
-    if (imgs->labelsize_max) {
-        /* Locate largest labelgroup */
-        for (y = 0; y < height; y++) {
+    memset(cols, 0, width * sizeof(*cols));
+
+    for (y = 0; y < height; y++) {
+        line = 0;
+        if (imgs->motion_rows[y] == 0) {
+            rows[y] = 0;
+            continue;
+        }
+        /* If Labeling enabled - locate center of largest labelgroup. */
+        if (imgs->labelsize_max) {
+            labels = imgs->labels + y * width;
             for (x = 0; x < width; x++) {
-                if (*(labels++) & 32768) {
-                    cent->x += x;
-                    cent->y += y;
-                    centc++;
-                }
+                cols[x] += (labels[x] & 32768) != 0;
+                line += (labels[x] & 32768) != 0;
             }
-        }
-
-    } else {
-        /* Locate movement */
-        for (y = 0; y < height; y++) {
+        } else {
+            out = imgs->img_motion.image_norm + y * width;
             for (x = 0; x < width; x++) {
-                if (*(out++)) {
-                    cent->x += x;
-                    cent->y += y;
-                    centc++;
-                }
+                cols[x] += out[x] != 0;
+                line += out[x] != 0;
             }
         }
+        rows[y] = line;
+    }
 
+    for (x = 0; x < width; x++) {
+        sumx += (long)x * cols[x];
+        centc += cols[x];
+    }
+    for (y = 0; y < height; y++) {
+        sumy += (long)y * rows[y];
     }
 
     if (centc) {
-        cent->x = cent->x / centc;
-        cent->y = cent->y / centc;
+        cent->x = sumx / centc;
+        cent->y = sumy / centc;
     }
 
     /* Now we find the size of the Motion. */
-
-    /* First reset pointers back to initial value. */
-    centc = 0;
-    labels = imgs->labels;
-    out = imgs->img_motion.image_norm;
-
-    /* If Labeling then we find the area around largest labelgroup instead. */
-    if (imgs->labelsize_max) {
-        for (y = 0; y < height; y++) {
-            for (x = 0; x < width; x++) {
-                if (*(labels++) & 32768) {
-                    if (x > cent->x) {
-                        xdist += x - cent->x;
-                    } else if (x < cent->x) {
-                        xdist += cent->x - x;
-                    }
-                    if (y > cent->y) {
-                        ydist += y - cent->y;
-                    } else if (y < cent->y) {
-                        ydist += cent->y - y;
-                    }
-                    centc++;
-                }
-            }
-        }
-
-    } else {
-        for (y = 0; y < height; y++) {
-            for (x = 0; x < width; x++) {
-                if (*(out++)) {
-                    if (x > cent->x) {
-                        xdist += x - cent->x;
-                    } else if (x < cent->x) {
-                        xdist += cent->x - x;
-                    }
-                    if (y > cent->y) {
-                        ydist += y - cent->y;
-                    } else if (y < cent->y) {
-                        ydist += cent->y - y;
-                    }
-                    centc++;
-                }
-            }
-        }
-
+    for (x = 0; x < width; x++) {
+        xdist += (long)cols[x] * abs(x - cent->x);
+    }
+    for (y = 0; y < height; y++) {
+        ydist += (long)rows[y] * abs(y - cent->y);
     }
 
     if (centc) {
@@ -186,183 +158,217 @@ void alg_locate_center_size(struct images *imgs, int width, int height, struct c
 
 
 /**
- * alg_draw_location
- *      Draws a box around the movement.
+ * alg_draw_box
+ *      Inverts the pixels of a box around the movement.
  */
-void alg_draw_location(struct coord *cent, struct images *imgs, int width, unsigned char *new,
-                       int style, int mode, int process_thisframe)
+static void alg_draw_box(struct coord *cent, int width, unsigned char *img)
 {
-    unsigned char *out = imgs->img_motion.image_norm;
     int x, y;
+    int width_miny = width * cent->miny;
+    int width_maxy = width * cent->maxy;
 
-    out = imgs->img_motion.image_norm;
+    for (x = cent->minx; x <= cent->maxx; x++) {
+        int width_miny_x = x + width_miny;
+        int width_maxy_x = x + width_maxy;
 
-    /* Debug image always gets a 'normal' box. */
-    if ((mode == LOCATE_BOTH) && process_thisframe) {
-        int width_miny = width * cent->miny;
-        int width_maxy = width * cent->maxy;
-
-        for (x = cent->minx; x <= cent->maxx; x++) {
-            int width_miny_x = x + width_miny;
-            int width_maxy_x = x + width_maxy;
-
-            out[width_miny_x] =~out[width_miny_x];
-            out[width_maxy_x] =~out[width_maxy_x];
-        }
-
-        for (y = cent->miny; y <= cent->maxy; y++) {
-            int width_minx_y = cent->minx + y * width;
-            int width_maxx_y = cent->maxx + y * width;
-
-            out[width_minx_y] =~out[width_minx_y];
-            out[width_maxx_y] =~out[width_maxx_y];
-        }
+        img[width_miny_x] =~img[width_miny_x];
+        img[width_maxy_x] =~img[width_maxy_x];
     }
-    if (style == LOCATE_BOX) { /* Draw a box on normal images. */
-        int width_miny = width * cent->miny;
-        int width_maxy = width * cent->maxy;
-
-        for (x = cent->minx; x <= cent->maxx; x++) {
-            int width_miny_x = x + width_miny;
-            int width_maxy_x = x + width_maxy;
 
-            new[width_miny_x] =~new[width_miny_x];
-            new[width_maxy_x] =~new[width_maxy_x];
-        }
+    for (y = cent->miny; y <= cent->maxy; y++) {
+        int width_minx_y = cent->minx + y * width;
+        int width_maxx_y = cent->maxx + y * width;
 
-        for (y = cent->miny; y <= cent->maxy; y++) {
-            int width_minx_y = cent->minx + y * width;
-            int width_maxx_y = cent->maxx + y * width;
+        img[width_minx_y] =~img[width_minx_y];
+        img[width_maxx_y] =~img[width_maxx_y];
+    }
+}
 
-            new[width_minx_y] =~new[width_minx_y];
-            new[width_maxx_y] =~new[width_maxx_y];
-        }
-    } else if (style == LOCATE_CROSS) { /* Draw a cross on normal images. */
-        int centy = cent->y * width;
+/**
+ * alg_draw_cross
+ *      Inverts the pixels of a cross of size pixels at the center of the movement.
+ */
+static void alg_draw_cross(struct coord *cent, int width, unsigned char *img, int size)
+{
+    int x, y;
+    int centy = cent->y * width;
 
-        for (x = cent->x - 10;  x <= cent->x + 10; x++) {
-            new[centy + x] =~new[centy + x];
-            out[centy + x] =~out[centy + x];
-        }
+    for (x = cent->x - size;  x <= cent->x + size; x++) {
+        img[centy + x] =~img[centy + x];
+    }
 
-        for (y = cent->y - 10; y <= cent->y + 10; y++) {
-            new[cent->x + y * width] =~new[cent->x + y * width];
-            out[cent->x + y * width] =~out[cent->x + y * width];
-        }
+    for (y = cent->y - size; y <= cent->y + size; y++) {
+        img[cent->x + y * width] =~img[cent->x + y * width];
     }
 }
 
-
 /**
- * alg_draw_red_location
- *          Draws a RED box around the movement.
+ * alg_draw_red_box
+ *      Draws a red box of lines two pixels wide around the movement.
  */
-void alg_draw_red_location(struct coord *cent, struct images *imgs, int width, unsigned char *new,
-                           int style, int mode, int process_thisframe)
+static void alg_draw_red_box(struct coord *cent, int width, int height, unsigned char *new)
 {
-    unsigned char *out = imgs->img_motion.image_norm;
     unsigned char *new_u, *new_v;
-    int x, y, v, cwidth, cblock;
+    int x, y, cwidth;
+    int width_miny = width * cent->miny;
+    int width_maxy = width * cent->maxy;
+    int cwidth_miny, cwidth_maxy;
 
     cwidth = width / 2;
-    cblock = imgs->motionsize / 4;
-    x = imgs->motionsize;
-    v = x + cblock;
-    out = imgs->img_motion.image_norm;
-    new_u = new + x;
-    new_v = new + v;
+    new_u = new + width * height;
+    new_v = new_u + (width * height) / 4;
+    cwidth_miny = cwidth * (cent->miny / 2);
+    cwidth_maxy = cwidth * (cent->maxy / 2);
 
-    /* Debug image always gets a 'normal' box. */
-    if ((mode == LOCATE_BOTH) && process_thisframe) {
-        int width_miny = width * cent->miny;
-        int width_maxy = width * cent->maxy;
+    for (x = cent->minx + 2; x <= cent->maxx - 2; x += 2) {
+        int width_miny_x = x + width_miny;
+        int width_maxy_x = x + width_maxy;
+        int cwidth_miny_x = x / 2 + cwidth_miny;
+        int cwidth_maxy_x = x / 2 + cwidth_maxy;
 
-        for (x = cent->minx; x <= cent->maxx; x++) {
-            int width_miny_x = x + width_miny;
-            int width_maxy_x = x + width_maxy;
+        new_u[cwidth_miny_x] = 128;
+        new_u[cwidth_maxy_x] = 128;
+        new_v[cwidth_miny_x] = 255;
+        new_v[cwidth_maxy_x] = 255;
 
-            out[width_miny_x] =~out[width_miny_x];
-            out[width_maxy_x] =~out[width_maxy_x];
-        }
+        new[width_miny_x] = 128;
+        new[width_maxy_x] = 128;
 
-        for (y = cent->miny; y <= cent->maxy; y++) {
-            int width_minx_y = cent->minx + y * width;
-            int width_maxx_y = cent->maxx + y * width;
+        new[width_miny_x + 1] = 128;
+        new[width_maxy_x + 1] = 128;
 
-            out[width_minx_y] =~out[width_minx_y];
-            out[width_maxx_y] =~out[width_maxx_y];
-        }
+        new[width_miny_x + width] = 128;
+        new[width_maxy_x + width] = 128;
+
+        new[width_miny_x + 1 + width] = 128;
+        new[width_maxy_x + 1 + width] = 128;
     }
 
-    if (style == LOCATE_REDBOX) { /* Draw a red box on normal images. */
-        int width_miny = width * cent->miny;
-        int width_maxy = width * cent->maxy;
-        int cwidth_miny = cwidth * (cent->miny / 2);
-        int cwidth_maxy = cwidth * (cent->maxy / 2);
+    for (y = cent->miny; y <= cent->maxy; y += 2) {
+        int width_minx_y = cent->minx + y * width;
+        int width_maxx_y = cent->maxx + y * width;
+        int cwidth_minx_y = (cent->minx / 2) + (y / 2) * cwidth;
+        int cwidth_maxx_y = (cent->maxx / 2) + (y / 2) * cwidth;
 
-        for (x = cent->minx + 2; x <= cent->maxx - 2; x += 2) {
-            int width_miny_x = x + width_miny;
-            int width_maxy_x = x + width_maxy;
-            int cwidth_miny_x = x / 2 + cwidth_miny;
-            int cwidth_maxy_x = x / 2 + cwidth_maxy;
+        new_u[cwidth_minx_y] = 128;
+        new_u[cwidth_maxx_y] = 128;
+        new_v[cwidth_minx_y] = 255;
+        new_v[cwidth_maxx_y] = 255;
 
-            new_u[cwidth_miny_x] = 128;
-            new_u[cwidth_maxy_x] = 128;
-            new_v[cwidth_miny_x] = 255;
-            new_v[cwidth_maxy_x] = 255;
+        new[width_minx_y] = 128;
+        new[width_maxx_y] = 128;
 
-            new[width_miny_x] = 128;
-            new[width_maxy_x] = 128;
+        new[width_minx_y + width] = 128;
+        new[width_maxx_y + width] = 128;
 
-            new[width_miny_x + 1] = 128;
-            new[width_maxy_x + 1] = 128;
+        new[width_minx_y + 1] = 128;
+        new[width_maxx_y + 1] = 128;
 
-            new[width_miny_x + width] = 128;
-            new[width_maxy_x + width] = 128;
+        new[width_minx_y + width + 1] = 128;
+        new[width_maxx_y + width + 1] = 128;
+    }
+}
 
-            new[width_miny_x + 1 + width] = 128;
-            new[width_maxy_x + 1 + width] = 128;
-        }
+/**
+ * alg_draw_red_cross
+ *      Colours a cross of size pixels red at the center of the movement.
+ */
+static void alg_draw_red_cross(struct coord *cent, int width, int height, unsigned char *new, int size)
+{
+    unsigned char *new_u, *new_v;
+    int x, y, cwidth;
+    int cwidth_maxy;
 
-        for (y = cent->miny; y <= cent->maxy; y += 2) {
-            int width_minx_y = cent->minx + y * width;
-            int width_maxx_y = cent->maxx + y * width;
-            int cwidth_minx_y = (cent->minx / 2) + (y / 2) * cwidth;
-            int cwidth_maxx_y = (cent->maxx / 2) + (y / 2) * cwidth;
+    cwidth = width / 2;
+    new_u = new + width * height;
+    new_v = new_u + (width * height) / 4;
+    cwidth_maxy = cwidth * (cent->y / 2);
 
-            new_u[cwidth_minx_y] = 128;
-            new_u[cwidth_maxx_y] = 128;
-            new_v[cwidth_minx_y] = 255;
-            new_v[cwidth_maxx_y] = 255;
+    for (x = cent->x - size; x <= cent->x + size; x += 2) {
+        int cwidth_maxy_x = x / 2 + cwidth_maxy;
 
-            new[width_minx_y] = 128;
-            new[width_maxx_y] = 128;
+        new_u[cwidth_maxy_x] = 128;
+        new_v[cwidth_maxy_x] = 255;
+    }
 
-            new[width_minx_y + width] = 128;
-            new[width_maxx_y + width] = 128;
+    for (y = cent->y - size; y <= cent->y + size; y += 2) {
+        int cwidth_minx_y = (cent->x / 2) + (y / 2) * cwidth;
 
-            new[width_minx_y + 1] = 128;
-            new[width_maxx_y + 1] = 128;
+        new_u[cwidth_minx_y] = 128;
+        new_v[cwidth_minx_y] = 255;
+    }
+}
 
-            new[width_minx_y + width + 1] = 128;
-            new[width_maxx_y + width + 1] = 128;
-        }
-    } else if (style == LOCATE_REDCROSS) { /* Draw a red cross on normal images. */
-        int cwidth_maxy = cwidth * (cent->y / 2);
+/**
+ * alg_draw_location
+ *      Draws a box around the movement.
+ */
+void alg_draw_location(struct coord *cent, struct images *imgs, int width, unsigned char *new,
+                       int style, int mode, int process_thisframe)
+{
+    unsigned char *out = imgs->img_motion.image_norm;
 
-        for (x = cent->x - 10; x <= cent->x + 10; x += 2) {
-            int cwidth_maxy_x = x / 2 + cwidth_maxy;
+    /* Debug image always gets a 'normal' box. */
+    if ((mode == LOCATE_BOTH) && process_thisframe) {
+        alg_draw_box(cent, width, out);
+    }
+    if (style == LOCATE_BOX) { /* Draw a box on normal images. */
+        alg_draw_box(cent, width, new);
+    } else if (style == LOCATE_CROSS) { /* Draw a cross on normal images. */
+        alg_draw_cross(cent, width, new, 10);
+        alg_draw_cross(cent, width, out, 10);
+    }
+}
 
-            new_u[cwidth_maxy_x] = 128;
-            new_v[cwidth_maxy_x] = 255;
-        }
 
-        for (y = cent->y - 10; y <= cent->y + 10; y += 2) {
-            int cwidth_minx_y = (cent->x / 2) + (y / 2) * cwidth;
+/**
+ * alg_draw_red_location
+ *          Draws a RED box around the movement.
+ */
+void alg_draw_red_location(struct coord *cent, struct images *imgs, int width, unsigned char *new,
+                           int style, int mode, int process_thisframe)
+{
+    unsigned char *out = imgs->img_motion.image_norm;
+    int height = imgs->motionsize / width;
 
-            new_u[cwidth_minx_y] = 128;
-            new_v[cwidth_minx_y] = 255;
-        }
+    /* Debug image always gets a 'normal' box. */
+    if ((mode == LOCATE_BOTH) && process_thisframe) {
+        alg_draw_box(cent, width, out);
+    }
+
+    if (style == LOCATE_REDBOX) { /* Draw a red box on normal images. */
+        alg_draw_red_box(cent, width, height, new);
+    } else if (style == LOCATE_REDCROSS) { /* Draw a red cross on normal images. */
+        alg_draw_red_cross(cent, width, height, new, 10);
+    }
+}
+
+/**
+ * alg_draw_location_high
+ *      Draws the locate box or cross found on the detection image at the
+ *      matching position of the high resolution image when the detection
+ *      uses a reduced copy of the captured image (detect_scale).
+ */
+void alg_draw_location_high(struct coord *cent, struct images *imgs, unsigned char *new, int style)
+{
+    struct coord loc;
+    int scale = imgs->detect_scale;
+
+    loc.x = cent->x * scale;
+    loc.y = cent->y * scale;
+    loc.minx = cent->minx * scale;
+    loc.maxx = cent->maxx * scale + scale - 1;
+    loc.miny = cent->miny * scale;
+    loc.maxy = cent->maxy * scale + scale - 1;
+
+    if (style == LOCATE_BOX) {
+        alg_draw_box(&loc, imgs->width_high, new);
+    } else if (style == LOCATE_CROSS) {
+        alg_draw_cross(&loc, imgs->width_high, new, 10 * scale);
+    } else if (style == LOCATE_REDBOX) {
+        alg_draw_red_box(&loc, imgs->width_high, imgs->height_high, new);
+    } else if (style == LOCATE_REDCROSS) {
+        alg_draw_red_cross(&loc, imgs->width_high, imgs->height_high, new, 10 * scale);
     }
 }
 
@@ -372,6 +378,22 @@ void alg_draw_red_location(struct coord *cent, struct images *imgs, int width, u
 #define DIFF(x, y)         (ABS((x)-(y)))
 #define NDIFF(x, y)        (ABS(x) * NORM / (ABS(x) + 2 * DIFF(x, y)))
 
+/**
+ * alg_noise_set
+ *      Set the noise level from the sum of the differences of the pixels
+ *      in the smart mask.
+ */
+static void alg_noise_set(struct context *cnt, int sum, int count)
+{
+    if (count > 3) {
+        /* Avoid divide by zero. */
+        sum /= count / 3;
+    }
+
+    /* 5: safe, 4: regular, 3: more sensitive */
+    cnt->noise = 4 + (cnt->conf.noise_level / 2) + (cnt->noise + sum) / 2;
+}
+
 /**
  * alg_noise_tune
  *
@@ -385,6 +407,16 @@ void alg_noise_tune(struct context *cnt, unsigned char *new)
     unsigned char *mask = imgs->mask;
     unsigned char *smartmask = imgs->smartmask_final;
 
+    #ifdef HAVE_OPENCL
+        /* The sums were taken by the diff on the GPU, skip the frames without one */
+        if (cnt->opencl != NULL) {
+            if (alg_opencl_noise(cnt, &sum, &count)) {
+                alg_noise_set(cnt, sum, count);
+            }
+            return;
+        }
+    #endif
+
     i = imgs->motionsize;
 
     for (; i > 0; i--) {
@@ -404,13 +436,7 @@ void alg_noise_tune(struct context *cnt, unsigned char *new)
         smartmask++;
     }
 
-    if (count > 3) {
-        /* Avoid divide by zero. */
-        sum /= count / 3;
-    }
-
-    /* 5: safe, 4: regular, 3: more sensitive */
-    cnt->noise = 4 + (cnt->conf.noise_level / 2) + (cnt->noise + sum) / 2;
+    alg_noise_set(cnt, sum, count);
 }
 
 /**
@@ -625,253 +651,245 @@ static int alg_labeling(struct context *cnt)
 }
 
 /**
- * dilate9
- *      Dilates a 3x3 box.
+ * alg_labeling_runs_root
+ *      Find the root run of a component and shorten the path to it.
  */
-static int dilate9(unsigned char *img, int width, int height, void *buffer)
+static int alg_labeling_runs_root(struct alg_run *runs, int indx)
 {
-    /*
-     * - row1, row2 and row3 represent lines in the temporary buffer.
-     * - Window is a sliding window containing max values of the columns
-     *   in the 3x3 matrix.
-     * - width is an index into the sliding window (this is faster than
-     *   doing modulo 3 on i).
-     * - blob keeps the current max value.
-     */
-    int y, i, sum = 0, widx;
-    unsigned char *row1, *row2, *row3, *rowTemp,*yp;
-    unsigned char window[3], blob, latest;
+    int root, next;
 
-    /* Set up row pointers in the temporary buffer. */
-    row1 = buffer;
-    row2 = row1 + width;
-    row3 = row2 + width;
+    root = indx;
+    while (runs[root].parent >= 0) {
+        root = runs[root].parent;
+    }
+    while (runs[indx].parent >= 0) {
+        next = runs[indx].parent;
+        runs[indx].parent = root;
+        indx = next;
+    }
+    return root;
+}
 
-    /* Init rows 2 and 3. */
-    memset(row2, 0, width);
-    memcpy(row3, img, width);
+/**
+ * alg_labeling_runs
+ *      Same result as alg_labeling but found with a two pass union find over
+ *      the horizontal runs of motion pixels instead of flood filling them.
+ *      Runs are linked when they overlap a run on the row above (4 way
+ *      connectivity as with iflood).  The root of each component holds the
+ *      negative size of the component in parent.  Labels are numbered in the
+ *      order iflood would have found them and, as with iflood, a component is
+ *      only labeled when it has a pixel outside of the last row and column.
+ */
+static int alg_labeling_runs(struct context *cnt)
+{
+    struct images *imgs = &cnt->imgs;
+    unsigned char *out = imgs->img_motion.image_norm;
+    struct alg_run *runs = imgs->label_runs;
+    int *rows = imgs->label_rows;
+    int *labels = imgs->labels;
+    int width = imgs->width;
+    int height = imgs->height;
+    int x, y, nruns, indx, prev, root, ra, rb, value;
+    int labelsize, current_label = 2;
+    int max_under = 0;
 
-    /* Pointer to the current row in img. */
-    yp = img;
+    cnt->current_image->total_labels = 0;
+    imgs->labelsize_max = 0;
+    imgs->labelgroup_max = 0;
+    imgs->labels_above = 0;
 
+    /* First pass: collect the runs and join the ones that touch. */
+    nruns = 0;
     for (y = 0; y < height; y++) {
-        /* Move down one step; row 1 becomes the previous row 2 and so on. */
-        rowTemp = row1;
-        row1 = row2;
-        row2 = row3;
-        row3 = rowTemp;
-
-        /* If we're at the last row, fill with zeros, otherwise copy from img. */
-        if (y == height - 1) {
-            memset(row3, 0, width);
-        } else {
-            memcpy(row3, yp+width, width);
-        }
-
-        /* Init slots 0 and 1 in the moving window. */
-        window[0] = MAX3(row1[0], row2[0], row3[0]);
-        window[1] = MAX3(row1[1], row2[1], row3[1]);
-
-        /* Init blob to the current max, and set window index. */
-        blob = MAX2(window[0], window[1]);
-        widx = 2;
-
-        /*
-         * Iterate over the current row; index i is off by one to eliminate
-         * a lot of +1es in the loop.
-         */
-        for (i = 2; i <= width - 1; i++) {
-            /* Get the max value of the next column in the 3x3 matrix. */
-            latest = window[widx] = MAX3(row1[i], row2[i], row3[i]);
-
-            /*
-             * If the value is larger than the current max, use it. Otherwise,
-             * calculate a new max (because the new value may not be the max.
-             */
-            if (latest >= blob) {
-                blob = latest;
-            } else {
-                blob = MAX3(window[0], window[1], window[2]);
+        rows[y] = nruns;
+        prev = (y > 0) ? rows[y - 1] : 0;
+        x = 0;
+        while (x < width) {
+            if (out[y * width + x] == 0) {
+                x++;
+                continue;
             }
-
-            /* Write the max value (blob) to the image. */
-            if (blob != 0) {
-                *(yp + i - 1) = blob;
-                sum++;
+            runs[nruns].x0 = x;
+            while ((x < width) && (out[y * width + x] != 0)) {
+                x++;
             }
+            runs[nruns].x1 = x - 1;
+            runs[nruns].parent = -(x - runs[nruns].x0);
+            runs[nruns].label = 0;
 
-            /* Wrap around the window index if necessary. */
-            if (++widx == 3) {
-                widx = 0;
+            /* Runs of the row above that end before this one starts can not touch later ones either */
+            while ((prev < rows[y]) && (runs[prev].x1 < runs[nruns].x0)) {
+                prev++;
+            }
+            for (indx = prev; (indx < rows[y]) && (runs[indx].x0 <= runs[nruns].x1); indx++) {
+                ra = alg_labeling_runs_root(runs, indx);
+                rb = alg_labeling_runs_root(runs, nruns);
+                if (ra != rb) {
+                    /* Keep the older root so the tree stays shallow */
+                    if (ra > rb) {
+                        root = ra;
+                        ra = rb;
+                        rb = root;
+                    }
+                    runs[ra].parent += runs[rb].parent;
+                    runs[rb].parent = ra;
+                }
+            }
+            if (indx > prev) {
+                /* The last run we touched may also touch the next run on this row */
+                prev = indx - 1;
             }
+            nruns++;
         }
-
-        /* Store zeros in the vertical sides. */
-        *yp = *(yp + width - 1) = 0;
-        yp += width;
     }
+    rows[height] = nruns;
 
-    return sum;
-}
-
-/**
- * dilate5
- *      Dilates a + shape.
- */
-static int dilate5(unsigned char *img, int width, int height, void *buffer)
-{
     /*
-     * - row1, row2 and row3 represent lines in the temporary buffer.
-     * - mem holds the max value of the overlapping part of two + shapes.
+     * Second pass: number the components in the order of their first
+     * run that iflood could have started from.
      */
-    int y, i, sum = 0;
-    unsigned char *row1, *row2, *row3, *rowTemp, *yp;
-    unsigned char blob, mem, latest;
-
-    /* Set up row pointers in the temporary buffer. */
-    row1 = buffer;
-    row2 = row1 + width;
-    row3 = row2 + width;
-
-    /* Init rows 2 and 3. */
-    memset(row2, 0, width);
-    memcpy(row3, img, width);
-
-    /* Pointer to the current row in img. */
-    yp = img;
-
-    for (y = 0; y < height; y++) {
-        /* Move down one step; row 1 becomes the previous row 2 and so on. */
-        rowTemp = row1;
-        row1 = row2;
-        row2 = row3;
-        row3 = rowTemp;
-
-        /* If we're at the last row, fill with zeros, otherwise copy from img. */
-        if (y == height - 1) {
-            memset(row3, 0, width);
-        } else {
-            memcpy(row3, yp + width, width);
-        }
-
-        /* Init mem and set blob to force an evaluation of the entire + shape. */
-        mem = MAX2(row2[0], row2[1]);
-        blob = 1; /* dummy value, must be > 0 */
+    for (y = 0; y < height - 1; y++) {
+        for (indx = rows[y]; indx < rows[y + 1]; indx++) {
+            if (runs[indx].x0 >= width - 1) {
+                continue;
+            }
+            root = alg_labeling_runs_root(runs, indx);
+            if (runs[root].label) {
+                continue;
+            }
 
-        for (i = 1; i < width - 1; i++) {
-            /* Get the max value of the "right edge" of the + shape. */
-            latest = MAX3(row1[i], row2[i + 1], row3[i]);
+            labelsize = -runs[root].parent;
+            imgs->labelsize[cnt->current_image->total_labels] = labelsize;
 
-            if (blob == 0) {
-                /* In case the last blob is zero, only latest matters. */
-                blob = latest;
-                mem = row2[i + 1];
+            /* Label above threshold? Mark it (add 32768 to labelnumber). */
+            if (labelsize > cnt->threshold) {
+                runs[root].label = current_label + 32768;
+                imgs->labelgroup_max += labelsize;
+                imgs->labels_above++;
             } else {
-                /* Otherwise, we have to check both latest and mem. */
-                blob = MAX2(mem, latest);
-                mem = MAX2(row2[i], row2[i + 1]);
+                runs[root].label = current_label;
+                if (max_under < labelsize) {
+                    max_under = labelsize;
+                }
             }
 
-            /* Write the max value (blob) to the image. */
-            if (blob != 0) {
-                *(yp + i) = blob;
-                sum++;
+            if (imgs->labelsize_max < labelsize) {
+                imgs->labelsize_max = labelsize;
+                imgs->largest_label = current_label;
             }
-        }
 
-        /* Store zeros in the vertical sides. */
-        *yp = *(yp + width - 1) = 0;
-        yp += width;
+            cnt->current_image->total_labels++;
+            current_label++;
+        }
     }
-    return sum;
-}
-
-/**
- * erode9
- *      Erodes a 3x3 box.
- */
-static int erode9(unsigned char *img, int width, int height, void *buffer, unsigned char flag)
-{
-    int y, i, sum = 0;
-    char *Row1,*Row2,*Row3;
-
-    Row1 = buffer;
-    Row2 = Row1 + width;
-    Row3 = Row1 + 2 * width;
-    memset(Row2, flag, width);
-    memcpy(Row3, img, width);
 
+    /*
+     * Fill the labels image with the values alg_labeling leaves behind:
+     * 1 for the pixels without motion it checked, 0 for the last row and
+     * column and the label for everything in a component.
+     */
     for (y = 0; y < height; y++) {
-        memcpy(Row1, Row2, width);
-        memcpy(Row2, Row3, width);
-
-        if (y == height-1) {
-            memset(Row3, flag, width);
-        } else {
-            memcpy(Row3, img + (y+1) * width, width);
+        value = (y < height - 1) ? 1 : 0;
+        for (x = 0; x < width - 1; x++) {
+            labels[y * width + x] = value;
         }
+        labels[y * width + width - 1] = 0;
 
-        for (i = width - 2; i >= 1; i--) {
-            if (Row1[i - 1] == 0 ||
-                Row1[i]     == 0 ||
-                Row1[i + 1] == 0 ||
-                Row2[i - 1] == 0 ||
-                Row2[i]     == 0 ||
-                Row2[i + 1] == 0 ||
-                Row3[i - 1] == 0 ||
-                Row3[i]     == 0 ||
-                Row3[i + 1] == 0) {
-                img[y * width + i] = 0;
-            } else {
-                sum++;
+        for (indx = rows[y]; indx < rows[y + 1]; indx++) {
+            root = alg_labeling_runs_root(runs, indx);
+            for (x = runs[indx].x0; x <= runs[indx].x1; x++) {
+                labels[y * width + x] = runs[root].label;
             }
         }
-
-        img[y * width] = img[y * width + width - 1] = flag;
     }
-    return sum;
+
+    return imgs->labelgroup_max ? imgs->labelgroup_max : max_under;
 }
 
+#define ALG_MORPH_MAX 16  /* Max number of operations in one pass of alg_morph */
+
 /**
- * erode5
- *      Erodes in a + shape.
+ * alg_morph_ring
+ *      Row y of the three row input ring of pipeline stage s.
  */
-static int erode5(unsigned char *img, int width, int height, void *buffer, unsigned char flag)
+static unsigned char *alg_morph_ring(unsigned char *buffer, int width, int s, int y)
 {
-    int y, i, sum = 0;
-    char *Row1,*Row2,*Row3;
+    return buffer + width * (1 + 3 * s + ((y + 3) % 3));
+}
 
-    Row1 = buffer;
-    Row2 = Row1 + width;
-    Row3 = Row1 + 2 * width;
-    memset(Row2, flag, width);
-    memcpy(Row3, img, width);
+/**
+ * alg_morph
+ *      Runs the erode (E/e) and dilate (D/d) operations in ops over the image.
+ *
+ *   The operations are pipelined row by row so the image is read and written
+ *   once for the whole list.  Each stage keeps copies of the three input rows
+ *   it needs so every operation only ever sees the output of the previous one,
+ *   as if they had been run one after another over the whole image.  Rows above
+ *   and below the image are taken as flag for erode and as zero for dilate and
+ *   the first and last column of the output are set the same way.
+ *
+ *   sums receives for each operation the count of non zero inner pixels
+ *   it produced.  When rows is not NULL it receives the same count for each
+ *   row of the image written back.  The buffer needs room for 3 rows per
+ *   stage plus one.
+ */
+static void alg_morph(unsigned char *img, int width, int height, const char *ops, int nops
+    , unsigned char flag, unsigned char *buffer, int bufsize, int *sums, int *rows)
+{
+    int count;
+    int s, t, y, stages, first;
+    unsigned char edge[ALG_MORPH_MAX];
+    unsigned char *dst;
 
-    for (y = 0; y < height; y++) {
-        memcpy(Row1, Row2, width);
-        memcpy(Row2, Row3, width);
+    stages = MIN2((bufsize / width - 1) / 3, ALG_MORPH_MAX);
 
-        if (y == height-1) {
-            memset(Row3, flag, width);
-        } else {
-            memcpy(Row3, img + (y + 1) * width, width);
+    for (first = 0; first < nops; first += stages) {
+        if (first + stages > nops) {
+            stages = nops - first;
         }
 
-        for (i = width - 2; i >= 1; i--) {
-            if (Row1[i]     == 0 ||
-                Row2[i - 1] == 0 ||
-                Row2[i]     == 0 ||
-                Row2[i + 1] == 0 ||
-                Row3[i]     == 0) {
-                img[y * width + i] = 0;
+        for (s = 0; s < stages; s++) {
+            sums[first + s] = 0;
+            if ((ops[first + s] == ALG_MORPH_ERODE9) || (ops[first + s] == ALG_MORPH_ERODE5)) {
+                edge[s] = flag;
             } else {
-                sum++;
+                edge[s] = 0;
             }
+            memset(alg_morph_ring(buffer, width, s, -1), edge[s], width);
         }
+        memcpy(alg_morph_ring(buffer, width, 0, 0), img, width);
+
+        /* Stage s works on row t - s so its input row below was just written by stage s - 1 */
+        for (t = 0; t < height + stages - 1; t++) {
+            for (s = 0; s < stages; s++) {
+                y = t - s;
+                if ((y < 0) || (y >= height)) {
+                    continue;
+                }
+                if (y + 1 == height) {
+                    memset(alg_morph_ring(buffer, width, s, y + 1), edge[s], width);
+                } else if (s == 0) {
+                    memcpy(alg_morph_ring(buffer, width, 0, y + 1), img + (y + 1) * width, width);
+                }
 
-        img[y * width] = img[y * width + width - 1] = flag;
+                if (s == stages - 1) {
+                    dst = img + y * width;
+                } else {
+                    dst = alg_morph_ring(buffer, width, s + 1, y);
+                }
+                count = alg_simd.morph_row(ops[first + s]
+                    , alg_morph_ring(buffer, width, s, y - 1)
+                    , alg_morph_ring(buffer, width, s, y)
+                    , alg_morph_ring(buffer, width, s, y + 1)
+                    , buffer, dst, width);
+                dst[0] = dst[width - 1] = edge[s];
+                sums[first + s] += count;
+                if ((rows != NULL) && (s == stages - 1)) {
+                    rows[y] = count;
+                }
+            }
+        }
     }
-    return sum;
 }
 
 /**
@@ -885,40 +903,86 @@ int alg_despeckle(struct context *cnt, int olddiffs)
     int width = cnt->imgs.width;
     int height = cnt->imgs.height;
     int done = 0, i, len = strlen(cnt->conf.despeckle_filter);
+    int top, bottom, margin = 0;
+    int *rows = cnt->imgs.motion_rows;
+    int nops, op, stop = 0, label = 0;
+    int sums[ALG_MORPH_MAX];
+    char ops[ALG_MORPH_MAX];
     unsigned char *common_buffer = cnt->imgs.common_buffer;
+    struct metrics_timer timer;
 
+    /*
+     * Rows outside of motion_top and motion_bottom are known to be empty so
+     * only the band in between is eroded and dilated.  Each dilate may grow
+     * the motion by a row so the band is widened by the number of dilates.
+     * The image borders are treated as empty rows already so the result is
+     * the same as processing the whole image.
+     */
     for (i = 0; i < len; i++) {
-        switch (cnt->conf.despeckle_filter[i]) {
-        case 'E':
-            if ((diffs = erode9(out, width, height, common_buffer, 0)) == 0) {
-                i = len;
+        if ((cnt->conf.despeckle_filter[i] == 'D') || (cnt->conf.despeckle_filter[i] == 'd')) {
+            margin++;
+        }
+    }
+    top = MAX2(cnt->imgs.motion_top - margin, 0);
+    bottom = MIN2(cnt->imgs.motion_bottom + margin, cnt->imgs.height);
+    if (bottom > top) {
+        out += top * width;
+        rows += top;
+        height = bottom - top;
+    }
+
+    /*
+     * Collect the erode and dilate operations up to the labeling and run
+     * them as one pass.  An erode that leaves nothing ends the despeckle
+     * like before, the operations after it have nothing left to work on.
+     */
+    i = 0;
+    while ((i < len) && !stop) {
+        nops = 0;
+        for (; (i < len) && (nops < ALG_MORPH_MAX); i++) {
+            op = cnt->conf.despeckle_filter[i];
+            if ((op == 'E') || (op == 'e') || (op == 'D') || (op == 'd')) {
+                ops[nops++] = op;
+            } else if ((op == 'l') || (op == 'L')) {
+                label = op;
+                len = i;
             }
-            done = 1;
+        }
+        if (nops == 0) {
             break;
-        case 'e':
-            if ((diffs = erode5(out, width, height, common_buffer, 0)) == 0) {
-                i = len;
+        }
+
+        alg_morph(out, width, height, ops, nops, 0
+            , common_buffer, 3 * cnt->imgs.width * cnt->imgs.height, sums, rows);
+        #ifdef HAVE_OPENCL
+            if (cnt->opencl != NULL) {
+                alg_opencl_motion_changed(cnt);
             }
+        #endif
+
+        for (op = 0; op < nops; op++) {
+            diffs = sums[op];
             done = 1;
-            break;
-        case 'D':
-            diffs = dilate9(out, width, height, common_buffer);
-            done = 1;
-            break;
-        case 'd':
-            diffs = dilate5(out, width, height, common_buffer);
-            done = 1;
-            break;
-        /* No further despeckle after labeling! */
-        case 'l':
+            if (((ops[op] == 'E') || (ops[op] == 'e')) && (diffs == 0)) {
+                stop = 1;
+                break;
+            }
+        }
+    }
+
+    /* No further despeckle after labeling! */
+    if (label && !stop) {
+        metrics_start(cnt, &timer);
+        if (label == 'l') {
             diffs = alg_labeling(cnt);
-            i = len;
-            done = 2;
-            break;
+        } else {
+            diffs = alg_labeling_runs(cnt);
         }
+        metrics_stop(cnt, METRICS_LABELING, &timer);
+        done = 2;
     }
 
-    /* If conf.despeckle_filter contains any valid action EeDdl */
+    /* If conf.despeckle_filter contains any valid action EeDdlL */
     if (done) {
         if (done != 2) {
             cnt->imgs.labelsize_max = 0; // Disable Labeling
@@ -932,392 +996,380 @@ int alg_despeckle(struct context *cnt, int olddiffs)
 }
 
 /**
- * alg_tune_smartmask
- *      Generates actual smartmask. Calculate sensitivity based on motion.
+ * alg_tune_smartmask_rows
+ *      Tune the smart mask of the rows y0 to y1.  The final mask of the rows
+ *      is eroded together with two rows on each side as these reach into
+ *      the rows by the two erodes.
  */
-void alg_tune_smartmask(struct context *cnt)
+static void alg_tune_smartmask_rows(struct context *cnt, int y0, int y1)
 {
-    int i, diff;
-    int motionsize = cnt->imgs.motionsize;
-    unsigned char *smartmask = cnt->imgs.smartmask;
-    unsigned char *smartmask_final = cnt->imgs.smartmask_final;
-    int *smartmask_buffer = cnt->imgs.smartmask_buffer;
-    int sensitivity = cnt->lastrate * (11 - cnt->smartmask_speed);
-
-    for (i = 0; i < motionsize; i++) {
-        /* Decrease smart_mask sensitivity every 5*speed seconds only. */
-        if (smartmask[i] > 0) {
-            smartmask[i]--;
-        }
-        /* Increase smart_mask sensitivity based on the buffered values. */
-        diff = smartmask_buffer[i]/sensitivity;
+    struct images *imgs = &cnt->imgs;
+    struct alg_smartmask_data sd;
+    int width = imgs->width;
+    int width_morph = 7 * width;   /* Buffer of alg_morph for 2 operations */
+    int i, e0, e1, sensitivity, sums[2];
+    unsigned char *band;
+
+    sensitivity = cnt->lastrate * (11 - cnt->smartmask_speed);
+    if (sensitivity < 1) {
+        sensitivity = 1;
+    } else if (sensitivity > USHRT_MAX) {
+        sensitivity = USHRT_MAX;
+    }
 
-        if (diff) {
-            if (smartmask[i] <= diff + 80) {
-                smartmask[i] += diff;
-            } else {
-                smartmask[i] = 80;
-            }
-            smartmask_buffer[i] %= sensitivity;
-        }
-        /* Transfer raw mask to the final stage when above trigger value. */
-        if (smartmask[i] > 20) {
-            smartmask_final[i] = 0;
-        } else {
-            smartmask_final[i] = 255;
+    e0 = MAX2(y0 - 2, 0);
+    e1 = MIN2(y1 + 2, imgs->height);
+    band = imgs->common_buffer + width_morph;
+
+    #ifdef HAVE_OPENCL
+        if (cnt->opencl != NULL) {
+            alg_opencl_smartmask_get(cnt, y0, y1);
         }
+    #endif
+
+    for (i = e0 * width; i < y0 * width; i++) {
+        band[i - e0 * width] = (imgs->smartmask[i] > 20) ? 0 : 255;
+    }
+    for (i = y1 * width; i < e1 * width; i++) {
+        band[i - e0 * width] = (imgs->smartmask[i] > 20) ? 0 : 255;
     }
+
+    sd.smartmask = imgs->smartmask + y0 * width;
+    sd.buffer = imgs->smartmask_buffer + y0 * width;
+    sd.final = band + (y0 - e0) * width;
+    sd.count = (y1 - y0) * width;
+    alg_simd_divisor(&sd, sensitivity);
+    alg_simd.smartmask_tune(&sd);
+
     /* Further expansion (here:erode due to inverted logic!) of the mask. */
-    diff = erode9(smartmask_final, cnt->imgs.width, cnt->imgs.height,
-                  cnt->imgs.common_buffer, 255);
-    diff = erode5(smartmask_final, cnt->imgs.width, cnt->imgs.height,
-                  cnt->imgs.common_buffer, 255);
-}
+    alg_morph(band, width, e1 - e0, "Ee", 2, 255
+        , imgs->common_buffer, width_morph, sums, NULL);
 
-/* Increment for *smartmask_buffer in alg_diff_standard. */
-#define SMARTMASK_SENSITIVITY_INCR 5
+    memcpy(imgs->smartmask_final + y0 * width, band + (y0 - e0) * width, (y1 - y0) * width);
+
+    #ifdef HAVE_OPENCL
+        if (cnt->opencl != NULL) {
+            alg_opencl_smartmask_put(cnt, y0, y1);
+        }
+    #endif
+}
 
 /**
- * alg_diff_standard
+ * alg_tune_smartmask
+ *      Generates actual smartmask. Calculate sensitivity based on motion.
  *
+ *   Each pixel is tuned once every smartmask_ratio frames.  The rows are
+ *   tuned in slices of at least a tile spread over the frames of the period
+ *   instead of all at once at the end of it so the cost is the same on each
+ *   frame.
  */
-int alg_diff_standard(struct context *cnt, unsigned char *new)
+void alg_tune_smartmask(struct context *cnt)
 {
-    struct images *imgs = &cnt->imgs;
-    int i, diffs = 0;
-    int noise = cnt->noise;
-    int smartmask_speed = cnt->smartmask_speed;
-    unsigned char *ref = imgs->ref;
-    unsigned char *out = imgs->img_motion.image_norm;
-    unsigned char *mask = imgs->mask;
-    unsigned char *smartmask_final = imgs->smartmask_final;
-    int *smartmask_buffer = imgs->smartmask_buffer;
-    #ifdef HAVE_MMX
-        mmx_t mmtemp; /* Used for transferring to/from memory. */
-        int unload;   /* Counter for unloading diff counts. */
-    #endif
+    int y1;
 
-    i = imgs->motionsize;
-    memset(out + i, 128, i / 2); /* Motion pictures are now b/w i.o. green */
-    /*
-     * Keeping this memset in the MMX case when zeroes are necessarily
-     * written anyway seems to be beneficial in terms of speed. Perhaps a
-     * cache thing?
-     */
-    memset(out, 0, i);
-
-    #ifdef HAVE_MMX
-        /*
-        * NOTE: The Pentium has two instruction pipes: U and V. I have grouped MMX
-        * instructions in pairs according to how I think they will be scheduled in
-        * the U and V pipes. Due to pairing constraints, the V pipe will sometimes
-        * be empty (for example, memory access always goes into the U pipe).
-        *
-        * The following MMX registers are kept throughout the loop:
-        * mm5 - 8 separate diff counters (unloaded periodically)
-        * mm6 - mask: 00ff 00ff 00ff 00ff
-        * mm7 - noise level as 8 packed bytes
-        *
-        * -- Per Jonsson
-        */
+    if (cnt->smartmask_ratio <= 0) {
+        return;
+    }
 
-        /*
-        * To avoid a div, we work with differences multiplied by 255 in the
-        * default case and *mask otherwise. Thus, the limit to compare with is
-        * 255 * (noise + 1) - 1).
-        */
-        mmtemp.uw[0] = mmtemp.uw[1] = mmtemp.uw[2] = mmtemp.uw[3] =
-                    (unsigned short)(noise * 255 + 254);
+    cnt->smartmask_count++;
+    if (cnt->smartmask_count >= cnt->smartmask_ratio) {
+        y1 = cnt->imgs.height;
+    } else {
+        y1 = (int)(((long)cnt->imgs.height * cnt->smartmask_count) / cnt->smartmask_ratio);
+        if (y1 - cnt->smartmask_row < ALG_TILE_SIZE) {
+            return;
+        }
+    }
 
-        /*
-        * Reset mm5 to zero, set the mm6 mask, and store the multiplied noise
-        * level as four words in mm7.
-        */
-        movq_m2r(mmtemp, mm7);             /* U */
-        pcmpeqb_r2r(mm6, mm6);             /* V */
+    if (y1 > cnt->smartmask_row) {
+        alg_tune_smartmask_rows(cnt, cnt->smartmask_row, y1);
+    }
 
-        pxor_r2r(mm5, mm5);                /* U */
-        psrlw_i2r(8, mm6);                 /* V */
+    cnt->smartmask_row = y1;
+    if (y1 == cnt->imgs.height) {
+        cnt->smartmask_row = 0;
+        cnt->smartmask_count = 0;
+    }
+}
 
-        /*
-        * We must unload mm5 every 255th round, because the diffs accumulate
-        * in each packed byte, which can hold at most 255 diffs before it
-        * gets saturated.
-        */
-        unload = 255;
+/**
+ * alg_diff_flags
+ *      The ALG_DIFF flags of the masks used on this frame.
+ */
+static int alg_diff_flags(struct context *cnt)
+{
+    int flags = 0;
 
-        for (; i > 7; i -= 8) {
-            /* Calculate abs(*ref-*new) for 8 pixels in parallel. */
-            movq_m2r(*ref, mm0);           /* U: mm0 = r7 r6 r5 r4 r3 r2 r1 r0 */
-            pxor_r2r(mm4, mm4);            /* V: mm4 = 0 */
+    if (cnt->imgs.mask) {
+        flags |= ALG_DIFF_MASK;
+    }
+    if (cnt->smartmask_speed) {
+        flags |= ALG_DIFF_SMARTMASK;
+        if (cnt->event_nr != cnt->prev_event) {
+            flags |= ALG_DIFF_SMARTBUF;
+        }
+    }
 
-            movq_m2r(*new, mm1);           /* U: mm1 = n7 n6 n5 n4 n3 n2 n1 n0 */
-            movq_r2r(mm0, mm2);            /* V: mm2 = r7 r6 r5 r4 r3 r2 r1 r0 */
+    return flags;
+}
 
-            /* These subtractions are saturated, i.e. won't go below 0. */
-            psubusb_r2r(mm1, mm0);         /* U: mm0 = (r7-n7) ... (r0-n0) */
-            psubusb_r2r(mm2, mm1);         /* V: mm1 = (n7-r7) ... (n0-r0) */
+/**
+ * alg_diff_kernel_get
+ *      The diff kernel specialized for the masks used on this frame.
+ */
+static alg_diff_kernel alg_diff_kernel_get(struct context *cnt)
+{
+    return alg_simd.diff[alg_diff_flags(cnt)];
+}
 
-            /* Each byte dX in mm0 is abs(nX-rX). */
-            por_r2r(mm1, mm0);             /* U: mm0 = d7 d6 d5 d4 d3 d2 d1 d0 */
+/**
+ * alg_diff_standard
+ *      Full diff against the reference frame applying the fixed and smart masks.
+ *      The per pixel work is done by the kernel selected in alg_simd_init.
+ *      The kernel is run row by row so the changed pixels of each row are
+ *      kept in motion_rows for the later stages.
+ */
+int alg_diff_standard(struct context *cnt, unsigned char *new)
+{
+    struct images *imgs = &cnt->imgs;
+    struct alg_diff_data dd;
+    alg_diff_kernel diff;
+    int y, diffs = 0;
+
+    #ifdef HAVE_OPENCL
+        if (cnt->opencl != NULL) {
+            diffs = alg_opencl_diff(cnt, new, alg_diff_flags(cnt));
+            if (diffs >= 0) {
+                return diffs;
+            }
+            diffs = 0;
+        }
+    #endif
 
-            /* Expand the absolute differences to words in mm0 and mm1. */
-            movq_r2r(mm0, mm1);            /* U: mm1 = d7 d6 d5 d4 d3 d2 d1 d0 */
-            punpcklbw_r2r(mm4, mm0);       /* V: mm0 =    d3    d2    d1    d0 */
+    diff = alg_diff_kernel_get(cnt);
 
-            punpckhbw_r2r(mm4, mm1);       /* U: mm1 =    d7    d6    d5    d4 */
+    memset(imgs->img_motion.image_norm + imgs->motionsize, 128
+        , imgs->motionsize / 2); /* Motion pictures are now b/w i.o. green */
 
-            if (mask) {
-                /*
-                * Load and expand 8 mask bytes to words in mm2 and mm3. Then
-                * multiply by mm0 and mm1, respectively.
-                */
-                movq_m2r(*mask, mm2);      /* U: mm2 = m7 m6 m5 m4 m3 m2 m1 m0 */
+    imgs->motion_top = 0;
+    imgs->motion_bottom = imgs->height;
 
-                movq_r2r(mm2, mm3);        /* U: mm3 = m7 m6 m5 m4 m3 m2 m1 m0 */
-                punpcklbw_r2r(mm4, mm2);   /* v: mm2 =    m3    m2    m1    m0 */
+    dd.ref = imgs->ref;
+    dd.new = new;
+    dd.out = imgs->img_motion.image_norm;
+    dd.mask = imgs->mask;
+    dd.smartmask_final = NULL;
+    dd.smartmask_buffer = NULL;
+    dd.count = imgs->width;
+    dd.noise = cnt->noise;
 
-                punpckhbw_r2r(mm4, mm3);   /* U: mm3 =    m7    m6    m5    m4 */
-                pmullw_r2r(mm2, mm0);      /* V: mm0 = (d3*m3) ... (d0*m0) */
+    if (cnt->smartmask_speed) {
+        dd.smartmask_final = imgs->smartmask_final;
+        if (cnt->event_nr != cnt->prev_event) {
+            dd.smartmask_buffer = imgs->smartmask_buffer;
+        }
+    }
 
-                pmullw_r2r(mm3, mm1);      /* U: mm1 = (d7*m7) ... (d4*m4) */
+    for (y = 0; y < imgs->height; y++) {
+        imgs->motion_rows[y] = diff(&dd);
+        diffs += imgs->motion_rows[y];
 
-                mask += 8;
-            } else {
-                /*
-                * Not using mask - multiply the absolute differences by 255. We
-                * do this by left-shifting 8 places and then subtracting dX.
-                */
-                movq_r2r(mm0, mm2);        /* U: mm2 =    d3    d2    d1    d0 */
-                psllw_i2r(8, mm0);         /* V: mm2 = (256*d3) ... (256*d0) */
-
-                movq_r2r(mm1, mm3);        /* U: mm3 =    d7    d6    d5    d4 */
-                psllw_i2r(8, mm1);         /* V: mm3 = (256*d7) ... (256*d4) */
-
-                psubusw_r2r(mm2, mm0);     /* U */
-                psubusw_r2r(mm3, mm1);     /* V */
-            }
+        dd.ref += imgs->width;
+        dd.new += imgs->width;
+        dd.out += imgs->width;
+        if (dd.mask) {
+            dd.mask += imgs->width;
+        }
+        if (dd.smartmask_final) {
+            dd.smartmask_final += imgs->width;
+        }
+        if (dd.smartmask_buffer) {
+            dd.smartmask_buffer += imgs->width;
+        }
+    }
 
-            /*
-            * Next, compare the multiplied absolute differences with the multiplied
-            * noise level (repeated as 4 words in mm7), resulting in a "motion flag"
-            * for each pixel.
-            *
-            * Since pcmpgtw performs signed comparisons, we have to subtract noise,
-            * test for equality to 0 and then invert the result.
-            *
-            * Note that it is safe to generate the "motion flags" before the
-            * smartmask code, as all that can happen is that individual flags get
-            * reset to 0 because of the smartmask.
-            */
-            psubusw_r2r(mm7, mm0);         /* U: subtract by (multiplied) noise */
-            psubusw_r2r(mm7, mm1);         /* V */
-
-            pcmpeqw_r2r(mm4, mm0);         /* U: test for equality with 0 */
-            pcmpeqw_r2r(mm4, mm1);         /* V */
-
-            pand_r2r(mm6, mm0);            /* U: convert 0xffff -> 0x00ff */
-            pand_r2r(mm6, mm1);            /* V */
-
-            pxor_r2r(mm6, mm0);            /* U: invert the result */
-            pxor_r2r(mm6, mm1);            /* V */
-
-            /* Each fX is the "motion flag" = 0 for no motion, 0xff for motion. */
-            packuswb_r2r(mm1, mm0);        /* U: mm0 = f7 f6 f5 f4 f3 f2 f1 f0 */
-
-            if (smartmask_speed) {
-                /*
-                * Apply the smartmask. Basically, if *smartmask_final is 0, the
-                * corresponding "motion flag" in mm0 will be reset.
-                */
-                movq_m2r(*smartmask_final, mm3); /* U: mm3 = s7 s6 s5 s4 s3 s2 s1 s0 */
-
-                /*
-                * ...but move the "motion flags" to memory before, in order to
-                * increment *smartmask_buffer properly below.
-                */
-                movq_r2m(mm0, mmtemp);           /* U */
-                pcmpeqb_r2r(mm4, mm3);           /* V: mm3 = 0xff where sX==0 */
-
-                /* AND negates the target before anding. */
-                pandn_r2r(mm0, mm3);             /* U: mm3 = 0xff where dX>noise && sX>0 */
-
-                movq_r2r(mm3, mm0);              /* U */
-
-                /* Add to *smartmask_buffer. This is probably the fastest way to do it. */
-                /* TODO:  Revise this to use a loop */
-                if (cnt->event_nr != cnt->prev_event) {
-                    if (mmtemp.ub[0]) {
-                        smartmask_buffer[0] += SMARTMASK_SENSITIVITY_INCR;
-                    }
-                    if (mmtemp.ub[1]) {
-                        smartmask_buffer[1] += SMARTMASK_SENSITIVITY_INCR;
-                    }
-                    if (mmtemp.ub[2]) {
-                        smartmask_buffer[2] += SMARTMASK_SENSITIVITY_INCR;
-                    }
-                    if (mmtemp.ub[3]) {
-                        smartmask_buffer[3] += SMARTMASK_SENSITIVITY_INCR;
-                    }
-                    if (mmtemp.ub[4]) {
-                        smartmask_buffer[4] += SMARTMASK_SENSITIVITY_INCR;
-                    }
-                    if (mmtemp.ub[5]) {
-                        smartmask_buffer[5] += SMARTMASK_SENSITIVITY_INCR;
-                    }
-                    if (mmtemp.ub[6]) {
-                        smartmask_buffer[6] += SMARTMASK_SENSITIVITY_INCR;
-                    }
-                    if (mmtemp.ub[7]) {
-                        smartmask_buffer[7] += SMARTMASK_SENSITIVITY_INCR;
-                    }
-                }
+    return diffs;
+}
 
-                smartmask_buffer += 8;
-                smartmask_final += 8;
-            }
+/**
+ * alg_init_tiles
+ *      Flag the tiles that the mask file excludes completely so that
+ *      alg_diff does not have to look at them.
+ */
+void alg_init_tiles(struct context *cnt)
+{
+    struct images *imgs = &cnt->imgs;
+    int tx, ty, x, y, x1, y1;
+    unsigned char *skip;
 
-            movq_m2r(*new, mm2);           /* U: mm1 = n7 n6 n5 n4 n3 n2 n1 n0 */
-
-            /*
-            * Cancel out pixels in *new according to the "motion flags" in mm0.
-            * Each NX is either 0 or nX as from *new.
-            */
-            pand_r2r(mm0, mm2);            /* U: mm1 = N7 N6 N5 N4 N3 N2 N1 N0 */
-            psubb_r2r(mm0, mm4);           /* V: mm4 = 0x01 where dX>noise */
-
-            /*
-            * mm5 holds 8 separate counts - each one is increased according to
-            * the contents of mm4 (where each byte is either 0x00 or 0x01).
-            */
-            movq_r2m(mm2, *out);           /* U: this will stall */
-            paddusb_r2r(mm4, mm5);         /* V: add counts to mm5 */
-
-            /*
-            * Every 255th turn, we need to unload mm5 into the diffs variable,
-            * because otherwise the packed bytes will get saturated.
-            */
-            if (--unload == 0) {
-                /* Unload mm5 to memory and reset it. */
-                movq_r2m(mm5, mmtemp);     /* U */
-                pxor_r2r(mm5, mm5);        /* V: mm5 = 0 */
-
-                diffs += mmtemp.ub[0] + mmtemp.ub[1] + mmtemp.ub[2] + mmtemp.ub[3] +
-                        mmtemp.ub[4] + mmtemp.ub[5] + mmtemp.ub[6] + mmtemp.ub[7];
-                unload = 255;
-            }
+    memset(imgs->tile_skip, 0, imgs->tile_cols * imgs->tile_rows);
+    imgs->motion_top = 0;
+    imgs->motion_bottom = imgs->height;
 
-            out += 8;
-            ref += 8;
-            new += 8;
-        }
+    if (!imgs->mask) {
+        return;
+    }
 
-        /*
-        * Check if there are diffs left in mm5 that need to be copied to the
-        * diffs variable.
-        */
-        if (unload < 255) {
-            movq_r2m(mm5, mmtemp);
-            diffs += mmtemp.ub[0] + mmtemp.ub[1] + mmtemp.ub[2] + mmtemp.ub[3] +
-                    mmtemp.ub[4] + mmtemp.ub[5] + mmtemp.ub[6] + mmtemp.ub[7];
+    #ifdef HAVE_OPENCL
+        if (cnt->opencl != NULL) {
+            alg_opencl_mask_put(cnt);
         }
-
-        emms();
-
     #endif
-    /*
-     * Note that the non-MMX code is present even if the MMX code is present.
-     * This is necessary if the resolution is not a multiple of 8, in which
-     * case the non-MMX code needs to take care of the remaining pixels.
-     */
-
-    for (; i > 0; i--) {
-        register unsigned char curdiff = (int)(abs(*ref - *new)); /* Using a temp variable is 12% faster. */
-        /* Apply fixed mask */
-        if (mask) {
-            curdiff = ((int)(curdiff * *mask++) / 255);
-        }
 
-        if (smartmask_speed) {
-            if (curdiff > noise) {
-                /*
-                 * Increase smart_mask sensitivity every frame when motion
-                 * is detected. (with speed=5, mask is increased by 1 every
-                 * second. To be able to increase by 5 every second (with
-                 * speed=10) we add 5 here. NOT related to the 5 at ratio-
-                 * calculation.
-                 */
-                if (cnt->event_nr != cnt->prev_event) {
-                    (*smartmask_buffer) += SMARTMASK_SENSITIVITY_INCR;
-                }
-                /* Apply smart_mask */
-                if (!*smartmask_final) {
-                    curdiff = 0;
+    for (ty = 0; ty < imgs->tile_rows; ty++) {
+        y1 = MIN2((ty + 1) * ALG_TILE_SIZE, imgs->height);
+        for (tx = 0; tx < imgs->tile_cols; tx++) {
+            x1 = MIN2((tx + 1) * ALG_TILE_SIZE, imgs->width);
+            skip = &imgs->tile_skip[ty * imgs->tile_cols + tx];
+            *skip = 1;
+            for (y = ty * ALG_TILE_SIZE; (y < y1) && *skip; y++) {
+                for (x = tx * ALG_TILE_SIZE; x < x1; x++) {
+                    if (imgs->mask[y * imgs->width + x]) {
+                        *skip = 0;
+                        break;
+                    }
                 }
             }
-            smartmask_final++;
-            smartmask_buffer++;
-        }
-        /* Pixel still in motion after all the masks? */
-        if (curdiff > noise) {
-            *out = *new;
-            diffs++;
         }
-        out++;
-        ref++;
-        new++;
     }
-    return diffs;
 }
 
 /**
- * alg_diff_fast
- *      Very fast diff function, does not apply mask overlaying.
+ * alg_diff_count
+ *      Count the changed pixels in each tile that is not masked out.
+ *      Returns the total over all the tiles.
  */
-static char alg_diff_fast(struct context *cnt, int max_n_changes, unsigned char *new)
+static int alg_diff_count(struct context *cnt, unsigned char *new)
 {
     struct images *imgs = &cnt->imgs;
-    int i, diffs = 0, step = imgs->motionsize/10000;
-    int noise = cnt->noise;
-    unsigned char *ref = imgs->ref;
+    int tx, ty, tx1, y, y1, x0, total;
+    int width = imgs->width;
+    unsigned short *counts;
+    unsigned char *skip;
+
+    memset(imgs->tile_counts, 0, imgs->tile_cols * imgs->tile_rows * sizeof(*imgs->tile_counts));
+
+    for (ty = 0; ty < imgs->tile_rows; ty++) {
+        counts = &imgs->tile_counts[ty * imgs->tile_cols];
+        skip = &imgs->tile_skip[ty * imgs->tile_cols];
+        y1 = MIN2((ty + 1) * ALG_TILE_SIZE, imgs->height);
+        for (tx = 0; tx < imgs->tile_cols; tx = tx1) {
+            if (skip[tx]) {
+                tx1 = tx + 1;
+                continue;
+            }
+            /* Run of tiles that are not masked out */
+            for (tx1 = tx + 1; (tx1 < imgs->tile_cols) && !skip[tx1]; tx1++);
+            x0 = tx * ALG_TILE_SIZE;
+            for (y = ty * ALG_TILE_SIZE; y < y1; y++) {
+                alg_simd.tile_count(imgs->ref + y * width + x0, new + y * width + x0
+                    , MIN2(tx1 * ALG_TILE_SIZE, width) - x0, cnt->noise, counts + tx);
+            }
+        }
+    }
 
-    if (!step % 2) {
-        step++;
+    total = 0;
+    for (tx = 0; tx < imgs->tile_cols * imgs->tile_rows; tx++) {
+        total += imgs->tile_counts[tx];
     }
-    /* We're checking only 1 of several pixels. */
-    max_n_changes /= step;
 
-    i = imgs->motionsize;
+    return total;
+}
+
+/**
+ * alg_diff_tiles
+ *      Run the full diff only on the tiles alg_diff_count found changed.
+ *      A tile without a single pixel above the noise level can not have
+ *      any motion after the masks are applied and it can not add to the
+ *      smart mask either so the result is the same as alg_diff_standard.
+ */
+static int alg_diff_tiles(struct context *cnt, unsigned char *new)
+{
+    struct images *imgs = &cnt->imgs;
+    struct alg_diff_data dd;
+    alg_diff_kernel diff;
+    int tx, ty, tx1, y, y0, y1, x0, x1, ofs, diffs = 0;
+    int width = imgs->width;
+    unsigned short *counts;
+
+    diff = alg_diff_kernel_get(cnt);
+
+    memset(imgs->img_motion.image_norm + imgs->motionsize, 128
+        , imgs->motionsize / 2); /* Motion pictures are now b/w i.o. green */
 
-    for (; i > 0; i -= step) {
-        register unsigned char curdiff = (int)(abs((char)(*ref - *new))); /* Using a temp variable is 12% faster. */
-        if (curdiff >  noise) {
-            diffs++;
-            if (diffs > max_n_changes) {
-                return 1;
+    imgs->motion_top = imgs->height;
+    imgs->motion_bottom = 0;
+
+    for (ty = 0; ty < imgs->tile_rows; ty++) {
+        counts = &imgs->tile_counts[ty * imgs->tile_cols];
+        y0 = ty * ALG_TILE_SIZE;
+        y1 = MIN2(y0 + ALG_TILE_SIZE, imgs->height);
+
+        for (tx = 0; (tx < imgs->tile_cols) && !counts[tx]; tx++);
+        if (tx == imgs->tile_cols) {
+            memset(imgs->img_motion.image_norm + y0 * width, 0, (y1 - y0) * width);
+            memset(imgs->motion_rows + y0, 0, (y1 - y0) * sizeof(*imgs->motion_rows));
+            continue;
+        }
+        if (imgs->motion_top > y0) {
+            imgs->motion_top = y0;
+        }
+        imgs->motion_bottom = y1;
+
+        for (y = y0; y < y1; y++) {
+            imgs->motion_rows[y] = 0;
+            for (tx = 0; tx < imgs->tile_cols; tx = tx1) {
+                for (tx1 = tx + 1; (tx1 < imgs->tile_cols) && (!counts[tx1] == !counts[tx]); tx1++);
+                x0 = tx * ALG_TILE_SIZE;
+                x1 = MIN2(tx1 * ALG_TILE_SIZE, width);
+                ofs = y * width + x0;
+                if (!counts[tx]) {
+                    memset(imgs->img_motion.image_norm + ofs, 0, x1 - x0);
+                    continue;
+                }
+                dd.ref = imgs->ref + ofs;
+                dd.new = new + ofs;
+                dd.out = imgs->img_motion.image_norm + ofs;
+                dd.mask = imgs->mask ? imgs->mask + ofs : NULL;
+                dd.smartmask_final = NULL;
+                dd.smartmask_buffer = NULL;
+                dd.count = x1 - x0;
+                dd.noise = cnt->noise;
+                if (cnt->smartmask_speed) {
+                    dd.smartmask_final = imgs->smartmask_final + ofs;
+                    if (cnt->event_nr != cnt->prev_event) {
+                        dd.smartmask_buffer = imgs->smartmask_buffer + ofs;
+                    }
+                }
+                imgs->motion_rows[y] += diff(&dd);
             }
+            diffs += imgs->motion_rows[y];
         }
-        ref += step;
-        new += step;
     }
 
-    return 0;
+    return diffs;
 }
 
 /**
  * alg_diff
- *      Uses diff_fast to quickly decide if there is anything worth
- *      sending to diff_standard.
+ *      Uses the per tile counts to quickly decide if there is anything
+ *      worth running the full diff on and then only diffs the tiles
+ *      that changed.
  */
 int alg_diff(struct context *cnt, unsigned char *new)
 {
-    int diffs = 0;
+    #ifdef HAVE_OPENCL
+        /* The GPU diffs the whole frame in about the time of the upload */
+        if (cnt->opencl != NULL) {
+            return alg_diff_standard(cnt, new);
+        }
+    #endif
 
-    if (alg_diff_fast(cnt, cnt->conf.threshold / 2, new)) {
-        diffs = alg_diff_standard(cnt, new);
+    if (alg_diff_count(cnt, new) <= cnt->conf.threshold / 2) {
+        return 0;
     }
 
-    return diffs;
+    return alg_diff_tiles(cnt, new);
 }
 
 /**
@@ -1347,22 +1399,16 @@ int alg_lightswitch(struct context *cnt, int diffs)
 
 /**
  * alg_switchfilter
- *
+ *      Uses the changed pixels of each row counted by alg_diff.
  */
 int alg_switchfilter(struct context *cnt, int diffs, unsigned char *newimg)
 {
     int linediff = diffs / cnt->imgs.height;
-    unsigned char *out = cnt->imgs.img_motion.image_norm;
-    int y, x, line;
+    int y, line;
     int lines = 0, vertlines = 0;
 
     for (y = 0; y < cnt->imgs.height; y++) {
-        line = 0;
-        for (x = 0; x < cnt->imgs.width; x++) {
-            if (*(out++)) {
-                line++;
-            }
-        }
+        line = cnt->imgs.motion_rows[y];
 
         if (line > cnt->imgs.width / 18) {
             vertlines++;
@@ -1402,13 +1448,8 @@ int alg_switchfilter(struct context *cnt, int diffs, unsigned char *newimg)
 #define EXCLUDE_LEVEL_PERCENT 20
 void alg_update_reference_frame(struct context *cnt, int action)
 {
+    struct alg_ref_data rd;
     int accept_timer = cnt->lastrate * ACCEPT_STATIC_OBJECT_TIME;
-    int i, threshold_ref;
-    int *ref_dyn = cnt->imgs.ref_dyn;
-    unsigned char *image_virgin = cnt->imgs.image_vprvcy.image_norm;
-    unsigned char *ref = cnt->imgs.ref;
-    unsigned char *smartmask = cnt->imgs.smartmask_final;
-    unsigned char *out = cnt->imgs.img_motion.image_norm;
 
     /* Match rate limit */
     if (cnt->lastrate > 5) {
@@ -1416,39 +1457,39 @@ void alg_update_reference_frame(struct context *cnt, int action)
     }
 
     if (action == UPDATE_REF_FRAME) { /* Black&white only for better performance. */
-        threshold_ref = cnt->noise * EXCLUDE_LEVEL_PERCENT / 100;
-
-        for (i = cnt->imgs.motionsize; i > 0; i--) {
-            /* Exclude pixels from ref frame well below noise level. */
-            if (((int)(abs(*ref - *image_virgin)) > threshold_ref) && (*smartmask)) {
-                if (*ref_dyn == 0) { /* Always give new pixels a chance. */
-                    *ref_dyn = 1;
-                } else if (*ref_dyn > accept_timer) { /* Include static Object after some time. */
-                    *ref_dyn = 0;
-                    *ref = *image_virgin;
-                } else if (*out) {
-                    (*ref_dyn)++; /* Motionpixel? Keep excluding from ref frame. */
-                } else {
-                    *ref_dyn = 0; /* Nothing special - release pixel. */
-                    *ref = (*ref + *image_virgin) / 2;
-                }
+        rd.ref = cnt->imgs.ref;
+        rd.virgin = cnt->imgs.image_vprvcy.image_norm;
+        rd.smartmask = cnt->imgs.smartmask_final;
+        rd.out = cnt->imgs.img_motion.image_norm;
+        rd.ref_dyn = cnt->imgs.ref_dyn;
+        rd.count = cnt->imgs.motionsize;
+        rd.threshold = cnt->noise * EXCLUDE_LEVEL_PERCENT / 100;
+        /* The timer never exceeds accept_timer + 1 so keep it within ref_dyn */
+        if (accept_timer < 0) {
+            rd.accept_timer = 0;
+        } else if (accept_timer > REF_DYN_MAX) {
+            rd.accept_timer = REF_DYN_MAX;
+        } else {
+            rd.accept_timer = accept_timer;
+        }
 
-            } else {  /* No motion: copy to ref frame. */
-                *ref_dyn = 0; /* Reset pixel */
-                *ref = *image_virgin;
+        #ifdef HAVE_OPENCL
+            if ((cnt->opencl != NULL) && (alg_opencl_ref_update(cnt, &rd) == 0)) {
+                return;
             }
+        #endif
 
-            ref++;
-            image_virgin++;
-            smartmask++;
-            ref_dyn++;
-            out++;
-        } /* end for i */
+        alg_simd.ref_update(&rd);
 
     } else {   /* action == RESET_REF_FRAME - also used to initialize the frame at startup. */
         /* Copy fresh image */
         memcpy(cnt->imgs.ref, cnt->imgs.image_vprvcy.image_norm, cnt->imgs.size_norm);
         /* Reset static objects */
         memset(cnt->imgs.ref_dyn, 0, cnt->imgs.motionsize * sizeof(*cnt->imgs.ref_dyn));
+        #ifdef HAVE_OPENCL
+            if (cnt->opencl != NULL) {
+                alg_opencl_ref_reset(cnt);
+            }
+        #endif
     }
 }
@@ -36,6 +36,14 @@ struct coord {
     int maxy;
 };
 
+/* A horizontal run of motion pixels used by the run based labeling */
+struct alg_run {
+    int x0;
+    int x1;
+    int parent;                 /* Index of parent run or negative size for a root */
+    int label;
+};
+
 struct segment {
     struct coord coord;
     int width;
@@ -49,6 +57,7 @@ void alg_draw_location(struct coord *cent, struct images *imgs, int width, unsig
                        int style, int mode, int process_thisframe);
 void alg_draw_red_location(struct coord *cent, struct images *imgs, int width, unsigned char *new,
                            int style, int mode, int process_thisframe);
+void alg_draw_location_high(struct coord *cent, struct images *imgs, unsigned char *new, int style);
 void alg_noise_tune(struct context *cnt, unsigned char *new);
 void alg_threshold_tune(struct context *cnt, int diffs, int motion);
 int alg_despeckle(struct context *cnt, int olddiffs);
@@ -58,5 +67,6 @@ int alg_diff(struct context *cnt, unsigned char *new);
 int alg_lightswitch(struct context *cnt, int diffs);
 int alg_switchfilter(struct context *cnt, int diffs, unsigned char *newimg);
 void alg_update_reference_frame(struct context *cnt, int action);
+void alg_init_tiles(struct context *cnt);
 
 #endif /* _INCLUDE_ALG_H */
@@ -0,0 +1,683 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *    alg_opencl.c
+ *
+ *    OpenCL backend of the diff and the reference frame update of alg.c
+ *    used when detect_backend is opencl.
+ *
+ *    The device, context and program are shared by all the cameras.  Each
+ *    camera has its own command queue, kernels and buffers so the cameras
+ *    submit their frames to the GPU independently.  The reference frame,
+ *    the static object timers, the masks and the smart mask buffer of a
+ *    camera stay in the memory of the GPU.  On each frame the new image is
+ *    uploaded and the motion image with the changed pixels of each row and
+ *    the sums of the noise tune are read back.  The despeckle, labeling and
+ *    the pictures keep using the motion image on the cpu.
+ *
+ *    The cpu copies of the reference frame and of the timers are not kept
+ *    up to date while the GPU is used.  When the GPU fails the backend is
+ *    shut down and the reference frame is reset on the cpu.  The smart mask
+ *    is tuned on the cpu, see alg_tune_smartmask, so the rows of the buffer
+ *    are read before and the buffer and final mask written back after each
+ *    slice.
+ *
+ */
+
+#include "translate.h"
+#include "motion.h"
+#include "util.h"
+#include "logger.h"
+#include "alg_simd.h"
+#include "alg_opencl.h"
+
+#ifdef HAVE_OPENCL
+
+#define CL_TARGET_OPENCL_VERSION 120
+#ifdef __APPLE__
+    #include <OpenCL/cl.h>
+#else
+    #include <CL/cl.h>
+#endif
+
+#define ALG_OPENCL_LOCAL    64      /* Width of the work groups of the diff */
+#define ALG_OPENCL_PLATFORMS 8
+
+/* Same as the scalar kernels in alg_simd.c */
+static const char *alg_opencl_source =
+    "__kernel void alg_diff(__global const uchar *ref, __global const uchar *img\n"
+    "    , __global uchar *out, __global const uchar *mask, __global const uchar *smf\n"
+    "    , __global ushort *smb, __global int *counts, int width, int height\n"
+    "    , int noise, int flags)\n"
+    "{\n"
+    "    __local int lrow, lsum, lcnt;\n"
+    "    int x = get_global_id(0);\n"
+    "    int y = get_global_id(1);\n"
+    "    int i = y * width + x;\n"
+    "    int d;\n"
+    "\n"
+    "    if (get_local_id(0) == 0) {\n"
+    "        lrow = 0;\n"
+    "        lsum = 0;\n"
+    "        lcnt = 0;\n"
+    "    }\n"
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "\n"
+    "    if (x < width) {\n"
+    "        d = abs_diff(ref[i], img[i]);\n"
+    "        if (flags & DIFF_MASK) {\n"
+    "            d = (d * mask[i]) / 255;\n"
+    "        }\n"
+    "        if (smf[i]) {\n"
+    "            atomic_add(&lsum, d + 1);\n"
+    "            atomic_inc(&lcnt);\n"
+    "        }\n"
+    "        if ((flags & DIFF_SMARTMASK) && (d > noise)) {\n"
+    "            if (flags & DIFF_SMARTBUF) {\n"
+    "                smb[i] = (ushort)min((int)smb[i] + SMARTMASK_INCR, 65535);\n"
+    "            }\n"
+    "            if (!smf[i]) {\n"
+    "                d = 0;\n"
+    "            }\n"
+    "        }\n"
+    "        if (d > noise) {\n"
+    "            out[i] = img[i];\n"
+    "            atomic_inc(&lrow);\n"
+    "        } else {\n"
+    "            out[i] = 0;\n"
+    "        }\n"
+    "    }\n"
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "\n"
+    "    if (get_local_id(0) == 0) {\n"
+    "        if (lrow) {\n"
+    "            atomic_add(&counts[y], lrow);\n"
+    "        }\n"
+    "        if (lcnt) {\n"
+    "            atomic_add(&counts[height], lsum);\n"
+    "            atomic_add(&counts[height + 1], lcnt);\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "__kernel void alg_ref(__global uchar *ref, __global const uchar *img\n"
+    "    , __global const uchar *smf, __global const uchar *out, __global ushort *dyn\n"
+    "    , int count, int threshold, int accept)\n"
+    "{\n"
+    "    int i = get_global_id(0);\n"
+    "\n"
+    "    if (i >= count) {\n"
+    "        return;\n"
+    "    }\n"
+    "    if ((abs_diff(ref[i], img[i]) > threshold) && smf[i]) {\n"
+    "        if (dyn[i] == 0) {\n"
+    "            dyn[i] = 1;\n"
+    "        } else if (dyn[i] > accept) {\n"
+    "            dyn[i] = 0;\n"
+    "            ref[i] = img[i];\n"
+    "        } else if (out[i]) {\n"
+    "            dyn[i]++;\n"
+    "        } else {\n"
+    "            dyn[i] = 0;\n"
+    "            ref[i] = (uchar)(((int)ref[i] + img[i]) / 2);\n"
+    "        }\n"
+    "    } else {\n"
+    "        dyn[i] = 0;\n"
+    "        ref[i] = img[i];\n"
+    "    }\n"
+    "}\n";
+
+struct alg_opencl {
+    cl_command_queue    queue;
+    cl_kernel           kdiff;
+    cl_kernel           kref;
+    cl_mem              ref;            /* Reference frame, Y plane only */
+    cl_mem              img;            /* Image of the frame */
+    cl_mem              out;            /* Motion image */
+    cl_mem              mask;
+    cl_mem              smf;            /* smartmask_final */
+    cl_mem              smb;            /* smartmask_buffer */
+    cl_mem              dyn;            /* ref_dyn */
+    cl_mem              counts;         /* Changed pixels of each row, then the noise sum and count */
+    int                 *counts_host;
+    int                 img_synced;     /* img holds the image of this frame */
+    int                 out_synced;     /* out holds img_motion */
+    int                 noise_valid;    /* The noise sums in counts_host are of this frame */
+};
+
+/* The device shared by all the cameras */
+static struct {
+    pthread_mutex_t     mutex;
+    int                 users;
+    cl_device_id        device;
+    cl_context          context;
+    cl_program          program;
+} alg_opencl_dev = {PTHREAD_MUTEX_INITIALIZER, 0, NULL, NULL, NULL};
+
+/** alg_opencl_dev_build
+ *  Build the kernels for the device.  Called with the device mutex held.
+ */
+static int alg_opencl_dev_build(void)
+{
+    char opts[256], *buildlog;
+    size_t len;
+    cl_int err;
+
+    alg_opencl_dev.program = clCreateProgramWithSource(alg_opencl_dev.context, 1
+        , &alg_opencl_source, NULL, &err);
+    if (err != CL_SUCCESS) {
+        MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
+            ,_("Unable to create the OpenCL program: error %d"), err);
+        return -1;
+    }
+
+    snprintf(opts, sizeof(opts)
+        , "-DDIFF_MASK=%d -DDIFF_SMARTMASK=%d -DDIFF_SMARTBUF=%d -DSMARTMASK_INCR=%d"
+        , ALG_DIFF_MASK, ALG_DIFF_SMARTMASK, ALG_DIFF_SMARTBUF, SMARTMASK_SENSITIVITY_INCR);
+
+    err = clBuildProgram(alg_opencl_dev.program, 1, &alg_opencl_dev.device, opts, NULL, NULL);
+    if (err != CL_SUCCESS) {
+        len = 0;
+        clGetProgramBuildInfo(alg_opencl_dev.program, alg_opencl_dev.device
+            , CL_PROGRAM_BUILD_LOG, 0, NULL, &len);
+        buildlog = mymalloc(len + 1);
+        buildlog[0] = '\0';
+        clGetProgramBuildInfo(alg_opencl_dev.program, alg_opencl_dev.device
+            , CL_PROGRAM_BUILD_LOG, len, buildlog, NULL);
+        buildlog[len] = '\0';
+        MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
+            ,_("Unable to build the OpenCL kernels: error %d %s"), err, buildlog);
+        free(buildlog);
+        clReleaseProgram(alg_opencl_dev.program);
+        alg_opencl_dev.program = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/** alg_opencl_dev_open
+ *  Find the first GPU and build the kernels for it, or take another
+ *  reference on the device when a camera already uses it.
+ */
+static int alg_opencl_dev_open(void)
+{
+    cl_platform_id platforms[ALG_OPENCL_PLATFORMS];
+    cl_uint nplatforms, ndevices, indx;
+    char name[128];
+    cl_int err;
+    int retcd;
+
+    pthread_mutex_lock(&alg_opencl_dev.mutex);
+        if (alg_opencl_dev.users > 0) {
+            alg_opencl_dev.users++;
+            pthread_mutex_unlock(&alg_opencl_dev.mutex);
+            return 0;
+        }
+
+        retcd = -1;
+        alg_opencl_dev.device = NULL;
+        if (clGetPlatformIDs(ALG_OPENCL_PLATFORMS, platforms, &nplatforms) != CL_SUCCESS) {
+            nplatforms = 0;
+        }
+        for (indx = 0; indx < MIN(nplatforms, ALG_OPENCL_PLATFORMS); indx++) {
+            if ((clGetDeviceIDs(platforms[indx], CL_DEVICE_TYPE_GPU, 1
+                    , &alg_opencl_dev.device, &ndevices) == CL_SUCCESS) && (ndevices > 0)) {
+                break;
+            }
+            alg_opencl_dev.device = NULL;
+        }
+
+        if (alg_opencl_dev.device == NULL) {
+            MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO, _("No OpenCL GPU found"));
+        } else {
+            alg_opencl_dev.context = clCreateContext(NULL, 1, &alg_opencl_dev.device
+                , NULL, NULL, &err);
+            if (err != CL_SUCCESS) {
+                MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
+                    ,_("Unable to create the OpenCL context: error %d"), err);
+                alg_opencl_dev.context = NULL;
+            } else if (alg_opencl_dev_build() != 0) {
+                clReleaseContext(alg_opencl_dev.context);
+                alg_opencl_dev.context = NULL;
+            } else {
+                name[0] = '\0';
+                clGetDeviceInfo(alg_opencl_dev.device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+                name[sizeof(name) - 1] = '\0';
+                MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+                    ,_("Using the OpenCL device %s for motion detection"), name);
+                alg_opencl_dev.users = 1;
+                retcd = 0;
+            }
+        }
+    pthread_mutex_unlock(&alg_opencl_dev.mutex);
+
+    return retcd;
+}
+
+static void alg_opencl_dev_close(void)
+{
+    pthread_mutex_lock(&alg_opencl_dev.mutex);
+        if (--alg_opencl_dev.users == 0) {
+            clReleaseProgram(alg_opencl_dev.program);
+            clReleaseContext(alg_opencl_dev.context);
+            alg_opencl_dev.program = NULL;
+            alg_opencl_dev.context = NULL;
+        }
+    pthread_mutex_unlock(&alg_opencl_dev.mutex);
+}
+
+static cl_mem alg_opencl_buffer(size_t size, cl_int *err)
+{
+    cl_mem mem;
+
+    if (*err != CL_SUCCESS) {
+        return NULL;
+    }
+    mem = clCreateBuffer(alg_opencl_dev.context, CL_MEM_READ_WRITE, size, NULL, err);
+    if (*err != CL_SUCCESS) {
+        return NULL;
+    }
+    return mem;
+}
+
+/** alg_opencl_fail
+ *  Shut the backend down after an error of the GPU.  The reference frame
+ *  on the gpu is lost so it is started again from the last image.
+ */
+static int alg_opencl_fail(struct context *cnt, cl_int err, const char *what)
+{
+    MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
+        ,_("OpenCL %s failed with error %d, using the cpu for motion detection"), what, err);
+
+    alg_opencl_deinit(cnt);
+
+    memcpy(cnt->imgs.ref, cnt->imgs.image_vprvcy.image_norm, cnt->imgs.size_norm);
+    memset(cnt->imgs.ref_dyn, 0, cnt->imgs.motionsize * sizeof(*cnt->imgs.ref_dyn));
+
+    return -1;
+}
+
+static cl_int alg_opencl_write(struct alg_opencl *ocl, cl_mem mem, size_t offset, size_t size, const void *ptr)
+{
+    return clEnqueueWriteBuffer(ocl->queue, mem, CL_TRUE, offset, size, ptr, 0, NULL, NULL);
+}
+
+/**
+ * alg_opencl_init
+ *  Set up the GPU state of the camera when detect_backend is opencl.  The
+ *  reference frame, masks and smart mask of the camera must be set up.
+ *  Returns 0 also when the cpu is used.
+ */
+int alg_opencl_init(struct context *cnt)
+{
+    struct alg_opencl *ocl;
+    struct images *imgs = &cnt->imgs;
+    cl_int err, width, height, count;
+
+    cnt->opencl = NULL;
+
+    if ((cnt->conf.detect_backend == NULL) || mystreq(cnt->conf.detect_backend, "cpu")) {
+        return 0;
+    }
+    if (!mystreq(cnt->conf.detect_backend, "opencl")) {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("Invalid detect_backend %s, using the cpu for motion detection")
+            ,cnt->conf.detect_backend);
+        return 0;
+    }
+
+    if (alg_opencl_dev_open() != 0) {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Using the cpu for motion detection"));
+        return 0;
+    }
+
+    ocl = mymalloc(sizeof(struct alg_opencl));
+    memset(ocl, 0, sizeof(struct alg_opencl));
+    ocl->counts_host = mymalloc((imgs->height + 2) * sizeof(int));
+    cnt->opencl = ocl;
+
+    ocl->queue = clCreateCommandQueue(alg_opencl_dev.context, alg_opencl_dev.device, 0, &err);
+    if (err == CL_SUCCESS) {
+        ocl->kdiff = clCreateKernel(alg_opencl_dev.program, "alg_diff", &err);
+    }
+    if (err == CL_SUCCESS) {
+        ocl->kref = clCreateKernel(alg_opencl_dev.program, "alg_ref", &err);
+    }
+    ocl->ref = alg_opencl_buffer(imgs->motionsize, &err);
+    ocl->img = alg_opencl_buffer(imgs->motionsize, &err);
+    ocl->out = alg_opencl_buffer(imgs->motionsize, &err);
+    ocl->mask = alg_opencl_buffer(imgs->motionsize, &err);
+    ocl->smf = alg_opencl_buffer(imgs->motionsize, &err);
+    ocl->smb = alg_opencl_buffer(imgs->motionsize * sizeof(*imgs->smartmask_buffer), &err);
+    ocl->dyn = alg_opencl_buffer(imgs->motionsize * sizeof(*imgs->ref_dyn), &err);
+    ocl->counts = alg_opencl_buffer((imgs->height + 2) * sizeof(cl_int), &err);
+    if (err != CL_SUCCESS) {
+        return alg_opencl_fail(cnt, err, _("setup"));
+    }
+
+    width = imgs->width;
+    height = imgs->height;
+    count = imgs->motionsize;
+    err = clSetKernelArg(ocl->kdiff, 0, sizeof(cl_mem), &ocl->ref);
+    err |= clSetKernelArg(ocl->kdiff, 1, sizeof(cl_mem), &ocl->img);
+    err |= clSetKernelArg(ocl->kdiff, 2, sizeof(cl_mem), &ocl->out);
+    err |= clSetKernelArg(ocl->kdiff, 3, sizeof(cl_mem), &ocl->mask);
+    err |= clSetKernelArg(ocl->kdiff, 4, sizeof(cl_mem), &ocl->smf);
+    err |= clSetKernelArg(ocl->kdiff, 5, sizeof(cl_mem), &ocl->smb);
+    err |= clSetKernelArg(ocl->kdiff, 6, sizeof(cl_mem), &ocl->counts);
+    err |= clSetKernelArg(ocl->kdiff, 7, sizeof(cl_int), &width);
+    err |= clSetKernelArg(ocl->kdiff, 8, sizeof(cl_int), &height);
+    err |= clSetKernelArg(ocl->kref, 0, sizeof(cl_mem), &ocl->ref);
+    err |= clSetKernelArg(ocl->kref, 1, sizeof(cl_mem), &ocl->img);
+    err |= clSetKernelArg(ocl->kref, 2, sizeof(cl_mem), &ocl->smf);
+    err |= clSetKernelArg(ocl->kref, 3, sizeof(cl_mem), &ocl->out);
+    err |= clSetKernelArg(ocl->kref, 4, sizeof(cl_mem), &ocl->dyn);
+    err |= clSetKernelArg(ocl->kref, 5, sizeof(cl_int), &count);
+    if (err != CL_SUCCESS) {
+        return alg_opencl_fail(cnt, err, _("setup"));
+    }
+
+    err = alg_opencl_write(ocl, ocl->ref, 0, imgs->motionsize, imgs->ref);
+    if (err == CL_SUCCESS) {
+        err = alg_opencl_write(ocl, ocl->dyn, 0, imgs->motionsize * sizeof(*imgs->ref_dyn), imgs->ref_dyn);
+    }
+    if (err == CL_SUCCESS) {
+        err = alg_opencl_write(ocl, ocl->smf, 0, imgs->motionsize, imgs->smartmask_final);
+    }
+    if (err == CL_SUCCESS) {
+        err = alg_opencl_write(ocl, ocl->smb, 0
+            , imgs->motionsize * sizeof(*imgs->smartmask_buffer), imgs->smartmask_buffer);
+    }
+    if ((err == CL_SUCCESS) && (imgs->mask != NULL)) {
+        err = alg_opencl_write(ocl, ocl->mask, 0, imgs->motionsize, imgs->mask);
+    }
+    if (err != CL_SUCCESS) {
+        return alg_opencl_fail(cnt, err, _("setup"));
+    }
+
+    return 0;
+}
+
+void alg_opencl_deinit(struct context *cnt)
+{
+    struct alg_opencl *ocl = cnt->opencl;
+    cl_mem mems[8];
+    int indx;
+
+    if (ocl == NULL) {
+        return;
+    }
+
+    if (ocl->queue != NULL) {
+        clFinish(ocl->queue);
+    }
+    mems[0] = ocl->ref;
+    mems[1] = ocl->img;
+    mems[2] = ocl->out;
+    mems[3] = ocl->mask;
+    mems[4] = ocl->smf;
+    mems[5] = ocl->smb;
+    mems[6] = ocl->dyn;
+    mems[7] = ocl->counts;
+    for (indx = 0; indx < 8; indx++) {
+        if (mems[indx] != NULL) {
+            clReleaseMemObject(mems[indx]);
+        }
+    }
+    if (ocl->kdiff != NULL) {
+        clReleaseKernel(ocl->kdiff);
+    }
+    if (ocl->kref != NULL) {
+        clReleaseKernel(ocl->kref);
+    }
+    if (ocl->queue != NULL) {
+        clReleaseCommandQueue(ocl->queue);
+    }
+
+    free(ocl->counts_host);
+    free(ocl);
+    cnt->opencl = NULL;
+
+    alg_opencl_dev_close();
+}
+
+/**
+ * alg_opencl_diff
+ *  Same as alg_diff_standard with the kernel of the ALG_DIFF flags.
+ *  Returns the number of changed pixels.
+ */
+int alg_opencl_diff(struct context *cnt, unsigned char *new, int flags)
+{
+    struct alg_opencl *ocl = cnt->opencl;
+    struct images *imgs = &cnt->imgs;
+    size_t global[2], local[2];
+    cl_int err, zero = 0, noise = cnt->noise, kflags = flags;
+    int y, diffs;
+
+    err = alg_opencl_write(ocl, ocl->img, 0, imgs->motionsize, new);
+    if (err == CL_SUCCESS) {
+        err = clEnqueueFillBuffer(ocl->queue, ocl->counts, &zero, sizeof(zero)
+            , 0, (imgs->height + 2) * sizeof(cl_int), 0, NULL, NULL);
+    }
+    if (err == CL_SUCCESS) {
+        err = clSetKernelArg(ocl->kdiff, 9, sizeof(cl_int), &noise);
+        err |= clSetKernelArg(ocl->kdiff, 10, sizeof(cl_int), &kflags);
+    }
+    if (err == CL_SUCCESS) {
+        global[0] = ((imgs->width + ALG_OPENCL_LOCAL - 1) / ALG_OPENCL_LOCAL) * ALG_OPENCL_LOCAL;
+        global[1] = imgs->height;
+        local[0] = ALG_OPENCL_LOCAL;
+        local[1] = 1;
+        err = clEnqueueNDRangeKernel(ocl->queue, ocl->kdiff, 2, NULL, global, local, 0, NULL, NULL);
+    }
+    if (err == CL_SUCCESS) {
+        err = clEnqueueReadBuffer(ocl->queue, ocl->out, CL_FALSE, 0, imgs->motionsize
+            , imgs->img_motion.image_norm, 0, NULL, NULL);
+    }
+    /* The queue is in order so the motion image is read once the counts are */
+    if (err == CL_SUCCESS) {
+        err = clEnqueueReadBuffer(ocl->queue, ocl->counts, CL_TRUE, 0
+            , (imgs->height + 2) * sizeof(cl_int), ocl->counts_host, 0, NULL, NULL);
+    }
+    if (err != CL_SUCCESS) {
+        return alg_opencl_fail(cnt, err, _("diff"));
+    }
+
+    memset(imgs->img_motion.image_norm + imgs->motionsize, 128
+        , imgs->motionsize / 2); /* Motion pictures are now b/w i.o. green */
+
+    diffs = 0;
+    for (y = 0; y < imgs->height; y++) {
+        imgs->motion_rows[y] = ocl->counts_host[y];
+        diffs += ocl->counts_host[y];
+    }
+    imgs->motion_top = 0;
+    imgs->motion_bottom = imgs->height;
+
+    ocl->img_synced = TRUE;
+    ocl->out_synced = TRUE;
+    ocl->noise_valid = TRUE;
+
+    return diffs;
+}
+
+/**
+ * alg_opencl_noise
+ *  The sums of alg_noise_tune from the diff of this frame.  Returns FALSE
+ *  when the diff did not run on this frame.
+ */
+int alg_opencl_noise(struct context *cnt, int *sum, int *count)
+{
+    struct alg_opencl *ocl = cnt->opencl;
+
+    if (!ocl->noise_valid) {
+        return FALSE;
+    }
+
+    *sum = ocl->counts_host[cnt->imgs.height];
+    *count = ocl->counts_host[cnt->imgs.height + 1];
+
+    return TRUE;
+}
+
+/** alg_opencl_frame_done
+ *  The reference update is the last use of the image of the frame.
+ */
+static void alg_opencl_frame_done(struct alg_opencl *ocl)
+{
+    ocl->img_synced = FALSE;
+    ocl->out_synced = FALSE;
+    ocl->noise_valid = FALSE;
+}
+
+int alg_opencl_ref_update(struct context *cnt, const struct alg_ref_data *rd)
+{
+    struct alg_opencl *ocl = cnt->opencl;
+    size_t global;
+    cl_int err, threshold, accept;
+
+    err = CL_SUCCESS;
+    if (!ocl->img_synced) {
+        err = alg_opencl_write(ocl, ocl->img, 0, rd->count, rd->virgin);
+    }
+    if ((err == CL_SUCCESS) && !ocl->out_synced) {
+        err = alg_opencl_write(ocl, ocl->out, 0, rd->count, rd->out);
+    }
+    if (err == CL_SUCCESS) {
+        threshold = rd->threshold;
+        accept = rd->accept_timer;
+        err = clSetKernelArg(ocl->kref, 6, sizeof(cl_int), &threshold);
+        err |= clSetKernelArg(ocl->kref, 7, sizeof(cl_int), &accept);
+    }
+    if (err == CL_SUCCESS) {
+        global = ((rd->count + 255) / 256) * 256;
+        err = clEnqueueNDRangeKernel(ocl->queue, ocl->kref, 1, NULL, &global, NULL, 0, NULL, NULL);
+    }
+    if (err == CL_SUCCESS) {
+        err = clFlush(ocl->queue);
+    }
+    if (err != CL_SUCCESS) {
+        return alg_opencl_fail(cnt, err, _("reference update"));
+    }
+
+    alg_opencl_frame_done(ocl);
+
+    return 0;
+}
+
+int alg_opencl_ref_reset(struct context *cnt)
+{
+    struct alg_opencl *ocl = cnt->opencl;
+    cl_ushort zero = 0;
+    cl_int err;
+
+    err = alg_opencl_write(ocl, ocl->ref, 0, cnt->imgs.motionsize, cnt->imgs.ref);
+    if (err == CL_SUCCESS) {
+        err = clEnqueueFillBuffer(ocl->queue, ocl->dyn, &zero, sizeof(zero)
+            , 0, cnt->imgs.motionsize * sizeof(cl_ushort), 0, NULL, NULL);
+    }
+    if (err != CL_SUCCESS) {
+        return alg_opencl_fail(cnt, err, _("reference reset"));
+    }
+
+    alg_opencl_frame_done(ocl);
+
+    return 0;
+}
+
+/* The fixed mask changed, see alg_init_tiles */
+int alg_opencl_mask_put(struct context *cnt)
+{
+    cl_int err;
+
+    if (cnt->imgs.mask == NULL) {
+        return 0;
+    }
+
+    err = alg_opencl_write(cnt->opencl, cnt->opencl->mask, 0, cnt->imgs.motionsize, cnt->imgs.mask);
+    if (err != CL_SUCCESS) {
+        return alg_opencl_fail(cnt, err, _("mask upload"));
+    }
+
+    return 0;
+}
+
+/* Read the rows y0 to y1 of the smart mask buffer before they are tuned */
+int alg_opencl_smartmask_get(struct context *cnt, int y0, int y1)
+{
+    struct alg_opencl *ocl = cnt->opencl;
+    size_t ofs = (size_t)y0 * cnt->imgs.width;
+    size_t len = (size_t)(y1 - y0) * cnt->imgs.width;
+    cl_int err;
+
+    err = clEnqueueReadBuffer(ocl->queue, ocl->smb, CL_TRUE
+        , ofs * sizeof(*cnt->imgs.smartmask_buffer), len * sizeof(*cnt->imgs.smartmask_buffer)
+        , cnt->imgs.smartmask_buffer + ofs, 0, NULL, NULL);
+    if (err != CL_SUCCESS) {
+        return alg_opencl_fail(cnt, err, _("smart mask read"));
+    }
+
+    return 0;
+}
+
+/* Write the rows y0 to y1 of the smart mask buffer and final smart mask */
+int alg_opencl_smartmask_put(struct context *cnt, int y0, int y1)
+{
+    struct alg_opencl *ocl = cnt->opencl;
+    size_t ofs = (size_t)y0 * cnt->imgs.width;
+    size_t len = (size_t)(y1 - y0) * cnt->imgs.width;
+    cl_int err;
+
+    err = alg_opencl_write(ocl, ocl->smb, ofs * sizeof(*cnt->imgs.smartmask_buffer)
+        , len * sizeof(*cnt->imgs.smartmask_buffer), cnt->imgs.smartmask_buffer + ofs);
+    if (err == CL_SUCCESS) {
+        err = alg_opencl_write(ocl, ocl->smf, ofs, len, cnt->imgs.smartmask_final + ofs);
+    }
+    if (err != CL_SUCCESS) {
+        return alg_opencl_fail(cnt, err, _("smart mask write"));
+    }
+
+    return 0;
+}
+
+/* The motion image was changed on the cpu after the diff */
+void alg_opencl_motion_changed(struct context *cnt)
+{
+    cnt->opencl->out_synced = FALSE;
+}
+
+#else /* HAVE_OPENCL */
+
+int alg_opencl_init(struct context *cnt)
+{
+    cnt->opencl = NULL;
+
+    if (mystreq(cnt->conf.detect_backend, "opencl")) {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("Motion was built without OpenCL, using the cpu for motion detection"));
+    }
+
+    return 0;
+}
+
+void alg_opencl_deinit(struct context *cnt)
+{
+    cnt->opencl = NULL;
+}
+
+#endif /* HAVE_OPENCL */
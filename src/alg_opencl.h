@@ -0,0 +1,43 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  alg_opencl.h
+ *    Headers associated with the OpenCL backend of the detection in alg_opencl.c
+ */
+
+#ifndef _INCLUDE_ALG_OPENCL_H
+#define _INCLUDE_ALG_OPENCL_H
+
+struct alg_ref_data;
+
+/*
+ * All the functions but alg_opencl_init return -1 when the GPU failed.  The
+ * backend is then shut down and the reference frame reset on the cpu, so
+ * the caller goes on with the cpu code.
+ */
+int alg_opencl_init(struct context *cnt);
+void alg_opencl_deinit(struct context *cnt);
+int alg_opencl_diff(struct context *cnt, unsigned char *new, int flags);
+int alg_opencl_noise(struct context *cnt, int *sum, int *count);
+int alg_opencl_ref_update(struct context *cnt, const struct alg_ref_data *rd);
+int alg_opencl_ref_reset(struct context *cnt);
+int alg_opencl_mask_put(struct context *cnt);
+int alg_opencl_smartmask_get(struct context *cnt, int y0, int y1);
+int alg_opencl_smartmask_put(struct context *cnt, int y0, int y1);
+void alg_opencl_motion_changed(struct context *cnt);
+
+#endif /* _INCLUDE_ALG_OPENCL_H */
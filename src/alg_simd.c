@@ -0,0 +1,1062 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*    alg_simd.c
+ *
+ *    Vectorized versions of the per pixel detection loops in alg.c.
+ *    The implementation is selected once at startup based upon the
+ *    capabilities of the cpu and every kernel must produce exactly the
+ *    same output as the scalar version.
+ *
+ */
+
+#include "translate.h"
+#include "motion.h"
+#include "logger.h"
+#include "alg_simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define HAVE_SIMD_X86
+    #include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+    #define HAVE_SIMD_NEON
+    #include <arm_neon.h>
+#endif
+
+/*
+ * Define the diff kernels of an implementation for each combination of the
+ * ALG_DIFF flags from its body function.  The flags are constants in each
+ * kernel so the code for the masks that are not in use is left out of the
+ * pixel loop.  A smart mask buffer without the smart mask is never asked
+ * for, those entries of the table are the kernels without it.
+ */
+#define ALG_SIMD_DIFF_KERNELS(isa, attr) \
+    attr static int alg_simd_diff_##isa##_0(const struct alg_diff_data *dd) \
+        { return alg_simd_diff_##isa##_body(dd, 0); } \
+    attr static int alg_simd_diff_##isa##_1(const struct alg_diff_data *dd) \
+        { return alg_simd_diff_##isa##_body(dd, ALG_DIFF_MASK); } \
+    attr static int alg_simd_diff_##isa##_2(const struct alg_diff_data *dd) \
+        { return alg_simd_diff_##isa##_body(dd, ALG_DIFF_SMARTMASK); } \
+    attr static int alg_simd_diff_##isa##_3(const struct alg_diff_data *dd) \
+        { return alg_simd_diff_##isa##_body(dd, ALG_DIFF_MASK | ALG_DIFF_SMARTMASK); } \
+    attr static int alg_simd_diff_##isa##_6(const struct alg_diff_data *dd) \
+        { return alg_simd_diff_##isa##_body(dd, ALG_DIFF_SMARTMASK | ALG_DIFF_SMARTBUF); } \
+    attr static int alg_simd_diff_##isa##_7(const struct alg_diff_data *dd) \
+        { return alg_simd_diff_##isa##_body(dd, ALG_DIFF_MASK | ALG_DIFF_SMARTMASK | ALG_DIFF_SMARTBUF); } \
+    static const alg_diff_kernel alg_simd_diff_##isa[ALG_DIFF_KERNELS] = { \
+        alg_simd_diff_##isa##_0, alg_simd_diff_##isa##_1, \
+        alg_simd_diff_##isa##_2, alg_simd_diff_##isa##_3, \
+        alg_simd_diff_##isa##_0, alg_simd_diff_##isa##_1, \
+        alg_simd_diff_##isa##_6, alg_simd_diff_##isa##_7 };
+
+/**
+ * alg_simd_diff_scalar
+ *      Reference implementation of the diff.  Also used by the vector
+ *      kernels for the pixels that remain after the last full vector.
+ */
+__attribute__((always_inline))
+static inline int alg_simd_diff_scalar(const struct alg_diff_data *dd, int indx, const int flags)
+{
+    int diffs = 0;
+    int curdiff;
+
+    for (; indx < dd->count; indx++) {
+        curdiff = abs(dd->ref[indx] - dd->new[indx]);
+        /* Apply fixed mask */
+        if (flags & ALG_DIFF_MASK) {
+            curdiff = (curdiff * dd->mask[indx]) / 255;
+        }
+
+        if ((flags & ALG_DIFF_SMARTMASK) && (curdiff > dd->noise)) {
+            /*
+             * Increase smart_mask sensitivity every frame when motion
+             * is detected. (with speed=5, mask is increased by 1 every
+             * second. To be able to increase by 5 every second (with
+             * speed=10) we add 5 here. NOT related to the 5 at ratio-
+             * calculation.
+             */
+            if (flags & ALG_DIFF_SMARTBUF) {
+                if (dd->smartmask_buffer[indx] < USHRT_MAX - SMARTMASK_SENSITIVITY_INCR) {
+                    dd->smartmask_buffer[indx] += SMARTMASK_SENSITIVITY_INCR;
+                } else {
+                    dd->smartmask_buffer[indx] = USHRT_MAX;
+                }
+            }
+            /* Apply smart_mask */
+            if (!dd->smartmask_final[indx]) {
+                curdiff = 0;
+            }
+        }
+
+        /* Pixel still in motion after all the masks? */
+        if (curdiff > dd->noise) {
+            dd->out[indx] = dd->new[indx];
+            diffs++;
+        } else {
+            dd->out[indx] = 0;
+        }
+    }
+
+    return diffs;
+}
+
+__attribute__((always_inline))
+static inline int alg_simd_diff_c_body(const struct alg_diff_data *dd, const int flags)
+{
+    return alg_simd_diff_scalar(dd, 0, flags);
+}
+
+ALG_SIMD_DIFF_KERNELS(c, )
+
+/**
+ * alg_simd_ref_scalar
+ *      Reference implementation of the reference frame update.  Moving
+ *      pixels are excluded from the reference frame until they have been
+ *      static for accept_timer frames.
+ */
+static void alg_simd_ref_scalar(const struct alg_ref_data *rd, int indx)
+{
+    for (; indx < rd->count; indx++) {
+        /* Exclude pixels from ref frame well below noise level. */
+        if ((abs(rd->ref[indx] - rd->virgin[indx]) > rd->threshold) && (rd->smartmask[indx])) {
+            if (rd->ref_dyn[indx] == 0) { /* Always give new pixels a chance. */
+                rd->ref_dyn[indx] = 1;
+            } else if (rd->ref_dyn[indx] > rd->accept_timer) { /* Include static Object after some time. */
+                rd->ref_dyn[indx] = 0;
+                rd->ref[indx] = rd->virgin[indx];
+            } else if (rd->out[indx]) {
+                rd->ref_dyn[indx]++; /* Motionpixel? Keep excluding from ref frame. */
+            } else {
+                rd->ref_dyn[indx] = 0; /* Nothing special - release pixel. */
+                rd->ref[indx] = (rd->ref[indx] + rd->virgin[indx]) / 2;
+            }
+        } else {  /* No motion: copy to ref frame. */
+            rd->ref_dyn[indx] = 0; /* Reset pixel */
+            rd->ref[indx] = rd->virgin[indx];
+        }
+    }
+}
+
+static void alg_simd_ref_c(const struct alg_ref_data *rd)
+{
+    alg_simd_ref_scalar(rd, 0);
+}
+
+/**
+ * alg_simd_tile_scalar
+ *      Count the pixels of a row that differ more than noise from the
+ *      reference and add them to the tile they belong to.
+ */
+static void alg_simd_tile_scalar(const unsigned char *ref, const unsigned char *new
+    , int count, int noise, unsigned short *tiles, int indx)
+{
+    for (; indx < count; indx++) {
+        if (abs(ref[indx] - new[indx]) > noise) {
+            tiles[indx / ALG_TILE_SIZE]++;
+        }
+    }
+}
+
+static void alg_simd_tile_c(const unsigned char *ref, const unsigned char *new
+    , int count, int noise, unsigned short *tiles)
+{
+    alg_simd_tile_scalar(ref, new, count, noise, tiles, 0);
+}
+
+/**
+ * alg_simd_morph_vert
+ *      Vertical part of the morphology: min or max of the three rows
+ *      from indx up to the end of the row.
+ */
+static void alg_simd_morph_vert(int op, const unsigned char *row1, const unsigned char *row2
+    , const unsigned char *row3, unsigned char *tmp, int width, int indx)
+{
+    unsigned char val;
+
+    for (; indx < width; indx++) {
+        if ((op == ALG_MORPH_ERODE9) || (op == ALG_MORPH_ERODE5)) {
+            val = (row1[indx] < row2[indx]) ? row1[indx] : row2[indx];
+            tmp[indx] = (val < row3[indx]) ? val : row3[indx];
+        } else {
+            val = (row1[indx] > row2[indx]) ? row1[indx] : row2[indx];
+            tmp[indx] = (val > row3[indx]) ? val : row3[indx];
+        }
+    }
+}
+
+/**
+ * alg_simd_morph_horz
+ *      Horizontal part of the morphology for the inner pixels from indx.
+ *      The 3x3 box uses the vertical result of both neighbors while the
+ *      + shape only uses the neighbors of the center row.  The erode keeps
+ *      the original value when there are no zeros under the shape.
+ *      Returns the count of non zero pixels written.
+ */
+static int alg_simd_morph_horz(int op, const unsigned char *row2, const unsigned char *tmp
+    , unsigned char *dst, int width, int indx)
+{
+    const unsigned char *side;
+    unsigned char val;
+    int sum = 0;
+
+    side = ((op == ALG_MORPH_ERODE9) || (op == ALG_MORPH_DILATE9)) ? tmp : row2;
+
+    for (; indx < width - 1; indx++) {
+        if ((op == ALG_MORPH_ERODE9) || (op == ALG_MORPH_ERODE5)) {
+            if ((tmp[indx] == 0) || (side[indx - 1] == 0) || (side[indx + 1] == 0)) {
+                dst[indx] = 0;
+            } else {
+                dst[indx] = row2[indx];
+            }
+        } else {
+            val = (side[indx - 1] > side[indx + 1]) ? side[indx - 1] : side[indx + 1];
+            dst[indx] = (val > tmp[indx]) ? val : tmp[indx];
+        }
+        if (dst[indx]) {
+            sum++;
+        }
+    }
+
+    return sum;
+}
+
+static int alg_simd_morph_c(int op, const unsigned char *row1, const unsigned char *row2
+    , const unsigned char *row3, unsigned char *tmp, unsigned char *dst, int width)
+{
+    alg_simd_morph_vert(op, row1, row2, row3, tmp, width, 0);
+    return alg_simd_morph_horz(op, row2, tmp, dst, width, 1);
+}
+
+/**
+ * alg_simd_divisor
+ *      Set up the division by the sensitivity for the smart mask kernels.
+ *      With l the bits of the sensitivity d, t = (n * magic) >> 16 gives
+ *      n / d = (t + ((n - t) >> shift1)) >> shift2 for all 16 bit n.
+ */
+void alg_simd_divisor(struct alg_smartmask_data *sd, int sensitivity)
+{
+    int l = 0;
+
+    while ((1 << l) < sensitivity) {
+        l++;
+    }
+
+    sd->sensitivity = sensitivity;
+    sd->magic = (unsigned short)(((((unsigned long long)1 << l) - sensitivity) << 16) / sensitivity + 1);
+    sd->shift1 = (l < 1) ? l : 1;
+    sd->shift2 = (l > 1) ? l - 1 : 0;
+}
+
+/**
+ * alg_simd_smartmask_scalar
+ *      Reference implementation of the smart mask tuning.  The sensitivity
+ *      of the smart mask is decreased by one and increased by the motion
+ *      collected in the buffer since the last tuning.
+ */
+static void alg_simd_smartmask_scalar(const struct alg_smartmask_data *sd, int indx)
+{
+    int diff;
+
+    for (; indx < sd->count; indx++) {
+        /* Decrease smart_mask sensitivity every 5*speed seconds only. */
+        if (sd->smartmask[indx] > 0) {
+            sd->smartmask[indx]--;
+        }
+        /* Increase smart_mask sensitivity based on the buffered values. */
+        diff = sd->buffer[indx] / sd->sensitivity;
+
+        if (diff) {
+            if (sd->smartmask[indx] <= diff + 80) {
+                sd->smartmask[indx] += diff;
+            } else {
+                sd->smartmask[indx] = 80;
+            }
+            sd->buffer[indx] %= sd->sensitivity;
+        }
+        /* Transfer raw mask to the final stage when above trigger value. */
+        if (sd->smartmask[indx] > 20) {
+            sd->final[indx] = 0;
+        } else {
+            sd->final[indx] = 255;
+        }
+    }
+}
+
+static void alg_simd_smartmask_c(const struct alg_smartmask_data *sd)
+{
+    alg_simd_smartmask_scalar(sd, 0);
+}
+
+#ifdef HAVE_SIMD_X86
+
+/*
+ * The vector kernels compare against the noise as unsigned 8 and 16 bit
+ * values.  Noise values out of that range are left to the scalar code.
+ *
+ * In all the x86 kernels the fixed mask is applied without a division by
+ * comparing diff * mask against 255 * (noise + 1) - 1 which is the same
+ * test as (diff * mask / 255) > noise.  Both values fit in 16 bits.
+ */
+
+__attribute__((target("sse2"), always_inline))
+static inline int alg_simd_diff_sse2_body(const struct alg_diff_data *dd, const int flags)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_cmpeq_epi8(zero, zero);
+    const __m128i noise8 = _mm_set1_epi8((char)dd->noise);
+    const __m128i noise16 = _mm_set1_epi16((short)(dd->noise * 255 + 254));
+    const __m128i incr = _mm_set1_epi16(SMARTMASK_SENSITIVITY_INCR);
+    __m128i vref, vnew, vdif, vflg, vmsk, vlo, vhi, vsmf, vf16;
+    int indx, bits, diffs = 0;
+    unsigned short *smb;
+
+    if ((dd->noise < 0) || (dd->noise > 255)) {
+        return alg_simd_diff_scalar(dd, 0, flags);
+    }
+
+    for (indx = 0; indx + 16 <= dd->count; indx += 16) {
+        vref = _mm_loadu_si128((const __m128i *)(dd->ref + indx));
+        vnew = _mm_loadu_si128((const __m128i *)(dd->new + indx));
+        vdif = _mm_or_si128(_mm_subs_epu8(vref, vnew), _mm_subs_epu8(vnew, vref));
+
+        if (flags & ALG_DIFF_MASK) {
+            vmsk = _mm_loadu_si128((const __m128i *)(dd->mask + indx));
+            vlo = _mm_mullo_epi16(_mm_unpacklo_epi8(vdif, zero), _mm_unpacklo_epi8(vmsk, zero));
+            vhi = _mm_mullo_epi16(_mm_unpackhi_epi8(vdif, zero), _mm_unpackhi_epi8(vmsk, zero));
+            vlo = _mm_cmpeq_epi16(_mm_subs_epu16(vlo, noise16), zero);
+            vhi = _mm_cmpeq_epi16(_mm_subs_epu16(vhi, noise16), zero);
+            vflg = _mm_xor_si128(_mm_packs_epi16(vlo, vhi), ones);
+        } else {
+            vflg = _mm_xor_si128(_mm_cmpeq_epi8(_mm_subs_epu8(vdif, noise8), zero), ones);
+        }
+
+        if (flags & ALG_DIFF_SMARTMASK) {
+            if ((flags & ALG_DIFF_SMARTBUF) && _mm_movemask_epi8(vflg)) {
+                smb = dd->smartmask_buffer + indx;
+                vf16 = _mm_and_si128(_mm_unpacklo_epi8(vflg, vflg), incr);
+                _mm_storeu_si128((__m128i *)smb
+                    , _mm_adds_epu16(_mm_loadu_si128((__m128i *)smb), vf16));
+                vf16 = _mm_and_si128(_mm_unpackhi_epi8(vflg, vflg), incr);
+                _mm_storeu_si128((__m128i *)(smb + 8)
+                    , _mm_adds_epu16(_mm_loadu_si128((__m128i *)(smb + 8)), vf16));
+            }
+            vsmf = _mm_loadu_si128((const __m128i *)(dd->smartmask_final + indx));
+            vflg = _mm_andnot_si128(_mm_cmpeq_epi8(vsmf, zero), vflg);
+        }
+
+        _mm_storeu_si128((__m128i *)(dd->out + indx), _mm_and_si128(vflg, vnew));
+
+        bits = _mm_movemask_epi8(vflg);
+        if (bits) {
+            diffs += __builtin_popcount((unsigned int)bits);
+        }
+    }
+
+    return diffs + alg_simd_diff_scalar(dd, indx, flags);
+}
+
+ALG_SIMD_DIFF_KERNELS(sse2, __attribute__((target("sse2"))))
+
+__attribute__((target("avx2"), always_inline))
+static inline int alg_simd_diff_avx2_body(const struct alg_diff_data *dd, const int flags)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_cmpeq_epi8(zero, zero);
+    const __m256i noise8 = _mm256_set1_epi8((char)dd->noise);
+    const __m256i noise16 = _mm256_set1_epi16((short)(dd->noise * 255 + 254));
+    const __m256i incr = _mm256_set1_epi16(SMARTMASK_SENSITIVITY_INCR);
+    __m256i vref, vnew, vdif, vflg, vmsk, vlo, vhi, vsmf, vf16;
+    int indx, bits, diffs = 0;
+    unsigned short *smb;
+
+    if ((dd->noise < 0) || (dd->noise > 255)) {
+        return alg_simd_diff_scalar(dd, 0, flags);
+    }
+
+    for (indx = 0; indx + 32 <= dd->count; indx += 32) {
+        vref = _mm256_loadu_si256((const __m256i *)(dd->ref + indx));
+        vnew = _mm256_loadu_si256((const __m256i *)(dd->new + indx));
+        vdif = _mm256_or_si256(_mm256_subs_epu8(vref, vnew), _mm256_subs_epu8(vnew, vref));
+
+        if (flags & ALG_DIFF_MASK) {
+            /* The unpack and pack instructions both work per 128 bit lane so order is kept */
+            vmsk = _mm256_loadu_si256((const __m256i *)(dd->mask + indx));
+            vlo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(vdif, zero), _mm256_unpacklo_epi8(vmsk, zero));
+            vhi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(vdif, zero), _mm256_unpackhi_epi8(vmsk, zero));
+            vlo = _mm256_cmpeq_epi16(_mm256_subs_epu16(vlo, noise16), zero);
+            vhi = _mm256_cmpeq_epi16(_mm256_subs_epu16(vhi, noise16), zero);
+            vflg = _mm256_xor_si256(_mm256_packs_epi16(vlo, vhi), ones);
+        } else {
+            vflg = _mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_subs_epu8(vdif, noise8), zero), ones);
+        }
+
+        if (flags & ALG_DIFF_SMARTMASK) {
+            if ((flags & ALG_DIFF_SMARTBUF) && _mm256_movemask_epi8(vflg)) {
+                smb = dd->smartmask_buffer + indx;
+                vf16 = _mm256_and_si256(_mm256_cvtepi8_epi16(_mm256_castsi256_si128(vflg)), incr);
+                _mm256_storeu_si256((__m256i *)smb
+                    , _mm256_adds_epu16(_mm256_loadu_si256((__m256i *)smb), vf16));
+                vf16 = _mm256_and_si256(_mm256_cvtepi8_epi16(_mm256_extracti128_si256(vflg, 1)), incr);
+                _mm256_storeu_si256((__m256i *)(smb + 16)
+                    , _mm256_adds_epu16(_mm256_loadu_si256((__m256i *)(smb + 16)), vf16));
+            }
+            vsmf = _mm256_loadu_si256((const __m256i *)(dd->smartmask_final + indx));
+            vflg = _mm256_andnot_si256(_mm256_cmpeq_epi8(vsmf, zero), vflg);
+        }
+
+        _mm256_storeu_si256((__m256i *)(dd->out + indx), _mm256_and_si256(vflg, vnew));
+
+        bits = _mm256_movemask_epi8(vflg);
+        if (bits) {
+            diffs += __builtin_popcount((unsigned int)bits);
+        }
+    }
+
+    return diffs + alg_simd_diff_scalar(dd, indx, flags);
+}
+
+ALG_SIMD_DIFF_KERNELS(avx2, __attribute__((target("avx2"))))
+
+/*
+ * The reference update kernels compute per pixel masks for the four
+ * outcomes of the scalar loop:
+ *   takev - pixel is not moving or has been static long enough: ref = new
+ *   avgm  - pixel released this frame: ref = floor average of ref and new
+ *   incm  - pixel still excluded: ref_dyn incremented (0 becomes 1)
+ * and ref_dyn is cleared everywhere else.  A timer of zero can never be
+ * above accept_timer so the two "excluded" cases share the increment.
+ */
+__attribute__((target("sse2")))
+static void alg_simd_ref_sse2(const struct alg_ref_data *rd)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_cmpeq_epi8(zero, zero);
+    const __m128i lsb = _mm_set1_epi8(1);
+    const __m128i one16 = _mm_set1_epi16(1);
+    const __m128i thr8 = _mm_set1_epi8((char)rd->threshold);
+    const __m128i acc16 = _mm_set1_epi16((short)rd->accept_timer);
+    __m128i vref, vnew, vsmk, vout, vdif, vdlo, vdhi;
+    __m128i vstill, vdz, vdgt, vout0, vtakev, vavgm, vincm, vavg;
+    int indx;
+
+    if ((rd->threshold < 0) || (rd->threshold > 255)) {
+        alg_simd_ref_scalar(rd, 0);
+        return;
+    }
+
+    for (indx = 0; indx + 16 <= rd->count; indx += 16) {
+        vref = _mm_loadu_si128((const __m128i *)(rd->ref + indx));
+        vnew = _mm_loadu_si128((const __m128i *)(rd->virgin + indx));
+        vsmk = _mm_loadu_si128((const __m128i *)(rd->smartmask + indx));
+        vout = _mm_loadu_si128((const __m128i *)(rd->out + indx));
+        vdlo = _mm_loadu_si128((const __m128i *)(rd->ref_dyn + indx));
+        vdhi = _mm_loadu_si128((const __m128i *)(rd->ref_dyn + indx + 8));
+
+        vdif = _mm_or_si128(_mm_subs_epu8(vref, vnew), _mm_subs_epu8(vnew, vref));
+        vstill = _mm_or_si128(_mm_cmpeq_epi8(_mm_subs_epu8(vdif, thr8), zero)
+            , _mm_cmpeq_epi8(vsmk, zero));
+
+        vdz = _mm_packs_epi16(_mm_cmpeq_epi16(vdlo, zero), _mm_cmpeq_epi16(vdhi, zero));
+        vdgt = _mm_packs_epi16(_mm_cmpeq_epi16(_mm_subs_epu16(vdlo, acc16), zero)
+            , _mm_cmpeq_epi16(_mm_subs_epu16(vdhi, acc16), zero));
+        vdgt = _mm_xor_si128(vdgt, ones);
+        vout0 = _mm_cmpeq_epi8(vout, zero);
+
+        vtakev = _mm_or_si128(vstill, vdgt);
+        vavgm = _mm_andnot_si128(_mm_or_si128(vtakev, vdz), vout0);
+        vincm = _mm_andnot_si128(_mm_or_si128(vtakev, vavgm), ones);
+
+        /* _mm_avg_epu8 rounds up, the scalar code rounds down */
+        vavg = _mm_sub_epi8(_mm_avg_epu8(vref, vnew), _mm_and_si128(_mm_xor_si128(vref, vnew), lsb));
+        vref = _mm_or_si128(_mm_and_si128(vtakev, vnew), _mm_andnot_si128(vtakev, vref));
+        vref = _mm_or_si128(_mm_and_si128(vavgm, vavg), _mm_andnot_si128(vavgm, vref));
+        _mm_storeu_si128((__m128i *)(rd->ref + indx), vref);
+
+        vdlo = _mm_and_si128(_mm_add_epi16(vdlo, one16), _mm_unpacklo_epi8(vincm, vincm));
+        vdhi = _mm_and_si128(_mm_add_epi16(vdhi, one16), _mm_unpackhi_epi8(vincm, vincm));
+        _mm_storeu_si128((__m128i *)(rd->ref_dyn + indx), vdlo);
+        _mm_storeu_si128((__m128i *)(rd->ref_dyn + indx + 8), vdhi);
+    }
+
+    alg_simd_ref_scalar(rd, indx);
+}
+
+__attribute__((target("avx2")))
+static void alg_simd_ref_avx2(const struct alg_ref_data *rd)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_cmpeq_epi8(zero, zero);
+    const __m256i lsb = _mm256_set1_epi8(1);
+    const __m256i one16 = _mm256_set1_epi16(1);
+    const __m256i thr8 = _mm256_set1_epi8((char)rd->threshold);
+    const __m256i acc16 = _mm256_set1_epi16((short)rd->accept_timer);
+    __m256i vref, vnew, vsmk, vout, vdif, vdlo, vdhi;
+    __m256i vstill, vdz, vdgt, vout0, vtakev, vavgm, vincm, vavg;
+    int indx;
+
+    if ((rd->threshold < 0) || (rd->threshold > 255)) {
+        alg_simd_ref_scalar(rd, 0);
+        return;
+    }
+
+    for (indx = 0; indx + 32 <= rd->count; indx += 32) {
+        vref = _mm256_loadu_si256((const __m256i *)(rd->ref + indx));
+        vnew = _mm256_loadu_si256((const __m256i *)(rd->virgin + indx));
+        vsmk = _mm256_loadu_si256((const __m256i *)(rd->smartmask + indx));
+        vout = _mm256_loadu_si256((const __m256i *)(rd->out + indx));
+        vdlo = _mm256_loadu_si256((const __m256i *)(rd->ref_dyn + indx));
+        vdhi = _mm256_loadu_si256((const __m256i *)(rd->ref_dyn + indx + 16));
+
+        vdif = _mm256_or_si256(_mm256_subs_epu8(vref, vnew), _mm256_subs_epu8(vnew, vref));
+        vstill = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_subs_epu8(vdif, thr8), zero)
+            , _mm256_cmpeq_epi8(vsmk, zero));
+
+        /* The pack works per 128 bit lane so the quadwords are put back in order */
+        vdz = _mm256_packs_epi16(_mm256_cmpeq_epi16(vdlo, zero), _mm256_cmpeq_epi16(vdhi, zero));
+        vdz = _mm256_permute4x64_epi64(vdz, 0xD8);
+        vdgt = _mm256_packs_epi16(_mm256_cmpeq_epi16(_mm256_subs_epu16(vdlo, acc16), zero)
+            , _mm256_cmpeq_epi16(_mm256_subs_epu16(vdhi, acc16), zero));
+        vdgt = _mm256_xor_si256(_mm256_permute4x64_epi64(vdgt, 0xD8), ones);
+        vout0 = _mm256_cmpeq_epi8(vout, zero);
+
+        vtakev = _mm256_or_si256(vstill, vdgt);
+        vavgm = _mm256_andnot_si256(_mm256_or_si256(vtakev, vdz), vout0);
+        vincm = _mm256_andnot_si256(_mm256_or_si256(vtakev, vavgm), ones);
+
+        vavg = _mm256_sub_epi8(_mm256_avg_epu8(vref, vnew)
+            , _mm256_and_si256(_mm256_xor_si256(vref, vnew), lsb));
+        vref = _mm256_blendv_epi8(vref, vnew, vtakev);
+        vref = _mm256_blendv_epi8(vref, vavg, vavgm);
+        _mm256_storeu_si256((__m256i *)(rd->ref + indx), vref);
+
+        vdlo = _mm256_and_si256(_mm256_add_epi16(vdlo, one16)
+            , _mm256_cvtepi8_epi16(_mm256_castsi256_si128(vincm)));
+        vdhi = _mm256_and_si256(_mm256_add_epi16(vdhi, one16)
+            , _mm256_cvtepi8_epi16(_mm256_extracti128_si256(vincm, 1)));
+        _mm256_storeu_si256((__m256i *)(rd->ref_dyn + indx), vdlo);
+        _mm256_storeu_si256((__m256i *)(rd->ref_dyn + indx + 16), vdhi);
+    }
+
+    alg_simd_ref_scalar(rd, indx);
+}
+
+__attribute__((target("sse2")))
+static void alg_simd_tile_sse2(const unsigned char *ref, const unsigned char *new
+    , int count, int noise, unsigned short *tiles)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i noise8 = _mm_set1_epi8((char)noise);
+    __m128i vref, vnew, vdif;
+    int indx, bits;
+
+    if ((noise < 0) || (noise > 255)) {
+        alg_simd_tile_scalar(ref, new, count, noise, tiles, 0);
+        return;
+    }
+
+    for (indx = 0; indx + 16 <= count; indx += 16) {
+        vref = _mm_loadu_si128((const __m128i *)(ref + indx));
+        vnew = _mm_loadu_si128((const __m128i *)(new + indx));
+        vdif = _mm_or_si128(_mm_subs_epu8(vref, vnew), _mm_subs_epu8(vnew, vref));
+        bits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(vdif, noise8), zero)) ^ 0xFFFF;
+        if (bits) {
+            tiles[indx / ALG_TILE_SIZE] += __builtin_popcount((unsigned int)bits);
+        }
+    }
+
+    alg_simd_tile_scalar(ref, new, count, noise, tiles, indx);
+}
+
+__attribute__((target("avx2")))
+static void alg_simd_tile_avx2(const unsigned char *ref, const unsigned char *new
+    , int count, int noise, unsigned short *tiles)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i noise8 = _mm256_set1_epi8((char)noise);
+    __m256i vref, vnew, vdif;
+    unsigned int bits;
+    int indx;
+
+    if ((noise < 0) || (noise > 255)) {
+        alg_simd_tile_scalar(ref, new, count, noise, tiles, 0);
+        return;
+    }
+
+    for (indx = 0; indx + 32 <= count; indx += 32) {
+        vref = _mm256_loadu_si256((const __m256i *)(ref + indx));
+        vnew = _mm256_loadu_si256((const __m256i *)(new + indx));
+        vdif = _mm256_or_si256(_mm256_subs_epu8(vref, vnew), _mm256_subs_epu8(vnew, vref));
+        bits = ~(unsigned int)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_subs_epu8(vdif, noise8), zero));
+        if (bits) {
+            /* Each vector covers two tiles */
+            tiles[indx / ALG_TILE_SIZE] += __builtin_popcount(bits & 0xFFFF);
+            tiles[indx / ALG_TILE_SIZE + 1] += __builtin_popcount(bits >> 16);
+        }
+    }
+
+    alg_simd_tile_scalar(ref, new, count, noise, tiles, indx);
+}
+
+__attribute__((target("sse2")))
+static int alg_simd_morph_sse2(int op, const unsigned char *row1, const unsigned char *row2
+    , const unsigned char *row3, unsigned char *tmp, unsigned char *dst, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const unsigned char *side;
+    __m128i vr1, vr2, vr3, vctr, vlft, vrgt, vres, vzro;
+    int indx, erode, sum = 0;
+
+    erode = ((op == ALG_MORPH_ERODE9) || (op == ALG_MORPH_ERODE5));
+    side = ((op == ALG_MORPH_ERODE9) || (op == ALG_MORPH_DILATE9)) ? tmp : row2;
+
+    for (indx = 0; indx + 16 <= width; indx += 16) {
+        vr1 = _mm_loadu_si128((const __m128i *)(row1 + indx));
+        vr2 = _mm_loadu_si128((const __m128i *)(row2 + indx));
+        vr3 = _mm_loadu_si128((const __m128i *)(row3 + indx));
+        if (erode) {
+            vres = _mm_min_epu8(_mm_min_epu8(vr1, vr2), vr3);
+        } else {
+            vres = _mm_max_epu8(_mm_max_epu8(vr1, vr2), vr3);
+        }
+        _mm_storeu_si128((__m128i *)(tmp + indx), vres);
+    }
+    alg_simd_morph_vert(op, row1, row2, row3, tmp, width, indx);
+
+    for (indx = 1; indx + 17 <= width; indx += 16) {
+        vctr = _mm_loadu_si128((const __m128i *)(tmp + indx));
+        vlft = _mm_loadu_si128((const __m128i *)(side + indx - 1));
+        vrgt = _mm_loadu_si128((const __m128i *)(side + indx + 1));
+        if (erode) {
+            vzro = _mm_cmpeq_epi8(_mm_min_epu8(_mm_min_epu8(vlft, vrgt), vctr), zero);
+            vres = _mm_andnot_si128(vzro, _mm_loadu_si128((const __m128i *)(row2 + indx)));
+        } else {
+            vres = _mm_max_epu8(_mm_max_epu8(vlft, vrgt), vctr);
+            vzro = _mm_cmpeq_epi8(vres, zero);
+        }
+        _mm_storeu_si128((__m128i *)(dst + indx), vres);
+        sum += __builtin_popcount((unsigned int)_mm_movemask_epi8(vzro) ^ 0xFFFF);
+    }
+
+    return sum + alg_simd_morph_horz(op, row2, tmp, dst, width, indx);
+}
+
+__attribute__((target("avx2")))
+static int alg_simd_morph_avx2(int op, const unsigned char *row1, const unsigned char *row2
+    , const unsigned char *row3, unsigned char *tmp, unsigned char *dst, int width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const unsigned char *side;
+    __m256i vr1, vr2, vr3, vctr, vlft, vrgt, vres, vzro;
+    int indx, erode, sum = 0;
+
+    erode = ((op == ALG_MORPH_ERODE9) || (op == ALG_MORPH_ERODE5));
+    side = ((op == ALG_MORPH_ERODE9) || (op == ALG_MORPH_DILATE9)) ? tmp : row2;
+
+    for (indx = 0; indx + 32 <= width; indx += 32) {
+        vr1 = _mm256_loadu_si256((const __m256i *)(row1 + indx));
+        vr2 = _mm256_loadu_si256((const __m256i *)(row2 + indx));
+        vr3 = _mm256_loadu_si256((const __m256i *)(row3 + indx));
+        if (erode) {
+            vres = _mm256_min_epu8(_mm256_min_epu8(vr1, vr2), vr3);
+        } else {
+            vres = _mm256_max_epu8(_mm256_max_epu8(vr1, vr2), vr3);
+        }
+        _mm256_storeu_si256((__m256i *)(tmp + indx), vres);
+    }
+    alg_simd_morph_vert(op, row1, row2, row3, tmp, width, indx);
+
+    for (indx = 1; indx + 33 <= width; indx += 32) {
+        vctr = _mm256_loadu_si256((const __m256i *)(tmp + indx));
+        vlft = _mm256_loadu_si256((const __m256i *)(side + indx - 1));
+        vrgt = _mm256_loadu_si256((const __m256i *)(side + indx + 1));
+        if (erode) {
+            vzro = _mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_min_epu8(vlft, vrgt), vctr), zero);
+            vres = _mm256_andnot_si256(vzro, _mm256_loadu_si256((const __m256i *)(row2 + indx)));
+        } else {
+            vres = _mm256_max_epu8(_mm256_max_epu8(vlft, vrgt), vctr);
+            vzro = _mm256_cmpeq_epi8(vres, zero);
+        }
+        _mm256_storeu_si256((__m256i *)(dst + indx), vres);
+        sum += __builtin_popcount(~(unsigned int)_mm256_movemask_epi8(vzro));
+    }
+
+    return sum + alg_simd_morph_horz(op, row2, tmp, dst, width, indx);
+}
+
+/*
+ * The smart mask kernels work on 16 bit lanes.  The smart mask wraps
+ * around at 8 bits as the unsigned char of the scalar code does.
+ */
+__attribute__((target("sse2")))
+static __m128i alg_simd_smartmask_sse2_half(const struct alg_smartmask_data *sd
+    , __m128i vsm, unsigned short *buffer)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one16 = _mm_set1_epi16(1);
+    const __m128i c80 = _mm_set1_epi16(80);
+    const __m128i lsb8 = _mm_set1_epi16(0xff);
+    const __m128i magic = _mm_set1_epi16((short)sd->magic);
+    const __m128i sens = _mm_set1_epi16((short)sd->sensitivity);
+    const __m128i shift1 = _mm_cvtsi32_si128(sd->shift1);
+    const __m128i shift2 = _mm_cvtsi32_si128(sd->shift2);
+    __m128i vbuf, vt, vq, vle, vnew;
+
+    vbuf = _mm_loadu_si128((const __m128i *)buffer);
+    vt = _mm_mulhi_epu16(vbuf, magic);
+    vq = _mm_srl_epi16(_mm_add_epi16(vt, _mm_srl_epi16(_mm_sub_epi16(vbuf, vt), shift1)), shift2);
+    _mm_storeu_si128((__m128i *)buffer, _mm_sub_epi16(vbuf, _mm_mullo_epi16(vq, sens)));
+
+    vsm = _mm_subs_epu16(vsm, one16);
+    vle = _mm_cmpeq_epi16(_mm_subs_epu16(vsm, _mm_adds_epu16(vq, c80)), zero);
+    vnew = _mm_or_si128(_mm_and_si128(vle, _mm_and_si128(_mm_add_epi16(vsm, vq), lsb8))
+        , _mm_andnot_si128(vle, c80));
+    vle = _mm_cmpeq_epi16(vq, zero);
+
+    return _mm_or_si128(_mm_and_si128(vle, vsm), _mm_andnot_si128(vle, vnew));
+}
+
+__attribute__((target("sse2")))
+static void alg_simd_smartmask_sse2(const struct alg_smartmask_data *sd)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i trig8 = _mm_set1_epi8(20);
+    __m128i vsm, vlo, vhi;
+    int indx;
+
+    for (indx = 0; indx + 16 <= sd->count; indx += 16) {
+        vsm = _mm_loadu_si128((const __m128i *)(sd->smartmask + indx));
+        vlo = alg_simd_smartmask_sse2_half(sd, _mm_unpacklo_epi8(vsm, zero), sd->buffer + indx);
+        vhi = alg_simd_smartmask_sse2_half(sd, _mm_unpackhi_epi8(vsm, zero), sd->buffer + indx + 8);
+        vsm = _mm_packus_epi16(vlo, vhi);
+        _mm_storeu_si128((__m128i *)(sd->smartmask + indx), vsm);
+        _mm_storeu_si128((__m128i *)(sd->final + indx), _mm_cmpeq_epi8(_mm_subs_epu8(vsm, trig8), zero));
+    }
+
+    alg_simd_smartmask_scalar(sd, indx);
+}
+
+__attribute__((target("avx2")))
+static __m256i alg_simd_smartmask_avx2_half(const struct alg_smartmask_data *sd
+    , __m256i vsm, unsigned short *buffer)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one16 = _mm256_set1_epi16(1);
+    const __m256i c80 = _mm256_set1_epi16(80);
+    const __m256i lsb8 = _mm256_set1_epi16(0xff);
+    const __m256i magic = _mm256_set1_epi16((short)sd->magic);
+    const __m256i sens = _mm256_set1_epi16((short)sd->sensitivity);
+    const __m128i shift1 = _mm_cvtsi32_si128(sd->shift1);
+    const __m128i shift2 = _mm_cvtsi32_si128(sd->shift2);
+    __m256i vbuf, vt, vq, vle, vnew;
+
+    vbuf = _mm256_loadu_si256((const __m256i *)buffer);
+    vt = _mm256_mulhi_epu16(vbuf, magic);
+    vq = _mm256_srl_epi16(_mm256_add_epi16(vt, _mm256_srl_epi16(_mm256_sub_epi16(vbuf, vt), shift1)), shift2);
+    _mm256_storeu_si256((__m256i *)buffer, _mm256_sub_epi16(vbuf, _mm256_mullo_epi16(vq, sens)));
+
+    vsm = _mm256_subs_epu16(vsm, one16);
+    vle = _mm256_cmpeq_epi16(_mm256_subs_epu16(vsm, _mm256_adds_epu16(vq, c80)), zero);
+    vnew = _mm256_blendv_epi8(c80, _mm256_and_si256(_mm256_add_epi16(vsm, vq), lsb8), vle);
+
+    return _mm256_blendv_epi8(vnew, vsm, _mm256_cmpeq_epi16(vq, zero));
+}
+
+__attribute__((target("avx2")))
+static void alg_simd_smartmask_avx2(const struct alg_smartmask_data *sd)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i trig8 = _mm256_set1_epi8(20);
+    __m256i vsm, vlo, vhi;
+    int indx;
+
+    for (indx = 0; indx + 32 <= sd->count; indx += 32) {
+        vsm = _mm256_loadu_si256((const __m256i *)(sd->smartmask + indx));
+        vlo = alg_simd_smartmask_avx2_half(sd, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(vsm))
+            , sd->buffer + indx);
+        vhi = alg_simd_smartmask_avx2_half(sd, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(vsm, 1))
+            , sd->buffer + indx + 16);
+        /* The pack works per 128 bit lane so the quarters are put back in order */
+        vsm = _mm256_permute4x64_epi64(_mm256_packus_epi16(vlo, vhi), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *)(sd->smartmask + indx), vsm);
+        _mm256_storeu_si256((__m256i *)(sd->final + indx)
+            , _mm256_cmpeq_epi8(_mm256_subs_epu8(vsm, trig8), zero));
+    }
+
+    alg_simd_smartmask_scalar(sd, indx);
+}
+
+#endif /* HAVE_SIMD_X86 */
+
+#ifdef HAVE_SIMD_NEON
+
+static inline int alg_simd_neon_count(uint8x16_t vflg)
+{
+    uint8x16_t vbit = vandq_u8(vflg, vdupq_n_u8(1));
+    #if defined(__aarch64__)
+        return vaddvq_u8(vbit);
+    #else
+        uint64x2_t vsum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vbit)));
+        return (int)(vgetq_lane_u64(vsum, 0) + vgetq_lane_u64(vsum, 1));
+    #endif
+}
+
+__attribute__((always_inline))
+static inline int alg_simd_diff_neon_body(const struct alg_diff_data *dd, const int flags)
+{
+    const uint8x16_t noise8 = vdupq_n_u8((uint8_t)dd->noise);
+    const uint16x8_t noise16 = vdupq_n_u16((uint16_t)(dd->noise * 255 + 254));
+    const uint8x16_t incr = vdupq_n_u8(SMARTMASK_SENSITIVITY_INCR);
+    uint8x16_t vref, vnew, vdif, vflg, vmsk, vsmf, vinc;
+    uint16x8_t vlo, vhi;
+    int indx, diffs = 0;
+    uint16_t *smb;
+
+    if ((dd->noise < 0) || (dd->noise > 255)) {
+        return alg_simd_diff_scalar(dd, 0, flags);
+    }
+
+    for (indx = 0; indx + 16 <= dd->count; indx += 16) {
+        vref = vld1q_u8(dd->ref + indx);
+        vnew = vld1q_u8(dd->new + indx);
+        vdif = vabdq_u8(vref, vnew);
+
+        if (flags & ALG_DIFF_MASK) {
+            vmsk = vld1q_u8(dd->mask + indx);
+            vlo = vcgtq_u16(vmull_u8(vget_low_u8(vdif), vget_low_u8(vmsk)), noise16);
+            vhi = vcgtq_u16(vmull_u8(vget_high_u8(vdif), vget_high_u8(vmsk)), noise16);
+            vflg = vcombine_u8(vmovn_u16(vlo), vmovn_u16(vhi));
+        } else {
+            vflg = vcgtq_u8(vdif, noise8);
+        }
+
+        if (flags & ALG_DIFF_SMARTMASK) {
+            if (flags & ALG_DIFF_SMARTBUF) {
+                smb = dd->smartmask_buffer + indx;
+                vinc = vandq_u8(vflg, incr);
+                vst1q_u16(smb, vqaddq_u16(vld1q_u16(smb), vmovl_u8(vget_low_u8(vinc))));
+                vst1q_u16(smb + 8, vqaddq_u16(vld1q_u16(smb + 8), vmovl_u8(vget_high_u8(vinc))));
+            }
+            vsmf = vld1q_u8(dd->smartmask_final + indx);
+            vflg = vandq_u8(vflg, vtstq_u8(vsmf, vsmf));
+        }
+
+        vst1q_u8(dd->out + indx, vandq_u8(vflg, vnew));
+        diffs += alg_simd_neon_count(vflg);
+    }
+
+    return diffs + alg_simd_diff_scalar(dd, indx, flags);
+}
+
+ALG_SIMD_DIFF_KERNELS(neon, )
+
+static void alg_simd_ref_neon(const struct alg_ref_data *rd)
+{
+    const uint8x16_t thr8 = vdupq_n_u8((uint8_t)rd->threshold);
+    const uint16x8_t acc16 = vdupq_n_u16((uint16_t)rd->accept_timer);
+    const uint16x8_t one16 = vdupq_n_u16(1);
+    uint8x16_t vref, vnew, vsmk, vout, vmov, vdz, vdgt, vtakev, vavgm, vincm;
+    uint16x8_t vdlo, vdhi;
+    int indx;
+
+    if ((rd->threshold < 0) || (rd->threshold > 255)) {
+        alg_simd_ref_scalar(rd, 0);
+        return;
+    }
+
+    for (indx = 0; indx + 16 <= rd->count; indx += 16) {
+        vref = vld1q_u8(rd->ref + indx);
+        vnew = vld1q_u8(rd->virgin + indx);
+        vsmk = vld1q_u8(rd->smartmask + indx);
+        vout = vld1q_u8(rd->out + indx);
+        vdlo = vld1q_u16(rd->ref_dyn + indx);
+        vdhi = vld1q_u16(rd->ref_dyn + indx + 8);
+
+        vmov = vandq_u8(vcgtq_u8(vabdq_u8(vref, vnew), thr8), vtstq_u8(vsmk, vsmk));
+        vdz = vcombine_u8(vmovn_u16(vceqq_u16(vdlo, vdupq_n_u16(0)))
+            , vmovn_u16(vceqq_u16(vdhi, vdupq_n_u16(0))));
+        vdgt = vcombine_u8(vmovn_u16(vcgtq_u16(vdlo, acc16)), vmovn_u16(vcgtq_u16(vdhi, acc16)));
+
+        vtakev = vornq_u8(vdgt, vmov);
+        vavgm = vbicq_u8(vceqq_u8(vout, vdupq_n_u8(0)), vorrq_u8(vtakev, vdz));
+        vincm = vmvnq_u8(vorrq_u8(vtakev, vavgm));
+
+        vref = vbslq_u8(vtakev, vnew, vref);
+        vref = vbslq_u8(vavgm, vhaddq_u8(vref, vnew), vref);
+        vst1q_u8(rd->ref + indx, vref);
+
+        vdlo = vandq_u16(vaddq_u16(vdlo, one16), vmovl_u8(vget_low_u8(vincm)));
+        vdhi = vandq_u16(vaddq_u16(vdhi, one16), vmovl_u8(vget_high_u8(vincm)));
+        vst1q_u16(rd->ref_dyn + indx, vdlo);
+        vst1q_u16(rd->ref_dyn + indx + 8, vdhi);
+    }
+
+    alg_simd_ref_scalar(rd, indx);
+}
+
+static void alg_simd_tile_neon(const unsigned char *ref, const unsigned char *new
+    , int count, int noise, unsigned short *tiles)
+{
+    const uint8x16_t noise8 = vdupq_n_u8((uint8_t)noise);
+    uint8x16_t vflg;
+    int indx;
+
+    if ((noise < 0) || (noise > 255)) {
+        alg_simd_tile_scalar(ref, new, count, noise, tiles, 0);
+        return;
+    }
+
+    for (indx = 0; indx + 16 <= count; indx += 16) {
+        vflg = vcgtq_u8(vabdq_u8(vld1q_u8(ref + indx), vld1q_u8(new + indx)), noise8);
+        tiles[indx / ALG_TILE_SIZE] += alg_simd_neon_count(vflg);
+    }
+
+    alg_simd_tile_scalar(ref, new, count, noise, tiles, indx);
+}
+
+static int alg_simd_morph_neon(int op, const unsigned char *row1, const unsigned char *row2
+    , const unsigned char *row3, unsigned char *tmp, unsigned char *dst, int width)
+{
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const unsigned char *side;
+    uint8x16_t vr1, vr2, vr3, vctr, vlft, vrgt, vres;
+    int indx, erode, sum = 0;
+
+    erode = ((op == ALG_MORPH_ERODE9) || (op == ALG_MORPH_ERODE5));
+    side = ((op == ALG_MORPH_ERODE9) || (op == ALG_MORPH_DILATE9)) ? tmp : row2;
+
+    for (indx = 0; indx + 16 <= width; indx += 16) {
+        vr1 = vld1q_u8(row1 + indx);
+        vr2 = vld1q_u8(row2 + indx);
+        vr3 = vld1q_u8(row3 + indx);
+        if (erode) {
+            vres = vminq_u8(vminq_u8(vr1, vr2), vr3);
+        } else {
+            vres = vmaxq_u8(vmaxq_u8(vr1, vr2), vr3);
+        }
+        vst1q_u8(tmp + indx, vres);
+    }
+    alg_simd_morph_vert(op, row1, row2, row3, tmp, width, indx);
+
+    for (indx = 1; indx + 17 <= width; indx += 16) {
+        vctr = vld1q_u8(tmp + indx);
+        vlft = vld1q_u8(side + indx - 1);
+        vrgt = vld1q_u8(side + indx + 1);
+        if (erode) {
+            vres = vminq_u8(vminq_u8(vlft, vrgt), vctr);
+            vres = vandq_u8(vtstq_u8(vres, vres), vld1q_u8(row2 + indx));
+        } else {
+            vres = vmaxq_u8(vmaxq_u8(vlft, vrgt), vctr);
+        }
+        vst1q_u8(dst + indx, vres);
+        sum += alg_simd_neon_count(vmvnq_u8(vceqq_u8(vres, zero)));
+    }
+
+    return sum + alg_simd_morph_horz(op, row2, tmp, dst, width, indx);
+}
+
+static uint16x8_t alg_simd_smartmask_neon_half(const struct alg_smartmask_data *sd
+    , uint16x8_t vsm, unsigned short *buffer)
+{
+    const uint16x8_t c80 = vdupq_n_u16(80);
+    const uint16x8_t lsb8 = vdupq_n_u16(0xff);
+    const uint16x4_t magic = vdup_n_u16(sd->magic);
+    const uint16x8_t sens = vdupq_n_u16((uint16_t)sd->sensitivity);
+    const int16x8_t shift1 = vdupq_n_s16((int16_t)-sd->shift1);
+    const int16x8_t shift2 = vdupq_n_s16((int16_t)-sd->shift2);
+    uint16x8_t vbuf, vt, vq, vle, vnew;
+
+    vbuf = vld1q_u16(buffer);
+    vt = vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(vbuf), magic), 16)
+        , vshrn_n_u32(vmull_u16(vget_high_u16(vbuf), magic), 16));
+    vq = vshlq_u16(vaddq_u16(vt, vshlq_u16(vsubq_u16(vbuf, vt), shift1)), shift2);
+    vst1q_u16(buffer, vsubq_u16(vbuf, vmulq_u16(vq, sens)));
+
+    vsm = vqsubq_u16(vsm, vdupq_n_u16(1));
+    vle = vcleq_u16(vsm, vqaddq_u16(vq, c80));
+    vnew = vbslq_u16(vle, vandq_u16(vaddq_u16(vsm, vq), lsb8), c80);
+
+    return vbslq_u16(vceqq_u16(vq, vdupq_n_u16(0)), vsm, vnew);
+}
+
+static void alg_simd_smartmask_neon(const struct alg_smartmask_data *sd)
+{
+    uint8x16_t vsm;
+    uint16x8_t vlo, vhi;
+    int indx;
+
+    for (indx = 0; indx + 16 <= sd->count; indx += 16) {
+        vsm = vld1q_u8(sd->smartmask + indx);
+        vlo = alg_simd_smartmask_neon_half(sd, vmovl_u8(vget_low_u8(vsm)), sd->buffer + indx);
+        vhi = alg_simd_smartmask_neon_half(sd, vmovl_u8(vget_high_u8(vsm)), sd->buffer + indx + 8);
+        vsm = vcombine_u8(vmovn_u16(vlo), vmovn_u16(vhi));
+        vst1q_u8(sd->smartmask + indx, vsm);
+        vst1q_u8(sd->final + indx, vcleq_u8(vsm, vdupq_n_u8(20)));
+    }
+
+    alg_simd_smartmask_scalar(sd, indx);
+}
+
+#endif /* HAVE_SIMD_NEON */
+
+/*
+ * The kernels in use.  Defaults to the scalar versions so that the alg
+ * functions are safe to call even before alg_simd_init.
+ */
+struct alg_simd_kernels alg_simd = {
+    "c",
+    alg_simd_diff_c,
+    alg_simd_ref_c,
+    alg_simd_tile_c,
+    alg_simd_morph_c,
+    alg_simd_smartmask_c
+};
+
+/**
+ * alg_simd_init
+ *      Select the kernels for the cpu we are running on.
+ */
+void alg_simd_init(void)
+{
+    #if defined(HAVE_SIMD_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            alg_simd.name = "avx2";
+            alg_simd.diff = alg_simd_diff_avx2;
+            alg_simd.ref_update = alg_simd_ref_avx2;
+            alg_simd.tile_count = alg_simd_tile_avx2;
+            alg_simd.morph_row = alg_simd_morph_avx2;
+            alg_simd.smartmask_tune = alg_simd_smartmask_avx2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            alg_simd.name = "sse2";
+            alg_simd.diff = alg_simd_diff_sse2;
+            alg_simd.ref_update = alg_simd_ref_sse2;
+            alg_simd.tile_count = alg_simd_tile_sse2;
+            alg_simd.morph_row = alg_simd_morph_sse2;
+            alg_simd.smartmask_tune = alg_simd_smartmask_sse2;
+        }
+    #elif defined(HAVE_SIMD_NEON)
+        alg_simd.name = "neon";
+        alg_simd.diff = alg_simd_diff_neon;
+        alg_simd.ref_update = alg_simd_ref_neon;
+        alg_simd.tile_count = alg_simd_tile_neon;
+        alg_simd.morph_row = alg_simd_morph_neon;
+        alg_simd.smartmask_tune = alg_simd_smartmask_neon;
+    #endif
+
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+        ,_("Using %s kernels for motion detection"), alg_simd.name);
+}
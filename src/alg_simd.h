@@ -0,0 +1,117 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  alg_simd.h
+ *    Headers associated with the vectorized detection kernels in alg_simd.c
+ */
+
+#ifndef _INCLUDE_ALG_SIMD_H
+#define _INCLUDE_ALG_SIMD_H
+
+/*
+ * Increment for *smartmask_buffer in the diff kernels.  The buffer is 16
+ * bits and the increments saturate.  Buffers are tuned once every 5 times
+ * the sensitivity frames so they never get near the limit.
+ */
+#define SMARTMASK_SENSITIVITY_INCR 5
+
+/*
+ * Arguments for a single pass of the diff kernel over the Y plane.
+ * A NULL mask disables the fixed mask.  A NULL smartmask_final disables the
+ * smart mask and a NULL smartmask_buffer disables its sensitivity update.
+ */
+struct alg_diff_data {
+    const unsigned char *ref;
+    const unsigned char *new;
+    unsigned char       *out;
+    const unsigned char *mask;
+    const unsigned char *smartmask_final;
+    unsigned short      *smartmask_buffer;
+    int                 count;
+    int                 noise;
+};
+
+/*
+ * Arguments for the smart mask tuning of count pixels.  final receives
+ * the smart mask before it is eroded.  The division of the buffer by the
+ * sensitivity is done with magic and the shifts as from alg_simd_divisor.
+ */
+struct alg_smartmask_data {
+    unsigned char       *smartmask;
+    unsigned short      *buffer;
+    unsigned char       *final;
+    int                 count;
+    int                 sensitivity;
+    unsigned short      magic;
+    int                 shift1;
+    int                 shift2;
+};
+
+/*
+ * Arguments for the reference frame update.  The static object timer in
+ * ref_dyn is 16 bits so accept_timer must be clamped to REF_DYN_MAX.
+ */
+#define REF_DYN_MAX 65534
+
+struct alg_ref_data {
+    unsigned char       *ref;
+    const unsigned char *virgin;
+    const unsigned char *smartmask;
+    const unsigned char *out;
+    unsigned short      *ref_dyn;
+    int                 count;
+    int                 threshold;
+    int                 accept_timer;
+};
+
+/*
+ * The diff kernels are specialized for each use of the masks.  The index of
+ * a kernel in alg_simd.diff is made of these flags.
+ */
+#define ALG_DIFF_MASK       0x01    /* mask is set */
+#define ALG_DIFF_SMARTMASK  0x02    /* smartmask_final is set */
+#define ALG_DIFF_SMARTBUF   0x04    /* smartmask_buffer is set, only with ALG_DIFF_SMARTMASK */
+#define ALG_DIFF_KERNELS    8
+
+typedef int (*alg_diff_kernel)(const struct alg_diff_data *dd);
+
+/* Width and height of the tiles used by the early exit in alg_diff */
+#define ALG_TILE_SIZE 16
+
+/* Operations of the morphology row kernel, same letters as despeckle_filter */
+#define ALG_MORPH_ERODE9    'E'
+#define ALG_MORPH_ERODE5    'e'
+#define ALG_MORPH_DILATE9   'D'
+#define ALG_MORPH_DILATE5   'd'
+
+struct alg_simd_kernels {
+    const char  *name;
+    const alg_diff_kernel *diff;    /* ALG_DIFF_KERNELS kernels indexed by the ALG_DIFF flags */
+    void        (*ref_update)(const struct alg_ref_data *rd);
+    void        (*tile_count)(const unsigned char *ref, const unsigned char *new
+                    , int count, int noise, unsigned short *tiles);
+    int         (*morph_row)(int op, const unsigned char *row1, const unsigned char *row2
+                    , const unsigned char *row3, unsigned char *tmp, unsigned char *dst, int width);
+    void        (*smartmask_tune)(const struct alg_smartmask_data *sd);
+};
+
+extern struct alg_simd_kernels alg_simd;
+
+void alg_simd_init(void);
+void alg_simd_divisor(struct alg_smartmask_data *sd, int sensitivity);
+
+#endif /* _INCLUDE_ALG_SIMD_H */
@@ -0,0 +1,331 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *    capture.c
+ *
+ *    Pipelined capture for the motion loop.
+ *
+ *    When capture_queue is set, a capture thread per camera takes frames
+ *    from the device with vid_next and places them into a bounded queue.
+ *    The motion loop then becomes the detection and actions stage and
+ *    takes frames from the queue instead of calling vid_next itself.
+ *    A slow picture save or movie encode therefore only fills the queue
+ *    rather than delaying the device.  When the queue is full the capture
+ *    thread waits for a free slot so memory use stays bounded.
+ *
+ *    Frames are handed over by swapping the image buffers between the
+ *    queue slot and the ring image so no image data is copied.
+ *
+ */
+
+#include "translate.h"
+#include "motion.h"
+#include "util.h"
+#include "logger.h"
+#include "video_common.h"
+#include "capture.h"
+#include "framepool.h"
+
+/* Seconds the motion loop waits for a frame before reporting a missing frame */
+#define CAPTURE_WAIT_SEC 1
+
+static void capture_timeout(struct timespec *ts, int sec)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    ts->tv_sec = tv.tv_sec + sec;
+    ts->tv_nsec = tv.tv_usec * 1000;
+}
+
+/** capture_pace
+ *  Sleep for what is left of the frame interval so the device is
+ *  not read faster than the framerate.
+ */
+static void capture_pace(struct context *cnt, struct timeval *tv_start)
+{
+    struct timeval tv_end;
+    long elapsed, frame_time;
+
+    if (cnt->conf.framerate <= 0) {
+        return;
+    }
+    frame_time = 1000000L / cnt->conf.framerate;
+
+    gettimeofday(&tv_end, NULL);
+    elapsed = (tv_end.tv_sec - tv_start->tv_sec) * 1000000L +
+        (tv_end.tv_usec - tv_start->tv_usec);
+
+    if (elapsed < frame_time) {
+        SLEEP(0, (frame_time - elapsed) * 1000);
+    }
+}
+
+static void *capture_handler(void *arg)
+{
+    struct context *cnt = arg;
+    struct capture_queue *capq = cnt->capq;
+    struct capture_frame *frame;
+    struct timeval tv_start;
+    struct timespec ts;
+    int stalled;
+
+    util_threadname_set("cq", cnt->threadnr, cnt->conf.camera_name);
+
+    pthread_setspecific(tls_key_threadnr, (void *)((unsigned long)cnt->threadnr));
+
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+        ,_("Capture thread started with a queue of %d frames"), capq->size);
+
+    while (!capq->finish) {
+        gettimeofday(&tv_start, NULL);
+
+        /* Back-pressure: wait for the motion loop to free a slot */
+        stalled = FALSE;
+        pthread_mutex_lock(&capq->mutex);
+            while ((capq->count == capq->size) && !capq->finish) {
+                if (!stalled) {
+                    stalled = TRUE;
+                    if (capq->stalls++ == 0) {
+                        MOTION_LOG(WRN, TYPE_ALL, NO_ERRNO
+                            ,_("Capture queue full, capture is waiting on the motion loop"));
+                    }
+                }
+                capture_timeout(&ts, CAPTURE_WAIT_SEC);
+                pthread_cond_timedwait(&capq->cond_put, &capq->mutex, &ts);
+            }
+            /* Only this thread writes the tail slot so it is filled unlocked */
+            frame = &capq->frames[(capq->head + capq->count) % capq->size];
+        pthread_mutex_unlock(&capq->mutex);
+
+        if (capq->finish) {
+            break;
+        }
+
+        pthread_mutex_lock(&capq->mutex_vid);
+            if (cnt->video_dev >= 0) {
+                frame->retcd = vid_next(cnt, &frame->img);
+            } else {
+                frame->retcd = 1;
+            }
+        pthread_mutex_unlock(&capq->mutex_vid);
+        gettimeofday(&frame->img.timestamp_tv, NULL);
+
+        pthread_mutex_lock(&capq->mutex);
+            capq->count++;
+            capq->captured++;
+            if (capq->count > capq->depth_max) {
+                capq->depth_max = capq->count;
+            }
+            pthread_cond_signal(&capq->cond_get);
+        pthread_mutex_unlock(&capq->mutex);
+
+        capture_pace(cnt, &tv_start);
+    }
+
+    MOTION_LOG(INF, TYPE_ALL, NO_ERRNO, _("Capture thread exiting"));
+
+    capq->finished = TRUE;
+
+    pthread_exit(NULL);
+}
+
+static void capture_free(struct context *cnt, struct capture_queue *capq)
+{
+    int indx;
+
+    for (indx = 0; indx < capq->size; indx++) {
+        framepool_put(cnt, capq->frames[indx].img.image_norm, cnt->imgs.size_norm);
+        framepool_put(cnt, capq->frames[indx].img.image_high, cnt->imgs.size_high);
+        free(capq->frames[indx].img.jpeg_data);
+    }
+    free(capq->frames);
+
+    pthread_cond_destroy(&capq->cond_get);
+    pthread_cond_destroy(&capq->cond_put);
+    pthread_mutex_destroy(&capq->mutex_vid);
+    pthread_mutex_destroy(&capq->mutex);
+
+    free(capq);
+}
+
+/** capture_start
+ *  Allocate the frame queue and start the capture thread when capture_queue
+ *  is set.  On any failure cnt->capq is left NULL and the motion loop falls
+ *  back to calling vid_next directly.
+ */
+void capture_start(struct context *cnt)
+{
+    struct capture_queue *capq;
+    int indx;
+
+    cnt->capq = NULL;
+
+    if (cnt->conf.capture_queue <= 0) {
+        return;
+    }
+
+    if (cnt->conf.minimum_frame_time) {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("capture_queue is not used with minimum_frame_time"));
+        return;
+    }
+
+    capq = mymalloc(sizeof(struct capture_queue));
+    memset(capq, 0, sizeof(struct capture_queue));
+
+    capq->size = cnt->conf.capture_queue;
+    capq->frames = mymalloc(capq->size * sizeof(struct capture_frame));
+    memset(capq->frames, 0, capq->size * sizeof(struct capture_frame));
+    for (indx = 0; indx < capq->size; indx++) {
+        capq->frames[indx].img.image_norm = framepool_get(cnt, cnt->imgs.size_norm, TRUE);
+        memset(capq->frames[indx].img.image_norm, 0x80, cnt->imgs.size_norm);
+        if (cnt->imgs.size_high > 0) {
+            capq->frames[indx].img.image_high = framepool_get(cnt, cnt->imgs.size_high, TRUE);
+            memset(capq->frames[indx].img.image_high, 0x80, cnt->imgs.size_high);
+        }
+    }
+
+    pthread_mutex_init(&capq->mutex, NULL);
+    pthread_mutex_init(&capq->mutex_vid, NULL);
+    pthread_cond_init(&capq->cond_put, NULL);
+    pthread_cond_init(&capq->cond_get, NULL);
+
+    cnt->capq = capq;
+
+    if (pthread_create(&capq->thread_id, NULL, &capture_handler, cnt) != 0) {
+        MOTION_LOG(ERR, TYPE_ALL, SHOW_ERRNO
+            ,_("Unable to start capture thread, capturing in the motion loop"));
+        cnt->capq = NULL;
+        capture_free(cnt, capq);
+    }
+}
+
+/** capture_stop
+ *  Stop and join the capture thread, report the queue counters and
+ *  release the queue.  The motion loop must not use the queue afterwards.
+ *  The locks are not taken here since after a watchdog kill the capture
+ *  thread may have been cancelled while holding one.
+ */
+void capture_stop(struct context *cnt)
+{
+    struct capture_queue *capq = cnt->capq;
+
+    if (capq == NULL) {
+        return;
+    }
+
+    capq->finish = TRUE;
+    pthread_cond_broadcast(&capq->cond_put);
+    pthread_join(capq->thread_id, NULL);
+
+    MOTION_LOG(INF, TYPE_ALL, NO_ERRNO
+        ,_("Capture queue: %lu frames captured, %lu consumed, %lu dropped when idle, %lu stalls, max depth %d of %d")
+        ,capq->captured, capq->consumed, capq->dropped, capq->stalls, capq->depth_max, capq->size);
+
+    cnt->capq = NULL;
+    capture_free(cnt, capq);
+}
+
+/** capture_next
+ *  Take the oldest frame from the queue into img_data.  Returns the vid_next
+ *  return code of that frame, or 1 (non fatal) when no frame arrived in time.
+ *  At the idle framerate the older frames are dropped for the newest one so
+ *  the frames are not delayed by the queue.
+ */
+int capture_next(struct context *cnt, struct image_data *img_data)
+{
+    struct capture_queue *capq = cnt->capq;
+    struct capture_frame *frame;
+    struct timespec ts;
+    unsigned char *tmp;
+    int retcd, alloc;
+
+    pthread_mutex_lock(&capq->mutex);
+        capture_timeout(&ts, CAPTURE_WAIT_SEC);
+        while ((capq->count == 0) && !capq->finished) {
+            if (pthread_cond_timedwait(&capq->cond_get, &capq->mutex, &ts) == ETIMEDOUT) {
+                break;
+            }
+        }
+        if (capq->count == 0) {
+            pthread_mutex_unlock(&capq->mutex);
+            return 1;
+        }
+
+        if (cnt->idle) {
+            while (capq->count > 1) {
+                if (++capq->head >= capq->size) {
+                    capq->head = 0;
+                }
+                capq->count--;
+                capq->dropped++;
+            }
+        }
+
+        frame = &capq->frames[capq->head];
+        retcd = frame->retcd;
+        if (retcd == 0) {
+            tmp = img_data->image_norm;
+            img_data->image_norm = frame->img.image_norm;
+            frame->img.image_norm = tmp;
+            if (cnt->imgs.size_high > 0) {
+                tmp = img_data->image_high;
+                img_data->image_high = frame->img.image_high;
+                frame->img.image_high = tmp;
+            }
+            tmp = img_data->jpeg_data;
+            img_data->jpeg_data = frame->img.jpeg_data;
+            frame->img.jpeg_data = tmp;
+            alloc = img_data->jpeg_alloc;
+            img_data->jpeg_alloc = frame->img.jpeg_alloc;
+            frame->img.jpeg_alloc = alloc;
+            img_data->jpeg_size = frame->img.jpeg_size;
+            img_data->high_pending = frame->img.high_pending;
+            img_data->idnbr_norm = frame->img.idnbr_norm;
+            img_data->idnbr_high = frame->img.idnbr_high;
+            img_data->timestamp_tv = frame->img.timestamp_tv;
+        }
+
+        if (++capq->head >= capq->size) {
+            capq->head = 0;
+        }
+        capq->count--;
+        capq->consumed++;
+        pthread_cond_signal(&capq->cond_put);
+    pthread_mutex_unlock(&capq->mutex);
+
+    return retcd;
+}
+
+/** capture_lock
+ *  Take the device lock around vid_start and vid_close in the motion loop.
+ *  Does nothing when the capture thread is not in use.
+ */
+void capture_lock(struct context *cnt)
+{
+    if (cnt->capq) {
+        pthread_mutex_lock(&cnt->capq->mutex_vid);
+    }
+}
+
+void capture_unlock(struct context *cnt)
+{
+    if (cnt->capq) {
+        pthread_mutex_unlock(&cnt->capq->mutex_vid);
+    }
+}
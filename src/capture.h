@@ -0,0 +1,58 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  capture.h
+ *    Headers associated with functions in the capture.c module.
+ */
+
+#ifndef _INCLUDE_CAPTURE_H
+#define _INCLUDE_CAPTURE_H
+
+struct capture_frame {
+    struct image_data   img;
+    int                 retcd;          /* Return code of vid_next for this frame */
+};
+
+struct capture_queue {
+    pthread_t               thread_id;
+    pthread_mutex_t         mutex;          /* Protects the frame array and counters */
+    pthread_cond_t          cond_put;       /* Signalled when a slot becomes free */
+    pthread_cond_t          cond_get;       /* Signalled when a frame is queued */
+    pthread_mutex_t         mutex_vid;      /* Serializes vid_next with vid_start/vid_close */
+
+    struct capture_frame    *frames;
+    int                     size;
+    int                     head;           /* Oldest queued frame */
+    int                     count;          /* Number of queued frames */
+
+    volatile int            finish;
+    volatile int            finished;
+
+    unsigned long           captured;       /* Frames taken from the device */
+    unsigned long           consumed;       /* Frames handed to the motion loop */
+    unsigned long           dropped;        /* Frames dropped for a newer one at the idle framerate */
+    unsigned long           stalls;         /* Times capture waited on a full queue */
+    int                     depth_max;      /* Highest number of queued frames seen */
+};
+
+void capture_start(struct context *cnt);
+void capture_stop(struct context *cnt);
+int capture_next(struct context *cnt, struct image_data *img_data);
+void capture_lock(struct context *cnt);
+void capture_unlock(struct context *cnt);
+
+#endif /* _INCLUDE_CAPTURE_H */
@@ -0,0 +1,1189 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *    cluster.c
+ *
+ *    Cameras shared out over several Motion nodes.
+ *
+ *    All the nodes read the same camera config files.  One of them is the
+ *    coordinator and decides which node runs each camera, the other nodes
+ *    only run the cameras they are given.  Every cluster_heartbeat seconds a
+ *    node posts to /cluster/heartbeat on the stream_port of the coordinator
+ *    the cameras it is running, with the CPU each of them took since the
+ *    last heartbeat, and gets back the cameras it is to run.  The CPU of a
+ *    camera is the time of the stages of its motion loop other than the
+ *    capture, which includes the wait for the camera.
+ *
+ *    The coordinator is a node of the cluster as well.  A camera without a
+ *    node goes to the node which then has the least load for each CPU core.
+ *    Every CLUSTER_BALANCE heartbeats one camera may be moved from the node
+ *    with the most load to the one with the least when that lowers the most
+ *    load by a tenth.  The node a camera moves to only gets it after the old
+ *    node stopped it so a camera never records twice.  A node that misses
+ *    CLUSTER_LOST heartbeats is lost and its cameras are given to the other
+ *    nodes.  After it starts the coordinator waits just as long before it
+ *    gives out cameras so the running nodes can report theirs first.
+ *
+ *    A node which can not reach the coordinator keeps running its cameras.
+ *
+ *    The coordinator answers /cluster.json with the nodes and cameras of the
+ *    cluster, adds the node of each camera to its status.json and sends the
+ *    streams of the cameras of other nodes to those nodes with a redirect.
+ *
+ *    Heartbeat, one line for the node and one for each camera it runs
+ *      node {name} {cpu cores} {url}
+ *      cam {camera_id} {running} {permille of a core or -1} {fps}
+ *    Answer, the cameras the node is to run
+ *      assigned
+ *      cam {camera_id}
+ */
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include "translate.h"
+#include "motion.h"
+#include "util.h"
+#include "logger.h"
+#include "metrics.h"
+#include "netcam.h"
+#include "netcam_wget.h"
+#include "webu.h"
+#include "cluster.h"
+
+#define CLUSTER_NODES_MAX   64      /* Nodes of a cluster including the coordinator */
+#define CLUSTER_LOST        3       /* Missed heartbeats before a node is lost */
+#define CLUSTER_BALANCE     12      /* Heartbeats between the moves of cameras for the load */
+#define CLUSTER_LOAD        100     /* Permille of a core for a camera when none was measured */
+#define CLUSTER_TIMEOUT     5       /* Seconds to wait for the coordinator */
+
+enum CLUSTER_MODE {
+    CLUSTER_OFF,
+    CLUSTER_COORDINATOR,
+    CLUSTER_NODE
+};
+
+struct cluster_node {
+    char                name[CLUSTER_NAME_LEN];
+    char                url[CLUSTER_URL_LEN];   /* Stream port of the node */
+    int                 cores;
+    int                 alive;
+    time_t              seen;                   /* Time of the last heartbeat */
+};
+
+struct cluster_cam {
+    struct context      *cnt;
+    int                 node;           /* Node the camera is given to, -1 for none */
+    int                 reported;       /* Node which runs the camera, -1 for none */
+    int                 running;
+    int                 fps;
+    int                 load;           /* Permille of a core, -1 when not measured */
+    unsigned long long  usec_last;      /* Loop time of the camera at the last heartbeat */
+    int                 usec_valid;
+};
+
+static struct {
+    pthread_mutex_t         mutex;
+    pthread_cond_t          cond;           /* Signalled when finishing */
+    pthread_t               thread_id;
+    int                     running;
+    int                     finish;
+    enum CLUSTER_MODE       mode;
+    int                     interval;       /* Seconds between the heartbeats */
+    struct cluster_node     nodes[CLUSTER_NODES_MAX];   /* First one is this node */
+    int                     node_count;
+    struct cluster_cam      *cams;
+    int                     cam_count;
+    time_t                  started;
+    time_t                  balanced;       /* Time a camera was last moved for the load */
+    struct timeval          measured;       /* Time the loads were last measured */
+    char                    host[CLUSTER_URL_LEN];      /* Of the coordinator */
+    char                    port[8];
+    char                    *auth;          /* Authorization header for the coordinator */
+    int                     reachable;      /* The coordinator answered the last heartbeat */
+} cluster = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .mode = CLUSTER_OFF,
+};
+
+/* Wait for usec or until finishing.  Returns TRUE when finishing. */
+static int cluster_wait(long usec)
+{
+    struct timespec ts;
+    struct timeval tv;
+    int finish;
+
+    gettimeofday(&tv, NULL);
+    usec += tv.tv_usec;
+    ts.tv_sec = tv.tv_sec + (usec / 1000000L);
+    ts.tv_nsec = (usec % 1000000L) * 1000;
+
+    pthread_mutex_lock(&cluster.mutex);
+        while (!cluster.finish) {
+            if (pthread_cond_timedwait(&cluster.cond, &cluster.mutex, &ts) == ETIMEDOUT) {
+                break;
+            }
+        }
+        finish = cluster.finish;
+    pthread_mutex_unlock(&cluster.mutex);
+
+    return finish;
+}
+
+/* Node names are put in the json and the heartbeats without quoting */
+static int cluster_name_valid(const char *name)
+{
+    if (*name == '\0') {
+        return FALSE;
+    }
+    for (; *name != '\0'; name++) {
+        if (!isalnum((unsigned char)*name) && (strchr("._-", *name) == NULL)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static int cluster_url_valid(const char *url)
+{
+    if (strncmp(url, "http://", 7) && strncmp(url, "https://", 8)) {
+        return FALSE;
+    }
+    for (; *url != '\0'; url++) {
+        if (!isgraph((unsigned char)*url) || (strchr("\"\\<>", *url) != NULL)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static struct cluster_cam *cluster_cam_find(int camera_id)
+{
+    int indx;
+
+    for (indx = 0; indx < cluster.cam_count; indx++) {
+        if (cluster.cams[indx].cnt->camera_id == camera_id) {
+            return &cluster.cams[indx];
+        }
+    }
+    return NULL;
+}
+
+static struct cluster_cam *cluster_cam_context(struct context *cnt)
+{
+    int indx;
+
+    for (indx = 0; indx < cluster.cam_count; indx++) {
+        if (cluster.cams[indx].cnt == cnt) {
+            return &cluster.cams[indx];
+        }
+    }
+    return NULL;
+}
+
+/* Whether the node is to run the camera.  Not before the node running it stopped it. */
+static int cluster_assigned(struct cluster_cam *cam, int node)
+{
+    return (cam->node == node) &&
+        ((cam->reported < 0) || (cam->reported == node) ||
+         !cluster.nodes[cam->reported].alive);
+}
+
+/* The node the camera runs on, or is about to run on */
+static int cluster_cam_node(struct cluster_cam *cam)
+{
+    return (cam->reported >= 0) ? cam->reported : cam->node;
+}
+
+/* Measure the cameras of this node, the load is taken over elapsed usec */
+static void cluster_measure(void)
+{
+    struct cluster_cam *cam;
+    struct metrics_hist hist;
+    struct timeval now;
+    unsigned long long usec;
+    int64_t elapsed;
+    int indx, stage;
+
+    gettimeofday(&now, NULL);
+    elapsed = (now.tv_sec - cluster.measured.tv_sec) * 1000000LL +
+        (now.tv_usec - cluster.measured.tv_usec);
+    cluster.measured = now;
+
+    for (indx = 0; indx < cluster.cam_count; indx++) {
+        cam = &cluster.cams[indx];
+        /* On the coordinator, a camera of another node */
+        if (cam->reported > 0) {
+            cam->usec_valid = FALSE;
+            continue;
+        }
+        cam->running = cam->cnt->running;
+        if (!cam->cnt->running || cam->cnt->connecting) {
+            cam->usec_valid = FALSE;
+            continue;
+        }
+        metrics_snapshot(cam->cnt, &hist);
+        usec = 0;
+        for (stage = 0; stage < METRICS_STAGES; stage++) {
+            if (stage != METRICS_CAPTURE) {
+                usec += hist.sum_usec[stage];
+            }
+        }
+        /* The metrics start again with the camera */
+        if (cam->usec_valid && (usec >= cam->usec_last) && (elapsed > 0)) {
+            cam->load = (int)(((usec - cam->usec_last) * 1000) / elapsed);
+        }
+        cam->usec_last = usec;
+        cam->usec_valid = TRUE;
+        cam->fps = (int)cam->cnt->lastrate;
+    }
+}
+
+/* Load used for the cameras not measured yet, the average of the others */
+static int cluster_load_default(void)
+{
+    long long sum;
+    int indx, count;
+
+    sum = 0;
+    count = 0;
+    for (indx = 0; indx < cluster.cam_count; indx++) {
+        if (cluster.cams[indx].load >= 0) {
+            sum += cluster.cams[indx].load;
+            count++;
+        }
+    }
+    if ((count == 0) || (sum == 0)) {
+        return CLUSTER_LOAD;
+    }
+    return (int)(sum / count);
+}
+
+/* Load of the cameras given to each node */
+static void cluster_node_loads(int *loads, int load_default)
+{
+    struct cluster_cam *cam;
+    int indx;
+
+    memset(loads, 0, sizeof(int) * CLUSTER_NODES_MAX);
+    for (indx = 0; indx < cluster.cam_count; indx++) {
+        cam = &cluster.cams[indx];
+        if (cam->node >= 0) {
+            loads[cam->node] += (cam->load >= 0) ? cam->load : load_default;
+        }
+    }
+}
+
+/* Give the cameras without a node, the heaviest first, to the least loaded nodes */
+static void cluster_assign(void)
+{
+    struct cluster_cam *cam, *cam_max;
+    int loads[CLUSTER_NODES_MAX];
+    int load_default, load, load_max, score, score_min;
+    int indx, node;
+
+    load_default = cluster_load_default();
+    cluster_node_loads(loads, load_default);
+
+    while (TRUE) {
+        cam_max = NULL;
+        load_max = -1;
+        for (indx = 0; indx < cluster.cam_count; indx++) {
+            cam = &cluster.cams[indx];
+            load = (cam->load >= 0) ? cam->load : load_default;
+            if ((cam->node < 0) && (load > load_max)) {
+                cam_max = cam;
+                load_max = load;
+            }
+        }
+        if (cam_max == NULL) {
+            return;
+        }
+
+        node = 0;
+        score_min = INT_MAX;
+        for (indx = 0; indx < cluster.node_count; indx++) {
+            if (!cluster.nodes[indx].alive) {
+                continue;
+            }
+            score = (loads[indx] + load_max) / cluster.nodes[indx].cores;
+            if (score < score_min) {
+                score_min = score;
+                node = indx;
+            }
+        }
+        cam_max->node = node;
+        loads[node] += load_max;
+
+        MOTION_LOG(INF, TYPE_ALL, NO_ERRNO
+            ,_("Camera ID: %d given to node %s")
+            ,cam_max->cnt->camera_id, cluster.nodes[node].name);
+    }
+}
+
+/* Move one camera from the node with the most load to the one with the least */
+static void cluster_balance(void)
+{
+    struct cluster_cam *cam, *cam_best;
+    int loads[CLUSTER_NODES_MAX];
+    int indx, node_hi, node_lo, score, load_hi, load_lo, after, after_best;
+
+    cluster_node_loads(loads, cluster_load_default());
+
+    node_hi = -1;
+    node_lo = -1;
+    load_hi = -1;
+    load_lo = INT_MAX;
+    for (indx = 0; indx < cluster.node_count; indx++) {
+        if (!cluster.nodes[indx].alive) {
+            continue;
+        }
+        score = loads[indx] / cluster.nodes[indx].cores;
+        if (score > load_hi) {
+            load_hi = score;
+            node_hi = indx;
+        }
+        if (score < load_lo) {
+            load_lo = score;
+            node_lo = indx;
+        }
+    }
+    if ((node_hi < 0) || (node_hi == node_lo)) {
+        return;
+    }
+
+    cam_best = NULL;
+    after_best = load_hi;
+    for (indx = 0; indx < cluster.cam_count; indx++) {
+        cam = &cluster.cams[indx];
+        if ((cam->node != node_hi) || (cam->reported != node_hi) || (cam->load < 0)) {
+            continue;
+        }
+        after = MAX((loads[node_hi] - cam->load) / cluster.nodes[node_hi].cores
+            , (loads[node_lo] + cam->load) / cluster.nodes[node_lo].cores);
+        if (after < after_best) {
+            after_best = after;
+            cam_best = cam;
+        }
+    }
+    if ((cam_best == NULL) || ((after_best * 10) >= (load_hi * 9))) {
+        return;
+    }
+
+    cam_best->node = node_lo;
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+        ,_("Camera ID: %d moves from node %s to node %s for the load")
+        ,cam_best->cnt->camera_id, cluster.nodes[node_hi].name
+        ,cluster.nodes[node_lo].name);
+}
+
+/* Round of the coordinator, run every heartbeat */
+static void cluster_coordinate(void)
+{
+    struct cluster_cam *cam;
+    time_t now;
+    int indx, node;
+
+    now = time(NULL);
+
+    pthread_mutex_lock(&cluster.mutex);
+        cluster.nodes[0].seen = now;
+        cluster_measure();
+        for (indx = 0; indx < cluster.cam_count; indx++) {
+            cam = &cluster.cams[indx];
+            if (cam->reported <= 0) {
+                cam->reported = cam->running ? 0 : -1;
+            }
+        }
+
+        for (node = 1; node < cluster.node_count; node++) {
+            if (!cluster.nodes[node].alive ||
+                ((now - cluster.nodes[node].seen) <= (CLUSTER_LOST * cluster.interval))) {
+                continue;
+            }
+            cluster.nodes[node].alive = FALSE;
+            MOTION_LOG(WRN, TYPE_ALL, NO_ERRNO
+                ,_("Node %s is lost, its cameras are given to the other nodes")
+                ,cluster.nodes[node].name);
+            for (indx = 0; indx < cluster.cam_count; indx++) {
+                cam = &cluster.cams[indx];
+                if (cam->node == node) {
+                    cam->node = -1;
+                }
+                if (cam->reported == node) {
+                    cam->reported = -1;
+                    cam->running = FALSE;
+                }
+            }
+        }
+
+        /* Cameras of this node after the cluster started again */
+        for (indx = 0; indx < cluster.cam_count; indx++) {
+            cam = &cluster.cams[indx];
+            if ((cam->node < 0) && (cam->reported == 0)) {
+                cam->node = 0;
+            }
+        }
+
+        if ((now - cluster.started) >= (CLUSTER_LOST * cluster.interval)) {
+            cluster_assign();
+            if ((now - cluster.balanced) >= (CLUSTER_BALANCE * cluster.interval)) {
+                cluster_balance();
+                cluster.balanced = now;
+            }
+        }
+
+        for (indx = 0; indx < cluster.cam_count; indx++) {
+            cam = &cluster.cams[indx];
+            cam->cnt->cluster_hosted = cluster_assigned(cam, 0);
+        }
+    pthread_mutex_unlock(&cluster.mutex);
+}
+
+static int cluster_send(int fd, const char *buf, size_t len)
+{
+    ssize_t sent;
+
+    while (len > 0) {
+        sent = send(fd, buf, len, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            if ((sent < 0) && (errno == EINTR)) {
+                continue;
+            }
+            return -1;
+        }
+        buf += sent;
+        len -= (size_t)sent;
+    }
+    return 0;
+}
+
+static int cluster_connect(void)
+{
+    struct addrinfo hints, *res, *ai;
+    struct timeval tmo;
+    int fd;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(cluster.host, cluster.port, &hints, &res) != 0) {
+        return -1;
+    }
+
+    tmo.tv_sec = CLUSTER_TIMEOUT;
+    tmo.tv_usec = 0;
+    fd = -1;
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tmo, sizeof(tmo));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    return fd;
+}
+
+/**
+ * cluster_post
+ *      Post the heartbeat to the coordinator.  Returns the body of the
+ *      answer, to be freed, or NULL when the coordinator did not answer.
+ */
+static char *cluster_post(const char *body, size_t body_len)
+{
+    char head[CLUSTER_URL_LEN * 2 + 256];
+    char *buf, *pos;
+    size_t size, used;
+    ssize_t len;
+    int fd, status;
+
+    fd = cluster_connect();
+    if (fd < 0) {
+        return NULL;
+    }
+
+    len = snprintf(head, sizeof(head),
+        "POST /cluster/heartbeat HTTP/1.0\r\n"
+        "Host: %s:%s\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: %lu\r\n"
+        "%s%s%s"
+        "Connection: close\r\n\r\n"
+        , cluster.host, cluster.port, (unsigned long)body_len
+        , (cluster.auth != NULL) ? "Authorization: Basic " : ""
+        , (cluster.auth != NULL) ? cluster.auth : ""
+        , (cluster.auth != NULL) ? "\r\n" : "");
+    if ((len >= (ssize_t)sizeof(head)) ||
+        (cluster_send(fd, head, (size_t)len) != 0) ||
+        (cluster_send(fd, body, body_len) != 0)) {
+        close(fd);
+        return NULL;
+    }
+
+    size = 4096;
+    used = 0;
+    buf = mymalloc(size);
+    while (TRUE) {
+        if ((used + 1) >= size) {
+            if (size >= CLUSTER_BEAT_MAX) {
+                break;
+            }
+            size *= 2;
+            buf = myrealloc(buf, size, "cluster_post");
+        }
+        len = recv(fd, buf + used, size - used - 1, 0);
+        if ((len < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (len <= 0) {
+            break;
+        }
+        used += (size_t)len;
+    }
+    close(fd);
+    buf[used] = '\0';
+
+    pos = strstr(buf, "\r\n\r\n");
+    if ((sscanf(buf, "HTTP/%*d.%*d %d", &status) != 1) || (status != 200) || (pos == NULL)) {
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO
+            ,_("Coordinator answered the heartbeat with %.40s"), buf);
+        free(buf);
+        return NULL;
+    }
+    pos += 4;
+    memmove(buf, pos, strlen(pos) + 1);
+
+    return buf;
+}
+
+/* Heartbeat of a node to the coordinator */
+static void cluster_heartbeat(void)
+{
+    struct cluster_cam *cam;
+    char *body, *answer, *line, *saveptr;
+    size_t size, used;
+    int indx, camera_id;
+
+    pthread_mutex_lock(&cluster.mutex);
+        cluster_measure();
+        size = CLUSTER_URL_LEN + 128 + (cluster.cam_count * 64);
+        body = mymalloc(size);
+        used = snprintf(body, size, "node %s %d %s\n"
+            , cluster.nodes[0].name, cluster.nodes[0].cores, cluster.nodes[0].url);
+        for (indx = 0; indx < cluster.cam_count; indx++) {
+            cam = &cluster.cams[indx];
+            if (cam->running) {
+                used += snprintf(body + used, size - used, "cam %d 1 %d %d\n"
+                    , cam->cnt->camera_id, cam->usec_valid ? cam->load : -1, cam->fps);
+            }
+        }
+    pthread_mutex_unlock(&cluster.mutex);
+
+    answer = cluster_post(body, used);
+    free(body);
+
+    if (answer == NULL) {
+        if (cluster.reachable) {
+            MOTION_LOG(WRN, TYPE_ALL, NO_ERRNO
+                ,_("Unable to reach the coordinator %s:%s, the cameras keep running")
+                ,cluster.host, cluster.port);
+            cluster.reachable = FALSE;
+        }
+        return;
+    }
+
+    line = strtok_r(answer, "\n", &saveptr);
+    if ((line == NULL) || mystrne(line, "assigned")) {
+        MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
+            ,_("Coordinator refused the heartbeat: %.80s")
+            ,(line != NULL) ? line : "");
+        free(answer);
+        return;
+    }
+
+    pthread_mutex_lock(&cluster.mutex);
+        for (indx = 0; indx < cluster.cam_count; indx++) {
+            cluster.cams[indx].node = -1;
+        }
+        while ((line = strtok_r(NULL, "\n", &saveptr)) != NULL) {
+            if (sscanf(line, "cam %d", &camera_id) != 1) {
+                continue;
+            }
+            cam = cluster_cam_find(camera_id);
+            if (cam != NULL) {
+                cam->node = 0;
+            }
+        }
+        for (indx = 0; indx < cluster.cam_count; indx++) {
+            cam = &cluster.cams[indx];
+            cam->cnt->cluster_hosted = (cam->node == 0);
+        }
+    pthread_mutex_unlock(&cluster.mutex);
+    free(answer);
+
+    if (!cluster.reachable) {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("Joined the cluster of the coordinator %s:%s"), cluster.host, cluster.port);
+        cluster.reachable = TRUE;
+    }
+}
+
+static void *cluster_handler(void *arg)
+{
+    (void)arg;
+
+    util_threadname_set("cl", 0, NULL);
+
+    while (TRUE) {
+        if (cluster.mode == CLUSTER_COORDINATOR) {
+            cluster_coordinate();
+        } else {
+            cluster_heartbeat();
+        }
+        if (cluster_wait(cluster.interval * 1000000L)) {
+            break;
+        }
+    }
+
+    pthread_exit(NULL);
+}
+
+/* Node mode: split host:port of the coordinator, with or without http:// */
+static int cluster_init_coordinator(const char *addr)
+{
+    const char *host, *port;
+    size_t len;
+
+    if ((addr == NULL) || (*addr == '\0')) {
+        return -1;
+    }
+    if (strncmp(addr, "http://", 7) == 0) {
+        addr += 7;
+    }
+    host = addr;
+    port = strrchr(addr, ':');
+    if ((port == NULL) || (port[1] == '\0') || (strlen(port + 1) >= sizeof(cluster.port))) {
+        return -1;
+    }
+    len = port - host;
+    if ((len > 1) && (host[0] == '[') && (host[len - 1] == ']')) {
+        host++;
+        len -= 2;
+    }
+    if ((len == 0) || (len >= sizeof(cluster.host))) {
+        return -1;
+    }
+    memcpy(cluster.host, host, len);
+    cluster.host[len] = '\0';
+    snprintf(cluster.port, sizeof(cluster.port), "%s", port + 1);
+    while (len > 0 && cluster.host[len - 1] == '/') {
+        cluster.host[--len] = '\0';
+    }
+    if (strchr(cluster.port, '/') != NULL) {
+        *strchr(cluster.port, '/') = '\0';
+    }
+
+    return 0;
+}
+
+/* Basic authentication with the stream_authentication for the heartbeats of a node.
+ * Returns -1 when the stream uses digest, which is not supported for the heartbeats.
+ */
+static int cluster_init_auth(struct context *cnt)
+{
+    char *userpass;
+
+    cluster.auth = NULL;
+    if ((cnt->conf.stream_auth_method == 0) || (cnt->conf.stream_authentication == NULL)) {
+        return 0;
+    }
+    if (cnt->conf.stream_auth_method != 1) {
+        MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
+            ,_("The heartbeats only use basic authentication, set stream_auth_method to 1"
+            ", the cameras run without a cluster"));
+        return -1;
+    }
+    if (cluster.mode != CLUSTER_NODE) {
+        return 0;
+    }
+
+    /* motion_base64_encode needs up to 3 additional chars. */
+    userpass = mymalloc(strlen(cnt->conf.stream_authentication) + 3);
+    strcpy(userpass, cnt->conf.stream_authentication);
+    cluster.auth = mymalloc(BASE64_LENGTH(strlen(userpass)) + 1);
+    motion_base64_encode(userpass, cluster.auth, strlen(userpass));
+    free(userpass);
+
+    return 0;
+}
+
+static void cluster_init_node(struct context *cnt)
+{
+    struct cluster_node *node;
+    long cores;
+
+    node = &cluster.nodes[0];
+    memset(node, 0, sizeof(struct cluster_node));
+
+    if ((cnt->conf.cluster_node_name != NULL) && (cnt->conf.cluster_node_name[0] != '\0')) {
+        snprintf(node->name, sizeof(node->name), "%s", cnt->conf.cluster_node_name);
+    } else {
+        snprintf(node->name, sizeof(node->name), "%.63s", cnt->hostname);
+    }
+
+    if ((cnt->conf.cluster_node_url != NULL) && (cnt->conf.cluster_node_url[0] != '\0')) {
+        snprintf(node->url, sizeof(node->url), "%s", cnt->conf.cluster_node_url);
+    } else {
+        snprintf(node->url, sizeof(node->url), "%s://%.200s:%d"
+            , cnt->conf.stream_tls ? "https" : "http", cnt->hostname, cnt->conf.stream_port);
+    }
+    while ((strlen(node->url) > 0) && (node->url[strlen(node->url) - 1] == '/')) {
+        node->url[strlen(node->url) - 1] = '\0';
+    }
+
+    cores = sysconf(_SC_NPROCESSORS_ONLN);
+    node->cores = (cores > 0) ? (int)cores : 1;
+    node->alive = TRUE;
+    node->seen = time(NULL);
+    cluster.node_count = 1;
+}
+
+/**
+ * cluster_init
+ *      Start the cluster thread when cluster_mode is set.  Without a cluster
+ *      every camera runs on this node.
+ */
+void cluster_init(struct context **cntlist)
+{
+    struct context *cnt;
+    const char *mode;
+    int indx, count;
+
+    cnt = cntlist[0];
+    mode = cnt->conf.cluster_mode;
+
+    pthread_mutex_lock(&cluster.mutex);
+        cluster.running = FALSE;
+        cluster.finish = FALSE;
+        cluster.mode = CLUSTER_OFF;
+        if ((mode == NULL) || mystreq(mode, "off")) {
+            cluster.mode = CLUSTER_OFF;
+        } else if (mystreq(mode, "coordinator")) {
+            cluster.mode = CLUSTER_COORDINATOR;
+        } else if (mystreq(mode, "node")) {
+            cluster.mode = CLUSTER_NODE;
+        } else {
+            MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
+                ,_("Unknown cluster_mode %s, the cameras run without a cluster"), mode);
+        }
+
+        if ((cluster.mode != CLUSTER_OFF) && (cnt->conf.stream_port == 0)) {
+            MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
+                ,_("The cluster needs the stream_port, the cameras run without a cluster"));
+            cluster.mode = CLUSTER_OFF;
+        }
+        if ((cluster.mode == CLUSTER_NODE) &&
+            (cluster_init_coordinator(cnt->conf.cluster_coordinator) != 0)) {
+            MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
+                ,_("Invalid cluster_coordinator %s, the cameras run without a cluster")
+                ,(cnt->conf.cluster_coordinator != NULL) ? cnt->conf.cluster_coordinator : "");
+            cluster.mode = CLUSTER_OFF;
+        }
+        if (cluster.mode != CLUSTER_OFF) {
+            cluster_init_node(cnt);
+            if (!cluster_name_valid(cluster.nodes[0].name) ||
+                !cluster_url_valid(cluster.nodes[0].url)) {
+                MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
+                    ,_("Invalid cluster_node_name %s or cluster_node_url %s"
+                    ", the cameras run without a cluster")
+                    ,cluster.nodes[0].name, cluster.nodes[0].url);
+                cluster.mode = CLUSTER_OFF;
+            }
+        }
+        /* A node whose heartbeats are all refused would be lost and its cameras recorded twice */
+        if ((cluster.mode != CLUSTER_OFF) && (cluster_init_auth(cnt) != 0)) {
+            cluster.mode = CLUSTER_OFF;
+        }
+
+        count = 0;
+        for (indx = (cntlist[1] != NULL ? 1 : 0); cntlist[indx] != NULL; indx++) {
+            cntlist[indx]->cluster_hosted = (cluster.mode == CLUSTER_OFF);
+            count++;
+        }
+        if (cluster.mode == CLUSTER_OFF) {
+            pthread_mutex_unlock(&cluster.mutex);
+            return;
+        }
+
+        cluster.cams = mymalloc(count * sizeof(struct cluster_cam));
+        cluster.cam_count = count;
+        for (indx = 0; indx < count; indx++) {
+            cluster.cams[indx].cnt = cntlist[indx + (cntlist[1] != NULL ? 1 : 0)];
+            cluster.cams[indx].node = -1;
+            cluster.cams[indx].reported = -1;
+            cluster.cams[indx].load = -1;
+        }
+
+        cluster.interval = MAX(cnt->conf.cluster_heartbeat, 1);
+        cluster.started = time(NULL);
+        cluster.balanced = cluster.started;
+        gettimeofday(&cluster.measured, NULL);
+        cluster.reachable = FALSE;
+    pthread_mutex_unlock(&cluster.mutex);
+
+    if (pthread_create(&cluster.thread_id, NULL, &cluster_handler, NULL) != 0) {
+        MOTION_LOG(ERR, TYPE_ALL, SHOW_ERRNO
+            ,_("Unable to start the cluster thread, the cameras run without a cluster"));
+        cluster_deinit();
+        for (indx = (cntlist[1] != NULL ? 1 : 0); cntlist[indx] != NULL; indx++) {
+            cntlist[indx]->cluster_hosted = TRUE;
+        }
+        return;
+    }
+    cluster.running = TRUE;
+
+    if (cluster.mode == CLUSTER_COORDINATOR) {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("Cluster coordinator %s of %d cameras started")
+            ,cluster.nodes[0].name, cluster.cam_count);
+    } else {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("Cluster node %s of the coordinator %s:%s started")
+            ,cluster.nodes[0].name, cluster.host, cluster.port);
+    }
+}
+
+/** cluster_deinit
+ *  Stop the cluster thread.  The cameras are stopped by then.
+ */
+void cluster_deinit(void)
+{
+    if (cluster.running) {
+        pthread_mutex_lock(&cluster.mutex);
+            cluster.finish = TRUE;
+            pthread_cond_broadcast(&cluster.cond);
+        pthread_mutex_unlock(&cluster.mutex);
+
+        pthread_join(cluster.thread_id, NULL);
+        cluster.running = FALSE;
+    }
+
+    pthread_mutex_lock(&cluster.mutex);
+        cluster.mode = CLUSTER_OFF;
+        free(cluster.cams);
+        cluster.cams = NULL;
+        cluster.cam_count = 0;
+        cluster.node_count = 0;
+        free(cluster.auth);
+        cluster.auth = NULL;
+    pthread_mutex_unlock(&cluster.mutex);
+}
+
+/* Whether this Motion is part of a cluster and waits for cameras to run */
+int cluster_active(void)
+{
+    return (cluster.mode != CLUSTER_OFF);
+}
+
+/* Whether this Motion is the coordinator the nodes post their heartbeats to */
+int cluster_coordinator(void)
+{
+    return (cluster.mode == CLUSTER_COORDINATOR);
+}
+
+/**
+ * cluster_report
+ *      Where the camera runs.  Returns FALSE when there is no cluster.
+ */
+int cluster_report(struct context *cnt, struct cluster_report *report)
+{
+    struct cluster_cam *cam;
+    int node;
+
+    memset(report, 0, sizeof(struct cluster_report));
+    report->load = -1;
+
+    if (cluster.mode == CLUSTER_OFF) {
+        return FALSE;
+    }
+
+    pthread_mutex_lock(&cluster.mutex);
+        cam = cluster_cam_context(cnt);
+        if (cam == NULL) {
+            pthread_mutex_unlock(&cluster.mutex);
+            return FALSE;
+        }
+        if (cluster.mode == CLUSTER_COORDINATOR) {
+            node = cluster_cam_node(cam);
+        } else {
+            node = cnt->cluster_hosted ? 0 : -1;
+        }
+        if (node >= 0) {
+            snprintf(report->node, sizeof(report->node), "%s", cluster.nodes[node].name);
+        }
+        report->remote = (node > 0);
+        report->running = cam->running;
+        report->fps = cam->fps;
+        report->load = cam->load;
+    pthread_mutex_unlock(&cluster.mutex);
+
+    return TRUE;
+}
+
+/**
+ * cluster_route
+ *      On the coordinator, the stream url of the node running the camera
+ *      when that is another node.  url may be NULL to only check that.
+ */
+int cluster_route(struct context *cnt, char *url, size_t url_size)
+{
+    struct cluster_cam *cam;
+    int node, retcd;
+
+    if (cluster.mode != CLUSTER_COORDINATOR) {
+        return FALSE;
+    }
+
+    retcd = FALSE;
+    pthread_mutex_lock(&cluster.mutex);
+        cam = cluster_cam_context(cnt);
+        if (cam != NULL) {
+            node = cluster_cam_node(cam);
+            if ((node > 0) && cluster.nodes[node].alive) {
+                if (url != NULL) {
+                    snprintf(url, url_size, "%s", cluster.nodes[node].url);
+                }
+                retcd = TRUE;
+            }
+        }
+    pthread_mutex_unlock(&cluster.mutex);
+
+    return retcd;
+}
+
+static void cluster_webu_node(struct webui_ctx *webui, int node, time_t now)
+{
+    char buf[CLUSTER_URL_LEN + CLUSTER_NAME_LEN + 160];
+    int indx, count, load;
+
+    count = 0;
+    load = 0;
+    for (indx = 0; indx < cluster.cam_count; indx++) {
+        if (cluster_cam_node(&cluster.cams[indx]) == node) {
+            count++;
+            load += MAX(cluster.cams[indx].load, 0);
+        }
+    }
+
+    snprintf(buf, sizeof(buf),
+        "{\"name\": \"%s\", \"url\": \"%s\", \"alive\": %s, \"cores\": %d"
+        ", \"cameras\": %d, \"load\": %d, \"seen_elapsed\": %ld}"
+        , cluster.nodes[node].name, cluster.nodes[node].url
+        , cluster.nodes[node].alive ? "true" : "false"
+        , cluster.nodes[node].cores, count, load
+        , (long)(now - cluster.nodes[node].seen));
+    webu_write(webui, buf);
+}
+
+/**
+ * cluster_webu_status
+ *      Answer /cluster.json with the nodes and the cameras of the cluster.
+ *      A node only knows its own cameras.
+ */
+void cluster_webu_status(struct webui_ctx *webui)
+{
+    struct cluster_cam *cam;
+    char buf[CLUSTER_URL_LEN + CLUSTER_NAME_LEN + 160];
+    time_t now;
+    int indx, node, first;
+
+    now = time(NULL);
+
+    pthread_mutex_lock(&cluster.mutex);
+        if (cluster.mode == CLUSTER_OFF) {
+            webu_write(webui, "{\"mode\": \"off\"}\n");
+            pthread_mutex_unlock(&cluster.mutex);
+            return;
+        }
+
+        if (cluster.mode == CLUSTER_COORDINATOR) {
+            webu_write(webui, "{\"mode\": \"coordinator\", \"nodes\": [");
+            for (indx = 0; indx < cluster.node_count; indx++) {
+                if (indx > 0) {
+                    webu_write(webui, ", ");
+                }
+                cluster_webu_node(webui, indx, now);
+            }
+            webu_write(webui, "]");
+        } else {
+            snprintf(buf, sizeof(buf),
+                "{\"mode\": \"node\", \"coordinator\": \"%s:%s\", \"reachable\": %s"
+                ", \"nodes\": ["
+                , cluster.host, cluster.port, cluster.reachable ? "true" : "false");
+            webu_write(webui, buf);
+            cluster_webu_node(webui, 0, now);
+            webu_write(webui, "]");
+        }
+
+        webu_write(webui, ", \"cameras\": [");
+        first = TRUE;
+        for (indx = 0; indx < cluster.cam_count; indx++) {
+            cam = &cluster.cams[indx];
+            node = cluster_cam_node(cam);
+            if ((cluster.mode == CLUSTER_NODE) && (node != 0)) {
+                continue;
+            }
+            snprintf(buf, sizeof(buf),
+                "%s{\"id\": %d, \"node\": %s%s%s, \"running\": %s, \"fps\": %d, \"load\": %d}"
+                , first ? "" : ", "
+                , cam->cnt->camera_id
+                , (node >= 0) ? "\"" : ""
+                , (node >= 0) ? cluster.nodes[node].name : "null"
+                , (node >= 0) ? "\"" : ""
+                , cam->running ? "true" : "false"
+                , cam->fps, cam->load);
+            webu_write(webui, buf);
+            first = FALSE;
+        }
+        webu_write(webui, "]}\n");
+    pthread_mutex_unlock(&cluster.mutex);
+}
+
+/* Find or add the node of a heartbeat.  Returns -1 when it is refused. */
+static int cluster_beat_node(char *line, const char **error)
+{
+    char name[CLUSTER_NAME_LEN], url[CLUSTER_URL_LEN];
+    int indx, cores;
+
+    if ((sscanf(line, "node %63s %d %255s", name, &cores, url) != 3) ||
+        !cluster_name_valid(name) || !cluster_url_valid(url)) {
+        *error = "invalid node";
+        return -1;
+    }
+    if (mystreq(name, cluster.nodes[0].name)) {
+        *error = "node name of the coordinator";
+        return -1;
+    }
+
+    for (indx = 1; indx < cluster.node_count; indx++) {
+        if (mystreq(cluster.nodes[indx].name, name)) {
+            break;
+        }
+    }
+    if (indx == cluster.node_count) {
+        if (cluster.node_count == CLUSTER_NODES_MAX) {
+            *error = "too many nodes";
+            return -1;
+        }
+        cluster.node_count++;
+        snprintf(cluster.nodes[indx].name, CLUSTER_NAME_LEN, "%s", name);
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Node %s joined the cluster"), name);
+    } else if (!cluster.nodes[indx].alive) {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Node %s is back in the cluster"), name);
+    }
+
+    snprintf(cluster.nodes[indx].url, CLUSTER_URL_LEN, "%s", url);
+    cluster.nodes[indx].cores = MAX(cores, 1);
+    cluster.nodes[indx].alive = TRUE;
+    cluster.nodes[indx].seen = time(NULL);
+
+    return indx;
+}
+
+/**
+ * cluster_webu_beat
+ *      Answer the heartbeat of a node posted to /cluster/heartbeat with the
+ *      cameras it is to run.
+ */
+void cluster_webu_beat(struct webui_ctx *webui)
+{
+    struct cluster_cam *cam;
+    const char *error;
+    char *line, *saveptr;
+    char buf[32];
+    int indx, node, camera_id, running, load, fps;
+
+    if (webui->post_data == NULL) {
+        webu_write(webui, "error no heartbeat\n");
+        return;
+    }
+
+    error = NULL;
+    pthread_mutex_lock(&cluster.mutex);
+        node = -1;
+        line = strtok_r(webui->post_data, "\n", &saveptr);
+        if (cluster.mode != CLUSTER_COORDINATOR) {
+            error = "not a coordinator";
+        } else if (line == NULL) {
+            error = "no heartbeat";
+        } else {
+            node = cluster_beat_node(line, &error);
+        }
+        if (node < 0) {
+            pthread_mutex_unlock(&cluster.mutex);
+            webu_write(webui, "error ");
+            webu_write(webui, error);
+            webu_write(webui, "\n");
+            return;
+        }
+
+        for (indx = 0; indx < cluster.cam_count; indx++) {
+            cam = &cluster.cams[indx];
+            if (cam->reported == node) {
+                cam->reported = -1;
+                cam->running = FALSE;
+            }
+        }
+        while ((line = strtok_r(NULL, "\n", &saveptr)) != NULL) {
+            if ((sscanf(line, "cam %d %d %d %d", &camera_id, &running, &load, &fps) != 4) ||
+                !running) {
+                continue;
+            }
+            cam = cluster_cam_find(camera_id);
+            if (cam == NULL) {
+                continue;
+            }
+            cam->reported = node;
+            cam->running = TRUE;
+            cam->fps = fps;
+            if (load >= 0) {
+                cam->load = load;
+            }
+            /* Still run by the node after the coordinator started again */
+            if (cam->node < 0) {
+                cam->node = node;
+            }
+        }
+
+        webu_write(webui, "assigned\n");
+        for (indx = 0; indx < cluster.cam_count; indx++) {
+            cam = &cluster.cams[indx];
+            if (cluster_assigned(cam, node)) {
+                snprintf(buf, sizeof(buf), "cam %d\n", cam->cnt->camera_id);
+                webu_write(webui, buf);
+            }
+        }
+    pthread_mutex_unlock(&cluster.mutex);
+}
@@ -0,0 +1,49 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  cluster.h
+ *    Headers associated with functions in the cluster.c module.
+ */
+
+#ifndef _INCLUDE_CLUSTER_H
+#define _INCLUDE_CLUSTER_H
+
+#define CLUSTER_NAME_LEN    64      /* Longest node name */
+#define CLUSTER_URL_LEN     256     /* Longest url of a node */
+#define CLUSTER_BEAT_MAX    (1024 * 1024)   /* Largest heartbeat or answer */
+
+struct webui_ctx;
+
+/* Where a camera of the cluster runs, for the status of the webcontrol */
+struct cluster_report {
+    char    node[CLUSTER_NAME_LEN];     /* Node running the camera, empty for none */
+    int     remote;                     /* The camera runs on another node */
+    int     running;                    /* As reported by the node */
+    int     fps;
+    int     load;                       /* Permille of a CPU core, -1 when not measured */
+};
+
+void cluster_init(struct context **cntlist);
+void cluster_deinit(void);
+int cluster_active(void);
+int cluster_coordinator(void);
+int cluster_report(struct context *cnt, struct cluster_report *report);
+int cluster_route(struct context *cnt, char *url, size_t url_size);
+void cluster_webu_status(struct webui_ctx *webui);
+void cluster_webu_beat(struct webui_ctx *webui);
+
+#endif /* _INCLUDE_CLUSTER_H */
@@ -48,6 +48,11 @@ struct config conf_template = {
     .native_language =                 TRUE,
     .watchdog_tmo =                    30,
     .watchdog_kill =                   10,
+    .worker_threads =                  0,
+    .frame_pool_budget =               0,
+    .memory_hugepages =                "off",
+    .memory_numa =                     FALSE,
+    .trace_buffer =                    0,
     .camera_name =                     NULL,
     .camera_id =                       0,
     .camera_dir =                      NULL,
@@ -71,11 +76,18 @@ struct config conf_template = {
     .mmalcam_name =                    NULL,
     .mmalcam_params =                  NULL,
 
+    .synth_camera =                    NULL,
+    .synth_motion =                    "5,25",
+
     /* Image processing configuration parameters */
     .width =                           DEF_WIDTH,
     .height =                          DEF_HEIGHT,
     .framerate =                       DEF_MAXFRAMERATE,
+    .framerate_idle =                  0,
+    .framerate_idle_time =             30,
     .minimum_frame_time =              0,
+    .capture_queue =                   0,
+    .detect_scale =                    1,
     .rotate =                          0,
     .flip_axis =                       "none",
     .locate_motion_mode =              "off",
@@ -99,6 +111,7 @@ struct config conf_template = {
     .mask_file =                       NULL,
     .mask_privacy =                    NULL,
     .smart_mask_speed =                0,
+    .detect_backend =                  NULL,
     .lightswitch_percent =             0,
     .lightswitch_frames =              5,
     .minimum_motion_frames =           1,
@@ -122,6 +135,8 @@ struct config conf_template = {
     .picture_output_motion =           FALSE,
     .picture_type =                    "jpeg",
     .picture_quality =                 75,
+    .picture_threads =                 0,
+    .picture_webp_method =             4,
     .picture_exif =                    NULL,
     .picture_filename =                DEF_IMAGEPATH,
 
@@ -138,6 +153,12 @@ struct config conf_template = {
     .movie_codec =                     "mkv",
     .movie_duplicate_frames =          FALSE,
     .movie_passthrough =               FALSE,
+    .movie_passthrough_preroll =       0,
+    .movie_threads =                   0,
+    .movie_thread_type =               NULL,
+    .movie_queue =                     0,
+    .movie_write_buffer =              0,
+    .movie_preallocate =               0,
     .movie_filename =                  DEF_MOVIEPATH,
     .movie_extpipe_use =               FALSE,
     .movie_extpipe =                   NULL,
@@ -148,10 +169,13 @@ struct config conf_template = {
     .timelapse_fps =                   30,
     .timelapse_codec =                 "mpg",
     .timelapse_filename =              DEF_TIMEPATH,
+    .timelapse_fsync =                 60,
 
     /* Loopback device configuration parameters */
     .video_pipe =                      NULL,
     .video_pipe_motion =               NULL,
+    .video_pipe_buffers =              0,
+    .shm_export =                      0,
 
     /* Webcontrol configuration parameters */
     .webcontrol_port =                 0,
@@ -184,6 +208,16 @@ struct config conf_template = {
     .stream_motion =                   FALSE,
     .stream_maxrate =                  1,
     .stream_limit =                    0,
+    .stream_scaled =                   NULL,
+    .stream_hls =                      FALSE,
+    .stream_threads =                  0,
+
+    /* Cluster configuration parameters */
+    .cluster_mode =                    NULL,
+    .cluster_coordinator =             NULL,
+    .cluster_node_name =               NULL,
+    .cluster_node_url =                NULL,
+    .cluster_heartbeat =               5,
 
     /* Database and SQL configuration parameters */
     .database_type =                   NULL,
@@ -193,6 +227,16 @@ struct config conf_template = {
     .database_user =                   NULL,
     .database_password =               NULL,
     .database_busy_timeout =           0,
+    .database_queue =                  0,
+    .database_wal =                    FALSE,
+    .database_commit_count =           0,
+    .database_commit_interval =        1000,
+    .event_index =                     NULL,
+    .retention_days =                  0,
+    .retention_size =                  0,
+    .retention_total =                 0,
+    .retention_free =                  0,
+    .retention_rate =                  10,
 
     .sql_log_picture =                 FALSE,
     .sql_log_snapshot =                FALSE,
@@ -215,6 +259,8 @@ static const char *print_int(struct context **cnt, char **str, int parm, unsigne
 static const char *print_camera(struct context **cnt, char **str, int parm, unsigned int threadnr);
 static struct context **read_camera_dir(struct context **cnt, char *str, int val);
 static struct context **config_camera(struct context **cnt, const char *str, int val);
+static struct context **config_camera_copy(struct context **cnt, int *indx);
+static struct context **config_loadtest(struct context **cnt);
 
 static void usage(void);
 static void config_parms_intl(void);
@@ -326,6 +372,51 @@ config_param config_params[] = {
     WEBUI_LEVEL_LIMITED
     },
     {
+    "worker_threads",
+    "# Number of threads shared by all cameras, -1 for one per CPU core (0 = one thread per camera).",
+    1,
+    CONF_OFFSET(worker_threads),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "frame_pool_budget",
+    "# Megabytes of image buffers for all cameras (0 = no limit).",
+    1,
+    CONF_OFFSET(frame_pool_budget),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "memory_hugepages",
+    "# Huge pages for the image buffers: off, transparent or explicit.",
+    1,
+    CONF_OFFSET(memory_hugepages),
+    copy_string,
+    print_string,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "memory_numa",
+    "# Place the image buffers of a camera on the NUMA node of its thread.",
+    1,
+    CONF_OFFSET(memory_numa),
+    copy_bool,
+    print_bool,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "trace_buffer",
+    "# Number of trace events kept for each thread.  Zero disables tracing.",
+    1,
+    CONF_OFFSET(trace_buffer),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
     "camera_name",
     "# User defined name for the camera.",
     0,
@@ -480,6 +571,24 @@ config_param config_params[] = {
     WEBUI_LEVEL_ADVANCED
     },
     {
+    "synth_camera",
+    "# Synthetic camera for testing: pattern or a raw YUV420P clip looped at width x height.",
+    0,
+    CONF_OFFSET(synth_camera),
+    copy_string,
+    print_string,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "synth_motion",
+    "# Seconds with and without a moving box on the synthetic camera (on,off).",
+    0,
+    CONF_OFFSET(synth_motion),
+    copy_string,
+    print_string,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
     "width",
     "############################################################\n"
     "# Image Processing configuration parameters\n"
@@ -510,6 +619,24 @@ config_param config_params[] = {
     WEBUI_LEVEL_LIMITED
     },
     {
+    "framerate_idle",
+    "# Frames per second processed after framerate_idle_time seconds without changes.",
+    0,
+    CONF_OFFSET(framerate_idle),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_LIMITED
+    },
+    {
+    "framerate_idle_time",
+    "# Seconds without changes before the framerate_idle is used.",
+    0,
+    CONF_OFFSET(framerate_idle_time),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_LIMITED
+    },
+    {
     "minimum_frame_time",
     "# Minimum time in seconds between capturing picture frames from the camera.",
     0,
@@ -519,6 +646,24 @@ config_param config_params[] = {
     WEBUI_LEVEL_LIMITED
     },
     {
+    "capture_queue",
+    "# Number of frames queued between a separate capture thread and the motion loop.",
+    0,
+    CONF_OFFSET(capture_queue),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "detect_scale",
+    "# Divide the captured image by this value (1, 2 or 4) for motion detection.",
+    0,
+    CONF_OFFSET(detect_scale),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
     "rotate",
     "# Number of degrees to rotate image.",
     0,
@@ -667,7 +812,7 @@ config_param config_params[] = {
     },
     {
     "despeckle_filter",
-    "# Despeckle the image using (E/e)rode or (D/d)ilate or (l)abel.",
+    "# Despeckle the image using (E/e)rode or (D/d)ilate or (l)abel or run based (L)abel.",
     0,
     CONF_OFFSET(despeckle_filter),
     copy_string,
@@ -711,6 +856,15 @@ config_param config_params[] = {
     WEBUI_LEVEL_LIMITED
     },
     {
+    "detect_backend",
+    "# Run the diff and reference frame of the motion detection on the cpu or with opencl.",
+    0,
+    CONF_OFFSET(detect_backend),
+    copy_string,
+    print_string,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
     "lightswitch_percent",
     "# Percentage of image that triggers a lightswitch detected.",
     0,
@@ -888,6 +1042,24 @@ config_param config_params[] = {
     WEBUI_LEVEL_LIMITED
     },
     {
+    "picture_threads",
+    "# Threads writing the pictures of all cameras, -1 for one per CPU core (0 = camera thread).",
+    1,
+    CONF_OFFSET(picture_threads),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "picture_webp_method",
+    "# Effort of the webp encoder from 0 (fastest) to 6 (smallest files).",
+    0,
+    CONF_OFFSET(picture_webp_method),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_LIMITED
+    },
+    {
     "picture_exif",
     "# Text to include in a JPEG EXIF comment",
     0,
@@ -1002,6 +1174,60 @@ config_param config_params[] = {
     WEBUI_LEVEL_ADVANCED
     },
     {
+    "movie_passthrough_preroll",
+    "# Seconds of pass through packets written before the motion. (0=use pre_capture)",
+    0,
+    CONF_OFFSET(movie_passthrough_preroll),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "movie_threads",
+    "# Number of threads used by the movie encoder. (0=use the codec default)",
+    0,
+    CONF_OFFSET(movie_threads),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "movie_thread_type",
+    "# Threading method of the movie encoder. (frame or slice)",
+    0,
+    CONF_OFFSET(movie_thread_type),
+    copy_string,
+    print_string,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "movie_queue",
+    "# Frames buffered for the movie encoder thread. (0=encode in the motion loop)",
+    0,
+    CONF_OFFSET(movie_queue),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "movie_write_buffer",
+    "# MB of movie data written to the file by a writer thread. (0=write in the encoder)",
+    0,
+    CONF_OFFSET(movie_write_buffer),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "movie_preallocate",
+    "# MB of disk space reserved for each movie file written behind",
+    0,
+    CONF_OFFSET(movie_preallocate),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
     "movie_filename",
     "# File name(without extension) for movies relative to target directory",
     0,
@@ -1077,6 +1303,15 @@ config_param config_params[] = {
     WEBUI_LEVEL_LIMITED
     },
     {
+    "timelapse_fsync",
+    "# Seconds between syncs of the mpg timelapse file to disk, 0 only when it is closed",
+    0,
+    CONF_OFFSET(timelapse_fsync),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_LIMITED
+    },
+    {
     "video_pipe",
     "############################################################\n"
     "# Loopback pipe configuration parameters\n"
@@ -1098,6 +1333,25 @@ config_param config_params[] = {
     WEBUI_LEVEL_LIMITED
     },
     {
+    "video_pipe_buffers",
+    "# Number of mapped streaming buffers of the loopback devices, images are dropped\n"
+    "# while the reader holds all of them (0 = write the images).",
+    0,
+    CONF_OFFSET(video_pipe_buffers),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_LIMITED
+    },
+    {
+    "shm_export",
+    "# Number of frames in the shared memory ring /motion-camN for external programs (0 = off).",
+    0,
+    CONF_OFFSET(shm_export),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_LIMITED
+    },
+    {
     "webcontrol_port",
     "############################################################\n"
     "# Webcontrol configuration parameters\n"
@@ -1357,6 +1611,81 @@ config_param config_params[] = {
     WEBUI_LEVEL_LIMITED
     },
     {
+    "stream_scaled",
+    "# Widths of the scaled streams, comma separated.",
+    0,
+    CONF_OFFSET(stream_scaled),
+    copy_string,
+    print_string,
+    WEBUI_LEVEL_LIMITED
+    },
+    {
+    "stream_hls",
+    "# Provide a HLS stream of the pass-through packets of a network camera",
+    0,
+    CONF_OFFSET(stream_hls),
+    copy_bool,
+    print_bool,
+    WEBUI_LEVEL_LIMITED
+    },
+    {
+    "stream_threads",
+    "# Threads of one daemon serving all camera streams on stream_port (0 = thread per connection)",
+    1,
+    CONF_OFFSET(stream_threads),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "cluster_mode",
+    "############################################################\n"
+    "# Cluster configuration parameters\n"
+    "############################################################\n\n"
+    "# Share the cameras out over several Motion nodes (off, coordinator or node)",
+    1,
+    CONF_OFFSET(cluster_mode),
+    copy_string,
+    print_string,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "cluster_coordinator",
+    "# host:port of the stream_port of the coordinator, for a node",
+    1,
+    CONF_OFFSET(cluster_coordinator),
+    copy_string,
+    print_string,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "cluster_node_name",
+    "# Name of this node in the cluster (default: host name)",
+    1,
+    CONF_OFFSET(cluster_node_name),
+    copy_string,
+    print_string,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "cluster_node_url",
+    "# Url of the stream_port of this node the streams are redirected to (default: http://hostname:stream_port)",
+    1,
+    CONF_OFFSET(cluster_node_url),
+    copy_string,
+    print_string,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "cluster_heartbeat",
+    "# Seconds between the heartbeats of the nodes to the coordinator",
+    1,
+    CONF_OFFSET(cluster_heartbeat),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
     "database_type",
     "############################################################\n"
     "# Database and SQL Configuration parameters\n"
@@ -1423,6 +1752,96 @@ config_param config_params[] = {
     WEBUI_LEVEL_ADVANCED
     },
     {
+    "database_queue",
+    "# Queries queued for a database writer thread shared by all cameras (0 = camera thread).",
+    1,
+    CONF_OFFSET(database_queue),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "database_wal",
+    "# Use write ahead logging for the sqlite3 database.",
+    0,
+    CONF_OFFSET(database_wal),
+    copy_bool,
+    print_bool,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "database_commit_count",
+    "# Queries grouped into one sqlite3 transaction (0 = commit each query).",
+    0,
+    CONF_OFFSET(database_commit_count),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "database_commit_interval",
+    "# Milliseconds before a partly filled sqlite3 transaction is committed.",
+    0,
+    CONF_OFFSET(database_commit_interval),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "event_index",
+    "# Directory of the index of the events served as events.json (empty = no index).",
+    0,
+    CONF_OFFSET(event_index),
+    copy_string,
+    print_string,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "retention_days",
+    "# Days the files of the events in the event_index are kept (0 = no limit).",
+    0,
+    CONF_OFFSET(retention_days),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "retention_size",
+    "# Megabytes the files of the indexed events of the camera may use (0 = no limit).",
+    0,
+    CONF_OFFSET(retention_size),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "retention_total",
+    "# Megabytes the files of the indexed events of all cameras may use (0 = no limit).",
+    1,
+    CONF_OFFSET(retention_total),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "retention_free",
+    "# Megabytes kept free on the target_dir by deleting the oldest events (0 = no limit).",
+    1,
+    CONF_OFFSET(retention_free),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
+    "retention_rate",
+    "# Files deleted per second by the retention (0 = no limit).",
+    1,
+    CONF_OFFSET(retention_rate),
+    copy_int,
+    print_int,
+    WEBUI_LEVEL_ADVANCED
+    },
+    {
     "sql_log_picture",
     "# Log to the database when creating motion triggered image file",
     0,
@@ -1642,6 +2061,15 @@ config_param config_params[] = {
     WEBUI_LEVEL_LIMITED
     },
     {
+    "track_predict",
+    "# Aim at where the motion is expected to be once the camera has moved",
+    0,
+    TRACK_OFFSET(predict),
+    copy_bool,
+    print_bool,
+    WEBUI_LEVEL_LIMITED
+    },
+    {
     "track_speed",
     "# Speed to set the motor to (stepper motor option)",
     0,
@@ -2359,7 +2787,7 @@ static void conf_cmdline(struct context *cnt, int thread)
     struct config *conf = &cnt->conf;
     int c;
 
-    while ((c = getopt(conf->argc, conf->argv, "bc:d:hmns?p:k:l:")) != EOF) {
+    while ((c = getopt(conf->argc, conf->argv, "bc:d:hmns?p:k:l:L:")) != EOF) {
         switch (c) {
         case 'c':
             if (thread == -1) {
@@ -2402,6 +2830,16 @@ static void conf_cmdline(struct context *cnt, int thread)
         case 'm':
             cnt->pause = 1;
             break;
+        case 'L':
+            if (thread == -1) {
+                cnt->loadtest_seconds = 60;
+                if ((sscanf(optarg, "%d:%d", &cnt->loadtest_cameras, &cnt->loadtest_seconds) < 1) ||
+                    (cnt->loadtest_cameras < 1) || (cnt->loadtest_seconds < 1)) {
+                    usage();
+                    exit(1);
+                }
+            }
+            break;
         case 'h':
         case '?':
         default:
@@ -2413,6 +2851,132 @@ static void conf_cmdline(struct context *cnt, int thread)
     optind = 1;
 }
 
+/*
+ * Hash index of the option names, so an option is found without comparing
+ * its name to the entries of config_params one by one.  The slots hold the
+ * index in the table plus one and 0 when empty.  Built once on first use.
+ */
+struct conf_index {
+    short           *slots;
+    unsigned int    mask;
+};
+
+static struct conf_index conf_index_parms;
+static struct conf_index conf_index_dep;
+static pthread_once_t conf_index_once = PTHREAD_ONCE_INIT;
+
+static unsigned int conf_index_hash(const char *name)
+{
+    unsigned int hash;
+
+    /* FNV-1a of the lower case name since the options are case insensitive */
+    hash = 2166136261U;
+    while (*name != '\0') {
+        hash = (hash ^ (unsigned char)tolower((unsigned char)*name)) * 16777619U;
+        name++;
+    }
+
+    return hash;
+}
+
+static void conf_index_init(struct conf_index *index, int count)
+{
+    unsigned int size;
+
+    size = 16;
+    while (size < (unsigned int)count * 2) {
+        size <<= 1;
+    }
+    index->slots = mymalloc(size * sizeof(short));
+    memset(index->slots, 0, size * sizeof(short));
+    index->mask = size - 1;
+}
+
+/* Slots are probed in order, so of two entries with the same name the first is found */
+static void conf_index_add(struct conf_index *index, const char *name, int indx)
+{
+    unsigned int slot;
+
+    slot = conf_index_hash(name) & index->mask;
+    while (index->slots[slot] != 0) {
+        slot = (slot + 1) & index->mask;
+    }
+    index->slots[slot] = (short)(indx + 1);
+}
+
+static void conf_index_build(void)
+{
+    int indx, count;
+
+    for (count = 0; config_params[count].param_name != NULL; count++);
+    conf_index_init(&conf_index_parms, count);
+    for (indx = 0; indx < count; indx++) {
+        conf_index_add(&conf_index_parms, config_params[indx].param_name, indx);
+    }
+
+    for (count = 0; dep_config_params[count].name != NULL; count++);
+    conf_index_init(&conf_index_dep, count);
+    for (indx = 0; indx < count; indx++) {
+        conf_index_add(&conf_index_dep, dep_config_params[indx].name, indx);
+    }
+}
+
+/**
+ * conf_param_lookup
+ *      Find an option by its name, ignoring the case as the config files do.
+ *
+ * Returns the index in config_params or -1 when there is no such option.
+ */
+int conf_param_lookup(const char *name)
+{
+    unsigned int slot;
+    int indx;
+
+    if (name == NULL) {
+        return -1;
+    }
+
+    pthread_once(&conf_index_once, conf_index_build);
+
+    slot = conf_index_hash(name) & conf_index_parms.mask;
+    while ((indx = conf_index_parms.slots[slot]) != 0) {
+        if (mystrceq(name, config_params[indx - 1].param_name)) {
+            return indx - 1;
+        }
+        slot = (slot + 1) & conf_index_parms.mask;
+    }
+
+    return -1;
+}
+
+/**
+ * conf_dep_lookup
+ *      Find a deprecated option by its exact name.
+ *
+ * Returns the index in dep_config_params or -1 when there is no such option.
+ */
+int conf_dep_lookup(const char *name)
+{
+    unsigned int slot;
+    int indx;
+
+    if (name == NULL) {
+        return -1;
+    }
+
+    pthread_once(&conf_index_once, conf_index_build);
+
+    slot = conf_index_hash(name) & conf_index_dep.mask;
+    while ((indx = conf_index_dep.slots[slot]) != 0) {
+        if (mystreq(name, dep_config_params[indx - 1].name)) {
+            return indx - 1;
+        }
+        slot = (slot + 1) & conf_index_dep.mask;
+    }
+
+    return -1;
+}
+
 /**
  * conf_cmdparse
  *      Sets a config option given by 'cmd' to the value given by 'arg1'.
@@ -2431,73 +2995,67 @@ struct context **conf_cmdparse(struct context **cnt, char *param_name, char *par
         return cnt;
     }
 
-    indx = 0;
-    while (config_params[indx].param_name != NULL) {
-        if (mystrceq(param_name, config_params[indx].param_name)) {
-            if (mystreq(param_name, "camera"))  {
-                cnt = config_camera(cnt, param_val, config_params[indx].conf_value);
-            } else if (mystreq(param_name, "camera_dir"))  {
-                cnt = read_camera_dir(cnt, param_val, config_params[indx].conf_value);
-            } else {
-                config_params[indx].copy(*cnt, param_val, config_params[indx].conf_value);
-            }
-
-            return cnt;
+    indx = conf_param_lookup(param_name);
+    if (indx >= 0) {
+        if (mystreq(param_name, "camera"))  {
+            cnt = config_camera(cnt, param_val, config_params[indx].conf_value);
+        } else if (mystreq(param_name, "camera_dir"))  {
+            cnt = read_camera_dir(cnt, param_val, config_params[indx].conf_value);
+        } else {
+            config_params[indx].copy(*cnt, param_val, config_params[indx].conf_value);
         }
-        indx++;
+
+        return cnt;
     }
 
     /* Now check deprecated options */
-    indx = 0;
-    while (dep_config_params[indx].name != NULL) {
-        if (mystreq(param_name, dep_config_params[indx].name)) {
-            MOTION_LOG(ALR, TYPE_ALL, NO_ERRNO, _("%s after version %s")
-                , dep_config_params[indx].info
-                , dep_config_params[indx].last_version);
-
-            if (mystreq(dep_config_params[indx].name,"brightness") ||
-                mystreq(dep_config_params[indx].name,"contrast") ||
-                mystreq(dep_config_params[indx].name,"saturation") ||
-                mystreq(dep_config_params[indx].name,"hue") ||
-                mystreq(dep_config_params[indx].name,"power_line_frequency") ||
-                mystreq(dep_config_params[indx].name,"v4l2_palette") ||
-                mystreq(dep_config_params[indx].name,"input") ||
-                mystreq(dep_config_params[indx].name,"norm") ||
-                mystreq(dep_config_params[indx].name,"frequency") ||
-                mystreq(dep_config_params[indx].name,"vid_control_params")) {
-                copy_video_params(*cnt, param_val, indx);
-
-            } else if (mystreq(dep_config_params[indx].name,"netcam_decoder") ||
-                mystreq(dep_config_params[indx].name,"netcam_use_tcp") ||
-                mystreq(dep_config_params[indx].name,"rtsp_uses_tcp") ||
-                mystreq(dep_config_params[indx].name,"netcam_rate")  ||
-                mystreq(dep_config_params[indx].name,"netcam_ratehigh") ||
-                mystreq(dep_config_params[indx].name,"netcam_proxy") ||
-                mystreq(dep_config_params[indx].name,"netcam_tolerant_check") ||
-                mystreq(dep_config_params[indx].name,"netcam_keepalive")) {
-                copy_netcam_params(*cnt, param_val, indx);
-
-            } else if (mystreq(dep_config_params[indx].name,"webcontrol_cors_header"))  {
-                copy_webcontrol_header(*cnt, param_val);
-
-            } else if (mystreq(dep_config_params[indx].name,"stream_cors_header"))  {
-                copy_stream_header(*cnt, param_val);
-
-            } else if (mystreq(dep_config_params[indx].name,"text_double"))  {
-                copy_text_double(*cnt, param_val);
-
-            } else if (mystreq(dep_config_params[indx].name,"webcontrol_html_output"))  {
-                copy_html_output(*cnt, param_val);
-
-            } else if (mystreq(dep_config_params[indx].name,"thread"))  {
-                cnt = config_camera(cnt, param_val, dep_config_params[indx].conf_value);
-
-            } else if (dep_config_params[indx].copy != NULL) {
-                dep_config_params[indx].copy(*cnt, param_val, dep_config_params[indx].conf_value);
-            }
-            return cnt;
+    indx = conf_dep_lookup(param_name);
+    if (indx >= 0) {
+        MOTION_LOG(ALR, TYPE_ALL, NO_ERRNO, _("%s after version %s")
+            , dep_config_params[indx].info
+            , dep_config_params[indx].last_version);
+
+        if (mystreq(dep_config_params[indx].name,"brightness") ||
+            mystreq(dep_config_params[indx].name,"contrast") ||
+            mystreq(dep_config_params[indx].name,"saturation") ||
+            mystreq(dep_config_params[indx].name,"hue") ||
+            mystreq(dep_config_params[indx].name,"power_line_frequency") ||
+            mystreq(dep_config_params[indx].name,"v4l2_palette") ||
+            mystreq(dep_config_params[indx].name,"input") ||
+            mystreq(dep_config_params[indx].name,"norm") ||
+            mystreq(dep_config_params[indx].name,"frequency") ||
+            mystreq(dep_config_params[indx].name,"vid_control_params")) {
+            copy_video_params(*cnt, param_val, indx);
+
+        } else if (mystreq(dep_config_params[indx].name,"netcam_decoder") ||
+            mystreq(dep_config_params[indx].name,"netcam_use_tcp") ||
+            mystreq(dep_config_params[indx].name,"rtsp_uses_tcp") ||
+            mystreq(dep_config_params[indx].name,"netcam_rate")  ||
+            mystreq(dep_config_params[indx].name,"netcam_ratehigh") ||
+            mystreq(dep_config_params[indx].name,"netcam_proxy") ||
+            mystreq(dep_config_params[indx].name,"netcam_tolerant_check") ||
+            mystreq(dep_config_params[indx].name,"netcam_keepalive")) {
+            copy_netcam_params(*cnt, param_val, indx);
+
+        } else if (mystreq(dep_config_params[indx].name,"webcontrol_cors_header"))  {
+            copy_webcontrol_header(*cnt, param_val);
+
+        } else if (mystreq(dep_config_params[indx].name,"stream_cors_header"))  {
+            copy_stream_header(*cnt, param_val);
+
+        } else if (mystreq(dep_config_params[indx].name,"text_double"))  {
+            copy_text_double(*cnt, param_val);
+
+        } else if (mystreq(dep_config_params[indx].name,"webcontrol_html_output"))  {
+            copy_html_output(*cnt, param_val);
+
+        } else if (mystreq(dep_config_params[indx].name,"thread"))  {
+            cnt = config_camera(cnt, param_val, dep_config_params[indx].conf_value);
+
+        } else if (dep_config_params[indx].copy != NULL) {
+            dep_config_params[indx].copy(*cnt, param_val, dep_config_params[indx].conf_value);
         }
-        indx++;
+        return cnt;
     }
 
     /* If we get here, it's unknown to us. */
@@ -2829,6 +3387,10 @@ struct context **conf_load(struct context **cnt)
         conf_cmdline(cnt[i], i);
     }
 
+    if (cnt[0]->loadtest_cameras > 0) {
+        cnt = config_loadtest(cnt);
+    }
+
     /* If pid file was passed from Command-line copy to main thread conf struct. */
     if (cnt[0]->pid_file[0]) {
         if (cnt[0]->conf.pid_file != NULL) {
@@ -2869,6 +3431,205 @@ struct context **conf_load(struct context **cnt)
     return cnt;
 }
 
+/*
+ * Options a running camera reads from its config as it goes, so a reload
+ * only needs to set them.  Any other option of a camera is used when the
+ * camera starts.
+ */
+static const char *conf_reload_live[] = {
+    "target_dir", "locate_motion_mode", "locate_motion_style",
+    "text_left", "text_right", "text_changes", "text_scale", "text_event",
+    "emulate_motion", "threshold", "threshold_maximum", "threshold_tune",
+    "noise_level", "noise_tune", "despeckle_filter", "area_detect", "smart_mask_speed",
+    "lightswitch_percent", "lightswitch_frames", "minimum_motion_frames",
+    "event_gap", "pre_capture", "post_capture",
+    "on_event_start", "on_event_end", "on_picture_save", "on_area_detected",
+    "on_motion_detected", "on_movie_start", "on_movie_end", "on_camera_lost",
+    "on_camera_found", "picture_output", "picture_output_motion", "picture_quality",
+    "picture_exif", "picture_filename", "snapshot_interval", "snapshot_filename",
+    "movie_output", "movie_output_motion", "movie_max_time", "movie_bps",
+    "movie_quality", "movie_codec", "movie_duplicate_frames", "movie_filename",
+    "movie_extpipe_use", "movie_extpipe", "movie_write_buffer", "movie_preallocate",
+    "timelapse_interval", "timelapse_mode", "timelapse_fps", "timelapse_codec",
+    "timelapse_filename", "timelapse_fsync",
+    "stream_preview_scale", "stream_preview_newline", "stream_preview_method",
+    "stream_quality", "stream_grey", "stream_motion", "stream_maxrate", "stream_limit",
+    "sql_log_picture", "sql_log_snapshot", "sql_log_movie", "sql_log_timelapse",
+    "sql_query_start", "sql_query_stop", "sql_query",
+    "track_auto", "track_move_wait", "track_predict",
+    NULL
+};
+
+/* The web control is started for all the cameras by the main thread */
+static const char *conf_reload_all[] = {
+    "camera_id", "stream_port", "stream_localhost", "stream_auth_method", "stream_tls",
+    "stream_header_params", "webcontrol_ipv6", "webcontrol_auth_method",
+    "webcontrol_tls", "webcontrol_header_params", "webcontrol_lock_minutes",
+    "webcontrol_lock_attempts", "webcontrol_lock_max_ips",
+    NULL
+};
+
+static int conf_reload_listed(const char **list, const char *name)
+{
+    int indx;
+
+    for (indx = 0; list[indx] != NULL; indx++) {
+        if (mystreq(list[indx], name)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * conf_reload_value
+ *      The value of an option as text in buf, like the print functions give it
+ *      but without their static buffer since the camera threads print as well.
+ *
+ * Returns NULL when the option is not defined.
+ */
+static const char *conf_reload_value(struct context *cnt, int indx, char *buf, size_t buf_size)
+{
+    int val = config_params[indx].conf_value;
+
+    if (config_params[indx].print == print_int) {
+        snprintf(buf, buf_size, "%d", *(int*)((char *)cnt + val));
+        return buf;
+    } else if (config_params[indx].print == print_bool) {
+        return *(int*)((char *)cnt + val) ? "on" : "off";
+    } else if (config_params[indx].print == print_string) {
+        return *(const char **)((char *)cnt + val);
+    }
+
+    return NULL;
+}
+
+/**
+ * conf_reload_changed
+ *      Whether an option has another value in the two contexts.
+ */
+static int conf_reload_changed(struct context *cnt, struct context *cnt_new, int indx)
+{
+    char buf[20], buf_new[20];
+    const char *value, *value_new;
+
+    if (config_params[indx].print == print_camera) {
+        return FALSE;
+    }
+
+    value = conf_reload_value(cnt, indx, buf, sizeof(buf));
+    value_new = conf_reload_value(cnt_new, indx, buf_new, sizeof(buf_new));
+
+    if ((value == NULL) || (value_new == NULL)) {
+        return (value != value_new);
+    }
+
+    return mystrne(value, value_new);
+}
+
+/**
+ * conf_reload_keep
+ *      Copy the options of a context just read from the config files.  The
+ *      running camera changes its own options, such as the rounded sizes of
+ *      the image, so reloads are compared with this copy instead.
+ *
+ * Returns the copy, to be freed with the context it is kept in.
+ */
+struct context *conf_reload_keep(struct context *cnt)
+{
+    struct context *cnt_kept;
+    char buf[20], *parm;
+    const char *value;
+    int indx;
+
+    cnt_kept = mymalloc(sizeof(struct context));
+    for (indx = 0; config_params[indx].param_name != NULL; indx++) {
+        if (config_params[indx].print == print_camera) {
+            continue;
+        }
+        value = conf_reload_value(cnt, indx, buf, sizeof(buf));
+        if (value != NULL) {
+            /* The copy functions take a writable string */
+            parm = mystrdup(value);
+            config_params[indx].copy(cnt_kept, parm, config_params[indx].conf_value);
+            free(parm);
+        }
+    }
+
+    return cnt_kept;
+}
+
+/**
+ * conf_reload_changes
+ *      Compare the options of a running context as they were read from the
+ *      config files, see conf_reload_keep, with the ones read again.
+ *
+ * Returns the CONF_RELOAD_* flags of the options that changed.
+ */
+int conf_reload_changes(struct context *cnt, struct context *cnt_new)
+{
+    struct context *cnt_kept;
+    char buf[20];
+    const char *name, *value;
+    int indx, changes;
+
+    cnt_kept = (cnt->conf_loaded != NULL) ? cnt->conf_loaded : cnt;
+
+    changes = 0;
+    for (indx = 0; config_params[indx].param_name != NULL; indx++) {
+        if (!conf_reload_changed(cnt_kept, cnt_new, indx)) {
+            continue;
+        }
+        name = config_params[indx].param_name;
+        value = conf_reload_value(cnt_new, indx, buf, sizeof(buf));
+
+        if (config_params[indx].main_thread || conf_reload_listed(conf_reload_all, name)) {
+            changes |= CONF_RELOAD_ALL;
+        } else if (mystreq(name, "mask_file") || mystreq(name, "mask_privacy")) {
+            changes |= CONF_RELOAD_MASK;
+        } else if ((value != NULL) && conf_reload_listed(conf_reload_live, name)) {
+            /* An option which is unset again gets its default from the camera start */
+            changes |= CONF_RELOAD_LIVE;
+        } else {
+            changes |= CONF_RELOAD_CAMERA;
+        }
+
+        MOTION_LOG(INF, TYPE_ALL, NO_ERRNO
+            ,_("Camera %d: option %s changed to %s")
+            ,cnt->camera_id, name, (value != NULL) ? value : "(not defined)");
+    }
+
+    return changes;
+}
+
+/**
+ * conf_reload_apply
+ *      Set the options of cnt which changed in the config files.  The options
+ *      cnt was read with are kept in cnt_new->conf_loaded, so the options the
+ *      camera changed itself are left alone when the files did not change them.
+ */
+void conf_reload_apply(struct context *cnt, struct context *cnt_new)
+{
+    struct context *cnt_kept;
+    char buf[20], *parm;
+    const char *value;
+    int indx;
+
+    cnt_kept = (cnt_new->conf_loaded != NULL) ? cnt_new->conf_loaded : cnt;
+
+    for (indx = 0; config_params[indx].param_name != NULL; indx++) {
+        if (!conf_reload_changed(cnt_kept, cnt_new, indx)) {
+            continue;
+        }
+        value = conf_reload_value(cnt_new, indx, buf, sizeof(buf));
+        /* The copy functions take a writable string */
+        parm = (value != NULL) ? mystrdup(value) : NULL;
+        config_params[indx].copy(cnt, parm, config_params[indx].conf_value);
+        free(parm);
+    }
+}
+
 /**
  * conf_output_parms
  *      Dump config options to log, useful for support purposes.
@@ -3156,6 +3917,12 @@ static struct context **config_camera(struct context **cnt, const char *str, int
         return cnt;
     }
 
+    if (cnt[0]->loadtest_cameras > 0) {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("Camera config file %s is not used for the load test"), str);
+        return cnt;
+    }
+
     fp = fopen(str, "re");
 
     if (!fp) {
@@ -3164,6 +3931,58 @@ static struct context **config_camera(struct context **cnt, const char *str, int
         return cnt;
     }
 
+    cnt = config_camera_copy(cnt, &i);
+
+    /* Process the camera's config file and notify user on console. */
+    strcpy(cnt[i]->conf_filename, str);
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+        ,_("Processing camera config file %s"), str);
+    conf_process(cnt + i, fp);
+
+    /* Finally we close the camera config file. */
+    myfclose(fp);
+
+    return cnt;
+}
+
+/**
+ * config_loadtest
+ *      Adds the cameras of the load test given with -L as copies of the
+ *      main context using a synthetic camera.  Each camera writes into the
+ *      directory cam<N> of the target_dir so the files of the cameras with
+ *      the same names do not overwrite each other.
+ */
+static struct context **config_loadtest(struct context **cnt)
+{
+    int i, indx;
+    char target_dir[PATH_MAX];
+
+    for (indx = 0; indx < cnt[0]->loadtest_cameras; indx++) {
+        cnt = config_camera_copy(cnt, &i);
+        if (cnt[i]->conf.synth_camera == NULL) {
+            cnt[i]->conf.synth_camera = mystrdup("pattern");
+        }
+        if (cnt[i]->conf.stream_port != 0) {
+            cnt[i]->conf.stream_port += i;
+        }
+
+        snprintf(target_dir, PATH_MAX, "%s/cam%d"
+            , (cnt[0]->conf.target_dir != NULL) ? cnt[0]->conf.target_dir : ".", i);
+        copy_string(cnt[i], target_dir, CONF_OFFSET(target_dir));
+    }
+
+    return cnt;
+}
+
+/**
+ * config_camera_copy
+ *      Adds a context to the end of the array as a copy of the main context.
+ *      The index of the new context is returned in indx.
+ */
+static struct context **config_camera_copy(struct context **cnt, int *indx)
+{
+    int i;
+
     /* Find the current number of threads defined. */
     i = -1;
 
@@ -3197,14 +4016,7 @@ static struct context **config_camera(struct context **cnt, const char *str, int
     /* Mark the end if the array of pointers to context structures. */
     cnt[i + 1] = NULL;
 
-    /* Process the camera's config file and notify user on console. */
-    strcpy(cnt[i]->conf_filename, str);
-    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
-        ,_("Processing camera config file %s"), str);
-    conf_process(cnt + i, fp);
-
-    /* Finally we close the camera config file. */
-    myfclose(fp);
+    *indx = i;
 
     return cnt;
 }
@@ -3231,6 +4043,7 @@ static void usage()
     printf("-p process_id_file\tFull path and filename of process id file (pid file).\n");
     printf("-l log file \t\tFull path and filename of log file.\n");
     printf("-m\t\t\tDisable motion detection at startup.\n");
+    printf("-L cameras[:seconds]\tLoad test with synthetic cameras, by default for 60 seconds.\n");
     printf("-h\t\t\tShow this screen.\n");
     printf("\n");
     printf("Motion is configured using a config file only. If none is supplied,\n");
@@ -3256,6 +4069,11 @@ static void config_parms_intl()
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","quiet",_("quiet"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","watchdog_tmo",_("watchdog_tmo"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","watchdog_kill",_("watchdog_kill"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","worker_threads",_("worker_threads"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","frame_pool_budget",_("frame_pool_budget"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","memory_hugepages",_("memory_hugepages"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","memory_numa",_("memory_numa"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","trace_buffer",_("trace_buffer"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","native_language",_("native_language"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","camera_name",_("camera_name"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","camera_id",_("camera_id"));
@@ -3274,10 +4092,16 @@ static void config_parms_intl()
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","netcam_userpass",_("netcam_userpass"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","mmalcam_name",_("mmalcam_name"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","mmalcam_params",_("mmalcam_params"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","synth_camera",_("synth_camera"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","synth_motion",_("synth_motion"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","width",_("width"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","height",_("height"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","framerate",_("framerate"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","framerate_idle",_("framerate_idle"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","framerate_idle_time",_("framerate_idle_time"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","minimum_frame_time",_("minimum_frame_time"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","capture_queue",_("capture_queue"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","detect_scale",_("detect_scale"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","rotate",_("rotate"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","flip_axis",_("flip_axis"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","locate_motion_mode",_("locate_motion_mode"));
@@ -3299,6 +4123,7 @@ static void config_parms_intl()
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","mask_file",_("mask_file"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","mask_privacy",_("mask_privacy"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","smart_mask_speed",_("smart_mask_speed"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","detect_backend",_("detect_backend"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","lightswitch_percent",_("lightswitch_percent"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","lightswitch_frames",_("lightswitch_frames"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","minimum_motion_frames",_("minimum_motion_frames"));
@@ -3318,6 +4143,8 @@ static void config_parms_intl()
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","picture_output_motion",_("picture_output_motion"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","picture_type",_("picture_type"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","picture_quality",_("picture_quality"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","picture_threads",_("picture_threads"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","picture_webp_method",_("picture_webp_method"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","picture_exif",_("picture_exif"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","picture_filename",_("picture_filename"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","snapshot_interval",_("snapshot_interval"));
@@ -3330,6 +4157,12 @@ static void config_parms_intl()
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","movie_codec",_("movie_codec"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","movie_duplicate_frames",_("movie_duplicate_frames"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","movie_passthrough",_("movie_passthrough"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","movie_passthrough_preroll",_("movie_passthrough_preroll"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","movie_threads",_("movie_threads"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","movie_thread_type",_("movie_thread_type"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","movie_queue",_("movie_queue"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","movie_write_buffer",_("movie_write_buffer"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","movie_preallocate",_("movie_preallocate"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","movie_filename",_("movie_filename"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","movie_extpipe_use",_("movie_extpipe_use"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","movie_extpipe",_("movie_extpipe"));
@@ -3338,8 +4171,11 @@ static void config_parms_intl()
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","timelapse_fps",_("timelapse_fps"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","timelapse_codec",_("timelapse_codec"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","timelapse_filename",_("timelapse_filename"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","timelapse_fsync",_("timelapse_fsync"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","video_pipe",_("video_pipe"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","video_pipe_motion",_("video_pipe_motion"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","video_pipe_buffers",_("video_pipe_buffers"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","shm_export",_("shm_export"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","webcontrol_port",_("webcontrol_port"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","webcontrol_ipv6",_("webcontrol_ipv6"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","webcontrol_localhost",_("webcontrol_localhost"));
@@ -3368,6 +4204,14 @@ static void config_parms_intl()
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","stream_motion",_("stream_motion"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","stream_maxrate",_("stream_maxrate"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","stream_limit",_("stream_limit"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","stream_scaled",_("stream_scaled"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","stream_hls",_("stream_hls"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","stream_threads",_("stream_threads"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","cluster_mode",_("cluster_mode"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","cluster_coordinator",_("cluster_coordinator"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","cluster_node_name",_("cluster_node_name"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","cluster_node_url",_("cluster_node_url"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","cluster_heartbeat",_("cluster_heartbeat"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","database_type",_("database_type"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","database_dbname",_("database_dbname"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","database_host",_("database_host"));
@@ -3375,6 +4219,16 @@ static void config_parms_intl()
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","database_user",_("database_user"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","database_password",_("database_password"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","database_busy_timeout",_("database_busy_timeout"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","database_queue",_("database_queue"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","database_wal",_("database_wal"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","database_commit_count",_("database_commit_count"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","database_commit_interval",_("database_commit_interval"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","event_index",_("event_index"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","retention_days",_("retention_days"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","retention_size",_("retention_size"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","retention_total",_("retention_total"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","retention_free",_("retention_free"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","retention_rate",_("retention_rate"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","sql_log_picture",_("sql_log_picture"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","sql_log_snapshot",_("sql_log_snapshot"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","sql_log_movie",_("sql_log_movie"));
@@ -3399,6 +4253,7 @@ static void config_parms_intl()
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","track_step_angle_x",_("track_step_angle_x"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","track_step_angle_y",_("track_step_angle_y"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","track_move_wait",_("track_move_wait"));
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","track_predict",_("track_predict"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","track_speed",_("track_speed"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","track_stepsize",_("track_stepsize"));
         MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO,"%s:%s","track_generic_move",_("track_generic_move"));
@@ -38,6 +38,11 @@ struct config {
     int             native_language;
     int             watchdog_tmo;
     int             watchdog_kill;
+    int             worker_threads;
+    int             frame_pool_budget;
+    const char      *memory_hugepages;
+    int             memory_numa;
+    int             trace_buffer;
     const char      *camera_name;
     int             camera_id;
     const char      *camera_dir;
@@ -61,11 +66,18 @@ struct config {
     const char      *mmalcam_name;
     const char      *mmalcam_params;
 
+    const char      *synth_camera;
+    const char      *synth_motion;
+
     /* Image processing configuration parameters */
     int             width;
     int             height;
     int             framerate;
+    int             framerate_idle;
+    int             framerate_idle_time;
     int             minimum_frame_time;
+    int             capture_queue;
+    int             detect_scale;
     int             rotate;
     const char      *flip_axis;
     const char      *locate_motion_mode;
@@ -89,6 +101,7 @@ struct config {
     const char      *mask_file;
     const char      *mask_privacy;
     int             smart_mask_speed;
+    const char      *detect_backend;
     int             lightswitch_percent;
     int             lightswitch_frames;
     int             minimum_motion_frames;
@@ -112,6 +125,8 @@ struct config {
     int             picture_output_motion;
     const char      *picture_type;
     int             picture_quality;
+    int             picture_threads;
+    int             picture_webp_method;
     const char      *picture_exif;
     const char      *picture_filename;
 
@@ -128,6 +143,12 @@ struct config {
     const char      *movie_codec;
     int             movie_duplicate_frames;
     int             movie_passthrough;
+    int             movie_passthrough_preroll;
+    int             movie_threads;
+    const char      *movie_thread_type;
+    int             movie_queue;
+    int             movie_write_buffer;
+    int             movie_preallocate;
     const char      *movie_filename;
     int             movie_extpipe_use;
     const char      *movie_extpipe;
@@ -138,10 +159,13 @@ struct config {
     int             timelapse_fps;
     const char      *timelapse_codec;
     const char      *timelapse_filename;
+    int             timelapse_fsync;
 
     /* Loopback device configuration parameters */
     const char      *video_pipe;
     const char      *video_pipe_motion;
+    int             video_pipe_buffers;
+    int             shm_export;
 
     /* Webcontrol configuration parameters */
     int             webcontrol_port;
@@ -174,6 +198,16 @@ struct config {
     int             stream_motion;
     int             stream_maxrate;
     int             stream_limit;
+    char            *stream_scaled;
+    int             stream_hls;
+    int             stream_threads;
+
+    /* Cluster configuration parameters */
+    const char      *cluster_mode;
+    const char      *cluster_coordinator;
+    const char      *cluster_node_name;
+    const char      *cluster_node_url;
+    int             cluster_heartbeat;
 
     /* Database and SQL configuration parameters */
     const char      *database_type;
@@ -183,6 +217,16 @@ struct config {
     const char      *database_user;
     const char      *database_password;
     int             database_busy_timeout;
+    int             database_queue;
+    int             database_wal;
+    int             database_commit_count;
+    int             database_commit_interval;
+    const char      *event_index;
+    int             retention_days;
+    int             retention_size;
+    int             retention_total;
+    int             retention_free;
+    int             retention_rate;
 
     int             sql_log_picture;
     int             sql_log_snapshot;
@@ -233,10 +277,21 @@ typedef struct {
 
 extern dep_config_param dep_config_params[];
 
+/* Changes found by conf_reload_changes */
+#define CONF_RELOAD_LIVE        0x01    /* Options the running camera reads as it goes */
+#define CONF_RELOAD_MASK        0x02    /* The mask files, loaded again by the camera */
+#define CONF_RELOAD_CAMERA      0x04    /* Options used when the camera starts, the camera is restarted */
+#define CONF_RELOAD_ALL         0x08    /* Options of the main thread or the web control, Motion is restarted */
+
 struct context **conf_cmdparse(struct context **cnt, char *cmd, char *arg1);
+int conf_param_lookup(const char *name);
+int conf_dep_lookup(const char *name);
 void conf_print(struct context **cnt);
 struct context **conf_load(struct context **cnt);
 void conf_output_parms(struct context **cnt);
 void copy_string(struct context *cnt, char *str, int val_ptr);
+struct context *conf_reload_keep(struct context *cnt);
+int conf_reload_changes(struct context *cnt, struct context *cnt_new);
+void conf_reload_apply(struct context *cnt, struct context *cnt_new);
 
 #endif /* _INCLUDE_CONF_H */
@@ -29,6 +29,79 @@
 
 pthread_mutex_t dbse_lock;
 
+/* Return codes of the dbse_exec functions */
+#define DBSE_OK     0
+#define DBSE_RETRY  1       /* Database not reachable, the query may be tried again */
+
+/* Longest wait in seconds before retrying an unreachable database */
+#define DBSE_BACKOFF_MAX 30
+
+struct dbse_job {
+    struct context          *cnt;
+    char                    *sqlquery;
+    struct timeval          tv_queued;
+    struct dbse_job         *next;
+};
+
+static struct {
+    pthread_mutex_t         mutex;
+    pthread_cond_t          cond_job;       /* Signalled when a query is queued */
+    pthread_cond_t          cond_done;      /* Broadcast when a query is done or retried */
+    pthread_t               thread_id;
+    int                     running;
+    int                     size;           /* Most queries queued, database_queue */
+    int                     count;
+    struct dbse_job         *head;
+    struct dbse_job         *tail;
+    struct dbse_job         *busy;          /* Query being run by the writer */
+    int                     backoff;        /* Seconds of the current retry wait, 0 when reachable */
+    int                     full;
+    int                     finish;
+
+    unsigned long           executed;
+    unsigned long           retried;
+    unsigned long           dropped;
+    int                     depth_max;
+    long                    latency_max;    /* usec from queueing to written */
+} dbse_writer = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond_job = PTHREAD_COND_INITIALIZER,
+    .cond_done = PTHREAD_COND_INITIALIZER,
+};
+
+#ifdef HAVE_SQLITE3
+/*
+ * A sqlite3 database file opened by the cameras.  Cameras using the same
+ * file share the connection so the queries grouped into a transaction by
+ * one camera do not keep the others waiting on the file lock.
+ */
+struct dbse_sqlite3 {
+    char                    *dbname;
+    sqlite3                 *db;
+    int                     users;          /* Cameras using the connection */
+    sqlite3_stmt            *stmt_begin;
+    sqlite3_stmt            *stmt_commit;
+    int                     commit_count;   /* Queries per transaction, 1 or less for none */
+    int                     commit_interval;/* msec an open transaction may wait for more */
+    int                     txn_count;      /* Queries in the open transaction, 0 when none */
+    struct timeval          txn_start;
+    struct dbse_sqlite3     *next;
+};
+
+/* Open sqlite3 database files, protected by dbse_lock */
+static struct dbse_sqlite3 *dbse_sqlite3_list = NULL;
+#endif /* HAVE_SQLITE3 */
+
+static void dbse_flush(struct context *cnt);
+
+static long dbse_elapsed_usec(struct timeval *tv)
+{
+    struct timeval tv_now;
+
+    gettimeofday(&tv_now, NULL);
+    return ((tv_now.tv_sec - tv->tv_sec) * 1000000L) + (tv_now.tv_usec - tv->tv_usec);
+}
+
 /** dbse_global_deinit */
 void dbse_global_deinit(struct context **cntlist)
 {
@@ -186,35 +259,165 @@ static int dbse_init_mariadb(struct context *cnt)
 
 }
 
+#ifdef HAVE_SQLITE3
+/** dbse_sqlite3_pragma
+ *  Switch the database to write ahead logging.  Synchronous NORMAL then
+ *  only syncs the log at checkpoints instead of on every commit.
+ */
+static void dbse_sqlite3_pragma(struct dbse_sqlite3 *dbs)
+{
+    int retcd;
+    char *errmsg = NULL;
+
+    retcd = sqlite3_exec(dbs->db, "PRAGMA journal_mode=WAL;PRAGMA synchronous=NORMAL;"
+        , NULL, 0, &errmsg);
+    if (retcd != SQLITE_OK) {
+        MOTION_LOG(ERR, TYPE_DB, NO_ERRNO
+            , _("Setting write ahead log failed.  Error %d : %s"), retcd, errmsg);
+        sqlite3_free(errmsg);
+        return;
+    }
+    MOTION_LOG(NTC, TYPE_DB, NO_ERRNO, _("Using write ahead log"));
+}
+
+/** dbse_sqlite3_open */
+static struct dbse_sqlite3 *dbse_sqlite3_open(struct context *cnt)
+{
+    struct dbse_sqlite3 *dbs;
+    int retcd;
+
+    for (dbs = dbse_sqlite3_list; dbs != NULL; dbs = dbs->next) {
+        if (mystreq(dbs->dbname, cnt->conf.database_dbname)) {
+            MOTION_LOG(NTC, TYPE_DB, NO_ERRNO
+                ,_("Sharing opened database %s"), cnt->conf.database_dbname);
+            dbs->users++;
+            return dbs;
+        }
+    }
+
+    MOTION_LOG(NTC, TYPE_DB, NO_ERRNO
+        ,_("Opening database %s"), cnt->conf.database_dbname);
+
+    dbs = mymalloc(sizeof(struct dbse_sqlite3));
+    memset(dbs, 0, sizeof(struct dbse_sqlite3));
+
+    retcd = sqlite3_open(cnt->conf.database_dbname, &dbs->db);
+    if (retcd != SQLITE_OK) {
+        MOTION_LOG(ERR, TYPE_DB, NO_ERRNO
+            ,_("Can't open SQLite3 database %s.  Error %d : %s")
+            , cnt->conf.database_dbname, retcd
+            , sqlite3_errmsg(dbs->db));
+        sqlite3_close(dbs->db);
+        free(dbs);
+        return NULL;
+    }
+    MOTION_LOG(NTC, TYPE_DB, NO_ERRNO
+        , _("Setting busy timeout to %d msec")
+        , cnt->conf.database_busy_timeout);
+    retcd = sqlite3_busy_timeout(dbs->db, cnt->conf.database_busy_timeout);
+    if (retcd != SQLITE_OK) {
+        MOTION_LOG(ERR, TYPE_DB, NO_ERRNO
+            , _("Setting busy timeout failed.  Error %d:%s")
+            , retcd, sqlite3_errmsg(dbs->db));
+    }
+
+    if (cnt->conf.database_wal) {
+        dbse_sqlite3_pragma(dbs);
+    }
+
+    /* The transaction statements are the same for every group so prepare them once */
+    dbs->commit_count = cnt->conf.database_commit_count;
+    dbs->commit_interval = cnt->conf.database_commit_interval;
+    if (dbs->commit_count > 1) {
+        if ((sqlite3_prepare_v2(dbs->db, "BEGIN", -1, &dbs->stmt_begin, NULL) != SQLITE_OK) ||
+            (sqlite3_prepare_v2(dbs->db, "COMMIT", -1, &dbs->stmt_commit, NULL) != SQLITE_OK)) {
+            MOTION_LOG(ERR, TYPE_DB, NO_ERRNO
+                , _("Preparing transaction statements failed: %s"), sqlite3_errmsg(dbs->db));
+            sqlite3_finalize(dbs->stmt_begin);
+            sqlite3_finalize(dbs->stmt_commit);
+            dbs->stmt_begin = NULL;
+            dbs->stmt_commit = NULL;
+            dbs->commit_count = 0;
+        } else {
+            MOTION_LOG(NTC, TYPE_DB, NO_ERRNO
+                , _("Grouping up to %d queries per transaction for %d msec")
+                , dbs->commit_count, dbs->commit_interval);
+        }
+    }
+
+    dbs->dbname = mystrdup(cnt->conf.database_dbname);
+    dbs->users = 1;
+    dbs->next = dbse_sqlite3_list;
+    dbse_sqlite3_list = dbs;
+
+    return dbs;
+}
+
+/** dbse_sqlite3_commit
+ *  Commit the open transaction of the database.  Called with dbse_lock held.
+ */
+static void dbse_sqlite3_commit(struct dbse_sqlite3 *dbs)
+{
+    int retcd;
+
+    if (dbs->txn_count == 0) {
+        return;
+    }
+
+    retcd = sqlite3_step(dbs->stmt_commit);
+    sqlite3_reset(dbs->stmt_commit);
+    if (retcd == SQLITE_BUSY) {
+        /* Readers still hold the file, the commit is tried again later */
+        return;
+    }
+    if (retcd != SQLITE_DONE) {
+        MOTION_LOG(ERR, TYPE_DB, NO_ERRNO
+            , _("SQLite3 commit error %d : %s"), retcd, sqlite3_errmsg(dbs->db));
+    }
+    dbs->txn_count = 0;
+}
+
+/** dbse_sqlite3_close */
+static void dbse_sqlite3_close(struct dbse_sqlite3 *dbs)
+{
+    struct dbse_sqlite3 **prev;
+
+    if (--dbs->users > 0) {
+        return;
+    }
+
+    dbse_sqlite3_commit(dbs);
+
+    for (prev = &dbse_sqlite3_list; *prev != NULL; prev = &(*prev)->next) {
+        if (*prev == dbs) {
+            *prev = dbs->next;
+            break;
+        }
+    }
+
+    sqlite3_finalize(dbs->stmt_begin);
+    sqlite3_finalize(dbs->stmt_commit);
+    sqlite3_close(dbs->db);
+    free(dbs->dbname);
+    free(dbs);
+}
+#endif /* HAVE_SQLITE3 */
+
 /** dbse_init_sqlite3 */
 static int dbse_init_sqlite3(struct context *cnt,struct context **cntlist)
 {
     #ifdef HAVE_SQLITE3
-        int retcd;
         if ((mystreq(cnt->conf.database_type, "sqlite3")) &&
             (cnt->conf.database_dbname != NULL)) {
-            MOTION_LOG(NTC, TYPE_DB, NO_ERRNO
-                ,_("Opening database %s"), cnt->conf.database_dbname);
-            retcd = sqlite3_open(cnt->conf.database_dbname, &cnt->database_sqlite3);
-            if (retcd != SQLITE_OK) {
-                MOTION_LOG(ERR, TYPE_DB, NO_ERRNO
-                    ,_("Can't open SQLite3 database %s.  Error %d : %s")
-                    , cnt->conf.database_dbname, retcd
-                    , sqlite3_errmsg(cnt->database_sqlite3));
-                sqlite3_close(cnt->database_sqlite3);
+            pthread_mutex_lock(&dbse_lock);
+                cnt->dbse_sqlite3 = dbse_sqlite3_open(cnt);
+            pthread_mutex_unlock(&dbse_lock);
+            if (cnt->dbse_sqlite3 == NULL) {
                 return -2;
             }
-            MOTION_LOG(NTC, TYPE_DB, NO_ERRNO
-                , _("Setting busy timeout to %d msec")
-                , cnt->conf.database_busy_timeout);
-            retcd = sqlite3_busy_timeout(cnt->database_sqlite3
-                , cnt->conf.database_busy_timeout);
-            if (retcd != SQLITE_OK) {
-                MOTION_LOG(ERR, TYPE_DB, NO_ERRNO
-                    , _("Setting busy timeout failed.  Error %d:%s")
-                    , retcd, sqlite3_errmsg(cnt->database_sqlite3));
-            }
+            cnt->database_sqlite3 = cnt->dbse_sqlite3->db;
         }
+        (void)cntlist;
     #else
         (void)cnt;
         (void)cntlist;
@@ -294,6 +497,8 @@ int dbse_init(struct context *cnt, struct context **cntlist)
 void dbse_deinit(struct context *cnt)
 {
     if (cnt->conf.database_type) {
+        dbse_flush(cnt);
+
         #if defined(HAVE_MYSQL)
             if ( (mystreq(cnt->conf.database_type, "mysql")) && (cnt->conf.database_dbname)) {
                 mysql_thread_end();
@@ -316,8 +521,11 @@ void dbse_deinit(struct context *cnt)
         #endif /* HAVE_PGSQL */
 
         #ifdef HAVE_SQLITE3
-            if (cnt->database_sqlite3 != NULL) {
-                sqlite3_close(cnt->database_sqlite3);
+            if (cnt->dbse_sqlite3 != NULL) {
+                pthread_mutex_lock(&dbse_lock);
+                    dbse_sqlite3_close(cnt->dbse_sqlite3);
+                pthread_mutex_unlock(&dbse_lock);
+                cnt->dbse_sqlite3 = NULL;
                 cnt->database_sqlite3 = NULL;
             }
         #endif /* HAVE_SQLITE3 */
@@ -342,11 +550,40 @@ void dbse_sqlmask_update(struct context *cnt)
                     cnt->conf.sql_log_timelapse * FTYPE_MPEG_TIMELAPSE;
 }
 
+/**
+ * dbse_commit_due
+ *
+ * Commit the grouped sqlite3 transaction of the camera once it has been
+ * open for database_commit_interval.  Called from the motion loop, so the
+ * lock is only tried and the commit is left for a later frame while the
+ * database is in use.
+ */
+void dbse_commit_due(struct context *cnt)
+{
+    #ifdef HAVE_SQLITE3
+        struct dbse_sqlite3 *dbs = cnt->dbse_sqlite3;
+
+        if ((dbs == NULL) || (dbs->txn_count == 0)) {
+            return;
+        }
+        if (dbse_elapsed_usec(&dbs->txn_start) < (dbs->commit_interval * 1000L)) {
+            return;
+        }
+        if (pthread_mutex_trylock(&dbse_lock) != 0) {
+            return;
+        }
+            dbse_sqlite3_commit(dbs);
+        pthread_mutex_unlock(&dbse_lock);
+    #else
+        (void)cnt;
+    #endif /* HAVE_SQLITE3 */
+}
+
 /**
  * dbse_exec_mysql
  *
  */
-static void dbse_exec_mysql(char *sqlquery, struct context *cnt)
+static int dbse_exec_mysql(char *sqlquery, struct context *cnt)
 {
     #if defined(HAVE_MYSQL)
         if (mystreq(cnt->conf.database_type, "mysql")) {
@@ -374,6 +611,7 @@ static void dbse_exec_mysql(char *sqlquery, struct context *cnt)
                             cnt->conf.database_dbname,
                             cnt->conf.database_host, cnt->conf.database_user,
                             mysql_error(cnt->database_mysql));
+                        return DBSE_RETRY;
                     } else {
                         MOTION_LOG(INF, TYPE_DB, NO_ERRNO
                             ,_("Re-Connection to MySQL database '%s' Succeed")
@@ -392,13 +630,15 @@ static void dbse_exec_mysql(char *sqlquery, struct context *cnt)
         (void)sqlquery;
         (void)cnt;
     #endif /* HAVE_MYSQL*/
+
+    return DBSE_OK;
 }
 
 /**
  * dbse_exec_mariadb
  *
  */
-static void dbse_exec_mariadb(char *sqlquery, struct context *cnt)
+static int dbse_exec_mariadb(char *sqlquery, struct context *cnt)
 {
     #if defined(HAVE_MARIADB)
         if (mystreq(cnt->conf.database_type, "mariadb")) {
@@ -426,6 +666,7 @@ static void dbse_exec_mariadb(char *sqlquery, struct context *cnt)
                             cnt->conf.database_dbname,
                             cnt->conf.database_host, cnt->conf.database_user,
                             mysql_error(cnt->database_mariadb));
+                        return DBSE_RETRY;
                     } else {
                         MOTION_LOG(INF, TYPE_DB, NO_ERRNO
                             ,_("Re-Connection to MariaDB database '%s' Succeed")
@@ -445,13 +686,14 @@ static void dbse_exec_mariadb(char *sqlquery, struct context *cnt)
         (void)cnt;
     #endif /* HAVE_MYSQL HAVE_MARIADB*/
 
+    return DBSE_OK;
 }
 
 /**
  * dbse_exec_pgsql
  *
  */
-static void dbse_exec_pgsql(char *sqlquery, struct context *cnt)
+static int dbse_exec_pgsql(char *sqlquery, struct context *cnt)
 {
     #ifdef HAVE_PGSQL
         if (mystreq(cnt->conf.database_type, "postgresql") && cnt->database_pgsql) {
@@ -470,7 +712,7 @@ static void dbse_exec_pgsql(char *sqlquery, struct context *cnt)
                 } else if (pstat == PGRES_POLLING_FAILED) {
                     cnt->eid_db_format = dbeid_rec_fail;  /* retry PGresetStart() */
                 } else {  /* session recovery in process but not complete */
-                    return;  /* discard this sqlquery; check again on next one */
+                    return DBSE_RETRY;  /* keep this sqlquery; check again on next one */
                 }
             }
 
@@ -497,6 +739,10 @@ static void dbse_exec_pgsql(char *sqlquery, struct context *cnt)
                 } else {  /* reset request fails if PGSQL server is (temporarily?) unreachable */
                     cnt->eid_db_format = dbeid_rec_fail;  /* try again next sqlquery */
                 }
+                if (res) {
+                    PQclear(res);
+                }
+                return DBSE_RETRY;
             } else if (!(estat == PGRES_COMMAND_OK || estat == PGRES_TUPLES_OK)) {
                 MOTION_LOG(ERR, TYPE_DB, SHOW_ERRNO, _("PGSQL query failed: [%s]  %s %s"),
                     sqlquery, PQresStatus(PQresultStatus(res)), PQresultErrorMessage(res));
@@ -510,21 +756,48 @@ static void dbse_exec_pgsql(char *sqlquery, struct context *cnt)
         (void)cnt;
     #endif /* HAVE_PGSQL */
 
+    return DBSE_OK;
 }
 
 /** dbse_exec_sqlite3 */
-static void dbse_exec_sqlite3(char *sqlquery, struct context *cnt)
+static int dbse_exec_sqlite3(char *sqlquery, struct context *cnt)
 {
     #ifdef HAVE_SQLITE3
         if (cnt->database_sqlite3 != NULL) {
+            struct dbse_sqlite3 *dbs = cnt->dbse_sqlite3;
             int retcd;
             char *errmsg = NULL;
+
+            if ((dbs->commit_count > 1) && (dbs->txn_count == 0)) {
+                retcd = sqlite3_step(dbs->stmt_begin);
+                sqlite3_reset(dbs->stmt_begin);
+                if (retcd == SQLITE_DONE) {
+                    gettimeofday(&dbs->txn_start, NULL);
+                } else {
+                    MOTION_LOG(ERR, TYPE_DB, NO_ERRNO
+                        , _("SQLite3 begin error %d : %s"), retcd, sqlite3_errmsg(dbs->db));
+                }
+            }
+
             MOTION_LOG(DBG, TYPE_DB, NO_ERRNO, _("Executing %s"), sqlquery);
             retcd = sqlite3_exec(cnt->database_sqlite3, sqlquery, NULL, 0, &errmsg);
+            if (sqlite3_get_autocommit(dbs->db) == 0) {
+                dbs->txn_count++;
+            }
             if (retcd != SQLITE_OK ) {
                 MOTION_LOG(ERR, TYPE_DB, NO_ERRNO
                     , _("SQLite3 error %d : %s"), retcd, errmsg);
                 sqlite3_free(errmsg);
+                /* The database is locked by another process beyond the busy timeout */
+                if ((retcd == SQLITE_BUSY) || (retcd == SQLITE_LOCKED)) {
+                    /* Release what the open transaction holds before the retry */
+                    dbse_sqlite3_commit(dbs);
+                    return DBSE_RETRY;
+                }
+            }
+
+            if (dbs->txn_count >= dbs->commit_count) {
+                dbse_sqlite3_commit(dbs);
             }
         }
     #else
@@ -532,6 +805,316 @@ static void dbse_exec_sqlite3(char *sqlquery, struct context *cnt)
         (void)cnt;
     #endif /* HAVE_SQLITE3 */
 
+    return DBSE_OK;
+}
+
+/**
+ * dbse_exec
+ *  Run a query on the database of the camera.  Returns DBSE_RETRY when the
+ *  database could not be reached and the query may be tried again later.
+ */
+static int dbse_exec(struct context *cnt, char *sqlquery)
+{
+    int retcd = DBSE_OK;
+
+    pthread_mutex_lock(&dbse_lock);
+        if (mystreq(cnt->conf.database_type,"mysql")) {
+            retcd = dbse_exec_mysql(sqlquery, cnt);
+        } else if (mystreq(cnt->conf.database_type,"mariadb")) {
+            retcd = dbse_exec_mariadb(sqlquery, cnt);
+        } else if (mystreq(cnt->conf.database_type,"postgresql")) {
+            retcd = dbse_exec_pgsql(sqlquery, cnt);
+        } else if (mystreq(cnt->conf.database_type,"sqlite3")) {
+            retcd = dbse_exec_sqlite3(sqlquery, cnt);
+        }
+    pthread_mutex_unlock(&dbse_lock);
+
+    return retcd;
+}
+
+/** dbse_backoff
+ *  Wait before the queued queries are tried again on an unreachable
+ *  database.  The wait doubles up to DBSE_BACKOFF_MAX seconds and ends
+ *  early on shutdown.  Called with the writer mutex held.
+ */
+static void dbse_backoff(void)
+{
+    struct timeval tv;
+    struct timespec ts;
+
+    if (dbse_writer.backoff == 0) {
+        dbse_writer.backoff = 1;
+        MOTION_LOG(WRN, TYPE_DB, NO_ERRNO
+            ,_("Database not available, queued queries are kept and retried"));
+    } else if (dbse_writer.backoff < DBSE_BACKOFF_MAX) {
+        dbse_writer.backoff *= 2;
+        if (dbse_writer.backoff > DBSE_BACKOFF_MAX) {
+            dbse_writer.backoff = DBSE_BACKOFF_MAX;
+        }
+    }
+    dbse_writer.retried++;
+
+    /* Cameras that are stopping may now discard their queries */
+    pthread_cond_broadcast(&dbse_writer.cond_done);
+
+    gettimeofday(&tv, NULL);
+    ts.tv_sec = tv.tv_sec + dbse_writer.backoff;
+    ts.tv_nsec = tv.tv_usec * 1000;
+    while (!dbse_writer.finish) {
+        if (pthread_cond_timedwait(&dbse_writer.cond_job, &dbse_writer.mutex, &ts) == ETIMEDOUT) {
+            break;
+        }
+    }
+}
+
+static void *dbse_writer_handler(void *arg)
+{
+    struct dbse_job *job;
+    long latency;
+    int retcd;
+
+    (void)arg;
+
+    util_threadname_set("db", 0, NULL);
+
+    #if defined(HAVE_MYSQL) || defined(HAVE_MARIADB)
+        mysql_thread_init();
+    #endif
+
+    pthread_mutex_lock(&dbse_writer.mutex);
+    while (TRUE) {
+        while ((dbse_writer.head == NULL) && !dbse_writer.finish) {
+            pthread_cond_wait(&dbse_writer.cond_job, &dbse_writer.mutex);
+        }
+        /* Queued queries are still written when finishing */
+        job = dbse_writer.head;
+        if (job == NULL) {
+            break;
+        }
+        dbse_writer.busy = job;
+        pthread_mutex_unlock(&dbse_writer.mutex);
+
+        pthread_setspecific(tls_key_threadnr, (void *)((unsigned long)job->cnt->threadnr));
+        retcd = dbse_exec(job->cnt, job->sqlquery);
+
+        pthread_mutex_lock(&dbse_writer.mutex);
+        dbse_writer.busy = NULL;
+
+        if ((retcd == DBSE_RETRY) && !dbse_writer.finish) {
+            dbse_backoff();
+            continue;
+        }
+
+        if (retcd == DBSE_RETRY) {
+            MOTION_LOG(ERR, TYPE_DB, NO_ERRNO
+                ,_("Database not available, discarding query on shutdown"));
+            dbse_writer.dropped++;
+        } else if (dbse_writer.backoff > 0) {
+            MOTION_LOG(NTC, TYPE_DB, NO_ERRNO, _("Database available again"));
+            dbse_writer.backoff = 0;
+        }
+
+        /* Only unstarted queries are removed by dbse_flush so job is still the head */
+        dbse_writer.head = job->next;
+        if (dbse_writer.head == NULL) {
+            dbse_writer.tail = NULL;
+        }
+        dbse_writer.count--;
+        dbse_writer.full = FALSE;
+        dbse_writer.executed++;
+
+        latency = dbse_elapsed_usec(&job->tv_queued);
+        if (latency > dbse_writer.latency_max) {
+            dbse_writer.latency_max = latency;
+        }
+        job->cnt->dbse_latency = latency;
+        job->cnt->dbse_pending--;
+        pthread_cond_broadcast(&dbse_writer.cond_done);
+
+        free(job->sqlquery);
+        free(job);
+    }
+    pthread_mutex_unlock(&dbse_writer.mutex);
+
+    #if defined(HAVE_MYSQL) || defined(HAVE_MARIADB)
+        mysql_thread_end();
+    #endif
+
+    pthread_exit(NULL);
+}
+
+/** dbse_queue
+ *  Hand a query to the writer thread, or run it here when database_queue
+ *  is not set.  A query for a full queue is discarded so that a slow
+ *  database never holds up the camera.
+ */
+static void dbse_queue(struct context *cnt, char *sqlquery)
+{
+    struct dbse_job *job;
+
+    if (!dbse_writer.running) {
+        dbse_exec(cnt, sqlquery);
+        return;
+    }
+
+    pthread_mutex_lock(&dbse_writer.mutex);
+        if (dbse_writer.count >= dbse_writer.size) {
+            if (!dbse_writer.full) {
+                MOTION_LOG(WRN, TYPE_DB, NO_ERRNO
+                    ,_("Database queue full with %d queries, discarding queries")
+                    , dbse_writer.count);
+                dbse_writer.full = TRUE;
+            }
+            dbse_writer.dropped++;
+            cnt->dbse_dropped++;
+            pthread_mutex_unlock(&dbse_writer.mutex);
+            return;
+        }
+
+        job = mymalloc(sizeof(struct dbse_job));
+        job->cnt = cnt;
+        job->sqlquery = mystrdup(sqlquery);
+        job->next = NULL;
+        gettimeofday(&job->tv_queued, NULL);
+
+        if (dbse_writer.tail == NULL) {
+            dbse_writer.head = job;
+        } else {
+            dbse_writer.tail->next = job;
+        }
+        dbse_writer.tail = job;
+        dbse_writer.count++;
+        if (dbse_writer.count > dbse_writer.depth_max) {
+            dbse_writer.depth_max = dbse_writer.count;
+        }
+        cnt->dbse_pending++;
+        pthread_cond_signal(&dbse_writer.cond_job);
+    pthread_mutex_unlock(&dbse_writer.mutex);
+}
+
+/** dbse_flush
+ *  Wait until the queued queries of the camera are written.  While the
+ *  database is not available the queries not yet started are discarded
+ *  instead so a stopping camera is not held up.
+ */
+static void dbse_flush(struct context *cnt)
+{
+    struct dbse_job *job, *prev, *next;
+    int discarded;
+
+    if (!dbse_writer.running) {
+        return;
+    }
+
+    pthread_mutex_lock(&dbse_writer.mutex);
+        while (cnt->dbse_pending > 0) {
+            if ((dbse_writer.backoff == 0) ||
+                ((dbse_writer.busy != NULL) && (dbse_writer.busy->cnt == cnt))) {
+                pthread_cond_wait(&dbse_writer.cond_done, &dbse_writer.mutex);
+                continue;
+            }
+
+            discarded = 0;
+            prev = NULL;
+            for (job = dbse_writer.head; job != NULL; job = next) {
+                next = job->next;
+                if (job->cnt != cnt) {
+                    prev = job;
+                    continue;
+                }
+                if (prev == NULL) {
+                    dbse_writer.head = next;
+                } else {
+                    prev->next = next;
+                }
+                if (dbse_writer.tail == job) {
+                    dbse_writer.tail = prev;
+                }
+                free(job->sqlquery);
+                free(job);
+                dbse_writer.count--;
+                discarded++;
+            }
+            cnt->dbse_pending -= discarded;
+            cnt->dbse_dropped += discarded;
+            dbse_writer.dropped += discarded;
+            MOTION_LOG(WRN, TYPE_DB, NO_ERRNO
+                ,_("Database not available, discarded %d queued queries"), discarded);
+        }
+    pthread_mutex_unlock(&dbse_writer.mutex);
+}
+
+/** dbse_writer_init
+ *  Start the database writer thread when database_queue is set.  It runs
+ *  the queries of all the cameras so a slow database does not stall them.
+ */
+void dbse_writer_init(struct context **cntlist)
+{
+    int indx, used;
+
+    dbse_writer.running = FALSE;
+
+    if (cntlist[0]->conf.database_queue <= 0) {
+        return;
+    }
+
+    used = FALSE;
+    for (indx = 0; cntlist[indx] != NULL; indx++) {
+        if (cntlist[indx]->conf.database_type != NULL) {
+            used = TRUE;
+        }
+    }
+    if (!used) {
+        return;
+    }
+
+    dbse_writer.size = cntlist[0]->conf.database_queue;
+    dbse_writer.head = NULL;
+    dbse_writer.tail = NULL;
+    dbse_writer.busy = NULL;
+    dbse_writer.count = 0;
+    dbse_writer.finish = FALSE;
+    dbse_writer.full = FALSE;
+    dbse_writer.backoff = 0;
+    dbse_writer.executed = 0;
+    dbse_writer.retried = 0;
+    dbse_writer.dropped = 0;
+    dbse_writer.depth_max = 0;
+    dbse_writer.latency_max = 0;
+
+    if (pthread_create(&dbse_writer.thread_id, NULL, &dbse_writer_handler, NULL) != 0) {
+        MOTION_LOG(ERR, TYPE_DB, SHOW_ERRNO
+            ,_("Unable to start database writer thread, queries run on the camera threads"));
+        return;
+    }
+    dbse_writer.running = TRUE;
+
+    MOTION_LOG(NTC, TYPE_DB, NO_ERRNO
+        ,_("Database writer started with a queue of %d queries"), dbse_writer.size);
+}
+
+/** dbse_writer_deinit
+ *  Write what is still queued and stop the writer thread.  The cameras
+ *  must have ended before this is called.
+ */
+void dbse_writer_deinit(void)
+{
+    if (!dbse_writer.running) {
+        return;
+    }
+
+    pthread_mutex_lock(&dbse_writer.mutex);
+        dbse_writer.finish = TRUE;
+        pthread_cond_broadcast(&dbse_writer.cond_job);
+    pthread_mutex_unlock(&dbse_writer.mutex);
+
+    pthread_join(dbse_writer.thread_id, NULL);
+    dbse_writer.running = FALSE;
+
+    MOTION_LOG(INF, TYPE_DB, NO_ERRNO
+        ,_("Database writer: %lu queries, %lu retries, %lu discarded, max depth %d, max latency %ld ms")
+        ,dbse_writer.executed, dbse_writer.retried, dbse_writer.dropped
+        ,dbse_writer.depth_max, dbse_writer.latency_max / 1000);
 }
 
 /** dbse_firstmotion */
@@ -547,17 +1130,7 @@ void dbse_firstmotion(struct context *cnt)
         return;
     }
 
-    pthread_mutex_lock(&dbse_lock);
-        if (mystreq(cnt->conf.database_type,"mysql")) {
-            dbse_exec_mysql(sqlquery, cnt);
-        } else if (mystreq(cnt->conf.database_type,"mariadb")) {
-            dbse_exec_mariadb(sqlquery, cnt);
-        } else if (mystreq(cnt->conf.database_type,"postgresql")) {
-            dbse_exec_pgsql(sqlquery, cnt);
-        } else if (mystreq(cnt->conf.database_type,"sqlite3")) {
-            dbse_exec_sqlite3(sqlquery, cnt);
-        }
-    pthread_mutex_unlock(&dbse_lock);
+    dbse_queue(cnt, sqlquery);
 
 }
 
@@ -574,17 +1147,7 @@ void dbse_newfile(struct context *cnt, char *filename, int sqltype, struct timev
         return;
     }
 
-    pthread_mutex_lock(&dbse_lock);
-        if (mystreq(cnt->conf.database_type,"mysql")) {
-            dbse_exec_mysql(sqlquery, cnt);
-        } else if (mystreq(cnt->conf.database_type,"mariadb")) {
-            dbse_exec_mariadb(sqlquery, cnt);
-        } else if (mystreq(cnt->conf.database_type,"postgresql")) {
-            dbse_exec_pgsql(sqlquery, cnt);
-        } else if (mystreq(cnt->conf.database_type,"sqlite3")) {
-            dbse_exec_sqlite3(sqlquery, cnt);
-        }
-    pthread_mutex_unlock(&dbse_lock);
+    dbse_queue(cnt, sqlquery);
 
 }
 
@@ -600,17 +1163,7 @@ void dbse_fileclose(struct context *cnt, char *filename, int sqltype, struct tim
         return;
     }
 
-    pthread_mutex_lock(&dbse_lock);
-        if (mystreq(cnt->conf.database_type,"mysql")) {
-            dbse_exec_mysql(sqlquery, cnt);
-        } else if (mystreq(cnt->conf.database_type,"mariadb")) {
-            dbse_exec_mariadb(sqlquery, cnt);
-        } else if (mystreq(cnt->conf.database_type,"postgresql")) {
-            dbse_exec_pgsql(sqlquery, cnt);
-        } else if (mystreq(cnt->conf.database_type,"sqlite3")) {
-            dbse_exec_sqlite3(sqlquery, cnt);
-        }
-    pthread_mutex_unlock(&dbse_lock);
+    dbse_queue(cnt, sqlquery);
 
 }
 
@@ -24,11 +24,14 @@
 
 void dbse_global_init(struct context **cntlist);
 void dbse_global_deinit(struct context **cntlist);
+void dbse_writer_init(struct context **cntlist);
+void dbse_writer_deinit(void);
 
 int dbse_init(struct context *cnt, struct context **cntlist);
 void dbse_deinit(struct context *cnt);
 
 void dbse_sqlmask_update(struct context *cnt);
+void dbse_commit_due(struct context *cnt);
 void dbse_firstmotion(struct context *cnt);
 void dbse_newfile(struct context *cnt, char *filename, int sqltype, struct timeval *tv1);
 void dbse_fileclose(struct context *cnt, char *filename, int sqltype, struct timeval *tv1);
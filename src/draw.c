@@ -1082,6 +1082,40 @@ struct draw_char draw_table[]= {
 };
 
 #define NEWLINE "\\n"
+
+/**
+ * draw_text_adjust
+ *  Apply the placement rules of a line of len characters.  Returns the
+ *  number of characters to draw, or 0 when the line is not drawn.
+ */
+static int draw_text_adjust(int *startx, int starty, int width, int len, int factor)
+{
+    if (*startx > width / 2) {
+        *startx -= len * (6 * factor);
+    }
+
+    if (*startx + len * 6 * factor >= width) {
+        len = (width - *startx - 1) / (6 * factor);
+    }
+
+    if ((*startx < 1) || (starty < 1) || (len < 1)) {
+        return 0;
+    }
+
+    return len;
+}
+
+static unsigned char *draw_char_ptr(char chr)
+{
+    int pos_check = (int)chr;
+
+    if ((pos_check <0) || (pos_check >127)) {
+        pos_check = 45; /* Use a - for non ascii characters*/
+    }
+
+    return char_arr_ptr[pos_check];
+}
+
 /**
  * draw_textn
  */
@@ -1092,15 +1126,8 @@ static int draw_textn(unsigned char *image, int startx,  int starty,  int width,
     int pos, line_offset, next_char_offs;
     unsigned char *image_ptr, *char_ptr;
 
-    if (startx > width / 2) {
-        startx -= len * (6 * factor);
-    }
-
-    if (startx + len * 6 * factor >= width) {
-        len = (width-startx-1)/(6*factor);
-    }
-
-    if ((startx < 1) || (starty < 1) || (len < 1)) {
+    len = draw_text_adjust(&startx, starty, width, len, factor);
+    if (len == 0) {
         return 0;
     }
 
@@ -1110,17 +1137,11 @@ static int draw_textn(unsigned char *image, int startx,  int starty,  int width,
     image_ptr = image + startx + (starty * width);
 
     for (pos = 0; pos < len; pos++) {
-        int pos_check = (int)text[pos];
-
-        if ((pos_check <0) || (pos_check >127)) {
-            pos_check = 45; /* Use a - for non ascii characters*/
-        }
-
-        char_ptr = char_arr_ptr[pos_check];
+        unsigned char *glyph = draw_char_ptr(text[pos]);
 
         for (y = 0; y < 8 * factor; y++) {
             for (x = 0; x < 7 * factor; x++) {
-                char_ptr = char_arr_ptr[pos_check] + y/factor*7 + x/factor;
+                char_ptr = glyph + y/factor*7 + x/factor;
 
                 switch(*char_ptr) {
                 case 1:
@@ -1144,13 +1165,181 @@ static int draw_textn(unsigned char *image, int startx,  int starty,  int width,
 }
 
 /**
- * draw_text
+ * draw_cache_char
+ *  Render the character at pos of the cached line into its mask, limited to
+ *  the mask columns from col_start up to col_end.  Pixels that are not part
+ *  of the character are left as they are, like on the image.
  */
-int draw_text(unsigned char *image, int width, int height, int startx, int starty, const char *text, int factor)
+static void draw_cache_char(struct draw_line_cache *cache, int pos, int col_start, int col_end)
+{
+    int x, y, col, factor;
+    unsigned char *glyph, *row;
+
+    factor = cache->factor;
+    glyph = draw_char_ptr(cache->text[pos]);
+    col = pos * 6 * factor;
+
+    for (y = 0; y < 8 * factor; y++) {
+        row = cache->mask + y * cache->mask_width;
+        for (x = 0; x < 7 * factor; x++) {
+            if ((col + x < col_start) || (col + x >= col_end)) {
+                continue;
+            }
+            if (glyph[y/factor*7 + x/factor]) {
+                row[col + x] = glyph[y/factor*7 + x/factor];
+            }
+        }
+    }
+}
+
+/**
+ * draw_cache_spans
+ *  Turn the mask into runs of black or white pixels at their offset in the
+ *  image so drawing the line is a memset per run.
+ */
+static void draw_cache_spans(struct draw_line_cache *cache)
+{
+    int x, y, start;
+    unsigned char *row;
+
+    cache->span_count = 0;
+    for (y = 0; y < 8 * cache->factor; y++) {
+        row = cache->mask + y * cache->mask_width;
+        x = 0;
+        while (x < cache->mask_width) {
+            if (row[x] == 0) {
+                x++;
+                continue;
+            }
+            start = x;
+            while ((x < cache->mask_width) && (row[x] == row[start])) {
+                x++;
+            }
+            if (cache->span_count == cache->span_alloc) {
+                cache->span_alloc = (cache->span_alloc * 2) + 64;
+                cache->spans = myrealloc(cache->spans
+                    , cache->span_alloc * sizeof(struct draw_span), "draw_cache_spans");
+            }
+            cache->spans[cache->span_count].offset = (y * cache->width) + start;
+            cache->spans[cache->span_count].len = x - start;
+            cache->spans[cache->span_count].value = (row[start] == 1) ? 0 : 255;
+            cache->span_count++;
+        }
+    }
+}
+
+/**
+ * draw_cache_update
+ *  Bring the cached line up to date with text.  When only some characters
+ *  changed, such as the seconds of a time stamp, only the columns of those
+ *  characters are rendered again.  Returns TRUE when the spans must be rebuilt.
+ */
+static int draw_cache_update(struct draw_line_cache *cache, int startx, int starty
+        , int width, const char *text, int len, int factor)
+{
+    int pos, y, col_start, col_end, changed;
+
+    if ((cache->len != len) || (cache->factor != factor) || (cache->width != width) ||
+        (cache->startx != startx) || (cache->starty != starty)) {
+        cache->len = len;
+        cache->factor = factor;
+        cache->width = width;
+        cache->startx = startx;
+        cache->starty = starty;
+        cache->mask_width = (len * 6 * factor) + factor;
+
+        free(cache->text);
+        free(cache->mask);
+        cache->text = mymalloc(len);
+        cache->mask = mymalloc(cache->mask_width * 8 * factor);
+        memcpy(cache->text, text, len);
+        memset(cache->mask, 0, cache->mask_width * 8 * factor);
+
+        for (pos = 0; pos < len; pos++) {
+            draw_cache_char(cache, pos, 0, cache->mask_width);
+        }
+        return TRUE;
+    }
+
+    changed = FALSE;
+    for (pos = 0; pos < len; pos++) {
+        if (cache->text[pos] == text[pos]) {
+            continue;
+        }
+        cache->text[pos] = text[pos];
+        changed = TRUE;
+
+        /* The first and last column of a character are shared with its neighbours */
+        col_start = pos * 6 * factor;
+        col_end = col_start + (7 * factor);
+        for (y = 0; y < 8 * factor; y++) {
+            memset(cache->mask + (y * cache->mask_width) + col_start, 0, col_end - col_start);
+        }
+        if (pos > 0) {
+            draw_cache_char(cache, pos - 1, col_start, col_end);
+        }
+        draw_cache_char(cache, pos, col_start, col_end);
+    }
+
+    /* Characters after a changed one draw over its last column */
+    if (changed) {
+        for (pos = 1; pos < len; pos++) {
+            col_start = pos * 6 * factor;
+            draw_cache_char(cache, pos, col_start, col_start + factor);
+        }
+    }
+
+    return changed;
+}
+
+/**
+ * draw_textn_cache
+ *  Same as draw_textn but the line is rendered once into the cache and
+ *  then drawn from the cached runs of pixels.
+ */
+static int draw_textn_cache(struct draw_line_cache *cache, unsigned char *image, int startx
+        , int starty, int width, const char *text, int len, int factor)
+{
+    int indx;
+    unsigned char *image_ptr;
+
+    len = draw_text_adjust(&startx, starty, width, len, factor);
+    if (len == 0) {
+        return 0;
+    }
+
+    if (draw_cache_update(cache, startx, starty, width, text, len, factor)) {
+        draw_cache_spans(cache);
+    }
+
+    image_ptr = image + startx + (starty * width);
+    for (indx = 0; indx < cache->span_count; indx++) {
+        memset(image_ptr + cache->spans[indx].offset
+            , cache->spans[indx].value, cache->spans[indx].len);
+    }
+
+    return 0;
+}
+
+static void draw_line(struct draw_cache *cache, int line, unsigned char *image, int startx
+        , int starty, int width, const char *text, int len, int factor)
+{
+    if ((cache != NULL) && (line < DRAW_CACHE_LINES)) {
+        draw_textn_cache(&cache->lines[line], image, startx, starty, width, text, len, factor);
+    } else {
+        draw_textn(image, startx, starty, width, text, len, factor);
+    }
+}
+
+/**
+ * draw_text_lines
+ */
+static int draw_text_lines(struct draw_cache *cache, unsigned char *image, int width, int height
+        , int startx, int starty, const char *text, int factor)
 {
     int num_nl = 0;
     const char *end, *begin;
-    int line_space, txtlen;
+    int line_space, txtlen, line;
 
     /* Count the number of newlines in "text" so we scroll it up the image. */
     begin = end = text;
@@ -1189,21 +1378,57 @@ int draw_text(unsigned char *image, int width, int height, int startx, int start
     starty -= line_space * num_nl;
 
     begin = end = text;
+    line = 0;
 
     while ((end = strstr(end, NEWLINE))) {
         int len = end-begin;
 
-        draw_textn(image, startx, starty, width, begin, len, factor);
+        draw_line(cache, line++, image, startx, starty, width, begin, len, factor);
         end += sizeof(NEWLINE)-1;
         begin = end;
         starty += line_space;
     }
 
-    draw_textn(image, startx, starty, width, begin, strlen(begin), factor);
+    draw_line(cache, line, image, startx, starty, width, begin, strlen(begin), factor);
 
     return 0;
 }
 
+/**
+ * draw_text
+ */
+int draw_text(unsigned char *image, int width, int height, int startx, int starty, const char *text, int factor)
+{
+    return draw_text_lines(NULL, image, width, height, startx, starty, text, factor);
+}
+
+/**
+ * draw_text_cache
+ *  Draw text like draw_text for an overlay that is drawn on every frame at
+ *  the same position.  The rendered lines are kept in cache and only the
+ *  characters that changed since the last frame are rendered again.
+ */
+int draw_text_cache(struct draw_cache *cache, unsigned char *image, int width, int height
+        , int startx, int starty, const char *text, int factor)
+{
+    return draw_text_lines(cache, image, width, height, startx, starty, text, factor);
+}
+
+/**
+ * draw_cache_free
+ */
+void draw_cache_free(struct draw_cache *cache)
+{
+    int indx;
+
+    for (indx = 0; indx < DRAW_CACHE_LINES; indx++) {
+        free(cache->lines[indx].text);
+        free(cache->lines[indx].mask);
+        free(cache->lines[indx].spans);
+    }
+    memset(cache, 0, sizeof(struct draw_cache));
+}
+
 /**
  * initialize_chars
  */
@@ -22,9 +22,39 @@
 #ifndef _INCLUDE_DRAW_H
 #define _INCLUDE_DRAW_H
 
+/* Number of lines of a text kept in a draw_cache */
+#define DRAW_CACHE_LINES 8
+
+struct draw_span {
+    int             offset;         /* Offset of the run from the start of the line */
+    int             len;
+    unsigned char   value;          /* Pixel value of the run */
+};
+
+struct draw_line_cache {
+    char            *text;          /* Characters rendered into mask */
+    int             len;
+    int             factor;
+    int             width;          /* Image width the spans were made for */
+    int             startx;
+    int             starty;
+    unsigned char   *mask;          /* 0 untouched, 1 black, 2 white */
+    int             mask_width;
+    struct draw_span *spans;
+    int             span_count;
+    int             span_alloc;
+};
+
+struct draw_cache {
+    struct draw_line_cache lines[DRAW_CACHE_LINES];
+};
+
 int initialize_chars(void);
 
 int draw_text(unsigned char *image, int width, int height, int startx, int starty, const char *text, int factor);
+int draw_text_cache(struct draw_cache *cache, unsigned char *image, int width, int height
+        , int startx, int starty, const char *text, int factor);
+void draw_cache_free(struct draw_cache *cache);
 
 
 #endif
@@ -33,7 +33,15 @@
 #include "event.h"
 #include "video_loopback.h"
 #include "video_common.h"
+#include "webu.h"
+#include "webu_stream.h"
 #include "dbse.h"
+#include "picwriter.h"
+#include "spawner.h"
+#include "metrics.h"
+#include "eventidx.h"
+#include "trace.h"
+#include "loadtest.h"
 
 /*
  * TODO Items:
@@ -76,28 +84,15 @@ const char *eventList[] = {
  * exec_command
  *      Execute 'command' with 'arg' as its argument.
  *      if !arg command is started with no arguments
- *      Before we call execl we need to close all the file handles
- *      that the fork inherited from the parent in order not to pass
- *      the open handles on to the shell
+ *      The command is started by the spawner helper so the motion
+ *      process is not forked for every saved picture.
  */
 static void exec_command(struct context *cnt, char *command, char *filename, int filetype)
 {
     char stamp[PATH_MAX];
     mystrftime(cnt, stamp, sizeof(stamp), command, &cnt->current_image->timestamp_tv, filename, filetype);
 
-    if (!fork()) {
-
-        /* Detach from parent */
-        setsid();
-
-        execl("/bin/sh", "sh", "-c", stamp, " &", NULL);
-
-        /* if above function succeeds the program never reach here */
-        MOTION_LOG(ALR, TYPE_EVENTS, SHOW_ERRNO
-            ,_("Unable to start external command '%s'"), stamp);
-
-        exit(1);
-    }
+    spawner_exec(stamp);
 
     MOTION_LOG(DBG, TYPE_EVENTS, NO_ERRNO
         ,_("Executing external command '%s'"), stamp);
@@ -233,6 +228,60 @@ static void event_sqlnewfile(struct context *cnt, motion_event eventtype
 
 }
 
+static void event_index_start(struct context *cnt, motion_event eventtype
+            , struct image_data *img_data, char *filename, void *eventdata, struct timeval *tv1)
+{
+    (void)eventtype;
+    (void)img_data;
+    (void)filename;
+    (void)eventdata;
+
+    eventidx_start(cnt, tv1);
+}
+
+static void event_index_motion(struct context *cnt, motion_event eventtype
+            , struct image_data *img_data, char *filename, void *eventdata, struct timeval *tv1)
+{
+    (void)eventtype;
+    (void)filename;
+    (void)eventdata;
+    (void)tv1;
+
+    eventidx_motion(cnt, img_data);
+}
+
+static void event_index_newfile(struct context *cnt, motion_event eventtype
+            , struct image_data *img_data, char *filename, void *eventdata, struct timeval *tv1)
+{
+    (void)eventtype;
+    (void)img_data;
+    (void)tv1;
+
+    eventidx_file(cnt, filename, (unsigned long)eventdata);
+}
+
+static void event_loadtest_newfile(struct context *cnt, motion_event eventtype
+            , struct image_data *img_data, char *filename, void *eventdata, struct timeval *tv1)
+{
+    (void)eventtype;
+    (void)img_data;
+    (void)eventdata;
+    (void)tv1;
+
+    loadtest_file(cnt, filename);
+}
+
+static void event_index_end(struct context *cnt, motion_event eventtype
+            , struct image_data *img_data, char *filename, void *eventdata, struct timeval *tv1)
+{
+    (void)eventtype;
+    (void)img_data;
+    (void)filename;
+    (void)eventdata;
+
+    eventidx_end(cnt, tv1);
+}
+
 static void event_sqlfileclose(struct context *cnt, motion_event eventtype
             , struct image_data *img_data, char *filename, void *eventdata, struct timeval *tv1)
 {
@@ -293,104 +342,299 @@ static void on_event_end_command(struct context *cnt, motion_event eventtype
     }
 }
 
+/* Encode image into a new buffer for strm and publish it to the connections */
+static void event_stream_encode(struct context *cnt, struct stream_data *strm
+            , unsigned char *image, int width, int height)
+{
+    struct stream_buffer *buf;
+
+    buf = webu_stream_getbuf(cnt, strm);
+    buf->jpeg_size = put_picture_memory(cnt
+        ,buf->jpeg_data
+        ,buf->alloc_size
+        ,image
+        ,cnt->conf.stream_quality
+        ,width
+        ,height);
+    webu_stream_putbuf(cnt, strm, buf);
+}
+
+/** event_stream_scale
+ *  Scale image into scale at width, keeping the aspect ratio.  Both sizes
+ *  are kept multiples of 8 as the jpg encoder needs.  Returns FALSE when the
+ *  image is not larger than the scaled size and should be sent as it is.
+ */
+static int event_stream_scale(struct context *cnt, struct stream_scale *scale
+            , unsigned char *image, int width)
+{
+    int height;
+
+    width = width - (width % 8);
+    height = (int)(((long)cnt->imgs.height * width) / cnt->imgs.width);
+    height = height - (height % 8);
+    if ((width >= cnt->imgs.width) || (height < 8)) {
+        return FALSE;
+    }
+
+    /* The sizes change when the camera is restarted with new dimensions */
+    if ((scale->scaler == NULL) || (scale->width != width) || (scale->height != height)) {
+        pic_scaler_free(scale->scaler);
+        free(scale->image);
+        scale->width = width;
+        scale->height = height;
+        scale->image = mymalloc((width * height * 3) / 2);
+        scale->scaler = pic_scaler_init(cnt->imgs.width, cnt->imgs.height, width, height);
+    }
+
+    pic_scaler_run(scale->scaler, image, scale->image);
+
+    return TRUE;
+}
+
+static void event_stream_encode_scaled(struct context *cnt, struct stream_data *strm
+            , struct stream_scale *scale, unsigned char *image, int width)
+{
+    if (event_stream_scale(cnt, scale, image, width)) {
+        event_stream_encode(cnt, strm, scale->image, scale->width, scale->height);
+    } else {
+        event_stream_encode(cnt, strm, image, cnt->imgs.width, cnt->imgs.height);
+    }
+}
+
+static void event_stream_encode_sub(struct context *cnt, unsigned char *image)
+{
+    event_stream_encode_scaled(cnt, &cnt->stream_sub, &cnt->stream_sub_scale
+        , image, cnt->imgs.width / 2);
+}
+
+/* Encode the scaled streams that have connections */
+static void event_stream_encode_renditions(struct context *cnt, unsigned char *image)
+{
+    struct stream_scaled *scaled;
+    int indx, cnct_count;
+
+    for (indx = 0; indx < cnt->stream_scaled_count; indx++) {
+        scaled = &cnt->stream_scaled[indx];
+        pthread_mutex_lock(&cnt->mutex_stream);
+            cnct_count = scaled->strm.cnct_count;
+        pthread_mutex_unlock(&cnt->mutex_stream);
+        if (cnct_count > 0) {
+            event_stream_encode_scaled(cnt, &scaled->strm, &scaled->scale
+                , image, scaled->width_conf);
+        }
+    }
+}
+
+static void event_stream_swap(unsigned char **img1, unsigned char **img2)
+{
+    unsigned char *tmp;
+
+    tmp = *img1;
+    *img1 = *img2;
+    *img2 = tmp;
+}
+
+/**
+ * event_stream_handler
+ *   Stream encoder thread.  Takes the newest images queued by event_stream_put,
+ *   encodes them without holding any lock used by the motion loop and publishes
+ *   them to the connections.
+ */
+static void *event_stream_handler(void *arg)
+{
+    struct context *cnt = arg;
+    struct stream_encoder *enc = &cnt->stream_enc;
+    int pending;
+
+    util_threadname_set("se", cnt->threadnr, cnt->conf.camera_name);
+
+    pthread_setspecific(tls_key_threadnr, (void *)((unsigned long)cnt->threadnr));
+
+    pthread_mutex_lock(&enc->mutex);
+    while (!enc->finish) {
+        if (enc->pending == 0) {
+            pthread_cond_wait(&enc->cond, &enc->mutex);
+            continue;
+        }
+        pending = enc->pending;
+        enc->pending = 0;
+        event_stream_swap(&enc->pend_norm, &enc->work_norm);
+        event_stream_swap(&enc->pend_motion, &enc->work_motion);
+        event_stream_swap(&enc->pend_source, &enc->work_source);
+        pthread_mutex_unlock(&enc->mutex);
+
+        if (pending & STREAM_ENC_NORM) {
+            event_stream_encode(cnt, &cnt->stream_norm
+                ,enc->work_norm, cnt->imgs.width, cnt->imgs.height);
+        }
+        if (pending & STREAM_ENC_SUB) {
+            event_stream_encode_sub(cnt, enc->work_norm);
+        }
+        if (pending & STREAM_ENC_SCALED) {
+            event_stream_encode_renditions(cnt, enc->work_norm);
+        }
+        if (pending & STREAM_ENC_MOTION) {
+            event_stream_encode(cnt, &cnt->stream_motion
+                ,enc->work_motion, cnt->imgs.width, cnt->imgs.height);
+        }
+        if (pending & STREAM_ENC_SOURCE) {
+            event_stream_encode(cnt, &cnt->stream_source
+                ,enc->work_source, cnt->imgs.width, cnt->imgs.height);
+        }
+
+        pthread_mutex_lock(&enc->mutex);
+        enc->encoded++;
+    }
+    pthread_mutex_unlock(&enc->mutex);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * event_stream_start
+ *   Start the stream encoder thread of the camera.  The image buffers are
+ *   allocated when the first connection needs them.
+ */
+void event_stream_start(struct context *cnt)
+{
+    struct stream_encoder *enc = &cnt->stream_enc;
+
+    memset(enc, 0, sizeof(struct stream_encoder));
+    pthread_mutex_init(&enc->mutex, NULL);
+    pthread_cond_init(&enc->cond, NULL);
+
+    if (pthread_create(&enc->thread_id, NULL, &event_stream_handler, cnt) != 0) {
+        MOTION_LOG(ERR, TYPE_STREAM, SHOW_ERRNO
+            ,_("Unable to start stream encoder thread, encoding in the motion loop"));
+        return;
+    }
+    enc->running = TRUE;
+}
+
+void event_stream_stop(struct context *cnt)
+{
+    struct stream_encoder *enc = &cnt->stream_enc;
+
+    if (enc->running) {
+        pthread_mutex_lock(&enc->mutex);
+            enc->finish = TRUE;
+            pthread_cond_signal(&enc->cond);
+        pthread_mutex_unlock(&enc->mutex);
+        pthread_join(enc->thread_id, NULL);
+        enc->running = FALSE;
+
+        MOTION_LOG(INF, TYPE_STREAM, NO_ERRNO
+            ,_("Stream encoder: %lu images encoded, %lu dropped")
+            ,enc->encoded, enc->dropped);
+    }
+
+    free(enc->pend_norm);
+    free(enc->pend_motion);
+    free(enc->pend_source);
+    free(enc->work_norm);
+    free(enc->work_motion);
+    free(enc->work_source);
+    enc->pend_norm = enc->pend_motion = enc->pend_source = NULL;
+    enc->work_norm = enc->work_motion = enc->work_source = NULL;
+
+    pthread_cond_destroy(&enc->cond);
+    pthread_mutex_destroy(&enc->mutex);
+}
+
+/* Copy an image for the encoder, allocating the pend buffer on first use */
+static void event_stream_copy(struct context *cnt, unsigned char **pend, unsigned char *image)
+{
+    if (*pend == NULL) {
+        *pend = mymalloc(cnt->imgs.size_norm);
+    }
+    memcpy(*pend, image, cnt->imgs.size_norm);
+}
+
 static void event_stream_put(struct context *cnt, motion_event eventtype
             , struct image_data *img_data, char *filename, void *eventdata, struct timeval *tv1)
 {
-    int subsize;
+    struct stream_encoder *enc = &cnt->stream_enc;
+    struct metrics_timer timer;
+    int pending, indx;
 
     (void)eventtype;
     (void)filename;
     (void)eventdata;
     (void)tv1;
 
-
+    pending = 0;
     pthread_mutex_lock(&cnt->mutex_stream);
-        /* Normal stream processing */
-        if (cnt->stream_norm.cnct_count > 0) {
-            if (cnt->stream_norm.jpeg_data == NULL) {
-                cnt->stream_norm.jpeg_data = mymalloc(cnt->imgs.size_norm);
-            }
-            if (img_data->image_norm != NULL) {
-                cnt->stream_norm.jpeg_size = put_picture_memory(cnt
-                    ,cnt->stream_norm.jpeg_data
-                    ,cnt->imgs.size_norm
-                    ,img_data->image_norm
-                    ,cnt->conf.stream_quality
-                    ,cnt->imgs.width
-                    ,cnt->imgs.height);
-            }
+        if ((cnt->stream_norm.cnct_count > 0) && (img_data->image_norm != NULL)) {
+            pending |= STREAM_ENC_NORM;
         }
-
-        /* Substream processing */
-        if (cnt->stream_sub.cnct_count > 0) {
-            if (cnt->stream_sub.jpeg_data == NULL) {
-                cnt->stream_sub.jpeg_data = mymalloc(cnt->imgs.size_norm);
-            }
-            if (img_data->image_norm != NULL) {
-                /* Resulting substream image must be multiple of 8 */
-                if (((cnt->imgs.width  % 16) == 0)  &&
-                    ((cnt->imgs.height % 16) == 0)) {
-                    subsize = ((cnt->imgs.width / 2) * (cnt->imgs.height / 2) * 3 / 2);
-                    if (cnt->imgs.substream_image == NULL) {
-                        cnt->imgs.substream_image = mymalloc(subsize);
-                    }
-                    pic_scale_img(cnt->imgs.width
-                        ,cnt->imgs.height
-                        ,img_data->image_norm
-                        ,cnt->imgs.substream_image);
-                    cnt->stream_sub.jpeg_size = put_picture_memory(cnt
-                        ,cnt->stream_sub.jpeg_data
-                        ,subsize
-                        ,cnt->imgs.substream_image
-                        ,cnt->conf.stream_quality
-                        ,(cnt->imgs.width / 2)
-                        ,(cnt->imgs.height / 2));
-                } else {
-                    /* Substream was not multiple of 8 so send full image*/
-                    cnt->stream_sub.jpeg_size = put_picture_memory(cnt
-                        ,cnt->stream_sub.jpeg_data
-                        ,cnt->imgs.size_norm
-                        ,img_data->image_norm
-                        ,cnt->conf.stream_quality
-                        ,cnt->imgs.width
-                        ,cnt->imgs.height);
-                }
+        if ((cnt->stream_sub.cnct_count > 0) && (img_data->image_norm != NULL)) {
+            pending |= STREAM_ENC_SUB;
+        }
+        if ((cnt->stream_motion.cnct_count > 0) && (cnt->imgs.img_motion.image_norm != NULL)) {
+            pending |= STREAM_ENC_MOTION;
+        }
+        if ((cnt->stream_source.cnct_count > 0) && (cnt->imgs.image_virgin.image_norm != NULL)) {
+            pending |= STREAM_ENC_SOURCE;
+        }
+        for (indx = 0; indx < cnt->stream_scaled_count; indx++) {
+            if ((cnt->stream_scaled[indx].strm.cnct_count > 0) && (img_data->image_norm != NULL)) {
+                pending |= STREAM_ENC_SCALED;
             }
         }
+    pthread_mutex_unlock(&cnt->mutex_stream);
 
-        /* Motion stream processing */
-        if (cnt->stream_motion.cnct_count > 0) {
-            if (cnt->stream_motion.jpeg_data == NULL) {
-                cnt->stream_motion.jpeg_data = mymalloc(cnt->imgs.size_norm);
-            }
-            if (cnt->imgs.img_motion.image_norm != NULL) {
-                cnt->stream_motion.jpeg_size = put_picture_memory(cnt
-                    ,cnt->stream_motion.jpeg_data
-                    ,cnt->imgs.size_norm
-                    ,cnt->imgs.img_motion.image_norm
-                    ,cnt->conf.stream_quality
-                    ,cnt->imgs.width
-                    ,cnt->imgs.height);
-            }
+    if (pending == 0) {
+        return;
+    }
+
+    metrics_start(cnt, &timer);
+
+    if (pending & (STREAM_ENC_NORM | STREAM_ENC_SUB | STREAM_ENC_SCALED)) {
+        motion_image_overlay(cnt, img_data);
+    }
+
+    if (!enc->running) {
+        if (pending & STREAM_ENC_NORM) {
+            event_stream_encode(cnt, &cnt->stream_norm
+                ,img_data->image_norm, cnt->imgs.width, cnt->imgs.height);
         }
+        if (pending & STREAM_ENC_SUB) {
+            event_stream_encode_sub(cnt, img_data->image_norm);
+        }
+        if (pending & STREAM_ENC_SCALED) {
+            event_stream_encode_renditions(cnt, img_data->image_norm);
+        }
+        if (pending & STREAM_ENC_MOTION) {
+            event_stream_encode(cnt, &cnt->stream_motion
+                ,cnt->imgs.img_motion.image_norm, cnt->imgs.width, cnt->imgs.height);
+        }
+        if (pending & STREAM_ENC_SOURCE) {
+            event_stream_encode(cnt, &cnt->stream_source
+                ,cnt->imgs.image_virgin.image_norm, cnt->imgs.width, cnt->imgs.height);
+        }
+        metrics_stop(cnt, METRICS_STREAM, &timer);
+        return;
+    }
 
-        /* Source stream processing */
-        if (cnt->stream_source.cnct_count > 0) {
-            if (cnt->stream_source.jpeg_data == NULL) {
-                cnt->stream_source.jpeg_data = mymalloc(cnt->imgs.size_norm);
-            }
-            if (cnt->imgs.image_virgin.image_norm != NULL) {
-                cnt->stream_source.jpeg_size = put_picture_memory(cnt
-                    ,cnt->stream_source.jpeg_data
-                    ,cnt->imgs.size_norm
-                    ,cnt->imgs.image_virgin.image_norm
-                    ,cnt->conf.stream_quality
-                    ,cnt->imgs.width
-                    ,cnt->imgs.height);
-            }
+    /* Replace whatever the encoder has not taken yet with the newest images */
+    pthread_mutex_lock(&enc->mutex);
+        if (enc->pending != 0) {
+            enc->dropped++;
         }
-    pthread_mutex_unlock(&cnt->mutex_stream);
+        if (pending & (STREAM_ENC_NORM | STREAM_ENC_SUB | STREAM_ENC_SCALED)) {
+            event_stream_copy(cnt, &enc->pend_norm, img_data->image_norm);
+        }
+        if (pending & STREAM_ENC_MOTION) {
+            event_stream_copy(cnt, &enc->pend_motion, cnt->imgs.img_motion.image_norm);
+        }
+        if (pending & STREAM_ENC_SOURCE) {
+            event_stream_copy(cnt, &enc->pend_source, cnt->imgs.image_virgin.image_norm);
+        }
+        enc->pending = pending;
+        pthread_cond_signal(&enc->cond);
+    pthread_mutex_unlock(&enc->mutex);
 
+    metrics_stop(cnt, METRICS_STREAM, &timer);
 }
 
 
@@ -398,12 +642,21 @@ static void event_stream_put(struct context *cnt, motion_event eventtype
 static void event_vlp_putpipe(struct context *cnt, motion_event eventtype
             , struct image_data *img_data, char *filename, void *eventdata, struct timeval *tv1)
 {
+    struct vlp_mmap *vmap;
+
     (void)eventtype;
     (void)filename;
-    (void)tv1;
 
     if (*(int *)eventdata >= 0) {
-        if (vlp_putpipe(*(int *)eventdata, img_data->image_norm, cnt->imgs.size_norm) == -1) {
+        /* The eventdata is either the normal or the motion pipe of the camera */
+        if (eventdata == &cnt->pipe) {
+            vmap = cnt->pipe_mmap;
+        } else {
+            vmap = cnt->mpipe_mmap;
+        }
+        motion_image_overlay(cnt, img_data);
+        if (vlp_putpipe(*(int *)eventdata, vmap, img_data->image_norm
+                , cnt->imgs.size_norm, tv1) == -1) {
             MOTION_LOG(ERR, TYPE_EVENTS, SHOW_ERRNO
                 ,_("Failed to put image into video pipe"));
         }
@@ -457,11 +710,14 @@ static void event_image_detect(struct context *cnt, motion_event eventtype
 
         passthrough = util_check_passthrough(cnt);
         if ((cnt->imgs.size_high > 0) && (!passthrough)) {
-            put_picture(cnt, fullfilename,img_data->image_high, FTYPE_IMAGE);
+            motion_image_high(cnt, img_data);
+            picwriter_save(cnt, fullfilename, img_data->image_high, FTYPE_IMAGE
+                , FTYPE_IMAGE, tv1, NULL, NULL);
         } else {
-            put_picture(cnt, fullfilename,img_data->image_norm, FTYPE_IMAGE);
+            motion_image_overlay(cnt, img_data);
+            picwriter_save(cnt, fullfilename, img_data->image_norm, FTYPE_IMAGE
+                , FTYPE_IMAGE, tv1, NULL, NULL);
         }
-        event(cnt, EVENT_FILECREATE, NULL, fullfilename, (void *)FTYPE_IMAGE, tv1);
     }
 }
 
@@ -502,8 +758,8 @@ static void event_imagem_detect(struct context *cnt, motion_event eventtype
             , cnt->conf.target_dir
             , (int)(PATH_MAX-2-strlen(cnt->conf.target_dir)-strlen(imageext(cnt)))
             , filenamem, imageext(cnt));
-        put_picture(cnt, fullfilenamem, cnt->imgs.img_motion.image_norm, FTYPE_IMAGE_MOTION);
-        event(cnt, EVENT_FILECREATE, NULL, fullfilenamem, (void *)FTYPE_IMAGE, tv1);
+        picwriter_save(cnt, fullfilenamem, cnt->imgs.img_motion.image_norm, FTYPE_IMAGE_MOTION
+            , FTYPE_IMAGE, tv1, NULL, NULL);
     }
 }
 
@@ -548,28 +804,23 @@ static void event_image_snapshot(struct context *cnt, motion_event eventtype
             , (int)(PATH_MAX-1-strlen(cnt->conf.target_dir))
             , fname);
 
-        passthrough = util_check_passthrough(cnt);
-        if ((cnt->imgs.size_high > 0) && (!passthrough)) {
-            put_picture(cnt, fullfilename, img_data->image_high, FTYPE_IMAGE_SNAPSHOT);
-        } else {
-            put_picture(cnt, fullfilename, img_data->image_norm, FTYPE_IMAGE_SNAPSHOT);
-        }
-        event(cnt, EVENT_FILECREATE, NULL, fullfilename, (void *)FTYPE_IMAGE_SNAPSHOT, tv1);
-
         /*
-         *  Update symbolic link *after* image has been written so that
-         *  the link always points to a valid file.
+         *  The symbolic link is updated *after* the image has been written so
+         *  that the link always points to a valid file.
          */
         snprintf(linkpath, PATH_MAX, "%.*s/lastsnap.%s"
             , (int)(PATH_MAX-strlen("/lastsnap.")-strlen(imageext(cnt)))
             , cnt->conf.target_dir, imageext(cnt));
 
-        remove(linkpath);
-
-        if (symlink(fname, linkpath)) {
-            MOTION_LOG(ERR, TYPE_EVENTS, SHOW_ERRNO
-                ,_("Could not create symbolic link [%s]"), fname);
-            return;
+        passthrough = util_check_passthrough(cnt);
+        if ((cnt->imgs.size_high > 0) && (!passthrough)) {
+            motion_image_high(cnt, img_data);
+            picwriter_save(cnt, fullfilename, img_data->image_high, FTYPE_IMAGE_SNAPSHOT
+                , FTYPE_IMAGE_SNAPSHOT, tv1, fname, linkpath);
+        } else {
+            motion_image_overlay(cnt, img_data);
+            picwriter_save(cnt, fullfilename, img_data->image_norm, FTYPE_IMAGE_SNAPSHOT
+                , FTYPE_IMAGE_SNAPSHOT, tv1, fname, linkpath);
         }
     } else {
         mystrftime(cnt, filepath, sizeof(filepath), cnt->conf.snapshot_filename, tv1, NULL, 0);
@@ -585,17 +836,36 @@ static void event_image_snapshot(struct context *cnt, motion_event eventtype
 
         passthrough = util_check_passthrough(cnt);
         if ((cnt->imgs.size_high > 0) && (!passthrough)) {
-            put_picture(cnt, fullfilename, img_data->image_high, FTYPE_IMAGE_SNAPSHOT);
+            motion_image_high(cnt, img_data);
+            picwriter_save(cnt, fullfilename, img_data->image_high, FTYPE_IMAGE_SNAPSHOT
+                , FTYPE_IMAGE_SNAPSHOT, tv1, NULL, NULL);
         } else {
-            put_picture(cnt, fullfilename, img_data->image_norm, FTYPE_IMAGE_SNAPSHOT);
+            motion_image_overlay(cnt, img_data);
+            picwriter_save(cnt, fullfilename, img_data->image_norm, FTYPE_IMAGE_SNAPSHOT
+                , FTYPE_IMAGE_SNAPSHOT, tv1, NULL, NULL);
         }
-
-        event(cnt, EVENT_FILECREATE, NULL, fullfilename, (void *)FTYPE_IMAGE_SNAPSHOT, tv1);
     }
 
     cnt->snapshot = 0;
 }
 
+/**
+ * event_image_flush
+ *      Collects the pictures still being written by the picture writer
+ *      threads so their file events come before the end of the event.
+ */
+static void event_image_flush(struct context *cnt, motion_event eventtype
+            , struct image_data *img_data, char *filename, void *eventdata, struct timeval *tv1)
+{
+    (void)eventtype;
+    (void)img_data;
+    (void)filename;
+    (void)eventdata;
+    (void)tv1;
+
+    picwriter_flush(cnt);
+}
+
 /**
  * event_image_preview
  *      event_image_preview
@@ -873,11 +1143,13 @@ static void event_extpipe_put(struct context *cnt, motion_event eventtype
         /* Check that is open */
         if ((cnt->extpipe_open) && (fileno(cnt->extpipe) > 0)) {
             if ((cnt->imgs.size_high > 0) && (!passthrough)) {
+                motion_image_high(cnt, img_data);
                 if (!fwrite(img_data->image_high, cnt->imgs.size_high, 1, cnt->extpipe)) {
                     MOTION_LOG(ERR, TYPE_EVENTS, SHOW_ERRNO
                         ,_("Error writing in pipe , state error %d"), ferror(cnt->extpipe));
                 }
             } else {
+                motion_image_overlay(cnt, img_data);
                 if (!fwrite(img_data->image_norm, cnt->imgs.size_norm, 1, cnt->extpipe)) {
                     MOTION_LOG(ERR, TYPE_EVENTS, SHOW_ERRNO
                         ,_("Error writing in pipe , state error %d"), ferror(cnt->extpipe));
@@ -1037,6 +1309,13 @@ static void event_ffmpeg_newfile(struct context *cnt, motion_event eventtype
         }
         cnt->ffmpeg_output->motion_images = 0;
         cnt->ffmpeg_output->passthrough =util_check_passthrough(cnt);
+        cnt->ffmpeg_output->passthrough_preroll = cnt->conf.movie_passthrough_preroll;
+        cnt->ffmpeg_output->threads = cnt->conf.movie_threads;
+        cnt->ffmpeg_output->thread_type = cnt->conf.movie_thread_type;
+        cnt->ffmpeg_output->queue_size = cnt->conf.movie_queue;
+        cnt->ffmpeg_output->write_buffer = cnt->conf.movie_write_buffer;
+        cnt->ffmpeg_output->preallocate = cnt->conf.movie_preallocate;
+        cnt->ffmpeg_output->threadnr = cnt->threadnr;
 
 
         retcd = ffmpeg_open(cnt->ffmpeg_output);
@@ -1073,8 +1352,15 @@ static void event_ffmpeg_newfile(struct context *cnt, motion_event eventtype
         }
         cnt->ffmpeg_output_motion->motion_images = TRUE;
         cnt->ffmpeg_output_motion->passthrough = FALSE;
+        cnt->ffmpeg_output_motion->passthrough_preroll = 0;
         cnt->ffmpeg_output_motion->high_resolution = FALSE;
         cnt->ffmpeg_output_motion->rtsp_data = NULL;
+        cnt->ffmpeg_output_motion->threads = cnt->conf.movie_threads;
+        cnt->ffmpeg_output_motion->thread_type = cnt->conf.movie_thread_type;
+        cnt->ffmpeg_output_motion->queue_size = cnt->conf.movie_queue;
+        cnt->ffmpeg_output_motion->write_buffer = cnt->conf.movie_write_buffer;
+        cnt->ffmpeg_output_motion->preallocate = cnt->conf.movie_preallocate;
+        cnt->ffmpeg_output_motion->threadnr = cnt->threadnr;
 
         retcd = ffmpeg_open(cnt->ffmpeg_output_motion);
         if (retcd < 0) {
@@ -1143,8 +1429,16 @@ static void event_ffmpeg_timelapse(struct context *cnt, motion_event eventtype
         cnt->ffmpeg_timelapse->test_mode = FALSE;
         cnt->ffmpeg_timelapse->gop_cnt = 0;
         cnt->ffmpeg_timelapse->motion_images = FALSE;
+        cnt->ffmpeg_timelapse->threads = cnt->conf.movie_threads;
+        cnt->ffmpeg_timelapse->thread_type = cnt->conf.movie_thread_type;
+        cnt->ffmpeg_timelapse->queue_size = 0;
+        cnt->ffmpeg_timelapse->write_buffer = 0;
+        cnt->ffmpeg_timelapse->preallocate = 0;
+        cnt->ffmpeg_timelapse->threadnr = cnt->threadnr;
         cnt->ffmpeg_timelapse->passthrough = FALSE;
+        cnt->ffmpeg_timelapse->passthrough_preroll = 0;
         cnt->ffmpeg_timelapse->rtsp_data = NULL;
+        cnt->ffmpeg_timelapse->tlapse_fsync = cnt->conf.timelapse_fsync;
 
         if ((mystreq(cnt->conf.timelapse_codec,"mpg")) ||
             (mystreq(cnt->conf.timelapse_codec,"swf"))) {
@@ -1178,6 +1472,8 @@ static void event_ffmpeg_timelapse(struct context *cnt, motion_event eventtype
         event(cnt, EVENT_FILECREATE, NULL, cnt->timelapsefilename, (void *)FTYPE_MPEG_TIMELAPSE, tv1);
     }
 
+    motion_image_overlay(cnt, img_data);
+    motion_image_high(cnt, img_data);
     if (ffmpeg_put_image(cnt->ffmpeg_timelapse, img_data, tv1) == -1) {
         MOTION_LOG(ERR, TYPE_EVENTS, NO_ERRNO, _("Error encoding image"));
     }
@@ -1187,11 +1483,16 @@ static void event_ffmpeg_timelapse(struct context *cnt, motion_event eventtype
 static void event_ffmpeg_put(struct context *cnt, motion_event eventtype
             , struct image_data *img_data, char *filename, void *eventdata, struct timeval *tv1)
 {
+    struct metrics_timer timer;
+
     (void)eventtype;
     (void)filename;
     (void)eventdata;
 
+    metrics_start(cnt, &timer);
     if (cnt->ffmpeg_output) {
+        motion_image_overlay(cnt, img_data);
+        motion_image_high(cnt, img_data);
         if (ffmpeg_put_image(cnt->ffmpeg_output, img_data, tv1) == -1) {
             MOTION_LOG(ERR, TYPE_EVENTS, NO_ERRNO, _("Error encoding image"));
         }
@@ -1201,6 +1502,7 @@ static void event_ffmpeg_put(struct context *cnt, motion_event eventtype
             MOTION_LOG(ERR, TYPE_EVENTS, NO_ERRNO, _("Error encoding image"));
         }
     }
+    metrics_stop(cnt, METRICS_ENCODE, &timer);
 }
 
 static void event_ffmpeg_closefile(struct context *cnt, motion_event eventtype
@@ -1252,152 +1554,218 @@ static void event_ffmpeg_timelapseend(struct context *cnt, motion_event eventtyp
 struct event_handlers {
     motion_event eventtype;
     event_handler handler;
+    const char *name;
 };
 
 struct event_handlers event_handlers[] = {
     {
     EVENT_FILECREATE,
-    event_sqlnewfile
+    event_sqlnewfile,
+    "event_sqlnewfile"
+    },
+    {
+    EVENT_FILECREATE,
+    event_index_newfile,
+    "event_index_newfile"
+    },
+    {
+    EVENT_FILECREATE,
+    event_loadtest_newfile,
+    "event_loadtest_newfile"
     },
     {
     EVENT_FILECREATE,
-    on_picture_save_command
+    on_picture_save_command,
+    "on_picture_save_command"
     },
     {
     EVENT_FILECREATE,
-    event_newfile
+    event_newfile,
+    "event_newfile"
     },
     {
     EVENT_MOTION,
-    event_beep
+    event_beep,
+    "event_beep"
     },
     {
     EVENT_MOTION,
-    on_motion_detected_command
+    on_motion_detected_command,
+    "on_motion_detected_command"
+    },
+    {
+    EVENT_MOTION,
+    event_index_motion,
+    "event_index_motion"
     },
     {
     EVENT_AREA_DETECTED,
-    on_area_command
+    on_area_command,
+    "on_area_command"
+    },
+    {
+    EVENT_FIRSTMOTION,
+    event_sqlfirstmotion,
+    "event_sqlfirstmotion"
     },
     {
     EVENT_FIRSTMOTION,
-    event_sqlfirstmotion
+    event_index_start,
+    "event_index_start"
     },
     {
     EVENT_FIRSTMOTION,
-    on_event_start_command
+    on_event_start_command,
+    "on_event_start_command"
     },
     {
     EVENT_ENDMOTION,
-    on_event_end_command
+    event_image_flush,
+    "event_image_flush"
+    },
+    {
+    EVENT_ENDMOTION,
+    on_event_end_command,
+    "on_event_end_command"
     },
     {
     EVENT_IMAGE_DETECTED,
-    event_image_detect
+    event_image_detect,
+    "event_image_detect"
     },
     {
     EVENT_IMAGEM_DETECTED,
-    event_imagem_detect
+    event_imagem_detect,
+    "event_imagem_detect"
     },
     {
     EVENT_IMAGE_SNAPSHOT,
-    event_image_snapshot
+    event_image_snapshot,
+    "event_image_snapshot"
     },
     #if defined(HAVE_V4L2) && !defined(BSD)
         {
         EVENT_IMAGE,
-        event_vlp_putpipe
+        event_vlp_putpipe,
+        "event_vlp_putpipe"
         },
         {
         EVENT_IMAGEM,
-        event_vlp_putpipe
+        event_vlp_putpipe,
+        "event_vlp_putpipe"
         },
     #endif /* defined(HAVE_V4L2) && !defined(BSD) */
     {
     EVENT_IMAGE_PREVIEW,
-    event_image_preview
+    event_image_preview,
+    "event_image_preview"
     },
     {
     EVENT_STREAM,
-    event_stream_put
+    event_stream_put,
+    "event_stream_put"
     },
     {
     EVENT_FIRSTMOTION,
-    event_ffmpeg_newfile
+    event_ffmpeg_newfile,
+    "event_ffmpeg_newfile"
     },
     {
     EVENT_IMAGE_DETECTED,
-    event_ffmpeg_put
+    event_ffmpeg_put,
+    "event_ffmpeg_put"
     },
     {
     EVENT_FFMPEG_PUT,
-    event_ffmpeg_put
+    event_ffmpeg_put,
+    "event_ffmpeg_put"
     },
     {
     EVENT_ENDMOTION,
-    event_ffmpeg_closefile
+    event_ffmpeg_closefile,
+    "event_ffmpeg_closefile"
     },
     {
     EVENT_TIMELAPSE,
-    event_ffmpeg_timelapse
+    event_ffmpeg_timelapse,
+    "event_ffmpeg_timelapse"
     },
     {
     EVENT_TIMELAPSEEND,
-    event_ffmpeg_timelapseend
+    event_ffmpeg_timelapseend,
+    "event_ffmpeg_timelapseend"
     },
     {
     EVENT_FILECLOSE,
-    event_sqlfileclose
+    event_sqlfileclose,
+    "event_sqlfileclose"
     },
     {
     EVENT_FILECLOSE,
-    on_movie_end_command
+    on_movie_end_command,
+    "on_movie_end_command"
     },
     {
     EVENT_FILECLOSE,
-    event_closefile
+    event_closefile,
+    "event_closefile"
     },
     {
     EVENT_FIRSTMOTION,
-    event_create_extpipe
+    event_create_extpipe,
+    "event_create_extpipe"
     },
     {
     EVENT_IMAGE_DETECTED,
-    event_extpipe_put
+    event_extpipe_put,
+    "event_extpipe_put"
     },
     {
     EVENT_FFMPEG_PUT,
-    event_extpipe_put
+    event_extpipe_put,
+    "event_extpipe_put"
     },
     {
     EVENT_ENDMOTION,
-    event_extpipe_end
+    event_extpipe_end,
+    "event_extpipe_end"
     },
     {
     EVENT_CAMERA_LOST,
-    event_camera_lost
+    event_camera_lost,
+    "event_camera_lost"
     },
     {
     EVENT_CAMERA_FOUND,
-    event_camera_found
+    event_camera_found,
+    "event_camera_found"
     },
     {
     EVENT_MOVIE_END,
-    event_ffmpeg_closefile
+    event_ffmpeg_closefile,
+    "event_ffmpeg_closefile"
     },
     {
     EVENT_MOVIE_END,
-    event_extpipe_end
+    event_extpipe_end,
+    "event_extpipe_end"
     },
     {
     EVENT_MOVIE_START,
-    event_ffmpeg_newfile
+    event_ffmpeg_newfile,
+    "event_ffmpeg_newfile"
     },
     {
     EVENT_MOVIE_START,
-    event_create_extpipe
+    event_create_extpipe,
+    "event_create_extpipe"
+    },
+    {
+    EVENT_ENDMOTION,
+    event_index_end,
+    "event_index_end"
     },
-    {0, NULL}
+    {0, NULL, NULL}
 };
 
 
@@ -1417,10 +1785,13 @@ void event(struct context *cnt, motion_event eventtype, struct image_data *img_d
            char *filename, void *eventdata, struct timeval *tv1)
 {
     int i=-1;
+    struct trace_span span;
 
     while (event_handlers[++i].handler) {
         if (eventtype == event_handlers[i].eventtype) {
+            trace_begin(&span);
             event_handlers[i].handler(cnt, eventtype, img_data, filename, eventdata, tv1);
+            trace_end(event_handlers[i].name, &span);
         }
     }
 }
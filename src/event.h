@@ -57,4 +57,7 @@ void event(struct context *cnt, motion_event type, struct image_data *img_data,
 
 const char *imageext(struct context *cnt);
 
+void event_stream_start(struct context *cnt);
+void event_stream_stop(struct context *cnt);
+
 #endif /* _INCLUDE_EVENT_H_ */
@@ -0,0 +1,535 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *    eventidx.c
+ *
+ *    Append only index of the events of a camera.
+ *
+ *    When event_index is set, the camera keeps two files in that directory.
+ *    cameraN.idx holds a header and one fixed size record per event, see
+ *    eventidx.h, which is appended when the event ends.  cameraN.paths holds
+ *    a "FTYPE path" line for each file created during an event, and the
+ *    record of the event points at its lines.  The records are in the order
+ *    the events ended so a time range is found by a binary search over the
+ *    mapped index instead of a scan of the target_dir.
+ *
+ *    Only the camera thread writes the files.  A record is written with a
+ *    single append so the webcontrol reads every complete record while the
+ *    camera goes on writing.  A record left partly written by a crash is
+ *    cut off when the camera opens the index again.
+ *
+ *    The retention deletes the files of the oldest events and then moves
+ *    expired in the header past their records, which the queries skip.
+ *
+ */
+
+#include <sys/mman.h>
+#include "translate.h"
+#include "motion.h"
+#include "util.h"
+#include "logger.h"
+#include "alg.h"
+#include "eventidx.h"
+
+/* The name of the index file with the extension ext for the camera */
+void eventidx_name(struct context *cnt, char *name, size_t size, const char *ext)
+{
+    snprintf(name, size, "%s/camera%d.%s", cnt->conf.event_index, cnt->camera_id, ext);
+}
+
+/* Append all of buf to the file, -1 when it could not be written */
+static int eventidx_write(int fd, const void *buf, size_t len)
+{
+    const char *ptr = buf;
+    ssize_t retcd;
+
+    while (len > 0) {
+        retcd = write(fd, ptr, len);
+        if (retcd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        ptr += retcd;
+        len -= retcd;
+    }
+
+    return 0;
+}
+
+/* Check the header of the index or write it to a new index */
+static int eventidx_header_check(struct context *cnt, int fd, const char *name)
+{
+    struct eventidx_header hdr;
+    struct stat statbuf;
+    off_t extra;
+
+    if (fstat(fd, &statbuf) != 0) {
+        MOTION_LOG(ERR, TYPE_EVENTS, SHOW_ERRNO
+            ,_("Unable to read the event index %s"), name);
+        return -1;
+    }
+
+    if (statbuf.st_size == 0) {
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = EVENTIDX_MAGIC;
+        hdr.version = EVENTIDX_VERSION;
+        hdr.record_size = sizeof(struct eventidx_record);
+        hdr.camera_id = cnt->camera_id;
+        if (eventidx_write(fd, &hdr, sizeof(hdr)) != 0) {
+            MOTION_LOG(ERR, TYPE_EVENTS, SHOW_ERRNO
+                ,_("Unable to write the event index %s"), name);
+            return -1;
+        }
+        return 0;
+    }
+
+    if ((statbuf.st_size < (off_t)sizeof(hdr)) ||
+        (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) ||
+        (hdr.magic != EVENTIDX_MAGIC) || (hdr.version != EVENTIDX_VERSION) ||
+        (hdr.record_size != sizeof(struct eventidx_record))) {
+        MOTION_LOG(ERR, TYPE_EVENTS, NO_ERRNO
+            ,_("%s is not an event index of this version"), name);
+        return -1;
+    }
+
+    extra = (statbuf.st_size - sizeof(hdr)) % sizeof(struct eventidx_record);
+    if (extra != 0) {
+        MOTION_LOG(WRN, TYPE_EVENTS, NO_ERRNO
+            ,_("Removing a partly written record from the event index %s"), name);
+        if (ftruncate(fd, statbuf.st_size - extra) != 0) {
+            MOTION_LOG(ERR, TYPE_EVENTS, SHOW_ERRNO
+                ,_("Unable to truncate the event index %s"), name);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* The file lines of rec as a string to be freed by the caller */
+static char *eventidx_paths(int fd_paths, const struct eventidx_record *rec)
+{
+    char *paths;
+
+    paths = mymalloc(rec->paths_len + 1);
+    if ((fd_paths < 0) || (rec->paths_len == 0) ||
+        (pread(fd_paths, paths, rec->paths_len, rec->paths_offset) != (ssize_t)rec->paths_len)) {
+        paths[0] = '\0';
+    } else {
+        paths[rec->paths_len] = '\0';
+    }
+
+    return paths;
+}
+
+/** eventidx_path_next
+ *  The path of the file line at *pos, terminated in place, with its FTYPE
+ *  in ftype.  *pos is moved to the next line.  Returns NULL after the last
+ *  line.
+ */
+char *eventidx_path_next(char **pos, int *ftype)
+{
+    char *line, *end, *path;
+
+    while (**pos != '\0') {
+        line = *pos;
+        end = strchr(line, '\n');
+        if (end == NULL) {
+            break;
+        }
+        *end = '\0';
+        *pos = end + 1;
+
+        path = strchr(line, ' ');
+        if (path != NULL) {
+            *ftype = atoi(line);
+            return path + 1;
+        }
+    }
+
+    return NULL;
+}
+
+/** eventidx_count
+ *  The expired and total records of the index open as fd_idx.
+ */
+int eventidx_count(int fd_idx, uint64_t *expired, uint64_t *count)
+{
+    struct eventidx_header hdr;
+    struct stat statbuf;
+
+    if ((fstat(fd_idx, &statbuf) != 0) || (statbuf.st_size < (off_t)sizeof(hdr)) ||
+        (pread(fd_idx, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) ||
+        (hdr.magic != EVENTIDX_MAGIC) || (hdr.version != EVENTIDX_VERSION) ||
+        (hdr.record_size != sizeof(struct eventidx_record))) {
+        return -1;
+    }
+
+    *count = (statbuf.st_size - sizeof(hdr)) / sizeof(struct eventidx_record);
+    *expired = MIN(hdr.expired, *count);
+
+    return 0;
+}
+
+/** eventidx_get
+ *  Read the record indx and, when paths is not NULL, its file lines as a
+ *  string to be freed by the caller.
+ */
+int eventidx_get(int fd_idx, int fd_paths, uint64_t indx
+            , struct eventidx_record *rec, char **paths)
+{
+    off_t offset;
+
+    offset = sizeof(struct eventidx_header) + (indx * sizeof(struct eventidx_record));
+    if (pread(fd_idx, rec, sizeof(struct eventidx_record), offset) !=
+        (ssize_t)sizeof(struct eventidx_record)) {
+        return -1;
+    }
+
+    if (paths != NULL) {
+        *paths = eventidx_paths(fd_paths, rec);
+    }
+
+    return 0;
+}
+
+/** eventidx_expire
+ *  Mark the records before expired as deleted.  fd_idx must not be opened
+ *  with O_APPEND.
+ */
+int eventidx_expire(int fd_idx, uint64_t expired)
+{
+    if (pwrite(fd_idx, &expired, sizeof(expired), offsetof(struct eventidx_header, expired)) !=
+        (ssize_t)sizeof(expired)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/** eventidx_init
+ *  Open the index files of the camera when event_index is set.
+ */
+void eventidx_init(struct context *cnt)
+{
+    struct eventidx_ctx *idx;
+    char name[PATH_MAX];
+    off_t paths_end;
+    int fd_idx, fd_paths;
+
+    cnt->eventidx = NULL;
+
+    if ((cnt->conf.event_index == NULL) || (cnt->conf.event_index[0] == '\0')) {
+        return;
+    }
+
+    eventidx_name(cnt, name, sizeof(name), "idx");
+    if (mycreate_path(name) == -1) {
+        return;
+    }
+    fd_idx = open(name, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_idx < 0) {
+        MOTION_LOG(ERR, TYPE_EVENTS, SHOW_ERRNO
+            ,_("Unable to open the event index %s"), name);
+        return;
+    }
+    if (eventidx_header_check(cnt, fd_idx, name) != 0) {
+        close(fd_idx);
+        return;
+    }
+
+    eventidx_name(cnt, name, sizeof(name), "paths");
+    fd_paths = open(name, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_paths < 0) {
+        MOTION_LOG(ERR, TYPE_EVENTS, SHOW_ERRNO
+            ,_("Unable to open the event index %s"), name);
+        close(fd_idx);
+        return;
+    }
+    paths_end = lseek(fd_paths, 0, SEEK_END);
+    if (paths_end < 0) {
+        paths_end = 0;
+    }
+
+    idx = mymalloc(sizeof(struct eventidx_ctx));
+    memset(idx, 0, sizeof(struct eventidx_ctx));
+    idx->fd_idx = fd_idx;
+    idx->fd_paths = fd_paths;
+    idx->paths_end = paths_end;
+
+    cnt->eventidx = idx;
+
+    MOTION_LOG(NTC, TYPE_EVENTS, NO_ERRNO
+        ,_("Indexing the events in %s"), cnt->conf.event_index);
+}
+
+/** eventidx_deinit
+ *  Close the index files.  An event still in progress is not recorded.
+ */
+void eventidx_deinit(struct context *cnt)
+{
+    struct eventidx_ctx *idx = cnt->eventidx;
+
+    if (idx == NULL) {
+        return;
+    }
+
+    close(idx->fd_idx);
+    close(idx->fd_paths);
+    free(idx);
+
+    cnt->eventidx = NULL;
+}
+
+/** eventidx_start
+ *  Begin the record of a new event at the time of its first picture.
+ */
+void eventidx_start(struct context *cnt, struct timeval *tv1)
+{
+    struct eventidx_ctx *idx = cnt->eventidx;
+    struct eventidx_record *rec;
+
+    if (idx == NULL) {
+        return;
+    }
+
+    rec = &idx->rec;
+    memset(rec, 0, sizeof(struct eventidx_record));
+    rec->start = tv1->tv_sec;
+    rec->paths_offset = idx->paths_end;
+    rec->event_nr = cnt->event_nr;
+    rec->minx = cnt->imgs.width;
+    rec->miny = cnt->imgs.height;
+    rec->maxx = 0;
+    rec->maxy = 0;
+    snprintf(rec->eventid, sizeof(rec->eventid), "%s", cnt->eventid);
+
+    idx->active = TRUE;
+}
+
+/** eventidx_motion
+ *  Add a motion frame of the event to its changes and box.
+ */
+void eventidx_motion(struct context *cnt, struct image_data *img)
+{
+    struct eventidx_ctx *idx = cnt->eventidx;
+    struct eventidx_record *rec;
+
+    if ((idx == NULL) || !idx->active || (img == NULL)) {
+        return;
+    }
+
+    rec = &idx->rec;
+    rec->frames++;
+    if (img->diffs > rec->diffs_max) {
+        rec->diffs_max = img->diffs;
+    }
+    if (img->location.width > 0) {
+        rec->minx = MIN(rec->minx, img->location.minx);
+        rec->miny = MIN(rec->miny, img->location.miny);
+        rec->maxx = MAX(rec->maxx, img->location.maxx);
+        rec->maxy = MAX(rec->maxy, img->location.maxy);
+    }
+}
+
+/** eventidx_file
+ *  Add a file created during the event to its lines in the paths file.
+ */
+void eventidx_file(struct context *cnt, const char *filename, int ftype)
+{
+    struct eventidx_ctx *idx = cnt->eventidx;
+    char line[PATH_MAX + 16];
+    int len;
+
+    if ((idx == NULL) || !idx->active || (filename == NULL)) {
+        return;
+    }
+
+    if (!(ftype & EVENTIDX_FTYPES)) {
+        return;
+    }
+
+    len = snprintf(line, sizeof(line), "%d %s\n", ftype, filename);
+    if ((len <= 0) || (len >= (int)sizeof(line))) {
+        return;
+    }
+
+    if (eventidx_write(idx->fd_paths, line, len) != 0) {
+        MOTION_LOG(ERR, TYPE_EVENTS, SHOW_ERRNO
+            ,_("Unable to add %s to the event index"), filename);
+        /* The lines of the event must stay contiguous so find the end again */
+        idx->paths_end = lseek(idx->fd_paths, 0, SEEK_END);
+        idx->rec.paths_offset = idx->paths_end;
+        idx->rec.paths_len = 0;
+        idx->rec.files = 0;
+        return;
+    }
+
+    idx->paths_end += len;
+    idx->rec.paths_len += len;
+    idx->rec.files++;
+}
+
+/** eventidx_end
+ *  Append the record of the event which ended with the size of its files,
+ *  which are all closed by now.
+ */
+void eventidx_end(struct context *cnt, struct timeval *tv1)
+{
+    struct eventidx_ctx *idx = cnt->eventidx;
+    struct eventidx_record *rec;
+    struct stat statbuf;
+    char *paths, *pos, *path;
+    int ftype;
+
+    if ((idx == NULL) || !idx->active) {
+        return;
+    }
+
+    rec = &idx->rec;
+    paths = eventidx_paths(idx->fd_paths, rec);
+    pos = paths;
+    while ((path = eventidx_path_next(&pos, &ftype)) != NULL) {
+        if (stat(path, &statbuf) == 0) {
+            rec->bytes += statbuf.st_size;
+        }
+    }
+    free(paths);
+
+    rec->end = tv1->tv_sec;
+    if (rec->end < rec->start) {
+        rec->end = rec->start;
+    }
+    if (rec->maxx < rec->minx) {
+        rec->minx = rec->miny = rec->maxx = rec->maxy = 0;
+    }
+
+    if (eventidx_write(idx->fd_idx, rec, sizeof(struct eventidx_record)) != 0) {
+        MOTION_LOG(ERR, TYPE_EVENTS, SHOW_ERRNO
+            ,_("Unable to add event %d to the event index"), rec->event_nr);
+    }
+
+    idx->active = FALSE;
+}
+
+/* The first record which ended at or after from */
+static size_t eventidx_search(const struct eventidx_record *recs, size_t count, time_t from)
+{
+    size_t lo, hi, mid;
+
+    lo = 0;
+    hi = count;
+    while (lo < hi) {
+        mid = lo + ((hi - lo) / 2);
+        if (recs[mid].end < (int64_t)from) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/** eventidx_query
+ *  Call callback for up to limit events of the camera, oldest first, which
+ *  overlap the time from to to.  A to of 0 has no end.  This is called from
+ *  the webcontrol and only reads the files.  Returns the number of events
+ *  or -1 when the camera has no index.
+ */
+int eventidx_query(struct context *cnt, time_t from, time_t to, int limit
+            , eventidx_callback callback, void *arg)
+{
+    const struct eventidx_header *hdr;
+    const struct eventidx_record *recs, *rec;
+    struct stat statbuf;
+    char name[PATH_MAX];
+    char *paths;
+    void *map;
+    size_t count, indx;
+    int fd_idx, fd_paths, found;
+
+    if ((cnt->conf.event_index == NULL) || (cnt->conf.event_index[0] == '\0')) {
+        return -1;
+    }
+    if (limit <= 0) {
+        limit = EVENTIDX_LIMIT;
+    }
+
+    eventidx_name(cnt, name, sizeof(name), "idx");
+    fd_idx = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd_idx < 0) {
+        return 0;
+    }
+    if ((fstat(fd_idx, &statbuf) != 0) ||
+        (statbuf.st_size < (off_t)(sizeof(struct eventidx_header) + sizeof(struct eventidx_record)))) {
+        close(fd_idx);
+        return 0;
+    }
+
+    map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd_idx, 0);
+    close(fd_idx);
+    if (map == MAP_FAILED) {
+        MOTION_LOG(ERR, TYPE_EVENTS, SHOW_ERRNO
+            ,_("Unable to map the event index %s"), name);
+        return -1;
+    }
+
+    hdr = map;
+    if ((hdr->magic != EVENTIDX_MAGIC) || (hdr->version != EVENTIDX_VERSION) ||
+        (hdr->record_size != sizeof(struct eventidx_record))) {
+        munmap(map, statbuf.st_size);
+        return -1;
+    }
+    recs = (const struct eventidx_record *)((const char *)map + sizeof(struct eventidx_header));
+    count = (statbuf.st_size - sizeof(struct eventidx_header)) / sizeof(struct eventidx_record);
+
+    eventidx_name(cnt, name, sizeof(name), "paths");
+    fd_paths = open(name, O_RDONLY | O_CLOEXEC);
+
+    /* The files of the expired records are deleted */
+    indx = eventidx_search(recs, count, from);
+    if (indx < hdr->expired) {
+        indx = MIN(hdr->expired, count);
+    }
+
+    found = 0;
+    for (; indx < count; indx++) {
+        rec = &recs[indx];
+        if ((to > 0) && (rec->start > (int64_t)to)) {
+            break;
+        }
+        if (found == limit) {
+            break;
+        }
+
+        paths = eventidx_paths(fd_paths, rec);
+        callback(arg, rec, paths);
+        free(paths);
+
+        found++;
+    }
+
+    if (fd_paths >= 0) {
+        close(fd_paths);
+    }
+    munmap(map, statbuf.st_size);
+
+    return found;
+}
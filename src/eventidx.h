@@ -0,0 +1,95 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  eventidx.h
+ *    Headers associated with functions in the eventidx.c module.
+ *
+ *    The structures below are the layout of the index files and may be
+ *    read by external programs.  Change EVENTIDX_VERSION when they change.
+ */
+
+#ifndef _INCLUDE_EVENTIDX_H
+#define _INCLUDE_EVENTIDX_H
+
+#include <stdint.h>
+
+#define EVENTIDX_MAGIC      0x58444945      /* "EIDX" */
+#define EVENTIDX_VERSION    2
+#define EVENTIDX_LIMIT      1000            /* Events answered by a query without a limit */
+
+/*
+ * The files belonging to an event.  Snapshots and the timelapse movie are
+ * also made during events but outlive them and are never indexed.
+ */
+#define EVENTIDX_FTYPES     (FTYPE_IMAGE | FTYPE_IMAGE_MOTION | FTYPE_MPEG | FTYPE_MPEG_MOTION)
+
+struct eventidx_header {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    record_size;    /* Bytes of each record after the header */
+    int32_t     camera_id;
+    uint64_t    expired;        /* Oldest records whose files the retention deleted */
+};
+
+struct eventidx_record {
+    int64_t     start;          /* Time of the first picture of the event */
+    int64_t     end;            /* Time the event ended */
+    int64_t     paths_offset;   /* Offset of the file lines in the paths file */
+    int64_t     bytes;          /* Size of the files when the event ended */
+    uint32_t    paths_len;      /* Bytes of the file lines */
+    int32_t     files;          /* Number of file lines */
+    int32_t     event_nr;
+    int32_t     diffs_max;      /* Most changed pixels of a motion frame */
+    int32_t     frames;         /* Motion frames of the event */
+    int32_t     minx;           /* Box around all the motion of the event */
+    int32_t     miny;
+    int32_t     maxx;
+    int32_t     maxy;
+    char        eventid[20];    /* The %v of the event, camera id and start time */
+};
+
+struct eventidx_ctx {
+    int                         fd_idx;
+    int                         fd_paths;
+    int64_t                     paths_end;      /* Size of the paths file */
+    int                         active;         /* rec is the event in progress */
+    struct eventidx_record      rec;
+};
+
+/*
+ * Called by eventidx_query for each event found.  paths is the string of
+ * the file lines of the event, "FTYPE path\n" each, for eventidx_path_next.
+ */
+typedef void (*eventidx_callback)(void *arg, const struct eventidx_record *rec
+            , char *paths);
+
+void eventidx_name(struct context *cnt, char *name, size_t size, const char *ext);
+char *eventidx_path_next(char **pos, int *ftype);
+int eventidx_count(int fd_idx, uint64_t *expired, uint64_t *count);
+int eventidx_get(int fd_idx, int fd_paths, uint64_t indx
+            , struct eventidx_record *rec, char **paths);
+int eventidx_expire(int fd_idx, uint64_t expired);
+void eventidx_init(struct context *cnt);
+void eventidx_deinit(struct context *cnt);
+void eventidx_start(struct context *cnt, struct timeval *tv1);
+void eventidx_motion(struct context *cnt, struct image_data *img);
+void eventidx_file(struct context *cnt, const char *filename, int ftype);
+void eventidx_end(struct context *cnt, struct timeval *tv1);
+int eventidx_query(struct context *cnt, time_t from, time_t to, int limit
+            , eventidx_callback callback, void *arg);
+
+#endif /* _INCLUDE_EVENTIDX_H */
@@ -41,6 +41,7 @@
 #include "netcam.h"
 #include "netcam_rtsp.h"
 #include "ffmpeg.h"
+#include "trace.h"
 
 #ifdef HAVE_FFMPEG
 
@@ -98,18 +99,59 @@ static int ffmpeg_timelapse_exists(const char *fname)
     return 0;
 }
 
+/** ffmpeg_timelapse_close
+ *  Flush, sync and close the appended timelapse file.
+ */
+static void ffmpeg_timelapse_close(struct ffmpeg *ffmpeg)
+{
+    if (ffmpeg->tlapse_file == NULL) {
+        return;
+    }
+
+    if ((fflush(ffmpeg->tlapse_file) != 0) || (fsync(fileno(ffmpeg->tlapse_file)) != 0)) {
+        MOTION_LOG(ERR, TYPE_ENCODER, SHOW_ERRNO
+            ,_("Error syncing timelapse file %s"), ffmpeg->filename);
+    }
+    myfclose(ffmpeg->tlapse_file);
+    ffmpeg->tlapse_file = NULL;
+
+    free(ffmpeg->tlapse_buf);
+    ffmpeg->tlapse_buf = NULL;
+}
+
+/** ffmpeg_timelapse_append
+ *  Append the packet to the timelapse file.  The file is opened on the first
+ *  packet and kept open with a large buffer until the timelapse is closed so
+ *  the packets do not each cost an open and close on network storage.  The
+ *  file is synced every tlapse_fsync seconds so a crash loses at most that.
+ */
 static int ffmpeg_timelapse_append(struct ffmpeg *ffmpeg, AVPacket *pkt)
 {
-    FILE *file;
+    time_t now;
 
-    file = fopen(ffmpeg->filename, "abe");
-    if (!file) {
-        return -1;
+    if (ffmpeg->tlapse_file == NULL) {
+        ffmpeg->tlapse_file = fopen(ffmpeg->filename, "abe");
+        if (ffmpeg->tlapse_file == NULL) {
+            return -1;
+        }
+        ffmpeg->tlapse_buf = mymalloc(TIMELAPSE_BUFSIZE);
+        setvbuf(ffmpeg->tlapse_file, ffmpeg->tlapse_buf, _IOFBF, TIMELAPSE_BUFSIZE);
+        ffmpeg->tlapse_synced = time(NULL);
     }
 
-    fwrite(pkt->data, 1, pkt->size,file);
+    if (fwrite(pkt->data, 1, pkt->size, ffmpeg->tlapse_file) != (size_t)pkt->size) {
+        return -1;
+    }
 
-    fclose(file);
+    if (ffmpeg->tlapse_fsync > 0) {
+        now = time(NULL);
+        if ((now - ffmpeg->tlapse_synced) >= ffmpeg->tlapse_fsync) {
+            if ((fflush(ffmpeg->tlapse_file) != 0) || (fsync(fileno(ffmpeg->tlapse_file)) != 0)) {
+                return -1;
+            }
+            ffmpeg->tlapse_synced = now;
+        }
+    }
 
     return 0;
 }
@@ -158,9 +200,30 @@ static int ffmpeg_lockmgr_cb(void **arg, enum AVLockOp op)
 }
 #endif
 
+static void ffmpeg_free_hw(struct ffmpeg *ffmpeg)
+{
+    #if ( MYFFVER >= 57083)
+        if (ffmpeg->hw_frame != NULL) {
+            my_frame_free(ffmpeg->hw_frame);
+            ffmpeg->hw_frame = NULL;
+        }
+        if (ffmpeg->hw_device_ctx != NULL) {
+            av_buffer_unref(&ffmpeg->hw_device_ctx);
+        }
+    #else
+        (void)ffmpeg;
+    #endif
+}
+
+static void ffmpeg_io_close(struct ffmpeg *ffmpeg);
+
 static void ffmpeg_free_context(struct ffmpeg *ffmpeg)
 {
 
+        int indx;
+
+        ffmpeg_timelapse_close(ffmpeg);
+
         if (ffmpeg->picture != NULL) {
             my_frame_free(ffmpeg->picture);
             ffmpeg->picture = NULL;
@@ -171,11 +234,23 @@ static void ffmpeg_free_context(struct ffmpeg *ffmpeg)
             ffmpeg->ctx_codec = NULL;
         }
 
+        ffmpeg_free_hw(ffmpeg);
+
         if (ffmpeg->oc != NULL) {
+            ffmpeg_io_close(ffmpeg);
             avformat_free_context(ffmpeg->oc);
             ffmpeg->oc = NULL;
         }
 
+        if (ffmpeg->passthru_pkts != NULL) {
+            for (indx = 0; indx < ffmpeg->passthru_size; indx++) {
+                my_packet_free(ffmpeg->passthru_pkts[indx].packet);
+            }
+            free(ffmpeg->passthru_pkts);
+            ffmpeg->passthru_pkts = NULL;
+            ffmpeg->passthru_size = 0;
+        }
+
 }
 
 static int ffmpeg_get_oformat(struct ffmpeg *ffmpeg)
@@ -327,14 +402,56 @@ static int ffmpeg_get_oformat(struct ffmpeg *ffmpeg)
     return 0;
 }
 
+#if ( MYFFVER >= 57083)
+/** ffmpeg_hw_upload
+ *  Copy the picture into a vaapi surface from the pool of the codec.
+ */
+static int ffmpeg_hw_upload(struct ffmpeg *ffmpeg)
+{
+    int retcd;
+    char errstr[128];
+
+    av_frame_unref(ffmpeg->hw_frame);
+
+    retcd = av_hwframe_get_buffer(ffmpeg->ctx_codec->hw_frames_ctx, ffmpeg->hw_frame, 0);
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO
+            ,_("Error getting vaapi surface:%s"),errstr);
+        return -1;
+    }
+
+    retcd = av_hwframe_transfer_data(ffmpeg->hw_frame, ffmpeg->picture, 0);
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO
+            ,_("Error uploading frame to vaapi surface:%s"),errstr);
+        return -1;
+    }
+    av_frame_copy_props(ffmpeg->hw_frame, ffmpeg->picture);
+
+    return 0;
+}
+#endif
+
 static int ffmpeg_encode_video(struct ffmpeg *ffmpeg)
 {
     #if ( MYFFVER >= 57041)
         //ffmpeg version 3.1 and after
         int retcd = 0;
         char errstr[128];
+        AVFrame *frame = ffmpeg->picture;
+
+        #if ( MYFFVER >= 57083)
+            if (ffmpeg->preferred_codec == USER_CODEC_VAAPI) {
+                if (ffmpeg_hw_upload(ffmpeg) < 0) {
+                    return -1;
+                }
+                frame = ffmpeg->hw_frame;
+            }
+        #endif
 
-        retcd = avcodec_send_frame(ffmpeg->ctx_codec, ffmpeg->picture);
+        retcd = avcodec_send_frame(ffmpeg->ctx_codec, frame);
         if (retcd < 0 ) {
             av_strerror(retcd, errstr, sizeof(errstr));
             MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO
@@ -534,30 +651,46 @@ static int ffmpeg_set_quality(struct ffmpeg *ffmpeg)
         if (ffmpeg->quality <= 0) {
             ffmpeg->quality = 45; // default to 45% quality
         }
-        av_dict_set(&ffmpeg->opts, "preset", "ultrafast", 0);
-        av_dict_set(&ffmpeg->opts, "tune", "zerolatency", 0);
-        /* This next if statement needs validation.  Are mpeg4omx
-         * and v4l2m2m even MY_CODEC_ID_H264 or MY_CODEC_ID_HEVC
-         * such that it even would be possible to be part of this
-         * if block to start with? */
-        if ((ffmpeg->preferred_codec == USER_CODEC_H264OMX) ||
-            (ffmpeg->preferred_codec == USER_CODEC_MPEG4OMX) ||
-            (ffmpeg->preferred_codec == USER_CODEC_V4L2M2M)) {
-            // bit_rate = ffmpeg->width * ffmpeg->height * ffmpeg->fps * quality_factor
-            ffmpeg->quality = (int)(((int64_t)ffmpeg->width * ffmpeg->height * ffmpeg->fps * ffmpeg->quality) >> 7);
-            // Clip bit rate to min
-            if (ffmpeg->quality < 4000) {
-                // magic number
-                ffmpeg->quality = 4000;
+        if ((ffmpeg->preferred_codec == USER_CODEC_VAAPI) ||
+            (ffmpeg->preferred_codec == USER_CODEC_NVENC)) {
+            /* The hardware encoders have no crf so use a constant quantizer */
+            char qp[10];
+            ffmpeg->quality = (int)(( (100-ffmpeg->quality) * 51)/100);
+            if (ffmpeg->preferred_codec == USER_CODEC_VAAPI) {
+                ffmpeg->ctx_codec->bit_rate = 0;
+                ffmpeg->ctx_codec->global_quality = ffmpeg->quality;
+            } else {
+                snprintf(qp, 10, "%d", ffmpeg->quality);
+                av_dict_set(&ffmpeg->opts, "rc", "constqp", 0);
+                av_dict_set(&ffmpeg->opts, "qp", qp, 0);
+                av_dict_set(&ffmpeg->opts, "zerolatency", "1", 0);
             }
-            ffmpeg->ctx_codec->profile = FF_PROFILE_H264_HIGH;
-            ffmpeg->ctx_codec->bit_rate = ffmpeg->quality;
         } else {
-            // Control other H264 encoders quality via CRF
-            char crf[10];
-            ffmpeg->quality = (int)(( (100-ffmpeg->quality) * 51)/100);
-            snprintf(crf, 10, "%d", ffmpeg->quality);
-            av_dict_set(&ffmpeg->opts, "crf", crf, 0);
+            av_dict_set(&ffmpeg->opts, "preset", "ultrafast", 0);
+            av_dict_set(&ffmpeg->opts, "tune", "zerolatency", 0);
+            /* This next if statement needs validation.  Are mpeg4omx
+             * and v4l2m2m even MY_CODEC_ID_H264 or MY_CODEC_ID_HEVC
+             * such that it even would be possible to be part of this
+             * if block to start with? */
+            if ((ffmpeg->preferred_codec == USER_CODEC_H264OMX) ||
+                (ffmpeg->preferred_codec == USER_CODEC_MPEG4OMX) ||
+                (ffmpeg->preferred_codec == USER_CODEC_V4L2M2M)) {
+                // bit_rate = ffmpeg->width * ffmpeg->height * ffmpeg->fps * quality_factor
+                ffmpeg->quality = (int)(((int64_t)ffmpeg->width * ffmpeg->height * ffmpeg->fps * ffmpeg->quality) >> 7);
+                // Clip bit rate to min
+                if (ffmpeg->quality < 4000) {
+                    // magic number
+                    ffmpeg->quality = 4000;
+                }
+                ffmpeg->ctx_codec->profile = FF_PROFILE_H264_HIGH;
+                ffmpeg->ctx_codec->bit_rate = ffmpeg->quality;
+            } else {
+                // Control other H264 encoders quality via CRF
+                char crf[10];
+                ffmpeg->quality = (int)(( (100-ffmpeg->quality) * 51)/100);
+                snprintf(crf, 10, "%d", ffmpeg->quality);
+                av_dict_set(&ffmpeg->opts, "crf", crf, 0);
+            }
         }
     } else {
         /* The selection of 8000 is a subjective number based upon viewing output files */
@@ -642,6 +775,12 @@ static int ffmpeg_set_codec_preferred(struct ffmpeg *ffmpeg)
         ffmpeg->preferred_codec = USER_CODEC_H264OMX;
     } else if (mystreq(ffmpeg->codec->name, "mpeg4_omx")) {
         ffmpeg->preferred_codec = USER_CODEC_MPEG4OMX;
+    #if ( MYFFVER >= 57083)
+    } else if (strstr(ffmpeg->codec->name, "_vaapi") != NULL) {
+        ffmpeg->preferred_codec = USER_CODEC_VAAPI;
+    } else if (strstr(ffmpeg->codec->name, "nvenc") != NULL) {
+        ffmpeg->preferred_codec = USER_CODEC_NVENC;
+    #endif
     } else {
         ffmpeg->preferred_codec = USER_CODEC_DEFAULT;
     }
@@ -654,41 +793,106 @@ static int ffmpeg_set_codec_preferred(struct ffmpeg *ffmpeg)
 
 }
 
-static int ffmpeg_set_codec(struct ffmpeg *ffmpeg)
+/** ffmpeg_set_hwframes
+ *  Open the vaapi device and attach a pool of surfaces to the codec.  The
+ *  images are uploaded to these surfaces in ffmpeg_encode_video.
+ */
+static int ffmpeg_set_hwframes(struct ffmpeg *ffmpeg)
 {
+    #if ( MYFFVER >= 57083)
+        AVBufferRef *frames_ref;
+        AVHWFramesContext *frames_ctx;
+        int retcd;
+        char errstr[128];
 
-    int retcd;
-    char errstr[128];
-    int chkrate;
+        retcd = av_hwdevice_ctx_create(&ffmpeg->hw_device_ctx, AV_HWDEVICE_TYPE_VAAPI, NULL, NULL, 0);
+        if (retcd < 0) {
+            av_strerror(retcd, errstr, sizeof(errstr));
+            MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO
+                ,_("Unable to open vaapi device %s"), errstr);
+            return retcd;
+        }
 
-    retcd = ffmpeg_set_codec_preferred(ffmpeg);
-    if (retcd != 0) {
-        return retcd;
-    }
+        frames_ref = av_hwframe_ctx_alloc(ffmpeg->hw_device_ctx);
+        if (frames_ref == NULL) {
+            MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO, _("Unable to allocate vaapi frames"));
+            return AVERROR(ENOMEM);
+        }
+        frames_ctx = (AVHWFramesContext *)(frames_ref->data);
+        frames_ctx->format    = AV_PIX_FMT_VAAPI;
+        frames_ctx->sw_format = AV_PIX_FMT_NV12;
+        frames_ctx->width     = ffmpeg->width;
+        frames_ctx->height    = ffmpeg->height;
+        frames_ctx->initial_pool_size = 20;
 
-    #if ( MYFFVER >= 57041)
-        ffmpeg->video_st = avformat_new_stream(ffmpeg->oc, ffmpeg->codec);
-        if (!ffmpeg->video_st) {
-            MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO, _("Could not alloc stream"));
-            ffmpeg_free_context(ffmpeg);
-            return -1;
+        retcd = av_hwframe_ctx_init(frames_ref);
+        if (retcd < 0) {
+            av_strerror(retcd, errstr, sizeof(errstr));
+            MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO
+                ,_("Unable to initialize vaapi frames %s"), errstr);
+            av_buffer_unref(&frames_ref);
+            return retcd;
+        }
+        ffmpeg->ctx_codec->hw_frames_ctx = av_buffer_ref(frames_ref);
+        av_buffer_unref(&frames_ref);
+
+        return 0;
+    #else
+        (void)ffmpeg;
+        return -1;
+    #endif
+}
+
+/** ffmpeg_set_codec_fallback
+ *  When a hardware encoder could not be opened, replace it with the software
+ *  encoder of the container.  Returns TRUE when the software encoder is ready
+ *  to be opened.
+ */
+static int ffmpeg_set_codec_fallback(struct ffmpeg *ffmpeg)
+{
+    #if ( MYFFVER >= 57083)
+        if ((ffmpeg->preferred_codec != USER_CODEC_VAAPI) &&
+            (ffmpeg->preferred_codec != USER_CODEC_NVENC)) {
+            return FALSE;
+        }
+
+        MOTION_LOG(WRN, TYPE_ENCODER, NO_ERRNO
+            ,_("Hardware encoder %s is not available, using the software encoder")
+            , ffmpeg->codec->name);
+
+        ffmpeg_free_hw(ffmpeg);
+        my_avcodec_close(ffmpeg->ctx_codec);
+        ffmpeg->ctx_codec = NULL;
+
+        ffmpeg->preferred_codec = USER_CODEC_DEFAULT;
+        ffmpeg->codec = avcodec_find_encoder(ffmpeg->oc->video_codec_id);
+        if (ffmpeg->codec == NULL) {
+            MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO
+                ,_("Codec %s not found"), ffmpeg->codec_name);
+            return FALSE;
         }
         ffmpeg->ctx_codec = avcodec_alloc_context3(ffmpeg->codec);
         if (ffmpeg->ctx_codec == NULL) {
             MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO, _("Failed to allocate codec!"));
-            ffmpeg_free_context(ffmpeg);
-            return -1;
+            return FALSE;
         }
+        MOTION_LOG(NTC, TYPE_ENCODER, NO_ERRNO,_("Using codec %s"), ffmpeg->codec->name);
+
+        return TRUE;
     #else
-        ffmpeg->video_st = avformat_new_stream(ffmpeg->oc, ffmpeg->codec);
-        if (!ffmpeg->video_st) {
-            MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO, _("Could not alloc stream"));
-            ffmpeg_free_context(ffmpeg);
-            return -1;
-        }
-        ffmpeg->ctx_codec = ffmpeg->video_st->codec;
+        (void)ffmpeg;
+        return FALSE;
     #endif
+}
 
+/** ffmpeg_set_codec_context
+ *  Set the parameters of the codec context and open the codec.  Returns
+ *  the avcodec_open2 result so a failed hardware encoder can be replaced.
+ */
+static int ffmpeg_set_codec_context(struct ffmpeg *ffmpeg)
+{
+    int retcd;
+    int chkrate;
 
     if (ffmpeg->tlapse != TIMELAPSE_NONE) {
         ffmpeg->ctx_codec->gop_size = 1;
@@ -728,6 +932,10 @@ static int ffmpeg_set_codec(struct ffmpeg *ffmpeg)
     ffmpeg->ctx_codec->time_base.den = ffmpeg->fps;
     if (ffmpeg->preferred_codec == USER_CODEC_V4L2M2M) {
         ffmpeg->ctx_codec->pix_fmt   = AV_PIX_FMT_NV21;
+    #if ( MYFFVER >= 57083)
+    } else if (ffmpeg->preferred_codec == USER_CODEC_VAAPI) {
+        ffmpeg->ctx_codec->pix_fmt   = AV_PIX_FMT_VAAPI;
+    #endif
     } else {
         ffmpeg->ctx_codec->pix_fmt   = MY_PIX_FMT_YUV420P;
     }
@@ -738,6 +946,15 @@ static int ffmpeg_set_codec(struct ffmpeg *ffmpeg)
     }
     ffmpeg->ctx_codec->flags |= MY_CODEC_FLAG_GLOBAL_HEADER;
 
+    if (ffmpeg->threads > 0) {
+        ffmpeg->ctx_codec->thread_count = ffmpeg->threads;
+    }
+    if (mystreq(ffmpeg->thread_type, "frame")) {
+        ffmpeg->ctx_codec->thread_type = FF_THREAD_FRAME;
+    } else if (mystreq(ffmpeg->thread_type, "slice")) {
+        ffmpeg->ctx_codec->thread_type = FF_THREAD_SLICE;
+    }
+
     if (mystreq(ffmpeg->codec->name, "h264_omx") ||
         mystreq(ffmpeg->codec->name, "mpeg4_omx")) {
         /* h264_omx & ffmpeg combination locks up on Raspberry Pi.
@@ -753,6 +970,14 @@ static int ffmpeg_set_codec(struct ffmpeg *ffmpeg)
         return -1;
     }
 
+    if (ffmpeg->preferred_codec == USER_CODEC_VAAPI) {
+        retcd = ffmpeg_set_hwframes(ffmpeg);
+        if (retcd < 0) {
+            av_dict_free(&ffmpeg->opts);
+            return retcd;
+        }
+    }
+
     retcd = avcodec_open2(ffmpeg->ctx_codec, ffmpeg->codec, &ffmpeg->opts);
     if (retcd < 0) {
         if (ffmpeg->codec->supported_framerates) {
@@ -769,16 +994,61 @@ static int ffmpeg_set_codec(struct ffmpeg *ffmpeg)
             retcd = avcodec_open2(ffmpeg->ctx_codec, ffmpeg->codec, &ffmpeg->opts);
             chkrate++;
         }
-        if (retcd < 0) {
-            av_strerror(retcd, errstr, sizeof(errstr));
-            MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO, _("Could not open codec %s"),errstr);
-            av_dict_free(&ffmpeg->opts);
+    }
+    av_dict_free(&ffmpeg->opts);
+
+    return retcd;
+}
+
+static int ffmpeg_set_codec(struct ffmpeg *ffmpeg)
+{
+
+    int retcd;
+    char errstr[128];
+    int quality;
+
+    retcd = ffmpeg_set_codec_preferred(ffmpeg);
+    if (retcd != 0) {
+        return retcd;
+    }
+
+    #if ( MYFFVER >= 57041)
+        ffmpeg->video_st = avformat_new_stream(ffmpeg->oc, ffmpeg->codec);
+        if (!ffmpeg->video_st) {
+            MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO, _("Could not alloc stream"));
+            ffmpeg_free_context(ffmpeg);
+            return -1;
+        }
+        ffmpeg->ctx_codec = avcodec_alloc_context3(ffmpeg->codec);
+        if (ffmpeg->ctx_codec == NULL) {
+            MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO, _("Failed to allocate codec!"));
+            ffmpeg_free_context(ffmpeg);
+            return -1;
+        }
+    #else
+        ffmpeg->video_st = avformat_new_stream(ffmpeg->oc, ffmpeg->codec);
+        if (!ffmpeg->video_st) {
+            MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO, _("Could not alloc stream"));
             ffmpeg_free_context(ffmpeg);
             return -1;
         }
+        ffmpeg->ctx_codec = ffmpeg->video_st->codec;
+    #endif
+
 
+    /* ffmpeg_set_quality replaces the quality with the codec value */
+    quality = ffmpeg->quality;
+    retcd = ffmpeg_set_codec_context(ffmpeg);
+    if ((retcd < 0) && ffmpeg_set_codec_fallback(ffmpeg)) {
+        ffmpeg->quality = quality;
+        retcd = ffmpeg_set_codec_context(ffmpeg);
+    }
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO, _("Could not open codec %s"),errstr);
+        ffmpeg_free_context(ffmpeg);
+        return -1;
     }
-    av_dict_free(&ffmpeg->opts);
 
     return 0;
 }
@@ -906,63 +1176,436 @@ static int ffmpeg_set_picture(struct ffmpeg *ffmpeg)
         }
     }
 
+    #if ( MYFFVER >= 57083)
+        /* The picture holds the image in system memory for the upload */
+        if (ffmpeg->preferred_codec == USER_CODEC_VAAPI) {
+            ffmpeg->picture->format = AV_PIX_FMT_NV12;
+            ffmpeg->picture->linesize[0] = 0;
+            ffmpeg->picture->linesize[1] = 0;
+            ffmpeg->picture->linesize[2] = 0;
+            retcd = av_frame_get_buffer(ffmpeg->picture, 32);
+            if (retcd < 0) {
+                av_strerror(retcd, errstr, sizeof(errstr));
+                MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO, _("could not alloc buffers %s"), errstr);
+                ffmpeg_free_context(ffmpeg);
+                return -1;
+            }
+            ffmpeg->hw_frame = my_frame_alloc();
+            if (ffmpeg->hw_frame == NULL) {
+                MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO, _("could not alloc frame"));
+                ffmpeg_free_context(ffmpeg);
+                return -1;
+            }
+        }
+    #endif
+
     return 0;
 
 }
 
-static int ffmpeg_set_outputfile(struct ffmpeg *ffmpeg)
+#define FFMPEG_IO_CHUNK     (256 * 1024)    /* Size of the chunks written behind */
+#define FFMPEG_IO_AVBUF     (64 * 1024)     /* Buffer of the AVIOContext */
+
+struct ffmpeg_io_chunk {
+    unsigned char   *data;
+    int64_t         offset;         /* File offset of the data */
+    int             len;
+};
+
+/*
+ * Write-behind output of a movie when movie_write_buffer is set.  The muxer
+ * writes through a custom AVIOContext into chunks which a writer thread
+ * writes to the file in order, so a stalled disk only holds up the encoder
+ * once all the chunks of the buffer are waiting.  A seek of the muxer starts
+ * a new chunk at the new offset.
+ */
+struct ffmpeg_io {
+    pthread_t               thread_id;
+    pthread_mutex_t         mutex;          /* Protects the chunks and counters */
+    pthread_cond_t          cond_put;       /* Signalled when a chunk was written */
+    pthread_cond_t          cond_get;       /* Signalled when a chunk is queued */
+
+    int                     fd;
+    struct ffmpeg_io_chunk  *chunks;
+    int                     size;
+    int                     head;           /* Oldest queued chunk */
+    int                     count;          /* Number of queued chunks */
+    int                     tail;           /* Chunk filled by the muxer, only used by the muxer */
+    int                     filling;        /* The tail chunk has data which is not yet queued */
+
+    int64_t                 pos;            /* Position of the muxer */
+    int64_t                 end;            /* Size of the file written */
+    int                     finish;
+    volatile int            error;          /* Writing the file failed */
+    unsigned long           stalls;         /* Times the muxer waited on a full buffer */
+};
+
+/** ffmpeg_io_handler
+ *  Writer thread of a movie.  The chunks are written oldest first.
+ */
+static void *ffmpeg_io_handler(void *arg)
 {
+    struct ffmpeg *ffmpeg = arg;
+    struct ffmpeg_io *io = ffmpeg->io;
+    struct ffmpeg_io_chunk *chunk;
+    ssize_t retcd;
+    int done;
 
-    int retcd;
-    char errstr[128];
+    util_threadname_set("mw", ffmpeg->threadnr, NULL);
 
-    #if ( MYFFVER < 58000)
-        snprintf(ffmpeg->oc->filename, sizeof(ffmpeg->oc->filename), "%s", ffmpeg->filename);
-    #endif
+    pthread_setspecific(tls_key_threadnr, (void *)((unsigned long)ffmpeg->threadnr));
 
-    /* Open the output file, if needed. */
-    if ((ffmpeg_timelapse_exists(ffmpeg->filename) == 0) || (ffmpeg->tlapse != TIMELAPSE_APPEND)) {
-        if (!(ffmpeg->oc->oformat->flags & AVFMT_NOFILE)) {
-            if (avio_open(&ffmpeg->oc->pb, ffmpeg->filename, MY_FLAG_WRITE) < 0) {
-                if (errno == ENOENT) {
-                    if (mycreate_path(ffmpeg->filename) == -1) {
-                        ffmpeg_free_context(ffmpeg);
-                        return -1;
-                    }
-                    if (avio_open(&ffmpeg->oc->pb, ffmpeg->filename, MY_FLAG_WRITE) < 0) {
-                        MOTION_LOG(ERR, TYPE_ENCODER, SHOW_ERRNO
-                            ,_("error opening file %s"), ffmpeg->filename);
-                        ffmpeg_free_context(ffmpeg);
-                        return -1;
-                    }
-                    /* Permission denied */
-                } else if (errno ==  EACCES) {
-                    MOTION_LOG(ERR, TYPE_ENCODER, SHOW_ERRNO
-                        ,_("Permission denied. %s"),ffmpeg->filename);
-                    ffmpeg_free_context(ffmpeg);
-                    return -1;
-                } else {
-                    MOTION_LOG(ERR, TYPE_ENCODER, SHOW_ERRNO
-                        ,_("Error opening file %s"), ffmpeg->filename);
-                    ffmpeg_free_context(ffmpeg);
-                    return -1;
+    while (TRUE) {
+        pthread_mutex_lock(&io->mutex);
+            while ((io->count == 0) && !io->finish) {
+                pthread_cond_wait(&io->cond_get, &io->mutex);
+            }
+            if (io->count == 0) {
+                pthread_mutex_unlock(&io->mutex);
+                break;
+            }
+            /* The head chunk is only released below so it is read unlocked */
+            chunk = &io->chunks[io->head];
+        pthread_mutex_unlock(&io->mutex);
+
+        done = 0;
+        while (!io->error && (done < chunk->len)) {
+            retcd = pwrite(io->fd, chunk->data + done, chunk->len - done, chunk->offset + done);
+            if (retcd < 0) {
+                if (errno == EINTR) {
+                    continue;
                 }
+                MOTION_LOG(ERR, TYPE_ENCODER, SHOW_ERRNO
+                    ,_("Error writing movie file %s"), ffmpeg->filename);
+                io->error = TRUE;
+            } else {
+                done += retcd;
             }
         }
 
-        /* Write the stream header,  For the TIMELAPSE_APPEND
-         * we write the data via standard file I/O so we close the
-         * items here
-         */
-        retcd = avformat_write_header(ffmpeg->oc, NULL);
-        if (retcd < 0) {
-            av_strerror(retcd, errstr, sizeof(errstr));
-            MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO
-                ,_("Could not write ffmpeg header %s"),errstr);
-            ffmpeg_free_context(ffmpeg);
-            return -1;
-        }
-        if (ffmpeg->tlapse == TIMELAPSE_APPEND) {
+        pthread_mutex_lock(&io->mutex);
+            if (++io->head >= io->size) {
+                io->head = 0;
+            }
+            io->count--;
+            pthread_cond_signal(&io->cond_put);
+        pthread_mutex_unlock(&io->mutex);
+    }
+
+    pthread_exit(NULL);
+}
+
+/* Hand the tail chunk to the writer thread */
+static void ffmpeg_io_queue(struct ffmpeg_io *io)
+{
+    pthread_mutex_lock(&io->mutex);
+        io->count++;
+        pthread_cond_signal(&io->cond_get);
+    pthread_mutex_unlock(&io->mutex);
+
+    if (++io->tail >= io->size) {
+        io->tail = 0;
+    }
+    io->filling = FALSE;
+}
+
+/* The chunk to fill at the muxer position, waiting for one when all are queued */
+static struct ffmpeg_io_chunk *ffmpeg_io_tail(struct ffmpeg_io *io)
+{
+    struct ffmpeg_io_chunk *chunk;
+    int stalled;
+
+    chunk = &io->chunks[io->tail];
+    if (io->filling) {
+        return chunk;
+    }
+
+    stalled = FALSE;
+    pthread_mutex_lock(&io->mutex);
+        while (io->count == io->size) {
+            if (!stalled) {
+                stalled = TRUE;
+                if (io->stalls++ == 0) {
+                    MOTION_LOG(WRN, TYPE_ENCODER, NO_ERRNO
+                        ,_("Movie write buffer full, the encoder is waiting on the disk"));
+                }
+            }
+            pthread_cond_wait(&io->cond_put, &io->mutex);
+        }
+    pthread_mutex_unlock(&io->mutex);
+
+    chunk->offset = io->pos;
+    chunk->len = 0;
+    io->filling = TRUE;
+
+    return chunk;
+}
+
+#if (MYFFVER >= 61000)
+static int ffmpeg_io_write(void *opaque, const uint8_t *buf, int buf_size)
+#else
+static int ffmpeg_io_write(void *opaque, uint8_t *buf, int buf_size)
+#endif
+{
+    struct ffmpeg_io *io = opaque;
+    struct ffmpeg_io_chunk *chunk;
+    int done, len;
+
+    if (io->error) {
+        return AVERROR(EIO);
+    }
+
+    done = 0;
+    while (done < buf_size) {
+        chunk = ffmpeg_io_tail(io);
+        len = MIN(FFMPEG_IO_CHUNK - chunk->len, buf_size - done);
+        memcpy(chunk->data + chunk->len, buf + done, len);
+        chunk->len += len;
+        done += len;
+
+        io->pos += len;
+        if (io->pos > io->end) {
+            io->end = io->pos;
+        }
+        if (chunk->len == FFMPEG_IO_CHUNK) {
+            ffmpeg_io_queue(io);
+        }
+    }
+
+    return buf_size;
+}
+
+static int64_t ffmpeg_io_seek(void *opaque, int64_t offset, int whence)
+{
+    struct ffmpeg_io *io = opaque;
+    struct ffmpeg_io_chunk *chunk;
+    int64_t pos;
+
+    if (whence & AVSEEK_SIZE) {
+        return io->end;
+    }
+
+    switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = io->pos + offset;
+        break;
+    case SEEK_END:
+        pos = io->end + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (pos < 0) {
+        return AVERROR(EINVAL);
+    }
+
+    /* The data after the seek goes into a new chunk */
+    chunk = &io->chunks[io->tail];
+    if (io->filling && (pos != chunk->offset + chunk->len)) {
+        ffmpeg_io_queue(io);
+    }
+    io->pos = pos;
+
+    return pos;
+}
+
+static void ffmpeg_io_free(struct ffmpeg_io *io)
+{
+    int indx;
+
+    for (indx = 0; indx < io->size; indx++) {
+        free(io->chunks[indx].data);
+    }
+    free(io->chunks);
+
+    pthread_cond_destroy(&io->cond_get);
+    pthread_cond_destroy(&io->cond_put);
+    pthread_mutex_destroy(&io->mutex);
+
+    free(io);
+}
+
+/** ffmpeg_io_open
+ *  Create the movie file and its write-behind output as the pb of the
+ *  format context.  With movie_preallocate the space of the file is reserved
+ *  up front so the movies written at the same time do not fragment each
+ *  other.  Returns -1 with errno set when the file can not be created.
+ */
+static int ffmpeg_io_open(struct ffmpeg *ffmpeg)
+{
+    struct ffmpeg_io *io;
+    unsigned char *iobuf;
+    int indx, fd, err;
+
+    fd = open(ffmpeg->filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        return -1;
+    }
+
+    #ifdef __linux__
+        if (ffmpeg->preallocate > 0) {
+            if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)ffmpeg->preallocate * 1024 * 1024) != 0) {
+                MOTION_LOG(DBG, TYPE_ENCODER, SHOW_ERRNO
+                    ,_("Unable to preallocate movie file %s"), ffmpeg->filename);
+            }
+        }
+    #endif
+
+    io = mymalloc(sizeof(struct ffmpeg_io));
+    memset(io, 0, sizeof(struct ffmpeg_io));
+    io->fd = fd;
+    io->size = (int)(((int64_t)ffmpeg->write_buffer * 1024 * 1024) / FFMPEG_IO_CHUNK);
+    if (io->size < 2) {
+        io->size = 2;
+    }
+    io->chunks = mymalloc(io->size * sizeof(struct ffmpeg_io_chunk));
+    memset(io->chunks, 0, io->size * sizeof(struct ffmpeg_io_chunk));
+    for (indx = 0; indx < io->size; indx++) {
+        io->chunks[indx].data = mymalloc(FFMPEG_IO_CHUNK);
+    }
+
+    pthread_mutex_init(&io->mutex, NULL);
+    pthread_cond_init(&io->cond_put, NULL);
+    pthread_cond_init(&io->cond_get, NULL);
+
+    ffmpeg->io = io;
+
+    if (pthread_create(&io->thread_id, NULL, &ffmpeg_io_handler, ffmpeg) != 0) {
+        err = errno;
+        MOTION_LOG(ERR, TYPE_ENCODER, SHOW_ERRNO, _("Unable to start movie writer thread"));
+        ffmpeg->io = NULL;
+        ffmpeg_io_free(io);
+        close(fd);
+        unlink(ffmpeg->filename);
+        errno = err;
+        return -1;
+    }
+
+    iobuf = av_malloc(FFMPEG_IO_AVBUF);
+    ffmpeg->oc->pb = avio_alloc_context(iobuf, FFMPEG_IO_AVBUF, 1, io
+        , NULL, &ffmpeg_io_write, &ffmpeg_io_seek);
+    ffmpeg->oc->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    return 0;
+}
+
+/** ffmpeg_io_close
+ *  Write out the buffered data of the movie and close the file.
+ */
+static void ffmpeg_io_close(struct ffmpeg *ffmpeg)
+{
+    struct ffmpeg_io *io = ffmpeg->io;
+
+    if (io == NULL) {
+        return;
+    }
+
+    if (ffmpeg->oc->pb != NULL) {
+        avio_flush(ffmpeg->oc->pb);
+    }
+    if (io->filling) {
+        ffmpeg_io_queue(io);
+    }
+
+    pthread_mutex_lock(&io->mutex);
+        io->finish = TRUE;
+        pthread_cond_broadcast(&io->cond_get);
+    pthread_mutex_unlock(&io->mutex);
+    pthread_join(io->thread_id, NULL);
+
+    /* Give back the preallocated space past the end of the movie */
+    if ((ffmpeg->preallocate > 0) && (ftruncate(io->fd, io->end) != 0)) {
+        MOTION_LOG(DBG, TYPE_ENCODER, SHOW_ERRNO
+            ,_("Unable to truncate movie file %s"), ffmpeg->filename);
+    }
+    if (close(io->fd) != 0) {
+        MOTION_LOG(ERR, TYPE_ENCODER, SHOW_ERRNO
+            ,_("Error closing movie file %s"), ffmpeg->filename);
+    }
+
+    MOTION_LOG(INF, TYPE_ENCODER, NO_ERRNO
+        ,_("Movie writer: %lld bytes, %lu stalls on a full buffer of %d KB")
+        ,(long long)io->end, io->stalls, (io->size * FFMPEG_IO_CHUNK) / 1024);
+
+    if (ffmpeg->oc->pb != NULL) {
+        av_freep(&ffmpeg->oc->pb->buffer);
+        #if (MYFFVER >= 57081)
+            avio_context_free(&ffmpeg->oc->pb);
+        #else
+            av_freep(&ffmpeg->oc->pb);
+        #endif
+    }
+
+    ffmpeg->io = NULL;
+    ffmpeg_io_free(io);
+}
+
+/* Open the output of the movie, written behind or directly through avio */
+static int ffmpeg_open_pb(struct ffmpeg *ffmpeg)
+{
+    if ((ffmpeg->write_buffer > 0) && (ffmpeg->tlapse == TIMELAPSE_NONE)) {
+        return ffmpeg_io_open(ffmpeg);
+    }
+
+    return avio_open(&ffmpeg->oc->pb, ffmpeg->filename, MY_FLAG_WRITE);
+}
+
+static int ffmpeg_set_outputfile(struct ffmpeg *ffmpeg)
+{
+
+    int retcd;
+    char errstr[128];
+
+    #if ( MYFFVER < 58000)
+        snprintf(ffmpeg->oc->filename, sizeof(ffmpeg->oc->filename), "%s", ffmpeg->filename);
+    #endif
+
+    /* Open the output file, if needed. */
+    if ((ffmpeg_timelapse_exists(ffmpeg->filename) == 0) || (ffmpeg->tlapse != TIMELAPSE_APPEND)) {
+        if (!(ffmpeg->oc->oformat->flags & AVFMT_NOFILE)) {
+            if (ffmpeg_open_pb(ffmpeg) < 0) {
+                if (errno == ENOENT) {
+                    if (mycreate_path(ffmpeg->filename) == -1) {
+                        ffmpeg_free_context(ffmpeg);
+                        return -1;
+                    }
+                    if (ffmpeg_open_pb(ffmpeg) < 0) {
+                        MOTION_LOG(ERR, TYPE_ENCODER, SHOW_ERRNO
+                            ,_("error opening file %s"), ffmpeg->filename);
+                        ffmpeg_free_context(ffmpeg);
+                        return -1;
+                    }
+                    /* Permission denied */
+                } else if (errno ==  EACCES) {
+                    MOTION_LOG(ERR, TYPE_ENCODER, SHOW_ERRNO
+                        ,_("Permission denied. %s"),ffmpeg->filename);
+                    ffmpeg_free_context(ffmpeg);
+                    return -1;
+                } else {
+                    MOTION_LOG(ERR, TYPE_ENCODER, SHOW_ERRNO
+                        ,_("Error opening file %s"), ffmpeg->filename);
+                    ffmpeg_free_context(ffmpeg);
+                    return -1;
+                }
+            }
+        }
+
+        /* Write the stream header,  For the TIMELAPSE_APPEND
+         * we write the data via standard file I/O so we close the
+         * items here
+         */
+        retcd = avformat_write_header(ffmpeg->oc, NULL);
+        if (retcd < 0) {
+            av_strerror(retcd, errstr, sizeof(errstr));
+            MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO
+                ,_("Could not write ffmpeg header %s"),errstr);
+            ffmpeg_free_context(ffmpeg);
+            return -1;
+        }
+        if (ffmpeg->tlapse == TIMELAPSE_APPEND) {
             av_write_trailer(ffmpeg->oc);
             avio_close(ffmpeg->oc->pb);
         }
@@ -1075,44 +1718,82 @@ static int ffmpeg_put_frame(struct ffmpeg *ffmpeg, const struct timeval *tv1)
 
 static void ffmpeg_passthru_reset(struct ffmpeg *ffmpeg)
 {
-    /* Reset the written flag at start of each event */
+    /* Start each movie at the oldest key frame in the packet array */
+    ffmpeg->passthru_idnbr = 0;
+
+}
+
+/* Return the packet in the camera ring with the requested idnbr or NULL when
+ * it is not in the ring.  The ring is contiguous by idnbr ending at the most
+ * recent packet so no search is needed.  Requires the mutex_pktarray.
+ */
+struct packet_item *ffmpeg_passthru_item(struct rtsp_context *rtsp_data, int64_t idnbr)
+{
+    int64_t back;
     int indx;
 
-    pthread_mutex_lock(&ffmpeg->rtsp_data->mutex_pktarray);
-        for(indx = 0; indx < ffmpeg->rtsp_data->pktarray_size; indx++) {
-            ffmpeg->rtsp_data->pktarray[indx].iswritten = FALSE;
-        }
-    pthread_mutex_unlock(&ffmpeg->rtsp_data->mutex_pktarray);
+    if (rtsp_data->pktarray_index < 0) {
+        return NULL;
+    }
 
+    back = rtsp_data->pktarray[rtsp_data->pktarray_index].idnbr - idnbr;
+    if ((back < 0) || (back >= rtsp_data->pktarray_size)) {
+        return NULL;
+    }
+
+    indx = rtsp_data->pktarray_index - (int)back;
+    if (indx < 0) {
+        indx += rtsp_data->pktarray_size;
+    }
+
+    if (rtsp_data->pktarray[indx].idnbr != idnbr) {
+        return NULL;
+    }
+
+    return &rtsp_data->pktarray[indx];
 }
 
-static void ffmpeg_passthru_write(struct ffmpeg *ffmpeg, int indx)
+static void ffmpeg_passthru_grow(struct ffmpeg *ffmpeg, int need)
 {
-    /* Write the packet in the buffer at indx to file */
-    char errstr[128];
-    int retcd;
+    int indx, newsize;
 
-    ffmpeg->pkt = my_packet_alloc(ffmpeg->pkt);
-    ffmpeg->rtsp_data->pktarray[indx].iswritten = TRUE;
-
-    retcd = my_copy_packet(ffmpeg->pkt, ffmpeg->rtsp_data->pktarray[indx].packet);
-    if (retcd < 0) {
-        av_strerror(retcd, errstr, sizeof(errstr));
-        MOTION_LOG(INF, TYPE_ENCODER, NO_ERRNO, _("av_copy_packet: %s"),errstr);
-        ffmpeg_free_pkt(ffmpeg);
+    if (need <= ffmpeg->passthru_size) {
         return;
     }
 
-    retcd = ffmpeg_set_pktpts(ffmpeg, &ffmpeg->rtsp_data->pktarray[indx].timestamp_tv);
+    newsize = need * 2;
+    ffmpeg->passthru_pkts = myrealloc(ffmpeg->passthru_pkts
+        , newsize * sizeof(struct packet_item), "ffmpeg_passthru_grow");
+    for (indx = ffmpeg->passthru_size; indx < newsize; indx++) {
+        ffmpeg->passthru_pkts[indx].packet = my_packet_alloc(NULL);
+        ffmpeg->passthru_pkts[indx].idnbr = 0;
+        ffmpeg->passthru_pkts[indx].iskey = FALSE;
+    }
+    ffmpeg->passthru_size = newsize;
+
+}
+
+static void ffmpeg_passthru_write(struct ffmpeg *ffmpeg, struct packet_item *item)
+{
+    /* Write the packet taken from the camera to file */
+    char errstr[128];
+    int retcd;
+
+    /* The packet stays with the item for reuse so it is borrowed by pkt */
+    ffmpeg->pkt = item->packet;
+
+    retcd = ffmpeg_set_pktpts(ffmpeg, &item->timestamp_tv);
     if (retcd < 0) {
-        ffmpeg_free_pkt(ffmpeg);
+        av_packet_unref(item->packet);
+        ffmpeg->pkt = NULL;
         return;
     }
 
     ffmpeg->pkt->stream_index = 0;
 
     retcd = av_write_frame(ffmpeg->oc, ffmpeg->pkt);
-    ffmpeg_free_pkt(ffmpeg);
+    av_packet_unref(item->packet);
+    ffmpeg->pkt = NULL;
     if (retcd < 0) {
         av_strerror(retcd, errstr, sizeof(errstr));
         MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO
@@ -1122,18 +1803,67 @@ static void ffmpeg_passthru_write(struct ffmpeg *ffmpeg, int indx)
 
 }
 
+/* Return the idnbr of the first packet of the movie.  Without a pre-roll this
+ * is the oldest key frame in the ring.  With a pre-roll it is the last key frame
+ * at least the pre-roll before the image so the movie starts on a key frame.
+ * Requires the mutex_pktarray.
+ */
+static int64_t ffmpeg_passthru_start(struct ffmpeg *ffmpeg, struct rtsp_context *rtsp_data
+            , int64_t idnbr_first, int64_t idnbr_image)
+{
+    struct packet_item *item;
+    struct timeval tv_start;
+    int64_t idnbr, idnbr_key;
+
+    tv_start.tv_sec = 0;
+    tv_start.tv_usec = 0;
+    if (ffmpeg->passthrough_preroll > 0) {
+        item = ffmpeg_passthru_item(rtsp_data, idnbr_image);
+        if (item != NULL) {
+            tv_start.tv_sec = item->timestamp_tv.tv_sec - ffmpeg->passthrough_preroll;
+            tv_start.tv_usec = item->timestamp_tv.tv_usec;
+        }
+    }
+
+    idnbr_key = 0;
+    for (idnbr = idnbr_first; idnbr <= idnbr_image; idnbr++) {
+        item = ffmpeg_passthru_item(rtsp_data, idnbr);
+        if ((item == NULL) || (!item->iskey)) {
+            continue;
+        }
+        if (idnbr_key == 0) {
+            idnbr_key = idnbr;
+        } else if ((item->timestamp_tv.tv_sec < tv_start.tv_sec) ||
+            ((item->timestamp_tv.tv_sec == tv_start.tv_sec) &&
+             (item->timestamp_tv.tv_usec <= tv_start.tv_usec))) {
+            idnbr_key = idnbr;
+        } else {
+            break;
+        }
+    }
+
+    if (idnbr_key == 0) {
+        return idnbr_first;
+    }
+
+    return idnbr_key;
+}
+
 static int ffmpeg_passthru_put(struct ffmpeg *ffmpeg, struct image_data *img_data)
 {
 
-    int idnbr_image, idnbr_lastwritten, idnbr_stop, idnbr_firstkey;
-    int indx, indx_lastwritten, indx_firstkey;
+    int64_t idnbr_image, idnbr_first, idnbr;
+    int indx, count;
+    struct rtsp_context *rtsp_data;
+    struct packet_item *item;
 
     if (ffmpeg->rtsp_data == NULL) {
         return -1;
     }
+    rtsp_data = ffmpeg->rtsp_data;
 
-    if ((ffmpeg->rtsp_data->status == RTSP_NOTCONNECTED  ) ||
-        (ffmpeg->rtsp_data->status == RTSP_RECONNECTING  )) {
+    if ((rtsp_data->status == RTSP_NOTCONNECTED  ) ||
+        (rtsp_data->status == RTSP_RECONNECTING  )) {
         return 0;
     }
 
@@ -1143,59 +1873,51 @@ static int ffmpeg_passthru_put(struct ffmpeg *ffmpeg, struct image_data *img_dat
         idnbr_image = img_data->idnbr_norm;
     }
 
-    pthread_mutex_lock(&ffmpeg->rtsp_data->mutex_pktarray);
-        idnbr_lastwritten = 0;
-        idnbr_firstkey = idnbr_image;
-        idnbr_stop = 0;
-        indx_lastwritten = -1;
-        indx_firstkey = -1;
-
-        for(indx = 0; indx < ffmpeg->rtsp_data->pktarray_size; indx++) {
-            if ((ffmpeg->rtsp_data->pktarray[indx].iswritten) &&
-                (ffmpeg->rtsp_data->pktarray[indx].idnbr > idnbr_lastwritten)) {
-                idnbr_lastwritten=ffmpeg->rtsp_data->pktarray[indx].idnbr;
-                indx_lastwritten = indx;
-            }
-            if ((ffmpeg->rtsp_data->pktarray[indx].idnbr >  idnbr_stop) &&
-                (ffmpeg->rtsp_data->pktarray[indx].idnbr <= idnbr_image)) {
-                idnbr_stop=ffmpeg->rtsp_data->pktarray[indx].idnbr;
-            }
-            if ((ffmpeg->rtsp_data->pktarray[indx].iskey) &&
-                (ffmpeg->rtsp_data->pktarray[indx].idnbr <= idnbr_firstkey)) {
-                    idnbr_firstkey=ffmpeg->rtsp_data->pktarray[indx].idnbr;
-                    indx_firstkey = indx;
-            }
+    /* Only references to the packets are taken under the lock.  The writing
+     * to file is done afterwards so the camera thread is not held up.
+     */
+    count = 0;
+    pthread_mutex_lock(&rtsp_data->mutex_pktarray);
+        if (rtsp_data->pktarray_index < 0) {
+            pthread_mutex_unlock(&rtsp_data->mutex_pktarray);
+            return 0;
         }
 
-        if (idnbr_stop == 0) {
-            pthread_mutex_unlock(&ffmpeg->rtsp_data->mutex_pktarray);
-            return 0;
+        idnbr_first = rtsp_data->pktarray[rtsp_data->pktarray_index].idnbr
+            - rtsp_data->pktarray_size + 1;
+        if (idnbr_first < 1) {
+            idnbr_first = 1;
         }
 
-        if (indx_lastwritten != -1) {
-            indx = indx_lastwritten;
-        } else if (indx_firstkey != -1) {
-            indx = indx_firstkey;
+        if (ffmpeg->passthru_idnbr == 0) {
+            idnbr = ffmpeg_passthru_start(ffmpeg, rtsp_data, idnbr_first, idnbr_image);
         } else {
-            indx = 0;
+            idnbr = ffmpeg->passthru_idnbr + 1;
+            if (idnbr < idnbr_first) {
+                idnbr = idnbr_first;
+            }
         }
 
-        while (TRUE) {
-            if ((!ffmpeg->rtsp_data->pktarray[indx].iswritten) &&
-                (ffmpeg->rtsp_data->pktarray[indx].packet->size > 0) &&
-                (ffmpeg->rtsp_data->pktarray[indx].idnbr >  idnbr_lastwritten) &&
-                (ffmpeg->rtsp_data->pktarray[indx].idnbr <= idnbr_image)) {
-                ffmpeg_passthru_write(ffmpeg, indx);
+        for (; idnbr <= idnbr_image; idnbr++) {
+            item = ffmpeg_passthru_item(rtsp_data, idnbr);
+            if ((item == NULL) || (item->packet->size <= 0)) {
+                continue;
             }
-            if (ffmpeg->rtsp_data->pktarray[indx].idnbr == idnbr_stop) {
-                break;
-            }
-            indx++;
-            if (indx == ffmpeg->rtsp_data->pktarray_size) {
-                indx = 0;
+            ffmpeg_passthru_grow(ffmpeg, count + 1);
+            if (my_copy_packet(ffmpeg->passthru_pkts[count].packet, item->packet) < 0) {
+                continue;
             }
+            ffmpeg->passthru_pkts[count].idnbr = idnbr;
+            ffmpeg->passthru_pkts[count].timestamp_tv = item->timestamp_tv;
+            ffmpeg->passthru_idnbr = idnbr;
+            count++;
         }
-    pthread_mutex_unlock(&ffmpeg->rtsp_data->mutex_pktarray);
+    pthread_mutex_unlock(&rtsp_data->mutex_pktarray);
+
+    for (indx = 0; indx < count; indx++) {
+        ffmpeg_passthru_write(ffmpeg, &ffmpeg->passthru_pkts[indx]);
+    }
+
     return 0;
 }
 
@@ -1339,6 +2061,39 @@ static void ffmpeg_put_pix_nv21(struct ffmpeg *ffmpeg, struct image_data *img_da
 
 }
 
+/** ffmpeg_put_pix_nv12
+ *  Convert the image into the nv12 picture that is uploaded to the vaapi surface.
+ */
+static void ffmpeg_put_pix_nv12(struct ffmpeg *ffmpeg, struct image_data *img_data)
+{
+    unsigned char *image, *imagecb, *imagecr, *dst;
+    int width, height, x, y;
+
+    if (ffmpeg->high_resolution) {
+        image = img_data->image_high;
+    } else {
+        image = img_data->image_norm;
+    }
+
+    width = ffmpeg->ctx_codec->width;
+    height = ffmpeg->ctx_codec->height;
+    imagecb = image + (width * height);
+    imagecr = imagecb + ((width * height) / 4);
+
+    for (y = 0; y < height; y++) {
+        memcpy(ffmpeg->picture->data[0] + (y * ffmpeg->picture->linesize[0])
+            , image + (y * width), width);
+    }
+    for (y = 0; y < height / 2; y++) {
+        dst = ffmpeg->picture->data[1] + (y * ffmpeg->picture->linesize[1]);
+        for (x = 0; x < width / 2; x++) {
+            dst[x * 2] = *imagecb++;
+            dst[x * 2 + 1] = *imagecr++;
+        }
+    }
+
+}
+
 static void ffmpeg_put_pix_yuv420(struct ffmpeg *ffmpeg, struct image_data *img_data)
 {
     unsigned char *image;
@@ -1357,6 +2112,308 @@ static void ffmpeg_put_pix_yuv420(struct ffmpeg *ffmpeg, struct image_data *img_
 }
 
 
+/** ffmpeg_put_image_encode
+ *  Encode one image into the movie.  This is called from the motion loop or
+ *  from the encoder thread when movie_queue is in use.
+ */
+static int ffmpeg_put_image_encode(struct ffmpeg *ffmpeg, struct image_data *img_data
+            , const struct timeval *tv1)
+{
+    int retcd = 0;
+    int cnt = 0;
+    struct trace_span span;
+
+    trace_begin(&span);
+
+    if (ffmpeg->passthrough) {
+        retcd = ffmpeg_passthru_put(ffmpeg, img_data);
+        trace_end("ffmpeg_put_image", &span);
+        return retcd;
+    }
+
+    if (ffmpeg->picture) {
+
+        if (ffmpeg->preferred_codec == USER_CODEC_V4L2M2M) {
+            ffmpeg_put_pix_nv21(ffmpeg, img_data);
+        } else if (ffmpeg->preferred_codec == USER_CODEC_VAAPI) {
+            ffmpeg_put_pix_nv12(ffmpeg, img_data);
+        } else {
+            ffmpeg_put_pix_yuv420(ffmpeg, img_data);
+        }
+
+        ffmpeg->gop_cnt ++;
+        if (ffmpeg->gop_cnt == ffmpeg->ctx_codec->gop_size ) {
+            ffmpeg->picture->pict_type = AV_PICTURE_TYPE_I;
+            ffmpeg->picture->key_frame = 1;
+            ffmpeg->gop_cnt = 0;
+        } else {
+            ffmpeg->picture->pict_type = AV_PICTURE_TYPE_P;
+            ffmpeg->picture->key_frame = 0;
+        }
+
+        /* A return code of -2 is thrown by the put_frame
+        * when a image is buffered.  For timelapse, we absolutely
+        * never want a frame buffered so we keep sending back the
+        * the same pic until it flushes or fails in a different way
+        */
+        retcd = ffmpeg_put_frame(ffmpeg, tv1);
+        while ((retcd == -2) && (ffmpeg->tlapse != TIMELAPSE_NONE)) {
+            retcd = ffmpeg_put_frame(ffmpeg, tv1);
+            cnt++;
+            if (cnt > 50) {
+                MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO
+                    ,_("Excessive attempts to clear buffered packet"));
+                retcd = -1;
+            }
+        }
+        //non timelapse buffered is ok
+        if (retcd == -2) {
+            retcd = 0;
+            MOTION_LOG(DBG, TYPE_ENCODER, NO_ERRNO, _("Buffered packet"));
+        }
+    }
+
+    trace_end("ffmpeg_put_image", &span);
+
+    return retcd;
+}
+
+static void ffmpeg_reset_start(struct ffmpeg *ffmpeg, const struct timeval *tv1)
+{
+    int64_t one_frame_interval = av_rescale_q(1,(AVRational){1, ffmpeg->fps},ffmpeg->video_st->time_base);
+    if (one_frame_interval <= 0) {
+        one_frame_interval = 1;
+    }
+    ffmpeg->base_pts = ffmpeg->last_pts + one_frame_interval;
+
+    ffmpeg->start_time.tv_sec = tv1->tv_sec;
+    ffmpeg->start_time.tv_usec = tv1->tv_usec;
+}
+
+struct ffmpeg_queue_item {
+    unsigned char   *image;
+    struct timeval  tv;
+    int             reset;          /* Item resets the movie start time instead of a frame */
+};
+
+struct ffmpeg_queue {
+    pthread_t                   thread_id;
+    pthread_mutex_t             mutex;          /* Protects the slots and counters */
+    pthread_cond_t              cond_put;       /* Signalled when a slot becomes free */
+    pthread_cond_t              cond_get;       /* Signalled when an item is queued */
+
+    struct ffmpeg_queue_item    *items;
+    int                         size;
+    int                         head;           /* Oldest queued item */
+    int                         count;          /* Number of queued items */
+    int                         image_size;
+
+    int                         finish;
+    volatile int                error;          /* Encoder failed on a queued frame */
+
+    unsigned long               queued;         /* Frames handed to the encoder thread */
+    unsigned long               stalls;         /* Times the motion loop waited on a full queue */
+    int                         depth_max;      /* Highest number of queued items seen */
+};
+
+/** ffmpeg_queue_handler
+ *  Encoder thread of a movie.  Frames are taken from the queue oldest first
+ *  and encoded in the same order as ffmpeg_put_image was called.
+ */
+static void *ffmpeg_queue_handler(void *arg)
+{
+    struct ffmpeg *ffmpeg = arg;
+    struct ffmpeg_queue *queue = ffmpeg->queue;
+    struct ffmpeg_queue_item *item;
+    struct image_data img_data;
+
+    util_threadname_set("me", ffmpeg->threadnr, NULL);
+
+    pthread_setspecific(tls_key_threadnr, (void *)((unsigned long)ffmpeg->threadnr));
+
+    memset(&img_data, 0, sizeof(img_data));
+
+    while (TRUE) {
+        pthread_mutex_lock(&queue->mutex);
+            while ((queue->count == 0) && !queue->finish) {
+                pthread_cond_wait(&queue->cond_get, &queue->mutex);
+            }
+            /* On close the frames still queued are encoded before exiting */
+            if (queue->count == 0) {
+                pthread_mutex_unlock(&queue->mutex);
+                break;
+            }
+            /* The head slot is only released below so it is read unlocked */
+            item = &queue->items[queue->head];
+        pthread_mutex_unlock(&queue->mutex);
+
+        if (item->reset) {
+            ffmpeg_reset_start(ffmpeg, &item->tv);
+        } else {
+            img_data.image_norm = item->image;
+            img_data.image_high = item->image;
+            if (ffmpeg_put_image_encode(ffmpeg, &img_data, &item->tv) < 0) {
+                queue->error = TRUE;
+            }
+        }
+
+        pthread_mutex_lock(&queue->mutex);
+            if (++queue->head >= queue->size) {
+                queue->head = 0;
+            }
+            queue->count--;
+            pthread_cond_signal(&queue->cond_put);
+        pthread_mutex_unlock(&queue->mutex);
+    }
+
+    pthread_exit(NULL);
+}
+
+static void ffmpeg_queue_free(struct ffmpeg_queue *queue)
+{
+    int indx;
+
+    for (indx = 0; indx < queue->size; indx++) {
+        free(queue->items[indx].image);
+    }
+    free(queue->items);
+
+    pthread_cond_destroy(&queue->cond_get);
+    pthread_cond_destroy(&queue->cond_put);
+    pthread_mutex_destroy(&queue->mutex);
+
+    free(queue);
+}
+
+/** ffmpeg_queue_start
+ *  Allocate the frame slots and start the encoder thread when movie_queue
+ *  is set.  Pass through and timelapse movies are written in the motion
+ *  loop.  On any failure ffmpeg->queue is left NULL.
+ */
+static void ffmpeg_queue_start(struct ffmpeg *ffmpeg)
+{
+    struct ffmpeg_queue *queue;
+    int indx;
+
+    ffmpeg->queue = NULL;
+
+    if ((ffmpeg->queue_size <= 0) || ffmpeg->passthrough ||
+        (ffmpeg->tlapse != TIMELAPSE_NONE)) {
+        return;
+    }
+
+    queue = mymalloc(sizeof(struct ffmpeg_queue));
+    memset(queue, 0, sizeof(struct ffmpeg_queue));
+
+    queue->size = ffmpeg->queue_size;
+    queue->image_size = (ffmpeg->width * ffmpeg->height * 3) / 2;
+    queue->items = mymalloc(queue->size * sizeof(struct ffmpeg_queue_item));
+    memset(queue->items, 0, queue->size * sizeof(struct ffmpeg_queue_item));
+    for (indx = 0; indx < queue->size; indx++) {
+        queue->items[indx].image = mymalloc(queue->image_size);
+    }
+
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->cond_put, NULL);
+    pthread_cond_init(&queue->cond_get, NULL);
+
+    ffmpeg->queue = queue;
+
+    if (pthread_create(&queue->thread_id, NULL, &ffmpeg_queue_handler, ffmpeg) != 0) {
+        MOTION_LOG(ERR, TYPE_ENCODER, SHOW_ERRNO
+            ,_("Unable to start encoder thread, encoding in the motion loop"));
+        ffmpeg->queue = NULL;
+        ffmpeg_queue_free(queue);
+    }
+}
+
+/** ffmpeg_queue_stop
+ *  Let the encoder thread finish the queued frames then join it so the
+ *  codec can be flushed and the movie closed.
+ */
+static void ffmpeg_queue_stop(struct ffmpeg *ffmpeg)
+{
+    struct ffmpeg_queue *queue = ffmpeg->queue;
+
+    if (queue == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+        queue->finish = TRUE;
+        pthread_cond_broadcast(&queue->cond_get);
+    pthread_mutex_unlock(&queue->mutex);
+    pthread_join(queue->thread_id, NULL);
+
+    MOTION_LOG(INF, TYPE_ENCODER, NO_ERRNO
+        ,_("Encoder queue: %lu frames, %lu stalls, max depth %d of %d")
+        ,queue->queued, queue->stalls, queue->depth_max, queue->size);
+
+    ffmpeg->queue = NULL;
+    ffmpeg_queue_free(queue);
+}
+
+/** ffmpeg_queue_put
+ *  Copy the image into a free slot for the encoder thread.  A NULL img_data
+ *  queues a reset of the movie start time so it is applied in frame order.
+ *  When all slots are in use this waits for the encoder so memory stays
+ *  bounded.  Returns -1 when the encoder failed on an earlier frame.
+ */
+static int ffmpeg_queue_put(struct ffmpeg *ffmpeg, struct image_data *img_data
+            , const struct timeval *tv1)
+{
+    struct ffmpeg_queue *queue = ffmpeg->queue;
+    struct ffmpeg_queue_item *item;
+    int stalled;
+
+    stalled = FALSE;
+    pthread_mutex_lock(&queue->mutex);
+        while (queue->count == queue->size) {
+            if (!stalled) {
+                stalled = TRUE;
+                if (queue->stalls++ == 0) {
+                    MOTION_LOG(WRN, TYPE_ENCODER, NO_ERRNO
+                        ,_("Encoder queue full, the motion loop is waiting on the encoder"));
+                }
+            }
+            pthread_cond_wait(&queue->cond_put, &queue->mutex);
+        }
+        /* Only the motion loop writes the tail slot so it is filled unlocked */
+        item = &queue->items[(queue->head + queue->count) % queue->size];
+    pthread_mutex_unlock(&queue->mutex);
+
+    item->tv.tv_sec = tv1->tv_sec;
+    item->tv.tv_usec = tv1->tv_usec;
+    if (img_data == NULL) {
+        item->reset = TRUE;
+    } else {
+        item->reset = FALSE;
+        if (ffmpeg->high_resolution) {
+            memcpy(item->image, img_data->image_high, queue->image_size);
+        } else {
+            memcpy(item->image, img_data->image_norm, queue->image_size);
+        }
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+        queue->count++;
+        if (!item->reset) {
+            queue->queued++;
+        }
+        if (queue->count > queue->depth_max) {
+            queue->depth_max = queue->count;
+        }
+        pthread_cond_signal(&queue->cond_get);
+    pthread_mutex_unlock(&queue->mutex);
+
+    if (queue->error) {
+        queue->error = FALSE;
+        return -1;
+    }
+
+    return 0;
+}
+
 #endif /* HAVE_FFMPEG */
 
 /****************************************************************************
@@ -1418,6 +2475,18 @@ int ffmpeg_open(struct ffmpeg *ffmpeg)
     #ifdef HAVE_FFMPEG
         int retcd;
 
+        ffmpeg->passthru_pkts = NULL;
+        ffmpeg->passthru_size = 0;
+        ffmpeg->passthru_idnbr = 0;
+        ffmpeg->queue = NULL;
+        ffmpeg->tlapse_file = NULL;
+        ffmpeg->tlapse_buf = NULL;
+        ffmpeg->io = NULL;
+        #if ( MYFFVER >= 57083)
+            ffmpeg->hw_device_ctx = NULL;
+            ffmpeg->hw_frame = NULL;
+        #endif
+
         ffmpeg->oc = avformat_alloc_context();
         if (!ffmpeg->oc) {
             MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO, _("Could not allocate output context"));
@@ -1468,6 +2537,8 @@ int ffmpeg_open(struct ffmpeg *ffmpeg)
             return -1;
         }
 
+        ffmpeg_queue_start(ffmpeg);
+
         return 0;
 
     #else /* No FFMPEG */
@@ -1483,6 +2554,8 @@ void ffmpeg_close(struct ffmpeg *ffmpeg)
 
         if (ffmpeg != NULL) {
 
+            ffmpeg_queue_stop(ffmpeg);
+
             if (ffmpeg_flush_codec(ffmpeg) < 0) {
                 MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO, _("Error flushing codec"));
             }
@@ -1491,7 +2564,9 @@ void ffmpeg_close(struct ffmpeg *ffmpeg)
                     av_write_trailer(ffmpeg->oc);
                 }
                 if (!(ffmpeg->oc->oformat->flags & AVFMT_NOFILE)) {
-                    if (ffmpeg->tlapse != TIMELAPSE_APPEND) {
+                    if (ffmpeg->io != NULL) {
+                        ffmpeg_io_close(ffmpeg);
+                    } else if (ffmpeg->tlapse != TIMELAPSE_APPEND) {
                         avio_close(ffmpeg->oc->pb);
                     }
                 }
@@ -1508,55 +2583,11 @@ void ffmpeg_close(struct ffmpeg *ffmpeg)
 int ffmpeg_put_image(struct ffmpeg *ffmpeg, struct image_data *img_data, const struct timeval *tv1)
 {
     #ifdef HAVE_FFMPEG
-        int retcd = 0;
-        int cnt = 0;
-
-        if (ffmpeg->passthrough) {
-            retcd = ffmpeg_passthru_put(ffmpeg, img_data);
-            return retcd;
+        if (ffmpeg->queue) {
+            return ffmpeg_queue_put(ffmpeg, img_data, tv1);
         }
 
-        if (ffmpeg->picture) {
-
-            if (ffmpeg->preferred_codec == USER_CODEC_V4L2M2M) {
-                ffmpeg_put_pix_nv21(ffmpeg, img_data);
-            } else {
-                ffmpeg_put_pix_yuv420(ffmpeg, img_data);
-            }
-
-            ffmpeg->gop_cnt ++;
-            if (ffmpeg->gop_cnt == ffmpeg->ctx_codec->gop_size ) {
-                ffmpeg->picture->pict_type = AV_PICTURE_TYPE_I;
-                ffmpeg->picture->key_frame = 1;
-                ffmpeg->gop_cnt = 0;
-            } else {
-                ffmpeg->picture->pict_type = AV_PICTURE_TYPE_P;
-                ffmpeg->picture->key_frame = 0;
-            }
-
-            /* A return code of -2 is thrown by the put_frame
-            * when a image is buffered.  For timelapse, we absolutely
-            * never want a frame buffered so we keep sending back the
-            * the same pic until it flushes or fails in a different way
-            */
-            retcd = ffmpeg_put_frame(ffmpeg, tv1);
-            while ((retcd == -2) && (ffmpeg->tlapse != TIMELAPSE_NONE)) {
-                retcd = ffmpeg_put_frame(ffmpeg, tv1);
-                cnt++;
-                if (cnt > 50) {
-                    MOTION_LOG(ERR, TYPE_ENCODER, NO_ERRNO
-                        ,_("Excessive attempts to clear buffered packet"));
-                    retcd = -1;
-                }
-            }
-            //non timelapse buffered is ok
-            if (retcd == -2) {
-                retcd = 0;
-                MOTION_LOG(DBG, TYPE_ENCODER, NO_ERRNO, _("Buffered packet"));
-            }
-        }
-
-        return retcd;
+        return ffmpeg_put_image_encode(ffmpeg, img_data, tv1);
 
     #else
         (void)ffmpeg;
@@ -1569,14 +2600,12 @@ int ffmpeg_put_image(struct ffmpeg *ffmpeg, struct image_data *img_data, const s
 void ffmpeg_reset_movie_start_time(struct ffmpeg *ffmpeg, const struct timeval *tv1)
 {
     #ifdef HAVE_FFMPEG
-        int64_t one_frame_interval = av_rescale_q(1,(AVRational){1, ffmpeg->fps},ffmpeg->video_st->time_base);
-        if (one_frame_interval <= 0) {
-            one_frame_interval = 1;
+        if (ffmpeg->queue) {
+            ffmpeg_queue_put(ffmpeg, NULL, tv1);
+            return;
         }
-        ffmpeg->base_pts = ffmpeg->last_pts + one_frame_interval;
 
-        ffmpeg->start_time.tv_sec = tv1->tv_sec;
-        ffmpeg->start_time.tv_usec = tv1->tv_usec;
+        ffmpeg_reset_start(ffmpeg, tv1);
 
     #else
         (void)ffmpeg;
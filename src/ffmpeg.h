@@ -29,6 +29,10 @@
 #include "config.h"
 struct image_data; /* forward declare for functions */
 struct rtsp_context;
+struct ffmpeg_queue;
+struct ffmpeg_io;
+
+#define TIMELAPSE_BUFSIZE   (1024 * 1024)   /* Write buffer of the appended timelapse */
 
 enum TIMELAPSE_TYPE {
     TIMELAPSE_NONE,         /* No timelapse, regular processing */
@@ -41,6 +45,8 @@ enum USER_CODEC {
     USER_CODEC_V4L2M2M,    /* Requested codec for movie is h264_v4l2m2m */
     USER_CODEC_H264OMX,    /* Requested h264_omx */
     USER_CODEC_MPEG4OMX,   /* Requested mpeg4_omx */
+    USER_CODEC_VAAPI,      /* Requested a vaapi encoder such as h264_vaapi */
+    USER_CODEC_NVENC,      /* Requested a nvenc encoder such as h264_nvenc */
     USER_CODEC_DEFAULT     /* All other default codecs */
 };
 
@@ -53,6 +59,10 @@ enum USER_CODEC {
         my_AVCodec      *codec;
         AVPacket *pkt;
         AVFrame *picture;       /* contains default image pointers */
+        #if (MYFFVER >= 57083)
+            AVBufferRef *hw_device_ctx;
+            AVFrame *hw_frame;  /* vaapi surface the picture is uploaded into */
+        #endif
         AVDictionary *opts;
         struct rtsp_context *rtsp_data;
         int width;
@@ -71,9 +81,25 @@ enum USER_CODEC {
         int            high_resolution;
         int            motion_images;
         int            passthrough;
+        int            passthrough_preroll; /* Seconds of packets written before the first image */
+        int            threads;         /* Codec thread_count, 0 for the codec default */
+        const char     *thread_type;    /* Codec thread_type, frame or slice */
+        int            queue_size;      /* Frames buffered for the encoder thread */
+        int            threadnr;
+        struct ffmpeg_queue *queue;
         enum USER_CODEC     preferred_codec;
         char *nal_info;
         int  nal_info_len;
+        struct packet_item *passthru_pkts;  /* Packets taken from the camera for writing */
+        int     passthru_size;
+        int64_t passthru_idnbr;             /* idnbr of the last packet written */
+        int     tlapse_fsync;               /* Seconds between syncs of the appended timelapse */
+        FILE    *tlapse_file;               /* Appended timelapse kept open for the period */
+        char    *tlapse_buf;
+        time_t  tlapse_synced;
+        int     write_buffer;               /* MB the movie file is written behind, 0 to write directly */
+        int     preallocate;                /* MB preallocated for the movie file */
+        struct ffmpeg_io *io;
     };
 #else
     struct ffmpeg {
@@ -94,6 +120,14 @@ enum USER_CODEC {
         int            high_resolution;
         int            motion_images;
         int            passthrough;
+        int            passthrough_preroll;
+        int            threads;
+        const char     *thread_type;
+        int            queue_size;
+        int            threadnr;
+        int            tlapse_fsync;
+        int            write_buffer;
+        int            preallocate;
     };
 #endif // HAVE_FFMPEG
 
@@ -105,5 +139,8 @@ int ffmpeg_open(struct ffmpeg *ffmpeg);
 int ffmpeg_put_image(struct ffmpeg *ffmpeg, struct image_data *img_data, const struct timeval *tv1);
 void ffmpeg_close(struct ffmpeg *ffmpeg);
 void ffmpeg_reset_movie_start_time(struct ffmpeg *ffmpeg, const struct timeval *tv1);
+#ifdef HAVE_FFMPEG
+    struct packet_item *ffmpeg_passthru_item(struct rtsp_context *rtsp_data, int64_t idnbr);
+#endif
 
 #endif /* _INCLUDE_FFMPEG_H_ */
@@ -0,0 +1,430 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *    framepool.c
+ *
+ *    Pool of image buffers shared by all cameras.
+ *
+ *    The image ring and the capture queue take their image buffers from
+ *    this pool and return them when the ring shrinks or the camera stops.
+ *    Returned buffers are kept on a free list per buffer size so a camera
+ *    resizing its ring, or another camera with the same image size, reuses
+ *    them instead of going back to malloc.
+ *
+ *    When frame_pool_budget is set, the bytes allocated by the pool for all
+ *    cameras are kept under the budget.  Buffers a camera needs to run at all
+ *    are always given and only reported when they exceed the budget.  The
+ *    optional buffers (pre_capture) are refused so the ring stays smaller.
+ *
+ *    The pool is also the allocator of the large detection buffers of a
+ *    camera (reference frame, smart mask, labels, common buffer) through
+ *    framepool_alloc and framepool_free.  memory_hugepages backs the large
+ *    buffers with huge pages to cut TLB misses on the per pixel loops and
+ *    memory_numa places them on the NUMA node of the camera thread.
+ *    Ring buffers are swapped with the capture queue and the V4L2 user
+ *    pointer buffers and are released with free(), so for them only
+ *    transparent huge pages are used.  Explicit huge pages are only used
+ *    for the detection buffers that never leave motion.
+ *
+ */
+
+#include "translate.h"
+#include "motion.h"
+#include "util.h"
+#include "logger.h"
+#include "framepool.h"
+
+#include <sys/mman.h>
+#if defined(__linux__)
+    #include <sys/syscall.h>
+    #include <linux/mempolicy.h>
+#endif
+
+/* Number of different buffer sizes kept on the free lists */
+#define FRAMEPOOL_CLASSES 16
+
+/* Size of a huge page and of the header in front of framepool_alloc buffers */
+#define FRAMEPOOL_HUGE_SIZE (2 * 1024 * 1024)
+#define FRAMEPOOL_HDR_SIZE  64
+
+enum FRAMEPOOL_HUGE {
+    FRAMEPOOL_HUGE_OFF,
+    FRAMEPOOL_HUGE_TRANSPARENT,
+    FRAMEPOOL_HUGE_EXPLICIT
+};
+
+struct framepool_hdr {
+    void            *base;          /* Start of the allocation */
+    size_t          len;            /* Length of the allocation */
+    int             mapped;         /* Allocated with mmap rather than malloc */
+};
+
+struct framepool_class {
+    size_t          size;
+    unsigned char   **bufs;         /* Free buffers of this size */
+    int             count;
+    int             alloc;
+};
+
+static pthread_mutex_t framepool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct framepool_class framepool_classes[FRAMEPOOL_CLASSES];
+static size_t framepool_limit;      /* Budget in bytes, 0 for no limit */
+static size_t framepool_total;      /* Bytes allocated by the pool, in use or free */
+static int framepool_huge;          /* FRAMEPOOL_HUGE_* from memory_hugepages */
+static int framepool_numa;          /* Bind buffers to the node of the allocating thread */
+static int framepool_huge_failed;   /* Explicit huge page allocation failed once */
+
+/** framepool_bind
+ *  Prefer the NUMA node the calling thread runs on for the pages of buf.
+ *  Must be called before the pages are first touched.  Without mbind the
+ *  pages still land on the node of the first thread writing them.
+ */
+static void framepool_bind(void *buf, size_t size)
+{
+    #if defined(__linux__) && defined(SYS_mbind) && defined(SYS_getcpu)
+        unsigned int cpu, node;
+        unsigned long nodemask;
+        uintptr_t start, pagesize;
+
+        if (!framepool_numa) {
+            return;
+        }
+        pagesize = (uintptr_t)sysconf(_SC_PAGESIZE);
+        if (size < pagesize) {
+            return;
+        }
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+            return;
+        }
+        if (node >= sizeof(nodemask) * 8) {
+            return;
+        }
+        nodemask = 1UL << node;
+
+        start = (uintptr_t)buf & ~(pagesize - 1);
+        if (syscall(SYS_mbind, (void *)start, size + ((uintptr_t)buf - start)
+                , MPOL_PREFERRED, &nodemask, sizeof(nodemask) * 8, 0) != 0) {
+            MOTION_LOG(DBG, TYPE_ALL, SHOW_ERRNO, _("Unable to bind buffer to node %u"), node);
+        }
+    #else
+        (void)buf;
+        (void)size;
+    #endif
+}
+
+/** framepool_malloc
+ *  malloc compatible allocation of size bytes.  Large buffers are aligned to
+ *  the huge page size and marked for transparent huge pages when huge pages
+ *  are in use.  The buffer is released with free().
+ */
+static void *framepool_malloc(size_t size)
+{
+    void *buf;
+    size_t align;
+
+    align = 64;
+    if ((framepool_huge != FRAMEPOOL_HUGE_OFF) && (size >= FRAMEPOOL_HUGE_SIZE)) {
+        align = FRAMEPOOL_HUGE_SIZE;
+    }
+    if (posix_memalign(&buf, align, size) != 0) {
+        return mymalloc(size);
+    }
+
+    #ifdef MADV_HUGEPAGE
+        if (align == FRAMEPOOL_HUGE_SIZE) {
+            madvise(buf, size, MADV_HUGEPAGE);
+        }
+    #endif
+    framepool_bind(buf, size);
+
+    return buf;
+}
+
+/* Release free buffers of any size until size more bytes fit in the budget.
+ * Requires the framepool_mutex.
+ */
+static void framepool_trim(size_t size)
+{
+    struct framepool_class *cls;
+    int indx;
+
+    for (indx = 0; indx < FRAMEPOOL_CLASSES; indx++) {
+        cls = &framepool_classes[indx];
+        while ((cls->count > 0) && (framepool_total + size > framepool_limit)) {
+            cls->count--;
+            free(cls->bufs[cls->count]);
+            framepool_total -= cls->size;
+        }
+    }
+}
+
+static struct framepool_class *framepool_class_find(size_t size, int create)
+{
+    int indx;
+
+    for (indx = 0; indx < FRAMEPOOL_CLASSES; indx++) {
+        if (framepool_classes[indx].size == size) {
+            return &framepool_classes[indx];
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    for (indx = 0; indx < FRAMEPOOL_CLASSES; indx++) {
+        if (framepool_classes[indx].count == 0) {
+            framepool_classes[indx].size = size;
+            return &framepool_classes[indx];
+        }
+    }
+    return NULL;
+}
+
+/** framepool_init
+ *  Set the budget of the pool in megabytes.  A budget of 0 means no limit.
+ *  hugepages is the memory_hugepages option and numa the memory_numa option.
+ */
+void framepool_init(int budget_mb, const char *hugepages, int numa)
+{
+    pthread_mutex_lock(&framepool_mutex);
+        if (budget_mb > 0) {
+            framepool_limit = (size_t)budget_mb * 1024 * 1024;
+        } else {
+            framepool_limit = 0;
+        }
+    pthread_mutex_unlock(&framepool_mutex);
+
+    if (framepool_limit > 0) {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("Frame pool budget %d MB"), budget_mb);
+    }
+
+    if (mystreq(hugepages, "transparent")) {
+        framepool_huge = FRAMEPOOL_HUGE_TRANSPARENT;
+    } else if (mystreq(hugepages, "explicit")) {
+        framepool_huge = FRAMEPOOL_HUGE_EXPLICIT;
+    } else {
+        if ((hugepages != NULL) && !mystreq(hugepages, "off")) {
+            MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
+                ,_("Invalid memory_hugepages %s, huge pages not used"), hugepages);
+        }
+        framepool_huge = FRAMEPOOL_HUGE_OFF;
+    }
+    framepool_huge_failed = FALSE;
+
+    #if !defined(MADV_HUGEPAGE)
+        if (framepool_huge == FRAMEPOOL_HUGE_TRANSPARENT) {
+            MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+                ,_("Transparent huge pages are not supported on this system"));
+        }
+    #endif
+    #if !defined(MAP_HUGETLB)
+        if (framepool_huge == FRAMEPOOL_HUGE_EXPLICIT) {
+            MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+                ,_("Explicit huge pages are not supported on this system"));
+        }
+    #endif
+
+    framepool_numa = numa;
+    #if !defined(__linux__) || !defined(SYS_mbind) || !defined(SYS_getcpu)
+        if (framepool_numa) {
+            MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+                ,_("NUMA placement is not supported on this system"));
+            framepool_numa = FALSE;
+        }
+    #endif
+
+    if ((framepool_huge != FRAMEPOOL_HUGE_OFF) || framepool_numa) {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("Image buffers use huge pages %s, NUMA placement %s")
+            ,(framepool_huge == FRAMEPOOL_HUGE_EXPLICIT) ? "explicit" :
+             (framepool_huge == FRAMEPOOL_HUGE_TRANSPARENT) ? "transparent" : "off"
+            ,framepool_numa ? "on" : "off");
+    }
+}
+
+void framepool_deinit(void)
+{
+    struct framepool_class *cls;
+    int indx;
+
+    pthread_mutex_lock(&framepool_mutex);
+        for (indx = 0; indx < FRAMEPOOL_CLASSES; indx++) {
+            cls = &framepool_classes[indx];
+            while (cls->count > 0) {
+                cls->count--;
+                free(cls->bufs[cls->count]);
+                framepool_total -= cls->size;
+            }
+            free(cls->bufs);
+            cls->bufs = NULL;
+            cls->alloc = 0;
+            cls->size = 0;
+        }
+    pthread_mutex_unlock(&framepool_mutex);
+}
+
+/** framepool_get
+ *  Take a buffer of size bytes for the camera.  A free buffer of the same size
+ *  is reused when there is one.  Returns NULL when the buffer is not required
+ *  and the budget does not allow it.  The contents of the buffer are undefined.
+ */
+unsigned char *framepool_get(struct context *cnt, size_t size, int required)
+{
+    struct framepool_class *cls;
+    unsigned char *buf;
+    int over;
+
+    over = FALSE;
+    pthread_mutex_lock(&framepool_mutex);
+        cls = framepool_class_find(size, FALSE);
+        if ((cls != NULL) && (cls->count > 0)) {
+            cls->count--;
+            buf = cls->bufs[cls->count];
+            cnt->framepool_bytes += size;
+            pthread_mutex_unlock(&framepool_mutex);
+            return buf;
+        }
+
+        if ((framepool_limit > 0) && (framepool_total + size > framepool_limit)) {
+            framepool_trim(size);
+            if (framepool_total + size > framepool_limit) {
+                if (!required) {
+                    pthread_mutex_unlock(&framepool_mutex);
+                    return NULL;
+                }
+                over = TRUE;
+            }
+        }
+        framepool_total += size;
+        cnt->framepool_bytes += size;
+    pthread_mutex_unlock(&framepool_mutex);
+
+    if (over) {
+        MOTION_LOG(WRN, TYPE_ALL, NO_ERRNO
+            ,_("Frame pool budget exceeded, camera uses %lu KB")
+            ,(unsigned long)(cnt->framepool_bytes / 1024));
+    }
+
+    return framepool_malloc(size);
+}
+
+/** framepool_put
+ *  Return a buffer taken with framepool_get.  It is kept for reuse unless
+ *  the pool is over the budget.
+ */
+void framepool_put(struct context *cnt, unsigned char *buf, size_t size)
+{
+    struct framepool_class *cls;
+
+    if (buf == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&framepool_mutex);
+        cnt->framepool_bytes -= size;
+
+        cls = NULL;
+        if ((framepool_limit == 0) || (framepool_total <= framepool_limit)) {
+            cls = framepool_class_find(size, TRUE);
+        }
+        if (cls == NULL) {
+            free(buf);
+            framepool_total -= size;
+            pthread_mutex_unlock(&framepool_mutex);
+            return;
+        }
+
+        if (cls->count == cls->alloc) {
+            cls->alloc += 8;
+            cls->bufs = myrealloc(cls->bufs, cls->alloc * sizeof(unsigned char *), "framepool_put");
+        }
+        cls->bufs[cls->count] = buf;
+        cls->count++;
+    pthread_mutex_unlock(&framepool_mutex);
+}
+
+/* Budget of the pool in bytes, 0 when there is no limit */
+size_t framepool_budget(void)
+{
+    return framepool_limit;
+}
+
+/** framepool_alloc
+ *  Allocate a detection buffer of size bytes for the calling camera thread.
+ *  With explicit huge pages large buffers are mapped from the huge page
+ *  reserve, falling back to transparent huge pages when the reserve is empty.
+ *  Like mymalloc this does not return NULL.  Release with framepool_free.
+ */
+void *framepool_alloc(size_t size)
+{
+    struct framepool_hdr *hdr;
+    unsigned char *base;
+    size_t len;
+    int mapped;
+
+    len = size + FRAMEPOOL_HDR_SIZE;
+    base = NULL;
+    mapped = FALSE;
+
+    #ifdef MAP_HUGETLB
+        if ((framepool_huge == FRAMEPOOL_HUGE_EXPLICIT) && (size >= FRAMEPOOL_HUGE_SIZE)) {
+            len = (len + FRAMEPOOL_HUGE_SIZE - 1) & ~((size_t)FRAMEPOOL_HUGE_SIZE - 1);
+            base = mmap(NULL, len, PROT_READ | PROT_WRITE
+                , MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (base == MAP_FAILED) {
+                base = NULL;
+                len = size + FRAMEPOOL_HDR_SIZE;
+                if (!framepool_huge_failed) {
+                    framepool_huge_failed = TRUE;
+                    MOTION_LOG(WRN, TYPE_ALL, SHOW_ERRNO
+                        ,_("No explicit huge pages available, using transparent huge pages"));
+                }
+            } else {
+                framepool_bind(base, len);
+                mapped = TRUE;
+            }
+        }
+    #endif
+
+    if (base == NULL) {
+        base = framepool_malloc(len);
+    }
+
+    hdr = (struct framepool_hdr *)base;
+    hdr->base = base;
+    hdr->len = len;
+    hdr->mapped = mapped;
+
+    return base + FRAMEPOOL_HDR_SIZE;
+}
+
+/* Release a buffer from framepool_alloc, NULL is ignored */
+void framepool_free(void *ptr)
+{
+    struct framepool_hdr *hdr;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    hdr = (struct framepool_hdr *)((unsigned char *)ptr - FRAMEPOOL_HDR_SIZE);
+    if (hdr->mapped) {
+        munmap(hdr->base, hdr->len);
+    } else {
+        free(hdr->base);
+    }
+}
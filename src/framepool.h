@@ -0,0 +1,33 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  framepool.h
+ *    Headers associated with functions in the framepool.c module.
+ */
+
+#ifndef _INCLUDE_FRAMEPOOL_H
+#define _INCLUDE_FRAMEPOOL_H
+
+void framepool_init(int budget_mb, const char *hugepages, int numa);
+void framepool_deinit(void);
+unsigned char *framepool_get(struct context *cnt, size_t size, int required);
+void framepool_put(struct context *cnt, unsigned char *buf, size_t size);
+size_t framepool_budget(void);
+void *framepool_alloc(size_t size);
+void framepool_free(void *ptr);
+
+#endif /* _INCLUDE_FRAMEPOOL_H */
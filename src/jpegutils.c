@@ -49,6 +49,14 @@
  *      jpgutl_emit_message
  *  Exposed Functions
  *    jpgutl_decode_jpeg
+ *    jpgutl_put_yuv420p / jpgutl_put_yuv420p_exif
+ *    jpgutl_put_grey / jpgutl_put_grey_exif
+ *  TurboJPEG
+ *    When built with libturbojpeg, each thread keeps a TurboJPEG compressor,
+ *    decompressor and output buffer for its lifetime.  The YUV420P planes are
+ *    then encoded and decoded directly without setting up a new libjpeg
+ *    object per image.  Anything TurboJPEG does not handle, such as JPEGs
+ *    that are not 4:2:0 or that raise warnings, falls back to libjpeg.
  */
 
 #include "translate.h"
@@ -88,6 +96,10 @@
 #include <jerror.h>
 #include <assert.h>
 
+#ifdef HAVE_TURBOJPEG
+    #include <turbojpeg.h>
+#endif
+
 static const uint8_t EOI_data[2] = { 0xFF, 0xD9 };
 
 struct jpgutl_error_mgr {
@@ -427,21 +439,192 @@ static GLOBAL(int) _jpeg_mem_size(j_compress_ptr cinfo)
     return dest->jpegsize;
 }
 
+#ifdef HAVE_TURBOJPEG
+
+/* TurboJPEG state kept by each thread that encodes or decodes */
+struct jpgutl_tj {
+    tjhandle        compress;
+    tjhandle        decompress;
+    unsigned char   *buf;           /* Compressed output, reused between images */
+    unsigned long   buf_size;
+};
+
+static pthread_key_t jpgutl_tj_key;
+static pthread_once_t jpgutl_tj_once = PTHREAD_ONCE_INIT;
+
+static void jpgutl_tj_free(void *arg)
+{
+    struct jpgutl_tj *tj = arg;
+
+    if (tj->compress != NULL) {
+        tjDestroy(tj->compress);
+    }
+    if (tj->decompress != NULL) {
+        tjDestroy(tj->decompress);
+    }
+    tjFree(tj->buf);
+    free(tj);
+}
+
+static void jpgutl_tj_key_create(void)
+{
+    pthread_key_create(&jpgutl_tj_key, jpgutl_tj_free);
+}
+
+/* TurboJPEG state of the calling thread, released when the thread ends */
+static struct jpgutl_tj *jpgutl_tj_get(void)
+{
+    struct jpgutl_tj *tj;
+
+    pthread_once(&jpgutl_tj_once, jpgutl_tj_key_create);
+
+    tj = pthread_getspecific(jpgutl_tj_key);
+    if (tj == NULL) {
+        tj = mymalloc(sizeof(struct jpgutl_tj));
+        memset(tj, 0, sizeof(struct jpgutl_tj));
+        pthread_setspecific(jpgutl_tj_key, tj);
+    }
+
+    return tj;
+}
+
+/**
+ * jpgutl_tj_put
+ *  Compress with the TurboJPEG compressor of the thread into its output
+ *  buffer and copy the result to dest_image with the EXIF APP1 marker added
+ *  after the JFIF marker, where libjpeg puts it.  planes holds the Y, U and
+ *  V planes for TJSAMP_420 or the single plane for TJSAMP_GRAY.
+ *  Returns the size written to dest_image, -1 when it does not fit or -2
+ *  when TurboJPEG failed and libjpeg should be used instead.
+ */
+static int jpgutl_tj_put(unsigned char *dest_image, int image_size, const unsigned char **planes
+            , int width, int height, int subsamp, int quality
+            , const unsigned char *exif, unsigned exif_len)
+{
+    struct jpgutl_tj *tj;
+    unsigned long need, jpeg_size, hdr_len;
+    int retcd;
+
+    tj = jpgutl_tj_get();
+    if (tj->compress == NULL) {
+        tj->compress = tjInitCompress();
+        if (tj->compress == NULL) {
+            return -2;
+        }
+    }
+
+    need = tjBufSize(width, height, subsamp);
+    if (tj->buf_size < need) {
+        tjFree(tj->buf);
+        tj->buf = tjAlloc(need);
+        if (tj->buf == NULL) {
+            tj->buf_size = 0;
+            return -2;
+        }
+        tj->buf_size = need;
+    }
+
+    jpeg_size = tj->buf_size;
+    if (subsamp == TJSAMP_GRAY) {
+        retcd = tjCompress2(tj->compress, planes[0], width, 0, height, TJPF_GRAY
+            , &tj->buf, &jpeg_size, TJSAMP_GRAY, quality, TJFLAG_FASTDCT | TJFLAG_NOREALLOC);
+    } else {
+        retcd = tjCompressFromYUVPlanes(tj->compress, planes, width, NULL, height, subsamp
+            , &tj->buf, &jpeg_size, quality, TJFLAG_FASTDCT | TJFLAG_NOREALLOC);
+    }
+    if (retcd != 0) {
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO
+            ,_("TurboJPEG compression failed: %s"), tjGetErrorStr2(tj->compress));
+        return -2;
+    }
+
+    if (exif_len == 0) {
+        if (jpeg_size > (unsigned long)image_size) {
+            return -1;
+        }
+        memcpy(dest_image, tj->buf, jpeg_size);
+        return jpeg_size;
+    }
+
+    if (jpeg_size + exif_len + 4 > (unsigned long)image_size) {
+        return -1;
+    }
+
+    /* SOI and, when present, the JFIF APP0 marker go first */
+    hdr_len = 2;
+    if ((jpeg_size > 6) && (tj->buf[2] == 0xFF) && (tj->buf[3] == 0xE0)) {
+        hdr_len += 2 + ((tj->buf[4] << 8) | tj->buf[5]);
+        if (hdr_len > jpeg_size) {
+            hdr_len = 2;
+        }
+    }
+
+    memcpy(dest_image, tj->buf, hdr_len);
+    dest_image[hdr_len] = 0xFF;
+    dest_image[hdr_len + 1] = JPEG_APP0 + 1;
+    dest_image[hdr_len + 2] = ((exif_len + 2) >> 8) & 0xFF;
+    dest_image[hdr_len + 3] = (exif_len + 2) & 0xFF;
+    memcpy(dest_image + hdr_len + 4, exif, exif_len);
+    memcpy(dest_image + hdr_len + 4 + exif_len, tj->buf + hdr_len, jpeg_size - hdr_len);
+
+    return jpeg_size + exif_len + 4;
+}
+
+/**
+ * jpgutl_tj_decode
+ *  Decode a 4:2:0 JPEG of the expected size straight into the YUV420P
+ *  planes of img_out.  Returns 0 on success and -1 when the image must be
+ *  decoded by libjpeg instead, which also reports size and corrupt data.
+ */
+static int jpgutl_tj_decode(unsigned char *jpeg_data_in, int jpeg_data_len
+            , unsigned int width, unsigned int height, unsigned char *img_out)
+{
+    struct jpgutl_tj *tj;
+    unsigned char *planes[3];
+    int jpeg_width, jpeg_height, jpeg_subsamp, jpeg_colorspace;
+
+    tj = jpgutl_tj_get();
+    if (tj->decompress == NULL) {
+        tj->decompress = tjInitDecompress();
+        if (tj->decompress == NULL) {
+            return -1;
+        }
+    }
+
+    if (tjDecompressHeader3(tj->decompress, jpeg_data_in, jpeg_data_len
+            , &jpeg_width, &jpeg_height, &jpeg_subsamp, &jpeg_colorspace) != 0) {
+        return -1;
+    }
+    if (((unsigned int)jpeg_width != width) || ((unsigned int)jpeg_height != height) ||
+        (jpeg_subsamp != TJSAMP_420)) {
+        return -1;
+    }
+
+    planes[0] = img_out;
+    planes[1] = planes[0] + width * height;
+    planes[2] = planes[1] + (width * height) / 4;
+
+    /* Warnings also return -1 so libjpeg decides whether the image is usable */
+    if (tjDecompressToYUVPlanes(tj->decompress, jpeg_data_in, jpeg_data_len
+            , planes, width, NULL, height, 0) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+#endif /* HAVE_TURBOJPEG */
+
 /*
  * put_jpeg_exif writes the EXIF APP1 chunk to the jpeg file.
  * It must be called after jpeg_start_compress() but before
  * any image data is written by jpeg_write_scanlines().
  */
-static void put_jpeg_exif(j_compress_ptr cinfo, const struct context *cnt
-            , const struct timeval *tv1, const struct coord *box)
+static void put_jpeg_exif(j_compress_ptr cinfo, const unsigned char *exif, unsigned exif_len)
 {
-    unsigned char *exif = NULL;
-    unsigned exif_len = prepare_exif(&exif, cnt, tv1, box);
-
     if(exif_len > 0) {
         /* EXIF data lives in a JPEG APP1 marker */
         jpeg_write_marker(cinfo, JPEG_APP0 + 1, exif, exif_len);
-        free(exif);
     }
 }
 
@@ -472,6 +655,12 @@ int jpgutl_decode_jpeg (unsigned char *jpeg_data_in, int jpeg_data_len
     struct jpeg_decompress_struct dinfo;
     struct jpgutl_error_mgr jerr;
 
+    #ifdef HAVE_TURBOJPEG
+        if (jpgutl_tj_decode(jpeg_data_in, jpeg_data_len, width, height, img_out) == 0) {
+            return 0;
+        }
+    #endif
+
     /* We set up the normal JPEG error routines, then override error_exit. */
     dinfo.err = jpeg_std_error (&jerr.pub);
     jerr.pub.error_exit = jpgutl_error_exit;
@@ -559,9 +748,14 @@ int jpgutl_decode_jpeg (unsigned char *jpeg_data_in, int jpeg_data_len
 
 }
 
-int jpgutl_put_yuv420p(unsigned char *dest_image, int image_size, unsigned char *input_image, int width
-            , int height, int quality, struct context *cnt, struct timeval *tv1, struct coord *box)
-
+/**
+ * jpgutl_put_yuv420p_exif
+ *  Compress the yuv420p input_image into dest_image with the EXIF data
+ *  already prepared by prepare_exif.  Does not use the camera context so
+ *  it may run on any thread.
+ */
+int jpgutl_put_yuv420p_exif(unsigned char *dest_image, int image_size, unsigned char *input_image
+            , int width, int height, int quality, const unsigned char *exif, unsigned exif_len)
 {
     int i, j, jpeg_image_size;
 
@@ -571,6 +765,19 @@ int jpgutl_put_yuv420p(unsigned char *dest_image, int image_size, unsigned char
     struct jpeg_compress_struct cinfo;
     struct jpgutl_error_mgr jerr;
 
+    #ifdef HAVE_TURBOJPEG
+        const unsigned char *planes[3];
+
+        planes[0] = input_image;
+        planes[1] = input_image + width * height;
+        planes[2] = planes[1] + (width * height) / 4;
+        jpeg_image_size = jpgutl_tj_put(dest_image, image_size, planes
+            , width, height, TJSAMP_420, quality, exif, exif_len);
+        if (jpeg_image_size != -2) {
+            return jpeg_image_size;
+        }
+    #endif
+
     data[0] = y;
     data[1] = cb;
     data[2] = cr;
@@ -617,7 +824,7 @@ int jpgutl_put_yuv420p(unsigned char *dest_image, int image_size, unsigned char
 
     jpeg_start_compress(&cinfo, TRUE);
 
-    put_jpeg_exif(&cinfo, cnt, tv1, box);
+    put_jpeg_exif(&cinfo, exif, exif_len);
 
     /* If the image is not a multiple of 16, this overruns the buffers
      * we'll just pad those last bytes with zeros
@@ -646,14 +853,45 @@ int jpgutl_put_yuv420p(unsigned char *dest_image, int image_size, unsigned char
     return jpeg_image_size;
 }
 
-int jpgutl_put_grey(unsigned char *dest_image, int image_size, unsigned char *input_image, int width
+int jpgutl_put_yuv420p(unsigned char *dest_image, int image_size, unsigned char *input_image, int width
             , int height, int quality, struct context *cnt, struct timeval *tv1, struct coord *box)
+
+{
+    unsigned char *exif = NULL;
+    unsigned exif_len;
+    int retcd;
+
+    exif_len = prepare_exif(&exif, cnt, tv1, box);
+    retcd = jpgutl_put_yuv420p_exif(dest_image, image_size, input_image
+        , width, height, quality, exif, exif_len);
+    free(exif);
+
+    return retcd;
+}
+
+/**
+ * jpgutl_put_grey_exif
+ *  Greyscale version of jpgutl_put_yuv420p_exif.
+ */
+int jpgutl_put_grey_exif(unsigned char *dest_image, int image_size, unsigned char *input_image
+            , int width, int height, int quality, const unsigned char *exif, unsigned exif_len)
 {
     int y, dest_image_size;
     JSAMPROW row_ptr[1];
     struct jpeg_compress_struct cjpeg;
     struct jpgutl_error_mgr jerr;
 
+    #ifdef HAVE_TURBOJPEG
+        const unsigned char *planes[1];
+
+        planes[0] = input_image;
+        dest_image_size = jpgutl_tj_put(dest_image, image_size, planes
+            , width, height, TJSAMP_GRAY, quality, exif, exif_len);
+        if (dest_image_size != -2) {
+            return dest_image_size;
+        }
+    #endif
+
     cjpeg.err = jpeg_std_error (&jerr.pub);
     jerr.pub.error_exit = jpgutl_error_exit;
     /* Also hook the emit_message routine to note corrupt-data warnings. */
@@ -683,7 +921,7 @@ int jpgutl_put_grey(unsigned char *dest_image, int image_size, unsigned char *in
 
     jpeg_start_compress (&cjpeg, TRUE);
 
-    put_jpeg_exif(&cjpeg, cnt, tv1, box);
+    put_jpeg_exif(&cjpeg, exif, exif_len);
 
     row_ptr[0] = input_image;
 
@@ -699,3 +937,18 @@ int jpgutl_put_grey(unsigned char *dest_image, int image_size, unsigned char *in
     return dest_image_size;
 }
 
+int jpgutl_put_grey(unsigned char *dest_image, int image_size, unsigned char *input_image, int width
+            , int height, int quality, struct context *cnt, struct timeval *tv1, struct coord *box)
+{
+    unsigned char *exif = NULL;
+    unsigned exif_len;
+    int retcd;
+
+    exif_len = prepare_exif(&exif, cnt, tv1, box);
+    retcd = jpgutl_put_grey_exif(dest_image, image_size, input_image
+        , width, height, quality, exif, exif_len);
+    free(exif);
+
+    return retcd;
+}
+
@@ -31,5 +31,9 @@ int jpgutl_put_yuv420p(unsigned char *dest_image, int image_size, unsigned char
             , int height, int quality, struct context *cnt, struct timeval *tv1, struct coord *box);
 int jpgutl_put_grey(unsigned char *dest_image, int image_size, unsigned char *input_image, int width
             , int height, int quality, struct context *cnt, struct timeval *tv1, struct coord *box);
+int jpgutl_put_yuv420p_exif(unsigned char *dest_image, int image_size, unsigned char *input_image
+            , int width, int height, int quality, const unsigned char *exif, unsigned exif_len);
+int jpgutl_put_grey_exif(unsigned char *dest_image, int image_size, unsigned char *input_image
+            , int width, int height, int quality, const unsigned char *exif, unsigned exif_len);
 
 #endif
@@ -0,0 +1,345 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *    loadtest.c
+ *
+ *    Load test with synthetic cameras started with the -L option.
+ *
+ *    The cameras are copies of the main configuration with a synthetic
+ *    camera, see video_synth.c, so the whole motion loop including the
+ *    pictures, movies and streams of the configuration runs on each of
+ *    them.  For each camera the frames processed, the CPU time of its
+ *    motion loop steps and the latency from the frame time to the end of
+ *    its motion loop step are kept.  When the test time is over, the fps
+ *    each camera sustained, the CPU use and the latency percentiles are
+ *    written to the log and Motion ends.  The latest files written by each
+ *    camera are kept and the test fails when a camera writes a file which
+ *    another camera wrote as well, since their numbers would not count the
+ *    writes of both.
+ *
+ */
+
+#include <sys/resource.h>
+#include "translate.h"
+#include "motion.h"
+#include "util.h"
+#include "logger.h"
+#include "video_synth.h"
+#include "loadtest.h"
+
+static struct {
+    int                 cameras;
+    int                 seconds;
+    long long           start_nsec;
+    struct rusage       start_usage;
+    int                 reported;
+    struct context      **cnt_list;
+    pthread_mutex_t     mutex;          /* Protects the files of the cameras */
+    unsigned long       shared;         /* Files written by more than one camera */
+    char                shared_file[PATH_MAX];
+} loadtest = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static long long loadtest_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((long long)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+static long long loadtest_cpu_nsec(struct timespec *ts)
+{
+    return ((long long)ts->tv_sec * 1000000000LL) + ts->tv_nsec;
+}
+
+static int loadtest_cmp(const void *a, const void *b)
+{
+    long la = *(const long *)a;
+    long lb = *(const long *)b;
+
+    return (la > lb) - (la < lb);
+}
+
+/* Percentile of the sorted samples in ms */
+static double loadtest_pct(long *samples, int count, int pct)
+{
+    if (count == 0) {
+        return 0;
+    }
+    return samples[(long)(count - 1) * pct / 100] / 1000.0;
+}
+
+/** loadtest_start
+ *  Set up the measurements of the cameras when the -L option was given.
+ */
+void loadtest_start(struct context **cnt_list)
+{
+    int indx;
+
+    loadtest.cameras = cnt_list[0]->loadtest_cameras;
+    loadtest.seconds = cnt_list[0]->loadtest_seconds;
+    loadtest.reported = FALSE;
+    loadtest.shared = 0;
+    if (loadtest.cameras <= 0) {
+        return;
+    }
+
+    for (indx = 1; cnt_list[indx]; indx++) {
+        cnt_list[indx]->loadtest = mymalloc(sizeof(struct loadtest_camera));
+        memset(cnt_list[indx]->loadtest, 0, sizeof(struct loadtest_camera));
+        pthread_mutex_init(&cnt_list[indx]->loadtest->mutex, NULL);
+    }
+
+    loadtest.cnt_list = cnt_list;
+    loadtest.start_nsec = loadtest_now();
+    getrusage(RUSAGE_SELF, &loadtest.start_usage);
+
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+        ,_("Load test of %d synthetic cameras for %d seconds")
+        ,loadtest.cameras, loadtest.seconds);
+}
+
+/** loadtest_stop
+ *  Called once the camera threads have finished.
+ */
+void loadtest_stop(struct context **cnt_list)
+{
+    int indx;
+
+    pthread_mutex_lock(&loadtest.mutex);
+        loadtest.cnt_list = NULL;
+    pthread_mutex_unlock(&loadtest.mutex);
+
+    for (indx = 0; cnt_list[indx]; indx++) {
+        if (cnt_list[indx]->loadtest != NULL) {
+            pthread_mutex_destroy(&cnt_list[indx]->loadtest->mutex);
+            free(cnt_list[indx]->loadtest);
+            cnt_list[indx]->loadtest = NULL;
+        }
+    }
+}
+
+void loadtest_step_start(struct context *cnt, struct timespec *cpu)
+{
+    if (cnt->loadtest != NULL) {
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, cpu);
+    }
+}
+
+/** loadtest_step_end
+ *  Add the CPU time of a motion loop step and when it processed a new
+ *  frame, the latency from the frame time.
+ */
+void loadtest_step_end(struct context *cnt, struct timespec *cpu, int captured)
+{
+    struct loadtest_camera *cam = cnt->loadtest;
+    struct timespec cpu_end;
+    struct timeval tv;
+    long long now;
+    long latency;
+
+    if (cam == NULL) {
+        return;
+    }
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    now = loadtest_now();
+    gettimeofday(&tv, NULL);
+    latency = ((tv.tv_sec - cnt->current_image->timestamp_tv.tv_sec) * 1000000L) +
+        (tv.tv_usec - cnt->current_image->timestamp_tv.tv_usec);
+
+    pthread_mutex_lock(&cam->mutex);
+        cam->cpu_nsec += loadtest_cpu_nsec(&cpu_end) - loadtest_cpu_nsec(cpu);
+        if (captured && (cnt->lost_connection == 0)) {
+            if (cam->frames == 0) {
+                cam->first_nsec = now;
+            }
+            cam->frames++;
+            cam->last_nsec = now;
+            cam->latency_usec[cam->latency_count % LOADTEST_SAMPLES] = (latency > 0) ? latency : 0;
+            cam->latency_count++;
+        }
+    pthread_mutex_unlock(&cam->mutex);
+}
+
+/** loadtest_file
+ *  Keep a file written by the camera and count it when another camera
+ *  wrote it as well.
+ */
+void loadtest_file(struct context *cnt, const char *filename)
+{
+    struct loadtest_camera *cam;
+    int indx, file;
+
+    if ((cnt->loadtest == NULL) || (filename == NULL)) {
+        return;
+    }
+
+    pthread_mutex_lock(&loadtest.mutex);
+        /* The files of the events ended by the shutdown are not counted */
+        if (loadtest.reported) {
+            pthread_mutex_unlock(&loadtest.mutex);
+            return;
+        }
+        for (indx = 1; (loadtest.cnt_list != NULL) && loadtest.cnt_list[indx]; indx++) {
+            cam = loadtest.cnt_list[indx]->loadtest;
+            if ((cam == NULL) || (cam == cnt->loadtest)) {
+                continue;
+            }
+            for (file = 0; (file < cam->file_count) && (file < LOADTEST_FILES); file++) {
+                if (mystreq(cam->files[file], filename)) {
+                    if (loadtest.shared == 0) {
+                        snprintf(loadtest.shared_file, PATH_MAX, "%s", filename);
+                    }
+                    loadtest.shared++;
+                    break;
+                }
+            }
+        }
+
+        cam = cnt->loadtest;
+        snprintf(cam->files[cam->file_count % LOADTEST_FILES], PATH_MAX, "%s", filename);
+        cam->file_count++;
+    pthread_mutex_unlock(&loadtest.mutex);
+}
+
+static double loadtest_usage_sec(struct rusage *usage)
+{
+    return usage->ru_utime.tv_sec + usage->ru_stime.tv_sec +
+        ((usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) / 1000000.0);
+}
+
+/** loadtest_report
+ *  Write the results of each camera and the totals to the log.
+ */
+static void loadtest_report(struct context **cnt_list, double elapsed)
+{
+    struct loadtest_camera *cam;
+    struct rusage usage;
+    long *samples, *all;
+    int indx, count, all_count, sustained, cams;
+    double fps, fps_total, cpu;
+    unsigned long late;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    for (cams = 0; cnt_list[cams + 1]; cams++);
+    all = mymalloc((cams + 1) * LOADTEST_SAMPLES * sizeof(long));
+    samples = mymalloc(LOADTEST_SAMPLES * sizeof(long));
+    all_count = 0;
+    sustained = 0;
+    cams = 0;
+    fps_total = 0;
+
+    for (indx = 1; cnt_list[indx]; indx++) {
+        cam = cnt_list[indx]->loadtest;
+        if (cam == NULL) {
+            continue;
+        }
+        cams++;
+
+        pthread_mutex_lock(&cam->mutex);
+            count = (cam->latency_count < LOADTEST_SAMPLES) ? cam->latency_count : LOADTEST_SAMPLES;
+            memcpy(samples, cam->latency_usec, count * sizeof(long));
+            if ((cam->frames > 1) && (cam->last_nsec > cam->first_nsec)) {
+                fps = (cam->frames - 1) / ((cam->last_nsec - cam->first_nsec) / 1000000000.0);
+            } else {
+                fps = 0;
+            }
+            cpu = (cam->cpu_nsec / 1000000000.0) / elapsed;
+        pthread_mutex_unlock(&cam->mutex);
+
+        late = (cnt_list[indx]->synth != NULL) ? cnt_list[indx]->synth->late : 0;
+
+        qsort(samples, count, sizeof(long), loadtest_cmp);
+        memcpy(all + all_count, samples, count * sizeof(long));
+        all_count += count;
+
+        fps_total += fps;
+        if (fps >= cnt_list[indx]->conf.framerate * 0.95) {
+            sustained++;
+        }
+
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("Load test camera %d: %.1f of %d fps, %lu frames late, loop CPU %.1f%%"
+               ", latency p50 %.1f ms p95 %.1f ms p99 %.1f ms")
+            ,cnt_list[indx]->camera_id, fps, cnt_list[indx]->conf.framerate, late, cpu * 100
+            ,loadtest_pct(samples, count, 50), loadtest_pct(samples, count, 95)
+            ,loadtest_pct(samples, count, 99));
+    }
+
+    qsort(all, all_count, sizeof(long), loadtest_cmp);
+    cpu = (loadtest_usage_sec(&usage) - loadtest_usage_sec(&loadtest.start_usage)) / elapsed;
+
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+        ,_("Load test: %d of %d cameras of %dx%d sustained the framerate, %.1f fps in total")
+        ,sustained, cams, cnt_list[0]->conf.width, cnt_list[0]->conf.height, fps_total);
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+        ,_("Load test: process CPU %.2f cores, %.2f cores per camera")
+        ,cpu, (cams > 0) ? cpu / cams : 0);
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+        ,_("Load test: latency of all cameras p50 %.1f ms p95 %.1f ms p99 %.1f ms")
+        ,loadtest_pct(all, all_count, 50), loadtest_pct(all, all_count, 95)
+        ,loadtest_pct(all, all_count, 99));
+
+    pthread_mutex_lock(&loadtest.mutex);
+        if (loadtest.shared > 0) {
+            MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
+                ,_("Load test failed: %lu files were written by more than one camera, such as %s")
+                ,loadtest.shared, loadtest.shared_file);
+        }
+    pthread_mutex_unlock(&loadtest.mutex);
+
+    free(samples);
+    free(all);
+}
+
+/** loadtest_check
+ *  Called each second from main.  Returns 1 once when the test time is
+ *  over and the results have been written so Motion can end.
+ */
+int loadtest_check(struct context **cnt_list)
+{
+    double elapsed;
+
+    if ((loadtest.cameras <= 0) || loadtest.reported) {
+        return 0;
+    }
+
+    elapsed = (loadtest_now() - loadtest.start_nsec) / 1000000000.0;
+    if (elapsed < loadtest.seconds) {
+        return 0;
+    }
+
+    loadtest_report(cnt_list, elapsed);
+    pthread_mutex_lock(&loadtest.mutex);
+        loadtest.reported = TRUE;
+    pthread_mutex_unlock(&loadtest.mutex);
+
+    return 1;
+}
+
+/** loadtest_failed
+ *  Whether the load test found files written by more than one camera.
+ */
+int loadtest_failed(void)
+{
+    return (loadtest.shared > 0);
+}
@@ -0,0 +1,48 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  loadtest.h
+ *    Headers associated with functions in the loadtest.c module.
+ */
+
+#ifndef _INCLUDE_LOADTEST_H
+#define _INCLUDE_LOADTEST_H
+
+#define LOADTEST_SAMPLES    4096    /* Latencies kept per camera for the percentiles */
+#define LOADTEST_FILES      16      /* Files kept per camera to find the ones of two cameras */
+
+struct loadtest_camera {
+    pthread_mutex_t     mutex;
+    unsigned long       frames;
+    long long           first_nsec;     /* Monotonic time of the first frame */
+    long long           last_nsec;      /* Monotonic time of the latest frame */
+    long long           cpu_nsec;       /* CPU time of the motion loop steps */
+    long                latency_usec[LOADTEST_SAMPLES];
+    int                 latency_count;  /* Samples taken, the latest are kept */
+    char                files[LOADTEST_FILES][PATH_MAX];    /* Latest files written */
+    int                 file_count;
+};
+
+void loadtest_start(struct context **cnt_list);
+void loadtest_stop(struct context **cnt_list);
+int loadtest_check(struct context **cnt_list);
+int loadtest_failed(void);
+void loadtest_file(struct context *cnt, const char *filename);
+void loadtest_step_start(struct context *cnt, struct timespec *cpu);
+void loadtest_step_end(struct context *cnt, struct timespec *cpu, int captured);
+
+#endif /* _INCLUDE_LOADTEST_H */
@@ -22,8 +22,19 @@
  *      Copyright 2005, William M. Brack
  *      Copyright 2008 by Angel Carpintero  (motiondevelop@gmail.com)
  *
+ *      Once log_start is called the messages are formatted on the calling
+ *      thread into a ring of that thread and written out by a single log
+ *      thread.  Only the calling thread adds to its ring and only the log
+ *      thread removes from it so neither takes a lock.  A full ring drops
+ *      the message and counts it rather than waiting on the log file or
+ *      syslog.  Before log_start and after log_stop the messages are
+ *      written on the calling thread.  The EMG and ALR messages, which are
+ *      mostly followed by an exit, are always written on the calling thread
+ *      after it wrote out the rings in place of the log thread.
+ *
  */
 
+#include "translate.h"
 #include "logger.h"   /* already includes motion.h */
 #include "util.h"
 #include <stdarg.h>
@@ -33,6 +44,47 @@ static FILE *logfile;
 static unsigned int log_level = LEVEL_DEFAULT;
 static unsigned int log_type = TYPE_DEFAULT;
 
+/* Messages held for each thread.  Further messages are dropped */
+#define LOG_RING_SIZE 32
+/* Seconds the log thread waits before checking for dropped messages */
+#define LOG_WAIT_SEC 1
+
+struct log_msg {
+    int                 level;
+    unsigned int        type;
+    int                 threadnr;
+    char                threadname[32];
+    char                buf[1024];
+};
+
+struct log_ring {
+    struct log_msg      msgs[LOG_RING_SIZE];
+    unsigned long       head;           /* Written by the owning thread */
+    unsigned long       tail;           /* Written by the log thread */
+    int                 released;       /* The owning thread has exited */
+    struct log_ring    *next;
+};
+
+static struct {
+    int                 initialized;
+    int                 running;        /* Messages go to the log thread */
+    int                 finish;
+    int                 wake;           /* The log thread has been signaled */
+    unsigned long       dropped;
+    unsigned long       dropped_reported;
+    struct log_ring    *rings;
+    pthread_key_t       key;
+    pthread_mutex_t     mutex;          /* Protects the list of rings */
+    pthread_mutex_t     mutex_drain;    /* Held while writing out the rings */
+    pthread_mutex_t     mutex_wake;
+    pthread_cond_t      cond_wake;
+    pthread_t           thread_id;
+} log_async;
+
+/* Flood suppression.  Only the log thread uses it once log_start is called */
+static int flood_cnt = 0;
+static char flood_msg[1024];
+
 static const char *log_type_str[] = {NULL, "COR", "STR", "ENC", "NET", "DBL", "EVT", "TRK", "VID", "ALL"};
 static const char *log_level_str[] = {"EMG", "ALR", "CRT", "ERR", "WRN", "NTC", "INF", "DBG", "ALL", NULL};
 
@@ -164,6 +216,236 @@ static char *str_time(void)
     return buffer;
 }
 
+/** log_output
+ *  Write a formatted message to the log file or syslog with the
+ *  suppression of repeated messages.
+ */
+static void log_output(struct log_msg *msg, int flush)
+{
+    char flood_repeats[1024];
+
+    if ((mystreq(msg->buf,flood_msg)) && (flood_cnt <= 5000)) {
+        flood_cnt++;
+        return;
+    }
+
+    if (flood_cnt > 1) {
+        snprintf(flood_repeats,1024,"[%d:%s] [%s] [%s] Above message repeats %d times",
+                 msg->threadnr, msg->threadname, get_log_level_str(msg->level)
+                 , get_log_type_str(msg->type), flood_cnt-1);
+        switch (log_mode) {
+        case LOGMODE_FILE:
+            strncat(flood_repeats, "\n", 1024 - strlen(flood_repeats));
+            fputs(flood_repeats, logfile);
+            break;
+
+        case LOGMODE_SYSLOG:
+            syslog(msg->level, "%s", flood_repeats);
+            strncat(flood_repeats, "\n", 1024 - strlen(flood_repeats));
+            fputs(flood_repeats, stderr);
+            break;
+        }
+    }
+    flood_cnt = 1;
+    snprintf(flood_msg,1024,"%s",msg->buf);
+    switch (log_mode) {
+    case LOGMODE_FILE:
+        strncat(msg->buf, "\n", 1024 - strlen(msg->buf));
+        fputs(msg->buf, logfile);
+        if (flush) {
+            fflush(logfile);
+        }
+        break;
+
+    case LOGMODE_SYSLOG:
+        syslog(msg->level, "%s", msg->buf);
+        strncat(msg->buf, "\n", 1024 - strlen(msg->buf));
+        fputs(msg->buf, stderr);
+        if (flush) {
+            fflush(stderr);
+        }
+        break;
+    }
+}
+
+/* Called when a thread exits to hand its ring to the log thread to free */
+static void log_ring_release(void *arg)
+{
+    struct log_ring *ring = arg;
+
+    __atomic_store_n(&ring->released, TRUE, __ATOMIC_RELEASE);
+}
+
+static struct log_ring *log_ring_get(void)
+{
+    struct log_ring *ring;
+
+    ring = pthread_getspecific(log_async.key);
+    if (ring != NULL) {
+        return ring;
+    }
+
+    ring = mymalloc(sizeof(struct log_ring));
+    memset(ring, 0, sizeof(struct log_ring));
+
+    pthread_mutex_lock(&log_async.mutex);
+        ring->next = log_async.rings;
+        log_async.rings = ring;
+    pthread_mutex_unlock(&log_async.mutex);
+
+    pthread_setspecific(log_async.key, ring);
+
+    return ring;
+}
+
+/* Write out the messages waiting in the rings and free the released rings */
+static void log_drain(void)
+{
+    struct log_ring *ring, **prev;
+    struct log_msg msg;
+    unsigned long head, tail, dropped;
+    int released;
+
+    pthread_mutex_lock(&log_async.mutex);
+        ring = log_async.rings;
+    pthread_mutex_unlock(&log_async.mutex);
+
+    /* Rings are only added at the front and only freed here */
+    while (ring != NULL) {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (tail = ring->tail; tail != head; tail++) {
+            log_output(&ring->msgs[tail % LOG_RING_SIZE], FALSE);
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        ring = ring->next;
+    }
+
+    dropped = __atomic_load_n(&log_async.dropped, __ATOMIC_RELAXED);
+    if (dropped != log_async.dropped_reported) {
+        memset(&msg, 0, sizeof(msg));
+        msg.level = WRN;
+        msg.type = TYPE_ALL;
+        snprintf(msg.threadname, sizeof(msg.threadname), "%s", "log");
+        snprintf(msg.buf, sizeof(msg.buf), "[0:log] [%s] [%s] %lu log messages dropped"
+            , get_log_level_str(WRN), get_log_type_str(TYPE_ALL)
+            , dropped - log_async.dropped_reported);
+        log_output(&msg, FALSE);
+        log_async.dropped_reported = dropped;
+    }
+
+    if (log_mode == LOGMODE_FILE) {
+        fflush(logfile);
+    } else if (log_mode == LOGMODE_SYSLOG) {
+        fflush(stderr);
+    }
+
+    /* The owner of a released ring has exited so no more is added to it */
+    pthread_mutex_lock(&log_async.mutex);
+        prev = &log_async.rings;
+        while (*prev != NULL) {
+            ring = *prev;
+            released = __atomic_load_n(&ring->released, __ATOMIC_ACQUIRE);
+            if (released && (ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))) {
+                *prev = ring->next;
+                free(ring);
+            } else {
+                prev = &ring->next;
+            }
+        }
+    pthread_mutex_unlock(&log_async.mutex);
+}
+
+static void *log_handler(void *arg)
+{
+    struct timespec ts;
+    struct timeval tv;
+
+    (void)arg;
+
+    util_threadname_set("lg", 0, NULL);
+
+    while (!log_async.finish) {
+        __atomic_store_n(&log_async.wake, FALSE, __ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&log_async.mutex_drain);
+            log_drain();
+        pthread_mutex_unlock(&log_async.mutex_drain);
+
+        pthread_mutex_lock(&log_async.mutex_wake);
+            if (!__atomic_load_n(&log_async.wake, __ATOMIC_SEQ_CST) && !log_async.finish) {
+                gettimeofday(&tv, NULL);
+                ts.tv_sec = tv.tv_sec + LOG_WAIT_SEC;
+                ts.tv_nsec = tv.tv_usec * 1000;
+                pthread_cond_timedwait(&log_async.cond_wake, &log_async.mutex_wake, &ts);
+            }
+        pthread_mutex_unlock(&log_async.mutex_wake);
+    }
+
+    pthread_mutex_lock(&log_async.mutex_drain);
+        log_drain();
+    pthread_mutex_unlock(&log_async.mutex_drain);
+
+    pthread_exit(NULL);
+}
+
+/** log_start
+ *  Start the log thread.  Called once the process has become a daemon
+ *  since the thread does not survive the fork.
+ */
+void log_start(void)
+{
+    if (log_async.running) {
+        return;
+    }
+
+    /* The rings of the threads that still run are kept over a restart */
+    if (!log_async.initialized) {
+        pthread_key_create(&log_async.key, log_ring_release);
+        pthread_mutex_init(&log_async.mutex, NULL);
+        pthread_mutex_init(&log_async.mutex_drain, NULL);
+        pthread_mutex_init(&log_async.mutex_wake, NULL);
+        pthread_cond_init(&log_async.cond_wake, NULL);
+        log_async.initialized = TRUE;
+    }
+
+    log_async.finish = FALSE;
+    log_async.wake = FALSE;
+
+    if (pthread_create(&log_async.thread_id, NULL, &log_handler, NULL) != 0) {
+        MOTION_LOG(ERR, TYPE_ALL, SHOW_ERRNO
+            ,_("Unable to start log thread, logging from each thread"));
+        return;
+    }
+
+    __atomic_store_n(&log_async.running, TRUE, __ATOMIC_RELEASE);
+}
+
+/** log_stop
+ *  Write out the waiting messages and stop the log thread.  Messages are
+ *  then written on the calling thread again.
+ */
+void log_stop(void)
+{
+    if (!log_async.running) {
+        return;
+    }
+
+    __atomic_store_n(&log_async.running, FALSE, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&log_async.mutex_wake);
+        log_async.finish = TRUE;
+        pthread_cond_signal(&log_async.cond_wake);
+    pthread_mutex_unlock(&log_async.mutex_wake);
+    pthread_join(log_async.thread_id, NULL);
+}
+
+/** log_dropped
+ *  Count of the messages dropped for a full ring.
+ */
+unsigned long log_dropped(void)
+{
+    return __atomic_load_n(&log_async.dropped, __ATOMIC_RELAXED);
+}
+
 /**
  * MOTION_LOG
  *
@@ -190,7 +472,7 @@ static char *str_time(void)
 void motion_log(int level, unsigned int type, int errno_flag,int fncname, const char *fmt, ...)
 {
     int errno_save, n;
-    char buf[1024];
+    char *buf;
     char usrfmt[1024];
 
     /* GNU-specific strerror_r() */
@@ -198,11 +480,10 @@ void motion_log(int level, unsigned int type, int errno_flag,int fncname, const
         char msg_buf[100];
     #endif
     va_list ap;
-    int threadnr;
-
-    static int flood_cnt = 0;
-    static char flood_msg[1024];
-    char flood_repeats[1024];
+    struct log_ring *ring;
+    struct log_msg *msg, msg_sync;
+    unsigned long head;
+    int drain;
 
 
     /* Exit if level is greater than log_level */
@@ -217,16 +498,37 @@ void motion_log(int level, unsigned int type, int errno_flag,int fncname, const
 
     //printf("log_type %d, type %d level %d\n", log_type, type, level);
 
-    threadnr = (unsigned long)pthread_getspecific(tls_key_threadnr);
-
     /*
      * First we save the current 'error' value.  This is required because
      * the subsequent calls to vsnprintf could conceivably change it!
      */
     errno_save = errno;
 
-    char threadname[32];
-    util_threadname_get(threadname);
+    /* Format straight into the ring slot of this thread when it is free */
+    ring = NULL;
+    head = 0;
+    drain = __atomic_load_n(&log_async.running, __ATOMIC_ACQUIRE);
+    if (drain && (level <= ALR)) {
+        /* The process may exit before the log thread gets to it */
+        msg = &msg_sync;
+    } else if (drain) {
+        drain = FALSE;
+        ring = log_ring_get();
+        head = ring->head;
+        if ((head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) >= LOG_RING_SIZE) {
+            __atomic_fetch_add(&log_async.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        msg = &ring->msgs[head % LOG_RING_SIZE];
+    } else {
+        msg = &msg_sync;
+    }
+
+    msg->level = level;
+    msg->type = type;
+    msg->threadnr = (unsigned long)pthread_getspecific(tls_key_threadnr);
+    util_threadname_get(msg->threadname);
+    buf = msg->buf;
 
     /*
      * Prefix the message with the thread number and name,
@@ -234,8 +536,8 @@ void motion_log(int level, unsigned int type, int errno_flag,int fncname, const
      * e.g. [1:enc] [ERR] [ALL] [Apr 03 00:08:44] blah
      */
     if (log_mode == LOGMODE_FILE) {
-        n = snprintf(buf, sizeof(buf), "[%d:%s] [%s] [%s] [%s] ",
-                     threadnr, threadname, get_log_level_str(level), get_log_type_str(type),
+        n = snprintf(buf, sizeof(msg->buf), "[%d:%s] [%s] [%s] [%s] ",
+                     msg->threadnr, msg->threadname, get_log_level_str(level), get_log_type_str(type),
                      str_time());
     } else {
     /*
@@ -243,8 +545,8 @@ void motion_log(int level, unsigned int type, int errno_flag,int fncname, const
      * log level string and log type string.
      * e.g. [1:trk] [DBG] [ALL] blah
      */
-        n = snprintf(buf, sizeof(buf), "[%d:%s] [%s] [%s] ",
-                     threadnr, threadname, get_log_level_str(level), get_log_type_str(type));
+        n = snprintf(buf, sizeof(msg->buf), "[%d:%s] [%s] [%s] ",
+                     msg->threadnr, msg->threadname, get_log_level_str(level), get_log_type_str(type));
     }
 
     /* Prepend the format specifier for the function name */
@@ -256,7 +558,7 @@ void motion_log(int level, unsigned int type, int errno_flag,int fncname, const
 
     /* Next add the user's message. */
     va_start(ap, fmt);
-    n += vsnprintf(buf + n, sizeof(buf) - n, usrfmt, ap);
+    n += vsnprintf(buf + n, sizeof(msg->buf) - n, usrfmt, ap);
     va_end(ap);
     buf[1023] = '\0';
 
@@ -279,52 +581,33 @@ void motion_log(int level, unsigned int type, int errno_flag,int fncname, const
          */
         #if defined(XSI_STRERROR_R)
             /* XSI-compliant strerror_r() */
-            strerror_r(errno_save, buf + n, sizeof(buf) - n);    /* 2 for the ': ' */
+            strerror_r(errno_save, buf + n, sizeof(msg->buf) - n);    /* 2 for the ': ' */
         #else
             /* GNU-specific strerror_r() */
             strncat(buf, strerror_r(errno_save, msg_buf, sizeof(msg_buf)), 1024 - strlen(buf));
         #endif
     }
 
-    if ((mystreq(buf,flood_msg)) && (flood_cnt <= 5000)) {
-        flood_cnt++;
-    } else {
-        if (flood_cnt > 1) {
-            snprintf(flood_repeats,1024,"[%d:%s] [%s] [%s] Above message repeats %d times",
-                     threadnr, threadname, get_log_level_str(level)
-                     , get_log_type_str(type), flood_cnt-1);
-            switch (log_mode) {
-            case LOGMODE_FILE:
-                strncat(flood_repeats, "\n", 1024 - strlen(flood_repeats));
-                fputs(flood_repeats, logfile);
-                fflush(logfile);
-                break;
-
-            case LOGMODE_SYSLOG:
-                syslog(level, "%s", flood_repeats);
-                strncat(flood_repeats, "\n", 1024 - strlen(flood_repeats));
-                fputs(flood_repeats, stderr);
-                fflush(stderr);
-                break;
-            }
-        }
-        flood_cnt = 1;
-        snprintf(flood_msg,1024,"%s",buf);
-        switch (log_mode) {
-        case LOGMODE_FILE:
-            strncat(buf, "\n", 1024 - strlen(buf));
-            fputs(buf, logfile);
-            fflush(logfile);
-            break;
+    if (drain) {
+        /* The messages of the rings came first */
+        pthread_mutex_lock(&log_async.mutex_drain);
+            log_drain();
+            log_output(msg, TRUE);
+        pthread_mutex_unlock(&log_async.mutex_drain);
+        return;
+    }
 
-        case LOGMODE_SYSLOG:
-            syslog(level, "%s", buf);
-            strncat(buf, "\n", 1024 - strlen(buf));
-            fputs(buf, stderr);
-            fflush(stderr);
-            break;
-        }
+    if (ring == NULL) {
+        log_output(msg, TRUE);
+        return;
     }
 
-}
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
 
+    /* Only the first message since the log thread last looked signals it */
+    if (!__atomic_exchange_n(&log_async.wake, TRUE, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&log_async.mutex_wake);
+            pthread_cond_signal(&log_async.cond_wake);
+        pthread_mutex_unlock(&log_async.mutex_wake);
+    }
+}
@@ -71,6 +71,9 @@ const char* get_log_level_str(unsigned int level);
 void set_log_level(unsigned int level);
 void set_log_mode(int mode);
 FILE * set_logfile(const char *logfile_name);
+void log_start(void);
+void log_stop(void);
+unsigned long log_dropped(void);
 void motion_log(int level, unsigned int type, int errno_flag,int fncname, const char *fmt, ...);
 
 #endif
@@ -0,0 +1,175 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *    metrics.c
+ *
+ *    Timings of the stages of the motion loop for the metrics page.
+ *
+ *    The stages are timed with a monotonic clock on the motion loop and the
+ *    times of a frame are only added to the histograms once per frame so the
+ *    lock shared with the webcontrol is taken once.  A stage that runs
+ *    inside another, such as the movie encode inside the actions, is only
+ *    counted in the inner stage so the stages add up to the frame time.
+ *
+ */
+
+#include "translate.h"
+#include "motion.h"
+#include "util.h"
+#include "logger.h"
+#include "capture.h"
+#include "netcam.h"
+#include "netcam_rtsp.h"
+#include "metrics.h"
+
+/* Upper bounds in usec of the histogram buckets */
+const long metrics_bucket_usec[METRICS_BUCKETS] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000
+};
+
+static const char *metrics_stage_names[METRICS_STAGES] = {
+    "capture", "diff", "despeckle", "labeling", "overlay", "actions", "encode", "stream"
+};
+
+const char *metrics_stage_name(enum METRICS_STAGE stage)
+{
+    return metrics_stage_names[stage];
+}
+
+static void metrics_frame_reset(struct loop_metrics *metrics)
+{
+    int indx;
+
+    for (indx = 0; indx < METRICS_STAGES; indx++) {
+        metrics->frame_usec[indx] = -1;
+    }
+    metrics->frame_accounted = 0;
+}
+
+void metrics_init(struct context *cnt)
+{
+    pthread_mutex_init(&cnt->metrics.mutex, NULL);
+    memset(&cnt->metrics.hist, 0, sizeof(struct metrics_hist));
+    cnt->metrics.frames_missed = 0;
+    metrics_frame_reset(&cnt->metrics);
+}
+
+void metrics_deinit(struct context *cnt)
+{
+    pthread_mutex_destroy(&cnt->metrics.mutex);
+}
+
+/** metrics_start
+ *  Start timing a stage.  Stages may be nested.
+ */
+void metrics_start(struct context *cnt, struct metrics_timer *timer)
+{
+    clock_gettime(CLOCK_MONOTONIC, &timer->ts);
+    timer->nested = cnt->metrics.frame_accounted;
+}
+
+/** metrics_stop
+ *  Add the time since metrics_start to the stage less the time of the
+ *  stages that ran inside it.
+ */
+void metrics_stop(struct context *cnt, enum METRICS_STAGE stage, struct metrics_timer *timer)
+{
+    struct timespec ts;
+    long elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    elapsed = ((ts.tv_sec - timer->ts.tv_sec) * 1000000L) +
+        ((ts.tv_nsec - timer->ts.tv_nsec) / 1000);
+    elapsed -= (cnt->metrics.frame_accounted - timer->nested);
+    if (elapsed < 0) {
+        elapsed = 0;
+    }
+
+    if (cnt->metrics.frame_usec[stage] < 0) {
+        cnt->metrics.frame_usec[stage] = elapsed;
+    } else {
+        cnt->metrics.frame_usec[stage] += elapsed;
+    }
+    cnt->metrics.frame_accounted += elapsed;
+}
+
+/** metrics_frame
+ *  Called once per frame on the motion loop.  Adds the stage times of the
+ *  frame to the histograms and updates the counters.
+ */
+void metrics_frame(struct context *cnt)
+{
+    struct loop_metrics *metrics = &cnt->metrics;
+    struct metrics_hist *hist = &metrics->hist;
+    unsigned long decode_errors;
+    int indx, bucket;
+
+    decode_errors = 0;
+    #ifdef HAVE_FFMPEG
+        if (cnt->rtsp != NULL) {
+            decode_errors += cnt->rtsp->decode_errors;
+        }
+        if (cnt->rtsp_high != NULL) {
+            decode_errors += cnt->rtsp_high->decode_errors;
+        }
+    #endif
+
+    pthread_mutex_lock(&metrics->mutex);
+        for (indx = 0; indx < METRICS_STAGES; indx++) {
+            if (metrics->frame_usec[indx] < 0) {
+                continue;
+            }
+            for (bucket = 0; bucket < METRICS_BUCKETS; bucket++) {
+                if (metrics->frame_usec[indx] <= metrics_bucket_usec[bucket]) {
+                    hist->bucket[indx][bucket]++;
+                    break;
+                }
+            }
+            hist->count[indx]++;
+            hist->sum_usec[indx] += metrics->frame_usec[indx];
+        }
+        hist->frames++;
+        hist->frames_missed = metrics->frames_missed;
+        hist->decode_errors = decode_errors;
+        hist->stream_dropped = cnt->stream_enc.dropped;
+        if (cnt->capq != NULL) {
+            hist->capture_stalls = cnt->capq->stalls;
+            hist->capture_depth = cnt->capq->count;
+        } else {
+            hist->capture_depth = 0;
+        }
+        hist->ring_size = cnt->imgs.image_ring_size;
+        if (cnt->imgs.image_ring_size > 0) {
+            hist->ring_used = (cnt->imgs.image_ring_in - cnt->imgs.image_ring_out
+                + cnt->imgs.image_ring_size) % cnt->imgs.image_ring_size;
+        } else {
+            hist->ring_used = 0;
+        }
+    pthread_mutex_unlock(&metrics->mutex);
+
+    metrics_frame_reset(metrics);
+}
+
+/** metrics_snapshot
+ *  Copy of the published metrics for the webcontrol
+ */
+void metrics_snapshot(struct context *cnt, struct metrics_hist *hist)
+{
+    pthread_mutex_lock(&cnt->metrics.mutex);
+        memcpy(hist, &cnt->metrics.hist, sizeof(struct metrics_hist));
+    pthread_mutex_unlock(&cnt->metrics.mutex);
+}
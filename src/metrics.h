@@ -0,0 +1,35 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  metrics.h
+ *    Headers associated with functions in the metrics.c module.
+ */
+
+#ifndef _INCLUDE_METRICS_H
+#define _INCLUDE_METRICS_H
+
+extern const long metrics_bucket_usec[METRICS_BUCKETS];
+
+void metrics_init(struct context *cnt);
+void metrics_deinit(struct context *cnt);
+void metrics_start(struct context *cnt, struct metrics_timer *timer);
+void metrics_stop(struct context *cnt, enum METRICS_STAGE stage, struct metrics_timer *timer);
+void metrics_frame(struct context *cnt);
+void metrics_snapshot(struct context *cnt, struct metrics_hist *hist);
+const char *metrics_stage_name(enum METRICS_STAGE stage);
+
+#endif /* _INCLUDE_METRICS_H */
@@ -31,6 +31,7 @@
 #include "logger.h"
 #include "netcam.h"
 #include "rotate.h"
+#include "video_common.h"
 
 #ifdef HAVE_MMAL
 
@@ -98,21 +99,27 @@ static void camera_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buff
     mmal_queue_put(mmalcam->camera_buffer_queue, buffer);
 }
 
-static void set_port_format(mmalcam_context_ptr mmalcam, MMAL_ES_FORMAT_T *format)
+static void camera_detect_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+    mmalcam_context_ptr mmalcam = (mmalcam_context_ptr) port->userdata;
+    mmal_queue_put(mmalcam->camera_detect_queue, buffer);
+}
+
+static void set_port_format(MMAL_ES_FORMAT_T *format, int width, int height)
 {
     format->encoding = MMAL_ENCODING_OPAQUE;
     format->encoding_variant = MMAL_ENCODING_I420;
-    format->es->video.width = mmalcam->width;
-    format->es->video.height = mmalcam->height;
+    format->es->video.width = width;
+    format->es->video.height = height;
     format->es->video.crop.x = 0;
     format->es->video.crop.y = 0;
-    format->es->video.crop.width = mmalcam->width;
-    format->es->video.crop.height = mmalcam->height;
+    format->es->video.crop.width = width;
+    format->es->video.crop.height = height;
 }
 
 static void set_video_port_format(mmalcam_context_ptr mmalcam, MMAL_ES_FORMAT_T *format)
 {
-    set_port_format(mmalcam, format);
+    set_port_format(format, mmalcam->width, mmalcam->height);
     format->es->video.frame_rate.num = mmalcam->framerate;
     format->es->video.frame_rate.den = VIDEO_FRAME_RATE_DEN;
     if (mmalcam->framerate > 30) {
@@ -122,6 +129,44 @@ static void set_video_port_format(mmalcam_context_ptr mmalcam, MMAL_ES_FORMAT_T
     }
 }
 
+/**
+ * setup_detect_port
+ *
+ *      Set up the preview port to give the reduced image of detect_scale.  The
+ *      ISP scales it from the same frames as the video port, so the detection
+ *      image needs no scaling on the CPU.
+ */
+static int setup_detect_port(mmalcam_context_ptr mmalcam, MMAL_PORT_T *port)
+{
+    set_port_format(port->format, mmalcam->detect_width, mmalcam->detect_height);
+    port->format->encoding = MMAL_ENCODING_I420;
+    port->format->es->video.frame_rate.num = mmalcam->framerate;
+    port->format->es->video.frame_rate.den = VIDEO_FRAME_RATE_DEN;
+    port->buffer_size = VCOS_ALIGN_UP(mmalcam->detect_width, 32) *
+        VCOS_ALIGN_UP(mmalcam->detect_height, 16) * 3 / 2;
+
+    if (mmal_port_parameter_set_boolean(port, MMAL_PARAMETER_NO_IMAGE_PADDING, 1)
+            != MMAL_SUCCESS) {
+        MOTION_LOG(WRN, TYPE_VIDEO, NO_ERRNO, _("MMAL no-padding setup of the preview port failed"));
+    }
+
+    if (mmal_port_format_commit(port) != MMAL_SUCCESS) {
+        MOTION_LOG(WRN, TYPE_VIDEO, NO_ERRNO
+            ,_("MMAL preview port can not give the %dx%d detection image, scaling it on the CPU")
+            ,mmalcam->detect_width, mmalcam->detect_height);
+        return MMALCAM_ERROR;
+    }
+
+    if (port->buffer_num < VIDEO_OUTPUT_BUFFERS_NUM) {
+        port->buffer_num = VIDEO_OUTPUT_BUFFERS_NUM;
+    }
+
+    mmalcam->camera_detect_port = port;
+    mmalcam->camera_detect_port->userdata = (struct MMAL_PORT_USERDATA_T*) mmalcam;
+
+    return MMALCAM_OK;
+}
+
 static int create_camera_component(mmalcam_context_ptr mmalcam, const char *mmalcam_name)
 {
     MMAL_STATUS_T status;
@@ -192,6 +237,12 @@ static int create_camera_component(mmalcam_context_ptr mmalcam, const char *mmal
         video_port->buffer_num = VIDEO_OUTPUT_BUFFERS_NUM;
     }
 
+    if ((mmalcam->detect_width > 0) &&
+        (setup_detect_port(mmalcam, camera_component->output[MMAL_CAMERA_PREVIEW_PORT]) != MMALCAM_OK)) {
+        mmalcam->detect_width = 0;
+        mmalcam->detect_height = 0;
+    }
+
     status = mmal_component_enable(camera_component);
 
     if (status) {
@@ -237,6 +288,23 @@ static int create_camera_buffer_structures(mmalcam_context_ptr mmalcam)
         return MMALCAM_ERROR;
     }
 
+    if (mmalcam->camera_detect_port == NULL) {
+        return MMALCAM_OK;
+    }
+
+    mmalcam->camera_detect_pool = mmal_pool_create(mmalcam->camera_detect_port->buffer_num,
+            mmalcam->camera_detect_port->buffer_size);
+    if (mmalcam->camera_detect_pool == NULL ) {
+        MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO, _("MMAL detection buffer pool creation failed"));
+        return MMALCAM_ERROR;
+    }
+
+    mmalcam->camera_detect_queue = mmal_queue_create();
+    if (mmalcam->camera_detect_queue == NULL ) {
+        MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO, _("MMAL detection buffer queue creation failed"));
+        return MMALCAM_ERROR;
+    }
+
     return MMALCAM_OK;
 }
 
@@ -265,6 +333,16 @@ static int send_pooled_buffers_to_port(MMAL_POOL_T *pool, MMAL_PORT_T *port)
 
 static void destroy_camera_buffer_structures(mmalcam_context_ptr mmalcam)
 {
+    if (mmalcam->camera_detect_queue != NULL ) {
+        mmal_queue_destroy(mmalcam->camera_detect_queue);
+        mmalcam->camera_detect_queue = NULL;
+    }
+
+    if (mmalcam->camera_detect_pool != NULL ) {
+        mmal_pool_destroy(mmalcam->camera_detect_pool);
+        mmalcam->camera_detect_pool = NULL;
+    }
+
     if (mmalcam->camera_buffer_queue != NULL ) {
         mmal_queue_destroy(mmalcam->camera_buffer_queue);
         mmalcam->camera_buffer_queue = NULL;
@@ -324,6 +402,13 @@ int mmalcam_start(struct context *cnt)
     cnt->imgs.size_norm = (mmalcam->width * mmalcam->height * 3) / 2;
     cnt->imgs.motionsize = mmalcam->width * mmalcam->height;
 
+    /* The reduced image of detect_scale is asked from the preview port */
+    vid_detect_scale(cnt);
+    if (cnt->imgs.detect_scale > 1) {
+        mmalcam->detect_width = cnt->imgs.width;
+        mmalcam->detect_height = cnt->imgs.height;
+    }
+
     int retval = create_camera_component(mmalcam, cnt->conf.mmalcam_name);
 
     if (retval == 0) {
@@ -345,10 +430,25 @@ int mmalcam_start(struct context *cnt)
         }
     }
 
+    if ((retval == 0) && (mmalcam->camera_detect_port != NULL)) {
+        if (mmal_port_enable(mmalcam->camera_detect_port, camera_detect_callback)) {
+            MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO, _("MMAL camera preview port enabling failed"));
+            retval = MMALCAM_ERROR;
+        }
+    }
+
     if (retval == 0) {
         retval = send_pooled_buffers_to_port(mmalcam->camera_buffer_pool, mmalcam->camera_capture_port);
     }
 
+    if ((retval == 0) && (mmalcam->camera_detect_port != NULL)) {
+        retval = send_pooled_buffers_to_port(mmalcam->camera_detect_pool, mmalcam->camera_detect_port);
+        cnt->imgs.detect_camera = TRUE;
+        MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+            ,_("MMAL camera gives the %dx%d detection image from the preview port")
+            ,mmalcam->detect_width, mmalcam->detect_height);
+    }
+
     return retval;
 }
 
@@ -374,6 +474,7 @@ void mmalcam_cleanup(struct mmalcam_context *mmalcam)
 
     if (mmalcam != NULL ) {
         if (mmalcam->camera_component) {
+            check_disable_port(mmalcam->camera_detect_port);
             check_disable_port(mmalcam->camera_capture_port);
             mmal_component_disable(mmalcam->camera_component);
             destroy_camera_buffer_structures(mmalcam);
@@ -388,6 +489,38 @@ void mmalcam_cleanup(struct mmalcam_context *mmalcam)
     }
 }
 
+static void copy_buffer(MMAL_BUFFER_HEADER_T *buffer, unsigned char *image, int size)
+{
+    if (buffer->cmd == 0 && (buffer->flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END)
+            && (int)buffer->length >= size) {
+        mmal_buffer_header_mem_lock(buffer);
+        memcpy(image, buffer->data, size);
+        mmal_buffer_header_mem_unlock(buffer);
+    } else {
+        MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO
+            ,_("cmd %d flags %08x size %d/%d at %08x, img_size=%d")
+            ,buffer->cmd, buffer->flags, buffer->length
+            ,buffer->alloc_size, buffer->data, size);
+    }
+}
+
+static void return_buffer_to_port(MMAL_POOL_T *pool, MMAL_PORT_T *port)
+{
+    if (port->is_enabled) {
+        MMAL_STATUS_T status;
+        MMAL_BUFFER_HEADER_T *new_buffer = mmal_queue_get(pool->queue);
+
+        if (new_buffer) {
+            status = mmal_port_send_buffer(port, new_buffer);
+        }
+
+        if (!new_buffer || status != MMAL_SUCCESS) {
+            MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO
+                ,_("Unable to return a buffer to the camera video port"));
+        }
+    }
+}
+
 /**
  * mmalcam_next
  *
@@ -404,6 +537,7 @@ void mmalcam_cleanup(struct mmalcam_context *mmalcam)
 int mmalcam_next(struct context *cnt,  struct image_data *img_data)
 {
     mmalcam_context_ptr mmalcam;
+    MMAL_BUFFER_HEADER_T *detect_buffer, *newer_buffer;
 
     if ((!cnt) || (!cnt->mmalcam)) {
         return NETCAM_FATAL_ERROR;
@@ -413,32 +547,21 @@ int mmalcam_next(struct context *cnt,  struct image_data *img_data)
 
     MMAL_BUFFER_HEADER_T *camera_buffer = mmal_queue_wait(mmalcam->camera_buffer_queue);
 
-    if (camera_buffer->cmd == 0 && (camera_buffer->flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END)
-            && (int)camera_buffer->length >= cnt->imgs.size_norm) {
-        mmal_buffer_header_mem_lock(camera_buffer);
-        memcpy(img_data->image_norm, camera_buffer->data, cnt->imgs.size_norm);
-        mmal_buffer_header_mem_unlock(camera_buffer);
-    } else {
-        MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO
-            ,_("cmd %d flags %08x size %d/%d at %08x, img_size=%d")
-            ,camera_buffer->cmd, camera_buffer->flags, camera_buffer->length
-            ,camera_buffer->alloc_size, camera_buffer->data, cnt->imgs.size_norm);
-    }
-
+    copy_buffer(camera_buffer, vid_capture_image(cnt, img_data), vid_capture_size(cnt));
     mmal_buffer_header_release(camera_buffer);
-
-    if (mmalcam->camera_capture_port->is_enabled) {
-        MMAL_STATUS_T status;
-        MMAL_BUFFER_HEADER_T *new_buffer = mmal_queue_get(mmalcam->camera_buffer_pool->queue);
-
-        if (new_buffer) {
-            status = mmal_port_send_buffer(mmalcam->camera_capture_port, new_buffer);
-        }
-
-        if (!new_buffer || status != MMAL_SUCCESS) {
-            MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO
-                ,_("Unable to return a buffer to the camera video port"));
+    return_buffer_to_port(mmalcam->camera_buffer_pool, mmalcam->camera_capture_port);
+
+    if (cnt->imgs.detect_camera) {
+        /* The newest reduced frame matches the frame just taken from the video port */
+        detect_buffer = mmal_queue_wait(mmalcam->camera_detect_queue);
+        while ((newer_buffer = mmal_queue_get(mmalcam->camera_detect_queue)) != NULL) {
+            mmal_buffer_header_release(detect_buffer);
+            return_buffer_to_port(mmalcam->camera_detect_pool, mmalcam->camera_detect_port);
+            detect_buffer = newer_buffer;
         }
+        copy_buffer(detect_buffer, img_data->image_norm, cnt->imgs.size_norm);
+        mmal_buffer_header_release(detect_buffer);
+        return_buffer_to_port(mmalcam->camera_detect_pool, mmalcam->camera_detect_port);
     }
 
     rotate_map(cnt,img_data);
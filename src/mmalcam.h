@@ -36,6 +36,13 @@ typedef struct mmalcam_context {
     struct MMAL_PORT_T *camera_capture_port;
     struct MMAL_POOL_T *camera_buffer_pool;
     struct MMAL_QUEUE_T *camera_buffer_queue;
+
+    /* Reduced image of detect_scale from the preview port, scaled by the ISP */
+    int detect_width;
+    int detect_height;
+    struct MMAL_PORT_T *camera_detect_port;
+    struct MMAL_POOL_T *camera_detect_pool;
+    struct MMAL_QUEUE_T *camera_detect_queue;
     struct raspicam_camera_parameters_s *camera_parameters;
 } mmalcam_context;
 
@@ -30,16 +30,45 @@
 #include "video_common.h"
 #include "video_v4l2.h"
 #include "video_loopback.h"
+#include "video_simd.h"
 #include "conf.h"
 #include "alg.h"
+#include "alg_simd.h"
+#include "alg_opencl.h"
+#include "capture.h"
+#include "framepool.h"
+#include "picwriter.h"
+#include "metrics.h"
+#include "trace.h"
+#include "loadtest.h"
+#include "shmexport.h"
+#include "eventidx.h"
+#include "retention.h"
+#include "cluster.h"
+#include "spawner.h"
 #include "track.h"
 #include "event.h"
 #include "picture.h"
 #include "rotate.h"
 #include "webu.h"
+#include "webu_stream.h"
+#include "webu_hls.h"
 #include "draw.h"
 #include "dbse.h"
 
+/* Cost of applying one run of the privacy mask in bytes written, see init_mask_privacy_spans */
+#define MASK_SPAN_COST 32
+
+/* Alignment of the detection buffers in the arena, a cache line and the widest SIMD vector */
+#define IMAGE_ARENA_ALIGN 64
+
+/* Text overlays drawn from cnt->text_cache, followed by those of the high image */
+enum TEXT_CACHE {
+    TEXT_CACHE_CHANGES,
+    TEXT_CACHE_LEFT,
+    TEXT_CACHE_RIGHT,
+    TEXT_CACHE_COUNT
+};
 
 /**
  * tls_key_threadnr
@@ -87,6 +116,44 @@ FILE *ptr_logfile = NULL;
  */
 unsigned int restart = 0;
 
+/**
+ * reload
+ *
+ *   Set by SIGHUP.  'main' reads the config files again and applies the
+ *   options that changed, see motion_reload.
+ */
+static volatile unsigned int reload = 0;
+
+
+/**
+ * image_preview_unpin
+ *
+ * The preview uses the images of the ring slot of the best frame instead of
+ * a copy.  Before the slot is reused or freed, the preview keeps the images of
+ * the slot and the slot takes the spare images of the preview in exchange.
+ *
+ * Parameters:
+ *
+ *      cnt      Pointer to the motion context structure
+ *
+ * Returns:     nothing
+ */
+static void image_preview_unpin(struct context *cnt)
+{
+    struct image_data *slot;
+
+    if (cnt->imgs.preview_slot < 0) {
+        return;
+    }
+
+    slot = &cnt->imgs.image_ring[cnt->imgs.preview_slot];
+    slot->image_norm = cnt->imgs.preview_spare_norm;
+    slot->image_high = cnt->imgs.preview_spare_high;
+
+    cnt->imgs.preview_spare_norm = NULL;
+    cnt->imgs.preview_spare_high = NULL;
+    cnt->imgs.preview_slot = -1;
+}
 
 /**
  * image_ring_resize
@@ -120,8 +187,11 @@ static void image_ring_resize(struct context *cnt, int new_size)
         }
 
         if (cnt->imgs.image_ring_in == smallest - 1 || smallest == 0) {
-            MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
-                ,_("Resizing pre_capture buffer to %d items"), new_size);
+            int i;
+
+            image_preview_unpin(cnt);
+
+            cnt->imgs.image_ring_request = new_size;
 
             /* Create memory for new ring buffer */
             struct image_data *tmp;
@@ -135,18 +205,54 @@ static void image_ring_resize(struct context *cnt, int new_size)
                 memcpy(tmp, cnt->imgs.image_ring, sizeof(struct image_data) * smallest);
             }
 
-            /* In the new buffers, allocate image memory */
-            {
-                int i;
-                for(i = smallest; i < new_size; i++) {
-                    tmp[i].image_norm = mymalloc(cnt->imgs.size_norm);
-                    memset(tmp[i].image_norm, 0x80, cnt->imgs.size_norm);  /* initialize to grey */
-                    if (cnt->imgs.size_high > 0) {
-                        tmp[i].image_high = mymalloc(cnt->imgs.size_high);
-                        memset(tmp[i].image_high, 0x80, cnt->imgs.size_high);
+            /* Return the images of the slots that are dropped */
+            for(i = smallest; i < cnt->imgs.image_ring_size; i++) {
+                framepool_put(cnt, cnt->imgs.image_ring[i].image_norm, cnt->imgs.size_norm);
+                if (cnt->imgs.size_high > 0) {
+                    framepool_put(cnt, cnt->imgs.image_ring[i].image_high, cnt->imgs.size_high);
+                }
+                free(cnt->imgs.image_ring[i].jpeg_data);
+                free(cnt->imgs.image_ring[i].overlay_text);
+            }
+
+            /* In the new buffers, allocate image memory.  The slots detection
+             * needs are always given, the pre_capture slots only within the budget.
+             */
+            for(i = smallest; i < new_size; i++) {
+                tmp[i].image_norm = framepool_get(cnt, cnt->imgs.size_norm
+                    , (i < cnt->conf.minimum_motion_frames) || (i == 0));
+                if (tmp[i].image_norm == NULL) {
+                    break;
+                }
+                memset(tmp[i].image_norm, 0x80, cnt->imgs.size_norm);  /* initialize to grey */
+                tmp[i].image_high = NULL;
+                tmp[i].jpeg_data = NULL;
+                tmp[i].jpeg_size = 0;
+                tmp[i].jpeg_alloc = 0;
+                tmp[i].high_pending = FALSE;
+                tmp[i].overlay = 0;
+                tmp[i].overlay_text = NULL;
+                tmp[i].overlay_alloc = 0;
+                if (cnt->imgs.size_high > 0) {
+                    tmp[i].image_high = framepool_get(cnt, cnt->imgs.size_high
+                        , (i < cnt->conf.minimum_motion_frames) || (i == 0));
+                    if (tmp[i].image_high == NULL) {
+                        framepool_put(cnt, tmp[i].image_norm, cnt->imgs.size_norm);
+                        break;
                     }
+                    memset(tmp[i].image_high, 0x80, cnt->imgs.size_high);
                 }
             }
+            if (i < new_size) {
+                MOTION_LOG(WRN, TYPE_ALL, NO_ERRNO
+                    ,_("Frame pool budget reached, pre_capture buffer limited to %d of %d items")
+                    , i, new_size);
+                new_size = i;
+            }
+
+            MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+                ,_("Resizing pre_capture buffer to %d items, %lu KB in use"), new_size
+                , (unsigned long)(cnt->framepool_bytes / 1024));
 
             /* Free the old ring */
             free(cnt->imgs.image_ring);
@@ -183,12 +289,16 @@ static void image_ring_destroy(struct context *cnt)
         return;
     }
 
-    /* Free all image buffers */
+    image_preview_unpin(cnt);
+
+    /* Return all image buffers to the pool */
     for (i = 0; i < cnt->imgs.image_ring_size; i++) {
-        free(cnt->imgs.image_ring[i].image_norm);
+        framepool_put(cnt, cnt->imgs.image_ring[i].image_norm, cnt->imgs.size_norm);
         if (cnt->imgs.size_high >0 ) {
-            free(cnt->imgs.image_ring[i].image_high);
+            framepool_put(cnt, cnt->imgs.image_ring[i].image_high, cnt->imgs.size_high);
         }
+        free(cnt->imgs.image_ring[i].jpeg_data);
+        free(cnt->imgs.image_ring[i].overlay_text);
     }
 
     /* Free the ring */
@@ -197,6 +307,104 @@ static void image_ring_destroy(struct context *cnt)
     cnt->imgs.image_ring = NULL;
     cnt->current_image = NULL;
     cnt->imgs.image_ring_size = 0;
+    cnt->imgs.image_ring_request = 0;
+}
+
+/* Give the next part of size bytes of the arena, NULL while only measuring */
+static void *image_arena_part(unsigned char *arena, size_t *offset, size_t size)
+{
+    void *part;
+
+    part = (arena != NULL) ? (arena + *offset) : NULL;
+    *offset += (size + IMAGE_ARENA_ALIGN - 1) & ~((size_t)IMAGE_ARENA_ALIGN - 1);
+
+    return part;
+}
+
+/**
+ * image_arena_carve
+ *
+ * Point the detection buffers of the camera at their parts of arena and
+ * return the size of the arena.  With a NULL arena the buffers are set to
+ * NULL and only the size is found.
+ * The buffers used together by the per pixel loops are next to each other.
+ */
+static size_t image_arena_carve(struct context *cnt, unsigned char *arena)
+{
+    struct images *imgs = &cnt->imgs;
+    size_t offset = 0;
+    size_t tiles = imgs->tile_cols * imgs->tile_rows;
+
+    imgs->ref = image_arena_part(arena, &offset, imgs->size_norm);
+    imgs->image_virgin.image_norm = image_arena_part(arena, &offset, imgs->size_norm);
+    imgs->img_motion.image_norm = image_arena_part(arena, &offset, imgs->size_norm);
+    imgs->image_vprvcy.image_norm = image_arena_part(arena, &offset, imgs->size_norm);
+
+    /* contains the moving objects of ref. frame */
+    imgs->ref_dyn = image_arena_part(arena, &offset, imgs->motionsize * sizeof(*imgs->ref_dyn));
+    imgs->smartmask = image_arena_part(arena, &offset, imgs->motionsize);
+    imgs->smartmask_final = image_arena_part(arena, &offset, imgs->motionsize);
+    imgs->smartmask_buffer = image_arena_part(arena, &offset
+        , imgs->motionsize * sizeof(*imgs->smartmask_buffer));
+
+    imgs->tile_counts = image_arena_part(arena, &offset, tiles * sizeof(*imgs->tile_counts));
+    imgs->tile_skip = image_arena_part(arena, &offset, tiles);
+    imgs->motion_rows = image_arena_part(arena, &offset, imgs->height * sizeof(*imgs->motion_rows));
+    imgs->locate_counts = image_arena_part(arena, &offset
+        , (imgs->width + imgs->height) * sizeof(*imgs->locate_counts));
+
+    imgs->labels = image_arena_part(arena, &offset, imgs->motionsize * sizeof(*imgs->labels));
+    imgs->labelsize = image_arena_part(arena, &offset
+        , (imgs->motionsize / 2 + 1) * sizeof(*imgs->labelsize));
+    imgs->label_runs = image_arena_part(arena, &offset
+        , imgs->height * ((imgs->width + 1) / 2) * sizeof(*imgs->label_runs));
+    imgs->label_rows = image_arena_part(arena, &offset
+        , (imgs->height + 1) * sizeof(*imgs->label_rows));
+
+    /* The conversions through RGB24 use it at the captured size */
+    if (imgs->detect_scale > 1) {
+        imgs->common_buffer = image_arena_part(arena, &offset, 3 * imgs->width_high * imgs->height_high);
+    } else {
+        imgs->common_buffer = image_arena_part(arena, &offset, 3 * imgs->width * imgs->height);
+    }
+    if (imgs->size_high > 0) {
+        imgs->image_virgin.image_high = image_arena_part(arena, &offset, imgs->size_high);
+    } else {
+        imgs->image_virgin.image_high = NULL;
+    }
+
+    return offset;
+}
+
+/**
+ * image_arena_init
+ *
+ * Allocate the buffers walked by the detection as one arena from the frame
+ * pool allocator, so they can use huge pages and the NUMA node of this
+ * thread.  Each buffer starts on a cache line, see IMAGE_ARENA_ALIGN.
+ */
+static void image_arena_init(struct context *cnt)
+{
+    size_t size;
+
+    size = image_arena_carve(cnt, NULL);
+    cnt->imgs.arena = framepool_alloc(size);
+    image_arena_carve(cnt, cnt->imgs.arena);
+
+    MOTION_LOG(INF, TYPE_ALL, NO_ERRNO
+        ,_("Detection buffers use %lu KB"), (unsigned long)(size / 1024));
+}
+
+/* Free the arena of the detection buffers as a unit */
+static void image_arena_free(struct context *cnt)
+{
+    if (cnt->imgs.arena == NULL) {
+        return;
+    }
+
+    framepool_free(cnt->imgs.arena);
+    cnt->imgs.arena = NULL;
+    image_arena_carve(cnt, NULL);
 }
 
 /**
@@ -213,23 +421,45 @@ static void image_ring_destroy(struct context *cnt)
  */
 static void image_save_as_preview(struct context *cnt, struct image_data *img)
 {
-    void *image_norm, *image_high;
+    motion_image_overlay(cnt, img);
+    motion_image_high(cnt, img);
 
-    /* Save our pointers to our memory locations for images*/
-    image_norm = cnt->imgs.preview_image.image_norm;
-    image_high = cnt->imgs.preview_image.image_high;
+    /* The own images of the preview become spare while it uses the slot */
+    if (cnt->imgs.preview_slot < 0) {
+        cnt->imgs.preview_spare_norm = cnt->imgs.preview_image.image_norm;
+        cnt->imgs.preview_spare_high = cnt->imgs.preview_image.image_high;
+    }
 
-    /* Copy over the meta data from the img into preview */
+    /* Copy over the meta data and the image pointers from the img into preview */
     memcpy(&cnt->imgs.preview_image, img, sizeof(struct image_data));
+    cnt->imgs.preview_image.jpeg_data = NULL;
+    cnt->imgs.preview_image.jpeg_size = 0;
+    cnt->imgs.preview_image.jpeg_alloc = 0;
+    cnt->imgs.preview_image.high_pending = FALSE;
+    cnt->imgs.preview_image.overlay = 0;
+    cnt->imgs.preview_image.overlay_text = NULL;
+    cnt->imgs.preview_image.overlay_alloc = 0;
 
-    /* Restore the pointers to the memory locations for images*/
-    cnt->imgs.preview_image.image_norm = image_norm;
-    cnt->imgs.preview_image.image_high = image_high;
-
-    /* Copy the actual images for norm and high */
-    memcpy(cnt->imgs.preview_image.image_norm, img->image_norm, cnt->imgs.size_norm);
-    if (cnt->imgs.size_high > 0) {
-        memcpy(cnt->imgs.preview_image.image_high, img->image_high, cnt->imgs.size_high);
+    /*
+     * The slot is not changed once it is saved so the preview uses its images
+     * until the slot is reused, see image_preview_unpin.  The locate box of the
+     * preview is drawn on the image so the image still going to the streams
+     * and loopback is copied.
+     */
+    if ((img == &cnt->imgs.image_ring[cnt->imgs.image_ring_in]) &&
+        (cnt->locate_motion_mode == LOCATE_PREVIEW)) {
+        cnt->imgs.preview_image.image_norm = cnt->imgs.preview_spare_norm;
+        cnt->imgs.preview_image.image_high = cnt->imgs.preview_spare_high;
+        cnt->imgs.preview_spare_norm = NULL;
+        cnt->imgs.preview_spare_high = NULL;
+        cnt->imgs.preview_slot = -1;
+
+        memcpy(cnt->imgs.preview_image.image_norm, img->image_norm, cnt->imgs.size_norm);
+        if (cnt->imgs.size_high > 0) {
+            memcpy(cnt->imgs.preview_image.image_high, img->image_high, cnt->imgs.size_high);
+        }
+    } else {
+        cnt->imgs.preview_slot = img - cnt->imgs.image_ring;
     }
 
     /*
@@ -256,6 +486,10 @@ static void image_save_as_preview(struct context *cnt, struct image_data *img)
             alg_draw_red_location(&img->location, &cnt->imgs, cnt->imgs.width, cnt->imgs.preview_image.image_norm,
                                   LOCATE_REDCROSS, LOCATE_NORMAL, cnt->process_thisframe);
         }
+        if (cnt->imgs.detect_scale > 1) {
+            alg_draw_location_high(&img->location, &cnt->imgs, cnt->imgs.preview_image.image_high,
+                                   cnt->locate_motion_style);
+        }
     }
 }
 
@@ -291,6 +525,8 @@ static void context_init(struct context *cnt)
 
     cnt->pipe = -1;
     cnt->mpipe = -1;
+    cnt->pipe_mmap = NULL;
+    cnt->mpipe_mmap = NULL;
 
     cnt->vdev = NULL;    /*Init to NULL to check loading parms vs web updates*/
     cnt->netcam = NULL;
@@ -327,6 +563,10 @@ static void context_destroy(struct context *cnt)
         }
     }
 
+    if (cnt->conf_loaded != NULL) {
+        context_destroy(cnt->conf_loaded);
+    }
+
     free(cnt);
 }
 
@@ -367,12 +607,9 @@ static void sig_handler(int signo)
         }
         break;
     case SIGHUP:
-        restart = 1;
-        /*
-         * Fall through, as the value of 'restart' is the only difference
-         * between SIGHUP and the ones below.
-         */
-         /*FALLTHROUGH*/
+        /* Read the config files again, see motion_reload */
+        reload = 1;
+        break;
     case SIGINT:
         /*FALLTHROUGH*/
     case SIGQUIT:
@@ -410,6 +647,18 @@ static void sig_handler(int signo)
     }
 }
 
+/**
+ * motion_restart_all
+ *
+ *   End all the threads and start Motion again with the config files read
+ *   anew.  Used when a reload can not be applied to the running cameras.
+ */
+void motion_restart_all(void)
+{
+    restart = 1;
+    sig_handler(SIGTERM);
+}
+
 /**
  * sigchild_handler
  *
@@ -516,8 +765,9 @@ static void motion_detected(struct context *cnt, int dev, struct image_data *img
     struct coord *location = &img->location;
     int indx;
 
-    /* Draw location */
+    /* Draw location, over the texts as the image is going to be saved */
     if (cnt->locate_motion_mode == LOCATE_ON) {
+        motion_image_overlay(cnt, img);
 
         if (cnt->locate_motion_style == LOCATE_BOX) {
             alg_draw_location(location, imgs, imgs->width, img->image_norm, LOCATE_BOX,
@@ -532,6 +782,9 @@ static void motion_detected(struct context *cnt, int dev, struct image_data *img
             alg_draw_red_location(location, imgs, imgs->width, img->image_norm, LOCATE_REDCROSS,
                                   LOCATE_BOTH, cnt->process_thisframe);
         }
+        if (imgs->detect_scale > 1) {
+            img->overlay |= OVERLAY_LOCATE_HIGH;
+        }
     }
 
     /* Calculate how centric motion is if configured preview center*/
@@ -593,8 +846,8 @@ static void motion_detected(struct context *cnt, int dev, struct image_data *img
 
         }
 
-        /* EVENT_MOTION triggers event_beep and on_motion_detected_command */
-        event(cnt, EVENT_MOTION, NULL, NULL, NULL, &img->timestamp_tv);
+        /* EVENT_MOTION triggers event_beep, on_motion_detected_command and event_index_motion */
+        event(cnt, EVENT_MOTION, img, NULL, NULL, &img->timestamp_tv);
     }
 
     /* Limit framerate */
@@ -620,7 +873,7 @@ static void motion_detected(struct context *cnt, int dev, struct image_data *img
 
     /* if track enabled and auto track on */
     if (cnt->track.type && cnt->track.active) {
-        cnt->moved = track_move(cnt, dev, location, imgs, 0);
+        track_move(cnt, dev, location, imgs, 0);
     }
 
 }
@@ -653,6 +906,7 @@ static void process_image_ring(struct context *cnt)
 
         /* Set inte global context that we are working with this image */
         cnt->current_image = &cnt->imgs.image_ring[cnt->imgs.image_ring_out];
+        motion_image_overlay(cnt, cnt->current_image);
 
         if (cnt->imgs.image_ring[cnt->imgs.image_ring_out].shot < cnt->conf.framerate) {
             if (cnt_list[0]->log_level >= DBG) {
@@ -776,6 +1030,11 @@ static int init_camera_type(struct context *cnt)
 
     cnt->camera_type = CAMERA_TYPE_UNKNOWN;
 
+    if (cnt->conf.synth_camera) {
+        cnt->camera_type = CAMERA_TYPE_SYNTH;
+        return 0;
+    }
+
     #ifdef HAVE_MMAL
         if (cnt->conf.mmalcam_name) {
             cnt->camera_type = CAMERA_TYPE_MMAL;
@@ -811,11 +1070,131 @@ static int init_camera_type(struct context *cnt)
 
 
     MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
-        , _("Unable to determine camera type (MMAL, Netcam, V4L2, BKTR)"));
+        , _("Unable to determine camera type (MMAL, Netcam, V4L2, BKTR, synthetic)"));
     return -1;
 
 }
 
+/**
+ * mask_spans_plane
+ *  Find the runs of zero (masked) bytes in a plane of the privacy mask.
+ *  Returns the number of runs and adds the number of masked bytes to masked.
+ */
+static int mask_spans_plane(struct mask_span **spans, const unsigned char *plane, int size, int *masked)
+{
+    int indx, start, count;
+
+    count = 0;
+    for (indx = 0; indx < size; indx++) {
+        if ((plane[indx] == 0) && ((indx == 0) || (plane[indx - 1] != 0))) {
+            count++;
+        }
+    }
+
+    *spans = NULL;
+    if (count == 0) {
+        return 0;
+    }
+    *spans = mymalloc(count * sizeof(struct mask_span));
+
+    count = 0;
+    indx = 0;
+    while (indx < size) {
+        if (plane[indx] != 0) {
+            indx++;
+            continue;
+        }
+        start = indx;
+        while ((indx < size) && (plane[indx] == 0)) {
+            indx++;
+        }
+        (*spans)[count].offset = start;
+        (*spans)[count].len = indx - start;
+        *masked += indx - start;
+        count++;
+    }
+
+    return count;
+}
+
+/**
+ * init_mask_privacy_spans
+ *  Compile the privacy mask of one image size into runs of masked pixels.
+ *  Masks usually cover a few areas so the frames are then only written
+ *  where masked.  When the runs would cost more than walking the whole
+ *  mask, such as for a mask of many small holes, the whole mask is used.
+ */
+static void init_mask_privacy_spans(struct mask_spans *spans, const unsigned char *mask
+        , int width, int height)
+{
+    int masked, cost, size;
+
+    masked = 0;
+    size = width * height;
+    spans->luma_count = mask_spans_plane(&spans->luma, mask, size, &masked);
+    spans->chroma_count = mask_spans_plane(&spans->chroma, mask + size, size / 4, &masked);
+
+    /* A run costs about as much as setting MASK_SPAN_COST bytes */
+    cost = ((spans->luma_count + (spans->chroma_count * 2)) * MASK_SPAN_COST) + masked;
+    spans->sparse = (cost < (size * 3) / 2);
+
+    MOTION_LOG(INF, TYPE_ALL, NO_ERRNO
+        ,_("Privacy mask %dx%d: %d runs covering %d%% of the image, %s")
+        ,width, height, spans->luma_count + spans->chroma_count
+        ,(int)(((long)masked * 100) / (size + (size / 4)))
+        ,spans->sparse ? _("applying the runs") : _("applying the whole mask"));
+}
+
+static void free_mask_privacy_spans(struct mask_spans *spans)
+{
+    free(spans->luma);
+    free(spans->chroma);
+    memset(spans, 0, sizeof(struct mask_spans));
+}
+
+/**
+ * init_mask
+ *
+ *   Load the mask file of the camera if one is set.
+ */
+static void init_mask(struct context *cnt)
+{
+    FILE *picture;
+
+    if (cnt->conf.mask_file) {
+        if ((picture = myfopen(cnt->conf.mask_file, "re"))) {
+            /*
+             * NOTE: The mask is expected to have the output dimensions. I.e., the mask
+             * applies to the already rotated image, not the capture image. Thus, use
+             * width and height from imgs.
+             */
+            cnt->imgs.mask = get_pgm(picture, cnt->imgs.width, cnt->imgs.height);
+            myfclose(picture);
+        } else {
+            MOTION_LOG(ERR, TYPE_ALL, SHOW_ERRNO
+                ,_("Error opening mask file %s")
+                ,cnt->conf.mask_file);
+            /*
+             * Try to write an empty mask file to make it easier
+             * for the user to edit it
+             */
+            put_fixed_mask(cnt, cnt->conf.mask_file);
+        }
+
+        if (!cnt->imgs.mask) {
+            MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
+                ,_("Failed to read mask image. Mask feature disabled."));
+        } else {
+            MOTION_LOG(INF, TYPE_ALL, NO_ERRNO
+                ,_("Maskfile \"%s\" loaded.")
+                ,cnt->conf.mask_file);
+        }
+    } else {
+        cnt->imgs.mask = NULL;
+    }
+
+}
+
 static void init_mask_privacy(struct context *cnt)
 {
 
@@ -920,11 +1299,54 @@ static void init_mask_privacy(struct context *cnt)
                 }
                 indx_img++;
             }
+
+            init_mask_privacy_spans(&cnt->imgs.mask_privacy_spans, cnt->imgs.mask_privacy
+                , cnt->imgs.width, cnt->imgs.height);
+            if (cnt->imgs.size_high > 0) {
+                init_mask_privacy_spans(&cnt->imgs.mask_privacy_high_spans
+                    , cnt->imgs.mask_privacy_high, cnt->imgs.width_high, cnt->imgs.height_high);
+            }
         }
     }
 
 }
 
+/**
+ * free_masks
+ *
+ *   Free the mask and the privacy mask of the camera.
+ */
+static void free_masks(struct context *cnt)
+{
+    if (cnt->imgs.mask) {
+        free(cnt->imgs.mask);
+        cnt->imgs.mask = NULL;
+    }
+
+    if (cnt->imgs.mask_privacy) {
+        free(cnt->imgs.mask_privacy);
+        cnt->imgs.mask_privacy = NULL;
+    }
+
+    if (cnt->imgs.mask_privacy_uv) {
+        free(cnt->imgs.mask_privacy_uv);
+        cnt->imgs.mask_privacy_uv = NULL;
+    }
+
+    if (cnt->imgs.mask_privacy_high) {
+        free(cnt->imgs.mask_privacy_high);
+        cnt->imgs.mask_privacy_high = NULL;
+    }
+
+    if (cnt->imgs.mask_privacy_high_uv) {
+        free(cnt->imgs.mask_privacy_high_uv);
+        cnt->imgs.mask_privacy_high_uv = NULL;
+    }
+
+    free_mask_privacy_spans(&cnt->imgs.mask_privacy_spans);
+    free_mask_privacy_spans(&cnt->imgs.mask_privacy_high_spans);
+}
+
 static void init_text_scale(struct context *cnt)
 {
 
@@ -961,64 +1383,121 @@ static void init_text_scale(struct context *cnt)
 
 }
 
-static void mot_stream_init(struct context *cnt)
+/** mot_stream_scaled_init
+ *  Set up the streams of the widths listed in stream_scaled.  The scaled
+ *  images are made by the stream encoder once a connection needs them.
+ */
+static void mot_stream_scaled_init(struct context *cnt)
 {
+    struct stream_scaled *scaled;
+    const char *st_pos;
+    char *en_pos;
+    long width;
+
+    cnt->stream_scaled_count = 0;
+    if (cnt->conf.stream_scaled == NULL) {
+        return;
+    }
+
+    st_pos = cnt->conf.stream_scaled;
+    while (*st_pos != '\0') {
+        width = strtol(st_pos, &en_pos, 10);
+        if (en_pos == st_pos) {
+            MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO
+                ,_("Invalid stream_scaled %s"), cnt->conf.stream_scaled);
+            break;
+        }
+        if (cnt->stream_scaled_count == STREAM_SCALED_MAX) {
+            MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO
+                ,_("Only %d widths are used from stream_scaled"), STREAM_SCALED_MAX);
+            break;
+        }
+        if (width < 16) {
+            MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO
+                ,_("Ignoring stream_scaled width %ld"), width);
+        } else {
+            /* The images of strm are kept, see mot_stream_init */
+            scaled = &cnt->stream_scaled[cnt->stream_scaled_count++];
+            memset(&scaled->scale, 0, sizeof(struct stream_scale));
+            scaled->width_conf = (int)width;
+        }
+        st_pos = en_pos;
+        while ((*st_pos == ',') || (*st_pos == ' ')) {
+            st_pos++;
+        }
+    }
+}
 
-    /* The image buffers are allocated in event_stream_put if needed*/
-    pthread_mutex_init(&cnt->mutex_stream, NULL);
+static void mot_stream_scale_free(struct stream_scale *scale)
+{
+    pic_scaler_free(scale->scaler);
+    free(scale->image);
+    memset(scale, 0, sizeof(struct stream_scale));
+}
 
-    cnt->imgs.substream_image = NULL;
+static void mot_stream_init(struct context *cnt)
+{
+    /*
+     * The image buffers are allocated in event_stream_put if needed.  The
+     * streams, with mutex_stream, outlive the camera thread since the web
+     * connections may still hold and release their images after it stopped,
+     * see mot_stream_free.
+     */
+    memset(&cnt->stream_sub_scale, 0, sizeof(struct stream_scale));
+    mot_stream_scaled_init(cnt);
+    webu_hls_init(cnt);
 
-    cnt->stream_norm.jpeg_size = 0;
-    cnt->stream_norm.jpeg_data = NULL;
-    cnt->stream_norm.cnct_count = 0;
+    event_stream_start(cnt);
 
-    cnt->stream_sub.jpeg_size = 0;
-    cnt->stream_sub.jpeg_data = NULL;
-    cnt->stream_sub.cnct_count = 0;
+}
 
-    cnt->stream_motion.jpeg_size = 0;
-    cnt->stream_motion.jpeg_data = NULL;
-    cnt->stream_motion.cnct_count = 0;
+static void mot_stream_freebufs(struct context *cnt)
+{
+    int indx;
 
-    cnt->stream_source.jpeg_size = 0;
-    cnt->stream_source.jpeg_data = NULL;
-    cnt->stream_source.cnct_count = 0;
+    webu_stream_freebufs(cnt, &cnt->stream_norm);
+    webu_stream_freebufs(cnt, &cnt->stream_sub);
+    webu_stream_freebufs(cnt, &cnt->stream_motion);
+    webu_stream_freebufs(cnt, &cnt->stream_source);
+    for (indx = 0; indx < STREAM_SCALED_MAX; indx++) {
+        webu_stream_freebufs(cnt, &cnt->stream_scaled[indx].strm);
+    }
+}
 
+/**
+ * mot_stream_free
+ *
+ *   Free the images released by the connections after the camera stopped
+ *   and the stream lock.  Called when the web control has been stopped.
+ */
+static void mot_stream_free(struct context *cnt)
+{
+    mot_stream_freebufs(cnt);
+    pthread_cond_destroy(&cnt->cond_stream);
+    pthread_mutex_destroy(&cnt->mutex_stream);
 }
 
 static void mot_stream_deinit(struct context *cnt)
 {
+    int indx;
 
     /* Need to check whether buffers were allocated since init
      * function defers the allocations to event_stream_put
     */
 
-    pthread_mutex_destroy(&cnt->mutex_stream);
-
-    if (cnt->imgs.substream_image != NULL) {
-        free(cnt->imgs.substream_image);
-        cnt->imgs.substream_image = NULL;
-    }
-
-    if (cnt->stream_norm.jpeg_data != NULL) {
-        free(cnt->stream_norm.jpeg_data);
-        cnt->stream_norm.jpeg_data = NULL;
-    }
+    event_stream_stop(cnt);
+    webu_hls_deinit(cnt);
 
-    if (cnt->stream_sub.jpeg_data != NULL) {
-        free(cnt->stream_sub.jpeg_data);
-        cnt->stream_sub.jpeg_data = NULL;
-    }
+    mot_stream_freebufs(cnt);
 
-    if (cnt->stream_motion.jpeg_data != NULL) {
-        free(cnt->stream_motion.jpeg_data);
-        cnt->stream_motion.jpeg_data = NULL;
-    }
+    /* Wake the connections still waiting for an image before the wait ends */
+    pthread_mutex_lock(&cnt->mutex_stream);
+        pthread_cond_broadcast(&cnt->cond_stream);
+    pthread_mutex_unlock(&cnt->mutex_stream);
 
-    if (cnt->stream_source.jpeg_data != NULL) {
-        free(cnt->stream_source.jpeg_data);
-        cnt->stream_source.jpeg_data = NULL;
+    mot_stream_scale_free(&cnt->stream_sub_scale);
+    for (indx = 0; indx < cnt->stream_scaled_count; indx++) {
+        mot_stream_scale_free(&cnt->stream_scaled[indx].scale);
     }
 }
 
@@ -1039,7 +1518,6 @@ static void mot_stream_deinit(struct context *cnt)
  */
 static int motion_init(struct context *cnt)
 {
-    FILE *picture;
     int indx, retcd;
 
     util_threadname_set("ml",cnt->threadnr,cnt->conf.camera_name);
@@ -1047,6 +1525,8 @@ static int motion_init(struct context *cnt)
     /* Store thread number in TLS. */
     pthread_setspecific(tls_key_threadnr, (void *)((unsigned long)cnt->threadnr));
 
+    cnt->capq = NULL;
+
     cnt->currenttime_tm = mymalloc(sizeof(struct tm));
     cnt->eventtime_tm = mymalloc(sizeof(struct tm));
     /* Init frame time */
@@ -1070,6 +1550,8 @@ static int motion_init(struct context *cnt)
     cnt->imgs.width_high = 0;
     cnt->imgs.height_high = 0;
     cnt->imgs.size_high = 0;
+    cnt->imgs.detect_scale = 1;
+    cnt->imgs.detect_camera = FALSE;
     cnt->movie_passthrough = cnt->conf.movie_passthrough;
     cnt->pause = cnt->conf.pause;
 
@@ -1168,28 +1650,24 @@ static int motion_init(struct context *cnt)
      */
     cnt->imgs.size_high = (cnt->imgs.width_high * cnt->imgs.height_high * 3) / 2;
 
+    cnt->imgs.preview_slot = -1;
     image_ring_resize(cnt, 1); /* Create a initial precapture ring buffer with 1 frame */
 
-    cnt->imgs.ref = mymalloc(cnt->imgs.size_norm);
-    cnt->imgs.img_motion.image_norm = mymalloc(cnt->imgs.size_norm);
-
-    /* contains the moving objects of ref. frame */
-    cnt->imgs.ref_dyn = mymalloc(cnt->imgs.motionsize * sizeof(*cnt->imgs.ref_dyn));
-    cnt->imgs.image_virgin.image_norm = mymalloc(cnt->imgs.size_norm);
-    cnt->imgs.image_vprvcy.image_norm = mymalloc(cnt->imgs.size_norm);
-    cnt->imgs.smartmask = mymalloc(cnt->imgs.motionsize);
-    cnt->imgs.smartmask_final = mymalloc(cnt->imgs.motionsize);
-    cnt->imgs.smartmask_buffer = mymalloc(cnt->imgs.motionsize * sizeof(*cnt->imgs.smartmask_buffer));
-    cnt->imgs.labels = mymalloc(cnt->imgs.motionsize * sizeof(*cnt->imgs.labels));
-    cnt->imgs.labelsize = mymalloc((cnt->imgs.motionsize/2+1) * sizeof(*cnt->imgs.labelsize));
-    cnt->imgs.preview_image.image_norm = mymalloc(cnt->imgs.size_norm);
-    cnt->imgs.common_buffer = mymalloc(3 * cnt->imgs.width * cnt->imgs.height);
+    cnt->imgs.tile_cols = (cnt->imgs.width + ALG_TILE_SIZE - 1) / ALG_TILE_SIZE;
+    cnt->imgs.tile_rows = (cnt->imgs.height + ALG_TILE_SIZE - 1) / ALG_TILE_SIZE;
+    image_arena_init(cnt);
+    memset(cnt->imgs.motion_rows, 0, cnt->imgs.height * sizeof(*cnt->imgs.motion_rows));
+    /* From the frame pool as the ring images since the preview exchanges images with the ring */
+    cnt->imgs.preview_image.image_norm = framepool_get(cnt, cnt->imgs.size_norm, TRUE);
+    cnt->text_cache = mymalloc(2 * TEXT_CACHE_COUNT * sizeof(struct draw_cache));
+    memset(cnt->text_cache, 0, 2 * TEXT_CACHE_COUNT * sizeof(struct draw_cache));
     if (cnt->imgs.size_high > 0) {
-        cnt->imgs.image_virgin.image_high = mymalloc(cnt->imgs.size_high);
-        cnt->imgs.preview_image.image_high = mymalloc(cnt->imgs.size_high);
+        cnt->imgs.preview_image.image_high = framepool_get(cnt, cnt->imgs.size_high, TRUE);
     }
 
+    prepare_exif_init(cnt);
     mot_stream_init(cnt);
+    metrics_init(cnt);
 
     /* Set output picture type */
     if (mystreq(cnt->conf.picture_type, "ppm")) {
@@ -1208,6 +1686,7 @@ static int motion_init(struct context *cnt)
     } else {
         cnt->imgs.picture_type = IMAGE_TYPE_JPEG;
     }
+    put_webp_init(cnt);
 
     /*
      * Now is a good time to init rotation data. Since vid_start has been
@@ -1222,6 +1701,9 @@ static int motion_init(struct context *cnt)
 
     init_text_scale(cnt);   /*Initialize and validate the text_scale */
 
+    shmexport_init(cnt);
+    eventidx_init(cnt);
+
     /* Capture first image, or we will get an alarm on start */
     if (cnt->video_dev >= 0) {
         int i;
@@ -1252,7 +1734,8 @@ static int motion_init(struct context *cnt)
                 ,_("Opening video loopback device for normal pictures"));
 
             /* vid_startpipe should get the output dimensions */
-            cnt->pipe = vlp_startpipe(cnt->conf.video_pipe, cnt->imgs.width, cnt->imgs.height);
+            cnt->pipe = vlp_startpipe(cnt->conf.video_pipe, cnt->imgs.width, cnt->imgs.height
+                , cnt->conf.video_pipe_buffers, &cnt->pipe_mmap);
 
             if (cnt->pipe < 0) {
                 MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
@@ -1266,7 +1749,8 @@ static int motion_init(struct context *cnt)
                 ,_("Opening video loopback device for motion pictures"));
 
             /* vid_startpipe should get the output dimensions */
-            cnt->mpipe = vlp_startpipe(cnt->conf.video_pipe_motion, cnt->imgs.width, cnt->imgs.height);
+            cnt->mpipe = vlp_startpipe(cnt->conf.video_pipe_motion, cnt->imgs.width, cnt->imgs.height
+                , cnt->conf.video_pipe_buffers, &cnt->mpipe_mmap);
 
             if (cnt->mpipe < 0) {
                 MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
@@ -1282,45 +1766,19 @@ static int motion_init(struct context *cnt)
     }
 
     /* Load the mask file if any */
-    if (cnt->conf.mask_file) {
-        if ((picture = myfopen(cnt->conf.mask_file, "re"))) {
-            /*
-             * NOTE: The mask is expected to have the output dimensions. I.e., the mask
-             * applies to the already rotated image, not the capture image. Thus, use
-             * width and height from imgs.
-             */
-            cnt->imgs.mask = get_pgm(picture, cnt->imgs.width, cnt->imgs.height);
-            myfclose(picture);
-        } else {
-            MOTION_LOG(ERR, TYPE_ALL, SHOW_ERRNO
-                ,_("Error opening mask file %s")
-                ,cnt->conf.mask_file);
-            /*
-             * Try to write an empty mask file to make it easier
-             * for the user to edit it
-             */
-            put_fixed_mask(cnt, cnt->conf.mask_file);
-        }
-
-        if (!cnt->imgs.mask) {
-            MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
-                ,_("Failed to read mask image. Mask feature disabled."));
-        } else {
-            MOTION_LOG(INF, TYPE_ALL, NO_ERRNO
-                ,_("Maskfile \"%s\" loaded.")
-                ,cnt->conf.mask_file);
-        }
-    } else {
-        cnt->imgs.mask = NULL;
-    }
+    init_mask(cnt);
 
     init_mask_privacy(cnt);
 
+    alg_init_tiles(cnt);
+
     /* Always initialize smart_mask - someone could turn it on later... */
     memset(cnt->imgs.smartmask, 0, cnt->imgs.motionsize);
     memset(cnt->imgs.smartmask_final, 255, cnt->imgs.motionsize);
     memset(cnt->imgs.smartmask_buffer, 0, cnt->imgs.motionsize * sizeof(*cnt->imgs.smartmask_buffer));
 
+    alg_opencl_init(cnt);
+
     /* Set noise level */
     cnt->noise = cnt->conf.noise_level;
 
@@ -1347,6 +1805,9 @@ static int motion_init(struct context *cnt)
 
     cnt->frame_delay = cnt->required_frame_time;
 
+    cnt->idle = FALSE;
+    cnt->idle_quiet = time(NULL);
+
     /*
      * Reserve enough space for a 10 second timing history buffer. Note that,
      * if there is any problem on the allocation, mymalloc does not return.
@@ -1363,8 +1824,9 @@ static int motion_init(struct context *cnt)
 
     cnt->track_posx = 0;
     cnt->track_posy = 0;
+    track_start(cnt);
     if (cnt->track.type) {
-        cnt->moved = track_center(cnt, cnt->video_dev, 0, 0, 0);
+        track_center(cnt, cnt->video_dev, 0, 0, 0);
     }
 
     /* Initialize area detection */
@@ -1397,7 +1859,8 @@ static int motion_init(struct context *cnt)
 
     cnt->olddiffs = 0;
     cnt->smartmask_ratio = 0;
-    cnt->smartmask_count = 20;
+    cnt->smartmask_count = 0;
+    cnt->smartmask_row = 0;
 
     cnt->previous_diffs = 0;
     cnt->previous_location_x = 0;
@@ -1415,6 +1878,8 @@ static int motion_init(struct context *cnt)
         MOTION_LOG(INF, TYPE_ALL, NO_ERRNO, _("Emulating motion"));
     }
 
+    capture_start(cnt);
+
     return 0;
 }
 
@@ -1432,6 +1897,7 @@ static int motion_init(struct context *cnt)
  */
 static void motion_cleanup(struct context *cnt)
 {
+    int indx;
 
     event(cnt, EVENT_TIMELAPSEEND, NULL, NULL, NULL, &cnt->current_image->timestamp_tv);
     if (cnt->event_nr == cnt->prev_event) {
@@ -1440,81 +1906,47 @@ static void motion_cleanup(struct context *cnt)
       cnt->event_nr++;
     }
 
+    picwriter_flush(cnt);
+    put_webp_deinit(cnt);
+
     mot_stream_deinit(cnt);
+    metrics_deinit(cnt);
+    shmexport_deinit(cnt);
+    eventidx_deinit(cnt);
+    alg_opencl_deinit(cnt);
+
+    capture_stop(cnt);
+    track_stop(cnt);
 
     if (cnt->video_dev >= 0) {
         vid_close(cnt);
         cnt->video_dev = -1;
     }
 
-    free(cnt->imgs.img_motion.image_norm);
-    cnt->imgs.img_motion.image_norm = NULL;
-
-    free(cnt->imgs.ref);
-    cnt->imgs.ref = NULL;
-
-    free(cnt->imgs.ref_dyn);
-    cnt->imgs.ref_dyn = NULL;
-
-    free(cnt->imgs.image_virgin.image_norm);
-    cnt->imgs.image_virgin.image_norm = NULL;
-
-    free(cnt->imgs.image_vprvcy.image_norm);
-    cnt->imgs.image_vprvcy.image_norm = NULL;
-
-    free(cnt->imgs.labels);
-    cnt->imgs.labels = NULL;
-
-    free(cnt->imgs.labelsize);
-    cnt->imgs.labelsize = NULL;
-
-    free(cnt->imgs.smartmask);
-    cnt->imgs.smartmask = NULL;
-
-    free(cnt->imgs.smartmask_final);
-    cnt->imgs.smartmask_final = NULL;
-
-    free(cnt->imgs.smartmask_buffer);
-    cnt->imgs.smartmask_buffer = NULL;
-
-    if (cnt->imgs.mask) {
-        free(cnt->imgs.mask);
-        cnt->imgs.mask = NULL;
-    }
-
-    if (cnt->imgs.mask_privacy) {
-        free(cnt->imgs.mask_privacy);
-        cnt->imgs.mask_privacy = NULL;
-    }
+    image_arena_free(cnt);
 
-    if (cnt->imgs.mask_privacy_uv) {
-        free(cnt->imgs.mask_privacy_uv);
-        cnt->imgs.mask_privacy_uv = NULL;
-    }
+    free_masks(cnt);
 
-    if (cnt->imgs.mask_privacy_high) {
-        free(cnt->imgs.mask_privacy_high);
-        cnt->imgs.mask_privacy_high = NULL;
+    if (cnt->text_cache != NULL) {
+        for (indx = 0; indx < 2 * TEXT_CACHE_COUNT; indx++) {
+            draw_cache_free(&cnt->text_cache[indx]);
+        }
+        free(cnt->text_cache);
+        cnt->text_cache = NULL;
     }
 
-    if (cnt->imgs.mask_privacy_high_uv) {
-        free(cnt->imgs.mask_privacy_high_uv);
-        cnt->imgs.mask_privacy_high_uv = NULL;
-    }
+    prepare_exif_deinit(cnt);
 
-    free(cnt->imgs.common_buffer);
-    cnt->imgs.common_buffer = NULL;
+    image_preview_unpin(cnt);
 
-    free(cnt->imgs.preview_image.image_norm);
+    framepool_put(cnt, cnt->imgs.preview_image.image_norm, cnt->imgs.size_norm);
     cnt->imgs.preview_image.image_norm = NULL;
 
-    if (cnt->imgs.image_virgin.image_high != NULL) {
-        free(cnt->imgs.image_virgin.image_high);
-        cnt->imgs.image_virgin.image_high = NULL;
-    }
+    pic_scaler_free(cnt->imgs.high_scaler);
+    cnt->imgs.high_scaler = NULL;
 
     if (cnt->imgs.preview_image.image_high != NULL) {
-        free(cnt->imgs.preview_image.image_high);
+        framepool_put(cnt, cnt->imgs.preview_image.image_high, cnt->imgs.size_high);
         cnt->imgs.preview_image.image_high = NULL;
     }
 
@@ -1522,15 +1954,10 @@ static void motion_cleanup(struct context *cnt)
 
     rotate_deinit(cnt); /* cleanup image rotation data */
 
-    if (cnt->pipe != -1) {
-        close(cnt->pipe);
-        cnt->pipe = -1;
-    }
-
-    if (cnt->mpipe != -1) {
-        close(cnt->mpipe);
-        cnt->mpipe = -1;
-    }
+    #if defined(HAVE_V4L2) && !defined(BSD)
+        vlp_stoppipe(&cnt->pipe, &cnt->pipe_mmap);
+        vlp_stoppipe(&cnt->mpipe, &cnt->mpipe_mmap);
+    #endif /* HAVE_V4L2 && !BSD */
 
     if (cnt->rolling_average_data != NULL) {
         free(cnt->rolling_average_data);
@@ -1549,12 +1976,41 @@ static void motion_cleanup(struct context *cnt)
 
 }
 
-static void mlp_mask_privacy(struct context *cnt)
+/**
+ * mask_privacy_spans
+ *
+ * Apply the privacy mask from its runs: masked luma becomes black and
+ * masked chroma 0x80.  Only the masked bytes of the image are written.
+ */
+static void mask_privacy_spans(unsigned char *image, const struct mask_spans *spans
+        , int size_y, int size_uv)
 {
+    const struct mask_span *span;
+    unsigned char *image_u, *image_v;
+    int indx;
 
-    if (cnt->imgs.mask_privacy == NULL) {
-        return;
+    for (indx = 0; indx < spans->luma_count; indx++) {
+        span = &spans->luma[indx];
+        memset(image + span->offset, 0x00, span->len);
+    }
+
+    image_u = image + size_y;
+    image_v = image_u + size_uv;
+    for (indx = 0; indx < spans->chroma_count; indx++) {
+        span = &spans->chroma[indx];
+        memset(image_u + span->offset, 0x80, span->len);
+        memset(image_v + span->offset, 0x80, span->len);
     }
+}
+
+/**
+ * mask_privacy_image
+ *
+ * Apply the privacy mask to the images of img_data, starting with
+ * the normal (indx_img 1) or only the high resolution image (indx_img 2).
+ */
+static void mask_privacy_image(struct context *cnt, struct image_data *img_data, int indx_img)
+{
 
     /*
     * This function uses long operations to process 4 (32 bit) or 8 (64 bit)
@@ -1568,12 +2024,11 @@ static void mlp_mask_privacy(struct context *cnt)
     int index_y;
     int index_crcb;
     int increment;
-    int indx_img;                /* Counter for how many images we need to apply the mask to */
     int indx_max;                /* 1 if we are only doing norm, 2 if we are doing both norm and high */
+    struct mask_spans *spans;
 
-    indx_img = 1;
     indx_max = 1;
-    if (cnt->imgs.size_high > 0) {
+    if ((cnt->imgs.size_high > 0) && !img_data->high_pending) {
         indx_max = 2;
     }
     increment = sizeof(unsigned long);
@@ -1582,17 +2037,25 @@ static void mlp_mask_privacy(struct context *cnt)
         if (indx_img == 1) {
             /* Normal Resolution */
             index_y = cnt->imgs.height * cnt->imgs.width;
-            image = cnt->current_image->image_norm;
+            image = img_data->image_norm;
             mask = cnt->imgs.mask_privacy;
             index_crcb = cnt->imgs.size_norm - index_y;
             maskuv = cnt->imgs.mask_privacy_uv;
+            spans = &cnt->imgs.mask_privacy_spans;
         } else {
             /* High Resolution */
             index_y = cnt->imgs.height_high * cnt->imgs.width_high;
-            image = cnt->current_image->image_high;
+            image = img_data->image_high;
             mask = cnt->imgs.mask_privacy_high;
             index_crcb = cnt->imgs.size_high - index_y;
             maskuv = cnt->imgs.mask_privacy_high_uv;
+            spans = &cnt->imgs.mask_privacy_high_spans;
+        }
+
+        if (spans->sparse) {
+            mask_privacy_spans(image, spans, index_y, index_crcb / 2);
+            indx_img++;
+            continue;
         }
 
         while (index_y >= increment) {
@@ -1632,6 +2095,169 @@ static void mlp_mask_privacy(struct context *cnt)
     }
 }
 
+static void mlp_mask_privacy(struct context *cnt)
+{
+    if (cnt->imgs.mask_privacy == NULL) {
+        return;
+    }
+
+    mask_privacy_image(cnt, cnt->current_image, 1);
+}
+
+/* Position of the overlay text indx on the normal image */
+static void image_overlay_pos(struct context *cnt, int indx, int *startx, int *starty)
+{
+    if (indx == TEXT_CACHE_CHANGES) {
+        *startx = cnt->imgs.width - 10;
+        *starty = 10;
+    } else if (indx == TEXT_CACHE_LEFT) {
+        *startx = 10;
+        *starty = cnt->imgs.height - (10 * cnt->text_scale);
+    } else {
+        *startx = cnt->imgs.width - 10;
+        *starty = cnt->imgs.height - (10 * cnt->text_scale);
+    }
+}
+
+/**
+ * image_overlay_set
+ *
+ * Keep the overlay texts of img, rendered for the moment it was captured.
+ * They are drawn only when the image is saved, streamed or recorded.  An
+ * empty text is not drawn.
+ */
+static void image_overlay_set(struct context *cnt, struct image_data *img
+            , const char *text[TEXT_CACHE_COUNT])
+{
+    int indx, len, size;
+
+    size = 0;
+    for (indx = 0; indx < TEXT_CACHE_COUNT; indx++) {
+        size += strlen(text[indx]) + 1;
+    }
+    if (size == TEXT_CACHE_COUNT) {
+        img->overlay = 0;
+        return;
+    }
+
+    if (size > img->overlay_alloc) {
+        img->overlay_text = myrealloc(img->overlay_text, size, "image_overlay_set");
+        img->overlay_alloc = size;
+    }
+
+    size = 0;
+    for (indx = 0; indx < TEXT_CACHE_COUNT; indx++) {
+        len = strlen(text[indx]) + 1;
+        memcpy(img->overlay_text + size, text[indx], len);
+        size += len;
+    }
+
+    img->overlay = OVERLAY_NORM;
+    if (cnt->imgs.detect_scale > 1) {
+        img->overlay |= OVERLAY_HIGH;
+    }
+}
+
+/* Draw the overlay texts of img on its normal or its high resolution image */
+static void image_overlay_draw(struct context *cnt, struct image_data *img, int high)
+{
+    int scale = cnt->imgs.detect_scale;
+    int indx, startx, starty;
+    const char *text;
+
+    text = img->overlay_text;
+    for (indx = 0; indx < TEXT_CACHE_COUNT; indx++) {
+        if (*text != '\0') {
+            image_overlay_pos(cnt, indx, &startx, &starty);
+            if (high) {
+                draw_text_cache(&cnt->text_cache[indx + TEXT_CACHE_COUNT], img->image_high
+                    , cnt->imgs.width_high, cnt->imgs.height_high
+                    , startx * scale, starty * scale, text, cnt->text_scale * scale);
+            } else {
+                draw_text_cache(&cnt->text_cache[indx], img->image_norm
+                    , cnt->imgs.width, cnt->imgs.height, startx, starty, text, cnt->text_scale);
+            }
+        }
+        text += strlen(text) + 1;
+    }
+}
+
+/**
+ * motion_image_overlay
+ *
+ * Draw the overlay texts of img_data on its normal image when it is first
+ * used.  Those of the high resolution image are drawn by motion_image_high.
+ */
+void motion_image_overlay(struct context *cnt, struct image_data *img_data)
+{
+    if (!(img_data->overlay & OVERLAY_NORM)) {
+        return;
+    }
+    img_data->overlay &= ~OVERLAY_NORM;
+
+    image_overlay_draw(cnt, img_data, FALSE);
+}
+
+/* Draw what is left of the overlays on the high resolution image */
+static void image_overlay_high(struct context *cnt, struct image_data *img_data)
+{
+    if (img_data->overlay & OVERLAY_HIGH) {
+        image_overlay_draw(cnt, img_data, TRUE);
+    }
+    if (img_data->overlay & OVERLAY_LOCATE_HIGH) {
+        alg_draw_location_high(&img_data->location, &cnt->imgs, img_data->image_high
+            , cnt->locate_motion_style);
+    }
+    img_data->overlay &= ~(OVERLAY_HIGH | OVERLAY_LOCATE_HIGH);
+}
+
+/**
+ * motion_image_high
+ *
+ * Make the high resolution image of img_data ready for use.  When the
+ * camera only decoded the detection size image, the full resolution one
+ * is decoded here from the kept frame then rotated and masked the same
+ * way the normal image was.  Its overlays are then drawn.
+ */
+void motion_image_high(struct context *cnt, struct image_data *img_data)
+{
+    if (!img_data->high_pending) {
+        image_overlay_high(cnt, img_data);
+        return;
+    }
+    img_data->high_pending = FALSE;
+
+    /*
+     * The high resolution camera decoded on demand was not decoding when
+     * the image was captured.  The normal image is scaled up in its place,
+     * it is already rotated and masked.
+     */
+    if (cnt->rtsp_high != NULL) {
+        netcam_rtsp_demand(cnt);
+        if (cnt->imgs.high_scaler == NULL) {
+            cnt->imgs.high_scaler = pic_scaler_init(cnt->imgs.width, cnt->imgs.height
+                , cnt->imgs.width_high, cnt->imgs.height_high);
+        }
+        pic_scaler_run(cnt->imgs.high_scaler, img_data->image_norm, img_data->image_high);
+        image_overlay_high(cnt, img_data);
+        return;
+    }
+
+    if (netcam_decode_high(cnt, img_data) != 0) {
+        memset(img_data->image_high, 0x80, cnt->imgs.size_high);
+        image_overlay_high(cnt, img_data);
+        return;
+    }
+
+    rotate_map_high(cnt, img_data);
+
+    if (cnt->imgs.mask_privacy != NULL) {
+        mask_privacy_image(cnt, img_data, 2);
+    }
+
+    image_overlay_high(cnt, img_data);
+}
+
 static void mlp_areadetect(struct context *cnt)
 {
     int i, j, z = 0;
@@ -1704,14 +2330,24 @@ static void mlp_prepare(struct context *cnt)
         cnt->conf.pre_capture = 0;
     }
 
+    if (cnt->conf.movie_passthrough_preroll < 0) {
+        cnt->conf.movie_passthrough_preroll = 0;
+    }
+
     /*
      * Check if our buffer is still the right size
      * If pre_capture or minimum_motion_frames has been changed
      * via the http remote control we need to re-size the ring buffer
+     * When the pre-roll of the pass through movie is taken from the
+     * packets of the camera, the ring only holds what detection needs.
      */
-    frame_buffer_size = cnt->conf.pre_capture + cnt->conf.minimum_motion_frames;
+    if (cnt->movie_passthrough && (cnt->conf.movie_passthrough_preroll > 0)) {
+        frame_buffer_size = cnt->conf.minimum_motion_frames;
+    } else {
+        frame_buffer_size = cnt->conf.pre_capture + cnt->conf.minimum_motion_frames;
+    }
 
-    if (cnt->imgs.image_ring_size != frame_buffer_size) {
+    if (cnt->imgs.image_ring_request != frame_buffer_size) {
         image_ring_resize(cnt, frame_buffer_size);
     }
 
@@ -1777,6 +2413,11 @@ static void mlp_resetimages(struct context *cnt)
         }
     }
 
+    /* The capture exchanges the images of the slot, so the preview gives it back first */
+    if (cnt->imgs.image_ring_in == cnt->imgs.preview_slot) {
+        image_preview_unpin(cnt);
+    }
+
     /* cnt->current_image points to position in ring where to store image, diffs etc. */
     old_image = cnt->current_image;
     cnt->current_image = &cnt->imgs.image_ring[cnt->imgs.image_ring_in];
@@ -1823,7 +2464,9 @@ static int mlp_retry(struct context *cnt)
         width = cnt->imgs.width;
         height  = cnt->imgs.height;
 
-        cnt->video_dev = vid_start(cnt);
+        capture_lock(cnt);
+            cnt->video_dev = vid_start(cnt);
+        capture_unlock(cnt);
         if (cnt->video_dev < 0) {
             return 0;
         }
@@ -1875,6 +2518,7 @@ static int mlp_capture(struct context *cnt)
     char tmpout[80];
     int vid_return_code = 0;        /* Return code used when calling vid_next */
     struct timeval tv1;
+    struct metrics_timer timer;
 
     /***** MOTION LOOP - IMAGE CAPTURE SECTION *****/
     /*
@@ -1885,11 +2529,15 @@ static int mlp_capture(struct context *cnt)
      * <0 = fatal error - leave the thread by breaking out of the main loop
      * >0 = non fatal error - copy last image or show grey image with message
      */
-    if (cnt->video_dev >= 0) {
+    metrics_start(cnt, &timer);
+    if (cnt->capq) {
+        vid_return_code = capture_next(cnt, cnt->current_image);
+    } else if (cnt->video_dev >= 0) {
         vid_return_code = vid_next(cnt, cnt->current_image);
     } else {
         vid_return_code = 1; /* Non fatal error */
     }
+    metrics_stop(cnt, METRICS_CAPTURE, &timer);
 
     // VALID PICTURE
     if (vid_return_code == 0) {
@@ -1930,7 +2578,9 @@ static int mlp_capture(struct context *cnt)
         /* Fatal error - Close video device */
         MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
             ,_("Video device fatal error - Closing video device"));
-        vid_close(cnt);
+        capture_lock(cnt);
+            vid_close(cnt);
+        capture_unlock(cnt);
         /*
          * Use virgin image, if we are not able to open it again next loop
          * a gray image with message is applied
@@ -1985,6 +2635,7 @@ static int mlp_capture(struct context *cnt)
          * we go straight for the grey error image.
          */
         ++cnt->missing_frame_counter;
+        cnt->metrics.frames_missed++;
 
         if (cnt->video_dev >= 0 &&
             cnt->missing_frame_counter < (MISSING_FRAMES_TIMEOUT * cnt->conf.framerate)) {
@@ -2022,7 +2673,9 @@ static int mlp_capture(struct context *cnt)
                 MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
                     ,_("Video signal still lost - "
                     "Trying to close video device"));
-                vid_close(cnt);
+                capture_lock(cnt);
+                    vid_close(cnt);
+                capture_unlock(cnt);
             }
         }
     }
@@ -2030,9 +2683,70 @@ static int mlp_capture(struct context *cnt)
 
 }
 
-static void mlp_detection(struct context *cnt)
+/** mlp_idle_rates
+ *  Restart the timing history at the frame time of the new rate so the
+ *  loop neither rushes nor drags after the change.
+ */
+static void mlp_idle_rates(struct context *cnt)
+{
+    int indx, rate;
+
+    rate = cnt->idle ? cnt->conf.framerate_idle : cnt->conf.framerate;
+    cnt->required_frame_time = (rate > 0) ? (1000000L / rate) : 0;
+    for (indx = 0; indx < cnt->rolling_average_limit; indx++) {
+        cnt->rolling_average_data[indx] = cnt->required_frame_time;
+    }
+}
+
+/** mlp_idle
+ *  Drop the loop to framerate_idle after framerate_idle_time seconds without
+ *  changes and go back to the framerate on the first frame with changes
+ *  above the alg_diff pre-pass level of half the threshold.  At the idle
+ *  rate every frame is processed, see the rate_limit in mlp_prepare.
+ */
+static void mlp_idle(struct context *cnt)
 {
+    int indx, viewers;
+    time_t now;
+
+    if ((cnt->conf.framerate_idle <= 0) ||
+        (cnt->conf.framerate_idle >= cnt->conf.framerate) ||
+        (cnt->conf.minimum_frame_time > 0)) {
+        if (cnt->idle) {
+            cnt->idle = FALSE;
+            mlp_idle_rates(cnt);
+        }
+        return;
+    }
+
+    viewers = cnt->stream_norm.cnct_count + cnt->stream_sub.cnct_count +
+        cnt->stream_motion.cnct_count + cnt->stream_source.cnct_count;
+    for (indx = 0; indx < STREAM_SCALED_MAX; indx++) {
+        viewers += cnt->stream_scaled[indx].strm.cnct_count;
+    }
+
+    now = cnt->current_image->timestamp_tv.tv_sec;
+    if ((cnt->current_image->diffs > cnt->threshold / 2) ||
+        (cnt->event_nr == cnt->prev_event) || cnt->detecting_motion ||
+        (viewers > 0) || cnt->conf.setup_mode || cnt->lost_connection) {
+        cnt->idle_quiet = now;
+        if (cnt->idle) {
+            MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO, _("Leaving the idle framerate"));
+            cnt->idle = FALSE;
+            mlp_idle_rates(cnt);
+        }
+    } else if (!cnt->idle && (now - cnt->idle_quiet >= cnt->conf.framerate_idle_time)) {
+        MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO
+            ,_("No changes for %d seconds, using the idle framerate of %d")
+            ,cnt->conf.framerate_idle_time, cnt->conf.framerate_idle);
+        cnt->idle = TRUE;
+        mlp_idle_rates(cnt);
+    }
+}
 
+static void mlp_detection(struct context *cnt)
+{
+    struct metrics_timer timer;
 
     /***** MOTION LOOP - MOTION DETECTION SECTION *****/
     /*
@@ -2041,9 +2755,8 @@ static void mlp_detection(struct context *cnt)
      * Make a differences picture in image_out
      *
      * alg_diff_standard is the slower full feature motion detection algorithm
-     * alg_diff first calls a fast detection algorithm which only looks at a
-     * fraction of the pixels. If this detects possible motion alg_diff_standard
-     * is called.
+     * alg_diff first counts the changed pixels per tile of the image. If this
+     * detects possible motion the full diff is only run on the changed tiles.
      */
     if (cnt->process_thisframe) {
         if (cnt->threshold && !cnt->pause) {
@@ -2053,11 +2766,13 @@ static void mlp_detection(struct context *cnt)
              * motion, the alg_diff will trigger alg_diff_standard
              * anyway
              */
+            metrics_start(cnt, &timer);
             if (cnt->detecting_motion || cnt->conf.setup_mode) {
                 cnt->current_image->diffs = alg_diff_standard(cnt, cnt->imgs.image_vprvcy.image_norm);
             } else {
                 cnt->current_image->diffs = alg_diff(cnt, cnt->imgs.image_vprvcy.image_norm);
             }
+            metrics_stop(cnt, METRICS_DIFF, &timer);
 
             /* Lightswitch feature - has light intensity changed?
              * This can happen due to change of light conditions or due to a sudden change of the camera
@@ -2117,7 +2832,9 @@ static void mlp_detection(struct context *cnt)
 
             if (cnt->conf.despeckle_filter && cnt->current_image->diffs > 0) {
                 cnt->olddiffs = cnt->current_image->diffs;
+                metrics_start(cnt, &timer);
                 cnt->current_image->diffs = alg_despeckle(cnt, cnt->olddiffs);
+                metrics_stop(cnt, METRICS_DESPECKLE, &timer);
             } else if (cnt->imgs.labelsize_max) {
                 cnt->imgs.labelsize_max = 0; /* Disable labeling if enabled */
             }
@@ -2128,11 +2845,9 @@ static void mlp_detection(struct context *cnt)
     }
 
     //TODO:  This section needs investigation for purpose, cause and effect
-    /* Manipulate smart_mask sensitivity (only every smartmask_ratio seconds) */
-    if ((cnt->smartmask_speed && (cnt->event_nr != cnt->prev_event)) &&
-        (!--cnt->smartmask_count)) {
+    /* Manipulate smart_mask sensitivity (each pixel every smartmask_ratio frames) */
+    if (cnt->smartmask_speed && (cnt->event_nr != cnt->prev_event)) {
         alg_tune_smartmask(cnt);
-        cnt->smartmask_count = cnt->smartmask_ratio;
     }
 
     /*
@@ -2143,12 +2858,17 @@ static void mlp_detection(struct context *cnt)
      * cnt->diffs = 0.
      * We also pretend to have a moving camera when we start Motion and when light
      * switch has been detected to allow camera to settle.
+     * The commands are sent by the tracking thread so the frames are also
+     * ignored while the camera is still moving.
      */
+    cnt->moved = track_settle(cnt, cnt->moved);
     if (cnt->moved) {
         cnt->moved--;
         cnt->current_image->diffs = 0;
     }
 
+    mlp_idle(cnt);
+
 }
 
 static void mlp_tuning(struct context *cnt)
@@ -2231,6 +2951,8 @@ static void mlp_overlay(struct context *cnt)
 {
 
     char tmp[PATH_MAX];
+    char changes[16], left[PATH_MAX], right[PATH_MAX];
+    const char *text[TEXT_CACHE_COUNT];
 
     /***** MOTION LOOP - TEXT AND GRAPHICS OVERLAY SECTION *****/
     /*
@@ -2259,16 +2981,21 @@ static void mlp_overlay(struct context *cnt)
         overlay_fixed_mask(cnt, cnt->imgs.img_motion.image_norm);
     }
 
+    /*
+     * The texts of the pictures are rendered now but only drawn when the
+     * image is saved, streamed or recorded, see motion_image_overlay.
+     */
+    changes[0] = '\0';
+    left[0] = '\0';
+    right[0] = '\0';
+
     /* Add changed pixels in upper right corner of the pictures */
     if (cnt->conf.text_changes) {
         if (!cnt->pause) {
-            sprintf(tmp, "%d", cnt->current_image->diffs);
+            sprintf(changes, "%d", cnt->current_image->diffs);
         } else {
-            sprintf(tmp, "-");
+            sprintf(changes, "-");
         }
-
-        draw_text(cnt->current_image->image_norm, cnt->imgs.width, cnt->imgs.height,
-                  cnt->imgs.width - 10, 10, tmp, cnt->text_scale);
     }
 
     /*
@@ -2289,21 +3016,21 @@ static void mlp_overlay(struct context *cnt)
 
     /* Add text in lower left corner of the pictures */
     if (cnt->conf.text_left) {
-        mystrftime(cnt, tmp, sizeof(tmp), cnt->conf.text_left,
+        mystrftime(cnt, left, sizeof(left), cnt->conf.text_left,
                    &cnt->current_image->timestamp_tv, NULL, 0);
-        draw_text(cnt->current_image->image_norm, cnt->imgs.width, cnt->imgs.height,
-                  10, cnt->imgs.height - (10 * cnt->text_scale), tmp, cnt->text_scale);
     }
 
     /* Add text in lower right corner of the pictures */
     if (cnt->conf.text_right) {
-        mystrftime(cnt, tmp, sizeof(tmp), cnt->conf.text_right,
+        mystrftime(cnt, right, sizeof(right), cnt->conf.text_right,
                    &cnt->current_image->timestamp_tv, NULL, 0);
-        draw_text(cnt->current_image->image_norm, cnt->imgs.width, cnt->imgs.height,
-                  cnt->imgs.width - 10, cnt->imgs.height - (10 * cnt->text_scale),
-                  tmp, cnt->text_scale);
     }
 
+    text[TEXT_CACHE_CHANGES] = changes;
+    text[TEXT_CACHE_LEFT] = left;
+    text[TEXT_CACHE_RIGHT] = right;
+    image_overlay_set(cnt, cnt->current_image, text);
+
 }
 
 static void mlp_actions(struct context *cnt)
@@ -2454,7 +3181,7 @@ static void mlp_actions(struct context *cnt)
             event(cnt, EVENT_ENDMOTION, NULL, NULL, NULL, &cnt->current_image->timestamp_tv);
 
             if (cnt->track.type) {
-                cnt->moved = track_center(cnt, cnt->video_dev, 0, 0, 0);
+                track_center(cnt, cnt->video_dev, 0, 0, 0);
             }
 
             MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("End of event %d"), cnt->event_nr);
@@ -2482,6 +3209,12 @@ static void mlp_actions(struct context *cnt)
         event(cnt, EVENT_MOVIE_START, NULL, NULL, NULL, &cnt->current_image->timestamp_tv);
     }
 
+    /* Have the high resolution decoded while there is motion, see netcam_rtsp_demand */
+    if ((cnt->rtsp_high != NULL) &&
+        ((cnt->event_nr == cnt->prev_event) || (cnt->current_image->flags & IMAGE_MOTION))) {
+        netcam_rtsp_demand(cnt);
+    }
+
 }
 
 static void mlp_setupmode(struct context *cnt)
@@ -2497,7 +3230,7 @@ static void mlp_setupmode(struct context *cnt)
             snprintf(part, 99, _("Raw changes: %5d - changes after '%s': %5d"),
                      cnt->olddiffs, cnt->conf.despeckle_filter, cnt->current_image->diffs);
             strcat(msg, part);
-            if (strchr(cnt->conf.despeckle_filter, 'l')) {
+            if (strchr(cnt->conf.despeckle_filter, 'l') || strchr(cnt->conf.despeckle_filter, 'L')) {
                 snprintf(part, 99,_(" - labels: %3d"), cnt->current_image->total_labels);
                 strcat(msg, part);
             }
@@ -2649,6 +3382,64 @@ static void mlp_loopback(struct context *cnt)
 
     event(cnt, EVENT_IMAGEM, &cnt->imgs.img_motion, NULL, &cnt->mpipe, &cnt->current_image->timestamp_tv);
 
+    webu_hls_put(cnt);
+
+    shmexport_put(cnt);
+
+}
+
+/**
+ * motion_reload_take
+ *
+ *   Apply the config of a reload handed to the camera, see motion_reload.
+ *   Changes of the options used when the camera starts are only taken
+ *   when restarting, by motion_start_thread.
+ *
+ * Returns: the CONF_RELOAD flags of the changes applied
+ */
+static int motion_reload_take(struct context *cnt, int restarting)
+{
+    struct context *cnt_new;
+    int changes;
+
+    pthread_mutex_lock(&global_lock);
+        cnt_new = cnt->reload;
+        changes = cnt->reload_changes;
+        if ((cnt_new != NULL) && (restarting || !(changes & CONF_RELOAD_CAMERA))) {
+            cnt->reload = NULL;
+            cnt->reload_changes = 0;
+        } else {
+            cnt_new = NULL;
+        }
+    pthread_mutex_unlock(&global_lock);
+
+    if (cnt_new == NULL) {
+        return 0;
+    }
+
+    conf_reload_apply(cnt, cnt_new);
+    context_destroy(cnt_new);
+
+    return changes;
+}
+
+static void mlp_reload(struct context *cnt)
+{
+    int changes;
+
+    changes = motion_reload_take(cnt, FALSE);
+    if (changes == 0) {
+        return;
+    }
+
+    if (changes & CONF_RELOAD_MASK) {
+        free_masks(cnt);
+        init_mask(cnt);
+        init_mask_privacy(cnt);
+        alg_init_tiles(cnt);
+    }
+
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Config changes applied"));
 }
 
 static void mlp_parmsupdate(struct context *cnt)
@@ -2660,6 +3451,8 @@ static void mlp_parmsupdate(struct context *cnt)
         return;
     }
 
+    mlp_reload(cnt);
+
     init_text_scale(cnt);  /* Initialize and validate text_scale */
 
     if (mystrceq(cnt->conf.picture_output, "on")) {
@@ -2705,6 +3498,11 @@ static void mlp_parmsupdate(struct context *cnt)
         if (cnt->conf.smart_mask_speed == 0) {
             memset(cnt->imgs.smartmask, 0, cnt->imgs.motionsize);
             memset(cnt->imgs.smartmask_final, 255, cnt->imgs.motionsize);
+            #ifdef HAVE_OPENCL
+                if (cnt->opencl != NULL) {
+                    alg_opencl_smartmask_put(cnt, 0, cnt->imgs.height);
+                }
+            #endif
         }
 
         cnt->smartmask_lastrate = cnt->lastrate;
@@ -2717,6 +3515,7 @@ static void mlp_parmsupdate(struct context *cnt)
     }
 
     dbse_sqlmask_update(cnt);
+    dbse_commit_due(cnt);
 
     cnt->threshold = cnt->conf.threshold;
     if (cnt->conf.threshold_maximum > cnt->conf.threshold ) {
@@ -2734,7 +3533,7 @@ static void mlp_parmsupdate(struct context *cnt)
 static void mlp_frametiming(struct context *cnt)
 {
 
-    int indx;
+    int indx, rate;
     struct timeval tv2;
     unsigned long int elapsedtime;  //TODO: Need to evaluate logic for needing this.
     long int delay_time_nsec;
@@ -2742,10 +3541,12 @@ static void mlp_frametiming(struct context *cnt)
     /***** MOTION LOOP - FRAMERATE TIMING AND SLEEPING SECTION *****/
     /*
      * Work out expected frame rate based on config setting which may
-     * have changed from http-control
+     * have changed from http-control.  The rate is read once since the
+     * web control may set it to 0 at any time.
      */
-    if (cnt->conf.framerate) {
-        cnt->required_frame_time = 1000000L / cnt->conf.framerate;
+    rate = cnt->idle ? cnt->conf.framerate_idle : cnt->conf.framerate;
+    if (rate > 0) {
+        cnt->required_frame_time = 1000000L / rate;
     } else {
         cnt->required_frame_time = 0;
     }
@@ -2779,7 +3580,11 @@ static void mlp_frametiming(struct context *cnt)
     cnt->rolling_average /= cnt->rolling_average_limit;
     cnt->frame_delay = cnt->required_frame_time - elapsedtime - (cnt->rolling_average - cnt->required_frame_time);
 
-    if (cnt->frame_delay > 0) {
+    /*
+     * The capture thread paces the device and capture_next waits for it.
+     * The worker pool schedules the camera again after frame_delay.
+     */
+    if ((cnt->frame_delay > 0) && (cnt->capq == NULL) && !cnt->pool_run) {
         /* Apply delay to meet frame time */
         if (cnt->frame_delay > cnt->required_frame_time) {
             cnt->frame_delay = cnt->required_frame_time;
@@ -2799,40 +3604,71 @@ static void mlp_frametiming(struct context *cnt)
 }
 
 /**
- * motion_loop
- *
- *   Thread function for the motion handling threads.
+ * motion_loop_step
  *
+ *   One pass of the motion loop for a single frame.
+ *   Returns 1 when the camera needs to end.
  */
-static void *motion_loop(void *arg)
+static int motion_loop_step(struct context *cnt)
 {
-    struct context *cnt = arg;
-
-    if (motion_init(cnt) == 0) {
-        while (!cnt->finish || cnt->event_stop) {
-            mlp_prepare(cnt);
-            if (cnt->get_image) {
-                mlp_resetimages(cnt);
-                if (mlp_retry(cnt) == 1) {
-                    break;
-                }
-                if (mlp_capture(cnt) == 1)  {
-                    break;
-                }
-                mlp_detection(cnt);
-                mlp_tuning(cnt);
-                mlp_overlay(cnt);
-                mlp_actions(cnt);
-                mlp_setupmode(cnt);
-            }
-            mlp_snapshot(cnt);
-            mlp_timelapse(cnt);
-            mlp_loopback(cnt);
-            mlp_parmsupdate(cnt);
-            mlp_frametiming(cnt);
+    struct metrics_timer timer;
+    struct trace_span span;
+    struct timespec cpu;
+    int captured;
+
+    loadtest_step_start(cnt, &cpu);
+    trace_begin(&span);
+    trace_stage_start();
+    mlp_prepare(cnt);
+    captured = cnt->get_image;
+    trace_stage("mlp_prepare");
+    if (cnt->get_image) {
+        mlp_resetimages(cnt);
+        trace_stage("mlp_resetimages");
+        if (mlp_retry(cnt) == 1) {
+            return 1;
         }
-    }
+        trace_stage("mlp_retry");
+        if (mlp_capture(cnt) == 1)  {
+            return 1;
+        }
+        trace_stage("mlp_capture");
+        mlp_detection(cnt);
+        trace_stage("mlp_detection");
+        mlp_tuning(cnt);
+        trace_stage("mlp_tuning");
+        metrics_start(cnt, &timer);
+        mlp_overlay(cnt);
+        metrics_stop(cnt, METRICS_OVERLAY, &timer);
+        trace_stage("mlp_overlay");
+        metrics_start(cnt, &timer);
+        mlp_actions(cnt);
+        metrics_stop(cnt, METRICS_ACTIONS, &timer);
+        trace_stage("mlp_actions");
+        mlp_setupmode(cnt);
+        trace_stage("mlp_setupmode");
+    }
+    mlp_snapshot(cnt);
+    trace_stage("mlp_snapshot");
+    mlp_timelapse(cnt);
+    trace_stage("mlp_timelapse");
+    mlp_loopback(cnt);
+    trace_stage("mlp_loopback");
+    mlp_parmsupdate(cnt);
+    trace_stage("mlp_parmsupdate");
+    picwriter_collect(cnt);
+    metrics_frame(cnt);
+    trace_stage("picwriter_collect");
+    trace_end("frame", &span);
+    loadtest_step_end(cnt, &cpu, captured);
+    mlp_frametiming(cnt);
+    trace_stage("mlp_frametiming");
+
+    return 0;
+}
 
+static void motion_loop_end(struct context *cnt)
+{
     cnt->lost_connection = 1;
     MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Thread exiting"));
 
@@ -2841,23 +3677,399 @@ static void *motion_loop(void *arg)
     pthread_mutex_lock(&global_lock);
         threads_running--;
     pthread_mutex_unlock(&global_lock);
-
-    cnt->running = 0;
-    cnt->finish = 0;
-
-    pthread_exit(NULL);
 }
 
 /**
- * become_daemon
- *
- *   Turns Motion into a daemon through forking. The parent process (i.e. the
- *   one initially calling this function) will exit inside this function, while
- *   control will be returned to the child process. Standard input/output are
- *   released properly, and the current directory is set to / in order to not
- *   lock up any file system.
+ * motion_loop
  *
- * Parameters:
+ *   Thread function for the motion handling threads.
+ *
+ */
+static void *motion_loop(void *arg)
+{
+    struct context *cnt = arg;
+    int retcd;
+
+    retcd = motion_init(cnt);
+    cnt->connecting = FALSE;
+    if (retcd == 0) {
+        while (!cnt->finish || cnt->event_stop) {
+            if (motion_loop_step(cnt) == 1) {
+                break;
+            }
+        }
+    }
+
+    motion_loop_end(cnt);
+
+    cnt->running = 0;
+    cnt->finish = 0;
+
+    pthread_exit(NULL);
+}
+
+/**
+ * motion_pool
+ *
+ *   When worker_threads is set, a fixed number of worker threads runs the
+ *   motion loop steps of all the cameras instead of one thread per camera.
+ *   Each camera is due again frame_delay after its step, as computed by
+ *   mlp_frametiming, and a free worker always takes the camera that is most
+ *   overdue.  When the workers fall behind, all cameras are delayed evenly
+ *   instead of the first cameras taking all the time.
+ */
+struct motion_pool_worker {
+    int             indx;
+    struct context  *cnt;           /* Camera the worker is running a step for */
+    int             locked;         /* Worker holds motion_pool.mutex */
+};
+
+static struct {
+    pthread_mutex_t             mutex;
+    pthread_cond_t              cond;
+    struct context              **cams;     /* Cameras scheduled by the pool */
+    int                         cams_count;
+    int                         cams_size;
+    struct motion_pool_worker   *workers;
+    int                         size;       /* Number of workers, 0 when not in use */
+    int                         running;    /* Number of worker threads alive */
+    int                         finish;
+} motion_pool;
+
+static unsigned long long int motion_pool_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_usec + 1000000ULL * tv.tv_sec;
+}
+
+/* Must be called with motion_pool.mutex held */
+static void motion_pool_remove(struct context *cnt)
+{
+    int indx;
+
+    for (indx = 0; indx < motion_pool.cams_count; indx++) {
+        if (motion_pool.cams[indx] == cnt) {
+            motion_pool.cams[indx] = motion_pool.cams[--motion_pool.cams_count];
+            break;
+        }
+    }
+}
+
+/**
+ * motion_pool_step
+ *
+ *   Runs one pass of the motion loop.  Returns 1 when the camera has ended.
+ */
+static int motion_pool_step(struct context *cnt)
+{
+    if ((cnt->finish && !cnt->event_stop) || (motion_loop_step(cnt) == 1)) {
+        motion_loop_end(cnt);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void *motion_pool_handler(void *arg);
+
+/* Must be called with motion_pool.mutex held */
+static void motion_pool_spawn(struct motion_pool_worker *wrk)
+{
+    pthread_t thread_id;
+    pthread_attr_t thread_attr;
+
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread_id, &thread_attr, &motion_pool_handler, wrk) == 0) {
+        motion_pool.running++;
+    } else {
+        MOTION_LOG(ERR, TYPE_ALL, SHOW_ERRNO
+            ,_("Unable to start worker thread %d"), wrk->indx);
+    }
+    pthread_attr_destroy(&thread_attr);
+}
+
+/**
+ * motion_pool_cancelled
+ *
+ *   Cleanup handler for a worker cancelled by the watchdog.  The camera it
+ *   was running is flagged for motion_watchdog to clean up and a new worker
+ *   takes its place.
+ */
+static void motion_pool_cancelled(void *arg)
+{
+    struct motion_pool_worker *wrk = arg;
+
+    if (!wrk->locked) {
+        pthread_mutex_lock(&motion_pool.mutex);
+    }
+    if (wrk->cnt != NULL) {
+        motion_pool_remove(wrk->cnt);
+        wrk->cnt->pool_busy = FALSE;
+        wrk->cnt->pool_killed = TRUE;
+        wrk->cnt = NULL;
+    }
+    motion_pool.running--;
+    if (!motion_pool.finish) {
+        motion_pool_spawn(wrk);
+    }
+    pthread_mutex_unlock(&motion_pool.mutex);
+}
+
+static void *motion_pool_handler(void *arg)
+{
+    struct motion_pool_worker *wrk = arg;
+    struct context *cnt;
+    struct timespec ts;
+    unsigned long long int now;
+    int indx, retcd;
+
+    util_threadname_set("wp", wrk->indx, NULL);
+
+    /* Only a running step may be cancelled, see motion_pool_cancel */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    pthread_cleanup_push(motion_pool_cancelled, wrk);
+
+    pthread_mutex_lock(&motion_pool.mutex);
+    wrk->locked = TRUE;
+    wrk->cnt = NULL;
+
+    while (!motion_pool.finish) {
+        cnt = NULL;
+        for (indx = 0; indx < motion_pool.cams_count; indx++) {
+            if (!motion_pool.cams[indx]->pool_busy &&
+                ((cnt == NULL) || (motion_pool.cams[indx]->pool_due < cnt->pool_due))) {
+                cnt = motion_pool.cams[indx];
+            }
+        }
+        if (cnt == NULL) {
+            pthread_cond_wait(&motion_pool.cond, &motion_pool.mutex);
+            continue;
+        }
+
+        now = motion_pool_now();
+        if (cnt->pool_due > now) {
+            ts.tv_sec = cnt->pool_due / 1000000;
+            ts.tv_nsec = (cnt->pool_due % 1000000) * 1000;
+            pthread_cond_timedwait(&motion_pool.cond, &motion_pool.mutex, &ts);
+            continue;
+        }
+
+        cnt->pool_busy = TRUE;
+        cnt->thread_id = pthread_self();
+        wrk->cnt = cnt;
+        wrk->locked = FALSE;
+        pthread_mutex_unlock(&motion_pool.mutex);
+
+        pthread_setspecific(tls_key_threadnr, (void *)((unsigned long)cnt->threadnr));
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+        retcd = motion_pool_step(cnt);
+
+        pthread_mutex_lock(&motion_pool.mutex);
+        wrk->locked = TRUE;
+        /* A cancel sent while the step was running is acted upon here */
+        pthread_testcancel();
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        pthread_setspecific(tls_key_threadnr, (void *)(0));
+
+        wrk->cnt = NULL;
+        cnt->pool_busy = FALSE;
+        if (retcd == 1) {
+            motion_pool_remove(cnt);
+            cnt->running = 0;
+            cnt->finish = 0;
+        } else {
+            cnt->pool_due = motion_pool_now();
+            if (cnt->frame_delay > 0) {
+                cnt->pool_due += cnt->frame_delay;
+            }
+            /* Another camera may now be the earliest */
+            pthread_cond_signal(&motion_pool.cond);
+        }
+    }
+
+    motion_pool.running--;
+    wrk->locked = FALSE;
+    pthread_mutex_unlock(&motion_pool.mutex);
+
+    pthread_cleanup_pop(0);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * motion_pool_start
+ *
+ *   Starts the worker threads when worker_threads is set.  A negative value
+ *   uses one worker per CPU core.  No more workers than cameras are started.
+ */
+static void motion_pool_start(void)
+{
+    int indx, cams;
+
+    motion_pool.size = 0;
+
+    if (cnt_list[0]->conf.worker_threads == 0) {
+        return;
+    }
+
+    motion_pool.size = cnt_list[0]->conf.worker_threads;
+    if (motion_pool.size < 0) {
+        motion_pool.size = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    for (cams = 0; cnt_list[cams + (cnt_list[1] != NULL ? 1 : 0)]; cams++);
+    if (motion_pool.size > cams) {
+        motion_pool.size = cams;
+    }
+    if (motion_pool.size < 1) {
+        motion_pool.size = 1;
+    }
+
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+        ,_("Running %d cameras on %d worker threads"), cams, motion_pool.size);
+
+    pthread_mutex_init(&motion_pool.mutex, NULL);
+    pthread_cond_init(&motion_pool.cond, NULL);
+
+    motion_pool.cams = NULL;
+    motion_pool.cams_count = 0;
+    motion_pool.cams_size = 0;
+    motion_pool.finish = FALSE;
+    motion_pool.running = 0;
+
+    motion_pool.workers = mymalloc(motion_pool.size * sizeof(struct motion_pool_worker));
+    memset(motion_pool.workers, 0, motion_pool.size * sizeof(struct motion_pool_worker));
+
+    pthread_mutex_lock(&motion_pool.mutex);
+        for (indx = 0; indx < motion_pool.size; indx++) {
+            motion_pool.workers[indx].indx = indx + 1;
+            motion_pool_spawn(&motion_pool.workers[indx]);
+        }
+    pthread_mutex_unlock(&motion_pool.mutex);
+}
+
+/**
+ * motion_pool_stop
+ *
+ *   Stops the worker threads once all the cameras have ended.
+ */
+static void motion_pool_stop(void)
+{
+    int wait_counter;
+
+    if (motion_pool.size == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&motion_pool.mutex);
+        motion_pool.finish = TRUE;
+        pthread_cond_broadcast(&motion_pool.cond);
+    pthread_mutex_unlock(&motion_pool.mutex);
+
+    wait_counter = 50;
+    while ((motion_pool.running > 0) && (wait_counter > 0)) {
+        SLEEP(0, 100000000);
+        wait_counter--;
+    }
+    if (motion_pool.running > 0) {
+        MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
+            ,_("%d worker threads did not stop"), motion_pool.running);
+        /* Leave the pool allocated since the workers may still use it */
+        motion_pool.size = 0;
+        return;
+    }
+
+    free(motion_pool.cams);
+    motion_pool.cams = NULL;
+    free(motion_pool.workers);
+    motion_pool.workers = NULL;
+    pthread_cond_destroy(&motion_pool.cond);
+    pthread_mutex_destroy(&motion_pool.mutex);
+
+    motion_pool.size = 0;
+}
+
+/**
+ * motion_pool_add
+ *
+ *   Schedules a camera on the worker pool in place of starting its thread.
+ */
+static void motion_pool_add(struct context *cnt)
+{
+    pthread_mutex_lock(&motion_pool.mutex);
+        if (motion_pool.cams_count == motion_pool.cams_size) {
+            motion_pool.cams_size += 8;
+            motion_pool.cams = myrealloc(motion_pool.cams
+                , motion_pool.cams_size * sizeof(struct context *), "motion_pool_add");
+        }
+        cnt->pool_run = TRUE;
+        cnt->pool_busy = FALSE;
+        cnt->pool_killed = FALSE;
+        cnt->pool_due = motion_pool_now();
+        motion_pool.cams[motion_pool.cams_count++] = cnt;
+        pthread_cond_signal(&motion_pool.cond);
+    pthread_mutex_unlock(&motion_pool.mutex);
+}
+
+/**
+ * motion_pool_connect
+ *
+ *   Thread that runs motion_init for a camera of the pool so opening the
+ *   camera does not hold up a worker and the other cameras.  The camera is
+ *   scheduled on the pool once it is set up.
+ */
+static void *motion_pool_connect(void *arg)
+{
+    struct context *cnt = arg;
+    int retcd;
+
+    pthread_setspecific(tls_key_threadnr, (void *)((unsigned long)cnt->threadnr));
+
+    retcd = motion_init(cnt);
+    cnt->connecting = FALSE;
+    if (retcd == 0) {
+        motion_pool_add(cnt);
+    } else {
+        motion_loop_end(cnt);
+        cnt->running = 0;
+        cnt->finish = 0;
+    }
+
+    pthread_exit(NULL);
+}
+
+/**
+ * motion_pool_cancel
+ *
+ *   Watchdog kill for a camera run by the pool.  A camera that is running
+ *   on a worker gets that worker cancelled.  Otherwise it is taken out of
+ *   the schedule and flagged the same way as a cancelled worker would.
+ */
+static void motion_pool_cancel(struct context *cnt)
+{
+    pthread_mutex_lock(&motion_pool.mutex);
+        if (cnt->pool_busy) {
+            pthread_cancel(cnt->thread_id);
+        } else if (!cnt->pool_killed) {
+            motion_pool_remove(cnt);
+            cnt->pool_killed = TRUE;
+        }
+    pthread_mutex_unlock(&motion_pool.mutex);
+}
+
+/**
+ * become_daemon
+ *
+ *   Turns Motion into a daemon through forking. The parent process (i.e. the
+ *   one initially calling this function) will exit inside this function, while
+ *   control will be returned to the child process. Standard input/output are
+ *   released properly, and the current directory is set to / in order to not
+ *   lock up any file system.
+ *
+ * Parameters:
  *
  *   cnt - current thread's context struct
  *
@@ -2958,6 +4170,8 @@ static void become_daemon(void)
 
 static void cntlist_create(int argc, char *argv[])
 {
+    int indx;
+
     /*
      * cnt_list is an array of pointers to the context structures cnt for each thread.
      * First we reserve room for a pointer to thread 0's context structure
@@ -2987,18 +4201,31 @@ static void cntlist_create(int argc, char *argv[])
     cnt_list[0]->conf.argv = argv;
     cnt_list[0]->conf.argc = argc;
     cnt_list = conf_load(cnt_list);
+
+    /* Kept before the cameras change their options, see motion_reload */
+    for (indx = 0; cnt_list[indx]; indx++) {
+        cnt_list[indx]->conf_loaded = conf_reload_keep(cnt_list[indx]);
+        pthread_mutex_init(&cnt_list[indx]->mutex_stream, NULL);
+        pthread_cond_init(&cnt_list[indx]->cond_stream, NULL);
+    }
 }
 
 static void motion_shutdown(void)
 {
     int indx;
 
+    log_stop();
+
     motion_remove_pid();
 
     webu_stop(cnt_list);
 
     indx = -1;
     while (cnt_list[++indx]) {
+        mot_stream_free(cnt_list[indx]);
+        if (cnt_list[indx]->reload != NULL) {
+            context_destroy(cnt_list[indx]->reload);
+        }
         context_destroy(cnt_list[indx]);
     }
 
@@ -3006,6 +4233,10 @@ static void motion_shutdown(void)
     cnt_list = NULL;
 
     vid_mutex_destroy();
+
+    trace_deinit();
+
+    spawner_deinit();
 }
 
 static void motion_camera_ids(void)
@@ -3211,6 +4442,20 @@ static void motion_startup(int daemonize, int argc, char *argv[])
 
     motion_ntc();
 
+    /* Before the image buffers are allocated so the helper stays small */
+    spawner_init();
+
+    /* After the fork of the daemon and the helper */
+    log_start();
+
+    trace_init(cnt_list[0]->conf.trace_buffer);
+
+    alg_simd_init();
+    vid_simd_init();
+
+    framepool_init(cnt_list[0]->conf.frame_pool_budget
+        , cnt_list[0]->conf.memory_hugepages, cnt_list[0]->conf.memory_numa);
+
     motion_camera_ids();
 
     initialize_chars();
@@ -3239,6 +4484,12 @@ static void motion_start_thread(struct context *cnt)
     char service[6];
     pthread_attr_t thread_attr;
 
+    /* A reload waiting for the camera to restart */
+    if (motion_reload_take(cnt, TRUE) != 0) {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("Camera ID: %d config changes applied"), cnt->camera_id);
+    }
+
     if (mystrne(cnt->conf_filename, "")) {
         cnt->conf_filename[sizeof(cnt->conf_filename) - 1] = '\0';
         MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Camera ID: %d is from %s")
@@ -3311,12 +4562,22 @@ static void motion_start_thread(struct context *cnt)
      * start another thread for this device. */
     cnt->running = 1;
 
+    /*
+     * The camera is opened by its own thread, also when it is then run by
+     * the worker pool, so the cameras connect in parallel and an offline
+     * camera does not hold up the others.
+     */
+    cnt->connecting = TRUE;
+    cnt->pool_run = (motion_pool.size > 0);
+
     pthread_attr_init(&thread_attr);
     pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
 
-    if (pthread_create(&cnt->thread_id, &thread_attr, &motion_loop, cnt)) {
+    if (pthread_create(&cnt->thread_id, &thread_attr
+            , cnt->pool_run ? &motion_pool_connect : &motion_loop, cnt)) {
         /* thread create failed, undo running state */
         cnt->running = 0;
+        cnt->connecting = FALSE;
         pthread_mutex_lock(&global_lock);
         threads_running--;
         pthread_mutex_unlock(&global_lock);
@@ -3343,6 +4604,152 @@ static void motion_restart(int argc, char **argv)
     restart = 0;
 }
 
+/**
+ * motion_reload_handover
+ *
+ *   Give the config read again to a running camera.  An older reload the
+ *   camera has not taken yet is replaced, the new one takes over its changes
+ *   and the options the camera was read with.
+ */
+static void motion_reload_handover(struct context *cnt, struct context *cnt_new, int changes)
+{
+    struct context *cnt_old, *cnt_kept;
+
+    pthread_mutex_lock(&global_lock);
+        cnt_old = cnt->reload;
+        if (cnt_old != NULL) {
+            changes |= cnt->reload_changes;
+            /* The camera still runs with the options the older reload was compared to */
+            cnt_kept = cnt_new->conf_loaded;
+            cnt_new->conf_loaded = cnt_old->conf_loaded;
+            cnt_old->conf_loaded = cnt_kept;
+        }
+        cnt->reload = cnt_new;
+        cnt->reload_changes = changes;
+        if ((changes & CONF_RELOAD_CAMERA) && cnt->running) {
+            cnt->restart = TRUE;
+            cnt->event_stop = TRUE;
+            cnt->finish = TRUE;
+        }
+    pthread_mutex_unlock(&global_lock);
+
+    if (cnt_old != NULL) {
+        context_destroy(cnt_old);
+    }
+
+    if (changes & CONF_RELOAD_CAMERA) {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("Camera ID: %d restarting for the config changes"), cnt->camera_id);
+    }
+}
+
+/**
+ * motion_reload
+ *
+ *   Read the config files again on SIGHUP and apply the options that
+ *   changed.  The options a camera reads as it goes, and its masks, are
+ *   applied by the camera thread without stopping it.  A camera with
+ *   changed options that are only used when it starts is restarted alone.
+ *   When cameras were added or removed, or an option of the main thread or
+ *   web control changed, Motion is restarted as a whole.
+ */
+static void motion_reload(void)
+{
+    struct context **cnt_new;
+    int *changes;
+    int indx, full;
+
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Reading the config files again"));
+
+    if (cnt_list[0]->loadtest_cameras > 0) {
+        motion_restart_all();
+        return;
+    }
+
+    cnt_new = mymalloc(sizeof(struct context *) * 2);
+    cnt_new[0] = mymalloc(sizeof(struct context));
+    context_init(cnt_new[0]);
+    cnt_new[1] = NULL;
+    cnt_new[0]->conf.argv = cnt_list[0]->conf.argv;
+    cnt_new[0]->conf.argc = cnt_list[0]->conf.argc;
+
+    cnt_new = conf_load(cnt_new);
+
+    full = FALSE;
+    for (indx = 0; cnt_new[indx]; indx++) {
+        if ((cnt_list[indx] == NULL) ||
+            mystrne(cnt_list[indx]->conf_filename, cnt_new[indx]->conf_filename)) {
+            full = TRUE;
+        }
+    }
+    if (cnt_list[indx] != NULL) {
+        full = TRUE;
+    }
+
+    changes = mymalloc(sizeof(int) * (indx + 1));
+    for (indx = 0; !full && cnt_new[indx]; indx++) {
+        changes[indx] = conf_reload_changes(cnt_list[indx], cnt_new[indx]);
+        if (changes[indx] & CONF_RELOAD_ALL) {
+            full = TRUE;
+        }
+    }
+
+    if (full) {
+        for (indx = 0; cnt_new[indx]; indx++) {
+            context_destroy(cnt_new[indx]);
+        }
+        free(cnt_new);
+        free(changes);
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("The cameras or the main options changed, restarting Motion"));
+        motion_restart_all();
+        return;
+    }
+
+    /*
+     * The options are compared as read from the files.  The reload holds the
+     * ones the context was read with for conf_reload_apply and the new ones
+     * are kept for the next reload, before the defaults below are put in.
+     */
+    for (indx = 0; cnt_new[indx]; indx++) {
+        if (changes[indx] != 0) {
+            cnt_new[indx]->conf_loaded = cnt_list[indx]->conf_loaded;
+            cnt_list[indx]->conf_loaded = conf_reload_keep(cnt_new[indx]);
+        }
+    }
+
+    /* The defaults put in by motion_startup and motion_init */
+    if ((cnt_new[0]->conf.log_level > ALL) || (cnt_new[0]->conf.log_level == 0)) {
+        cnt_new[0]->conf.log_level = LEVEL_DEFAULT;
+    }
+    if ((cnt_new[0]->conf.log_type == NULL) ||
+        !(get_log_type(cnt_new[0]->conf.log_type))) {
+        free(cnt_new[0]->conf.log_type);
+        cnt_new[0]->conf.log_type = mystrdup("ALL");
+    }
+    for (indx = 0; cnt_new[indx]; indx++) {
+        if ((cnt_new[indx]->conf.target_dir == NULL) && ((indx > 0) || (cnt_new[1] == NULL))) {
+            cnt_new[indx]->conf.target_dir = mystrdup(".");
+        }
+    }
+
+    for (indx = 0; cnt_new[indx]; indx++) {
+        if (changes[indx] == 0) {
+            context_destroy(cnt_new[indx]);
+        } else if (((indx == 0) && (cnt_list[1] != NULL)) ||
+            (!cnt_list[indx]->running && !cnt_list[indx]->restart)) {
+            /* The main context, or a camera that was stopped */
+            conf_reload_apply(cnt_list[indx], cnt_new[indx]);
+            context_destroy(cnt_new[indx]);
+        } else {
+            motion_reload_handover(cnt_list[indx], cnt_new[indx], changes[indx]);
+        }
+    }
+
+    free(cnt_new);
+    free(changes);
+}
+
 static void motion_watchdog(int indx)
 {
 
@@ -3364,6 +4771,12 @@ static void motion_watchdog(int indx)
         return;
     }
 
+    /* The connects to the camera have their own timeouts */
+    if (cnt_list[indx]->connecting) {
+        cnt_list[indx]->watchdog = cnt_list[indx]->conf.watchdog_tmo;
+        return;
+    }
+
     cnt_list[indx]->watchdog--;
     if (cnt_list[indx]->watchdog == 0) {
         MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
@@ -3389,7 +4802,14 @@ static void motion_watchdog(int indx)
             (cnt_list[indx]->netcam != NULL)) {
             pthread_cancel(cnt_list[indx]->netcam->thread_id);
         }
-        pthread_cancel(cnt_list[indx]->thread_id);
+        if (cnt_list[indx]->capq != NULL) {
+            pthread_cancel(cnt_list[indx]->capq->thread_id);
+        }
+        if (cnt_list[indx]->pool_run) {
+            motion_pool_cancel(cnt_list[indx]);
+        } else {
+            pthread_cancel(cnt_list[indx]->thread_id);
+        }
     }
 
     if (cnt_list[indx]->watchdog < -cnt_list[indx]->conf.watchdog_kill) {
@@ -3433,7 +4853,8 @@ static void motion_watchdog(int indx)
             }
         }
         if (cnt_list[indx]->running &&
-            pthread_kill(cnt_list[indx]->thread_id, 0) == ESRCH) {
+            (cnt_list[indx]->pool_run ? cnt_list[indx]->pool_killed :
+            pthread_kill(cnt_list[indx]->thread_id, 0) == ESRCH)) {
             MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO
                 ,_("Thread %d - Cleaning thread.")
                 , cnt_list[indx]->threadnr);
@@ -3443,7 +4864,7 @@ static void motion_watchdog(int indx)
             motion_cleanup(cnt_list[indx]);
             cnt_list[indx]->running = 0;
             cnt_list[indx]->finish = 0;
-        } else {
+        } else if (!cnt_list[indx]->pool_run || cnt_list[indx]->pool_busy) {
             pthread_kill(cnt_list[indx]->thread_id,SIGVTALRM);
         }
     }
@@ -3469,6 +4890,11 @@ static int motion_check_threadcount(void)
         }
     }
 
+    /* A node of a cluster waits for the cameras it is given */
+    if (!finish && cluster_active()) {
+        motion_threads_running++;
+    }
+
     /* If the web control/streams are in finish/shutdown, we
      * do not want to count them.  They will be completely closed
      * by the process outside of loop that is checking the counts
@@ -3498,6 +4924,62 @@ static int motion_check_threadcount(void)
     }
 }
 
+/**
+ * motion_cluster_check
+ *
+ *   Start the camera the cluster gave to this node or stop the one given to
+ *   another node.
+ */
+static void motion_cluster_check(struct context *cnt)
+{
+    if (finish || (cnt->cluster_hosted == cnt->cluster_started)) {
+        return;
+    }
+    cnt->cluster_started = cnt->cluster_hosted;
+
+    if (cnt->cluster_hosted) {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("Camera ID: %d given to this node"), cnt->camera_id);
+        cnt->restart = TRUE;
+    } else {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("Camera ID: %d given to another node"), cnt->camera_id);
+        cnt->restart = FALSE;
+        if (cnt->running) {
+            cnt->event_stop = TRUE;
+            cnt->finish = TRUE;
+        }
+    }
+}
+
+/**
+ * motion_picture_threads
+ *
+ *   Number of picture writer threads to start.  webp is encoded several
+ *   times slower than jpeg so when a camera writes webp pictures and
+ *   picture_threads is 0 they are still written on one thread per CPU core.
+ */
+static int motion_picture_threads(struct context **cntlist)
+{
+    int indx;
+
+    if (cntlist[0]->conf.picture_threads != 0) {
+        return cntlist[0]->conf.picture_threads;
+    }
+
+    #ifdef HAVE_WEBP
+        for (indx = 0; cntlist[indx] != NULL; indx++) {
+            if (mystreq(cntlist[indx]->conf.picture_type, "webp")) {
+                return -1;
+            }
+        }
+    #else
+        (void)indx;
+    #endif /* HAVE_WEBP */
+
+    return 0;
+}
+
 /**
  * main
  *
@@ -3534,9 +5016,24 @@ int main (int argc, char **argv)
             motion_restart(argc, argv);
         }
 
+        motion_pool_start();
+
+        picwriter_init(motion_picture_threads(cnt_list));
+
+        dbse_writer_init(cnt_list);
+
+        retention_init(cnt_list);
+
+        loadtest_start(cnt_list);
+
+        cluster_init(cnt_list);
+
         for (i = cnt_list[1] != NULL ? 1 : 0; cnt_list[i]; i++) {
             cnt_list[i]->threadnr = i ? i : 1;
-            motion_start_thread(cnt_list[i]);
+            cnt_list[i]->cluster_started = cnt_list[i]->cluster_hosted;
+            if (cnt_list[i]->cluster_hosted) {
+                motion_start_thread(cnt_list[i]);
+            }
         }
 
         MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
@@ -3548,7 +5045,18 @@ int main (int argc, char **argv)
                 break;
             }
 
+            if (reload) {
+                reload = 0;
+                motion_reload();
+            }
+
+            /* End of the load test time, end as on SIGTERM */
+            if (loadtest_check(cnt_list)) {
+                sig_handler(SIGTERM);
+            }
+
             for (i = (cnt_list[1] != NULL ? 1 : 0); cnt_list[i]; i++) {
+                motion_cluster_check(cnt_list[i]);
                 /* Check if threads wants to be restarted */
                 if ((!cnt_list[i]->running) && (cnt_list[i]->restart)) {
                     MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
@@ -3559,6 +5067,18 @@ int main (int argc, char **argv)
             }
         }
 
+        cluster_deinit();
+
+        motion_pool_stop();
+
+        loadtest_stop(cnt_list);
+
+        picwriter_deinit();
+
+        dbse_writer_deinit();
+
+        retention_deinit();
+
         /* Reset end main loop flag */
         finish = 0;
 
@@ -3574,6 +5094,8 @@ int main (int argc, char **argv)
 
     MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO, _("Motion terminating"));
 
+    framepool_deinit();
+
     ffmpeg_global_deinit();
 
     dbse_global_deinit(cnt_list);
@@ -3584,6 +5106,6 @@ int main (int argc, char **argv)
     pthread_key_delete(tls_key_threadnr);
     pthread_mutex_destroy(&global_lock);
 
-    return 0;
+    return loadtest_failed() ? 1 : 0;
 }
 
@@ -28,6 +28,8 @@ struct images;
 struct image_data;
 struct rtsp_context;
 struct ffmpeg;
+struct pic_scaler;
+struct webu_hls;
 
 #include "config.h"
 
@@ -98,6 +100,11 @@ struct ffmpeg;
     #if (MYFFVER >= 57083)
         #include "libavutil/hwcontext.h"
     #endif
+    #ifdef HAVE_AVFILTER
+        #include <libavfilter/avfilter.h>
+        #include <libavfilter/buffersrc.h>
+        #include <libavfilter/buffersink.h>
+    #endif
 #else
     #define MYFFVER 0
 #endif
@@ -223,13 +230,19 @@ struct ffmpeg;
 #define IMAGE_PRECAP    16
 #define IMAGE_POSTCAP   32
 
+/* Overlays of an image not yet drawn, see motion_image_overlay */
+#define OVERLAY_NORM         1  /* Texts on image_norm */
+#define OVERLAY_HIGH         2  /* Texts on image_high */
+#define OVERLAY_LOCATE_HIGH  4  /* Locate box on image_high */
+
 enum CAMERA_TYPE {
     CAMERA_TYPE_UNKNOWN,
     CAMERA_TYPE_V4L2,
     CAMERA_TYPE_BKTR,
     CAMERA_TYPE_MMAL,
     CAMERA_TYPE_RTSP,
-    CAMERA_TYPE_NETCAM
+    CAMERA_TYPE_NETCAM,
+    CAMERA_TYPE_SYNTH
 };
 
 enum WEBUI_LEVEL{
@@ -272,12 +285,126 @@ struct image_data {
 
     int total_labels;
 
+    /* Frame as received when image_high is only decoded when needed, see motion_image_high */
+    unsigned char *jpeg_data;
+    int jpeg_size;
+    int jpeg_alloc;
+    int high_pending;           /* image_high is not yet decoded from jpeg_data */
+
+    /* Texts rendered when captured and drawn on the image when it is used */
+    int overlay;                /* OVERLAY_* still to be drawn */
+    char *overlay_text;         /* The text_changes, text_left and text_right strings in a row */
+    int overlay_alloc;
+
+};
+
+/*
+ * A stream image is encoded once and then shared by all the connections.
+ * The buffer is not changed after it is published with webu_stream_putbuf.
+ * ref_count is protected by mutex_stream and the buffer is reused or freed
+ * once the last holder releases it.
+ */
+struct stream_buffer {
+    unsigned char       *jpeg_data;     /* Image compressed as JPG */
+    long                jpeg_size;      /* The number of bytes for jpg */
+    long                alloc_size;     /* The allocated size of jpeg_data */
+    int                 ref_count;      /* The stream plus each connection sending it */
+    struct stream_data  *strm;          /* The stream the buffer belongs to */
 };
 
 struct stream_data {
-    unsigned char   *jpeg_data; /* Image compressed as JPG */
-    long            jpeg_size;  /* The number of bytes for jpg */
-    int             cnct_count; /* Counter of the number of connections */
+    struct stream_buffer    *jpeg;      /* Latest image */
+    struct stream_buffer    *spare;     /* Released buffer kept for the next image */
+    int                     cnct_count; /* Counter of the number of connections */
+    unsigned long           seq;        /* Number of images published, for waiting connections */
+};
+
+/* A scaled copy of the normal stream image for the sub and scaled streams */
+struct stream_scale {
+    int                 width;
+    int                 height;
+    unsigned char       *image;
+    struct pic_scaler   *scaler;
+};
+
+#define STREAM_SCALED_MAX   4           /* Widths permitted in stream_scaled */
+
+/* A stream of the normal image scaled to a width given in stream_scaled */
+struct stream_scaled {
+    struct stream_data  strm;
+    struct stream_scale scale;
+    int                 width_conf;     /* Width requested in stream_scaled */
+};
+
+/*
+ * The stream images are encoded on a separate thread.  The motion loop
+ * copies the newest images into the pend buffers, replacing any that have
+ * not been taken yet, and the encoder swaps them with its work buffers.
+ */
+#define STREAM_ENC_NORM     0x01
+#define STREAM_ENC_SUB      0x02
+#define STREAM_ENC_MOTION   0x04
+#define STREAM_ENC_SOURCE   0x08
+#define STREAM_ENC_SCALED   0x10
+
+struct stream_encoder {
+    pthread_t           thread_id;
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+    int                 running;
+    int                 finish;
+    int                 pending;        /* STREAM_ENC_* flags of the pend images */
+    unsigned char       *pend_norm;
+    unsigned char       *pend_motion;
+    unsigned char       *pend_source;
+    unsigned char       *work_norm;
+    unsigned char       *work_motion;
+    unsigned char       *work_source;
+    unsigned long       encoded;        /* Images encoded */
+    unsigned long       dropped;        /* Images replaced before they were encoded */
+};
+
+/* Stages of the motion loop timed for the metrics */
+enum METRICS_STAGE {
+    METRICS_CAPTURE,
+    METRICS_DIFF,
+    METRICS_DESPECKLE,
+    METRICS_LABELING,
+    METRICS_OVERLAY,
+    METRICS_ACTIONS,
+    METRICS_ENCODE,
+    METRICS_STREAM,
+    METRICS_STAGES
+};
+
+#define METRICS_BUCKETS 12
+
+/* The metrics as published once per frame for the webcontrol */
+struct metrics_hist {
+    unsigned long       bucket[METRICS_STAGES][METRICS_BUCKETS]; /* Frames in each bucket, not cumulative */
+    unsigned long       count[METRICS_STAGES];      /* Frames that ran the stage */
+    unsigned long long  sum_usec[METRICS_STAGES];
+    unsigned long       frames;
+    unsigned long       frames_missed;      /* Frames the camera did not deliver */
+    unsigned long       decode_errors;
+    unsigned long       stream_dropped;     /* Stream images replaced before they were encoded */
+    unsigned long       capture_stalls;
+    int                 capture_depth;      /* Frames waiting in the capture queue */
+    int                 ring_used;          /* Images held in the pre-capture ring */
+    int                 ring_size;
+};
+
+struct metrics_timer {
+    struct timespec     ts;
+    long                nested;
+};
+
+struct loop_metrics {
+    pthread_mutex_t     mutex;
+    struct metrics_hist hist;
+    long                frame_usec[METRICS_STAGES]; /* Current frame, -1 when the stage did not run */
+    long                frame_accounted;            /* usec of the current frame given to a stage */
+    unsigned long       frames_missed;              /* Counted on the motion loop, published with hist */
 };
 
 /*
@@ -306,23 +433,43 @@ struct stream_data {
 *               These values are set in rotate_init.
 */
 
+/* Run of pixels covered by the privacy mask */
+struct mask_span {
+    int offset;
+    int len;
+};
+
+/* The privacy mask of one image size compiled into runs, see init_mask_privacy */
+struct mask_spans {
+    struct mask_span *luma;           /* Runs in the Y plane */
+    int luma_count;
+    struct mask_span *chroma;         /* Runs in the U plane, the same apply to V */
+    int chroma_count;
+    int sparse;                       /* Apply the runs instead of the whole mask */
+};
+
 struct images {
     struct image_data *image_ring;    /* The base address of the image ring buffer */
     int image_ring_size;
+    int image_ring_request;           /* Size last requested, larger than the size when over budget */
     int image_ring_in;                /* Index in image ring buffer we last added a image into */
     int image_ring_out;               /* Index in image ring buffer we want to process next time */
 
+    unsigned char *arena;             /* One allocation holding the detection buffers */
     unsigned char *ref;               /* The reference frame */
     struct image_data img_motion;     /* Picture buffer for motion images */
-    int *ref_dyn;                     /* Dynamic objects to be excluded from reference frame */
+    unsigned short *ref_dyn;          /* Dynamic objects to be excluded from reference frame */
     struct image_data image_virgin;   /* Last picture frame with no text or locate overlay */
     struct image_data image_vprvcy;   /* Virgin image with the privacy mask applied */
     struct image_data preview_image;  /* Picture buffer for best image when enables */
+    int preview_slot;                 /* Ring slot the preview images are in, -1 when they are its own */
+    unsigned char *preview_spare_norm; /* Own images of the preview while it uses a ring slot */
+    unsigned char *preview_spare_high;
+    struct pic_scaler *high_scaler;   /* Scales image_norm up when image_high was not decoded */
     unsigned char *mask;              /* Buffer for the mask file */
     unsigned char *smartmask;
     unsigned char *smartmask_final;
     unsigned char *common_buffer;
-    unsigned char *substream_image;
 
     unsigned char *mask_privacy;      /* Buffer for the privacy mask values */
     unsigned char *mask_privacy_uv;   /* Buffer for the privacy U&V values */
@@ -330,9 +477,22 @@ struct images {
     unsigned char *mask_privacy_high;      /* Buffer for the privacy mask values */
     unsigned char *mask_privacy_high_uv;   /* Buffer for the privacy U&V values */
 
-    int *smartmask_buffer;
+    struct mask_spans mask_privacy_spans;      /* Runs of the privacy mask */
+    struct mask_spans mask_privacy_high_spans; /* Runs of the high resolution privacy mask */
+
+    unsigned short *smartmask_buffer;
     int *labels;
-    int *labelsize;
+    int *labelsize;                   /* Size of each label found by the run based labeling */
+    struct alg_run *label_runs;       /* Runs of motion pixels for the run based labeling */
+    int *label_rows;                  /* Index of the first run of each row */
+    unsigned short *tile_counts;      /* Changed pixels per tile for the early exit in alg_diff */
+    unsigned char *tile_skip;         /* Tiles completely excluded by the mask file */
+    int tile_cols;
+    int tile_rows;
+    int motion_top;                   /* First row of img_motion that may contain motion */
+    int motion_bottom;                /* Row after the last row that may contain motion */
+    int *motion_rows;                 /* Changed pixels of each row of img_motion from alg_diff and alg_despeckle */
+    int *locate_counts;               /* Motion pixels per column and then per row for alg_locate_center_size */
     int width;
     int height;
     int type;
@@ -342,6 +502,8 @@ struct images {
     int width_high;
     int height_high;
     int size_high;                 /* Number of bytes for high resolution image */
+    int detect_scale;              /* Divisor of the captured size used for the detection */
+    int detect_camera;             /* The camera delivers the reduced image itself, see mmalcam.c */
 
     int motionsize;
     int labelgroup_max;
@@ -390,6 +552,7 @@ struct context {
     struct trackoptions track;
     int                 track_posx;
     int                 track_posy;
+    struct track_worker *track_worker;      /* Sends the tracking commands to the camera */
 
     enum CAMERA_TYPE      camera_type;
     struct netcam_context *netcam;
@@ -400,6 +563,15 @@ struct context {
     struct rtsp_context *rtsp_high;         /* this structure contains the context for high resolution RTSP connection */
 
     struct params_context *vdev;            /* Structure for v4l2 and bktr device information */
+    struct synth_context *synth;            /* Generated frames when synth_camera is set */
+    struct shmexport_ctx *shmexport;        /* Shared memory frame ring when shm_export is set */
+    struct eventidx_ctx *eventidx;          /* Index of the events when event_index is set */
+    struct alg_opencl   *opencl;            /* GPU state of the detection when detect_backend is opencl */
+    struct capture_queue *capq;             /* Capture thread and frame queue when capture_queue is set */
+    size_t              framepool_bytes;    /* Bytes of image buffers taken from the frame pool */
+    struct picwriter_job *picw_head;        /* Pictures queued to the writer threads, oldest first */
+    struct picwriter_job *picw_tail;
+    int                 picw_pending;       /* Number of pictures on the picw list */
 
     struct image_data *current_image;       /* Pointer to a structure where the image, diffs etc is stored */
     unsigned int new_img;
@@ -432,15 +604,30 @@ struct context {
     volatile unsigned int webcontrol_running;
     volatile unsigned int webcontrol_finish;      /* End the thread */
     volatile int watchdog;
+    volatile int connecting;            /* motion_init is still opening the camera */
+
+    /* Config read again on SIGHUP, handed to the camera under global_lock, see motion_reload */
+    struct context *reload;
+    int reload_changes;                 /* The CONF_RELOAD flags of the changes in reload */
+    struct context *conf_loaded;        /* The options as read from the config files, see conf_reload_keep */
 
     pthread_t thread_id;
 
+    /* Scheduling state when the camera is run by the worker pool (worker_threads) */
+    int pool_run;                       /* Camera is run by the pool rather than its own thread */
+    int pool_busy;                      /* A worker is running a step for the camera */
+    int pool_killed;                    /* The watchdog has cancelled the camera */
+    unsigned long long int pool_due;    /* Time in usec the next step is due */
+
     int event_nr;
     int prev_event;
     char            eventid[20];        /* Cam ID + Date/Time 99999yyyymmddhhmmss */
     unsigned int lightswitch_framecounter;
     char text_event_string[PATH_MAX];        /* The text for conv. spec. %C - */
     int text_scale;
+    struct draw_cache *text_cache;           /* Rendered text_changes, text_left and text_right */
+    struct exif_cache *exif_cache;           /* Prebuilt EXIF blocks of the pictures */
+    struct WebPConfig *webp_config;          /* Encoder config of the webp pictures */
 
     int postcap;                             /* downcounter, frames left to to send post event */
     int shots;
@@ -458,19 +645,28 @@ struct context {
     unsigned int startup_frames;
     unsigned int moved;
     unsigned int pause;
+    int loadtest_cameras;                    /* Synthetic cameras of the load test from the command line */
+    int loadtest_seconds;
+    struct loadtest_camera *loadtest;        /* Measurements of this camera during the load test */
     int missing_frame_counter;               /* counts failed attempts to fetch picture frame from camera */
     unsigned int lost_connection;
 
     int video_dev;
     int pipe;
     int mpipe;
+    struct vlp_mmap *pipe_mmap;         /* Streaming buffers of the pipes, NULL when written */
+    struct vlp_mmap *mpipe_mmap;
 
     char hostname[PATH_MAX];
 
     int sql_mask;
+    int dbse_pending;                   /* Queries of this camera on the database writer queue */
+    unsigned long dbse_dropped;         /* Queries discarded for a full queue or lost database */
+    long dbse_latency;                  /* usec from queueing to written of the last query */
 
     #ifdef HAVE_SQLITE3
         sqlite3 *database_sqlite3;
+        struct dbse_sqlite3 *dbse_sqlite3;  /* Shared connection of the database file */
     #endif
 
     #if defined(HAVE_MYSQL)
@@ -521,6 +717,8 @@ struct context {
     unsigned int get_image;    /* Flag used to signal that we capture new image when we run the loop */
 
     long int required_frame_time, frame_delay;
+    int idle;                  /* Processing at framerate_idle, see mlp_idle */
+    time_t idle_quiet;         /* Time of the last change that ends the idle rate */
 
     long int rolling_average_limit;
     long int *rolling_average_data;
@@ -528,7 +726,8 @@ struct context {
 
     int olddiffs;   //only need this in here for a printf later...do we need that printf?
     int smartmask_ratio;
-    int smartmask_count;
+    int smartmask_count;            /* Frames of the smartmask_ratio period done */
+    int smartmask_row;              /* Next row for alg_tune_smartmask */
 
     int previous_diffs, previous_location_x, previous_location_y;
     unsigned long int time_last_frame, time_current_frame;
@@ -545,11 +744,22 @@ struct context {
     int                 camera_id;
 
     pthread_mutex_t     mutex_stream;
+    pthread_cond_t      cond_stream;    /* Signalled when a stream image is published */
+    struct stream_encoder stream_enc;
 
     struct stream_data  stream_norm;    /* Copy of the image to use for web stream*/
     struct stream_data  stream_sub;     /* Copy of the image to use for web stream*/
     struct stream_data  stream_motion;  /* Copy of the image to use for web stream*/
     struct stream_data  stream_source;  /* Copy of the image to use for web stream*/
+    struct stream_scale stream_sub_scale;   /* Half size image of stream_sub */
+    struct stream_scaled stream_scaled[STREAM_SCALED_MAX];
+    int                 stream_scaled_count;
+    struct webu_hls     *hls;           /* Remux of the pass-through packets for the HLS stream */
+
+    struct loop_metrics metrics;        /* Stage timings and counters for the metrics page */
+
+    int                 cluster_hosted;     /* The camera is to run on this node of the cluster */
+    int                 cluster_started;    /* cluster_hosted as last acted upon by main */
 
     struct params_context    *webcontrol_headers;  /* Headers for webcontrol */
     struct params_context    *stream_headers;  /* Headers for stream */
@@ -564,5 +774,8 @@ extern FILE *ptr_logfile;
 /* TLS keys below */
 extern pthread_key_t tls_key_threadnr; /* key for thread number */
 void motion_remove_pid(void);
+void motion_image_high(struct context *cnt, struct image_data *img_data);
+void motion_image_overlay(struct context *cnt, struct image_data *img_data);
+void motion_restart_all(void);
 
 #endif /* _INCLUDE_MOTION_H */
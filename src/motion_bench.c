@@ -0,0 +1,699 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *    motion_bench.c
+ *
+ *    Benchmark of the detection stages on a recorded clip.
+ *
+ *    The frames of the clip are decoded into memory first and then passed
+ *    through the same stages as the motion loop, each timed on its own.
+ *    Raw YUV420P and MJPEG clips are read directly, other clips such as
+ *    H.264 are decoded with ffmpeg.  The result is written as a table or
+ *    as CSV or JSON for comparing builds and hosts.
+ *
+ *    Build with "make motion-bench".  It is not built or installed by default.
+ *
+ */
+
+#include <getopt.h>
+#include "translate.h"
+#include "motion.h"
+#include "util.h"
+#include "logger.h"
+#include "alg.h"
+#include "alg_simd.h"
+#include "video_simd.h"
+#include "draw.h"
+#include "rotate.h"
+#include "jpegutils.h"
+#include "framepool.h"
+#include "metrics.h"
+
+/* Provided by motion.c for the motion program */
+pthread_key_t tls_key_threadnr;
+pthread_mutex_t global_lock;
+volatile int threads_running = 0;
+
+void motion_remove_pid(void)
+{
+}
+
+void motion_restart_all(void)
+{
+}
+
+void motion_image_high(struct context *cnt, struct image_data *img_data)
+{
+    (void)cnt;
+    (void)img_data;
+}
+
+void motion_image_overlay(struct context *cnt, struct image_data *img_data)
+{
+    (void)cnt;
+    (void)img_data;
+}
+
+enum BENCH_STAGE {
+    BENCH_DIFF,
+    BENCH_DESPECKLE,
+    BENCH_LABELING,
+    BENCH_REFERENCE,
+    BENCH_SMARTMASK,
+    BENCH_ROTATE,
+    BENCH_TEXT,
+    BENCH_STAGES
+};
+
+enum BENCH_FORMAT {
+    BENCH_FORMAT_TEXT,
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON
+};
+
+struct bench_stage {
+    const char         *name;
+    unsigned long       runs;
+    long long           nsec;
+    size_t              bytes;      /* Image bytes processed per run */
+};
+
+struct bench_ctx {
+    const char         *clip;
+    int                 width;
+    int                 height;
+    int                 frames_max;
+    int                 frames;
+    int                 repeat;
+    int                 threshold;
+    int                 noise;
+    int                 rotate;
+    const char         *despeckle;
+    enum BENCH_FORMAT   format;
+    unsigned char     **images;
+    struct bench_stage  stages[BENCH_STAGES];
+};
+
+static long long bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((long long)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+static void bench_usage(void)
+{
+    printf("motion-bench: Benchmark of the motion detection stages\n\n");
+    printf("Usage: motion-bench -i clip [options]\n\n");
+    printf("  -i clip        .yuv (YUV420P frames), .mjpeg/.mjpg or a clip ffmpeg can decode\n");
+    printf("  -s WxH         Frame size.  Required for .yuv and .mjpeg clips\n");
+    printf("  -n frames      Frames read from the clip.  Default 50\n");
+    printf("  -r repeat      Passes over the frames.  Default 5\n");
+    printf("  -t threshold   Changed pixels for motion.  Default 1500\n");
+    printf("  -N noise       Noise level.  Default 32\n");
+    printf("  -d filter      Despeckle filter before the labeling.  Default EedD\n");
+    printf("  -R degrees     Rotation for the rotate stage.  Default 90\n");
+    printf("  -f format      text, csv or json.  Default text\n");
+    printf("  -h             Show this help\n\n");
+}
+
+static int bench_parms(struct bench_ctx *bench, int argc, char **argv)
+{
+    int c;
+
+    bench->clip = NULL;
+    bench->width = 0;
+    bench->height = 0;
+    bench->frames_max = 50;
+    bench->repeat = 5;
+    bench->threshold = 1500;
+    bench->noise = 32;
+    bench->rotate = 90;
+    bench->despeckle = "EedD";
+    bench->format = BENCH_FORMAT_TEXT;
+
+    while ((c = getopt(argc, argv, "i:s:n:r:t:N:d:R:f:h")) != EOF) {
+        switch (c) {
+        case 'i':
+            bench->clip = optarg;
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &bench->width, &bench->height) != 2) {
+                fprintf(stderr, "Invalid size %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'n':
+            bench->frames_max = atoi(optarg);
+            break;
+        case 'r':
+            bench->repeat = atoi(optarg);
+            break;
+        case 't':
+            bench->threshold = atoi(optarg);
+            break;
+        case 'N':
+            bench->noise = atoi(optarg);
+            break;
+        case 'd':
+            bench->despeckle = optarg;
+            break;
+        case 'R':
+            bench->rotate = atoi(optarg);
+            break;
+        case 'f':
+            if (mystreq(optarg, "csv")) {
+                bench->format = BENCH_FORMAT_CSV;
+            } else if (mystreq(optarg, "json")) {
+                bench->format = BENCH_FORMAT_JSON;
+            } else if (mystreq(optarg, "text")) {
+                bench->format = BENCH_FORMAT_TEXT;
+            } else {
+                fprintf(stderr, "Invalid format %s\n", optarg);
+                return -1;
+            }
+            break;
+        default:
+            bench_usage();
+            return -1;
+        }
+    }
+
+    if (bench->clip == NULL) {
+        bench_usage();
+        return -1;
+    }
+    if ((bench->frames_max < 1) || (bench->repeat < 1)) {
+        fprintf(stderr, "The frames and repeat must be at least 1\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* The detection works on images with sizes that are a multiple of 8 */
+static int bench_size_check(struct bench_ctx *bench)
+{
+    if ((bench->width < 64) || (bench->height < 64) ||
+        (bench->width % 8) || (bench->height % 8)) {
+        fprintf(stderr, "The frame size %dx%d must be at least 64x64 and a multiple of 8\n"
+            , bench->width, bench->height);
+        return -1;
+    }
+    return 0;
+}
+
+static unsigned char *bench_image_add(struct bench_ctx *bench)
+{
+    size_t size_norm = (bench->width * bench->height * 3) / 2;
+
+    bench->images[bench->frames] = mymalloc(size_norm);
+
+    return bench->images[bench->frames];
+}
+
+static int bench_load_yuv(struct bench_ctx *bench)
+{
+    FILE *fp;
+    size_t size_norm;
+
+    if (bench_size_check(bench) != 0) {
+        return -1;
+    }
+
+    fp = myfopen(bench->clip, "rbe");
+    if (fp == NULL) {
+        fprintf(stderr, "Unable to open %s\n", bench->clip);
+        return -1;
+    }
+
+    size_norm = (bench->width * bench->height * 3) / 2;
+    while (bench->frames < bench->frames_max) {
+        if (fread(bench_image_add(bench), 1, size_norm, fp) != size_norm) {
+            free(bench->images[bench->frames]);
+            break;
+        }
+        bench->frames++;
+    }
+
+    myfclose(fp);
+
+    return 0;
+}
+
+/* The clip is the JPEG images one after the other as sent by MJPEG cameras */
+static int bench_load_mjpeg(struct bench_ctx *bench)
+{
+    FILE *fp;
+    unsigned char *data;
+    long len, st, indx;
+
+    if (bench_size_check(bench) != 0) {
+        return -1;
+    }
+
+    fp = myfopen(bench->clip, "rbe");
+    if (fp == NULL) {
+        fprintf(stderr, "Unable to open %s\n", bench->clip);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (len <= 0) {
+        myfclose(fp);
+        return -1;
+    }
+    data = mymalloc(len);
+    if (fread(data, 1, len, fp) != (size_t)len) {
+        fprintf(stderr, "Unable to read %s\n", bench->clip);
+        myfclose(fp);
+        free(data);
+        return -1;
+    }
+    myfclose(fp);
+
+    st = -1;
+    for (indx = 0; (indx + 1 < len) && (bench->frames < bench->frames_max); indx++) {
+        if ((data[indx] != 0xFF) || ((data[indx + 1] != 0xD8) && (data[indx + 1] != 0xD9))) {
+            continue;
+        }
+        if (data[indx + 1] == 0xD8) {
+            st = indx;
+        } else if (st >= 0) {
+            if (jpgutl_decode_jpeg(data + st, (int)(indx + 2 - st)
+                    , bench->width, bench->height, bench_image_add(bench)) == 0) {
+                bench->frames++;
+            } else {
+                free(bench->images[bench->frames]);
+            }
+            st = -1;
+        }
+    }
+
+    free(data);
+
+    return 0;
+}
+
+#if defined(HAVE_FFMPEG) && (MYFFVER >= 57041)
+
+static void bench_ffmpeg_put(struct bench_ctx *bench, struct SwsContext *swsctx, AVFrame *frame)
+{
+    unsigned char *img;
+    uint8_t *dst[4];
+    int dst_linesize[4];
+
+    img = bench_image_add(bench);
+    dst[0] = img;
+    dst[1] = img + (bench->width * bench->height);
+    dst[2] = dst[1] + (bench->width * bench->height) / 4;
+    dst[3] = NULL;
+    dst_linesize[0] = bench->width;
+    dst_linesize[1] = bench->width / 2;
+    dst_linesize[2] = bench->width / 2;
+    dst_linesize[3] = 0;
+
+    sws_scale(swsctx, (const uint8_t * const *)frame->data, frame->linesize
+        , 0, frame->height, dst, dst_linesize);
+
+    bench->frames++;
+}
+
+static int bench_load_ffmpeg(struct bench_ctx *bench)
+{
+    AVFormatContext *fmtctx = NULL;
+    AVCodecContext *codecctx = NULL;
+    my_AVCodec *decoder = NULL;
+    struct SwsContext *swsctx = NULL;
+    AVPacket *pkt;
+    AVFrame *frame;
+    int strm, retcd;
+
+    if (avformat_open_input(&fmtctx, bench->clip, NULL, NULL) < 0) {
+        fprintf(stderr, "Unable to open %s\n", bench->clip);
+        return -1;
+    }
+    if (avformat_find_stream_info(fmtctx, NULL) < 0) {
+        avformat_close_input(&fmtctx);
+        return -1;
+    }
+    strm = av_find_best_stream(fmtctx, AVMEDIA_TYPE_VIDEO, -1, -1, &decoder, 0);
+    if (strm < 0) {
+        fprintf(stderr, "No video stream in %s\n", bench->clip);
+        avformat_close_input(&fmtctx);
+        return -1;
+    }
+    codecctx = avcodec_alloc_context3(decoder);
+    avcodec_parameters_to_context(codecctx, fmtctx->streams[strm]->codecpar);
+    if (avcodec_open2(codecctx, decoder, NULL) < 0) {
+        fprintf(stderr, "Unable to open the decoder for %s\n", bench->clip);
+        avcodec_free_context(&codecctx);
+        avformat_close_input(&fmtctx);
+        return -1;
+    }
+
+    if ((bench->width == 0) || (bench->height == 0)) {
+        bench->width = codecctx->width - (codecctx->width % 8);
+        bench->height = codecctx->height - (codecctx->height % 8);
+    }
+    if (bench_size_check(bench) != 0) {
+        avcodec_free_context(&codecctx);
+        avformat_close_input(&fmtctx);
+        return -1;
+    }
+
+    pkt = my_packet_alloc(NULL);
+    frame = my_frame_alloc();
+
+    while ((bench->frames < bench->frames_max) && (av_read_frame(fmtctx, pkt) >= 0)) {
+        if (pkt->stream_index == strm) {
+            avcodec_send_packet(codecctx, pkt);
+            while (bench->frames < bench->frames_max) {
+                retcd = avcodec_receive_frame(codecctx, frame);
+                if (retcd < 0) {
+                    break;
+                }
+                if (swsctx == NULL) {
+                    swsctx = sws_getContext(frame->width, frame->height, frame->format
+                        , bench->width, bench->height, MY_PIX_FMT_YUV420P
+                        , SWS_BICUBIC, NULL, NULL, NULL);
+                    if (swsctx == NULL) {
+                        break;
+                    }
+                }
+                bench_ffmpeg_put(bench, swsctx, frame);
+            }
+        }
+        av_packet_unref(pkt);
+    }
+
+    if (swsctx != NULL) {
+        sws_freeContext(swsctx);
+    }
+    my_frame_free(frame);
+    my_packet_free(pkt);
+    avcodec_free_context(&codecctx);
+    avformat_close_input(&fmtctx);
+
+    return 0;
+}
+
+#else
+
+static int bench_load_ffmpeg(struct bench_ctx *bench)
+{
+    fprintf(stderr, "Clips other than .yuv and .mjpeg need motion built with ffmpeg: %s\n"
+        , bench->clip);
+    return -1;
+}
+
+#endif
+
+static int bench_load(struct bench_ctx *bench)
+{
+    const char *ext;
+    int retcd;
+
+    bench->frames = 0;
+    bench->images = mymalloc(bench->frames_max * sizeof(unsigned char *));
+
+    ext = strrchr(bench->clip, '.');
+    if (ext == NULL) {
+        ext = "";
+    }
+
+    if (mystrceq(ext, ".yuv")) {
+        retcd = bench_load_yuv(bench);
+    } else if (mystrceq(ext, ".mjpeg") || mystrceq(ext, ".mjpg")) {
+        retcd = bench_load_mjpeg(bench);
+    } else {
+        retcd = bench_load_ffmpeg(bench);
+    }
+
+    if ((retcd == 0) && (bench->frames == 0)) {
+        fprintf(stderr, "No frames read from %s\n", bench->clip);
+        retcd = -1;
+    }
+
+    return retcd;
+}
+
+/* Set up the images of a camera context like motion_init does */
+static void bench_context(struct bench_ctx *bench, struct context *cnt, struct image_data *current)
+{
+    struct images *imgs = &cnt->imgs;
+
+    memset(cnt, 0, sizeof(struct context));
+    memset(current, 0, sizeof(struct image_data));
+
+    cnt->conf.threshold = bench->threshold;
+    cnt->conf.text_scale = 1;
+    cnt->conf.rotate = bench->rotate;
+    cnt->conf.flip_axis = "none";
+    cnt->threshold = bench->threshold;
+    cnt->noise = bench->noise;
+    cnt->lastrate = 15;
+    cnt->smartmask_speed = 5;
+    cnt->smartmask_ratio = 5 * cnt->lastrate * (11 - cnt->smartmask_speed);
+    cnt->smartmask_count = 0;
+    cnt->smartmask_row = 0;
+    cnt->event_nr = 1;
+    cnt->prev_event = 0;
+    cnt->current_image = current;
+
+    imgs->width = bench->width;
+    imgs->height = bench->height;
+    imgs->motionsize = bench->width * bench->height;
+    imgs->size_norm = (imgs->motionsize * 3) / 2;
+
+    imgs->ref = framepool_alloc(imgs->size_norm);
+    imgs->img_motion.image_norm = framepool_alloc(imgs->size_norm);
+    imgs->ref_dyn = framepool_alloc(imgs->motionsize * sizeof(*imgs->ref_dyn));
+    imgs->image_vprvcy.image_norm = mymalloc(imgs->size_norm);
+    imgs->smartmask = framepool_alloc(imgs->motionsize);
+    imgs->smartmask_final = framepool_alloc(imgs->motionsize);
+    imgs->smartmask_buffer = framepool_alloc(imgs->motionsize * sizeof(*imgs->smartmask_buffer));
+    imgs->labels = framepool_alloc(imgs->motionsize * sizeof(*imgs->labels));
+    imgs->labelsize = framepool_alloc((imgs->motionsize/2+1) * sizeof(*imgs->labelsize));
+    imgs->label_runs = mymalloc(imgs->height * ((imgs->width + 1) / 2) * sizeof(*imgs->label_runs));
+    imgs->label_rows = mymalloc((imgs->height + 1) * sizeof(*imgs->label_rows));
+    imgs->tile_cols = (imgs->width + ALG_TILE_SIZE - 1) / ALG_TILE_SIZE;
+    imgs->tile_rows = (imgs->height + ALG_TILE_SIZE - 1) / ALG_TILE_SIZE;
+    imgs->tile_counts = mymalloc(imgs->tile_cols * imgs->tile_rows * sizeof(*imgs->tile_counts));
+    imgs->tile_skip = mymalloc(imgs->tile_cols * imgs->tile_rows);
+    imgs->motion_rows = mymalloc(imgs->height * sizeof(*imgs->motion_rows));
+    memset(imgs->motion_rows, 0, imgs->height * sizeof(*imgs->motion_rows));
+    imgs->locate_counts = mymalloc((imgs->width + imgs->height) * sizeof(*imgs->locate_counts));
+    imgs->common_buffer = framepool_alloc(3 * imgs->width * imgs->height);
+
+    memset(imgs->smartmask, 0, imgs->motionsize);
+    memset(imgs->smartmask_final, 255, imgs->motionsize);
+    memset(imgs->smartmask_buffer, 0, imgs->motionsize * sizeof(*imgs->smartmask_buffer));
+
+    alg_init_tiles(cnt);
+    metrics_init(cnt);
+}
+
+static void bench_stage_add(struct bench_stage *stage, long long start)
+{
+    stage->nsec += bench_now() - start;
+    stage->runs++;
+}
+
+/** bench_run
+ *  Pass the frames through the stages in the order of the motion loop.
+ *  Despeckle and labeling only run on frames with motion as in the loop.
+ */
+static void bench_run(struct bench_ctx *bench)
+{
+    struct context *cnt, *cnt_rot;
+    struct image_data current, current_rot, img_rot;
+    struct bench_stage *stages = bench->stages;
+    char filter[PATH_MAX];
+    char text[32];
+    long long start;
+    int rep, indx, diffs;
+
+    cnt = mymalloc(sizeof(struct context));
+    cnt_rot = mymalloc(sizeof(struct context));
+    bench_context(bench, cnt, &current);
+    /* rotate_init swaps the sizes so it has a context of its own */
+    bench_context(bench, cnt_rot, &current_rot);
+    rotate_init(cnt_rot);
+    img_rot.image_norm = mymalloc(cnt->imgs.size_norm);
+
+    stages[BENCH_DIFF].name = "diff";
+    stages[BENCH_DIFF].bytes = cnt->imgs.motionsize;
+    stages[BENCH_DESPECKLE].name = "despeckle";
+    stages[BENCH_DESPECKLE].bytes = cnt->imgs.motionsize;
+    stages[BENCH_LABELING].name = "labeling";
+    stages[BENCH_LABELING].bytes = cnt->imgs.motionsize;
+    stages[BENCH_REFERENCE].name = "reference";
+    stages[BENCH_REFERENCE].bytes = cnt->imgs.motionsize;
+    stages[BENCH_SMARTMASK].name = "smartmask";
+    stages[BENCH_SMARTMASK].bytes = cnt->imgs.motionsize;
+    stages[BENCH_ROTATE].name = "rotate";
+    stages[BENCH_ROTATE].bytes = cnt->imgs.size_norm;
+    stages[BENCH_TEXT].name = "text";
+    stages[BENCH_TEXT].bytes = cnt->imgs.motionsize;
+
+    memcpy(cnt->imgs.image_vprvcy.image_norm, bench->images[0], cnt->imgs.size_norm);
+    alg_update_reference_frame(cnt, RESET_REF_FRAME);
+
+    for (rep = 0; rep < bench->repeat; rep++) {
+        for (indx = 0; indx < bench->frames; indx++) {
+            memcpy(cnt->imgs.image_vprvcy.image_norm, bench->images[indx], cnt->imgs.size_norm);
+
+            start = bench_now();
+            diffs = alg_diff(cnt, cnt->imgs.image_vprvcy.image_norm);
+            bench_stage_add(&stages[BENCH_DIFF], start);
+
+            if (diffs > 0) {
+                snprintf(filter, sizeof(filter), "%s", bench->despeckle);
+                cnt->conf.despeckle_filter = filter;
+                start = bench_now();
+                diffs = alg_despeckle(cnt, diffs);
+                bench_stage_add(&stages[BENCH_DESPECKLE], start);
+            }
+            if (diffs > 0) {
+                cnt->conf.despeckle_filter = "l";
+                start = bench_now();
+                diffs = alg_despeckle(cnt, diffs);
+                bench_stage_add(&stages[BENCH_LABELING], start);
+            }
+
+            start = bench_now();
+            alg_update_reference_frame(cnt, UPDATE_REF_FRAME);
+            bench_stage_add(&stages[BENCH_REFERENCE], start);
+
+            start = bench_now();
+            alg_tune_smartmask(cnt);
+            bench_stage_add(&stages[BENCH_SMARTMASK], start);
+
+            memcpy(img_rot.image_norm, bench->images[indx], cnt->imgs.size_norm);
+            start = bench_now();
+            rotate_map(cnt_rot, &img_rot);
+            bench_stage_add(&stages[BENCH_ROTATE], start);
+
+            snprintf(text, sizeof(text), "Frame %d diffs %d", indx, diffs);
+            start = bench_now();
+            draw_text(cnt->imgs.image_vprvcy.image_norm, cnt->imgs.width, cnt->imgs.height
+                , 10, 20, text, cnt->conf.text_scale);
+            bench_stage_add(&stages[BENCH_TEXT], start);
+        }
+    }
+
+    cnt->conf.despeckle_filter = NULL;
+    rotate_deinit(cnt_rot);
+    free(img_rot.image_norm);
+}
+
+static void bench_report(struct bench_ctx *bench)
+{
+    struct bench_stage *stage;
+    double ns_frame, mb_sec;
+    int indx;
+
+    if (bench->format == BENCH_FORMAT_CSV) {
+        printf("clip,width,height,frames,kernels,stage,runs,ns_per_frame,mb_per_sec\n");
+    } else if (bench->format == BENCH_FORMAT_JSON) {
+        printf("{\"clip\": \"%s\", \"width\": %d, \"height\": %d, \"frames\": %d"
+            ", \"kernels\": \"%s\", \"stages\": ["
+            , bench->clip, bench->width, bench->height, bench->frames, alg_simd.name);
+    } else {
+        printf("Clip %s  %dx%d  %d frames x %d  %s kernels\n\n"
+            , bench->clip, bench->width, bench->height, bench->frames
+            , bench->repeat, alg_simd.name);
+        printf("%-12s %10s %14s %12s\n", "stage", "runs", "ns/frame", "MB/s");
+    }
+
+    for (indx = 0; indx < BENCH_STAGES; indx++) {
+        stage = &bench->stages[indx];
+        if (stage->runs > 0) {
+            ns_frame = (double)stage->nsec / stage->runs;
+        } else {
+            ns_frame = 0;
+        }
+        if (stage->nsec > 0) {
+            mb_sec = ((double)stage->bytes * stage->runs / (1024.0 * 1024.0))
+                / ((double)stage->nsec / 1000000000.0);
+        } else {
+            mb_sec = 0;
+        }
+
+        if (bench->format == BENCH_FORMAT_CSV) {
+            printf("%s,%d,%d,%d,%s,%s,%lu,%.0f,%.1f\n"
+                , bench->clip, bench->width, bench->height, bench->frames, alg_simd.name
+                , stage->name, stage->runs, ns_frame, mb_sec);
+        } else if (bench->format == BENCH_FORMAT_JSON) {
+            printf("%s{\"name\": \"%s\", \"runs\": %lu, \"ns_per_frame\": %.0f, \"mb_per_sec\": %.1f}"
+                , (indx > 0) ? ", " : "", stage->name, stage->runs, ns_frame, mb_sec);
+        } else {
+            printf("%-12s %10lu %14.0f %12.1f\n", stage->name, stage->runs, ns_frame, mb_sec);
+        }
+    }
+
+    if (bench->format == BENCH_FORMAT_JSON) {
+        printf("]}\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_ctx bench;
+    int indx;
+
+    memset(&bench, 0, sizeof(bench));
+
+    pthread_key_create(&tls_key_threadnr, NULL);
+    pthread_setspecific(tls_key_threadnr, (void *)(0));
+    pthread_mutex_init(&global_lock, NULL);
+
+    /* Only report the problems on stderr */
+    set_log_mode(LOGMODE_NONE);
+    set_log_level(WRN);
+
+    if (bench_parms(&bench, argc, argv) != 0) {
+        return 1;
+    }
+
+    #ifdef HAVE_FFMPEG
+        ffmpeg_global_init();
+    #endif
+
+    framepool_init(0, "off", FALSE);
+    alg_simd_init();
+    vid_simd_init();
+    initialize_chars();
+
+    if (bench_load(&bench) != 0) {
+        return 1;
+    }
+
+    bench_run(&bench);
+    bench_report(&bench);
+
+    for (indx = 0; indx < bench.frames; indx++) {
+        free(bench.images[indx]);
+    }
+    free(bench.images);
+
+    return 0;
+}
@@ -28,6 +28,7 @@
 #include "netcam.h"
 #include "netcam_http.h"
 #include "netcam_ftp.h"
+#include "jpegutils.h"
 
 /*
  * The following three routines (netcam_url_match, netcam_url_parse and
@@ -263,7 +264,7 @@ static void *netcam_handler_loop(void *arg)
         if (netcam->response) {    /* If html input */
             if (netcam->caps.streaming == NCS_UNSUPPORTED) {
                 /* Non-streaming ie. jpeg */
-                if (!netcam->connect_keepalive ||
+                if (!netcam->connect_keepalive || (netcam->sock == -1) ||
                     (netcam->connect_keepalive && netcam->keepalive_timeup)) {
                     /* If keepalive flag set but time up, time to close this socket. */
                     if (netcam->connect_keepalive && netcam->keepalive_timeup) {
@@ -301,6 +302,10 @@ static void *netcam_handler_loop(void *arg)
                         MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO
                             ,_("Error in header (%d)"), retval);
                     }
+                    /* The kept connection is out of step with the cam so open a new one */
+                    if (netcam->connect_keepalive) {
+                        netcam_disconnect(netcam);
+                    }
                     /* Need to have a dynamic delay here. */
                     continue;
                 }
@@ -346,8 +351,7 @@ static void *netcam_handler_loop(void *arg)
             MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO,_("Error getting jpeg image"));
             /* If FTP connection, attempt to re-connect to server. */
             if (netcam->ftp) {
-                close(netcam->ftp->control_file_desc);
-                if (ftp_connect(netcam) < 0) {
+                if (ftp_reconnect(netcam) < 0) {
                     MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO,_("Trying to re-connect"));
                 }
             }
@@ -550,7 +554,10 @@ void netcam_cleanup(netcam_context_ptr netcam, int init_retry_flag)
     }
     netcam->parameters = NULL;
 
-    free(netcam->response);
+    if (netcam->response != NULL) {
+        free(netcam->response->header);
+        free(netcam->response);
+    }
 
     pthread_mutex_destroy(&netcam->mutex);
     pthread_cond_destroy(&netcam->cap_cond);
@@ -619,6 +626,31 @@ int netcam_next(struct context *cnt, struct image_data *img_data)
     return netcam_proc_jpeg(netcam, img_data);
 }
 
+/**
+ * netcam_decode_high
+ *
+ *      Decode the full size image of a frame that was only decoded at
+ *      the detection size.  Called from the motion thread when a picture
+ *      or movie needs the high resolution image.
+ *
+ * Parameters:
+ *      cnt             pointer to the context for this thread
+ *      img_data        image holding the kept JPEG frame
+ *
+ * Returns:             0 on success, -1 on failure.
+ */
+int netcam_decode_high(struct context *cnt, struct image_data *img_data)
+{
+    netcam_context_ptr netcam = cnt->netcam;
+
+    if ((netcam == NULL) || (img_data->jpeg_size == 0)) {
+        return -1;
+    }
+
+    return jpgutl_decode_jpeg(img_data->jpeg_data, img_data->jpeg_size
+        , netcam->width, netcam->height, img_data->image_high);
+}
+
 /**
  * netcam_start
  *
@@ -678,7 +710,9 @@ int netcam_start(struct context *cnt)
     util_parms_parse(netcam->parameters, (char*)cnt->conf.netcam_params, TRUE);
     util_parms_add_default(netcam->parameters,"proxy","NULL");
     util_parms_add_default(netcam->parameters,"keepalive","off");
+    util_parms_add_default(netcam->parameters,"pipeline","off");
     util_parms_add_default(netcam->parameters,"tolerant_check","off"); /*false*/
+    util_parms_add_default(netcam->parameters,"decode_scale","1");
 
     for (indx = 0; indx < netcam->parameters->params_count; indx++) {
         if (mystreq(netcam->parameters->params_array[indx].param_name,"proxy") &&
@@ -771,6 +805,14 @@ int netcam_start(struct context *cnt)
                 ,netcam->connect_keepalive ? "ON":"OFF");
         }
 
+        if (mystreq(netcam->parameters->params_array[indx].param_name,"pipeline")) {
+            if (mystreq(netcam->parameters->params_array[indx].param_value,"on")) {
+                netcam->pipeline = TRUE;
+            } else {
+                netcam->pipeline = FALSE;
+            }
+        }
+
         if (mystreq(netcam->parameters->params_array[indx].param_name,"tolerant_check")) {
             if (mystreq(netcam->parameters->params_array[indx].param_value,"off")) {
                 netcam->netcam_tolerant_check = FALSE;
@@ -778,6 +820,17 @@ int netcam_start(struct context *cnt)
                 netcam->netcam_tolerant_check = TRUE;
             }
         }
+
+        if (mystreq(netcam->parameters->params_array[indx].param_name,"decode_scale")) {
+            netcam->decode_scale = atoi(netcam->parameters->params_array[indx].param_value);
+            if ((netcam->decode_scale != 1) && (netcam->decode_scale != 2) &&
+                (netcam->decode_scale != 4) && (netcam->decode_scale != 8)) {
+                MOTION_LOG(WRN, TYPE_NETCAM, NO_ERRNO
+                    ,_("Invalid decode_scale %s, must be 1, 2, 4 or 8.  Using 1")
+                    ,netcam->parameters->params_array[indx].param_value);
+                netcam->decode_scale = 1;
+            }
+        }
     }
 
 
@@ -844,16 +897,43 @@ int netcam_start(struct context *cnt)
         return -2;
     }
 
+    /* The detection image must itself be a multiple of 8 and in colour */
+    if ((netcam->decode_scale > 1) &&
+        (((netcam->width / netcam->decode_scale) % 8) ||
+         ((netcam->height / netcam->decode_scale) % 8) ||
+         (netcam->width % netcam->decode_scale) ||
+         (netcam->height % netcam->decode_scale) ||
+         netcam->jpeg_grey)) {
+        MOTION_LOG(NTC, TYPE_NETCAM, NO_ERRNO
+            ,_("decode_scale %d can not be used with the %dx%d %s images, using 1")
+            ,netcam->decode_scale, netcam->width, netcam->height
+            ,netcam->jpeg_grey ? "grey":"colour");
+        netcam->decode_scale = 1;
+    }
+
     /* Fill in camera details into context structure. */
-    cnt->imgs.width = netcam->width;
-    cnt->imgs.height = netcam->height;
-    cnt->imgs.size_norm = (netcam->width * netcam->height * 3) / 2;
-    cnt->imgs.motionsize = netcam->width * netcam->height;
+    cnt->imgs.width = netcam->width / netcam->decode_scale;
+    cnt->imgs.height = netcam->height / netcam->decode_scale;
+    cnt->imgs.size_norm = (cnt->imgs.width * cnt->imgs.height * 3) / 2;
+    cnt->imgs.motionsize = cnt->imgs.width * cnt->imgs.height;
 
     cnt->imgs.width_high  = 0;
     cnt->imgs.height_high = 0;
     cnt->imgs.size_high   = 0;
 
+    /*
+     * Detection runs on the scaled image while pictures and movies
+     * use the full size one, decoded only when it is needed.
+     */
+    if (netcam->decode_scale > 1) {
+        cnt->imgs.width_high  = netcam->width;
+        cnt->imgs.height_high = netcam->height;
+        cnt->imgs.size_high   = (netcam->width * netcam->height * 3) / 2;
+        MOTION_LOG(NTC, TYPE_NETCAM, NO_ERRNO
+            ,_("Decoding %dx%d for detection, %dx%d when pictures or movies need it")
+            ,cnt->imgs.width, cnt->imgs.height, netcam->width, netcam->height);
+    }
+
     pthread_attr_init(&handler_attribute);
     pthread_attr_setdetachstate(&handler_attribute, PTHREAD_CREATE_DETACHED);
     pthread_mutex_lock(&global_lock);
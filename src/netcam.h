@@ -176,6 +176,12 @@ typedef struct netcam_context {
                                   and then re-open it with Keep-Alive set again.
                                   Even Keep-Alive netcams need a close/open sometimes. */
 
+    int pipeline;               /* set to TRUE to send the request of the next
+                                  image before the current one is read */
+
+    int request_sent;           /* set to TRUE when the request of the next
+                                  image was already sent (pipelined) */
+
     char *connect_request;      /* contains the complete string
                                   required for connection to the
                                   camera */
@@ -224,6 +230,8 @@ typedef struct netcam_context {
 
     int JFIF_marker;            /* Debug to know if JFIF was present or not */
     unsigned int netcam_tolerant_check; /* For network cameras with buggy firmwares */
+    int decode_scale;           /* Detection image is decoded at 1/decode_scale of the JPEG size */
+    int jpeg_grey;              /* The camera sends grey scale JPEGs */
 
     struct timeval last_image;  /* time the most recent image was received */
     float av_frame_time;        /* "running average" of time between successive frames (microseconds) */
@@ -240,6 +248,7 @@ typedef struct netcam_context {
 
 int netcam_start(struct context *cnt);
 int netcam_next(struct context *cnt, struct image_data *img_data);
+int netcam_decode_high(struct context *cnt, struct image_data *img_data);
 void netcam_cleanup(netcam_context_ptr netcam, int init_retry_flag);
 void netcam_url_parse(struct url_t *parse_url, const char *text_url);
 void netcam_url_free(struct url_t *parse_url);
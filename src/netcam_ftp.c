@@ -874,6 +874,58 @@ static int ftp_send_type(ftp_context_pointer ctxt, char type)
     return 0;
 }
 
+/**
+* ftp_reconnect
+*
+*      Replace a failed control connection by a new, logged in one.  A
+*      prefetched image is lost with the old connection.
+*
+* Parameters:
+*
+*      netcam  Pointer to the netcam context.
+*
+* Returns -1 in case of error, 0 otherwise.
+*/
+int ftp_reconnect(netcam_context_ptr netcam)
+{
+    ftp_context_pointer ctxt = netcam->ftp;
+
+    if (ctxt == NULL) {
+        return -1;
+    }
+
+    netcam->request_sent = FALSE;
+
+    if (ctxt->data_file_desc >= 0) {
+        close(ctxt->data_file_desc);
+        ctxt->data_file_desc = -1;
+    }
+
+    if (ctxt->control_file_desc >= 0) {
+        close(ctxt->control_file_desc);
+        ctxt->control_file_desc = -1;
+    }
+
+    /* Whatever was left of the answers of the old server is stale. */
+    ctxt->control_buffer_index = 0;
+    ctxt->control_buffer_used = 0;
+    ctxt->control_buffer_answer = 0;
+
+    if (ftp_connect(netcam) < 0) {
+        return -1;
+    }
+
+    if (ftp_send_type(ctxt, 'I') < 0) {
+        MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO
+            ,_("Error sending TYPE I to ftp server"));
+        close(ctxt->control_file_desc);
+        ctxt->control_file_desc = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
 /**
 * ftp_read
 *
@@ -955,9 +1007,12 @@ int ftp_close(ftp_context_pointer ctxt)
  * netcam_read_ftp_jpeg
  *
  *      This routine reads from a netcam using the FTP protocol.
- *      The current implementation is still a little experimental,
- *      and needs some additional code for error detection and
- *      recovery.
+ *      The control connection stays logged in from one image to the
+ *      next and is only opened again once the server dropped it.
+ *      With the pipeline option the data connection and RETR of the
+ *      next image are set up as soon as the current one is received,
+ *      so the next transfer is under way while the current image is
+ *      decoded and the main loop is waited for.
  */
 static int netcam_read_ftp_jpeg(netcam_context_ptr netcam)
 {
@@ -968,10 +1023,21 @@ static int netcam_read_ftp_jpeg(netcam_context_ptr netcam)
     buffer = netcam->receiving;
     buffer->used = 0;
 
-    /* Request the image from the remote server. */
-    if (ftp_get_socket(netcam->ftp) <= 0) {
-        MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO,_("ftp_get_socket failed"));
-        return -1;
+    if (netcam->request_sent) {
+        /* The image was already requested after the previous one. */
+        netcam->request_sent = FALSE;
+    } else {
+        /* The server closes idle control connections, so log in again. */
+        if ((netcam->ftp->control_file_desc < 0) && (ftp_reconnect(netcam) < 0)) {
+            MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO,_("ftp_reconnect failed"));
+            return -1;
+        }
+
+        /* Request the image from the remote server. */
+        if (ftp_get_socket(netcam->ftp) <= 0) {
+            MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO,_("ftp_get_socket failed"));
+            return -1;
+        }
     }
 
     /* Now fetch the image using ftp_read.  Note this is a blocking call. */
@@ -989,6 +1055,17 @@ static int netcam_read_ftp_jpeg(netcam_context_ptr netcam)
 
     netcam_image_read_complete(netcam);
 
+    /*
+     * The current image is complete and confirmed on the control connection
+     * so the next one can be requested while this one is decoded.  When this
+     * fails the next image is simply requested the usual way.
+     */
+    if (netcam->pipeline && (netcam->ftp->control_file_desc >= 0)) {
+        if (ftp_get_socket(netcam->ftp) > 0) {
+            netcam->request_sent = TRUE;
+        }
+    }
+
     return 0;
 }
 
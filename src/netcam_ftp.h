@@ -50,6 +50,7 @@ typedef struct ftp_context {
 /* The public interface */
 int ftp_close(ftp_context_pointer ctxt);
 int ftp_connect(netcam_context_ptr netcam);
+int ftp_reconnect(netcam_context_ptr netcam);
 int netcam_setup_ftp(netcam_context_ptr netcam, struct url_t *url);
 
 #endif
@@ -25,6 +25,8 @@
  *      Copyright 2005, William M. Brack
  ***********************************************************/
 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "translate.h"
 #include "motion.h"
 #include "util.h"
@@ -37,6 +39,7 @@
 #define POLLING_TIMEOUT  READ_TIMEOUT /* File polling timeout [s] */
 #define POLLING_TIME  500*1000*1000   /* File polling time quantum [ns] (500ms) */
 #define MAX_HEADER_RETRIES      5     /* Max tries to find a header record */
+#define BODY_READ_SIZE  (64 * 1024)   /* Image buffer growth while reading a body */
 #define MINVAL(x, y) ((x) < (y) ? (x) : (y))
 
 /* These strings are used for the HTTP connection. */
@@ -279,12 +282,10 @@ int netcam_read_next_header(netcam_context_ptr netcam)
                         ,header);
                  }
 
-                free(header);
                 return -1;
             }
 
             retval = (strstr(header, netcam->boundary) == NULL);
-            free(header);
 
             if (!retval) {
                 break;
@@ -297,7 +298,6 @@ int netcam_read_next_header(netcam_context_ptr netcam)
 
         if (retval != HG_OK) {
             MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO,_("Error reading image header (2)"));
-            free(header);
             return -1;
         }
 
@@ -308,7 +308,6 @@ int netcam_read_next_header(netcam_context_ptr netcam)
         if ((retval = netcam_check_content_type(header)) >= 0) {
             if (retval != 1) {
                 MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO,_("Header not JPEG"));
-                free(header);
                 return -1;
             }
         }
@@ -320,17 +319,35 @@ int netcam_read_next_header(netcam_context_ptr netcam)
             } else {
                 netcam->receiving->content_length = 0;
                 MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO,_("Content-Length 0"));
-                free(header);
                 return -1;
             }
         }
-
-        free(header);
     }
 
     MOTION_LOG(DBG, TYPE_NETCAM, NO_ERRNO,_("Found image header record"));
 
-    free(header);
+    return 0;
+}
+
+/**
+ * netcam_send_request
+ *
+ *      Send the request for an image to the camera.
+ *
+ * Parameters:
+ *      netcam          Pointer to the netcam_context structure.
+ *
+ * Returns:             0 for success, -1 if any error.
+ */
+static int netcam_send_request(netcam_context_ptr netcam)
+{
+    if (send(netcam->sock, netcam->connect_request,
+             strlen(netcam->connect_request), MSG_NOSIGNAL) < 0) {
+        MOTION_LOG(ERR, TYPE_NETCAM, SHOW_ERRNO
+            ,_("Error sending 'connect' request"));
+        return -1;
+    }
+
     return 0;
 }
 
@@ -363,14 +380,14 @@ int netcam_read_first_header(netcam_context_ptr netcam)
     int firstflag = 1;
     int aliveflag = 0;    /* If we have seen a Keep-Alive header from cam. */
     int closeflag = 0;    /* If we have seen a Connection: close header from cam. */
+    int http11 = 0;       /* If the cam answered with HTTP/1.1 */
     char *header;
     char *boundary;
 
-    /* Send the initial command to the camera. */
-    if (send(netcam->sock, netcam->connect_request,
-             strlen(netcam->connect_request), 0) < 0) {
-        MOTION_LOG(ERR, TYPE_NETCAM, SHOW_ERRNO
-            ,_("Error sending 'connect' request"));
+    /* Send the initial command to the camera unless it was pipelined. */
+    if (netcam->request_sent) {
+        netcam->request_sent = FALSE;
+    } else if (netcam_send_request(netcam) < 0) {
         return -1;
     }
 
@@ -404,7 +421,6 @@ int netcam_read_first_header(netcam_context_ptr netcam)
         if (ret != HG_OK) {
             MOTION_LOG(WRN, TYPE_NETCAM, NO_ERRNO
                 ,_("Error reading first header (%s)"), header);
-            free(header);
             return -1;
         }
 
@@ -412,7 +428,6 @@ int netcam_read_first_header(netcam_context_ptr netcam)
             if ((ret = http_result_code(header)) != 200) {
                 MOTION_LOG(DBG, TYPE_NETCAM, NO_ERRNO,_("HTTP Result code %d"), ret);
 
-                free(header);
                 if (netcam->connect_keepalive) {
                     /*
                      * Cannot unset netcam->cnt->conf.netcam_keepalive as it is assigned const
@@ -427,8 +442,8 @@ int netcam_read_first_header(netcam_context_ptr netcam)
                 }
                 return ret;
             }
+            http11 = (strncmp(header, "HTTP/1.1", 8) == 0);
             firstflag = 0;
-            free(header);
             continue;
         }
 
@@ -483,7 +498,6 @@ int netcam_read_first_header(netcam_context_ptr netcam)
                 } else {
                     MOTION_LOG(NTC, TYPE_NETCAM, NO_ERRNO
                         ,_("Boundary string not found in header"));
-                    free(header);
                     return -1;
                 }
                 break;
@@ -496,7 +510,6 @@ int netcam_read_first_header(netcam_context_ptr netcam)
             default:
                 /* Error */
                 MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO,_("Unrecognized content type"));
-                free(header);
                 return -1;
 
             }
@@ -529,9 +542,16 @@ int netcam_read_first_header(netcam_context_ptr netcam)
              MOTION_LOG(NTC, TYPE_NETCAM, NO_ERRNO
                 ,_("Found Conn: close header ('%s')"), header);
         }
-        free(header);
     }
-    free(header);
+
+    /*
+     * HTTP/1.1 connections are persistent unless the cam says close so
+     * most HTTP/1.1 cams do not send a Keep-Alive header at all.
+     */
+    if (http11 && netcam->connect_http_11 && !closeflag) {
+        aliveflag = TRUE;
+        netcam->keepalive_thisconn = TRUE;
+    }
 
     if (netcam->caps.streaming == NCS_UNSUPPORTED && netcam->connect_keepalive) {
 
@@ -644,6 +664,9 @@ int netcam_read_first_header(netcam_context_ptr netcam)
  */
 void netcam_disconnect(netcam_context_ptr netcam)
 {
+    /* A pipelined request is lost with the connection */
+    netcam->request_sent = FALSE;
+
     if (netcam->sock > 0) {
         if (close(netcam->sock) < 0) {
             MOTION_LOG(ERR, TYPE_NETCAM, SHOW_ERRNO, _("disconnect"));
@@ -835,6 +858,12 @@ int netcam_connect(netcam_context_ptr netcam, int err_flag)
         return -1;
     }
 
+    /* The requests are small and would otherwise wait for the ack of the previous one */
+    optval = 1;
+    if (setsockopt(netcam->sock, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) < 0) {
+        MOTION_LOG(DBG, TYPE_NETCAM, SHOW_ERRNO, "setsockopt(TCP_NODELAY)");
+    }
+
     /* The socket info is stored in the rbuf structure of our context. */
     rbuf_initialize(netcam);
 
@@ -922,6 +951,87 @@ void netcam_image_read_complete(netcam_context_ptr netcam)
     pthread_mutex_unlock(&netcam->mutex);
 }
 
+/**
+ * netcam_read_body
+ *
+ *      Read len bytes of image data into the buffer.  What is left in the
+ *      response buffer is taken first and the rest is received straight into
+ *      the image buffer instead of passing through the response buffer.
+ *      The buffer grows as the data arrives rather than to the length the
+ *      camera gave.
+ *
+ * Parameters:
+ *      netcam          Pointer to netcam context
+ *      buffer          Image buffer the data is added to
+ *      len             Number of bytes to read
+ *
+ * Returns:             0 for success, -1 if the data could not be received
+ */
+static int netcam_read_body(netcam_context_ptr netcam, netcam_buff_ptr buffer, size_t len)
+{
+    ssize_t retval;
+    size_t done, want;
+
+    done = 0;
+    while (done < len) {
+        want = MINVAL(len - done, BODY_READ_SIZE);
+        netcam_check_buffsize(buffer, done + want);
+
+        retval = rbuf_flush(netcam, buffer->ptr + buffer->used + done, (int)want);
+        if (retval == 0) {
+            retval = netcam_recv(netcam, buffer->ptr + buffer->used + done, want);
+        }
+        if (retval <= 0) {
+            buffer->used += done;
+            return -1;
+        }
+        done += retval;
+    }
+    buffer->used += done;
+
+    return 0;
+}
+
+/**
+ * netcam_trim_boundary
+ *
+ *      A streaming camera may send a Content-Length which does not match the
+ *      image.  When the boundary string is found in the image read, the image
+ *      is cut there and what follows is put back into the response buffer to
+ *      be read as the next header.
+ *
+ * Parameters:
+ *      netcam          Pointer to netcam context
+ *      buffer          Image buffer read with the Content-Length
+ *
+ * Returns:             Nothing
+ */
+static void netcam_trim_boundary(netcam_context_ptr netcam, netcam_buff_ptr buffer)
+{
+    struct rbuf *response = netcam->response;
+    char *ptr;
+    size_t rest;
+
+    ptr = memmem(buffer->ptr, buffer->used, netcam->boundary, netcam->boundary_length);
+    if (ptr == NULL) {
+        return;
+    }
+
+    rest = buffer->used - (ptr - buffer->ptr);
+    buffer->used = ptr - buffer->ptr;
+
+    MOTION_LOG(DBG, TYPE_NETCAM, NO_ERRNO
+        ,_("Boundary found inside Content-Length, %d bytes given back"), (int)rest);
+
+    /* If it does not fit, the next header is found by skipping to the next boundary */
+    if ((rest + response->buffer_left) <= sizeof(response->buffer)) {
+        memmove(response->buffer + rest, response->buffer_pos, response->buffer_left);
+        memcpy(response->buffer, ptr, rest);
+        response->buffer_pos = response->buffer;
+        response->buffer_left += rest;
+    }
+}
+
 /**
  * netcam_read_html_jpeg
  *
@@ -994,6 +1104,19 @@ static int netcam_read_html_jpeg(netcam_context_ptr netcam)
     buffer = netcam->receiving;
     /* Assure the target buffer is empty. */
     buffer->used = 0;
+
+    /*
+     * With pipelining the request for the next image is sent before this
+     * one is read, so the next image is on its way while this body is read
+     * and the main loop is waited for.  This needs the length of the body
+     * since the next response follows it on the same connection.
+     */
+    if (netcam->pipeline && netcam->connect_keepalive && !netcam->keepalive_timeup &&
+        (netcam->caps.streaming == NCS_UNSUPPORTED) && (buffer->content_length > 0)) {
+        if (netcam_send_request(netcam) == 0) {
+            netcam->request_sent = TRUE;
+        }
+    }
     /* Prepare for read loop. */
     if (buffer->content_length != 0) {
         remaining = buffer->content_length;
@@ -1001,6 +1124,23 @@ static int netcam_read_html_jpeg(netcam_context_ptr netcam)
         remaining = 9999999;
     }
 
+    /*
+     * With a Content-Length the image is received straight into its buffer
+     * and only checked for a boundary afterwards, so the read loop below is
+     * only used when the end of the image must be found in the stream.
+     */
+    if (buffer->content_length != 0) {
+        if (netcam_read_body(netcam, buffer, remaining) < 0) {
+            MOTION_LOG(ERR, TYPE_NETCAM, SHOW_ERRNO
+                ,_("recv() fail reading image of %d bytes"), (int)remaining);
+            return -1;
+        }
+        if (netcam->boundary) {
+            netcam_trim_boundary(netcam, buffer);
+        }
+        remaining = 0;
+    }
+
     /* Now read in the data. */
     while (remaining) {
         /* Assure data in input buffer. */
@@ -1637,28 +1777,16 @@ static int netcam_read_mjpg_jpeg(netcam_context_ptr netcam)
             continue ;
         }
 
-        /* Make room for the chunk. */
-        netcam_check_buffsize(buffer, (int) mh.mh_chunksize);
-
-        read_bytes = 0;
-        while (read_bytes < mh.mh_chunksize) {
-            retval = rbuf_flush(netcam, buffer->ptr + buffer->used + read_bytes,
-                                mh.mh_chunksize - read_bytes);
-            read_bytes += retval;
-            MOTION_LOG(DBG, TYPE_NETCAM, NO_ERRNO
-                ,_("Read [%d/%d] chunk bytes, [%d/%d] total")
-                ,read_bytes, mh.mh_chunksize
-                ,buffer->used + read_bytes, mh.mh_framesize);
-
-            if (retval < (int) (mh.mh_chunksize - read_bytes)) {
-                /* MOTION_LOG(EMG, TYPE_NETCAM, NO_ERRNO, "Chunk incomplete, going to refill."); */
-                if (netcam_mjpg_buffer_refill(netcam) < 0) {
-                    return -1;
-                }
-
+        /* The chunk is received straight into the image buffer. */
+        if (netcam_read_body(netcam, buffer, mh.mh_chunksize) < 0) {
+            MOTION_LOG(ALR, TYPE_NETCAM, NO_ERRNO
+                ,_("Read error, trying to reconnect.."));
+            if (netcam_http_request(netcam) < 0) {
+                MOTION_LOG(CRT, TYPE_NETCAM, NO_ERRNO
+                    ,_("lost the cam."));
             }
+            return -1;
         }
-        buffer->used += read_bytes;
 
         MOTION_LOG(DBG, TYPE_NETCAM, NO_ERRNO
             ,_("Chunk complete, buffer used [%d] bytes."), buffer->used);
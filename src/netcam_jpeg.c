@@ -31,6 +31,7 @@
 #include "util.h"
 #include "logger.h"
 #include "rotate.h"
+#include "video_common.h"
 #include "netcam.h"
 #include "netcam_jpeg.h"
 
@@ -272,10 +273,12 @@ static void netcam_output_message(j_common_ptr cinfo)
  * Parameters:
  *     netcam          pointer to netcam_context.
  *     cinfo           pointer to JPEG decompression context.
+ *     scale           decode the image at 1/scale of its size using
+ *                     the DCT scaling of the JPEG library.
  *
  * Returns:           Error code.
  */
-static int netcam_init_jpeg(netcam_context_ptr netcam, j_decompress_ptr cinfo)
+static int netcam_init_jpeg(netcam_context_ptr netcam, j_decompress_ptr cinfo, int scale)
 {
     netcam_buff_ptr buff;
 
@@ -353,6 +356,12 @@ static int netcam_init_jpeg(netcam_context_ptr netcam, j_decompress_ptr cinfo)
     /* Read file parameters (rejecting tables-only). */
     jpeg_read_header(cinfo, TRUE);
 
+    /* Decode directly at the reduced size, skipping the unused coefficients. */
+    if (scale > 1) {
+        cinfo->scale_num = 1;
+        cinfo->scale_denom = scale;
+    }
+
     /* Override the desired colour space. */
     if (cinfo->out_color_space != JCS_GRAYSCALE) {
         cinfo->out_color_space = JCS_YCbCr;
@@ -386,17 +395,19 @@ static int netcam_image_conv(netcam_context_ptr netcam, struct jpeg_decompress_s
     /* Working variables */
     int             linesize, i;
     unsigned char  *upic, *vpic;
-    unsigned char  *pic = img_data->image_norm;
+    unsigned char  *pic = vid_capture_image(netcam->cnt, img_data);
     unsigned char   y;              /* Switch for decoding YUV data */
     unsigned int    width, height;
 
     width = cinfo->output_width;
     height = cinfo->output_height;
 
-    if (width && ((width != netcam->width) || (height != netcam->height))) {
+    if (width && ((width != netcam->width / netcam->decode_scale) ||
+        (height != netcam->height / netcam->decode_scale))) {
         MOTION_LOG(WRN, TYPE_NETCAM, NO_ERRNO
             ,_("JPEG image size %dx%d, JPEG was %dx%d")
-            ,netcam->width, netcam->height, width, height);
+            ,netcam->width / netcam->decode_scale, netcam->height / netcam->decode_scale
+            ,width, height);
         jpeg_destroy_decompress(cinfo);
         netcam->jpeg_error |= 4;
         return netcam->jpeg_error;
@@ -448,6 +459,21 @@ static int netcam_image_conv(netcam_context_ptr netcam, struct jpeg_decompress_s
     jpeg_finish_decompress(cinfo);
     jpeg_destroy_decompress(cinfo);
 
+    /*
+     * When only the detection size was decoded, keep the frame so the
+     * full size image can be decoded if a picture or movie needs it.
+     */
+    if (netcam->decode_scale > 1) {
+        if (img_data->jpeg_alloc < (int)netcam->jpegbuf->used) {
+            img_data->jpeg_data = myrealloc(img_data->jpeg_data
+                , netcam->jpegbuf->used, "netcam_image_conv");
+            img_data->jpeg_alloc = netcam->jpegbuf->used;
+        }
+        memcpy(img_data->jpeg_data, netcam->jpegbuf->ptr, netcam->jpegbuf->used);
+        img_data->jpeg_size = netcam->jpegbuf->used;
+        img_data->high_pending = TRUE;
+    }
+
     rotate_map(netcam->cnt, img_data);
 
     if (netcam->jpeg_error) {
@@ -489,7 +515,7 @@ int netcam_proc_jpeg(netcam_context_ptr netcam,  struct image_data *img_data)
     MOTION_LOG(DBG, TYPE_NETCAM, NO_ERRNO
         ,_("processing jpeg image - content length %d"), netcam->latest->content_length);
 
-    ret = netcam_init_jpeg(netcam, &cinfo);
+    ret = netcam_init_jpeg(netcam, &cinfo, netcam->decode_scale);
     if (ret != 0) {
         return ret;
     }
@@ -501,13 +527,13 @@ int netcam_proc_jpeg(netcam_context_ptr netcam,  struct image_data *img_data)
      * restart of Motion.
      */
     if (netcam->width) {    /* 0 means not yet init'ed */
-        if ((cinfo.output_width != netcam->width) ||
-            (cinfo.output_height != netcam->height)) {
+        if ((cinfo.output_width != netcam->width / netcam->decode_scale) ||
+            (cinfo.output_height != netcam->height / netcam->decode_scale)) {
             retval = NETCAM_RESTART_ERROR;
             MOTION_LOG(ERR, TYPE_NETCAM, NO_ERRNO
                 ,_("Camera width/height mismatch with JPEG image - "
                 " expected %dx%d, JPEG %dx%d retval %d")
-                ,netcam->width, netcam->height
+                ,netcam->width / netcam->decode_scale, netcam->height / netcam->decode_scale
                 ,cinfo.output_width, cinfo.output_height, retval);
             return retval;
         }
@@ -578,11 +604,12 @@ void netcam_get_dimensions(netcam_context_ptr netcam)
     struct jpeg_decompress_struct cinfo; /* Decompression control struct. */
     int ret;
 
-    ret = netcam_init_jpeg(netcam, &cinfo);
+    ret = netcam_init_jpeg(netcam, &cinfo, 1);
 
     netcam->width = cinfo.output_width;
     netcam->height = cinfo.output_height;
     netcam->JFIF_marker = cinfo.saw_JFIF_marker;
+    netcam->jpeg_grey = (cinfo.out_color_space == JCS_GRAYSCALE);
 
     jpeg_destroy_decompress(&cinfo);
 
@@ -26,7 +26,8 @@
  *      netcam_rtsp_setup
  *      netcam_rtsp_next
  *      netcam_rtsp_cleanup
- *  are called from video_common.c therefore must be defined even
+ *  are called from video_common.c and netcam_rtsp_demand from
+ *  motion.c therefore must be defined even
  *  if FFmpeg is not present.  They must also not have FFmpeg
  *  structures in the declarations.  Simple error
  *  messages are raised if called when no FFmpeg is found.
@@ -47,12 +48,16 @@
 #include "rotate.h"
 #include "netcam.h"
 #include "netcam_rtsp.h"
+#include "trace.h"
 #include "video_v4l2.h"  /* Needed to validate palette for v4l2 via netcam */
 
 #ifdef HAVE_FFMPEG
 
 #include "ffmpeg.h"
 
+#define NETCAM_RTSP_DEMAND_SEC  3       /* Seconds decoded on demand after the last request */
+#define NETCAM_RTSP_GOP_MAX     600     /* Packets kept since the last key frame while idle */
+
 static void netcam_rtsp_free_pkt(struct rtsp_context *rtsp_data)
 {
     if (rtsp_data->packet_recv != NULL) {
@@ -105,6 +110,11 @@ static void netcam_rtsp_null_context(struct rtsp_context *rtsp_data)
     rtsp_data->codec_context   = NULL;
     rtsp_data->format_context  = NULL;
     rtsp_data->transfer_format = NULL;
+    #if (MYFFVER >= 57083) && defined(HAVE_AVFILTER)
+        rtsp_data->hw_graph        = NULL;
+        rtsp_data->hw_graph_src    = NULL;
+        rtsp_data->hw_graph_sink   = NULL;
+    #endif
 
 }
 
@@ -126,6 +136,11 @@ static void netcam_rtsp_close_context(struct rtsp_context *rtsp_data)
     if (rtsp_data->pktarray != NULL) {
         netcam_rtsp_pktarray_free(rtsp_data);
     }
+    if (rtsp_data->gop != NULL) {
+        netcam_rtsp_gop_free(rtsp_data);
+        free(rtsp_data->gop);
+        rtsp_data->gop = NULL;
+    }
     if (rtsp_data->codec_context != NULL) {
         my_avcodec_close(rtsp_data->codec_context);
     }
@@ -136,6 +151,9 @@ static void netcam_rtsp_close_context(struct rtsp_context *rtsp_data)
         avformat_close_input(&rtsp_data->transfer_format);
     }
     #if (MYFFVER >= 57083)
+        #ifdef HAVE_AVFILTER
+            if (rtsp_data->hw_graph != NULL) avfilter_graph_free(&rtsp_data->hw_graph);
+        #endif
         if (rtsp_data->hw_device_ctx   != NULL) av_buffer_unref(&rtsp_data->hw_device_ctx);
     #endif
     netcam_rtsp_null_context(rtsp_data);
@@ -165,7 +183,7 @@ static void netcam_rtsp_pktarray_resize(struct context *cnt, int is_highres)
     int                   indx;
     struct rtsp_context  *rtsp_data;
     struct packet_item   *tmp;
-    int                   newsize;
+    int                   newsize, fps;
 
     if (is_highres) {
         idnbr_last = cnt->imgs.image_ring[cnt->imgs.image_ring_out].idnbr_high;
@@ -177,7 +195,7 @@ static void netcam_rtsp_pktarray_resize(struct context *cnt, int is_highres)
         rtsp_data = cnt->rtsp;
     }
 
-    if (!rtsp_data->passthrough) {
+    if (!rtsp_data->keep_packets) {
         return;
     }
 
@@ -188,23 +206,44 @@ static void netcam_rtsp_pktarray_resize(struct context *cnt, int is_highres)
         newsize = 30;
     }
 
+    fps = rtsp_data->src_fps;
+    if (fps <= 0) {
+        fps = cnt->conf.framerate;
+    }
+
+    /* Hold twice the pre-roll so it can reach back to the key frame before it */
+    if (cnt->conf.movie_passthrough_preroll > 0) {
+        if (newsize < (cnt->conf.movie_passthrough_preroll * fps * 2)) {
+            newsize = cnt->conf.movie_passthrough_preroll * fps * 2;
+        }
+    }
+
+    /* Hold a few seconds so the HLS stream can start at the last key frame */
+    if (cnt->conf.stream_hls) {
+        if (newsize < (fps * 4)) {
+            newsize = fps * 4;
+        }
+    }
+
     pthread_mutex_lock(&rtsp_data->mutex_pktarray);
         if ((rtsp_data->pktarray_size < newsize) ||  (rtsp_data->pktarray_size < 30)) {
             tmp = mymalloc(newsize * sizeof(struct packet_item));
-            if (rtsp_data->pktarray_size > 0 ) {
-                memcpy(tmp, rtsp_data->pktarray, sizeof(struct packet_item) * rtsp_data->pktarray_size);
+            /* Copy the oldest packet first so the idnbr stay contiguous around the ring */
+            for(indx = 0; indx < rtsp_data->pktarray_size; indx++) {
+                tmp[indx] = rtsp_data->pktarray[
+                    (rtsp_data->pktarray_index + 1 + indx) % rtsp_data->pktarray_size];
             }
             for(indx = rtsp_data->pktarray_size; indx < newsize; indx++) {
-                tmp[indx].packet = my_packet_alloc(tmp[indx].packet);
+                tmp[indx].packet = my_packet_alloc(NULL);
                 tmp[indx].idnbr = 0;
                 tmp[indx].iskey = FALSE;
-                tmp[indx].iswritten = FALSE;
             }
 
             if (rtsp_data->pktarray != NULL) {
                 free(rtsp_data->pktarray);
             }
             rtsp_data->pktarray = tmp;
+            rtsp_data->pktarray_index = rtsp_data->pktarray_size - 1;
             rtsp_data->pktarray_size = newsize;
 
             MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
@@ -218,8 +257,7 @@ static void netcam_rtsp_pktarray_add(struct rtsp_context *rtsp_data)
 {
 
     int indx_next;
-    int retcd;
-    char errstr[128];
+    AVPacket *pkt;
 
     pthread_mutex_lock(&rtsp_data->mutex_pktarray);
 
@@ -237,27 +275,19 @@ static void netcam_rtsp_pktarray_add(struct rtsp_context *rtsp_data)
 
         rtsp_data->pktarray[indx_next].idnbr = rtsp_data->idnbr;
 
-        my_packet_free(rtsp_data->pktarray[indx_next].packet);
-        rtsp_data->pktarray[indx_next].packet = NULL;
-
-        rtsp_data->pktarray[indx_next].packet = my_packet_alloc(rtsp_data->pktarray[indx_next].packet);
-        retcd = my_copy_packet(rtsp_data->pktarray[indx_next].packet, rtsp_data->packet_recv);
-        if ((rtsp_data->interrupted) || (retcd < 0)) {
-            av_strerror(retcd, errstr, sizeof(errstr));
-            MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
-                ,_("%s: av_copy_packet: %s ,Interrupt: %s")
-                ,rtsp_data->cameratype
-                ,errstr, rtsp_data->interrupted ? _("True"):_("False"));
-            my_packet_free(rtsp_data->pktarray[indx_next].packet);
-            rtsp_data->pktarray[indx_next].packet = NULL;
-        }
+        /* Swap the received packet into the ring rather than copying it.
+         * The packet it replaces is released along with packet_recv
+         * after the lock is dropped.
+         */
+        pkt = rtsp_data->pktarray[indx_next].packet;
+        rtsp_data->pktarray[indx_next].packet = rtsp_data->packet_recv;
+        rtsp_data->packet_recv = pkt;
 
         if (rtsp_data->pktarray[indx_next].packet->flags & AV_PKT_FLAG_KEY) {
             rtsp_data->pktarray[indx_next].iskey = TRUE;
         } else {
             rtsp_data->pktarray[indx_next].iskey = FALSE;
         }
-        rtsp_data->pktarray[indx_next].iswritten = FALSE;
         rtsp_data->pktarray[indx_next].timestamp_tv.tv_sec = rtsp_data->img_recv->image_time.tv_sec;
         rtsp_data->pktarray[indx_next].timestamp_tv.tv_usec = rtsp_data->img_recv->image_time.tv_usec;
         rtsp_data->pktarray_index = indx_next;
@@ -265,6 +295,63 @@ static void netcam_rtsp_pktarray_add(struct rtsp_context *rtsp_data)
 
 }
 
+/* Keep a video packet that did not produce an image for the pass-through.
+ * Each packet gets its own idnbr so the writer puts it out with the next image.
+ */
+static void netcam_rtsp_pktarray_keep(struct rtsp_context *rtsp_data)
+{
+
+    if ((!rtsp_data->keep_packets) ||
+        (rtsp_data->packet_recv->stream_index != rtsp_data->video_stream_index)) {
+        return;
+    }
+
+    pthread_mutex_lock(&rtsp_data->mutex);
+        rtsp_data->idnbr++;
+        netcam_rtsp_pktarray_add(rtsp_data);
+    pthread_mutex_unlock(&rtsp_data->mutex);
+
+}
+
+static void netcam_rtsp_gop_free(struct rtsp_context *rtsp_data)
+{
+    int indx;
+
+    for (indx = 0; indx < rtsp_data->gop_count; indx++) {
+        my_packet_free(rtsp_data->gop[indx]);
+    }
+    rtsp_data->gop_count = 0;
+}
+
+/* Keep a video packet that is not decoded so the decoding can start from
+ * the last key frame when it is asked for.
+ */
+static void netcam_rtsp_gop_keep(struct rtsp_context *rtsp_data)
+{
+    AVPacket *pkt;
+
+    if (rtsp_data->packet_recv->flags & AV_PKT_FLAG_KEY) {
+        netcam_rtsp_gop_free(rtsp_data);
+    } else if ((rtsp_data->gop_count == 0) ||
+        (rtsp_data->gop_count == NETCAM_RTSP_GOP_MAX)) {
+        /* Wait for the next key frame */
+        netcam_rtsp_gop_free(rtsp_data);
+        return;
+    }
+
+    if (rtsp_data->gop == NULL) {
+        rtsp_data->gop = mymalloc(NETCAM_RTSP_GOP_MAX * sizeof(AVPacket *));
+    }
+
+    pkt = my_packet_alloc(NULL);
+    if (av_packet_ref(pkt, rtsp_data->packet_recv) < 0) {
+        my_packet_free(pkt);
+        netcam_rtsp_gop_free(rtsp_data);
+        return;
+    }
+    rtsp_data->gop[rtsp_data->gop_count++] = pkt;
+}
+
 static int netcam_decode_sw(struct rtsp_context *rtsp_data)
 {
 
@@ -280,12 +367,14 @@ static int netcam_decode_sw(struct rtsp_context *rtsp_data)
                 MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
                     ,_("%s: Ignoring packet with invalid data")
                     ,rtsp_data->cameratype);
+                rtsp_data->decode_errors++;
                 retcd = 0;
             } else if (retcd < 0) {
                 av_strerror(retcd, errstr, sizeof(errstr));
                     MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
                         ,_("%s: Rec frame error: %s")
                         ,rtsp_data->cameratype, errstr);
+                rtsp_data->decode_errors++;
                 retcd = -1;
             } else {
                 retcd = -1;
@@ -305,12 +394,14 @@ static int netcam_decode_sw(struct rtsp_context *rtsp_data)
 
         if (retcd == AVERROR_INVALIDDATA) {
             MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO, _("Ignoring packet with invalid data"));
+            rtsp_data->decode_errors++;
             return 0;
         }
 
         if (retcd < 0) {
             av_strerror(retcd, errstr, sizeof(errstr));
             MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO, _("Error decoding packet: %s"),errstr);
+            rtsp_data->decode_errors++;
             return -1;
         }
 
@@ -323,6 +414,158 @@ static int netcam_decode_sw(struct rtsp_context *rtsp_data)
     #endif
 }
 
+#if (MYFFVER >= 57083) && defined(HAVE_AVFILTER)
+
+static int netcam_hwscale_open(struct rtsp_context *rtsp_data, AVFrame *hw_frame)
+{
+    int retcd;
+    char args[256], filters[256];
+    AVBufferSrcParameters *par;
+    AVFilterInOut *outputs, *inputs;
+
+    rtsp_data->hw_graph = avfilter_graph_alloc();
+    if (rtsp_data->hw_graph == NULL) {
+        return -1;
+    }
+
+    snprintf(args, sizeof(args)
+        ,"video_size=%dx%d:pix_fmt=%d:time_base=1/1:pixel_aspect=1/1"
+        ,hw_frame->width, hw_frame->height, hw_frame->format);
+    retcd = avfilter_graph_create_filter(&rtsp_data->hw_graph_src
+        ,avfilter_get_by_name("buffer"), "in", args, NULL, rtsp_data->hw_graph);
+    if (retcd < 0) {
+        return -1;
+    }
+
+    /* The scale filters take the device from the frames of the decoder */
+    par = av_buffersrc_parameters_alloc();
+    if (par == NULL) {
+        return -1;
+    }
+    par->hw_frames_ctx = hw_frame->hw_frames_ctx;
+    retcd = av_buffersrc_parameters_set(rtsp_data->hw_graph_src, par);
+    av_free(par);
+    if (retcd < 0) {
+        return -1;
+    }
+
+    retcd = avfilter_graph_create_filter(&rtsp_data->hw_graph_sink
+        ,avfilter_get_by_name("buffersink"), "out", NULL, NULL, rtsp_data->hw_graph);
+    if (retcd < 0) {
+        return -1;
+    }
+
+    if (mystrceq(rtsp_data->decoder_nm,"vaapi")) {
+        snprintf(filters, sizeof(filters)
+            ,"scale_vaapi=w=%d:h=%d:format=nv12,hwdownload,format=nv12,format=yuv420p"
+            ,rtsp_data->imgsize.width, rtsp_data->imgsize.height);
+    } else {
+        snprintf(filters, sizeof(filters)
+            ,"scale_cuda=w=%d:h=%d,hwdownload,format=nv12,format=yuv420p"
+            ,rtsp_data->imgsize.width, rtsp_data->imgsize.height);
+    }
+
+    outputs = avfilter_inout_alloc();
+    inputs = avfilter_inout_alloc();
+    if ((outputs == NULL) || (inputs == NULL)) {
+        avfilter_inout_free(&outputs);
+        avfilter_inout_free(&inputs);
+        return -1;
+    }
+    outputs->name = av_strdup("in");
+    outputs->filter_ctx = rtsp_data->hw_graph_src;
+    outputs->pad_idx = 0;
+    outputs->next = NULL;
+    inputs->name = av_strdup("out");
+    inputs->filter_ctx = rtsp_data->hw_graph_sink;
+    inputs->pad_idx = 0;
+    inputs->next = NULL;
+
+    retcd = avfilter_graph_parse_ptr(rtsp_data->hw_graph, filters, &inputs, &outputs, NULL);
+    avfilter_inout_free(&outputs);
+    avfilter_inout_free(&inputs);
+    if (retcd < 0) {
+        return -1;
+    }
+
+    retcd = avfilter_graph_config(rtsp_data->hw_graph, NULL);
+    if (retcd < 0) {
+        return -1;
+    }
+
+    MOTION_LOG(NTC, TYPE_NETCAM, NO_ERRNO
+        ,_("%s: Scaling %dx%d to %dx%d on the %s device")
+        ,rtsp_data->cameratype, hw_frame->width, hw_frame->height
+        ,rtsp_data->imgsize.width, rtsp_data->imgsize.height
+        ,rtsp_data->decoder_nm);
+
+    return 0;
+}
+
+#endif
+
+#if (MYFFVER >= 57083)
+
+/* netcam_hwscale
+ *
+ * Scale a hw decoded frame to the image size on the device so only the
+ * small image is transferred to system memory.
+ *
+ * Return values:
+ *   0 hw scaling not used.  The frame must be transferred at full size
+ *   1 rtsp_data->frame has the scaled YUV420P image
+ */
+static int netcam_hwscale(struct rtsp_context *rtsp_data, AVFrame *hw_frame)
+{
+
+    #ifdef HAVE_AVFILTER
+        int retcd;
+
+        if ((!rtsp_data->hw_scale) || (rtsp_data->imgsize.width <= 0) ||
+            ((rtsp_data->imgsize.width == hw_frame->width) &&
+             (rtsp_data->imgsize.height == hw_frame->height))) {
+            return 0;
+        }
+
+        if (rtsp_data->hw_graph == NULL) {
+            if (netcam_hwscale_open(rtsp_data, hw_frame) < 0) {
+                MOTION_LOG(NTC, TYPE_NETCAM, NO_ERRNO
+                    ,_("%s: Unable to scale on the %s device.  Scaling in software.")
+                    ,rtsp_data->cameratype, rtsp_data->decoder_nm);
+                if (rtsp_data->hw_graph != NULL) {
+                    avfilter_graph_free(&rtsp_data->hw_graph);
+                }
+                rtsp_data->hw_scale = FALSE;
+                return 0;
+            }
+        }
+
+        retcd = av_buffersrc_add_frame_flags(rtsp_data->hw_graph_src
+            , hw_frame, AV_BUFFERSRC_FLAG_KEEP_REF);
+        if (retcd < 0) {
+            MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
+                ,_("%s: Error sending frame to the scaler"),rtsp_data->cameratype);
+            return 0;
+        }
+
+        av_frame_unref(rtsp_data->frame);
+        retcd = av_buffersink_get_frame(rtsp_data->hw_graph_sink, rtsp_data->frame);
+        if (retcd < 0) {
+            MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
+                ,_("%s: Error receiving frame from the scaler"),rtsp_data->cameratype);
+            return 0;
+        }
+
+        return 1;
+    #else
+        (void)rtsp_data;
+        (void)hw_frame;
+        return 0;
+    #endif
+}
+
+#endif
+
 static int netcam_decode_vaapi(struct rtsp_context *rtsp_data)
 {
 
@@ -342,12 +585,14 @@ static int netcam_decode_vaapi(struct rtsp_context *rtsp_data)
                 MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
                     ,_("%s: Ignoring packet with invalid data")
                     ,rtsp_data->cameratype);
+                rtsp_data->decode_errors++;
                 retcd = 0;
             } else if (retcd < 0) {
                 av_strerror(retcd, errstr, sizeof(errstr));
                     MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
                         ,_("%s: Rec frame error: %s")
                         ,rtsp_data->cameratype, errstr);
+                rtsp_data->decode_errors++;
                 retcd = -1;
             } else {
                 retcd = -1;
@@ -355,6 +600,12 @@ static int netcam_decode_vaapi(struct rtsp_context *rtsp_data)
             my_frame_free(hw_frame);
             return retcd;
         }
+
+        if (netcam_hwscale(rtsp_data, hw_frame) == 1) {
+            my_frame_free(hw_frame);
+            return 1;
+        }
+
         rtsp_data->frame->format=AV_PIX_FMT_YUV420P;
 
         retcd = av_hwframe_transfer_data(rtsp_data->frame, hw_frame, 0);
@@ -394,12 +645,14 @@ static int netcam_decode_cuda(struct rtsp_context *rtsp_data)
                 MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
                     ,_("%s: Ignoring packet with invalid data")
                     ,rtsp_data->cameratype);
+                rtsp_data->decode_errors++;
                 retcd = 0;
             } else if (retcd < 0) {
                 av_strerror(retcd, errstr, sizeof(errstr));
                     MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
                         ,_("%s: Rec frame error: %s")
                         ,rtsp_data->cameratype, errstr);
+                rtsp_data->decode_errors++;
                 retcd = -1;
             } else {
                 retcd = -1;
@@ -407,6 +660,12 @@ static int netcam_decode_cuda(struct rtsp_context *rtsp_data)
             my_frame_free(hw_frame);
             return retcd;
         }
+
+        if (netcam_hwscale(rtsp_data, hw_frame) == 1) {
+            my_frame_free(hw_frame);
+            return 1;
+        }
+
         rtsp_data->frame->format=AV_PIX_FMT_NV12;
 
         retcd = av_hwframe_transfer_data(rtsp_data->frame, hw_frame, 0);
@@ -459,12 +718,14 @@ static int netcam_rtsp_decode_video(struct rtsp_context *rtsp_data)
         if (retcd == AVERROR_INVALIDDATA) {
             MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
                 ,_("Ignoring packet with invalid data"));
+            rtsp_data->decode_errors++;
             return 0;
         }
         if (retcd < 0 && retcd != AVERROR_EOF) {
             av_strerror(retcd, errstr, sizeof(errstr));
             MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
                 ,_("Error sending packet to codec: %s"), errstr);
+            rtsp_data->decode_errors++;
             return -1;
         }
 
@@ -666,10 +927,17 @@ static void netcam_rtsp_decoder_error(struct rtsp_context *rtsp_data, int retcd,
         rtsp_data->decoder_nm = mymalloc(5);
         snprintf(rtsp_data->decoder_nm, 5, "%s","NULL");
 
-        if (rtsp_data->high_resolution) {
-            util_parms_update(rtsp_data->parameters, rtsp_data->cnt, "netcam_high_params");
-        } else {
-            util_parms_update(rtsp_data->parameters, rtsp_data->cnt, "netcam_params");
+        /*
+         * The config is only updated by the camera thread setting up the
+         * connection.  The handler may serve cameras other than the one which
+         * opened it, so it only keeps the change in its own parameters.
+         */
+        if (rtsp_data->handler_finished) {
+            if (rtsp_data->high_resolution) {
+                util_parms_update(rtsp_data->parameters, rtsp_data->cnt, "netcam_high_params");
+            } else {
+                util_parms_update(rtsp_data->parameters, rtsp_data->cnt, "netcam_params");
+            }
         }
     }
 
@@ -841,6 +1109,24 @@ static int netcam_init_swdecoder(struct rtsp_context *rtsp_data)
     #endif
 }
 
+/* Tell the decoder which frames to skip for the reduced rate detection */
+static void netcam_rtsp_skip_frame(struct rtsp_context *rtsp_data)
+{
+
+    if (rtsp_data->skip_frame == AVDISCARD_DEFAULT) {
+        return;
+    }
+
+    rtsp_data->codec_context->skip_frame = rtsp_data->skip_frame;
+
+    MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
+        ,_("%s: Decoding only %s frames")
+        ,rtsp_data->cameratype
+        ,(rtsp_data->skip_frame == AVDISCARD_NONKEY) ? _("key") :
+         (rtsp_data->skip_frame == AVDISCARD_BIDIR) ? _("non bidirectional") : _("reference"));
+
+}
+
 static int netcam_rtsp_open_codec(struct rtsp_context *rtsp_data)
 {
 
@@ -882,6 +1168,8 @@ static int netcam_rtsp_open_codec(struct rtsp_context *rtsp_data)
             return -1;
         }
 
+        netcam_rtsp_skip_frame(rtsp_data);
+
         MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
             ,_("%s: Decoder opened"), rtsp_data->cameratype);
 
@@ -914,6 +1202,9 @@ static int netcam_rtsp_open_codec(struct rtsp_context *rtsp_data)
         } else {
             retcd = netcam_init_swdecoder(rtsp_data);
         }
+        if (retcd == 0) {
+            netcam_rtsp_skip_frame(rtsp_data);
+        }
         return retcd;
     #endif
 
@@ -1140,7 +1431,57 @@ static int netcam_rtsp_resize(struct rtsp_context *rtsp_data)
 
 }
 
-static int netcam_rtsp_read_image(struct rtsp_context *rtsp_data)
+/** netcam_rtsp_demand_check
+ *  Start or stop the decoding of a high resolution camera decoded on
+ *  demand.  The decoding starts by running the packets kept since the
+ *  last key frame through the decoder so the next packet decodes to a
+ *  complete image.
+ */
+static void netcam_rtsp_demand_check(struct rtsp_context *rtsp_data)
+{
+    AVPacket *pkt;
+    int demand, indx;
+
+    if (!rtsp_data->decode_demand) {
+        rtsp_data->decoding = TRUE;
+        return;
+    }
+
+    pthread_mutex_lock(&rtsp_data->mutex);
+        demand = (time(NULL) < rtsp_data->demand_until);
+    pthread_mutex_unlock(&rtsp_data->mutex);
+
+    if (!demand) {
+        if (rtsp_data->decoding) {
+            MOTION_LOG(DBG, TYPE_NETCAM, NO_ERRNO
+                ,_("%s: Stopped decoding until requested"), rtsp_data->cameratype);
+        }
+        rtsp_data->decoding = FALSE;
+        return;
+    }
+
+    if (rtsp_data->decoding || (rtsp_data->gop_count == 0)) {
+        return;
+    }
+
+    MOTION_LOG(DBG, TYPE_NETCAM, NO_ERRNO
+        ,_("%s: Decoding on request from %d packets")
+        , rtsp_data->cameratype, rtsp_data->gop_count);
+
+    avcodec_flush_buffers(rtsp_data->codec_context);
+    pkt = rtsp_data->packet_recv;
+    for (indx = 0; indx < rtsp_data->gop_count; indx++) {
+        rtsp_data->packet_recv = rtsp_data->gop[indx];
+        if (netcam_rtsp_decode_video(rtsp_data) < 0) {
+            break;
+        }
+    }
+    rtsp_data->packet_recv = pkt;
+    netcam_rtsp_gop_free(rtsp_data);
+    rtsp_data->decoding = TRUE;
+}
+
+static int netcam_rtsp_read_next(struct rtsp_context *rtsp_data)
 {
 
     int  size_decoded;
@@ -1161,6 +1502,8 @@ static int netcam_rtsp_read_image(struct rtsp_context *rtsp_data)
     }
     rtsp_data->interruptduration = 10;
 
+    netcam_rtsp_demand_check(rtsp_data);
+
     rtsp_data->status = RTSP_READINGIMAGE;
     rtsp_data->img_recv->used = 0;
     size_decoded = 0;
@@ -1194,6 +1537,12 @@ static int netcam_rtsp_read_image(struct rtsp_context *rtsp_data)
                     if (rtsp_data->packet_recv->data != NULL) {
                         size_decoded = 1;
                     }
+                } else if (!rtsp_data->decoding) {
+                    /* Only the packets are kept until the image is asked for */
+                    if (rtsp_data->packet_recv->data != NULL) {
+                        netcam_rtsp_gop_keep(rtsp_data);
+                        size_decoded = 1;
+                    }
                 } else {
                     size_decoded = netcam_rtsp_decode_packet(rtsp_data);
                 }
@@ -1204,6 +1553,7 @@ static int netcam_rtsp_read_image(struct rtsp_context *rtsp_data)
             } else if (size_decoded == 0) {
                 /* Did not fail, just didn't get anything.  Try again */
                 nodata++;
+                netcam_rtsp_pktarray_keep(rtsp_data);
                 netcam_rtsp_free_pkt(rtsp_data);
                 rtsp_data->packet_recv = my_packet_alloc(rtsp_data->packet_recv);
             } else {
@@ -1225,8 +1575,8 @@ static int netcam_rtsp_read_image(struct rtsp_context *rtsp_data)
         rtsp_data->status = RTSP_CONNECTED;
     }
 
-    /* Skip resize/pix format for high pass-through */
-    if (!(rtsp_data->high_resolution && rtsp_data->passthrough)) {
+    /* Skip resize/pix format for high pass-through and packets not decoded */
+    if (!(rtsp_data->high_resolution && rtsp_data->passthrough) && rtsp_data->decoding) {
         if ((rtsp_data->imgsize.width  != rtsp_data->frame->width) ||
             (rtsp_data->imgsize.height != rtsp_data->frame->height) ||
             (netcam_rtsp_check_pixfmt(rtsp_data) != 0)) {
@@ -1240,14 +1590,15 @@ static int netcam_rtsp_read_image(struct rtsp_context *rtsp_data)
 
     pthread_mutex_lock(&rtsp_data->mutex);
         rtsp_data->idnbr++;
-        if (rtsp_data->passthrough) {
+        if (rtsp_data->keep_packets) {
             netcam_rtsp_pktarray_add(rtsp_data);
         }
-        if (!(rtsp_data->high_resolution && rtsp_data->passthrough)) {
+        if (!(rtsp_data->high_resolution && rtsp_data->passthrough) && rtsp_data->decoding) {
             xchg = rtsp_data->img_latest;
             rtsp_data->img_latest = rtsp_data->img_recv;
             rtsp_data->img_recv = xchg;
         }
+        rtsp_data->decoded = rtsp_data->decoding;
     pthread_mutex_unlock(&rtsp_data->mutex);
 
     netcam_rtsp_free_pkt(rtsp_data);
@@ -1265,7 +1616,7 @@ static int netcam_rtsp_read_image(struct rtsp_context *rtsp_data)
         }
     } else {
         if (rtsp_data->capture_rate < 1) {
-            rtsp_data->capture_rate = rtsp_data->conf->framerate;
+            rtsp_data->capture_rate = rtsp_data->framerate;
             MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
                     ,_("%s: capture_rate not specified in netcam_params. Using framerate %d")
                     ,rtsp_data->cameratype,rtsp_data->capture_rate);
@@ -1275,6 +1626,21 @@ static int netcam_rtsp_read_image(struct rtsp_context *rtsp_data)
     return 0;
 }
 
+/** netcam_rtsp_read_image
+ *  Read the next image from the camera as one span of the trace.
+ */
+static int netcam_rtsp_read_image(struct rtsp_context *rtsp_data)
+{
+    struct trace_span span;
+    int retcd;
+
+    trace_begin(&span);
+    retcd = netcam_rtsp_read_next(rtsp_data);
+    trace_end("netcam_rtsp_read_image", &span);
+
+    return retcd;
+}
+
 static int netcam_rtsp_ntc(struct rtsp_context *rtsp_data)
 {
 
@@ -1358,14 +1724,20 @@ static void netcam_rtsp_set_options(struct rtsp_context *rtsp_data)
             ,_("%s: Setting input_format video4linux2"),rtsp_data->cameratype);
         rtsp_data->format_context->iformat = av_find_input_format("video4linux2");
 
-        sprintf(tmpval,"%d",rtsp_data->conf->framerate);
+        sprintf(tmpval,"%d",rtsp_data->framerate);
         util_parms_add_default(rtsp_data->parameters,"framerate", tmpval);
 
-        sprintf(tmpval,"%dx%d",rtsp_data->conf->width, rtsp_data->conf->height);
+        sprintf(tmpval,"%dx%d",rtsp_data->conf_width, rtsp_data->conf_height);
         util_parms_add_default(rtsp_data->parameters,"video_size", tmpval);
 
-        /* Allow a bit more time for the v4l2 device to start up */
-        rtsp_data->cnt->watchdog = 60;
+        /*
+         * Allow a bit more time for the v4l2 device to start up.  The watchdog
+         * is of the camera thread, which only waits for the connection before
+         * the handler is started.
+         */
+        if (rtsp_data->handler_finished) {
+            rtsp_data->cnt->watchdog = 60;
+        }
         rtsp_data->interruptduration = 55;
 
 
@@ -1475,7 +1847,9 @@ static void netcam_rtsp_set_parms (struct context *cnt, struct rtsp_context *rts
 
     int indx, val_len;
 
-    rtsp_data->conf = &cnt->conf;
+    rtsp_data->framerate = cnt->conf.framerate;
+    rtsp_data->conf_width = cnt->conf.width;
+    rtsp_data->conf_height = cnt->conf.height;
 
     if (rtsp_data->high_resolution) {
         rtsp_data->imgsize.width = 0;
@@ -1499,7 +1873,7 @@ static void netcam_rtsp_set_parms (struct context *cnt, struct rtsp_context *rts
 
     util_parms_add_default(rtsp_data->parameters,"decoder","NULL");
 
-    rtsp_data->camera_name = cnt->conf.camera_name;
+    rtsp_data->camera_name = mystrdup(cnt->conf.camera_name);
     rtsp_data->img_recv = mymalloc(sizeof(netcam_buff));
     rtsp_data->img_recv->ptr = mymalloc(NETCAM_BUFFSIZE);
     rtsp_data->img_latest = mymalloc(sizeof(netcam_buff));
@@ -1512,9 +1886,13 @@ static void netcam_rtsp_set_parms (struct context *cnt, struct rtsp_context *rts
     rtsp_data->first_image = TRUE;
     rtsp_data->reconnect_count = 0;
     rtsp_data->cnt = cnt;
+    rtsp_data->cnt_threadnr = cnt->threadnr;
     rtsp_data->src_fps =  -99; /* Default to invalid value so we can test for whether real value exist */
 
     rtsp_data->capture_rate = -1;
+    rtsp_data->hw_scale = TRUE;
+    rtsp_data->skip_frame = AVDISCARD_DEFAULT;
+    rtsp_data->decode_demand = FALSE;
     for (indx = 0; indx < rtsp_data->parameters->params_count; indx++) {
         if ( mystreq(rtsp_data->parameters->params_array[indx].param_name,"decoder")) {
             val_len = strlen(rtsp_data->parameters->params_array[indx].param_value) + 1;
@@ -1527,13 +1905,36 @@ static void netcam_rtsp_set_parms (struct context *cnt, struct rtsp_context *rts
             rtsp_data->capture_rate = atoi(rtsp_data->parameters->params_array[indx].param_value);
         }
 
+        if ( mystreq(rtsp_data->parameters->params_array[indx].param_name,"hw_scale")) {
+            rtsp_data->hw_scale = !mystreq(rtsp_data->parameters->params_array[indx].param_value,"off");
+        }
+
+        if ( mystreq(rtsp_data->parameters->params_array[indx].param_name,"skip_frame")) {
+            if (mystreq(rtsp_data->parameters->params_array[indx].param_value,"nonref")) {
+                rtsp_data->skip_frame = AVDISCARD_NONREF;
+            } else if (mystreq(rtsp_data->parameters->params_array[indx].param_value,"bidir")) {
+                rtsp_data->skip_frame = AVDISCARD_BIDIR;
+            } else if (mystreq(rtsp_data->parameters->params_array[indx].param_value,"nonkey")) {
+                rtsp_data->skip_frame = AVDISCARD_NONKEY;
+            } else {
+                rtsp_data->skip_frame = AVDISCARD_DEFAULT;
+            }
+        }
+
+        if ( mystreq(rtsp_data->parameters->params_array[indx].param_name,"decode")) {
+            rtsp_data->decode_demand = rtsp_data->high_resolution &&
+                mystreq(rtsp_data->parameters->params_array[indx].param_value,"demand");
+        }
+
     }
 
     /* If this is the norm and we have a highres, then disable passthru on the norm */
     if ((!rtsp_data->high_resolution) && (cnt->conf.netcam_high_url)) {
         rtsp_data->passthrough = FALSE;
+        rtsp_data->keep_packets = FALSE;
     } else {
         rtsp_data->passthrough = util_check_passthrough(cnt);
+        rtsp_data->keep_packets = (rtsp_data->passthrough || cnt->conf.stream_hls);
     }
 
     rtsp_data->interruptduration = 5;
@@ -1754,7 +2155,7 @@ static int netcam_rtsp_open_context(struct rtsp_context *rtsp_data)
         return -1;
     }
 
-    if (rtsp_data->passthrough) {
+    if (rtsp_data->keep_packets) {
         retcd = netcam_rtsp_copy_stream(rtsp_data);
         if ((retcd < 0) || (rtsp_data->interrupted)) {
             if (rtsp_data->status == RTSP_NOTCONNECTED) {
@@ -1763,6 +2164,7 @@ static int netcam_rtsp_open_context(struct rtsp_context *rtsp_data)
                     ,rtsp_data->cameratype);
             }
             rtsp_data->passthrough = FALSE;
+            rtsp_data->keep_packets = FALSE;
         }
     }
 
@@ -1788,6 +2190,14 @@ static int netcam_rtsp_connect(struct rtsp_context *rtsp_data)
         return -1;
     }
 
+    /* The first images are decoded to check the size and format */
+    rtsp_data->decoding = TRUE;
+    if (rtsp_data->decode_demand) {
+        pthread_mutex_lock(&rtsp_data->mutex);
+            rtsp_data->demand_until = time(NULL) + NETCAM_RTSP_DEMAND_SEC;
+        pthread_mutex_unlock(&rtsp_data->mutex);
+    }
+
     if (netcam_rtsp_ntc(rtsp_data) < 0) {
         return -1;
     }
@@ -1873,6 +2283,9 @@ static void netcam_rtsp_shutdown(struct rtsp_context *rtsp_data)
         }
         rtsp_data->decoder_nm = NULL;
 
+        free(rtsp_data->camera_name);
+        rtsp_data->camera_name = NULL;
+
         util_parms_free (rtsp_data->parameters);
 
         if (rtsp_data->parameters != NULL) {
@@ -1958,7 +2371,7 @@ static void *netcam_rtsp_handler(void *arg)
 
     MOTION_LOG(NTC, TYPE_NETCAM, NO_ERRNO
         ,_("%s: Camera handler thread [%d] started")
-        ,rtsp_data->cameratype, rtsp_data->threadnbr);
+        ,rtsp_data->cameratype, rtsp_data->cnt_threadnr);
 
     while (!rtsp_data->finish) {
         if (!rtsp_data->format_context) {      /* We must have disconnected.  Try to reconnect */
@@ -2050,6 +2463,105 @@ static int netcam_rtsp_start_handler(struct rtsp_context *rtsp_data)
 
 }
 
+/* Connections opened by one camera and also used by every other camera
+ * configured with the same url, netcam_params, image size and the other
+ * options the connection is set up with.
+ */
+static pthread_mutex_t netcam_rtsp_shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct rtsp_context *netcam_rtsp_shared = NULL;
+
+static char *netcam_rtsp_shared_key(struct context *cnt)
+{
+    char *key;
+    int key_len;
+
+    key_len = snprintf(NULL, 0, "%s|%s|%s|%dx%d|%d|%d|%d"
+        , cnt->conf.netcam_url
+        , (cnt->conf.netcam_params) ? cnt->conf.netcam_params : ""
+        , (cnt->conf.netcam_userpass) ? cnt->conf.netcam_userpass : ""
+        , cnt->conf.width, cnt->conf.height, cnt->conf.framerate
+        , util_check_passthrough(cnt), cnt->conf.stream_hls) + 1;
+    key = mymalloc(key_len);
+    snprintf(key, key_len, "%s|%s|%s|%dx%d|%d|%d|%d"
+        , cnt->conf.netcam_url
+        , (cnt->conf.netcam_params) ? cnt->conf.netcam_params : ""
+        , (cnt->conf.netcam_userpass) ? cnt->conf.netcam_userpass : ""
+        , cnt->conf.width, cnt->conf.height, cnt->conf.framerate
+        , util_check_passthrough(cnt), cnt->conf.stream_hls);
+
+    return key;
+}
+
+/* Use the connection of another camera with the same key.  Returns TRUE when found */
+static int netcam_rtsp_shared_get(struct context *cnt, const char *key)
+{
+    struct rtsp_context *rtsp_data;
+
+    pthread_mutex_lock(&netcam_rtsp_shared_mutex);
+        rtsp_data = netcam_rtsp_shared;
+        while (rtsp_data != NULL) {
+            if (mystreq(rtsp_data->shared_key, key) && !rtsp_data->finish) {
+                rtsp_data->shared_count++;
+                cnt->rtsp = rtsp_data;
+                break;
+            }
+            rtsp_data = rtsp_data->shared_next;
+        }
+    pthread_mutex_unlock(&netcam_rtsp_shared_mutex);
+
+    if (rtsp_data == NULL) {
+        return FALSE;
+    }
+
+    MOTION_LOG(NTC, TYPE_NETCAM, NO_ERRNO
+        ,_("%s: Sharing the connection opened by camera %d")
+        ,rtsp_data->cameratype, rtsp_data->cnt_threadnr);
+
+    return TRUE;
+}
+
+static void netcam_rtsp_shared_add(struct rtsp_context *rtsp_data, char *key)
+{
+    pthread_mutex_lock(&netcam_rtsp_shared_mutex);
+        rtsp_data->shared_key = key;
+        rtsp_data->shared_count = 1;
+        rtsp_data->shared_next = netcam_rtsp_shared;
+        netcam_rtsp_shared = rtsp_data;
+    pthread_mutex_unlock(&netcam_rtsp_shared_mutex);
+}
+
+/* Release our use of a shared connection.  Returns TRUE when other cameras still use it */
+static int netcam_rtsp_shared_release(struct rtsp_context *rtsp_data)
+{
+    struct rtsp_context **item;
+    int inuse;
+
+    if (rtsp_data->shared_key == NULL) {
+        return FALSE;
+    }
+
+    pthread_mutex_lock(&netcam_rtsp_shared_mutex);
+        inuse = (--rtsp_data->shared_count > 0);
+        if (!inuse) {
+            item = &netcam_rtsp_shared;
+            while (*item != NULL) {
+                if (*item == rtsp_data) {
+                    *item = rtsp_data->shared_next;
+                    break;
+                }
+                item = &(*item)->shared_next;
+            }
+        }
+    pthread_mutex_unlock(&netcam_rtsp_shared_mutex);
+
+    if (!inuse) {
+        free(rtsp_data->shared_key);
+        rtsp_data->shared_key = NULL;
+    }
+
+    return inuse;
+}
+
 /*********************************************************
  *  This ends the section of functions that rely upon FFmpeg
  ***********************************************************/
@@ -2063,6 +2575,7 @@ int netcam_rtsp_setup(struct context *cnt)
         int retcd;
         int indx_cam, indx_max;
         struct rtsp_context *rtsp_data;
+        char *shared_key;
 
         cnt->rtsp = NULL;
         cnt->rtsp_high = NULL;
@@ -2071,6 +2584,16 @@ int netcam_rtsp_setup(struct context *cnt)
             return -1;
         }
 
+        /* Cameras using a high resolution stream are not shared */
+        shared_key = NULL;
+        if (cnt->conf.netcam_high_url == NULL) {
+            shared_key = netcam_rtsp_shared_key(cnt);
+            if (netcam_rtsp_shared_get(cnt, shared_key)) {
+                free(shared_key);
+                return 0;
+            }
+        }
+
         indx_cam = 1;
         if (cnt->conf.netcam_high_url) {
             indx_max = 2;
@@ -2104,6 +2627,7 @@ int netcam_rtsp_setup(struct context *cnt)
             netcam_rtsp_set_parms(cnt, rtsp_data);
 
             if (netcam_rtsp_connect(rtsp_data) < 0) {
+                free(shared_key);
                 return -1;
             }
 
@@ -2112,6 +2636,7 @@ int netcam_rtsp_setup(struct context *cnt)
                 MOTION_LOG(CRT, TYPE_NETCAM, NO_ERRNO
                     ,_("Failed trying to read first image - retval:%d"), retcd);
                 rtsp_data->status = RTSP_NOTCONNECTED;
+                free(shared_key);
                 return -1;
             }
             /* When running dual, there seems to be contamination across norm/high with codec functions. */
@@ -2129,12 +2654,17 @@ int netcam_rtsp_setup(struct context *cnt)
             }
 
             if (netcam_rtsp_start_handler(rtsp_data) < 0) {
+                free(shared_key);
                 return -1;
             }
 
             indx_cam++;
         }
 
+        if (shared_key != NULL) {
+            netcam_rtsp_shared_add(cnt->rtsp, shared_key);
+        }
+
         return 0;
 
     #else  /* No FFmpeg/Libav */
@@ -2168,10 +2698,16 @@ int netcam_rtsp_next(struct context *cnt, struct image_data *img_data)
             }
             pthread_mutex_lock(&cnt->rtsp_high->mutex);
                 netcam_rtsp_pktarray_resize(cnt, TRUE);
+                img_data->high_pending = FALSE;
                 if (!cnt->rtsp_high->passthrough) {
-                    memcpy(img_data->image_high
-                        ,cnt->rtsp_high->img_latest->ptr
-                        ,cnt->rtsp_high->img_latest->used);
+                    if (cnt->rtsp_high->decoded) {
+                        memcpy(img_data->image_high
+                            ,cnt->rtsp_high->img_latest->ptr
+                            ,cnt->rtsp_high->img_latest->used);
+                    } else {
+                        /* Made from the normal image when used, see motion_image_high */
+                        img_data->high_pending = TRUE;
+                    }
                 }
                 img_data->idnbr_high = cnt->rtsp_high->idnbr;
             pthread_mutex_unlock(&cnt->rtsp_high->mutex);
@@ -2216,7 +2752,10 @@ void netcam_rtsp_cleanup(struct context *cnt, int init_retry_flag)
                 rtsp_data = cnt->rtsp_high;
             }
 
-            if (rtsp_data) {
+            if (rtsp_data && netcam_rtsp_shared_release(rtsp_data)) {
+                MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
+                    ,_("%s: Network camera still used by other cameras."),rtsp_data->cameratype);
+            } else if (rtsp_data) {
                 MOTION_LOG(INF, TYPE_NETCAM, NO_ERRNO
                     ,_("%s: Shutting down network camera."),rtsp_data->cameratype);
 
@@ -2274,3 +2813,21 @@ void netcam_rtsp_cleanup(struct context *cnt, int init_retry_flag)
 
 }
 
+/**
+ * netcam_rtsp_demand
+ *  Ask for the images of a high resolution camera decoded on demand for
+ *  the next NETCAM_RTSP_DEMAND_SEC seconds.
+ */
+void netcam_rtsp_demand(struct context *cnt)
+{
+    #ifdef HAVE_FFMPEG
+        if ((cnt->rtsp_high == NULL) || (!cnt->rtsp_high->decode_demand)) {
+            return;
+        }
+        pthread_mutex_lock(&cnt->rtsp_high->mutex);
+            cnt->rtsp_high->demand_until = time(NULL) + NETCAM_RTSP_DEMAND_SEC;
+        pthread_mutex_unlock(&cnt->rtsp_high->mutex);
+    #else  /* No FFmpeg/Libav */
+        (void)cnt;
+    #endif /* End #ifdef HAVE_FFMPEG */
+}
@@ -43,7 +43,6 @@ struct imgsize_context {
         AVPacket                 *packet;
         int64_t                   idnbr;
         int                       iskey;
-        int                       iswritten;
         struct timeval            timestamp_tv;
     };
 
@@ -57,7 +56,7 @@ struct imgsize_context {
         struct SwsContext        *swsctx;                /* Context for the resizing of the image */
         AVPacket                 *packet_recv;           /* The packet that is currently being processed */
         AVFormatContext          *transfer_format;       /* Format context just for transferring to pass-through */
-        struct packet_item       *pktarray;              /* Pointer to array of packets for passthru processing */
+        struct packet_item       *pktarray;              /* Ring of packets for passthru processing, ordered by idnbr */
         int                       pktarray_size;         /* The number of packets in array.  1 based */
         int                       pktarray_index;        /* The index to the most current packet in array */
         int64_t                   idnbr;                 /* A ID number to track the packet vs image */
@@ -68,7 +67,14 @@ struct imgsize_context {
             enum AVHWDeviceType       hw_type;
             enum AVPixelFormat        hw_pix_fmt;
             AVBufferRef               *hw_device_ctx;
+            #ifdef HAVE_AVFILTER
+                AVFilterGraph             *hw_graph;     /* Scales the hw frames before the download */
+                AVFilterContext           *hw_graph_src;
+                AVFilterContext           *hw_graph_sink;
+            #endif
         #endif
+        int                       hw_scale;         /* Boolean for whether to scale hw frames on the device */
+        enum AVDiscard            skip_frame;       /* Frames the decoder skips.  Packets are still kept */
         my_AVCodec               *decoder;
 
         enum RTSP_STATUS          status;                /* Status of whether the camera is connecting, closed, etc*/
@@ -85,10 +91,17 @@ struct imgsize_context {
         int                       handler_finished; /* Boolean for whether the handler is running or not */
         int                       first_image;      /* Boolean for whether we have captured the first image */
         int                       passthrough;      /* Boolean for whether we are doing pass-through processing */
+        int                       keep_packets;     /* Boolean for whether packets are kept for pass-through or HLS */
+        int                       decode_demand;    /* Boolean for decoding the high resolution only on demand */
+        time_t                    demand_until;     /* Decode on demand until this time, protected by mutex */
+        int                       decoding;         /* Boolean for whether the packets are being decoded */
+        int                       decoded;          /* Boolean for whether img_latest is of the latest packet */
+        AVPacket                **gop;              /* Packets since the last key frame while not decoding */
+        int                       gop_count;
 
         char                     *path;             /* The connection string to use for the camera */
         char                     *service;          /* String specifying the type of camera http, rtsp, v4l2 */
-        const char               *camera_name;      /* The name of the camera as provided in the config file */
+        char                     *camera_name;      /* The name of the camera as provided in the config file */
         char                      cameratype[30];   /* String specifying Normal or High for use in logging */
         struct imgsize_context    imgsize;          /* The image size parameters */
 
@@ -97,14 +110,22 @@ struct imgsize_context {
         int                       reconnect_count;  /* Count of the times reconnection is tried*/
         int                       src_fps;          /* The fps provided from source*/
         int                       capture_rate;     /* The framerate for the capture rate*/
+        unsigned long             decode_errors;    /* Count of the packets the decoder rejected */
 
         struct timeval            frame_prev_tm;    /* The time set before calling the av functions */
         struct timeval            frame_curr_tm;    /* Time during the interrupt to determine duration since start*/
 
         struct params_context    *parameters;       /* User specified parameters for the camera */
-        struct config            *conf;             /* Pointer to conf parms of parent cnt*/
+        int                       framerate;        /* The config of the camera that opened the connection, */
+        int                       conf_width;       /* copied since a shared connection outlives it */
+        int                       conf_height;
         char                      *decoder_nm;      /* User requested decoder */
-        struct context            *cnt;
+        struct context            *cnt;             /* The camera that opened it, only used before the handler starts */
+        int                       cnt_threadnr;     /* The thread number of that camera */
+
+        char                      *shared_key;      /* Url and parms when the connection is shared */
+        int                       shared_count;     /* Cameras using this connection */
+        struct rtsp_context       *shared_next;     /* Next shared connection */
 
         char                      threadname[16];   /* The thread name*/
         int                       threadnbr;        /* The thread number */
@@ -128,5 +149,6 @@ struct imgsize_context {
 int netcam_rtsp_setup(struct context *cnt);
 int netcam_rtsp_next(struct context *cnt, struct image_data *img_data);
 void netcam_rtsp_cleanup(struct context *cnt, int init_retry_flag);
+void netcam_rtsp_demand(struct context *cnt);
 
 #endif /* _INCLUDE_NETCAM_RTSP_H */
@@ -65,9 +65,10 @@
    horizontal TAB.  Also, this function will accept a header ending
    with just LF instead of CRLF.
 
-   The header may be of arbitrary length; the function will allocate
-   as much memory as necessary for it to fit.  It need not contain a
-   `:', thus you can use it to retrieve, say, HTTP status line.
+   The header may be of arbitrary length; the line buffer of the
+   connection is grown as much as necessary for it to fit.  *HDR is only
+   valid until the next call and must not be freed.  It need not contain
+   a `:', thus you can use it to retrieve, say, HTTP status line.
 
    All trailing whitespace is stripped from the header, and it is
    zero-terminated.
@@ -75,15 +76,21 @@
 int header_get(netcam_context_ptr netcam, char **hdr, enum header_get_flags flags)
 {
     int i;
-    int bufsize = 80;
 
-    *hdr = mymalloc(bufsize);
+    /* The line buffer is kept with the connection so it is not allocated per header */
+    if (netcam->response->header == NULL) {
+        netcam->response->header_size = 256;
+        netcam->response->header = mymalloc(netcam->response->header_size);
+    }
+    *hdr = netcam->response->header;
 
     for (i = 0; 1; i++) {
         int res;
-        /* #### Use DO_REALLOC?  */
-        if (i > bufsize - 1) {
-            *hdr = (char *)myrealloc(*hdr, (bufsize <<= 1), "");
+        if (i > netcam->response->header_size - 1) {
+            netcam->response->header_size <<= 1;
+            netcam->response->header = myrealloc(netcam->response->header
+                , netcam->response->header_size, "header_get");
+            *hdr = netcam->response->header;
         }
 
         res = RBUF_READCHAR (netcam, *hdr + i);
@@ -34,11 +34,13 @@
 /* Retrieval stream */
 struct rbuf
 {
-    char buffer[4096];      /* the input buffer */
+    char buffer[16384];     /* the input buffer */
     char *buffer_pos;       /* current position in the buffer */
     size_t buffer_left;     /* number of bytes left in the buffer:
                             buffer_left = buffer_end - buffer_pos */
     int ret;                /* used by RBUF_READCHAR macro */
+    char *header;           /* line returned by header_get, reused for each header */
+    int header_size;
 };
 
 /* Read a character from RBUF.  If there is anything in the buffer,
@@ -124,12 +124,14 @@ struct tiff_writing {
     unsigned data_offset;
 };
 
-static void put_direntry(struct tiff_writing *into, const char *data, unsigned length)
+/* Returns the offset of the data from the TIFF base */
+static unsigned put_direntry(struct tiff_writing *into, const char *data, unsigned length)
 {
     if (length <= 4) {
         /* Entries that fit in the directory entry are stored there */
         memset(into->buf, 0, 4);
         memcpy(into->buf, data, length);
+        return into->buf - into->base;
     } else {
         /* Longer entries are stored out-of-line */
         unsigned offset = into->data_offset;
@@ -142,80 +144,84 @@ static void put_direntry(struct tiff_writing *into, const char *data, unsigned l
         put_uint32(into->buf, offset);
         memcpy(into->base + offset, data, length);
         into->data_offset = offset + length;
+        return offset;
     }
 }
 
-static void put_stringentry(struct tiff_writing *into, unsigned tag, const char *str, int with_nul)
+/* Returns the offset of the string from the TIFF base */
+static unsigned put_stringentry(struct tiff_writing *into, unsigned tag, const char *str, int with_nul)
 {
     unsigned stringlength = strlen(str) + (with_nul?1:0);
+    unsigned offset;
 
     put_uint16(into->buf, tag);
     put_uint16(into->buf + 2, TIFF_TYPE_ASCII);
     put_uint32(into->buf + 4, stringlength);
     into->buf += 8;
-    put_direntry(into, str, stringlength);
+    offset = put_direntry(into, str, stringlength);
     into->buf += 4;
+
+    return offset;
 }
 
-static void put_subjectarea(struct tiff_writing *into, const struct coord *box)
+static void put_subjectarea_values(JOCTET *ool, const struct coord *box)
 {
+    put_uint16(ool  , box->x); /* Center.x */
+    put_uint16(ool+2, box->y); /* Center.y */
+    put_uint16(ool+4, box->width);
+    put_uint16(ool+6, box->height);
+}
+
+/* Returns the offset of the values from the TIFF base */
+static unsigned put_subjectarea(struct tiff_writing *into, const struct coord *box)
+{
+    unsigned offset = into->data_offset;
+
     put_uint16(into->buf    , EXIF_TAG_SUBJECT_AREA);
     put_uint16(into->buf + 2, TIFF_TYPE_USHORT);
     put_uint32(into->buf + 4, 4 /* Four USHORTs */);
     put_uint32(into->buf + 8, into->data_offset);
     into->buf += 12;
-    JOCTET *ool = into->base + into->data_offset;
-    put_uint16(ool  , box->x); /* Center.x */
-    put_uint16(ool+2, box->y); /* Center.y */
-    put_uint16(ool+4, box->width);
-    put_uint16(ool+6, box->height);
+    put_subjectarea_values(into->base + into->data_offset, box);
     into->data_offset += 8;
+
+    return offset;
 }
 
 /*
- * prepare_exif() is a comon function used to prepare
- * exif data to be inserted into jpeg or webp files
- *
+ * A prebuilt EXIF block of a camera.  The tags only change with the
+ * description and whether there is a subject area, so a new picture only
+ * patches the time stamps, time zone and subject area of the block.
  */
-unsigned prepare_exif(unsigned char **exif, const struct context *cnt
-            , const struct timeval *tv_in1, const struct coord *box)
-{
-    /* description, datetime, and subtime are the values that are actually
-     * put into the EXIF data
-    */
-    char *description, *datetime, *subtime;
-    char datetime_buf[22];
-    struct tm timestamp_tm;
-    struct timeval tv1;
+struct exif_template {
+    unsigned char   *marker;            /* NULL until built */
+    unsigned        len;
+    char            *description;       /* Description the block was built with */
+    unsigned        datetime_len;
+    unsigned        datetime_ofs[2];    /* TIFF and EXIF date and time in marker */
+    unsigned        tzoffset_ofs;
+    unsigned        box_ofs;
+};
 
-    gettimeofday(&tv1, NULL);
-    if (tv_in1 != NULL) {
-        tv1.tv_sec = tv_in1->tv_sec;
-        tv1.tv_usec = tv_in1->tv_usec;
-    }
+struct exif_cache {
+    pthread_mutex_t         mutex;      /* The pictures and the stream encoder share it */
+    struct exif_template    tmpl[2];    /* Without and with a subject area */
+};
 
-    localtime_r(&tv1.tv_sec, &timestamp_tm);
-    /* Exif requires this exact format */
-    snprintf(datetime_buf, 21, "%04d:%02d:%02d %02d:%02d:%02d",
-        (timestamp_tm.tm_year + 1900) & 0xffff,
-        (timestamp_tm.tm_mon + 1) & 0x0f,
-        timestamp_tm.tm_mday,
-        timestamp_tm.tm_hour,
-        timestamp_tm.tm_min,
-        timestamp_tm.tm_sec);
-    datetime = datetime_buf;
+/*
+ * exif_build() writes the EXIF data of the values given and, when tmpl
+ * is not NULL, the offsets of the values which change for each picture.
+ */
+static unsigned exif_build(unsigned char **exif, const char *description
+            , const char *datetime, int tzoffset, const struct coord *box
+            , struct exif_template *tmpl)
+{
+    const char *subtime;
 
     // TODO: Extract subsecond timestamp from somewhere, but only
     // use as much of it as is indicated by conf->frame_limit
     subtime = NULL;
 
-    if (cnt->conf.picture_exif) {
-        description = malloc(PATH_MAX);
-        mystrftime(cnt, description, PATH_MAX-1, cnt->conf.picture_exif, &tv1, NULL, 0);
-    } else {
-        description = NULL;
-    }
-
     /* Calculate an upper bound on the size of the APP1 marker so
      * we can allocate a buffer for it.
      */
@@ -280,6 +286,8 @@ unsigned prepare_exif(unsigned char **exif, const struct context *cnt
                                datasize;
 
     JOCTET *marker = malloc(buffer_size);
+    unsigned offset;
+
     memcpy(marker, exif_marker_start, 14); /* EXIF and TIFF headers */
 
     struct tiff_writing writing = (struct tiff_writing) {
@@ -298,7 +306,10 @@ unsigned prepare_exif(unsigned char **exif, const struct context *cnt
     }
 
     if (datetime) {
-        put_stringentry(&writing, TIFF_TAG_DATETIME, datetime, 1);
+        offset = put_stringentry(&writing, TIFF_TAG_DATETIME, datetime, 1);
+        if (tmpl != NULL) {
+            tmpl->datetime_ofs[0] = 6 + offset;
+        }
     }
 
     if (ifd1_tagcount > 0) {
@@ -311,7 +322,10 @@ unsigned prepare_exif(unsigned char **exif, const struct context *cnt
 
     if (datetime) {
         memcpy(writing.buf, exif_tzoffset_tag, 12);
-        put_sint16(writing.buf+8, timestamp_tm.tm_gmtoff / 3600);
+        put_sint16(writing.buf+8, tzoffset);
+        if (tmpl != NULL) {
+            tmpl->tzoffset_ofs = (writing.buf + 8) - marker;
+        }
         writing.buf += 12;
     }
 
@@ -327,11 +341,17 @@ unsigned prepare_exif(unsigned char **exif, const struct context *cnt
         writing.buf += 14;
 
         if (datetime) {
-            put_stringentry(&writing, EXIF_TAG_ORIGINAL_DATETIME, datetime, 1);
+            offset = put_stringentry(&writing, EXIF_TAG_ORIGINAL_DATETIME, datetime, 1);
+            if (tmpl != NULL) {
+                tmpl->datetime_ofs[1] = 6 + offset;
+            }
         }
 
         if (box) {
-            put_subjectarea(&writing, box);
+            offset = put_subjectarea(&writing, box);
+            if (tmpl != NULL) {
+                tmpl->box_ofs = 6 + offset;
+            }
         }
 
         if (subtime) {
@@ -351,24 +371,151 @@ unsigned prepare_exif(unsigned char **exif, const struct context *cnt
     /* assert we didn't underestimate the original buffer size */
     assert(marker_len <= buffer_size);
 
-    free(description);
-
     *exif = marker;
     return marker_len;
 }
 
+/* Whether the template was built for these values */
+static int exif_template_same(const struct exif_template *tmpl
+            , const char *description, const char *datetime)
+{
+    if (tmpl->marker == NULL) {
+        return FALSE;
+    }
+    if (strlen(datetime) != tmpl->datetime_len) {
+        return FALSE;
+    }
+    if ((description == NULL) || (tmpl->description == NULL)) {
+        return (description == tmpl->description);
+    }
+    return mystreq(description, tmpl->description);
+}
+
+/*
+ * prepare_exif() is a comon function used to prepare
+ * exif data to be inserted into jpeg or webp files
+ *
+ * The block is copied from the template of the camera and only the time
+ * stamps and subject area are patched, unless the description changed.
+ */
+unsigned prepare_exif(unsigned char **exif, const struct context *cnt
+            , const struct timeval *tv_in1, const struct coord *box)
+{
+    /* description and datetime are the values that are actually
+     * put into the EXIF data
+    */
+    const char *description;
+    char *description_buf, *datetime;
+    char datetime_buf[22];
+    struct exif_template *tmpl;
+    struct tm timestamp_tm;
+    struct timeval tv1;
+    unsigned len;
+    int tzoffset;
+
+    gettimeofday(&tv1, NULL);
+    if (tv_in1 != NULL) {
+        tv1.tv_sec = tv_in1->tv_sec;
+        tv1.tv_usec = tv_in1->tv_usec;
+    }
+
+    localtime_r(&tv1.tv_sec, &timestamp_tm);
+    /* Exif requires this exact format */
+    snprintf(datetime_buf, 21, "%04d:%02d:%02d %02d:%02d:%02d",
+        (timestamp_tm.tm_year + 1900) & 0xffff,
+        (timestamp_tm.tm_mon + 1) & 0x0f,
+        timestamp_tm.tm_mday,
+        timestamp_tm.tm_hour,
+        timestamp_tm.tm_min,
+        timestamp_tm.tm_sec);
+    datetime = datetime_buf;
+    tzoffset = timestamp_tm.tm_gmtoff / 3600;
+
+    /* A description without conversion specifiers is used as it is */
+    description_buf = NULL;
+    if (cnt->conf.picture_exif == NULL) {
+        description = NULL;
+    } else if (strchr(cnt->conf.picture_exif, '%') == NULL) {
+        description = cnt->conf.picture_exif;
+    } else {
+        description_buf = malloc(PATH_MAX);
+        mystrftime(cnt, description_buf, PATH_MAX-1, cnt->conf.picture_exif, &tv1, NULL, 0);
+        description = description_buf;
+    }
+
+    if (cnt->exif_cache == NULL) {
+        len = exif_build(exif, description, datetime, tzoffset, box, NULL);
+        free(description_buf);
+        return len;
+    }
+
+    tmpl = &cnt->exif_cache->tmpl[(box != NULL) ? 1 : 0];
+    pthread_mutex_lock(&cnt->exif_cache->mutex);
+        if (!exif_template_same(tmpl, description, datetime)) {
+            free(tmpl->marker);
+            free(tmpl->description);
+            tmpl->marker = NULL;
+            tmpl->len = exif_build(&tmpl->marker, description, datetime, tzoffset, box, tmpl);
+            tmpl->description = (description != NULL) ? mystrdup(description) : NULL;
+            tmpl->datetime_len = strlen(datetime);
+        } else {
+            memcpy(tmpl->marker + tmpl->datetime_ofs[0], datetime, tmpl->datetime_len);
+            memcpy(tmpl->marker + tmpl->datetime_ofs[1], datetime, tmpl->datetime_len);
+            put_sint16(tmpl->marker + tmpl->tzoffset_ofs, tzoffset);
+            if (box != NULL) {
+                put_subjectarea_values(tmpl->marker + tmpl->box_ofs, box);
+            }
+        }
+        len = tmpl->len;
+        if (len > 0) {
+            *exif = mymalloc(len);
+            memcpy(*exif, tmpl->marker, len);
+        }
+    pthread_mutex_unlock(&cnt->exif_cache->mutex);
+
+    free(description_buf);
+
+    return len;
+}
+
+/** prepare_exif_init
+ *  Create the cache of the EXIF blocks of the camera.
+ */
+void prepare_exif_init(struct context *cnt)
+{
+    cnt->exif_cache = mymalloc(sizeof(struct exif_cache));
+    memset(cnt->exif_cache, 0, sizeof(struct exif_cache));
+    pthread_mutex_init(&cnt->exif_cache->mutex, NULL);
+}
+
+/** prepare_exif_deinit
+ *  Free the cache once the camera and its stream encoder are stopped.
+ */
+void prepare_exif_deinit(struct context *cnt)
+{
+    int indx;
+
+    if (cnt->exif_cache == NULL) {
+        return;
+    }
+
+    for (indx = 0; indx < 2; indx++) {
+        free(cnt->exif_cache->tmpl[indx].marker);
+        free(cnt->exif_cache->tmpl[indx].description);
+    }
+    pthread_mutex_destroy(&cnt->exif_cache->mutex);
+    free(cnt->exif_cache);
+    cnt->exif_cache = NULL;
+}
+
 #ifdef HAVE_WEBP
 /*
  * put_webp_exif writes the EXIF APP1 chunk to the webp file.
  * It must be called after WebPEncode() and the result
  * can then be written out to webp a file
  */
-static void put_webp_exif(WebPMux* webp_mux, const struct context *cnt
-            , const struct timeval *tv1, const struct coord *box)
+static void put_webp_exif(WebPMux* webp_mux, const unsigned char *exif, unsigned exif_len)
 {
-    unsigned char *exif = NULL;
-    unsigned exif_len = prepare_exif(&exif, cnt, tv1, box);
-
     if(exif_len > 0) {
         WebPData webp_exif;
         /* EXIF in WEBP does not need the EXIF marker signature (6 bytes) that are needed by jpeg */
@@ -380,7 +527,6 @@ static void put_webp_exif(WebPMux* webp_mux, const struct context *cnt
             MOTION_LOG(ERR, TYPE_CORE, NO_ERRNO
                 , _("Unable to set set EXIF to webp chunk"));
         }
-        free(exif);
     }
 }
 #endif /* HAVE_WEBP */
@@ -394,6 +540,8 @@ static void put_webp_exif(WebPMux* webp_mux, const struct context *cnt
  * - image is the image in YUV420P format.
  * - width and height are the dimensions of the image
  * - quality is the webp encoding quality 0-100%
+ * - webp_config is the encoder config of the camera from put_webp_init
+ * - exif is the EXIF data from prepare_exif, exif_len 0 for none
  *
  * Output:
  * - The webp is written directly to the file given by the file pointer fp
@@ -401,15 +549,18 @@ static void put_webp_exif(WebPMux* webp_mux, const struct context *cnt
  * Returns nothing
  */
 static void put_webp_yuv420p_file(FILE *fp, unsigned char *image, int width, int height
-            , int quality, struct context *cnt, struct timeval *tv1, struct coord *box)
+            , int quality, const struct WebPConfig *webp_config
+            , const unsigned char *exif, unsigned exif_len)
 {
     #ifdef HAVE_WEBP
-        /* Create a config present and check for compatible library version */
-        WebPConfig webp_config;
-        if (!WebPConfigPreset(&webp_config, WEBP_PRESET_DEFAULT, (float) quality)) {
-            MOTION_LOG(ERR, TYPE_CORE, NO_ERRNO, _("libwebp version error"));
+        /* Copy the prebuilt config, only the quality may change with each picture */
+        WebPConfig config;
+        if (webp_config == NULL) {
+            MOTION_LOG(ERR, TYPE_CORE, NO_ERRNO, _("libwebp encoder not configured"));
             return;
         }
+        config = *webp_config;
+        config.quality = (float) quality;
 
         /* Create the input data structure and check for compatible library version */
         WebPPicture webp_image;
@@ -418,18 +569,19 @@ static void put_webp_yuv420p_file(FILE *fp, unsigned char *image, int width, int
             return;
         }
 
-        /* Allocate the image buffer based on image width and height */
+        /*
+         * Map the input YUV420P buffer as individual Y, U and V planes.  The
+         * encoder reads them in place so no picture buffer is allocated.
+         */
         webp_image.width = width;
         webp_image.height = height;
-        if (!WebPPictureAlloc(&webp_image)) {
-            MOTION_LOG(ERR, TYPE_CORE, NO_ERRNO,_("libwebp image buffer allocation error"));
-            return;
-        }
-
-        /* Map the input YUV420P buffer as individual Y, U and V pointers */
+        webp_image.use_argb = 0;
+        webp_image.colorspace = WEBP_YUV420;
         webp_image.y = image;
         webp_image.u = image + width * height;
         webp_image.v = webp_image.u + (width * height) / 4;
+        webp_image.y_stride = width;
+        webp_image.uv_stride = (width + 1) / 2;
 
         /* Setup the memory writting method */
         WebPMemoryWriter webp_writer;
@@ -438,7 +590,7 @@ static void put_webp_yuv420p_file(FILE *fp, unsigned char *image, int width, int
         webp_image.custom_ptr = (void*) &webp_writer;
 
         /* Encode the YUV image as webp */
-        if (!WebPEncode(&webp_config, &webp_image)) {
+        if (!WebPEncode(&config, &webp_image)) {
             MOTION_LOG(WRN, TYPE_CORE, NO_ERRNO,_("libwebp image compression error"));
         }
 
@@ -449,7 +601,7 @@ static void put_webp_yuv420p_file(FILE *fp, unsigned char *image, int width, int
 
         /* Create a mux from the prepared image data */
         WebPMux* webp_mux = WebPMuxCreate(&webp_bitstream, 1);
-        put_webp_exif(webp_mux, cnt, tv1, box);
+        put_webp_exif(webp_mux, exif, exif_len);
 
         /* Add Exif data to the webp image data */
         WebPData webp_output;
@@ -471,7 +623,7 @@ static void put_webp_yuv420p_file(FILE *fp, unsigned char *image, int width, int
             free(webp_writer.mem);
         #endif /* WEBP_ENCODER_ABI_VERSION */
 
-        /* free the memory used by webp for image data */
+        /* free what the encoder may have allocated with the picture */
         WebPPictureFree(&webp_image);
         /* free the memory used by webp mux object */
         WebPMuxDelete(webp_mux);
@@ -483,12 +635,57 @@ static void put_webp_yuv420p_file(FILE *fp, unsigned char *image, int width, int
         (void)width;
         (void)height;
         (void)quality;
-        (void)cnt;
-        (void)tv1;
-        (void)box;
+        (void)webp_config;
+        (void)exif;
+        (void)exif_len;
+    #endif /* HAVE_WEBP */
+}
+
+/** put_webp_init
+ *  Build the webp encoder config of the camera once so that each picture
+ *  only copies it.  picture_webp_method trades the encoding speed for the
+ *  file size and the encoder uses its own threads where it can.
+ */
+void put_webp_init(struct context *cnt)
+{
+    #ifdef HAVE_WEBP
+        WebPConfig *config;
+
+        cnt->webp_config = NULL;
+        if (cnt->imgs.picture_type != IMAGE_TYPE_WEBP) {
+            return;
+        }
+
+        config = mymalloc(sizeof(WebPConfig));
+        if (!WebPConfigPreset(config, WEBP_PRESET_DEFAULT, (float) cnt->conf.picture_quality)) {
+            MOTION_LOG(ERR, TYPE_CORE, NO_ERRNO, _("libwebp version error"));
+            free(config);
+            return;
+        }
+        config->method = cnt->conf.picture_webp_method;
+        config->thread_level = 1;
+
+        if (!WebPValidateConfig(config)) {
+            MOTION_LOG(ERR, TYPE_CORE, NO_ERRNO
+                ,_("Invalid picture_webp_method %d, using %d")
+                , cnt->conf.picture_webp_method, 4);
+            config->method = 4;
+        }
+        cnt->webp_config = config;
+    #else
+        cnt->webp_config = NULL;
     #endif /* HAVE_WEBP */
 }
 
+/** put_webp_deinit
+ *  Free the webp encoder config once the pictures of the camera are written.
+ */
+void put_webp_deinit(struct context *cnt)
+{
+    free(cnt->webp_config);
+    cnt->webp_config = NULL;
+}
+
 /**
  * put_jpeg_yuv420p_file
  *      Converts an YUV420P coded image to a jpeg image and writes
@@ -498,6 +695,7 @@ static void put_webp_yuv420p_file(FILE *fp, unsigned char *image, int width, int
  * - image is the image in YUV420P format.
  * - width and height are the dimensions of the image
  * - quality is the jpeg encoding quality 0-100%
+ * - exif is the EXIF data from prepare_exif, exif_len 0 for none
  *
  * Output:
  * - The jpeg is written directly to the file given by the file pointer fp
@@ -505,14 +703,14 @@ static void put_webp_yuv420p_file(FILE *fp, unsigned char *image, int width, int
  * Returns nothing
  */
 static void put_jpeg_yuv420p_file(FILE *fp, unsigned char *image, int width, int height
-            , int quality, struct context *cnt, struct timeval *tv1, struct coord *box)
+            , int quality, const unsigned char *exif, unsigned exif_len)
 {
     int sz, image_size;
 
     image_size = (width * height * 3)/2;
     unsigned char *buf = mymalloc(image_size);
 
-    sz = jpgutl_put_yuv420p(buf, image_size, image, width, height, quality, cnt ,tv1, box);
+    sz = jpgutl_put_yuv420p_exif(buf, image_size, image, width, height, quality, exif, exif_len);
     fwrite(buf, sz, 1, fp);
 
     free(buf);
@@ -528,20 +726,21 @@ static void put_jpeg_yuv420p_file(FILE *fp, unsigned char *image, int width, int
  * - image is the image in greyscale format.
  * - width and height are the dimensions of the image
  * - quality is the jpeg encoding quality 0-100%
+ * - exif is the EXIF data from prepare_exif, exif_len 0 for none
  * Output:
  * - The jpeg is written directly to the file given by the file pointer fp
  *
  * Returns nothing
  */
 static void put_jpeg_grey_file(FILE *picture, unsigned char *image, int width, int height,
-            int quality, struct context *cnt, struct timeval *tv1, struct coord *box)
+            int quality, const unsigned char *exif, unsigned exif_len)
 {
     int sz, image_size;
 
     image_size = (width * height * 3)/2;
     unsigned char *buf = mymalloc(image_size);
 
-    sz = jpgutl_put_grey(buf, image_size, image, width, height, quality, cnt ,tv1, box);
+    sz = jpgutl_put_grey_exif(buf, image_size, image, width, height, quality, exif, exif_len);
     fwrite(buf, sz, 1, picture);
 
     free(buf);
@@ -791,37 +990,68 @@ int put_picture_memory(struct context *cnt, unsigned char* dest_image, int image
     return 0;
 }
 
-static void put_picture_fd(struct context *cnt, FILE *picture, unsigned char *image
-            , int quality, int ftype)
+/**
+ * put_picture_dims
+ *      Width and height of the image saved to a picture of type ftype.
+ */
+void put_picture_dims(struct context *cnt, int ftype, int *width, int *height)
 {
-    int width, height, passthrough;
+    int passthrough;
 
     passthrough = util_check_passthrough(cnt);
     if (((ftype == FTYPE_IMAGE) || (ftype == FTYPE_IMAGE_SNAPSHOT)) &&
         (cnt->imgs.size_high > 0) && (!passthrough)) {
-        width = cnt->imgs.width_high;
-        height = cnt->imgs.height_high;
+        *width = cnt->imgs.width_high;
+        *height = cnt->imgs.height_high;
     } else {
-        width = cnt->imgs.width;
-        height = cnt->imgs.height;
+        *width = cnt->imgs.width;
+        *height = cnt->imgs.height;
     }
+}
 
-    if (cnt->imgs.picture_type == IMAGE_TYPE_PPM) {
+/**
+ * put_picture_encode
+ *      Encodes the image as picture_type and writes it to the open file.
+ *      Only uses its arguments so it may run on the picture writer threads.
+ */
+void put_picture_encode(FILE *picture, int picture_type, unsigned char *image
+            , int width, int height, int quality, const struct WebPConfig *webp_config
+            , const unsigned char *exif, unsigned exif_len)
+{
+    if (picture_type == IMAGE_TYPE_PPM) {
         put_ppm_bgr24_file(picture, image, width, height);
 
-    } else if (cnt->imgs.picture_type == IMAGE_TYPE_WEBP) {
-        put_webp_yuv420p_file(picture, image, width, height, quality, cnt
-            , &(cnt->current_image->timestamp_tv), &(cnt->current_image->location));
+    } else if (picture_type == IMAGE_TYPE_WEBP) {
+        put_webp_yuv420p_file(picture, image, width, height, quality, webp_config
+            , exif, exif_len);
 
-    } else if (cnt->imgs.picture_type == IMAGE_TYPE_GREY) {
-        put_jpeg_grey_file(picture, image, width, height, quality, cnt
-            , &(cnt->current_image->timestamp_tv), &(cnt->current_image->location));
+    } else if (picture_type == IMAGE_TYPE_GREY) {
+        put_jpeg_grey_file(picture, image, width, height, quality, exif, exif_len);
 
     } else {
-        put_jpeg_yuv420p_file(picture, image, width, height, quality, cnt
+        put_jpeg_yuv420p_file(picture, image, width, height, quality, exif, exif_len);
+    }
+
+}
+
+static void put_picture_fd(struct context *cnt, FILE *picture, unsigned char *image
+            , int quality, int ftype)
+{
+    unsigned char *exif = NULL;
+    unsigned exif_len = 0;
+    int width, height;
+
+    put_picture_dims(cnt, ftype, &width, &height);
+
+    if (cnt->imgs.picture_type != IMAGE_TYPE_PPM) {
+        exif_len = prepare_exif(&exif, cnt
             , &(cnt->current_image->timestamp_tv), &(cnt->current_image->location));
     }
 
+    put_picture_encode(picture, cnt->imgs.picture_type, image, width, height
+        , quality, cnt->webp_config, exif, exif_len);
+
+    free(exif);
 }
 
 void put_picture(struct context *cnt, char *file, unsigned char *image, int ftype)
@@ -1016,23 +1246,137 @@ void put_fixed_mask(struct context *cnt, const char *file)
         "re-run motion to enable mask feature"), cnt->conf.mask_file);
 }
 
-void pic_scale_img(int width_src, int height_src, unsigned char *img_src, unsigned char *img_dst)
+/*
+ * Box scaler for the yuv420p stream images.  Every destination pixel is the
+ * average of the source pixels it covers, so any reduction is anti aliased.
+ * The rows a destination row covers are first summed into rowsum, a plain
+ * loop the compiler vectorizes, and the columns are then summed from that
+ * using the spans computed once when the scaler is made.  A span is at
+ * least one source pixel so a larger destination repeats the pixels.
+ */
+struct pic_scaler_plane {
+    int             width_src;
+    int             height_src;
+    int             width_dst;
+    int             height_dst;
+    int             *xpos;          /* First source column of each destination column */
+    int             *ypos;          /* First source row of each destination row */
+};
+
+struct pic_scaler {
+    struct pic_scaler_plane luma;
+    struct pic_scaler_plane chroma;
+    unsigned int            *rowsum;
+};
+
+static int *pic_scaler_pos(int size_src, int size_dst)
+{
+    int *pos, indx;
+
+    /* The extra entry is the end of the last span */
+    pos = mymalloc((size_dst + 1) * sizeof(int));
+    for (indx = 0; indx <= size_dst; indx++) {
+        pos[indx] = (int)(((long long)indx * size_src) / size_dst);
+    }
+
+    return pos;
+}
+
+static void pic_scaler_plane_init(struct pic_scaler_plane *plane
+            , int width_src, int height_src, int width_dst, int height_dst)
 {
+    plane->width_src = width_src;
+    plane->height_src = height_src;
+    plane->width_dst = width_dst;
+    plane->height_dst = height_dst;
+    plane->xpos = pic_scaler_pos(width_src, width_dst);
+    plane->ypos = pic_scaler_pos(height_src, height_dst);
+}
+
+static void pic_scaler_plane_run(struct pic_scaler_plane *plane, unsigned int *rowsum
+            , const unsigned char *img_src, unsigned char *img_dst)
+{
+    const unsigned char *row;
+    unsigned int sum, cnt;
+    int x, y, dx, dy, rows, xend;
+
+    for (dy = 0; dy < plane->height_dst; dy++) {
+        rows = plane->ypos[dy + 1] - plane->ypos[dy];
+        if (rows < 1) {
+            rows = 1;
+        }
 
-    int i = 0, x, y;
-    for (y = 0; y < height_src; y+=2) {
-        for (x = 0; x < width_src; x+=2) {
-            img_dst[i++] = img_src[y * width_src + x];
+        row = img_src + (plane->ypos[dy] * plane->width_src);
+        for (x = 0; x < plane->width_src; x++) {
+            rowsum[x] = row[x];
+        }
+        for (y = 1; y < rows; y++) {
+            row += plane->width_src;
+            for (x = 0; x < plane->width_src; x++) {
+                rowsum[x] += row[x];
+            }
+        }
+
+        for (dx = 0; dx < plane->width_dst; dx++) {
+            xend = plane->xpos[dx + 1];
+            if (xend <= plane->xpos[dx]) {
+                xend = plane->xpos[dx] + 1;
+            }
+            sum = 0;
+            for (x = plane->xpos[dx]; x < xend; x++) {
+                sum += rowsum[x];
+            }
+            cnt = (xend - plane->xpos[dx]) * rows;
+            *img_dst++ = (sum + (cnt / 2)) / cnt;
         }
     }
+}
+
+/**
+ * pic_scaler_init
+ *  Make a scaler from a width_src x height_src to a width_dst x height_dst
+ *  yuv420p image.  The dimensions of the destination must be even.
+ */
+struct pic_scaler *pic_scaler_init(int width_src, int height_src, int width_dst, int height_dst)
+{
+    struct pic_scaler *scaler;
+
+    scaler = mymalloc(sizeof(struct pic_scaler));
+    pic_scaler_plane_init(&scaler->luma, width_src, height_src, width_dst, height_dst);
+    pic_scaler_plane_init(&scaler->chroma
+        , width_src / 2, height_src / 2, width_dst / 2, height_dst / 2);
+    scaler->rowsum = mymalloc(width_src * sizeof(unsigned int));
 
-    for (y = 0; y < height_src / 2; y+=2) {
-       for (x = 0; x < width_src; x += 4) {
-          img_dst[i++] = img_src[(width_src * height_src) + (y * width_src) + x];
-          img_dst[i++] = img_src[(width_src * height_src) + (y * width_src) + (x + 1)];
-       }
+    return scaler;
+}
+
+void pic_scaler_free(struct pic_scaler *scaler)
+{
+    if (scaler == NULL) {
+        return;
     }
+    free(scaler->luma.xpos);
+    free(scaler->luma.ypos);
+    free(scaler->chroma.xpos);
+    free(scaler->chroma.ypos);
+    free(scaler->rowsum);
+    free(scaler);
+}
 
-    return;
+/** pic_scaler_run */
+void pic_scaler_run(struct pic_scaler *scaler, const unsigned char *img_src, unsigned char *img_dst)
+{
+    int size_src, size_dst, chroma_src, chroma_dst;
+
+    size_src = scaler->luma.width_src * scaler->luma.height_src;
+    size_dst = scaler->luma.width_dst * scaler->luma.height_dst;
+    chroma_src = scaler->chroma.width_src * scaler->chroma.height_src;
+    chroma_dst = scaler->chroma.width_dst * scaler->chroma.height_dst;
+
+    pic_scaler_plane_run(&scaler->luma, scaler->rowsum, img_src, img_dst);
+    pic_scaler_plane_run(&scaler->chroma, scaler->rowsum
+        , img_src + size_src, img_dst + size_dst);
+    pic_scaler_plane_run(&scaler->chroma, scaler->rowsum
+        , img_src + size_src + chroma_src, img_dst + size_dst + chroma_dst);
 }
 
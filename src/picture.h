@@ -31,9 +31,19 @@ void overlay_largest_label(struct context *cnt, unsigned char *out);
 int put_picture_memory(struct context *cnt, unsigned char* dest_image, int image_size
             , unsigned char *image, int quality, int width, int height);
 void put_picture(struct context *cnt, char *file, unsigned char *image, int ftype);
+void put_picture_dims(struct context *cnt, int ftype, int *width, int *height);
+void put_picture_encode(FILE *picture, int picture_type, unsigned char *image
+            , int width, int height, int quality, const struct WebPConfig *webp_config
+            , const unsigned char *exif, unsigned exif_len);
 unsigned char *get_pgm(FILE *picture, int width, int height);
-void pic_scale_img(int width_src, int height_src, unsigned char *img_src, unsigned char *img_dst);
+struct pic_scaler *pic_scaler_init(int width_src, int height_src, int width_dst, int height_dst);
+void pic_scaler_free(struct pic_scaler *scaler);
+void pic_scaler_run(struct pic_scaler *scaler, const unsigned char *img_src, unsigned char *img_dst);
 unsigned prepare_exif(unsigned char **exif, const struct context *cnt
             , const struct timeval *tv_in1, const struct coord *box);
+void prepare_exif_init(struct context *cnt);
+void prepare_exif_deinit(struct context *cnt);
+void put_webp_init(struct context *cnt);
+void put_webp_deinit(struct context *cnt);
 
 #endif /* _INCLUDE_PICTURE_H_ */
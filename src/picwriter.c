@@ -0,0 +1,388 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *    picwriter.c
+ *
+ *    Picture writer threads shared by all cameras.
+ *
+ *    When picture_threads is set, the pictures saved for motion, the motion
+ *    images and the snapshots are encoded and written by a pool of writer
+ *    threads instead of the camera thread.  The camera copies the image into
+ *    a buffer from the frame pool, prepares the EXIF data while its context
+ *    still describes the image and queues the job.  Any free writer then
+ *    encodes and writes it so several pictures are encoded at the same time.
+ *
+ *    The camera thread collects its finished jobs in the order they were
+ *    saved and only then sends EVENT_FILECREATE and makes the lastsnap link.
+ *    on_picture_save, the database and the other file events therefore still
+ *    see complete files in the same order as before.  All the pictures of an
+ *    event are collected before the end of the event is processed.
+ *
+ */
+
+#include "translate.h"
+#include "motion.h"
+#include "util.h"
+#include "logger.h"
+#include "picture.h"
+#include "event.h"
+#include "framepool.h"
+#include "picwriter.h"
+
+/* Pictures of a camera that may be queued or written at the same time */
+#define PICWRITER_PENDING_MAX 16
+
+struct picwriter_job {
+    struct context          *cnt;
+    char                    file[PATH_MAX];
+    char                    linkname[PATH_MAX]; /* Target of the symbolic link */
+    char                    linkpath[PATH_MAX]; /* Link made once written, empty for none */
+    unsigned char           *image;             /* Copy of the image from the frame pool */
+    size_t                  image_size;
+    int                     picture_type;
+    int                     width;
+    int                     height;
+    int                     quality;
+    unsigned char           *exif;
+    unsigned                exif_len;
+    int                     ftype;              /* FTYPE_ sent with EVENT_FILECREATE */
+    struct timeval          tv;
+    int                     errnum;             /* errno when the file could not be opened */
+    int                     done;
+    struct picwriter_job    *next;              /* Next job of the camera in saving order */
+    struct picwriter_job    *qnext;             /* Next job in the writer queue */
+};
+
+static struct {
+    pthread_mutex_t         mutex;
+    pthread_cond_t          cond_job;       /* Signalled when a job is queued */
+    pthread_cond_t          cond_done;      /* Broadcast when a job is written */
+    pthread_t               *threads;
+    int                     size;           /* Number of writer threads, 0 when not in use */
+    struct picwriter_job    *qhead;
+    struct picwriter_job    *qtail;
+    int                     finish;
+} picwriter = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond_job = PTHREAD_COND_INITIALIZER,
+    .cond_done = PTHREAD_COND_INITIALIZER,
+};
+
+static void picwriter_write(struct picwriter_job *job)
+{
+    FILE *picture;
+
+    picture = myfopen(job->file, "wbe");
+    if (!picture) {
+        job->errnum = (errno != 0) ? errno : EIO;
+        return;
+    }
+
+    put_picture_encode(picture, job->picture_type, job->image
+        , job->width, job->height, job->quality, job->cnt->webp_config
+        , job->exif, job->exif_len);
+
+    myfclose(picture);
+}
+
+static void *picwriter_handler(void *arg)
+{
+    struct picwriter_job *job;
+
+    util_threadname_set("pw", (int)(unsigned long)arg, NULL);
+
+    while (TRUE) {
+        pthread_mutex_lock(&picwriter.mutex);
+            while ((picwriter.qhead == NULL) && !picwriter.finish) {
+                pthread_cond_wait(&picwriter.cond_job, &picwriter.mutex);
+            }
+            /* Queued jobs are still written when finishing */
+            job = picwriter.qhead;
+            if (job != NULL) {
+                picwriter.qhead = job->qnext;
+                if (picwriter.qhead == NULL) {
+                    picwriter.qtail = NULL;
+                }
+            }
+        pthread_mutex_unlock(&picwriter.mutex);
+
+        if (job == NULL) {
+            break;
+        }
+
+        pthread_setspecific(tls_key_threadnr, (void *)((unsigned long)job->cnt->threadnr));
+        picwriter_write(job);
+
+        /* The camera may release the job as soon as it is marked done */
+        pthread_mutex_lock(&picwriter.mutex);
+            job->done = TRUE;
+            pthread_cond_broadcast(&picwriter.cond_done);
+        pthread_mutex_unlock(&picwriter.mutex);
+    }
+
+    pthread_exit(NULL);
+}
+
+/* Replace the symbolic link at linkpath with one to linkname */
+static void picwriter_link(const char *linkname, const char *linkpath)
+{
+    remove(linkpath);
+
+    if (symlink(linkname, linkpath)) {
+        MOTION_LOG(ERR, TYPE_EVENTS, SHOW_ERRNO
+            ,_("Could not create symbolic link [%s]"), linkname);
+    }
+}
+
+/** picwriter_finish
+ *  Report a written job on the camera thread and release it.
+ */
+static void picwriter_finish(struct context *cnt, struct picwriter_job *job)
+{
+    if (job->errnum == EACCES) {
+        errno = job->errnum;
+        MOTION_LOG(ERR, TYPE_ALL, SHOW_ERRNO
+            ,_("Can't write picture to file %s - check access rights to target directory\n"
+            "Thread is going to finish due to this fatal error"), job->file);
+        cnt->finish = 1;
+        cnt->restart = 0;
+    } else if (job->errnum != 0) {
+        errno = job->errnum;
+        MOTION_LOG(ERR, TYPE_ALL, SHOW_ERRNO
+            ,_("Can't write picture to file %s"), job->file);
+    }
+
+    event(cnt, EVENT_FILECREATE, NULL, job->file, (void *)(unsigned long)job->ftype, &job->tv);
+    if (job->linkpath[0] != '\0') {
+        picwriter_link(job->linkname, job->linkpath);
+    }
+
+    framepool_put(cnt, job->image, job->image_size);
+    free(job->exif);
+    free(job);
+}
+
+/* Wait until the oldest job of the camera is written and collect it */
+static void picwriter_wait(struct context *cnt)
+{
+    struct picwriter_job *job;
+
+    job = cnt->picw_head;
+    if (job == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&picwriter.mutex);
+        while (!job->done) {
+            pthread_cond_wait(&picwriter.cond_done, &picwriter.mutex);
+        }
+    pthread_mutex_unlock(&picwriter.mutex);
+
+    picwriter_collect(cnt);
+}
+
+/** picwriter_init
+ *  Start the writer threads when picture_threads is set.  A negative value
+ *  uses one writer per CPU core.
+ */
+void picwriter_init(int threads)
+{
+    int indx;
+
+    picwriter.size = 0;
+
+    if (threads == 0) {
+        return;
+    }
+    if (threads < 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    picwriter.qhead = NULL;
+    picwriter.qtail = NULL;
+    picwriter.finish = FALSE;
+
+    picwriter.threads = mymalloc(threads * sizeof(pthread_t));
+    for (indx = 0; indx < threads; indx++) {
+        if (pthread_create(&picwriter.threads[picwriter.size], NULL
+                , &picwriter_handler, (void *)(unsigned long)(indx + 1)) != 0) {
+            MOTION_LOG(ERR, TYPE_ALL, SHOW_ERRNO
+                ,_("Unable to start picture writer thread"));
+            break;
+        }
+        picwriter.size++;
+    }
+
+    if (picwriter.size == 0) {
+        MOTION_LOG(ERR, TYPE_ALL, NO_ERRNO
+            ,_("Pictures are written by the camera threads"));
+        free(picwriter.threads);
+        picwriter.threads = NULL;
+        return;
+    }
+
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+        ,_("Writing pictures on %d threads"), picwriter.size);
+}
+
+/** picwriter_deinit
+ *  Write what is still queued and stop the writer threads.  The cameras
+ *  must have ended and collected their jobs before this is called.
+ */
+void picwriter_deinit(void)
+{
+    int indx;
+
+    if (picwriter.size == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&picwriter.mutex);
+        picwriter.finish = TRUE;
+        pthread_cond_broadcast(&picwriter.cond_job);
+    pthread_mutex_unlock(&picwriter.mutex);
+
+    for (indx = 0; indx < picwriter.size; indx++) {
+        pthread_join(picwriter.threads[indx], NULL);
+    }
+    picwriter.size = 0;
+
+    free(picwriter.threads);
+    picwriter.threads = NULL;
+}
+
+/** picwriter_save
+ *  Save image as the picture file for the event_ftype file event.  ftype is
+ *  the type of picture as for put_picture.  When linkpath is not NULL a
+ *  symbolic link to linkname is made there after the file is written.
+ *  Without writer threads the picture is written before returning,
+ *  otherwise EVENT_FILECREATE is sent when the camera collects the job.
+ */
+void picwriter_save(struct context *cnt, char *file, unsigned char *image, int ftype
+            , int event_ftype, struct timeval *tv1, const char *linkname, const char *linkpath)
+{
+    struct picwriter_job *job;
+
+    if (picwriter.size == 0) {
+        put_picture(cnt, file, image, ftype);
+        event(cnt, EVENT_FILECREATE, NULL, file, (void *)(unsigned long)event_ftype, tv1);
+        if (linkpath != NULL) {
+            picwriter_link(linkname, linkpath);
+        }
+        return;
+    }
+
+    /* Back-pressure: a camera saving faster than the writers waits here */
+    while (cnt->picw_pending >= PICWRITER_PENDING_MAX) {
+        picwriter_wait(cnt);
+    }
+
+    job = mymalloc(sizeof(struct picwriter_job));
+    memset(job, 0, sizeof(struct picwriter_job));
+
+    job->cnt = cnt;
+    put_picture_dims(cnt, ftype, &job->width, &job->height);
+    job->image_size = (job->width * job->height * 3) / 2;
+
+    /* Within the frame pool budget, wait for older pictures to be written */
+    job->image = framepool_get(cnt, job->image_size, FALSE);
+    while ((job->image == NULL) && (cnt->picw_head != NULL)) {
+        picwriter_wait(cnt);
+        job->image = framepool_get(cnt, job->image_size, FALSE);
+    }
+    if (job->image == NULL) {
+        job->image = framepool_get(cnt, job->image_size, TRUE);
+    }
+    memcpy(job->image, image, job->image_size);
+
+    job->picture_type = cnt->imgs.picture_type;
+    job->quality = cnt->conf.picture_quality;
+    if (job->picture_type != IMAGE_TYPE_PPM) {
+        job->exif_len = prepare_exif(&job->exif, cnt
+            , &(cnt->current_image->timestamp_tv), &(cnt->current_image->location));
+    }
+
+    snprintf(job->file, PATH_MAX, "%s", file);
+    if (linkpath != NULL) {
+        snprintf(job->linkname, PATH_MAX, "%s", linkname);
+        snprintf(job->linkpath, PATH_MAX, "%s", linkpath);
+    }
+    job->ftype = event_ftype;
+    job->tv = *tv1;
+
+    /* The camera list is only used by the camera thread */
+    if (cnt->picw_tail == NULL) {
+        cnt->picw_head = job;
+    } else {
+        cnt->picw_tail->next = job;
+    }
+    cnt->picw_tail = job;
+    cnt->picw_pending++;
+
+    pthread_mutex_lock(&picwriter.mutex);
+        if (picwriter.qtail == NULL) {
+            picwriter.qhead = job;
+        } else {
+            picwriter.qtail->qnext = job;
+        }
+        picwriter.qtail = job;
+        pthread_cond_signal(&picwriter.cond_job);
+    pthread_mutex_unlock(&picwriter.mutex);
+}
+
+/** picwriter_collect
+ *  Send the file events of the pictures of the camera that are written,
+ *  in the order they were saved.  Called from the camera thread.
+ */
+void picwriter_collect(struct context *cnt)
+{
+    struct picwriter_job *job;
+    int done;
+
+    while (cnt->picw_head != NULL) {
+        job = cnt->picw_head;
+
+        pthread_mutex_lock(&picwriter.mutex);
+            done = job->done;
+        pthread_mutex_unlock(&picwriter.mutex);
+
+        if (!done) {
+            break;
+        }
+
+        cnt->picw_head = job->next;
+        if (cnt->picw_head == NULL) {
+            cnt->picw_tail = NULL;
+        }
+        cnt->picw_pending--;
+
+        picwriter_finish(cnt, job);
+    }
+}
+
+/** picwriter_flush
+ *  Wait for all the pictures of the camera to be written and collect them.
+ */
+void picwriter_flush(struct context *cnt)
+{
+    while (cnt->picw_head != NULL) {
+        picwriter_wait(cnt);
+    }
+}
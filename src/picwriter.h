@@ -0,0 +1,32 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  picwriter.h
+ *    Headers associated with functions in the picwriter.c module.
+ */
+
+#ifndef _INCLUDE_PICWRITER_H
+#define _INCLUDE_PICWRITER_H
+
+void picwriter_init(int threads);
+void picwriter_deinit(void);
+void picwriter_save(struct context *cnt, char *file, unsigned char *image, int ftype
+            , int event_ftype, struct timeval *tv1, const char *linkname, const char *linkpath);
+void picwriter_collect(struct context *cnt);
+void picwriter_flush(struct context *cnt);
+
+#endif /* _INCLUDE_PICWRITER_H */
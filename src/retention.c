@@ -0,0 +1,482 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *    retention.c
+ *
+ *    Retention thread shared by all cameras.
+ *
+ *    When a camera with an event_index has a retention budget, a thread
+ *    deletes the files of its oldest events until the budgets are met.
+ *    retention_days and retention_size are the budgets of each camera,
+ *    retention_total is the size of the events of all the cameras and
+ *    retention_free is the space to keep free on the filesystem of each
+ *    target_dir.  The events and the size of their files come from the
+ *    index so the target_dir is never scanned.  Files which are not part of
+ *    an event, such as the snapshots and timelapse movies, are not deleted,
+ *    and neither are the files of the index outside of the target_dir.
+ *
+ *    The budgets are checked every RETENTION_INTERVAL seconds.  The files
+ *    are deleted at up to retention_rate files a second so a large backlog
+ *    does not compete with the recording for the disk.  Once the files of an
+ *    event are deleted, the event is marked as expired in the index.
+ *
+ */
+
+#include <sys/statvfs.h>
+#include "translate.h"
+#include "motion.h"
+#include "util.h"
+#include "logger.h"
+#include "eventidx.h"
+#include "retention.h"
+
+#define RETENTION_INTERVAL  10              /* Seconds between the checks of the budgets */
+#define RETENTION_MB        (1024 * 1024)
+
+struct retention_cam {
+    struct context          *cnt;
+    int                     fd_idx;         /* -1 when the index is not open */
+    int                     fd_paths;
+    uint64_t                expired;        /* Records of the index already deleted */
+    uint64_t                count;          /* Records of the index */
+    uint64_t                scanned;        /* Records counted in used */
+    int64_t                 used;           /* Bytes of the files of the records kept */
+    int                     has_next;       /* next is the record at expired */
+    struct eventidx_record  next;
+};
+
+static struct {
+    pthread_mutex_t         mutex;
+    pthread_cond_t          cond;           /* Signalled when finishing */
+    pthread_t               thread_id;
+    int                     running;
+    int                     finish;
+    struct retention_cam    *cams;
+    int                     cam_count;
+    int                     rate;           /* Files deleted a second, 0 for no limit */
+    int64_t                 total;          /* Bytes of all the cameras, 0 for no limit */
+    int64_t                 free;           /* Bytes kept free, 0 for no limit */
+    unsigned long           deleted;        /* Events deleted */
+    int64_t                 freed;          /* Bytes of the events deleted */
+} retention = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* Wait for usec or until finishing.  Returns TRUE when finishing. */
+static int retention_wait(long usec)
+{
+    struct timespec ts;
+    struct timeval tv;
+    int finish;
+
+    gettimeofday(&tv, NULL);
+    usec += tv.tv_usec;
+    ts.tv_sec = tv.tv_sec + (usec / 1000000L);
+    ts.tv_nsec = (usec % 1000000L) * 1000;
+
+    pthread_mutex_lock(&retention.mutex);
+        while (!retention.finish) {
+            if (pthread_cond_timedwait(&retention.cond, &retention.mutex, &ts) == ETIMEDOUT) {
+                break;
+            }
+        }
+        finish = retention.finish;
+    pthread_mutex_unlock(&retention.mutex);
+
+    return finish;
+}
+
+/* Read the oldest record kept of the camera into next */
+static void retention_next(struct retention_cam *cam)
+{
+    cam->has_next = (cam->expired < cam->count) &&
+        (eventidx_get(cam->fd_idx, -1, cam->expired, &cam->next, NULL) == 0);
+}
+
+/* Open the index of the camera and count the size of the records added since the last check */
+static void retention_open(struct retention_cam *cam)
+{
+    struct eventidx_record rec;
+    char name[PATH_MAX];
+    uint64_t indx;
+
+    cam->fd_idx = -1;
+    cam->has_next = FALSE;
+
+    eventidx_name(cam->cnt, name, sizeof(name), "idx");
+    cam->fd_idx = open(name, O_RDWR | O_CLOEXEC);
+    if (cam->fd_idx < 0) {
+        return;
+    }
+    if (eventidx_count(cam->fd_idx, &cam->expired, &cam->count) != 0) {
+        close(cam->fd_idx);
+        cam->fd_idx = -1;
+        return;
+    }
+    eventidx_name(cam->cnt, name, sizeof(name), "paths");
+    cam->fd_paths = open(name, O_RDONLY | O_CLOEXEC);
+
+    /* Count again when the index was replaced */
+    if (cam->scanned > cam->count) {
+        cam->scanned = 0;
+        cam->used = 0;
+    }
+    if (cam->scanned < cam->expired) {
+        cam->scanned = cam->expired;
+    }
+    for (indx = cam->scanned; indx < cam->count; indx++) {
+        if (eventidx_get(cam->fd_idx, -1, indx, &rec, NULL) != 0) {
+            break;
+        }
+        cam->used += rec.bytes;
+    }
+    cam->scanned = indx;
+
+    retention_next(cam);
+}
+
+static void retention_close(struct retention_cam *cam)
+{
+    if (cam->fd_idx < 0) {
+        return;
+    }
+    close(cam->fd_idx);
+    if (cam->fd_paths >= 0) {
+        close(cam->fd_paths);
+    }
+    cam->fd_idx = -1;
+    cam->has_next = FALSE;
+}
+
+/* Remove the directory of a deleted file when it is now empty, but never the target_dir */
+static void retention_rmdir(struct context *cnt, const char *path)
+{
+    char dir[PATH_MAX];
+    char *slash;
+    size_t len;
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    slash = strrchr(dir, '/');
+    if ((slash == NULL) || (slash == dir)) {
+        return;
+    }
+    *slash = '\0';
+
+    if (cnt->conf.target_dir != NULL) {
+        len = strlen(cnt->conf.target_dir);
+        while ((len > 1) && (cnt->conf.target_dir[len - 1] == '/')) {
+            len--;
+        }
+        if ((strlen(dir) == len) && (strncmp(dir, cnt->conf.target_dir, len) == 0)) {
+            return;
+        }
+    }
+
+    /* Fails as it should while the directory still has files */
+    rmdir(dir);
+}
+
+/* Whether a path of the index is a file under the target_dir, which is all retention deletes */
+static int retention_path_valid(struct context *cnt, const char *path)
+{
+    const char *dir;
+    size_t len;
+
+    dir = (cnt->conf.target_dir != NULL) ? cnt->conf.target_dir : ".";
+    len = strlen(dir);
+    while ((len > 0) && (dir[len - 1] == '/')) {
+        len--;
+    }
+
+    if ((strncmp(path, dir, len) != 0) || (path[len] != '/')) {
+        return FALSE;
+    }
+    if ((strstr(path + len, "/../") != NULL) ||
+        ((strlen(path) >= 3) && mystreq(path + strlen(path) - 3, "/.."))) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Delete the files of the oldest event of the camera and mark it expired */
+static void retention_delete(struct retention_cam *cam)
+{
+    struct eventidx_record rec;
+    char *paths, *pos, *path;
+    int ftype;
+
+    if (eventidx_get(cam->fd_idx, cam->fd_paths, cam->expired, &rec, &paths) != 0) {
+        cam->has_next = FALSE;
+        return;
+    }
+
+    pos = paths;
+    while ((path = eventidx_path_next(&pos, &ftype)) != NULL) {
+        /* Indexes written by older versions may list snapshots and timelapses */
+        if (!(ftype & EVENTIDX_FTYPES)) {
+            continue;
+        }
+        /* A damaged index, or one from before the target_dir changed */
+        if (!retention_path_valid(cam->cnt, path)) {
+            MOTION_LOG(WRN, TYPE_ALL, NO_ERRNO
+                ,_("Not deleting %s of camera %d since it is not in the target_dir")
+                ,path, cam->cnt->camera_id);
+            continue;
+        }
+        if (unlink(path) != 0) {
+            if (errno != ENOENT) {
+                MOTION_LOG(WRN, TYPE_ALL, SHOW_ERRNO
+                    ,_("Unable to delete %s"), path);
+            }
+            continue;
+        }
+        retention_rmdir(cam->cnt, path);
+        /* The files of an event are still all deleted when finishing */
+        if ((retention.rate > 0) && !retention.finish) {
+            retention_wait(1000000L / retention.rate);
+        }
+    }
+    free(paths);
+
+    MOTION_LOG(DBG, TYPE_ALL, NO_ERRNO
+        ,_("Deleted the files of event %s of camera %d")
+        ,rec.eventid, cam->cnt->camera_id);
+
+    cam->expired++;
+    if (eventidx_expire(cam->fd_idx, cam->expired) != 0) {
+        MOTION_LOG(ERR, TYPE_ALL, SHOW_ERRNO
+            ,_("Unable to mark the deleted events in the index of camera %d")
+            ,cam->cnt->camera_id);
+    }
+    cam->used = MAX(cam->used - rec.bytes, 0);
+    retention.deleted++;
+    retention.freed += rec.bytes;
+
+    retention_next(cam);
+}
+
+/* Free bytes on the filesystem of the target_dir of the camera, -1 when unknown */
+static int64_t retention_available(struct retention_cam *cam)
+{
+    struct statvfs statbuf;
+    const char *dir;
+
+    dir = (cam->cnt->conf.target_dir != NULL) ? cam->cnt->conf.target_dir : ".";
+    if (statvfs(dir, &statbuf) != 0) {
+        return -1;
+    }
+
+    return (int64_t)statbuf.f_bavail * statbuf.f_frsize;
+}
+
+/*
+ * The camera with the oldest event still kept.  With lowspace only the
+ * cameras whose target_dir has less than retention_free left are chosen.
+ */
+static struct retention_cam *retention_oldest(int lowspace)
+{
+    struct retention_cam *cam, *oldest;
+    int64_t avail;
+    int indx;
+
+    oldest = NULL;
+    for (indx = 0; indx < retention.cam_count; indx++) {
+        cam = &retention.cams[indx];
+        if (!cam->has_next) {
+            continue;
+        }
+        if ((oldest != NULL) && (cam->next.start >= oldest->next.start)) {
+            continue;
+        }
+        if (lowspace) {
+            avail = retention_available(cam);
+            if ((avail < 0) || (avail >= retention.free)) {
+                continue;
+            }
+        }
+        oldest = cam;
+    }
+
+    return oldest;
+}
+
+/* Delete the oldest events until all the budgets are met */
+static void retention_check(void)
+{
+    struct retention_cam *cam;
+    int64_t used, limit;
+    time_t now;
+    int indx;
+
+    for (indx = 0; indx < retention.cam_count; indx++) {
+        retention_open(&retention.cams[indx]);
+    }
+
+    now = time(NULL);
+    for (indx = 0; indx < retention.cam_count; indx++) {
+        cam = &retention.cams[indx];
+        if (cam->cnt->conf.retention_days > 0) {
+            limit = (int64_t)now - ((int64_t)cam->cnt->conf.retention_days * 86400);
+            while (!retention.finish && cam->has_next && (cam->next.end < limit)) {
+                retention_delete(cam);
+            }
+        }
+        if (cam->cnt->conf.retention_size > 0) {
+            limit = (int64_t)cam->cnt->conf.retention_size * RETENTION_MB;
+            while (!retention.finish && cam->has_next && (cam->used > limit)) {
+                retention_delete(cam);
+            }
+        }
+    }
+
+    while (!retention.finish && (retention.total > 0)) {
+        used = 0;
+        for (indx = 0; indx < retention.cam_count; indx++) {
+            used += retention.cams[indx].used;
+        }
+        if (used <= retention.total) {
+            break;
+        }
+        cam = retention_oldest(FALSE);
+        if (cam == NULL) {
+            break;
+        }
+        retention_delete(cam);
+    }
+
+    while (!retention.finish && (retention.free > 0)) {
+        cam = retention_oldest(TRUE);
+        if (cam == NULL) {
+            break;
+        }
+        retention_delete(cam);
+    }
+
+    for (indx = 0; indx < retention.cam_count; indx++) {
+        retention_close(&retention.cams[indx]);
+    }
+}
+
+static void *retention_handler(void *arg)
+{
+    (void)arg;
+
+    util_threadname_set("rt", 0, NULL);
+
+    while (TRUE) {
+        retention_check();
+        if (retention_wait(RETENTION_INTERVAL * 1000000L)) {
+            break;
+        }
+    }
+
+    pthread_exit(NULL);
+}
+
+/** retention_init
+ *  Start the retention thread when a camera with an event_index has a
+ *  budget.
+ */
+void retention_init(struct context **cntlist)
+{
+    struct context *cnt;
+    int indx, count, budget;
+
+    retention.running = FALSE;
+
+    retention.rate = cntlist[0]->conf.retention_rate;
+    retention.total = (int64_t)cntlist[0]->conf.retention_total * RETENTION_MB;
+    retention.free = (int64_t)cntlist[0]->conf.retention_free * RETENTION_MB;
+    retention.finish = FALSE;
+
+    count = 0;
+    for (indx = (cntlist[1] != NULL ? 1 : 0); cntlist[indx] != NULL; indx++) {
+        count++;
+    }
+    retention.cams = mymalloc(count * sizeof(struct retention_cam));
+    memset(retention.cams, 0, count * sizeof(struct retention_cam));
+    retention.cam_count = 0;
+
+    budget = (retention.total > 0) || (retention.free > 0);
+    for (indx = (cntlist[1] != NULL ? 1 : 0); cntlist[indx] != NULL; indx++) {
+        cnt = cntlist[indx];
+        if ((cnt->conf.retention_days > 0) || (cnt->conf.retention_size > 0)) {
+            budget = TRUE;
+        }
+        if ((cnt->conf.event_index == NULL) || (cnt->conf.event_index[0] == '\0')) {
+            continue;
+        }
+        retention.cams[retention.cam_count].cnt = cnt;
+        retention.cams[retention.cam_count].fd_idx = -1;
+        retention.cam_count++;
+    }
+
+    if (!budget) {
+        free(retention.cams);
+        retention.cams = NULL;
+        return;
+    }
+    if (retention.cam_count == 0) {
+        MOTION_LOG(WRN, TYPE_ALL, NO_ERRNO
+            ,_("The retention budgets need the event_index of the cameras, no files are deleted"));
+        free(retention.cams);
+        retention.cams = NULL;
+        return;
+    }
+
+    retention.deleted = 0;
+    retention.freed = 0;
+
+    if (pthread_create(&retention.thread_id, NULL, &retention_handler, NULL) != 0) {
+        MOTION_LOG(ERR, TYPE_ALL, SHOW_ERRNO
+            ,_("Unable to start the retention thread, no files are deleted"));
+        free(retention.cams);
+        retention.cams = NULL;
+        return;
+    }
+    retention.running = TRUE;
+
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+        ,_("Retention of the events of %d cameras started"), retention.cam_count);
+}
+
+/** retention_deinit
+ *  Stop the retention thread.  The cameras are stopped by then.
+ */
+void retention_deinit(void)
+{
+    if (!retention.running) {
+        return;
+    }
+
+    pthread_mutex_lock(&retention.mutex);
+        retention.finish = TRUE;
+        pthread_cond_broadcast(&retention.cond);
+    pthread_mutex_unlock(&retention.mutex);
+
+    pthread_join(retention.thread_id, NULL);
+    retention.running = FALSE;
+
+    free(retention.cams);
+    retention.cams = NULL;
+
+    MOTION_LOG(INF, TYPE_ALL, NO_ERRNO
+        ,_("Retention: %lu events deleted, %lld MB freed")
+        ,retention.deleted, (long long)(retention.freed / RETENTION_MB));
+}
@@ -0,0 +1,28 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  retention.h
+ *    Headers associated with functions in the retention.c module.
+ */
+
+#ifndef _INCLUDE_RETENTION_H
+#define _INCLUDE_RETENTION_H
+
+void retention_init(struct context **cntlist);
+void retention_deinit(void);
+
+#endif /* _INCLUDE_RETENTION_H */
@@ -310,21 +310,37 @@ void rotate_deinit(struct context *cnt)
 }
 
 /**
- * rotate_map
- *
- *  Main entry point for rotation.
+ * rotate_fused
  *
- * Parameters:
+ *  Returns the degrees a capture converter should rotate by while it
+ *  converts the frame, or 0 when rotate_map must be used instead.  This is
+ *  only the case for a plain rotation of a camera without a high resolution
+ *  image, since a flip has to be done before the rotation.
+ */
+int rotate_fused(struct context *cnt)
+{
+    if ((cnt->rotate_data.degrees == 0) ||
+        (cnt->rotate_data.axis != FLIP_TYPE_NONE) ||
+        (cnt->rotate_data.capture_width_high != 0)) {
+        return 0;
+    }
+
+    return cnt->rotate_data.degrees;
+}
+
+/**
+ * rotate_map_images
  *
- *   img_data- pointer to the image data to rotate
- *   cnt - the current thread's context structure
+ *  Rotates the normal and high resolution images, or only the high
+ *  resolution image when high_only is set.  A high resolution image that
+ *  is still to be decoded (high_pending) is left for rotate_map_high.
  *
  * Returns:
  *
  *   0  - success
  *   -1 - failure (shouldn't happen)
  */
-int rotate_map(struct context *cnt, struct image_data *img_data)
+static int rotate_map_images(struct context *cnt, struct image_data *img_data, int high_only)
 {
     /*
      * The image format is YUV 4:2:0 planar, which has the pixel
@@ -346,9 +362,11 @@ int rotate_map(struct context *cnt, struct image_data *img_data)
         return 0;
     }
 
-    indx = 0;
+    /* With detect_scale the normal image is made from the rotated high image */
+    indx = (high_only || ((cnt->imgs.detect_scale > 1) && !cnt->imgs.detect_camera)) ? 1 : 0;
     indx_max = 0;
-    if ((cnt->rotate_data.capture_width_high != 0) && (cnt->rotate_data.capture_height_high != 0)) {
+    if ((cnt->rotate_data.capture_width_high != 0) && (cnt->rotate_data.capture_height_high != 0) &&
+        (high_only || !img_data->high_pending)) {
         indx_max = 1;
     }
 
@@ -426,3 +444,34 @@ int rotate_map(struct context *cnt, struct image_data *img_data)
     return 0;
 }
 
+/**
+ * rotate_map
+ *
+ *  Main entry point for rotation.
+ *
+ * Parameters:
+ *
+ *   img_data- pointer to the image data to rotate
+ *   cnt - the current thread's context structure
+ *
+ * Returns:
+ *
+ *   0  - success
+ *   -1 - failure (shouldn't happen)
+ */
+int rotate_map(struct context *cnt, struct image_data *img_data)
+{
+    return rotate_map_images(cnt, img_data, FALSE);
+}
+
+/**
+ * rotate_map_high
+ *
+ *  Rotates only the high resolution image, used once an image that was
+ *  captured with high_pending has its high resolution image decoded.
+ */
+int rotate_map_high(struct context *cnt, struct image_data *img_data)
+{
+    return rotate_map_images(cnt, img_data, TRUE);
+}
+
@@ -73,5 +73,7 @@ void rotate_deinit(struct context *cnt);
  *   -1 - failure (rare, shouldn't happen)
  */
 int rotate_map(struct context *cnt, struct image_data *img_data);
+int rotate_map_high(struct context *cnt, struct image_data *img_data);
+int rotate_fused(struct context *cnt);
 
 #endif
@@ -0,0 +1,208 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *    shmexport.c
+ *
+ *    Export of the frames of a camera in a POSIX shared memory ring.
+ *
+ *    When shm_export is set, the camera creates /motion-camN where N is the
+ *    camera id, with a header and shm_export slots.  Each frame processed by
+ *    the motion loop is put into the next slot with its capture time and
+ *    detection results, and the header seq is advanced.  External programs
+ *    map the memory read only, see shmexport.h for the layout, and read the
+ *    frames in place instead of receiving a copy through a pipe or device.
+ *
+ *    A slot is written as a sequence lock.  The slot seq is odd while the
+ *    slot is written so a reader copies the slot and checks that seq was even
+ *    and did not change meanwhile.  On Linux the header seq is also a futex
+ *    word which is woken on each frame, so readers can wait with FUTEX_WAIT
+ *    on the last seq they saw instead of polling.
+ *
+ *    The image_norm of a slot is the captured image before the text and
+ *    locate overlays.  The image_high is added for cameras with a high
+ *    resolution image.
+ *
+ */
+
+#include <sys/mman.h>
+#ifdef __linux__
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+#endif
+#include "translate.h"
+#include "motion.h"
+#include "util.h"
+#include "logger.h"
+#include "shmexport.h"
+
+#define SHMEXPORT_ALIGN     64
+
+static size_t shmexport_align(size_t size)
+{
+    return (size + SHMEXPORT_ALIGN - 1) & ~((size_t)SHMEXPORT_ALIGN - 1);
+}
+
+/** shmexport_init
+ *  Create the shared memory of the camera when shm_export is set.
+ */
+void shmexport_init(struct context *cnt)
+{
+    struct shmexport_ctx *shm;
+    struct shmexport_header *hdr;
+    size_t header_size, slot_size;
+    int slots;
+
+    cnt->shmexport = NULL;
+
+    slots = cnt->conf.shm_export;
+    if (slots <= 0) {
+        return;
+    }
+    if (slots > 64) {
+        MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+            ,_("Invalid shm_export %d, using 64 slots"), slots);
+        slots = 64;
+    }
+
+    header_size = shmexport_align(sizeof(struct shmexport_header));
+    slot_size = shmexport_align(sizeof(struct shmexport_slot)) +
+        shmexport_align(cnt->imgs.size_norm) + shmexport_align(cnt->imgs.size_high);
+
+    shm = mymalloc(sizeof(struct shmexport_ctx));
+    snprintf(shm->name, sizeof(shm->name), "/motion-cam%d", cnt->camera_id);
+    shm->size = header_size + (slot_size * slots);
+
+    shm->fd = shm_open(shm->name, O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0640);
+    if (shm->fd < 0) {
+        MOTION_LOG(ERR, TYPE_ALL, SHOW_ERRNO
+            ,_("Unable to create the shared memory %s"), shm->name);
+        free(shm);
+        return;
+    }
+
+    if (ftruncate(shm->fd, shm->size) != 0) {
+        MOTION_LOG(ERR, TYPE_ALL, SHOW_ERRNO
+            ,_("Unable to size the shared memory %s"), shm->name);
+        close(shm->fd);
+        shm_unlink(shm->name);
+        free(shm);
+        return;
+    }
+
+    hdr = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+    if (hdr == MAP_FAILED) {
+        MOTION_LOG(ERR, TYPE_ALL, SHOW_ERRNO
+            ,_("Unable to map the shared memory %s"), shm->name);
+        close(shm->fd);
+        shm_unlink(shm->name);
+        free(shm);
+        return;
+    }
+    shm->hdr = hdr;
+
+    memset(hdr, 0, header_size);
+    hdr->version = SHMEXPORT_VERSION;
+    hdr->slots = slots;
+    hdr->slot_size = slot_size;
+    hdr->header_size = header_size;
+    hdr->camera_id = cnt->camera_id;
+    hdr->width = cnt->imgs.width;
+    hdr->height = cnt->imgs.height;
+    hdr->size_norm = cnt->imgs.size_norm;
+    if (cnt->imgs.size_high > 0) {
+        hdr->width_high = cnt->imgs.width_high;
+        hdr->height_high = cnt->imgs.height_high;
+        hdr->size_high = cnt->imgs.size_high;
+    }
+    /* Readers check the magic last */
+    __atomic_store_n(&hdr->magic, SHMEXPORT_MAGIC, __ATOMIC_RELEASE);
+
+    cnt->shmexport = shm;
+
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+        ,_("Exporting the frames in the shared memory %s with %d slots")
+        ,shm->name, slots);
+}
+
+void shmexport_deinit(struct context *cnt)
+{
+    struct shmexport_ctx *shm = cnt->shmexport;
+
+    if (shm == NULL) {
+        return;
+    }
+
+    munmap(shm->hdr, shm->size);
+    close(shm->fd);
+    shm_unlink(shm->name);
+    free(shm);
+    cnt->shmexport = NULL;
+}
+
+/** shmexport_put
+ *  Put the frame of the motion loop into the next slot and wake the readers.
+ */
+void shmexport_put(struct context *cnt)
+{
+    struct shmexport_ctx *shm = cnt->shmexport;
+    struct shmexport_header *hdr;
+    struct shmexport_slot *slot;
+    struct image_data *img;
+    unsigned char *base;
+    uint32_t seq;
+
+    if (shm == NULL) {
+        return;
+    }
+
+    hdr = shm->hdr;
+    img = cnt->current_image;
+    seq = hdr->seq + 1;
+    base = (unsigned char *)hdr + hdr->header_size + ((size_t)(seq % hdr->slots) * hdr->slot_size);
+    slot = (struct shmexport_slot *)base;
+
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        slot->frame = seq;
+        slot->tv_sec = img->timestamp_tv.tv_sec;
+        slot->tv_usec = img->timestamp_tv.tv_usec;
+        slot->diffs = img->diffs;
+        slot->flags = img->flags;
+        slot->event_nr = cnt->event_nr;
+        slot->total_labels = img->total_labels;
+        slot->x = img->location.x;
+        slot->y = img->location.y;
+        slot->width = img->location.width;
+        slot->height = img->location.height;
+        slot->offset_norm = shmexport_align(sizeof(struct shmexport_slot));
+        memcpy(base + slot->offset_norm, cnt->imgs.image_virgin.image_norm, hdr->size_norm);
+        if (hdr->size_high > 0) {
+            motion_image_high(cnt, img);
+            slot->offset_high = slot->offset_norm + shmexport_align(hdr->size_norm);
+            memcpy(base + slot->offset_high, img->image_high, hdr->size_high);
+        } else {
+            slot->offset_high = 0;
+        }
+
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&hdr->seq, seq, __ATOMIC_RELEASE);
+
+    #ifdef __linux__
+        syscall(SYS_futex, &hdr->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    #endif
+}
@@ -0,0 +1,77 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  shmexport.h
+ *    Headers associated with functions in the shmexport.c module.
+ *
+ *    The structures below are the layout of the shared memory and are
+ *    read by the external consumers.  Change SHMEXPORT_VERSION when they change.
+ */
+
+#ifndef _INCLUDE_SHMEXPORT_H
+#define _INCLUDE_SHMEXPORT_H
+
+#include <stdint.h>
+
+#define SHMEXPORT_MAGIC     0x544f4d4d      /* "MMOT" */
+#define SHMEXPORT_VERSION   1
+
+struct shmexport_header {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    seq;            /* Frames written.  The futex word woken on each frame */
+    uint32_t    slots;
+    uint32_t    slot_size;      /* Bytes from one slot to the next */
+    uint32_t    header_size;    /* Offset of the first slot */
+    int32_t     camera_id;
+    int32_t     width;
+    int32_t     height;
+    int32_t     width_high;     /* 0 when there is no high resolution image */
+    int32_t     height_high;
+    uint32_t    size_norm;      /* Bytes of the YUV420P image_norm */
+    uint32_t    size_high;      /* Bytes of the YUV420P image_high */
+};
+
+struct shmexport_slot {
+    uint32_t    seq;            /* Odd while the slot is being written */
+    uint32_t    frame;          /* Header seq of the frame in the slot */
+    int64_t     tv_sec;         /* Capture time of the frame */
+    int64_t     tv_usec;
+    int32_t     diffs;          /* Changed pixels */
+    uint32_t    flags;          /* IMAGE_* flags */
+    int32_t     event_nr;       /* Event of the frame when flags has IMAGE_MOTION */
+    int32_t     total_labels;
+    int32_t     x;              /* Center and size of the motion */
+    int32_t     y;
+    int32_t     width;
+    int32_t     height;
+    uint32_t    offset_norm;    /* Offset of image_norm from the start of the slot */
+    uint32_t    offset_high;    /* Offset of image_high, 0 when there is none */
+};
+
+struct shmexport_ctx {
+    char                        name[64];
+    int                         fd;
+    size_t                      size;
+    struct shmexport_header     *hdr;
+};
+
+void shmexport_init(struct context *cnt);
+void shmexport_deinit(struct context *cnt);
+void shmexport_put(struct context *cnt);
+
+#endif /* _INCLUDE_SHMEXPORT_H */
@@ -0,0 +1,259 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *    spawner.c
+ *
+ *    Command spawner for the on_* event commands.
+ *
+ *    Forking the motion process copies the page tables of all the image
+ *    rings, frame pools and movie encoders, which takes long enough to be
+ *    seen as a jitter of the frames every time a command is started.  At
+ *    startup, before the cameras allocate anything, a small helper process
+ *    is forked instead.  The camera threads write the commands to it over a
+ *    pipe and the helper starts them with posix_spawn.
+ *
+ *    Every command is written as one NUL terminated string of at most
+ *    PIPE_BUF bytes so the writes of the camera threads never interleave.
+ *    The pipe does not block; when the helper is not running or its pipe is
+ *    full the command is started by forking the motion process as before.
+ *
+ */
+
+#include <spawn.h>
+#include "translate.h"
+#include "motion.h"
+#include "util.h"
+#include "logger.h"
+#include "spawner.h"
+
+extern char **environ;
+
+static struct {
+    int     fd;             /* Write end of the pipe to the helper, -1 when not running */
+    pid_t   pid;
+    int     exited;         /* Helper found gone, commands are forked */
+} spawner = {-1, 0, FALSE};
+
+/** spawner_command
+ *  Start the command detached from the helper with the shell.
+ */
+static void spawner_command(char *command)
+{
+    posix_spawnattr_t attr;
+    sigset_t sigs;
+    pid_t pid;
+    short flags;
+    char *argv[] = {"sh", "-c", command, " &", NULL};
+
+    posix_spawnattr_init(&attr);
+
+    /* The helper ignores the signals of the terminal, the command must not */
+    flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    sigfillset(&sigs);
+    posix_spawnattr_setsigdefault(&attr, &sigs);
+    sigemptyset(&sigs);
+    posix_spawnattr_setsigmask(&attr, &sigs);
+
+    #ifdef POSIX_SPAWN_SETSID
+        flags |= POSIX_SPAWN_SETSID;
+    #else
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, 0);
+    #endif
+    posix_spawnattr_setflags(&attr, flags);
+
+    if (posix_spawn(&pid, "/bin/sh", NULL, &attr, argv, environ) != 0) {
+        MOTION_LOG(ALR, TYPE_EVENTS, SHOW_ERRNO
+            ,_("Unable to start external command '%s'"), command);
+    }
+
+    posix_spawnattr_destroy(&attr);
+}
+
+/** spawner_helper
+ *  Main of the helper process.  Starts the commands read from the pipe
+ *  until the motion process closes it.
+ */
+static void spawner_helper(int fd)
+{
+    char buf[PIPE_BUF * 2];
+    size_t used, start, indx;
+    ssize_t len;
+
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTERM, SIG_IGN);
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGUSR1, SIG_IGN);
+    signal(SIGALRM, SIG_IGN);
+
+    used = 0;
+    while (1) {
+        len = read(fd, buf + used, sizeof(buf) - used);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (len == 0) {
+            break;
+        }
+        used += len;
+
+        start = 0;
+        for (indx = 0; indx < used; indx++) {
+            if (buf[indx] == '\0') {
+                spawner_command(buf + start);
+                start = indx + 1;
+            }
+        }
+        if (start > 0) {
+            memmove(buf, buf + start, used - start);
+            used -= start;
+        } else if (used == sizeof(buf)) {
+            /* Can not happen with the writes limited to PIPE_BUF */
+            used = 0;
+        }
+    }
+
+    _exit(0);
+}
+
+/** spawner_fork
+ *  Start the command by forking the motion process.
+ */
+static void spawner_fork(char *command)
+{
+    if (!fork()) {
+
+        /* Detach from parent */
+        setsid();
+
+        execl("/bin/sh", "sh", "-c", command, " &", NULL);
+
+        /* if above function succeeds the program never reach here */
+        MOTION_LOG(ALR, TYPE_EVENTS, SHOW_ERRNO
+            ,_("Unable to start external command '%s'"), command);
+
+        exit(1);
+    }
+}
+
+/** spawner_init
+ *  Fork the helper process.  Must be called before the threads are started
+ *  and before the image buffers are allocated to keep the helper small.
+ */
+void spawner_init(void)
+{
+    int fds[2];
+    pid_t pid;
+
+    if (spawner.fd != -1) {
+        return;
+    }
+
+    if (pipe(fds) != 0) {
+        MOTION_LOG(ERR, TYPE_EVENTS, SHOW_ERRNO
+            ,_("Unable to create the command spawner pipe"));
+        return;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    pid = fork();
+    if (pid < 0) {
+        MOTION_LOG(ERR, TYPE_EVENTS, SHOW_ERRNO
+            ,_("Unable to start the command spawner, commands are forked"));
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+
+    if (pid == 0) {
+        close(fds[1]);
+        spawner_helper(fds[0]);
+    }
+
+    close(fds[0]);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+
+    spawner.fd = fds[1];
+    spawner.pid = pid;
+    spawner.exited = FALSE;
+
+    MOTION_LOG(NTC, TYPE_EVENTS, NO_ERRNO
+        ,_("Command spawner started, pid: %d"), (int)pid);
+}
+
+/** spawner_deinit
+ *  Close the pipe so the helper exits once the queued commands are started.
+ */
+void spawner_deinit(void)
+{
+    if (spawner.fd == -1) {
+        return;
+    }
+
+    close(spawner.fd);
+    spawner.fd = -1;
+    spawner.pid = 0;
+    spawner.exited = FALSE;
+}
+
+/** spawner_exec
+ *  Start the command with the shell, detached from motion.
+ */
+void spawner_exec(char *command)
+{
+    size_t len;
+    ssize_t retcd;
+
+    len = strlen(command) + 1;
+
+    if ((spawner.fd != -1) && (len <= PIPE_BUF)) {
+        retcd = write(spawner.fd, command, len);
+        if (retcd == (ssize_t)len) {
+            return;
+        }
+        if ((retcd < 0) && (errno == EPIPE) && !spawner.exited) {
+            spawner.exited = TRUE;
+            MOTION_LOG(ERR, TYPE_EVENTS, NO_ERRNO
+                ,_("Command spawner exited, commands are forked"));
+        }
+    }
+
+    spawner_fork(command);
+}
+
+/** spawner_pending
+ *  Bytes of commands waiting in the pipe for the helper to start.
+ */
+int spawner_pending(void)
+{
+    int bytes;
+
+    if (spawner.fd == -1) {
+        return 0;
+    }
+
+    if (ioctl(spawner.fd, FIONREAD, &bytes) < 0) {
+        return 0;
+    }
+
+    return bytes;
+}
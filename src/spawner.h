@@ -0,0 +1,30 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  spawner.h
+ *    Headers associated with functions in the spawner.c module.
+ */
+
+#ifndef _INCLUDE_SPAWNER_H
+#define _INCLUDE_SPAWNER_H
+
+void spawner_init(void);
+void spawner_deinit(void);
+void spawner_exec(char *command);
+int spawner_pending(void);
+
+#endif /* _INCLUDE_SPAWNER_H */
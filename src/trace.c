@@ -0,0 +1,306 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *    trace.c
+ *
+ *    Recorder of the spans of time taken by the frames of each thread.
+ *
+ *    When trace_buffer is set each thread that records a span is given a
+ *    ring of that many events the first time it records one.  Only the
+ *    owning thread writes to a ring so recording takes no lock; the head
+ *    is published after the event is written.  The webcontrol copies the
+ *    rings and drops the events that were overwritten while it copied.
+ *    The ring of a thread that exits is kept until another thread needs one
+ *    so the spans of a camera that lost its connection can still be read.
+ *
+ */
+
+#include "translate.h"
+#include "motion.h"
+#include "util.h"
+#include "logger.h"
+#include "trace.h"
+
+/* Most rings kept.  Threads after these are not traced */
+#define TRACE_RINGS_MAX 64
+/* Most events kept in a ring */
+#define TRACE_EVENTS_MAX 1000000
+
+struct trace_ring {
+    struct trace_event     *events;
+    unsigned long           head;           /* Count of events written */
+    long long               stage_usec;     /* Start of the current stage */
+    int                     tid;
+    int                     in_use;
+    char                    threadname[16];
+    struct trace_ring      *next;
+};
+
+static struct {
+    int                     size;           /* Events per ring, 0 when not tracing */
+    int                     ring_count;
+    struct trace_ring      *rings;
+    pthread_key_t           key;
+    pthread_mutex_t         mutex;
+} trace;
+
+/* Assigned to the threads that found no free ring */
+static struct trace_ring trace_untraced;
+
+static long long trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((long long)ts.tv_sec * 1000000LL) + (ts.tv_nsec / 1000);
+}
+
+/* Called when a thread exits to release its ring */
+static void trace_release(void *arg)
+{
+    struct trace_ring *ring = arg;
+
+    if (ring == &trace_untraced) {
+        return;
+    }
+
+    pthread_mutex_lock(&trace.mutex);
+        ring->in_use = FALSE;
+    pthread_mutex_unlock(&trace.mutex);
+}
+
+/** trace_ring_get
+ *  The ring of the calling thread.  A new or released ring is assigned the
+ *  first time a thread records.  Returns NULL when tracing is off or all
+ *  the rings are in use.
+ */
+static struct trace_ring *trace_ring_get(void)
+{
+    struct trace_ring *ring;
+
+    if (trace.size == 0) {
+        return NULL;
+    }
+
+    ring = pthread_getspecific(trace.key);
+    if (ring == &trace_untraced) {
+        return NULL;
+    } else if (ring != NULL) {
+        return ring;
+    }
+
+    pthread_mutex_lock(&trace.mutex);
+        if (trace.ring_count < TRACE_RINGS_MAX) {
+            ring = mymalloc(sizeof(struct trace_ring));
+            memset(ring, 0, sizeof(struct trace_ring));
+            ring->events = mymalloc(trace.size * sizeof(struct trace_event));
+            ring->tid = ++trace.ring_count;
+            ring->next = trace.rings;
+            trace.rings = ring;
+        } else {
+            for (ring = trace.rings; ring != NULL; ring = ring->next) {
+                if (!ring->in_use) {
+                    break;
+                }
+            }
+        }
+        if (ring != NULL) {
+            ring->in_use = TRUE;
+            ring->head = 0;
+            ring->stage_usec = trace_now();
+            util_threadname_get(ring->threadname);
+        }
+    pthread_mutex_unlock(&trace.mutex);
+
+    if (ring == NULL) {
+        MOTION_LOG(WRN, TYPE_ALL, NO_ERRNO
+            ,_("All %d trace buffers are in use, thread is not traced"), TRACE_RINGS_MAX);
+        /* Do not search again on every span of this thread */
+        pthread_setspecific(trace.key, &trace_untraced);
+        return NULL;
+    }
+
+    pthread_setspecific(trace.key, ring);
+
+    return ring;
+}
+
+static void trace_record(struct trace_ring *ring, const char *name
+        , long long start, long long end)
+{
+    struct trace_event *event;
+    unsigned long head;
+
+    head = ring->head;
+    event = &ring->events[head % trace.size];
+    event->name = name;
+    event->ts_usec = start;
+    event->dur_usec = (long)(end - start);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/** trace_init
+ *  Set up the recorder with the number of events kept for each thread.
+ *  Tracing is off when the size is zero.
+ */
+void trace_init(int size)
+{
+    memset(&trace, 0, sizeof(trace));
+
+    if (size <= 0) {
+        return;
+    }
+    if (size > TRACE_EVENTS_MAX) {
+        MOTION_LOG(WRN, TYPE_ALL, NO_ERRNO
+            ,_("trace_buffer limited to %d"), TRACE_EVENTS_MAX);
+        size = TRACE_EVENTS_MAX;
+    }
+
+    pthread_mutex_init(&trace.mutex, NULL);
+    pthread_key_create(&trace.key, trace_release);
+    trace.size = size;
+
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+        ,_("Tracing with %d events per thread"), size);
+}
+
+/** trace_deinit
+ *  Free the rings.  Called once the threads that record have finished.
+ */
+void trace_deinit(void)
+{
+    struct trace_ring *ring;
+
+    if (trace.size == 0) {
+        return;
+    }
+
+    trace.size = 0;
+
+    while (trace.rings != NULL) {
+        ring = trace.rings;
+        trace.rings = ring->next;
+        free(ring->events);
+        free(ring);
+    }
+
+    pthread_key_delete(trace.key);
+    pthread_mutex_destroy(&trace.mutex);
+}
+
+/** trace_begin
+ *  Start a span that is ended with trace_end on the same thread.
+ */
+void trace_begin(struct trace_span *span)
+{
+    if (trace.size == 0) {
+        return;
+    }
+    span->ts_usec = trace_now();
+}
+
+void trace_end(const char *name, struct trace_span *span)
+{
+    struct trace_ring *ring;
+
+    ring = trace_ring_get();
+    if (ring == NULL) {
+        return;
+    }
+    trace_record(ring, name, span->ts_usec, trace_now());
+}
+
+/** trace_stage_start
+ *  Mark the start of the first of a sequence of stages.
+ */
+void trace_stage_start(void)
+{
+    struct trace_ring *ring;
+
+    ring = trace_ring_get();
+    if (ring == NULL) {
+        return;
+    }
+    ring->stage_usec = trace_now();
+}
+
+/** trace_stage
+ *  Record the stage that ran since the last stage boundary of the thread.
+ */
+void trace_stage(const char *name)
+{
+    struct trace_ring *ring;
+    long long now;
+
+    ring = trace_ring_get();
+    if (ring == NULL) {
+        return;
+    }
+    now = trace_now();
+    trace_record(ring, name, ring->stage_usec, now);
+    ring->stage_usec = now;
+}
+
+/** trace_collect
+ *  Copy the events of each ring and pass them to the callback, oldest first.
+ *  Events that the owner overwrote during the copy are left out.
+ */
+void trace_collect(trace_callback callback, void *arg)
+{
+    struct trace_ring *ring;
+    struct trace_event *events;
+    unsigned long head, first, valid, indx;
+
+    if (trace.size == 0) {
+        return;
+    }
+
+    events = mymalloc(trace.size * sizeof(struct trace_event));
+
+    pthread_mutex_lock(&trace.mutex);
+        for (ring = trace.rings; ring != NULL; ring = ring->next) {
+            head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            if (head > (unsigned long)trace.size) {
+                first = head - trace.size;
+            } else {
+                first = 0;
+            }
+            for (indx = first; indx < head; indx++) {
+                events[indx - first] = ring->events[indx % trace.size];
+            }
+
+            /* The slot of the event being written is also not valid */
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            valid = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+            if (valid >= (unsigned long)trace.size) {
+                valid = valid - trace.size + 1;
+            } else {
+                valid = 0;
+            }
+            if (valid < first) {
+                valid = first;
+            }
+            if (valid < head) {
+                callback(arg, ring->tid, ring->threadname
+                    , events + (valid - first), (int)(head - valid));
+            }
+        }
+    pthread_mutex_unlock(&trace.mutex);
+
+    free(events);
+}
@@ -0,0 +1,48 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  trace.h
+ *    Headers associated with functions in the trace.c module.
+ */
+
+#ifndef _INCLUDE_TRACE_H
+#define _INCLUDE_TRACE_H
+
+/* One completed span of time on a thread */
+struct trace_event {
+    const char     *name;           /* Static name of the span */
+    long long       ts_usec;        /* Start on the monotonic clock */
+    long            dur_usec;       /* Duration of the span */
+};
+
+/* Start of a span that is open on the stack of the caller */
+struct trace_span {
+    long long       ts_usec;
+};
+
+typedef void (*trace_callback)(void *arg, int tid, const char *threadname
+    , struct trace_event *events, int count);
+
+void trace_init(int size);
+void trace_deinit(void);
+void trace_begin(struct trace_span *span);
+void trace_end(const char *name, struct trace_span *span);
+void trace_stage_start(void);
+void trace_stage(const char *name);
+void trace_collect(trace_callback callback, void *arg);
+
+#endif /* _INCLUDE_TRACE_H */
@@ -56,6 +56,7 @@ struct trackoptions track_template = {
     .step_angle_x =    10,             /* UVC step angle in degrees X-axis that camera moves during auto tracking */
     .step_angle_y =    10,             /* UVC step angle in degrees Y-axis that camera moves during auto tracking */
     .move_wait =       10,             /* number of frames to disable motion detection after camera moving */
+    .predict =         0,              /* aim at the predicted location of the motion */
     .generic_move =    NULL            /* command to execute to move a generic camera */
 };
 
@@ -87,7 +88,7 @@ static unsigned int generic_move(struct context *cnt, enum track_action action,
 
 
 /* Add a call to your functions here: */
-unsigned int track_center(struct context *cnt, int dev, unsigned int manual, int xoff, int yoff)
+static unsigned int track_center_cmd(struct context *cnt, int dev, unsigned int manual, int xoff, int yoff)
 {
     struct coord cent;
 
@@ -135,7 +136,7 @@ unsigned int track_center(struct context *cnt, int dev, unsigned int manual, int
 }
 
 /* Add a call to your functions here: */
-unsigned int track_move(struct context *cnt, int dev, struct coord *cent
+static unsigned int track_move_cmd(struct context *cnt, int dev, struct coord *cent
             , struct images *imgs, unsigned int manual)
 {
 
@@ -171,6 +172,310 @@ unsigned int track_move(struct context *cnt, int dev, struct coord *cent
     return 0;
 }
 
+/******************************************************************************
+    Tracking thread
+    The commands are queued by the motion loop and the web control and sent
+    to the camera one at a time.  While a command waits or is being sent and
+    for the frames returned by it afterwards, track_settle makes the motion
+    loop ignore the frames instead of waiting for the camera.
+******************************************************************************/
+
+static long long track_msec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/** track_moved
+ *  Update the moves of the camera and the command time after a command.
+ *  Called with the mutex locked.
+ */
+static void track_moved(struct track_worker *tw, struct track_cmd *cmd, long msec)
+{
+    if ((cmd->action == TRACK_MOVE) && !cmd->manual) {
+        /* The camera is turned so the location becomes the center of the image */
+        tw->shift_x += cmd->cent.x - (cmd->imgs->width / 2);
+        tw->shift_y += cmd->cent.y - (cmd->imgs->height / 2);
+    } else {
+        tw->history_count = 0;
+        tw->shift_x = 0;
+        tw->shift_y = 0;
+    }
+
+    if (tw->commands++ == 0) {
+        tw->cmd_msec = msec;
+    } else {
+        tw->cmd_msec = ((tw->cmd_msec * 3) + msec) / 4;
+    }
+}
+
+static void *track_handler(void *arg)
+{
+    struct context *cnt = arg;
+    struct track_worker *tw = cnt->track_worker;
+    struct track_cmd cmd;
+    unsigned int frames;
+    long long start;
+
+    util_threadname_set("tr", cnt->threadnr, cnt->conf.camera_name);
+
+    pthread_setspecific(tls_key_threadnr, (void *)((unsigned long)cnt->threadnr));
+
+    while (TRUE) {
+        pthread_mutex_lock(&tw->mutex);
+            while ((tw->count == 0) && !tw->finish) {
+                pthread_cond_wait(&tw->cond_get, &tw->mutex);
+            }
+            if (tw->finish) {
+                pthread_mutex_unlock(&tw->mutex);
+                break;
+            }
+            memcpy(&cmd, &tw->cmds[tw->head], sizeof(struct track_cmd));
+            tw->head = (tw->head + 1) % TRACK_QUEUE;
+            tw->count--;
+            tw->busy = TRUE;
+        pthread_mutex_unlock(&tw->mutex);
+
+        start = track_msec();
+        if (cmd.action == TRACK_CENTER) {
+            frames = track_center_cmd(cnt, cmd.dev, cmd.manual, cmd.xoff, cmd.yoff);
+        } else {
+            frames = track_move_cmd(cnt, cmd.dev, &cmd.cent, cmd.imgs, cmd.manual);
+        }
+
+        pthread_mutex_lock(&tw->mutex);
+            track_moved(tw, &cmd, (long)(track_msec() - start));
+            if (frames > tw->settle) {
+                tw->settle = frames;
+            }
+            tw->busy = FALSE;
+        pthread_mutex_unlock(&tw->mutex);
+    }
+
+    pthread_exit(NULL);
+}
+
+/** track_queue
+ *  Queue a command for the tracking thread.  A command of the auto tracking
+ *  replaces an auto tracking command that is still waiting since only the
+ *  newest location is of interest.  Without the thread the command is sent
+ *  right away as before.
+ */
+static void track_queue(struct context *cnt, struct track_cmd *cmd)
+{
+    struct track_worker *tw = cnt->track_worker;
+    struct track_cmd *last;
+    unsigned int frames;
+
+    if (tw == NULL) {
+        if (cmd->action == TRACK_CENTER) {
+            frames = track_center_cmd(cnt, cmd->dev, cmd->manual, cmd->xoff, cmd->yoff);
+        } else {
+            frames = track_move_cmd(cnt, cmd->dev, &cmd->cent, cmd->imgs, cmd->manual);
+        }
+        cnt->moved = frames;
+        return;
+    }
+
+    pthread_mutex_lock(&tw->mutex);
+        last = &tw->cmds[(tw->head + tw->count + TRACK_QUEUE - 1) % TRACK_QUEUE];
+        if ((tw->count > 0) && ((!cmd->manual && !last->manual) || (tw->count == TRACK_QUEUE))) {
+            memcpy(last, cmd, sizeof(struct track_cmd));
+            tw->coalesced++;
+        } else {
+            memcpy(&tw->cmds[(tw->head + tw->count) % TRACK_QUEUE], cmd, sizeof(struct track_cmd));
+            tw->count++;
+            pthread_cond_signal(&tw->cond_get);
+        }
+    pthread_mutex_unlock(&tw->mutex);
+}
+
+/** track_predict
+ *  Add the location to the history and when track_predict is set, move it
+ *  to where the motion is expected to be once the command and the
+ *  track_move_wait frames are over.  The history holds the locations plus
+ *  the moves of the camera so the speed is not distorted by the camera
+ *  turning in between.  Called with the mutex locked.
+ */
+static void track_predict(struct context *cnt, struct track_worker *tw
+            , struct coord *cent, struct images *imgs)
+{
+    struct track_point *first, *last;
+    long long now, lead, span;
+    int indx;
+
+    now = track_msec();
+    if ((tw->history_count > 0) &&
+        ((now - tw->history[tw->history_count - 1].msec) > TRACK_HISTORY_MSEC)) {
+        tw->history_count = 0;
+        tw->shift_x = 0;
+        tw->shift_y = 0;
+    }
+
+    if (tw->history_count == TRACK_HISTORY) {
+        for (indx = 1; indx < TRACK_HISTORY; indx++) {
+            tw->history[indx - 1] = tw->history[indx];
+        }
+        tw->history_count--;
+    }
+    last = &tw->history[tw->history_count++];
+    last->x = cent->x + tw->shift_x;
+    last->y = cent->y + tw->shift_y;
+    last->msec = now;
+
+    if (!cnt->track.predict || (tw->history_count < 2)) {
+        return;
+    }
+
+    first = &tw->history[0];
+    span = last->msec - first->msec;
+    if (span <= 0) {
+        return;
+    }
+
+    lead = tw->cmd_msec;
+    if (cnt->conf.framerate > 0) {
+        lead += (cnt->track.move_wait * 1000LL) / cnt->conf.framerate;
+    }
+
+    cent->x = (int)(last->x + (((last->x - first->x) * lead) / span)) - tw->shift_x;
+    cent->y = (int)(last->y + (((last->y - first->y) * lead) / span)) - tw->shift_y;
+    if (cent->x < 0) {
+        cent->x = 0;
+    } else if (cent->x >= imgs->width) {
+        cent->x = imgs->width - 1;
+    }
+    if (cent->y < 0) {
+        cent->y = 0;
+    } else if (cent->y >= imgs->height) {
+        cent->y = imgs->height - 1;
+    }
+}
+
+void track_center(struct context *cnt, int dev, unsigned int manual, int xoff, int yoff)
+{
+    struct track_cmd cmd;
+
+    memset(&cmd, 0, sizeof(struct track_cmd));
+    cmd.action = TRACK_CENTER;
+    cmd.dev = dev;
+    cmd.manual = manual;
+    cmd.xoff = xoff;
+    cmd.yoff = yoff;
+
+    track_queue(cnt, &cmd);
+}
+
+void track_move(struct context *cnt, int dev, struct coord *cent
+            , struct images *imgs, unsigned int manual)
+{
+    struct track_cmd cmd;
+
+    memset(&cmd, 0, sizeof(struct track_cmd));
+    cmd.action = TRACK_MOVE;
+    cmd.dev = dev;
+    cmd.manual = manual;
+    cmd.cent = *cent;
+    cmd.imgs = imgs;
+
+    if (!manual && (cnt->track_worker != NULL)) {
+        pthread_mutex_lock(&cnt->track_worker->mutex);
+            track_predict(cnt, cnt->track_worker, &cmd.cent, imgs);
+        pthread_mutex_unlock(&cnt->track_worker->mutex);
+    }
+
+    track_queue(cnt, &cmd);
+}
+
+/** track_settle
+ *  Frames the motion loop is to ignore.  While a command waits or is sent
+ *  this is at least the current frame, afterwards the frames returned by
+ *  the command are added to moved.
+ */
+unsigned int track_settle(struct context *cnt, unsigned int moved)
+{
+    struct track_worker *tw = cnt->track_worker;
+
+    if (tw == NULL) {
+        return moved;
+    }
+
+    pthread_mutex_lock(&tw->mutex);
+        if (tw->settle > moved) {
+            moved = tw->settle;
+        }
+        tw->settle = 0;
+        if ((tw->busy || (tw->count > 0)) && (moved == 0)) {
+            moved = 1;
+        }
+    pthread_mutex_unlock(&tw->mutex);
+
+    return moved;
+}
+
+/** track_start
+ *  Start the tracking thread of the camera when tracking is configured.
+ *  When the thread can not be started the commands are sent by the callers.
+ */
+void track_start(struct context *cnt)
+{
+    struct track_worker *tw;
+
+    cnt->track_worker = NULL;
+
+    if (!cnt->track.type) {
+        return;
+    }
+
+    tw = mymalloc(sizeof(struct track_worker));
+    memset(tw, 0, sizeof(struct track_worker));
+    pthread_mutex_init(&tw->mutex, NULL);
+    pthread_cond_init(&tw->cond_get, NULL);
+
+    cnt->track_worker = tw;
+
+    if (pthread_create(&tw->thread_id, NULL, &track_handler, cnt) != 0) {
+        MOTION_LOG(ERR, TYPE_TRACK, SHOW_ERRNO
+            ,_("Unable to start tracking thread, moving the camera in the motion loop"));
+        cnt->track_worker = NULL;
+        pthread_cond_destroy(&tw->cond_get);
+        pthread_mutex_destroy(&tw->mutex);
+        free(tw);
+    }
+}
+
+/** track_stop
+ *  Drop the waiting commands, wait for the one being sent and stop the
+ *  tracking thread.
+ */
+void track_stop(struct context *cnt)
+{
+    struct track_worker *tw = cnt->track_worker;
+
+    if (tw == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&tw->mutex);
+        tw->finish = TRUE;
+        tw->count = 0;
+        pthread_cond_signal(&tw->cond_get);
+    pthread_mutex_unlock(&tw->mutex);
+    pthread_join(tw->thread_id, NULL);
+
+    MOTION_LOG(INF, TYPE_TRACK, NO_ERRNO
+        ,_("Tracking: %lu commands sent, %lu replaced by a newer one, %ld ms per command")
+        ,tw->commands, tw->coalesced, tw->cmd_msec);
+
+    cnt->track_worker = NULL;
+    pthread_cond_destroy(&tw->cond_get);
+    pthread_mutex_destroy(&tw->mutex);
+    free(tw);
+}
+
 /******************************************************************************
     Stepper motor on serial port
     http://www.lavrsen.dk/twiki/bin/view/Motion/MotionTracking
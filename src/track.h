@@ -49,6 +49,7 @@ struct trackoptions {
     unsigned int step_angle_x;
     unsigned int step_angle_y;
     unsigned int move_wait;
+    unsigned int predict;           /* Aim where the motion is expected once the camera has moved */
     /* UVC */
     int pan_angle; // degrees
     int tilt_angle; // degrees
@@ -57,12 +58,62 @@ struct trackoptions {
 
 extern struct trackoptions track_template;
 
-unsigned int track_center(struct context *cnt, int dev
+enum track_action { TRACK_CENTER, TRACK_MOVE };
+
+#define TRACK_QUEUE             8       /* Commands waiting for the camera */
+#define TRACK_HISTORY           4       /* Locations kept for the prediction */
+#define TRACK_HISTORY_MSEC      3000    /* Locations older than this start a new history */
+
+struct track_cmd {
+    enum track_action   action;
+    int                 dev;
+    unsigned int        manual;
+    int                 xoff;
+    int                 yoff;
+    struct coord        cent;
+    struct images       *imgs;
+};
+
+struct track_point {
+    int                 x;              /* Location plus the moves of the camera since the history started */
+    int                 y;
+    long long           msec;
+};
+
+/*
+ * The commands to the camera are sent by a tracking thread per camera so the
+ * motion loop does not wait on the serial port, the ioctls or the sleeps of
+ * the drivers while the camera moves.
+ */
+struct track_worker {
+    pthread_t           thread_id;
+    pthread_mutex_t     mutex;          /* Protects the commands, counters and history */
+    pthread_cond_t      cond_get;       /* Signalled when a command is queued */
+
+    struct track_cmd    cmds[TRACK_QUEUE];
+    int                 head;           /* Oldest queued command */
+    int                 count;          /* Number of queued commands */
+    int                 busy;           /* A command is being sent to the camera */
+    unsigned int        settle;         /* Frames to ignore after the last command */
+    int                 finish;
+
+    struct track_point  history[TRACK_HISTORY];
+    int                 history_count;
+    int                 shift_x;        /* Moves of the camera in pixels since the history started */
+    int                 shift_y;
+    long                cmd_msec;       /* Average time a command takes */
+
+    unsigned long       commands;       /* Commands sent to the camera */
+    unsigned long       coalesced;      /* Commands replaced by a newer one before being sent */
+};
+
+void track_start(struct context *cnt);
+void track_stop(struct context *cnt);
+void track_center(struct context *cnt, int dev
             , unsigned int manual, int xoff, int yoff);
-unsigned int track_move(struct context *cnt, int dev, struct coord *cent
+void track_move(struct context *cnt, int dev, struct coord *cent
             , struct images *imgs, unsigned int manual);
-
-enum track_action { TRACK_CENTER, TRACK_MOVE };
+unsigned int track_settle(struct context *cnt, unsigned int moved);
 
 /*
 * Some default values:
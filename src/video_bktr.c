@@ -990,12 +990,19 @@ int bktr_next(struct context *cnt,  struct image_data *img_data)
         struct config *conf = &cnt->conf;
         struct video_dev *dev;
         int width, height;
+        unsigned char *map;
         int dev_bktr = cnt->video_dev;
         int ret = -1;
 
         /* NOTE: Since this is a capture, we need to use capture dimensions. */
-        width = cnt->rotate_data.capture_width_norm;
-        height = cnt->rotate_data.capture_height_norm;
+        if (cnt->imgs.detect_scale > 1) {
+            width = cnt->rotate_data.capture_width_high;
+            height = cnt->rotate_data.capture_height_high;
+        } else {
+            width = cnt->rotate_data.capture_width_norm;
+            height = cnt->rotate_data.capture_height_norm;
+        }
+        map = vid_capture_image(cnt, img_data);
 
         pthread_mutex_lock(&bktr_mutex);
         dev = viddevs;
@@ -1019,10 +1026,10 @@ int bktr_next(struct context *cnt,  struct image_data *img_data)
             dev->frames = conf->roundrobin_frames;
         }
 
-        bktr_set_input(cnt, dev, img_data->image_norm, width, height, cnt->param_input,
+        bktr_set_input(cnt, dev, map, width, height, cnt->param_input,
                        cnt->param_norm, conf->roundrobin_skip, cnt->param_freq);
 
-        ret = bktr_capture(dev, img_data->image_norm, width, height);
+        ret = bktr_capture(dev, map, width, height);
 
         if (--dev->frames <= 0) {
             dev->owner = -1;
@@ -27,10 +27,12 @@
 #include "util.h"
 #include "logger.h"
 #include "video_common.h"
+#include "video_simd.h"
 #include "netcam.h"
 #include "netcam_rtsp.h"
 #include "video_v4l2.h"
 #include "video_bktr.h"
+#include "video_synth.h"
 #include "jpegutils.h"
 
 typedef unsigned char uint8_t;
@@ -275,148 +277,22 @@ void vid_bayer2rgb24(unsigned char *dst, unsigned char *src, long int width, lon
 
 void vid_yuv422to420p(unsigned char *map, unsigned char *cap_map, int width, int height)
 {
-    unsigned char *src, *dest, *src2, *dest2;
-    int i, j;
-
-    /* Create the Y plane. */
-    src = cap_map;
-    dest = map;
-    for (i = width * height; i > 0; i--) {
-        *dest++ = *src;
-        src += 2;
-    }
-    /* Create U and V planes. */
-    src = cap_map + 1;
-    src2 = cap_map + width * 2 + 1;
-    dest = map + width * height;
-    dest2 = dest + (width * height) / 4;
-    for (i = height / 2; i > 0; i--) {
-        for (j = width / 2; j > 0; j--) {
-            *dest = ((int) *src + (int) *src2) / 2;
-            src += 2;
-            src2 += 2;
-            dest++;
-            *dest2 = ((int) *src + (int) *src2) / 2;
-            src += 2;
-            src2 += 2;
-            dest2++;
-        }
-        src += width * 2;
-        src2 += width * 2;
-    }
+    vid_simd.yuv422to420p(map, cap_map, width, height);
 }
 
 void vid_yuv422pto420p(unsigned char *map, unsigned char *cap_map, int width, int height)
 {
-    unsigned char *src, *dest, *dest2;
-    unsigned char *src_u, *src_u2, *src_v, *src_v2;
-
-    int i, j;
-    /*Planar version of 422 */
-    /* Create the Y plane. */
-    src = cap_map;
-    dest = map;
-    for (i = width * height; i > 0; i--) {
-        *dest++ = *src++;
-    }
-
-    /* Create U and V planes. */
-    dest = map + width * height;
-    dest2 = dest + (width * height) / 4;
-    for (i = 0; i< (height / 2); i++) {
-        src_u = cap_map + (width * height) + ((i*2) * (width/2));
-        src_u2 = src_u  + (width/2);
-        src_v = src_u + (width/2 * height);
-        src_v2 = src_v  + (width/2);
-
-        for (j = 0; j < (width / 2); j++) {
-            *dest = ((int) *src_u + (int) *src_u2) / 2;
-            src_u ++;
-            src_u2++;
-            dest++;
-
-            *dest2 = ((int) *src_v + (int) *src_v2) / 2;
-            src_v ++;
-            src_v2++;
-            dest2++;
-        }
-    }
+    vid_simd.yuv422pto420p(map, cap_map, width, height);
 }
 
 void vid_uyvyto420p(unsigned char *map, unsigned char *cap_map, int width, int height)
 {
-    uint8_t *pY = map;
-    uint8_t *pU = pY + (width * height);
-    uint8_t *pV = pU + (width * height) / 4;
-    uint32_t uv_offset = width * 2 * sizeof(uint8_t);
-    int ix, jx;
-
-    for (ix = 0; ix < height; ix++) {
-        for (jx = 0; jx < width; jx += 2) {
-            uint16_t calc;
-
-            if ((ix&1) == 0) {
-                calc = *cap_map;
-                calc += *(cap_map + uv_offset);
-                calc /= 2;
-                *pU++ = (uint8_t) calc;
-            }
-
-            cap_map++;
-            *pY++ = *cap_map++;
-
-            if ((ix&1) == 0) {
-                calc = *cap_map;
-                calc += *(cap_map + uv_offset);
-                calc /= 2;
-                *pV++ = (uint8_t) calc;
-            }
-
-            cap_map++;
-            *pY++ = *cap_map++;
-        }
-    }
+    vid_simd.uyvyto420p(map, cap_map, width, height);
 }
 
 void vid_rgb24toyuv420p(unsigned char *map, unsigned char *cap_map, int width, int height)
 {
-    unsigned char *y, *u, *v;
-    unsigned char *r, *g, *b;
-    int i, loop;
-
-    r = cap_map;
-    g = r + 1;
-    b = g + 1;
-
-    y = map;
-    u = y + width * height;
-    v = u + (width * height) / 4;
-    memset(u, 0, width * height / 4);
-    memset(v, 0, width * height / 4);
-
-    for (loop = 0; loop < height; loop++) {
-        for (i = 0; i < width; i += 2) {
-            *y++ = (9796 ** r + 19235 ** g + 3736 ** b) >> 15;
-            *u += ((-4784 ** r - 9437 ** g + 14221 ** b) >> 17) + 32;
-            *v += ((20218 ** r - 16941 ** g - 3277 ** b) >> 17) + 32;
-            r += 3;
-            g += 3;
-            b += 3;
-            *y++ = (9796 ** r + 19235 ** g + 3736 ** b) >> 15;
-            *u += ((-4784 ** r - 9437 ** g + 14221 ** b) >> 17) + 32;
-            *v += ((20218 ** r - 16941 ** g - 3277 ** b) >> 17) + 32;
-            r += 3;
-            g += 3;
-            b += 3;
-            u++;
-            v++;
-        }
-
-        if ((loop & 1) == 0) {
-            u -= width / 2;
-            v -= width / 2;
-        }
-    }
+    vid_simd.rgb24toyuv420p(map, cap_map, width, height);
 }
 
 /**
@@ -466,31 +342,7 @@ int vid_mjpegtoyuv420p(unsigned char *map, unsigned char *cap_map, int width, in
 
 void vid_y10torgb24(unsigned char *map, unsigned char *cap_map, int width, int height, int shift)
 {
-    /* Source code: raw2rgbpnm project */
-    /* url: http://salottisipuli.retiisi.org.uk/cgi-bin/gitweb.cgi?p=~sailus/raw2rgbpnm.git;a=summary */
-
-    /* bpp - bits per pixel */
-    /* bpp: 'Pixels are stored in 16-bit words with unused high bits padded with 0' */
-    /* url: https://linuxtv.org/downloads/v4l-dvb-apis/V4L2-PIX-FMT-Y12.html */
-    /* url: https://linuxtv.org/downloads/v4l-dvb-apis/V4L2-PIX-FMT-Y10.html */
-
-    int src_size[2] = {width,height};
-    int bpp = 16;
-    unsigned int src_stride = (src_size[0] * bpp) / 8;
-    unsigned int rgb_stride = src_size[0] * 3;
-    int a = 0;
-    int src_x = 0, src_y = 0;
-    int dst_x = 0, dst_y = 0;
-
-    for (src_y = 0, dst_y = 0; dst_y < src_size[1]; src_y++, dst_y++) {
-        for (src_x = 0, dst_x = 0; dst_x < src_size[0]; src_x++, dst_x++) {
-            a = (cap_map[src_y*src_stride + src_x*2+0] |
-                (cap_map[src_y*src_stride + src_x*2+1] << 8)) >> shift;
-            map[dst_y*rgb_stride+3*dst_x+0] = a;
-            map[dst_y*rgb_stride+3*dst_x+1] = a;
-            map[dst_y*rgb_stride+3*dst_x+2] = a;
-        }
-    }
+    vid_simd.y10torgb24(map, cap_map, width, height, shift);
 }
 
 void vid_greytoyuv420p(unsigned char *map, unsigned char *cap_map, int width, int height)
@@ -501,6 +353,220 @@ void vid_greytoyuv420p(unsigned char *map, unsigned char *cap_map, int width, in
 
 }
 
+/*
+ * Converters that also rotate.
+ *
+ * These write the YUV420P image already rotated by 90, 180 or 270 degrees
+ * clockwise so the separate rotate_map pass and its copy through the
+ * rotate buffer are not needed.  Each output plane is filled in square
+ * tiles so the source rows a tile reads from stay in the cache while the
+ * output is written sequentially.
+ *
+ * Output sample (row, col) is read from the source at
+ * base + row * step_r + col * step_c bytes, which covers all the rotations.
+ */
+#define VID_ROT_TILE 32
+
+struct vid_rot_map {
+    long base;
+    long step_r;
+    long step_c;
+};
+
+typedef void (*vid_rot_line)(unsigned char *dst, unsigned char *src, long step, long extra, int count);
+
+/* Set up the walk over a source plane of width x height samples */
+static void vid_rot_setup(struct vid_rot_map *rmap, int deg, int width, int height
+            , long rowbytes, long pixbytes, long offset)
+{
+    switch (deg) {
+    case 90:
+        rmap->base = (height - 1) * rowbytes;
+        rmap->step_r = pixbytes;
+        rmap->step_c = -rowbytes;
+        break;
+    case 180:
+        rmap->base = (height - 1) * rowbytes + (width - 1) * pixbytes;
+        rmap->step_r = -rowbytes;
+        rmap->step_c = -pixbytes;
+        break;
+    case 270:
+        rmap->base = (width - 1) * pixbytes;
+        rmap->step_r = -pixbytes;
+        rmap->step_c = rowbytes;
+        break;
+    default:
+        rmap->base = 0;
+        rmap->step_r = rowbytes;
+        rmap->step_c = pixbytes;
+        break;
+    }
+    rmap->base += offset;
+}
+
+static void vid_rot_plane(unsigned char *dst, int out_w, int out_h, unsigned char *src
+            , struct vid_rot_map *rmap, long extra, vid_rot_line line)
+{
+    int tile_r, tile_c, row, row_max, count;
+
+    for (tile_r = 0; tile_r < out_h; tile_r += VID_ROT_TILE) {
+        row_max = (tile_r + VID_ROT_TILE < out_h) ? tile_r + VID_ROT_TILE : out_h;
+        for (tile_c = 0; tile_c < out_w; tile_c += VID_ROT_TILE) {
+            count = (out_w - tile_c < VID_ROT_TILE) ? out_w - tile_c : VID_ROT_TILE;
+            for (row = tile_r; row < row_max; row++) {
+                line(dst + (long)row * out_w + tile_c
+                    , src + rmap->base + row * rmap->step_r + tile_c * rmap->step_c
+                    , rmap->step_c, extra, count);
+            }
+        }
+    }
+}
+
+static void vid_rot_line_copy(unsigned char *dst, unsigned char *src, long step, long extra, int count)
+{
+    (void)extra;
+
+    while (count-- > 0) {
+        *dst++ = *src;
+        src += step;
+    }
+}
+
+/* Chroma of packed 4:2:2, averaging the sample with the one of the next line */
+static void vid_rot_line_avg(unsigned char *dst, unsigned char *src, long step, long extra, int count)
+{
+    while (count-- > 0) {
+        *dst++ = ((int) src[0] + (int) src[extra]) / 2;
+        src += step;
+    }
+}
+
+static void vid_rot_line_rgb_y(unsigned char *dst, unsigned char *src, long step, long extra, int count)
+{
+    (void)extra;
+
+    while (count-- > 0) {
+        *dst++ = (9796 * src[0] + 19235 * src[1] + 3736 * src[2]) >> 15;
+        src += step;
+    }
+}
+
+/* Chroma of a 2x2 block of RGB24 pixels, summed the way vid_rgb24toyuv420p does */
+#define VID_ROT_RGB_U(p) ((((-4784 * (p)[0] - 9437 * (p)[1] + 14221 * (p)[2]) >> 17) + 32))
+#define VID_ROT_RGB_V(p) ((((20218 * (p)[0] - 16941 * (p)[1] - 3277 * (p)[2]) >> 17) + 32))
+
+static void vid_rot_line_rgb_u(unsigned char *dst, unsigned char *src, long step, long extra, int count)
+{
+    while (count-- > 0) {
+        *dst++ = (unsigned char)(VID_ROT_RGB_U(src) + VID_ROT_RGB_U(src + 3) +
+            VID_ROT_RGB_U(src + extra) + VID_ROT_RGB_U(src + extra + 3));
+        src += step;
+    }
+}
+
+static void vid_rot_line_rgb_v(unsigned char *dst, unsigned char *src, long step, long extra, int count)
+{
+    while (count-- > 0) {
+        *dst++ = (unsigned char)(VID_ROT_RGB_V(src) + VID_ROT_RGB_V(src + 3) +
+            VID_ROT_RGB_V(src + extra) + VID_ROT_RGB_V(src + extra + 3));
+        src += step;
+    }
+}
+
+/* Output dimensions of a width x height capture rotated by deg */
+static void vid_rot_dims(int deg, int width, int height, int *out_w, int *out_h)
+{
+    if ((deg == 90) || (deg == 270)) {
+        *out_w = height;
+        *out_h = width;
+    } else {
+        *out_w = width;
+        *out_h = height;
+    }
+}
+
+/**
+ * vid_yuv422to420p_rot
+ *  Convert packed YUYV, or UYVY when uyvy is set, of the capture size
+ *  width x height into YUV420P rotated clockwise by deg.
+ */
+void vid_yuv422to420p_rot(unsigned char *map, unsigned char *cap_map, int width, int height
+            , int deg, int uyvy)
+{
+    struct vid_rot_map rmap;
+    int out_w, out_h, wh;
+
+    vid_rot_dims(deg, width, height, &out_w, &out_h);
+    wh = width * height;
+
+    vid_rot_setup(&rmap, deg, width, height, width * 2, 2, uyvy ? 1 : 0);
+    vid_rot_plane(map, out_w, out_h, cap_map, &rmap, 0, vid_rot_line_copy);
+
+    vid_rot_setup(&rmap, deg, width / 2, height / 2, width * 4, 4, uyvy ? 0 : 1);
+    vid_rot_plane(map + wh, out_w / 2, out_h / 2, cap_map, &rmap, width * 2, vid_rot_line_avg);
+
+    vid_rot_setup(&rmap, deg, width / 2, height / 2, width * 4, 4, uyvy ? 2 : 3);
+    vid_rot_plane(map + wh + wh / 4, out_w / 2, out_h / 2, cap_map, &rmap, width * 2, vid_rot_line_avg);
+}
+
+/**
+ * vid_yuv420p_rot
+ *  Copy a YUV420P capture of width x height rotated clockwise by deg.
+ */
+void vid_yuv420p_rot(unsigned char *map, unsigned char *cap_map, int width, int height, int deg)
+{
+    struct vid_rot_map rmap;
+    int out_w, out_h, wh;
+
+    vid_rot_dims(deg, width, height, &out_w, &out_h);
+    wh = width * height;
+
+    vid_rot_setup(&rmap, deg, width, height, width, 1, 0);
+    vid_rot_plane(map, out_w, out_h, cap_map, &rmap, 0, vid_rot_line_copy);
+
+    vid_rot_setup(&rmap, deg, width / 2, height / 2, width / 2, 1, wh);
+    vid_rot_plane(map + wh, out_w / 2, out_h / 2, cap_map, &rmap, 0, vid_rot_line_copy);
+
+    vid_rot_setup(&rmap, deg, width / 2, height / 2, width / 2, 1, wh + wh / 4);
+    vid_rot_plane(map + wh + wh / 4, out_w / 2, out_h / 2, cap_map, &rmap, 0, vid_rot_line_copy);
+}
+
+/**
+ * vid_rgb24toyuv420p_rot
+ *  Convert RGB24 of width x height into YUV420P rotated clockwise by deg.
+ */
+void vid_rgb24toyuv420p_rot(unsigned char *map, unsigned char *cap_map, int width, int height, int deg)
+{
+    struct vid_rot_map rmap;
+    int out_w, out_h, wh;
+
+    vid_rot_dims(deg, width, height, &out_w, &out_h);
+    wh = width * height;
+
+    vid_rot_setup(&rmap, deg, width, height, width * 3, 3, 0);
+    vid_rot_plane(map, out_w, out_h, cap_map, &rmap, 0, vid_rot_line_rgb_y);
+
+    vid_rot_setup(&rmap, deg, width / 2, height / 2, width * 6, 6, 0);
+    vid_rot_plane(map + wh, out_w / 2, out_h / 2, cap_map, &rmap, width * 3, vid_rot_line_rgb_u);
+    vid_rot_plane(map + wh + wh / 4, out_w / 2, out_h / 2, cap_map, &rmap, width * 3, vid_rot_line_rgb_v);
+}
+
+/**
+ * vid_greytoyuv420p_rot
+ *  Convert a grey capture of width x height into YUV420P rotated clockwise by deg.
+ */
+void vid_greytoyuv420p_rot(unsigned char *map, unsigned char *cap_map, int width, int height, int deg)
+{
+    struct vid_rot_map rmap;
+    int out_w, out_h;
+
+    vid_rot_dims(deg, width, height, &out_w, &out_h);
+
+    vid_rot_setup(&rmap, deg, width, height, width, 1, 0);
+    vid_rot_plane(map, out_w, out_h, cap_map, &rmap, 0, vid_rot_line_copy);
+    memset(map + (width * height), 128, (width * height) / 2);
+}
+
 /* vid_parms_parse
  * Parse the video_params into an array.
 */
@@ -521,6 +587,7 @@ void vid_parms_parse(struct context *cnt)
     util_parms_add_default(cnt->vdev,"input","-1");
     util_parms_add_default(cnt->vdev,"norm","0");
     util_parms_add_default(cnt->vdev,"frequency","0");
+    util_parms_add_default(cnt->vdev,"userptr","0");
 
     for (indx = 0; indx < cnt->vdev->params_count; indx++) {
         if (mystreq(cnt->vdev->params_array[indx].param_name, "input")) {
@@ -564,6 +631,12 @@ void vid_close(struct context *cnt)
         }
     #endif
 
+    if (cnt->camera_type == CAMERA_TYPE_SYNTH) {
+        MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO,_("Cleaning up synthetic camera"));
+        synth_cleanup(cnt);
+        return;
+    }
+
     if (cnt->netcam) {
         MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO,_("calling netcam_cleanup"));
         netcam_cleanup(cnt->netcam, 0);
@@ -590,7 +663,7 @@ void vid_close(struct context *cnt)
         return;
     }
 
-    MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO,_("No Camera device cleanup (MMAL, Netcam, V4L2, BKTR)"));
+    MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO,_("No Camera device cleanup (MMAL, Netcam, V4L2, BKTR, synthetic)"));
     return;
 
 }
@@ -617,7 +690,140 @@ void vid_close(struct context *cnt)
  *     -1 if failed to open device.
  *     -3 image dimensions are not modulo 8
  */
-int vid_start(struct context *cnt)
+/**
+ * vid_capture_image
+ *  Return the image a camera backend captures into.  This is the high
+ *  resolution image when the detection uses a reduced copy (detect_scale).
+ */
+unsigned char *vid_capture_image(struct context *cnt, struct image_data *img_data)
+{
+    if (cnt->imgs.detect_scale > 1) {
+        return img_data->image_high;
+    }
+    return img_data->image_norm;
+}
+
+/** vid_capture_size
+ *  Number of bytes of the image returned by vid_capture_image.
+ */
+int vid_capture_size(struct context *cnt)
+{
+    if (cnt->imgs.detect_scale > 1) {
+        return cnt->imgs.size_high;
+    }
+    return cnt->imgs.size_norm;
+}
+
+/**
+ * vid_detect_scale
+ *  Apply detect_scale once the backend has set the capture size.  The captured
+ *  image becomes the high resolution image and the normal image, which is
+ *  used for the detection, is reduced by detect_scale in each direction.
+ *  A backend which can deliver the reduced image itself calls this from its
+ *  start to learn the size and then sets detect_camera.
+ */
+void vid_detect_scale(struct context *cnt)
+{
+    int scale, width, height;
+
+    scale = cnt->conf.detect_scale;
+    if (scale <= 1) {
+        return;
+    }
+
+    if ((scale != 2) && (scale != 4)) {
+        MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+            ,_("Invalid detect_scale %d, detecting on the captured image"), scale);
+        return;
+    }
+
+    if ((cnt->camera_type == CAMERA_TYPE_RTSP) || (cnt->imgs.width_high > 0)) {
+        MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+            ,_("detect_scale is not used when the camera provides a high resolution image"));
+        return;
+    }
+
+    width = cnt->imgs.width / scale;
+    height = cnt->imgs.height / scale;
+    if ((width % 8) || (height % 8) || (width < 64) || (height < 64)) {
+        MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+            ,_("detect_scale %d gives %dx%d which is not a multiple of 8 of at least 64")
+            ,scale, width, height);
+        return;
+    }
+
+    cnt->imgs.width_high = cnt->imgs.width;
+    cnt->imgs.height_high = cnt->imgs.height;
+    cnt->imgs.size_high = (cnt->imgs.width_high * cnt->imgs.height_high * 3) / 2;
+
+    cnt->imgs.width = width;
+    cnt->imgs.height = height;
+    cnt->imgs.motionsize = width * height;
+    cnt->imgs.size_norm = (width * height * 3) / 2;
+    cnt->imgs.detect_scale = scale;
+
+    MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+        ,_("Detecting motion on %dx%d of the %dx%d captured image")
+        ,width, height, cnt->imgs.width_high, cnt->imgs.height_high);
+}
+
+/**
+ * vid_scale_plane
+ *  Reduce one plane to width x height by averaging blocks of scale x scale
+ *  pixels.  The source plane is scale times the width and height.
+ */
+static void vid_scale_plane(unsigned char *dst, unsigned char *src, int width, int height, int scale)
+{
+    int x, y, dx, dy, sum, shift, half, src_w;
+    unsigned char *row;
+
+    shift = (scale == 4) ? 4 : 2;
+    half = 1 << (shift - 1);
+    src_w = width * scale;
+
+    for (y = 0; y < height; y++) {
+        row = src + (long)y * scale * src_w;
+        for (x = 0; x < width; x++) {
+            sum = 0;
+            for (dy = 0; dy < scale; dy++) {
+                for (dx = 0; dx < scale; dx++) {
+                    sum += row[dy * src_w + dx];
+                }
+            }
+            *dst++ = (unsigned char)((sum + half) >> shift);
+            row += scale;
+        }
+    }
+}
+
+/**
+ * vid_scale_image
+ *  Make the normal image used by the detection from the captured (and
+ *  already rotated) high resolution image.
+ */
+static void vid_scale_image(struct context *cnt, struct image_data *img_data)
+{
+    int width, height, scale;
+    unsigned char *dst, *src;
+
+    width = cnt->imgs.width;
+    height = cnt->imgs.height;
+    scale = cnt->imgs.detect_scale;
+    dst = img_data->image_norm;
+    src = img_data->image_high;
+
+    vid_scale_plane(dst, src, width, height, scale);
+    dst += width * height;
+    src += cnt->imgs.width_high * cnt->imgs.height_high;
+
+    vid_scale_plane(dst, src, width / 2, height / 2, scale);
+    dst += (width * height) / 4;
+    src += (cnt->imgs.width_high * cnt->imgs.height_high) / 4;
+
+    vid_scale_plane(dst, src, width / 2, height / 2, scale);
+}
+
+static int vid_start_dev(struct context *cnt)
 {
     int dev = -1;
 
@@ -634,6 +840,15 @@ int vid_start(struct context *cnt)
         }
     #endif
 
+    if (cnt->camera_type == CAMERA_TYPE_SYNTH) {
+        MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO,_("Opening synthetic camera"));
+        dev = synth_start(cnt);
+        if (dev < 0) {
+            MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO,_("Synthetic camera failed to open"));
+        }
+        return dev;
+    }
+
     if (cnt->camera_type == CAMERA_TYPE_NETCAM) {
         MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO,_("Opening Netcam"));
         dev = netcam_start(cnt);
@@ -674,32 +889,32 @@ int vid_start(struct context *cnt)
     }
 
     MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO
-        ,_("No Camera device specified (MMAL, Netcam, V4L2, BKTR)"));
+        ,_("No Camera device specified (MMAL, Netcam, V4L2, BKTR, synthetic)"));
     return dev;
 
 }
 
-/**
- * vid_next
- *
- * vid_next fetches a video frame from a either v4l device or netcam
- *
- * Parameters:
- *     cnt        Pointer to the context for this thread
- *     map        Pointer to the buffer in which the function puts the new image
- *
- * Global variable
- *     viddevs    The viddevs struct is "global" within the context of video.c
- *                and used in functions vid_*.
- * Returns
- *     0                        Success
- *    -1                        Fatal V4L error
- *    -2                        Fatal Netcam error
- *    Positive numbers...
- *    with bit 0 set            Non fatal V4L error (copy grey image and discard this image)
- *    with bit 1 set            Non fatal Netcam error
- */
-int vid_next(struct context *cnt, struct image_data *img_data)
+int vid_start(struct context *cnt)
+{
+    int dev;
+
+    /* The high resolution image of detect_scale is set again for the new capture size */
+    if (cnt->imgs.detect_scale > 1) {
+        cnt->imgs.width_high = 0;
+        cnt->imgs.height_high = 0;
+    }
+    cnt->imgs.detect_scale = 1;
+    cnt->imgs.detect_camera = FALSE;
+
+    dev = vid_start_dev(cnt);
+    if ((dev >= 0) && (cnt->imgs.detect_scale == 1)) {
+        vid_detect_scale(cnt);
+    }
+
+    return dev;
+}
+
+static int vid_next_dev(struct context *cnt, struct image_data *img_data)
 {
 
     #ifdef HAVE_MMAL
@@ -711,6 +926,10 @@ int vid_next(struct context *cnt, struct image_data *img_data)
         }
     #endif
 
+    if (cnt->camera_type == CAMERA_TYPE_SYNTH) {
+        return synth_next(cnt, img_data);
+    }
+
     if (cnt->camera_type == CAMERA_TYPE_NETCAM) {
         if (cnt->video_dev == -1) {
             return NETCAM_GENERAL_ERROR;
@@ -737,3 +956,35 @@ int vid_next(struct context *cnt, struct image_data *img_data)
 
     return -2;
 }
+
+/**
+ * vid_next
+ *
+ * vid_next fetches a video frame from a either v4l device or netcam
+ *
+ * Parameters:
+ *     cnt        Pointer to the context for this thread
+ *     map        Pointer to the buffer in which the function puts the new image
+ *
+ * Global variable
+ *     viddevs    The viddevs struct is "global" within the context of video.c
+ *                and used in functions vid_*.
+ * Returns
+ *     0                        Success
+ *    -1                        Fatal V4L error
+ *    -2                        Fatal Netcam error
+ *    Positive numbers...
+ *    with bit 0 set            Non fatal V4L error (copy grey image and discard this image)
+ *    with bit 1 set            Non fatal Netcam error
+ */
+int vid_next(struct context *cnt, struct image_data *img_data)
+{
+    int retcd;
+
+    retcd = vid_next_dev(cnt, img_data);
+    if ((retcd == 0) && (cnt->imgs.detect_scale > 1) && !cnt->imgs.detect_camera) {
+        vid_scale_image(cnt, img_data);
+    }
+
+    return retcd;
+}
@@ -72,6 +72,9 @@ struct video_dev {
 
 int vid_start(struct context *cnt);
 int vid_next(struct context *cnt, struct image_data *img_data);
+unsigned char *vid_capture_image(struct context *cnt, struct image_data *img_data);
+int vid_capture_size(struct context *cnt);
+void vid_detect_scale(struct context *cnt);
 void vid_close(struct context *cnt);
 void vid_mutex_destroy(void);
 void vid_mutex_init(void);
@@ -85,6 +88,11 @@ void vid_rgb24toyuv420p(unsigned char *map, unsigned char *cap_map, int width, i
 void vid_bayer2rgb24(unsigned char *dst, unsigned char *src, long int width, long int height);
 void vid_y10torgb24(unsigned char *map, unsigned char *cap_map, int width, int height, int shift);
 void vid_greytoyuv420p(unsigned char *map, unsigned char *cap_map, int width, int height);
+void vid_yuv422to420p_rot(unsigned char *map, unsigned char *cap_map, int width, int height
+            , int deg, int uyvy);
+void vid_yuv420p_rot(unsigned char *map, unsigned char *cap_map, int width, int height, int deg);
+void vid_rgb24toyuv420p_rot(unsigned char *map, unsigned char *cap_map, int width, int height, int deg);
+void vid_greytoyuv420p_rot(unsigned char *map, unsigned char *cap_map, int width, int height, int deg);
 int vid_sonix_decompress(unsigned char *outp, unsigned char *inp, int width, int height);
 int vid_mjpegtoyuv420p(unsigned char *map, unsigned char *cap_map, int width, int height, unsigned int size);
 
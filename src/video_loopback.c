@@ -32,8 +32,23 @@
 #include "video_loopback.h"
 #include <dirent.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <linux/videodev2.h>
 
+#define VLP_BUFFERS_MAX     32      /* Most streaming buffers requested of a pipe */
+
+/* The streaming output buffers of a pipe used instead of write */
+struct vlp_mmap {
+    int             buf_type;       /* V4L2_BUF_TYPE_VIDEO_OUTPUT or its _MPLANE variant */
+    int             buf_count;
+    void          **buf_start;      /* Mapped buffers of the device */
+    size_t         *buf_length;
+    int             buf_unused;     /* Buffers from this one on were never queued */
+    int             buf_spare;      /* Dequeued buffer that failed to queue, -1 for none */
+    int             streaming;
+    long            dropped;        /* Frames dropped while the consumer held all buffers */
+};
+
 static int vlp_open_vidpipe(void)
 {
     int pipe_fd = -1;
@@ -161,6 +176,20 @@ static void vlp_show_vcap(struct v4l2_capability *cap)
 
 static void vlp_show_vfmt(struct v4l2_format *v)
 {
+    if (v->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
+        MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO, "type: type:              %d",v->type);
+        MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO, "fmt.pix_mp.width:        %d",v->fmt.pix_mp.width);
+        MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO, "fmt.pix_mp.height:       %d",v->fmt.pix_mp.height);
+        MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO, "fmt.pix_mp.pixelformat:  %d",v->fmt.pix_mp.pixelformat);
+        MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO, "fmt.pix_mp.num_planes:   %d",v->fmt.pix_mp.num_planes);
+        MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO, "plane_fmt[0].sizeimage:  %d",v->fmt.pix_mp.plane_fmt[0].sizeimage);
+        MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO, "fmt.pix_mp.field:        %d",v->fmt.pix_mp.field);
+        MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO, "plane_fmt[0].bytesperline: %d",v->fmt.pix_mp.plane_fmt[0].bytesperline);
+        MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO, "fmt.pix_mp.colorspace:   %d",v->fmt.pix_mp.colorspace);
+        MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO, "------------------------");
+        return;
+    }
+
     MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO, "type: type:           %d",v->type);
     MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO, "fmt.pix.width:        %d",v->fmt.pix.width);
     MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO, "fmt.pix.height:       %d",v->fmt.pix.height);
@@ -172,11 +201,139 @@ static void vlp_show_vfmt(struct v4l2_format *v)
     MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO, "------------------------");
 }
 
-int vlp_startpipe(const char *dev_name, int width, int height)
+/**
+ * vlp_mmap_free
+ *      Stop the streaming of a pipe and release its buffers.
+ */
+static void vlp_mmap_free(int dev, struct vlp_mmap *vmap)
+{
+    struct v4l2_requestbuffers req;
+    int type, indx;
+
+    if (vmap->streaming) {
+        type = vmap->buf_type;
+        if (ioctl(dev, VIDIOC_STREAMOFF, &type) == -1) {
+            MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO, "ioctl (VIDIOC_STREAMOFF)");
+        }
+    }
+
+    for (indx = 0; indx < vmap->buf_count; indx++) {
+        if (vmap->buf_start[indx] != NULL) {
+            munmap(vmap->buf_start[indx], vmap->buf_length[indx]);
+        }
+    }
+
+    /* Give the buffers back so the device may be written to again. */
+    memset(&req, 0, sizeof(req));
+    req.count = 0;
+    req.type = vmap->buf_type;
+    req.memory = V4L2_MEMORY_MMAP;
+    ioctl(dev, VIDIOC_REQBUFS, &req);
+
+    free(vmap->buf_start);
+    free(vmap->buf_length);
+    free(vmap);
+}
+
+/**
+ * vlp_mmap_start
+ *      Request and map the streaming output buffers of a pipe and make the
+ *      device non-blocking so a slow consumer only costs dropped frames.
+ *      Returns NULL when the device can not stream.
+ */
+static struct vlp_mmap *vlp_mmap_start(int dev, int buf_type, int buffers)
+{
+    struct v4l2_requestbuffers req;
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+    struct vlp_mmap *vmap;
+    unsigned int offset;
+    int indx, flags;
+
+    memset(&req, 0, sizeof(req));
+    req.count = buffers;
+    req.type = buf_type;
+    req.memory = V4L2_MEMORY_MMAP;
+
+    if (ioctl(dev, VIDIOC_REQBUFS, &req) == -1) {
+        MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO, "ioctl (VIDIOC_REQBUFS)");
+        return NULL;
+    }
+
+    if (req.count < 1) {
+        MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO,_("No streaming buffers granted by the pipe"));
+        return NULL;
+    }
+
+    vmap = mymalloc(sizeof(struct vlp_mmap));
+    vmap->buf_type = buf_type;
+    vmap->buf_count = req.count;
+    vmap->buf_start = mymalloc(req.count * sizeof(void *));
+    vmap->buf_length = mymalloc(req.count * sizeof(size_t));
+    vmap->buf_unused = 0;
+    vmap->buf_spare = -1;
+    vmap->streaming = FALSE;
+    vmap->dropped = 0;
+
+    for (indx = 0; indx < vmap->buf_count; indx++) {
+        memset(&buf, 0, sizeof(buf));
+        memset(&plane, 0, sizeof(plane));
+        buf.type = buf_type;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = indx;
+        if (buf_type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
+            buf.m.planes = &plane;
+            buf.length = 1;
+        }
+
+        if (ioctl(dev, VIDIOC_QUERYBUF, &buf) == -1) {
+            MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO, "ioctl (VIDIOC_QUERYBUF)");
+            vlp_mmap_free(dev, vmap);
+            return NULL;
+        }
+
+        if (buf_type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
+            vmap->buf_length[indx] = plane.length;
+            offset = plane.m.mem_offset;
+        } else {
+            vmap->buf_length[indx] = buf.length;
+            offset = buf.m.offset;
+        }
+
+        vmap->buf_start[indx] = mmap(NULL, vmap->buf_length[indx]
+            , PROT_READ | PROT_WRITE, MAP_SHARED, dev, offset);
+        if (vmap->buf_start[indx] == MAP_FAILED) {
+            MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO,_("Failed to map buffer %d of the pipe"), indx);
+            vmap->buf_start[indx] = NULL;
+            vlp_mmap_free(dev, vmap);
+            return NULL;
+        }
+    }
+
+    flags = fcntl(dev, F_GETFL);
+    if ((flags == -1) || (fcntl(dev, F_SETFL, flags | O_NONBLOCK) == -1)) {
+        MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO,_("Failed to make the pipe non-blocking"));
+        vlp_mmap_free(dev, vmap);
+        return NULL;
+    }
+
+    MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+        ,_("Streaming to the pipe with %d mapped %s buffers")
+        , vmap->buf_count
+        , (buf_type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) ? "multi-planar":"single-planar");
+
+    return vmap;
+}
+
+int vlp_startpipe(const char *dev_name, int width, int height, int buffers, struct vlp_mmap **vmap)
 {
     int dev;
     struct v4l2_format v;
     struct v4l2_capability vc;
+    unsigned int caps;
+    int buf_type;
+
+    *vmap = NULL;
 
     if (mystreq(dev_name, "-")) {
         dev = vlp_open_vidpipe();
@@ -198,9 +355,21 @@ int vlp_startpipe(const char *dev_name, int width, int height)
 
     vlp_show_vcap(&vc);
 
+    /* Devices that only offer the multi-planar api get the image as one plane. */
+    if (vc.capabilities & V4L2_CAP_DEVICE_CAPS) {
+        caps = vc.device_caps;
+    } else {
+        caps = vc.capabilities;
+    }
+    if (!(caps & V4L2_CAP_VIDEO_OUTPUT) && (caps & V4L2_CAP_VIDEO_OUTPUT_MPLANE)) {
+        buf_type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    } else {
+        buf_type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    }
+
     memset(&v, 0, sizeof(v));
 
-    v.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    v.type = buf_type;
 
     if (ioctl(dev, VIDIOC_G_FMT, &v) == -1) {
         MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO, "ioctl (VIDIOC_G_FMT)");
@@ -209,14 +378,25 @@ int vlp_startpipe(const char *dev_name, int width, int height)
     MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO,_("Original pipe specifications"));
     vlp_show_vfmt(&v);
 
-    v.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    v.fmt.pix.width = width;
-    v.fmt.pix.height = height;
-    v.fmt.pix.pixelformat = V4L2_PIX_FMT_YUV420;
-    v.fmt.pix.sizeimage = 3 * width * height / 2;
-    v.fmt.pix.bytesperline = width;
-    v.fmt.pix.field = V4L2_FIELD_NONE;
-    v.fmt.pix.colorspace = V4L2_COLORSPACE_SRGB;
+    v.type = buf_type;
+    if (buf_type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
+        v.fmt.pix_mp.width = width;
+        v.fmt.pix_mp.height = height;
+        v.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_YUV420;
+        v.fmt.pix_mp.num_planes = 1;
+        v.fmt.pix_mp.plane_fmt[0].sizeimage = 3 * width * height / 2;
+        v.fmt.pix_mp.plane_fmt[0].bytesperline = width;
+        v.fmt.pix_mp.field = V4L2_FIELD_NONE;
+        v.fmt.pix_mp.colorspace = V4L2_COLORSPACE_SRGB;
+    } else {
+        v.fmt.pix.width = width;
+        v.fmt.pix.height = height;
+        v.fmt.pix.pixelformat = V4L2_PIX_FMT_YUV420;
+        v.fmt.pix.sizeimage = 3 * width * height / 2;
+        v.fmt.pix.bytesperline = width;
+        v.fmt.pix.field = V4L2_FIELD_NONE;
+        v.fmt.pix.colorspace = V4L2_COLORSPACE_SRGB;
+    }
     MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO,_("Proposed pipe specifications"));
     vlp_show_vfmt(&v);
 
@@ -228,12 +408,121 @@ int vlp_startpipe(const char *dev_name, int width, int height)
     MOTION_LOG(INF, TYPE_VIDEO, NO_ERRNO,_("Final pipe specifications"));
     vlp_show_vfmt(&v);
 
+    if (buffers > 0) {
+        if (!(caps & V4L2_CAP_STREAMING)) {
+            MOTION_LOG(WRN, TYPE_VIDEO, NO_ERRNO
+                ,_("Pipe can not stream, writing the images instead"));
+        } else {
+            if (buffers > VLP_BUFFERS_MAX) {
+                buffers = VLP_BUFFERS_MAX;
+            }
+            *vmap = vlp_mmap_start(dev, buf_type, buffers);
+            if (*vmap == NULL) {
+                MOTION_LOG(WRN, TYPE_VIDEO, NO_ERRNO
+                    ,_("Streaming to the pipe failed, writing the images instead"));
+            }
+        }
+    }
+
     return dev;
 }
 
-int vlp_putpipe(int dev, unsigned char *image, int imgsize)
+/**
+ * vlp_putpipe
+ *      Give the image to the pipe.  With streaming buffers the image goes into
+ *      a free buffer which is then queued; when the consumer holds all of them
+ *      the image is dropped instead of waiting.
+ *      Returns -1 on error with errno set, otherwise the bytes given.
+ */
+int vlp_putpipe(int dev, struct vlp_mmap *vmap, unsigned char *image, int imgsize, struct timeval *tv1)
 {
-    return write(dev, image, imgsize);
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+    int indx, type;
+
+    if (vmap == NULL) {
+        return write(dev, image, imgsize);
+    }
+
+    memset(&buf, 0, sizeof(buf));
+    memset(&plane, 0, sizeof(plane));
+    buf.type = vmap->buf_type;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (vmap->buf_type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
+        buf.m.planes = &plane;
+        buf.length = 1;
+    }
+
+    if (vmap->buf_spare >= 0) {
+        indx = vmap->buf_spare;
+        vmap->buf_spare = -1;
+    } else if (vmap->buf_unused < vmap->buf_count) {
+        indx = vmap->buf_unused++;
+    } else {
+        if (ioctl(dev, VIDIOC_DQBUF, &buf) == -1) {
+            if (errno != EAGAIN) {
+                return -1;
+            }
+            if (vmap->dropped++ == 0) {
+                MOTION_LOG(WRN, TYPE_VIDEO, NO_ERRNO
+                    ,_("Pipe consumer too slow, dropping images"));
+            }
+            return 0;
+        }
+        indx = buf.index;
+    }
+
+    if ((size_t)imgsize > vmap->buf_length[indx]) {
+        imgsize = vmap->buf_length[indx];
+    }
+    memcpy(vmap->buf_start[indx], image, imgsize);
+
+    buf.index = indx;
+    buf.field = V4L2_FIELD_NONE;
+    buf.flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
+    buf.timestamp = *tv1;
+    if (vmap->buf_type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
+        plane.bytesused = imgsize;
+        plane.length = vmap->buf_length[indx];
+    } else {
+        buf.bytesused = imgsize;
+    }
+
+    if (ioctl(dev, VIDIOC_QBUF, &buf) == -1) {
+        vmap->buf_spare = indx;
+        return -1;
+    }
+
+    if (!vmap->streaming) {
+        type = vmap->buf_type;
+        if (ioctl(dev, VIDIOC_STREAMON, &type) == -1) {
+            return -1;
+        }
+        vmap->streaming = TRUE;
+    }
+
+    return imgsize;
+}
+
+/**
+ * vlp_stoppipe
+ *      Release the streaming buffers of the pipe and close it.
+ */
+void vlp_stoppipe(int *dev, struct vlp_mmap **vmap)
+{
+    if (*vmap != NULL) {
+        if ((*vmap)->dropped > 0) {
+            MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+                ,_("Pipe dropped %ld images for a slow consumer"), (*vmap)->dropped);
+        }
+        vlp_mmap_free(*dev, *vmap);
+        *vmap = NULL;
+    }
+
+    if (*dev != -1) {
+        close(*dev);
+        *dev = -1;
+    }
 }
 
 
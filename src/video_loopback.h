@@ -24,7 +24,10 @@
 #ifndef _INCLUDE_VIDEO_LOOPBACK_H
 #define _INCLUDE_VIDEO_LOOPBACK_H
 
-int vlp_startpipe(const char *dev_name, int width, int height);
-int vlp_putpipe(int dev, unsigned char *image, int imgsize);
+struct vlp_mmap;
+
+int vlp_startpipe(const char *dev_name, int width, int height, int buffers, struct vlp_mmap **vmap);
+int vlp_putpipe(int dev, struct vlp_mmap *vmap, unsigned char *image, int imgsize, struct timeval *tv1);
+void vlp_stoppipe(int *dev, struct vlp_mmap **vmap);
 
 #endif
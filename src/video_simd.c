@@ -0,0 +1,734 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*    video_simd.c
+ *
+ *    Vectorized versions of the pixel format converters in video_common.c.
+ *    As in alg_simd.c the implementation is selected once at startup based
+ *    upon the capabilities of the cpu and every kernel must produce exactly
+ *    the same image as the scalar version.
+ *
+ */
+
+#include "translate.h"
+#include "motion.h"
+#include "logger.h"
+#include "video_simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define HAVE_SIMD_X86
+    #include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+    #define HAVE_SIMD_NEON
+    #include <arm_neon.h>
+#endif
+
+/*
+ * Scalar reference versions.  These are the converters as they were in
+ * video_common.c and are used when the cpu has no vector unit we support.
+ */
+
+static void vid_simd_yuyv_c(unsigned char *map, unsigned char *cap_map, int width, int height)
+{
+    unsigned char *src, *dest, *src2, *dest2;
+    int i, j;
+
+    /* Create the Y plane. */
+    src = cap_map;
+    dest = map;
+    for (i = width * height; i > 0; i--) {
+        *dest++ = *src;
+        src += 2;
+    }
+    /* Create U and V planes. */
+    src = cap_map + 1;
+    src2 = cap_map + width * 2 + 1;
+    dest = map + width * height;
+    dest2 = dest + (width * height) / 4;
+    for (i = height / 2; i > 0; i--) {
+        for (j = width / 2; j > 0; j--) {
+            *dest = ((int) *src + (int) *src2) / 2;
+            src += 2;
+            src2 += 2;
+            dest++;
+            *dest2 = ((int) *src + (int) *src2) / 2;
+            src += 2;
+            src2 += 2;
+            dest2++;
+        }
+        src += width * 2;
+        src2 += width * 2;
+    }
+}
+
+static void vid_simd_yuv422p_c(unsigned char *map, unsigned char *cap_map, int width, int height)
+{
+    unsigned char *src, *dest, *dest2;
+    unsigned char *src_u, *src_u2, *src_v, *src_v2;
+
+    int i, j;
+    /*Planar version of 422 */
+    /* Create the Y plane. */
+    src = cap_map;
+    dest = map;
+    for (i = width * height; i > 0; i--) {
+        *dest++ = *src++;
+    }
+
+    /* Create U and V planes. */
+    dest = map + width * height;
+    dest2 = dest + (width * height) / 4;
+    for (i = 0; i< (height / 2); i++) {
+        src_u = cap_map + (width * height) + ((i*2) * (width/2));
+        src_u2 = src_u  + (width/2);
+        src_v = src_u + (width/2 * height);
+        src_v2 = src_v  + (width/2);
+
+        for (j = 0; j < (width / 2); j++) {
+            *dest = ((int) *src_u + (int) *src_u2) / 2;
+            src_u ++;
+            src_u2++;
+            dest++;
+
+            *dest2 = ((int) *src_v + (int) *src_v2) / 2;
+            src_v ++;
+            src_v2++;
+            dest2++;
+        }
+    }
+}
+
+static void vid_simd_uyvy_c(unsigned char *map, unsigned char *cap_map, int width, int height)
+{
+    uint8_t *pY = map;
+    uint8_t *pU = pY + (width * height);
+    uint8_t *pV = pU + (width * height) / 4;
+    uint32_t uv_offset = width * 2 * sizeof(uint8_t);
+    int ix, jx;
+
+    for (ix = 0; ix < height; ix++) {
+        for (jx = 0; jx < width; jx += 2) {
+            uint16_t calc;
+
+            if ((ix&1) == 0) {
+                calc = *cap_map;
+                calc += *(cap_map + uv_offset);
+                calc /= 2;
+                *pU++ = (uint8_t) calc;
+            }
+
+            cap_map++;
+            *pY++ = *cap_map++;
+
+            if ((ix&1) == 0) {
+                calc = *cap_map;
+                calc += *(cap_map + uv_offset);
+                calc /= 2;
+                *pV++ = (uint8_t) calc;
+            }
+
+            cap_map++;
+            *pY++ = *cap_map++;
+        }
+    }
+}
+
+
+static void vid_simd_rgb24_c(unsigned char *map, unsigned char *cap_map, int width, int height)
+{
+    unsigned char *y, *u, *v;
+    unsigned char *r, *g, *b;
+    int i, loop;
+
+    r = cap_map;
+    g = r + 1;
+    b = g + 1;
+
+    y = map;
+    u = y + width * height;
+    v = u + (width * height) / 4;
+    memset(u, 0, width * height / 4);
+    memset(v, 0, width * height / 4);
+
+    for (loop = 0; loop < height; loop++) {
+        for (i = 0; i < width; i += 2) {
+            *y++ = (9796 ** r + 19235 ** g + 3736 ** b) >> 15;
+            *u += ((-4784 ** r - 9437 ** g + 14221 ** b) >> 17) + 32;
+            *v += ((20218 ** r - 16941 ** g - 3277 ** b) >> 17) + 32;
+            r += 3;
+            g += 3;
+            b += 3;
+            *y++ = (9796 ** r + 19235 ** g + 3736 ** b) >> 15;
+            *u += ((-4784 ** r - 9437 ** g + 14221 ** b) >> 17) + 32;
+            *v += ((20218 ** r - 16941 ** g - 3277 ** b) >> 17) + 32;
+            r += 3;
+            g += 3;
+            b += 3;
+            u++;
+            v++;
+        }
+
+        if ((loop & 1) == 0) {
+            u -= width / 2;
+            v -= width / 2;
+        }
+    }
+}
+
+
+static void vid_simd_y10_c(unsigned char *map, unsigned char *cap_map, int width, int height, int shift)
+{
+    /* Source code: raw2rgbpnm project */
+    /* url: http://salottisipuli.retiisi.org.uk/cgi-bin/gitweb.cgi?p=~sailus/raw2rgbpnm.git;a=summary */
+
+    /* bpp - bits per pixel */
+    /* bpp: 'Pixels are stored in 16-bit words with unused high bits padded with 0' */
+    /* url: https://linuxtv.org/downloads/v4l-dvb-apis/V4L2-PIX-FMT-Y12.html */
+    /* url: https://linuxtv.org/downloads/v4l-dvb-apis/V4L2-PIX-FMT-Y10.html */
+
+    int src_size[2] = {width,height};
+    int bpp = 16;
+    unsigned int src_stride = (src_size[0] * bpp) / 8;
+    unsigned int rgb_stride = src_size[0] * 3;
+    int a = 0;
+    int src_x = 0, src_y = 0;
+    int dst_x = 0, dst_y = 0;
+
+    for (src_y = 0, dst_y = 0; dst_y < src_size[1]; src_y++, dst_y++) {
+        for (src_x = 0, dst_x = 0; dst_x < src_size[0]; src_x++, dst_x++) {
+            a = (cap_map[src_y*src_stride + src_x*2+0] |
+                (cap_map[src_y*src_stride + src_x*2+1] << 8)) >> shift;
+            map[dst_y*rgb_stride+3*dst_x+0] = a;
+            map[dst_y*rgb_stride+3*dst_x+1] = a;
+            map[dst_y*rgb_stride+3*dst_x+2] = a;
+        }
+    }
+}
+
+
+/*
+ * Scalar pieces used by the vector kernels for whatever is left after the
+ * last full vector of a row.
+ */
+
+/* Y of packed 4:2:2 where yoff is the offset of the Y byte in a pixel */
+static void vid_simd_packed_y_tail(unsigned char *dst, const unsigned char *src, int yoff, int count)
+{
+    int indx;
+
+    for (indx = 0; indx < count; indx++) {
+        dst[indx] = src[indx * 2 + yoff];
+    }
+}
+
+/* U and V of a line pair of packed 4:2:2 where uoff and voff are their offsets */
+static void vid_simd_packed_uv_tail(unsigned char *dstu, unsigned char *dstv
+            , const unsigned char *src, const unsigned char *src2, int uoff, int voff, int count)
+{
+    int indx;
+
+    for (indx = 0; indx < count; indx++) {
+        dstu[indx] = ((int) src[indx * 4 + uoff] + (int) src2[indx * 4 + uoff]) / 2;
+        dstv[indx] = ((int) src[indx * 4 + voff] + (int) src2[indx * 4 + voff]) / 2;
+    }
+}
+
+static void vid_simd_avg_tail(unsigned char *dst, const unsigned char *src
+            , const unsigned char *src2, int count)
+{
+    int indx;
+
+    for (indx = 0; indx < count; indx++) {
+        dst[indx] = ((int) src[indx] + (int) src2[indx]) / 2;
+    }
+}
+
+/* Convert pixels indx to width of a line pair of RGB24 the way vid_simd_rgb24_c does */
+static void vid_simd_rgb24_tail(unsigned char *y, unsigned char *y2, unsigned char *u
+            , unsigned char *v, const unsigned char *rgb, const unsigned char *rgb2
+            , int indx, int width)
+{
+    const unsigned char *p;
+    int row, i;
+
+    for (i = indx / 2; i < width / 2; i++) {
+        u[i] = 0;
+        v[i] = 0;
+    }
+    for (row = 0; row < 2; row++) {
+        for (i = indx; i < width; i++) {
+            p = (row ? rgb2 : rgb) + i * 3;
+            (row ? y2 : y)[i] = (9796 * p[0] + 19235 * p[1] + 3736 * p[2]) >> 15;
+            u[i / 2] += ((-4784 * p[0] - 9437 * p[1] + 14221 * p[2]) >> 17) + 32;
+            v[i / 2] += ((20218 * p[0] - 16941 * p[1] - 3277 * p[2]) >> 17) + 32;
+        }
+    }
+}
+
+static void vid_simd_y10_tail(unsigned char *map, const unsigned char *cap_map
+            , int shift, int indx, int count)
+{
+    int a;
+
+    for (; indx < count; indx++) {
+        a = (cap_map[indx * 2] | (cap_map[indx * 2 + 1] << 8)) >> shift;
+        map[indx * 3 + 0] = a;
+        map[indx * 3 + 1] = a;
+        map[indx * 3 + 2] = a;
+    }
+}
+
+#ifdef HAVE_SIMD_X86
+
+/*
+ * The 4:2:2 chroma is the truncated average (a + b) / 2.  pavgb rounds up
+ * so the low bit of a ^ b is taken off its result.
+ */
+__attribute__((target("sse2")))
+static inline __m128i vid_simd_avg_sse2(__m128i a, __m128i b)
+{
+    return _mm_sub_epi8(_mm_avg_epu8(a, b)
+        , _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+/*
+ * Packed 4:2:2 to YUV420P.  The byte offsets of Y, U and V in the 4 bytes
+ * of a pixel pair are 0/1/3 for YUYV and 1/0/2 for UYVY.
+ */
+__attribute__((target("sse2")))
+static void vid_simd_packed_sse2(unsigned char *map, unsigned char *cap_map
+            , int width, int height, int uyvy)
+{
+    const __m128i mask8 = _mm_set1_epi16(0x00ff);
+    const __m128i mask32 = _mm_set1_epi32(0x000000ff);
+    const int yoff = uyvy ? 1 : 0, uoff = uyvy ? 0 : 1, voff = uyvy ? 2 : 3;
+    const int ushift = uoff * 8, vshift = voff * 8;
+    unsigned char *dstu, *dstv, *src, *src2;
+    __m128i va, vb, vc, vd;
+    int wh, indx, row;
+
+    wh = width * height;
+
+    /* Y plane */
+    for (indx = 0; indx + 16 <= wh; indx += 16) {
+        va = _mm_loadu_si128((const __m128i *)(cap_map + indx * 2));
+        vb = _mm_loadu_si128((const __m128i *)(cap_map + indx * 2 + 16));
+        if (uyvy) {
+            va = _mm_srli_epi16(va, 8);
+            vb = _mm_srli_epi16(vb, 8);
+        } else {
+            va = _mm_and_si128(va, mask8);
+            vb = _mm_and_si128(vb, mask8);
+        }
+        _mm_storeu_si128((__m128i *)(map + indx), _mm_packus_epi16(va, vb));
+    }
+    vid_simd_packed_y_tail(map + indx, cap_map + indx * 2, yoff, wh - indx);
+
+    /* U and V planes from each pair of lines */
+    dstu = map + wh;
+    dstv = dstu + wh / 4;
+    for (row = 0; row < height / 2; row++) {
+        src = cap_map + row * width * 4;
+        src2 = src + width * 2;
+        for (indx = 0; indx + 8 <= width / 2; indx += 8) {
+            va = vid_simd_avg_sse2(_mm_loadu_si128((const __m128i *)(src + indx * 4))
+                , _mm_loadu_si128((const __m128i *)(src2 + indx * 4)));
+            vb = vid_simd_avg_sse2(_mm_loadu_si128((const __m128i *)(src + indx * 4 + 16))
+                , _mm_loadu_si128((const __m128i *)(src2 + indx * 4 + 16)));
+            vc = _mm_packs_epi32(
+                _mm_and_si128(_mm_srl_epi32(va, _mm_cvtsi32_si128(ushift)), mask32)
+                , _mm_and_si128(_mm_srl_epi32(vb, _mm_cvtsi32_si128(ushift)), mask32));
+            vd = _mm_packs_epi32(
+                _mm_and_si128(_mm_srl_epi32(va, _mm_cvtsi32_si128(vshift)), mask32)
+                , _mm_and_si128(_mm_srl_epi32(vb, _mm_cvtsi32_si128(vshift)), mask32));
+            _mm_storel_epi64((__m128i *)(dstu + indx), _mm_packus_epi16(vc, vc));
+            _mm_storel_epi64((__m128i *)(dstv + indx), _mm_packus_epi16(vd, vd));
+        }
+        vid_simd_packed_uv_tail(dstu + indx, dstv + indx, src + indx * 4, src2 + indx * 4
+            , uoff, voff, width / 2 - indx);
+        dstu += width / 2;
+        dstv += width / 2;
+    }
+}
+
+__attribute__((target("sse2")))
+static void vid_simd_yuyv_sse2(unsigned char *map, unsigned char *cap_map, int width, int height)
+{
+    vid_simd_packed_sse2(map, cap_map, width, height, FALSE);
+}
+
+__attribute__((target("sse2")))
+static void vid_simd_uyvy_sse2(unsigned char *map, unsigned char *cap_map, int width, int height)
+{
+    vid_simd_packed_sse2(map, cap_map, width, height, TRUE);
+}
+
+__attribute__((target("sse2")))
+static void vid_simd_yuv422p_sse2(unsigned char *map, unsigned char *cap_map, int width, int height)
+{
+    unsigned char *dst, *dst2, *src_u, *src_v;
+    int wh, w2, row, indx;
+
+    wh = width * height;
+    w2 = width / 2;
+
+    memcpy(map, cap_map, wh);
+
+    dst = map + wh;
+    dst2 = dst + wh / 4;
+    for (row = 0; row < height / 2; row++) {
+        src_u = cap_map + wh + (row * 2) * w2;
+        src_v = src_u + w2 * height;
+        for (indx = 0; indx + 16 <= w2; indx += 16) {
+            _mm_storeu_si128((__m128i *)(dst + indx), vid_simd_avg_sse2(
+                _mm_loadu_si128((const __m128i *)(src_u + indx))
+                , _mm_loadu_si128((const __m128i *)(src_u + w2 + indx))));
+            _mm_storeu_si128((__m128i *)(dst2 + indx), vid_simd_avg_sse2(
+                _mm_loadu_si128((const __m128i *)(src_v + indx))
+                , _mm_loadu_si128((const __m128i *)(src_v + w2 + indx))));
+        }
+        vid_simd_avg_tail(dst + indx, src_u + indx, src_u + w2 + indx, w2 - indx);
+        vid_simd_avg_tail(dst2 + indx, src_v + indx, src_v + w2 + indx, w2 - indx);
+        dst += w2;
+        dst2 += w2;
+    }
+}
+
+/*
+ * RGB24 to YUV420P.  Four pixels at a time are spread into 16 bit lanes
+ * as (r, g) and (b, 0) pairs so pmaddwd gives the same 32 bit sums the
+ * scalar code computes.  The scalar code adds the four chroma terms of a
+ * sample into an unsigned char, which can wrap for V, so the sums are
+ * truncated rather than saturated to 8 bits.
+ */
+__attribute__((target("ssse3")))
+static inline void vid_simd_rgb24_terms_ssse3(__m128i grp, __m128i *vy, __m128i *vu, __m128i *vv)
+{
+    const __m128i shuf_rg = _mm_setr_epi8(0, -1, 1, -1, 3, -1, 4, -1, 6, -1, 7, -1, 9, -1, 10, -1);
+    const __m128i shuf_b = _mm_setr_epi8(2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1);
+    const __m128i k32 = _mm_set1_epi32(32);
+    __m128i vrg, vb;
+
+    vrg = _mm_shuffle_epi8(grp, shuf_rg);
+    vb = _mm_shuffle_epi8(grp, shuf_b);
+
+    *vy = _mm_srai_epi32(_mm_add_epi32(
+        _mm_madd_epi16(vrg, _mm_set1_epi32((19235 << 16) | 9796))
+        , _mm_madd_epi16(vb, _mm_set1_epi32(3736))), 15);
+    *vu = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(
+        _mm_madd_epi16(vrg, _mm_set1_epi32((int)(((unsigned)(-9437 & 0xffff) << 16) | (-4784 & 0xffff))))
+        , _mm_madd_epi16(vb, _mm_set1_epi32(14221))), 17), k32);
+    *vv = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(
+        _mm_madd_epi16(vrg, _mm_set1_epi32((int)(((unsigned)(-16941 & 0xffff) << 16) | (20218 & 0xffff))))
+        , _mm_madd_epi16(vb, _mm_set1_epi32(-3277 & 0xffff))), 17), k32);
+}
+
+/* Convert 16 pixels of a line.  Returns Y in vy and the pair sums of U and V */
+__attribute__((target("ssse3")))
+static inline void vid_simd_rgb24_line_ssse3(const unsigned char *rgb, __m128i *vy
+            , __m128i *vu, __m128i *vv)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i v0, v1, v2, grp[4], ty[4], tu[4], tv[4];
+    int indx;
+
+    v0 = _mm_loadu_si128((const __m128i *)rgb);
+    v1 = _mm_loadu_si128((const __m128i *)(rgb + 16));
+    v2 = _mm_loadu_si128((const __m128i *)(rgb + 32));
+    grp[0] = v0;
+    grp[1] = _mm_alignr_epi8(v1, v0, 12);
+    grp[2] = _mm_alignr_epi8(v2, v1, 8);
+    grp[3] = _mm_srli_si128(v2, 4);
+
+    for (indx = 0; indx < 4; indx++) {
+        vid_simd_rgb24_terms_ssse3(grp[indx], &ty[indx], &tu[indx], &tv[indx]);
+    }
+
+    *vy = _mm_packus_epi16(_mm_packs_epi32(ty[0], ty[1]), _mm_packs_epi32(ty[2], ty[3]));
+    *vu = _mm_packs_epi32(_mm_madd_epi16(_mm_packs_epi32(tu[0], tu[1]), ones)
+        , _mm_madd_epi16(_mm_packs_epi32(tu[2], tu[3]), ones));
+    *vv = _mm_packs_epi32(_mm_madd_epi16(_mm_packs_epi32(tv[0], tv[1]), ones)
+        , _mm_madd_epi16(_mm_packs_epi32(tv[2], tv[3]), ones));
+}
+
+__attribute__((target("ssse3")))
+static void vid_simd_rgb24_ssse3(unsigned char *map, unsigned char *cap_map, int width, int height)
+{
+    const __m128i mask8 = _mm_set1_epi16(0x00ff);
+    unsigned char *y, *u, *v, *rgb;
+    __m128i vy, vu, vv, vy2, vu2, vv2;
+    int row, indx;
+
+    u = map + width * height;
+    v = u + (width * height) / 4;
+
+    for (row = 0; row < height; row += 2) {
+        y = map + row * width;
+        rgb = cap_map + row * width * 3;
+        for (indx = 0; indx + 16 <= width; indx += 16) {
+            vid_simd_rgb24_line_ssse3(rgb + indx * 3, &vy, &vu, &vv);
+            vid_simd_rgb24_line_ssse3(rgb + (width + indx) * 3, &vy2, &vu2, &vv2);
+            _mm_storeu_si128((__m128i *)(y + indx), vy);
+            _mm_storeu_si128((__m128i *)(y + width + indx), vy2);
+            vu = _mm_and_si128(_mm_add_epi16(vu, vu2), mask8);
+            vv = _mm_and_si128(_mm_add_epi16(vv, vv2), mask8);
+            _mm_storel_epi64((__m128i *)(u + indx / 2), _mm_packus_epi16(vu, vu));
+            _mm_storel_epi64((__m128i *)(v + indx / 2), _mm_packus_epi16(vv, vv));
+        }
+        vid_simd_rgb24_tail(y, y + width, u, v, rgb, rgb + width * 3, indx, width);
+        u += width / 2;
+        v += width / 2;
+    }
+}
+
+__attribute__((target("ssse3")))
+static void vid_simd_y10_ssse3(unsigned char *map, unsigned char *cap_map, int width, int height, int shift)
+{
+    const __m128i shuf0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i shuf1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+    const __m128i shuf2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+    const __m128i mask8 = _mm_set1_epi16(0x00ff);
+    const __m128i vshift = _mm_cvtsi32_si128(shift);
+    __m128i va, vb, vgrey;
+    int indx, count;
+
+    count = width * height;
+    for (indx = 0; indx + 16 <= count; indx += 16) {
+        va = _mm_srl_epi16(_mm_loadu_si128((const __m128i *)(cap_map + indx * 2)), vshift);
+        vb = _mm_srl_epi16(_mm_loadu_si128((const __m128i *)(cap_map + indx * 2 + 16)), vshift);
+        vgrey = _mm_packus_epi16(_mm_and_si128(va, mask8), _mm_and_si128(vb, mask8));
+        _mm_storeu_si128((__m128i *)(map + indx * 3), _mm_shuffle_epi8(vgrey, shuf0));
+        _mm_storeu_si128((__m128i *)(map + indx * 3 + 16), _mm_shuffle_epi8(vgrey, shuf1));
+        _mm_storeu_si128((__m128i *)(map + indx * 3 + 32), _mm_shuffle_epi8(vgrey, shuf2));
+    }
+    vid_simd_y10_tail(map, cap_map, shift, indx, count);
+}
+
+#endif /* HAVE_SIMD_X86 */
+
+#ifdef HAVE_SIMD_NEON
+
+/* vhaddq_u8 is the truncated average (a + b) / 2 used for the 4:2:2 chroma */
+static void vid_simd_packed_neon(unsigned char *map, unsigned char *cap_map
+            , int width, int height, int uyvy)
+{
+    const int yoff = uyvy ? 1 : 0, uoff = uyvy ? 0 : 1, voff = uyvy ? 2 : 3;
+    unsigned char *dstu, *dstv, *src, *src2;
+    uint8x16x2_t vpix;
+    uint8x8x4_t va, vb;
+    int wh, indx, row;
+
+    wh = width * height;
+
+    for (indx = 0; indx + 16 <= wh; indx += 16) {
+        vpix = vld2q_u8(cap_map + indx * 2);
+        vst1q_u8(map + indx, vpix.val[yoff]);
+    }
+    vid_simd_packed_y_tail(map + indx, cap_map + indx * 2, yoff, wh - indx);
+
+    dstu = map + wh;
+    dstv = dstu + wh / 4;
+    for (row = 0; row < height / 2; row++) {
+        src = cap_map + row * width * 4;
+        src2 = src + width * 2;
+        for (indx = 0; indx + 8 <= width / 2; indx += 8) {
+            va = vld4_u8(src + indx * 4);
+            vb = vld4_u8(src2 + indx * 4);
+            vst1_u8(dstu + indx, vhadd_u8(va.val[uoff], vb.val[uoff]));
+            vst1_u8(dstv + indx, vhadd_u8(va.val[voff], vb.val[voff]));
+        }
+        vid_simd_packed_uv_tail(dstu + indx, dstv + indx, src + indx * 4, src2 + indx * 4
+            , uoff, voff, width / 2 - indx);
+        dstu += width / 2;
+        dstv += width / 2;
+    }
+}
+
+static void vid_simd_yuyv_neon(unsigned char *map, unsigned char *cap_map, int width, int height)
+{
+    vid_simd_packed_neon(map, cap_map, width, height, FALSE);
+}
+
+static void vid_simd_uyvy_neon(unsigned char *map, unsigned char *cap_map, int width, int height)
+{
+    vid_simd_packed_neon(map, cap_map, width, height, TRUE);
+}
+
+static void vid_simd_yuv422p_neon(unsigned char *map, unsigned char *cap_map, int width, int height)
+{
+    unsigned char *dst, *dst2, *src_u, *src_v;
+    int wh, w2, row, indx;
+
+    wh = width * height;
+    w2 = width / 2;
+
+    memcpy(map, cap_map, wh);
+
+    dst = map + wh;
+    dst2 = dst + wh / 4;
+    for (row = 0; row < height / 2; row++) {
+        src_u = cap_map + wh + (row * 2) * w2;
+        src_v = src_u + w2 * height;
+        for (indx = 0; indx + 16 <= w2; indx += 16) {
+            vst1q_u8(dst + indx, vhaddq_u8(vld1q_u8(src_u + indx), vld1q_u8(src_u + w2 + indx)));
+            vst1q_u8(dst2 + indx, vhaddq_u8(vld1q_u8(src_v + indx), vld1q_u8(src_v + w2 + indx)));
+        }
+        vid_simd_avg_tail(dst + indx, src_u + indx, src_u + w2 + indx, w2 - indx);
+        vid_simd_avg_tail(dst2 + indx, src_v + indx, src_v + w2 + indx, w2 - indx);
+        dst += w2;
+        dst2 += w2;
+    }
+}
+
+/* Y and the chroma term of four pixels, the same 32 bit sums as the scalar code */
+static inline int32x4_t vid_simd_rgb24_dot_neon(int16x4_t r, int16x4_t g, int16x4_t b
+            , int16_t kr, int16_t kg, int16_t kb)
+{
+    return vmlal_n_s16(vmlal_n_s16(vmull_n_s16(r, kr), g, kg), b, kb);
+}
+
+/* Convert 8 pixels of a line.  Returns Y in vy and the pair sums of U and V */
+static inline void vid_simd_rgb24_line_neon(const unsigned char *rgb, uint8x8_t *vy
+            , int16x4_t *vu, int16x4_t *vv)
+{
+    const int32x4_t k32 = vdupq_n_s32(32);
+    uint8x8x3_t vpix;
+    int16x8_t r, g, b;
+    int32x4_t ylo, yhi, ulo, uhi, vlo, vhi;
+
+    vpix = vld3_u8(rgb);
+    r = vreinterpretq_s16_u16(vmovl_u8(vpix.val[0]));
+    g = vreinterpretq_s16_u16(vmovl_u8(vpix.val[1]));
+    b = vreinterpretq_s16_u16(vmovl_u8(vpix.val[2]));
+
+    ylo = vshrq_n_s32(vid_simd_rgb24_dot_neon(vget_low_s16(r), vget_low_s16(g)
+        , vget_low_s16(b), 9796, 19235, 3736), 15);
+    yhi = vshrq_n_s32(vid_simd_rgb24_dot_neon(vget_high_s16(r), vget_high_s16(g)
+        , vget_high_s16(b), 9796, 19235, 3736), 15);
+    *vy = vqmovun_s16(vcombine_s16(vmovn_s32(ylo), vmovn_s32(yhi)));
+
+    ulo = vaddq_s32(vshrq_n_s32(vid_simd_rgb24_dot_neon(vget_low_s16(r), vget_low_s16(g)
+        , vget_low_s16(b), -4784, -9437, 14221), 17), k32);
+    uhi = vaddq_s32(vshrq_n_s32(vid_simd_rgb24_dot_neon(vget_high_s16(r), vget_high_s16(g)
+        , vget_high_s16(b), -4784, -9437, 14221), 17), k32);
+    *vu = vmovn_s32(vpaddlq_s16(vcombine_s16(vmovn_s32(ulo), vmovn_s32(uhi))));
+
+    vlo = vaddq_s32(vshrq_n_s32(vid_simd_rgb24_dot_neon(vget_low_s16(r), vget_low_s16(g)
+        , vget_low_s16(b), 20218, -16941, -3277), 17), k32);
+    vhi = vaddq_s32(vshrq_n_s32(vid_simd_rgb24_dot_neon(vget_high_s16(r), vget_high_s16(g)
+        , vget_high_s16(b), 20218, -16941, -3277), 17), k32);
+    *vv = vmovn_s32(vpaddlq_s16(vcombine_s16(vmovn_s32(vlo), vmovn_s32(vhi))));
+}
+
+static void vid_simd_rgb24_neon(unsigned char *map, unsigned char *cap_map, int width, int height)
+{
+    unsigned char *y, *u, *v, *rgb;
+    uint8x8_t vy, vy2;
+    int16x4_t vu, vv, vu2, vv2, vu3, vv3, vu4, vv4;
+    int row, indx;
+
+    u = map + width * height;
+    v = u + (width * height) / 4;
+
+    for (row = 0; row < height; row += 2) {
+        y = map + row * width;
+        rgb = cap_map + row * width * 3;
+        for (indx = 0; indx + 16 <= width; indx += 16) {
+            vid_simd_rgb24_line_neon(rgb + indx * 3, &vy, &vu, &vv);
+            vid_simd_rgb24_line_neon(rgb + (width + indx) * 3, &vy2, &vu2, &vv2);
+            vst1_u8(y + indx, vy);
+            vst1_u8(y + width + indx, vy2);
+            vid_simd_rgb24_line_neon(rgb + (indx + 8) * 3, &vy, &vu3, &vv3);
+            vid_simd_rgb24_line_neon(rgb + (width + indx + 8) * 3, &vy2, &vu4, &vv4);
+            vst1_u8(y + indx + 8, vy);
+            vst1_u8(y + width + indx + 8, vy2);
+            /* Truncate like the unsigned char sums of the scalar code */
+            vst1_u8(u + indx / 2, vmovn_u16(vreinterpretq_u16_s16(
+                vcombine_s16(vadd_s16(vu, vu2), vadd_s16(vu3, vu4)))));
+            vst1_u8(v + indx / 2, vmovn_u16(vreinterpretq_u16_s16(
+                vcombine_s16(vadd_s16(vv, vv2), vadd_s16(vv3, vv4)))));
+        }
+        vid_simd_rgb24_tail(y, y + width, u, v, rgb, rgb + width * 3, indx, width);
+        u += width / 2;
+        v += width / 2;
+    }
+}
+
+static void vid_simd_y10_neon(unsigned char *map, unsigned char *cap_map, int width, int height, int shift)
+{
+    const int16x8_t vshift = vdupq_n_s16((int16_t)-shift);
+    uint16x8_t va, vb;
+    uint8x16x3_t vrgb;
+    int indx, count;
+
+    count = width * height;
+    for (indx = 0; indx + 16 <= count; indx += 16) {
+        va = vshlq_u16(vreinterpretq_u16_u8(vld1q_u8(cap_map + indx * 2)), vshift);
+        vb = vshlq_u16(vreinterpretq_u16_u8(vld1q_u8(cap_map + indx * 2 + 16)), vshift);
+        vrgb.val[0] = vcombine_u8(vmovn_u16(va), vmovn_u16(vb));
+        vrgb.val[1] = vrgb.val[0];
+        vrgb.val[2] = vrgb.val[0];
+        vst3q_u8(map + indx * 3, vrgb);
+    }
+    vid_simd_y10_tail(map, cap_map, shift, indx, count);
+}
+
+#endif /* HAVE_SIMD_NEON */
+
+/*
+ * The converters in use.  Defaults to the scalar versions so that the
+ * vid functions are safe to call even before vid_simd_init.
+ */
+struct vid_simd_kernels vid_simd = {
+    "c",
+    vid_simd_yuyv_c,
+    vid_simd_yuv422p_c,
+    vid_simd_uyvy_c,
+    vid_simd_rgb24_c,
+    vid_simd_y10_c
+};
+
+/**
+ * vid_simd_init
+ *      Select the converters for the cpu we are running on.
+ */
+void vid_simd_init(void)
+{
+    #if defined(HAVE_SIMD_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2")) {
+            vid_simd.name = "sse2";
+            vid_simd.yuv422to420p = vid_simd_yuyv_sse2;
+            vid_simd.yuv422pto420p = vid_simd_yuv422p_sse2;
+            vid_simd.uyvyto420p = vid_simd_uyvy_sse2;
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+            vid_simd.name = "ssse3";
+            vid_simd.rgb24toyuv420p = vid_simd_rgb24_ssse3;
+            vid_simd.y10torgb24 = vid_simd_y10_ssse3;
+        }
+    #elif defined(HAVE_SIMD_NEON)
+        vid_simd.name = "neon";
+        vid_simd.yuv422to420p = vid_simd_yuyv_neon;
+        vid_simd.yuv422pto420p = vid_simd_yuv422p_neon;
+        vid_simd.uyvyto420p = vid_simd_uyvy_neon;
+        vid_simd.rgb24toyuv420p = vid_simd_rgb24_neon;
+        vid_simd.y10torgb24 = vid_simd_y10_neon;
+    #endif
+
+    MOTION_LOG(NTC, TYPE_ALL, NO_ERRNO
+        ,_("Using %s kernels for pixel format conversion"), vid_simd.name);
+}
@@ -0,0 +1,39 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  video_simd.h
+ *    Headers associated with the vectorized pixel format converters in video_simd.c
+ */
+
+#ifndef _INCLUDE_VIDEO_SIMD_H
+#define _INCLUDE_VIDEO_SIMD_H
+
+struct vid_simd_kernels {
+    const char  *name;
+    void        (*yuv422to420p)(unsigned char *map, unsigned char *cap_map, int width, int height);
+    void        (*yuv422pto420p)(unsigned char *map, unsigned char *cap_map, int width, int height);
+    void        (*uyvyto420p)(unsigned char *map, unsigned char *cap_map, int width, int height);
+    void        (*rgb24toyuv420p)(unsigned char *map, unsigned char *cap_map, int width, int height);
+    void        (*y10torgb24)(unsigned char *map, unsigned char *cap_map, int width, int height
+                    , int shift);
+};
+
+extern struct vid_simd_kernels vid_simd;
+
+void vid_simd_init(void);
+
+#endif /* _INCLUDE_VIDEO_SIMD_H */
@@ -0,0 +1,266 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *    video_synth.c
+ *
+ *    Synthetic camera for testing and sizing without camera devices.
+ *
+ *    When synth_camera is "pattern" the frames are generated from a fixed
+ *    background, otherwise synth_camera is a raw YUV420P clip of width x
+ *    height which is read frame by frame and looped.  A box moves across
+ *    the frames for the seconds given with synth_motion so the detection,
+ *    events and movies are exercised as with a real scene.
+ *
+ *    The frames are paced to framerate like a camera would deliver them.
+ *    The frames that were due while the camera was not read are lost and
+ *    counted as late.
+ *
+ */
+
+#include "translate.h"
+#include "motion.h"
+#include "util.h"
+#include "logger.h"
+#include "video_common.h"
+#include "video_synth.h"
+
+static long long synth_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((long long)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+/** synth_motion_parms
+ *  Read the on,off seconds of synth_motion.  A single 0 turns the box off.
+ */
+static void synth_motion_parms(struct context *cnt, struct synth_context *synth)
+{
+    synth->motion_on = 0;
+    synth->motion_off = 0;
+
+    if (cnt->conf.synth_motion == NULL) {
+        return;
+    }
+
+    if (sscanf(cnt->conf.synth_motion, "%d,%d", &synth->motion_on, &synth->motion_off) < 1) {
+        MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+            ,_("Invalid synth_motion %s, using no motion"), cnt->conf.synth_motion);
+        synth->motion_on = 0;
+    }
+    if (synth->motion_on < 0) {
+        synth->motion_on = 0;
+    }
+    if (synth->motion_off < 0) {
+        synth->motion_off = 0;
+    }
+}
+
+/** synth_pattern
+ *  Background of diagonal bands with some fixed detail so the detection
+ *  and the encoders get a frame that is not flat.
+ */
+static void synth_pattern(struct synth_context *synth)
+{
+    unsigned char *img;
+    int x, y;
+
+    synth->pattern = mymalloc(synth->size);
+    img = synth->pattern;
+
+    for (y = 0; y < synth->height; y++) {
+        for (x = 0; x < synth->width; x++) {
+            *img++ = (unsigned char)(64 + ((x + y) % 128) + (((x / 16) + (y / 16)) % 2) * 16);
+        }
+    }
+    memset(img, 128, synth->size - (synth->width * synth->height));
+}
+
+/** synth_box
+ *  Move the box one step and draw it into the luma plane.
+ */
+static void synth_box(struct synth_context *synth, unsigned char *img)
+{
+    int y;
+
+    synth->box_x += synth->box_dx;
+    synth->box_y += synth->box_dy;
+    if ((synth->box_x < 0) || (synth->box_x + synth->box_size > synth->width)) {
+        synth->box_dx = -synth->box_dx;
+        synth->box_x += 2 * synth->box_dx;
+    }
+    if ((synth->box_y < 0) || (synth->box_y + synth->box_size > synth->height)) {
+        synth->box_dy = -synth->box_dy;
+        synth->box_y += 2 * synth->box_dy;
+    }
+
+    for (y = synth->box_y; y < synth->box_y + synth->box_size; y++) {
+        memset(img + (y * synth->width) + synth->box_x, 235, synth->box_size);
+    }
+}
+
+/** synth_frame
+ *  Put the next frame of the clip or pattern into img.
+ */
+static int synth_frame(struct context *cnt, struct synth_context *synth, unsigned char *img)
+{
+    int secs;
+
+    if (synth->clip != NULL) {
+        if (fread(img, 1, synth->size, synth->clip) != (size_t)synth->size) {
+            rewind(synth->clip);
+            if (fread(img, 1, synth->size, synth->clip) != (size_t)synth->size) {
+                MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO
+                    ,_("Unable to read a frame from %s"), cnt->conf.synth_camera);
+                return -1;
+            }
+        }
+    } else {
+        memcpy(img, synth->pattern, synth->size);
+    }
+
+    /* The script runs on the frame count so runs are repeatable */
+    if (synth->motion_on > 0) {
+        secs = (int)(synth->frames / synth->framerate);
+        if ((secs % (synth->motion_on + synth->motion_off)) < synth->motion_on) {
+            synth_box(synth, img);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * synth_start
+ *  Set up the synthetic camera at the configured size and framerate.
+ *
+ * Returns
+ *     0  Success
+ *    -1  The clip can not be read
+ *    -3  Image dimensions are not modulo 8
+ */
+int synth_start(struct context *cnt)
+{
+    struct synth_context *synth;
+    int width, height;
+
+    width = cnt->conf.width;
+    height = cnt->conf.height;
+    if ((width % 8) || (height % 8) || (width < 64) || (height < 64)) {
+        MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO
+            ,_("Synthetic camera size %dx%d must be a multiple of 8 of at least 64")
+            ,width, height);
+        return -3;
+    }
+
+    synth = mymalloc(sizeof(struct synth_context));
+    memset(synth, 0, sizeof(struct synth_context));
+    synth->width = width;
+    synth->height = height;
+    synth->size = (width * height * 3) / 2;
+    synth->framerate = (cnt->conf.framerate > 0) ? cnt->conf.framerate : 1;
+    synth->frame_nsec = 1000000000LL / synth->framerate;
+    synth->box_size = height / 8;
+    synth->box_x = width / 4;
+    synth->box_y = height / 4;
+    synth->box_dx = (width / 200) + 1;
+    synth->box_dy = (height / 300) + 1;
+    synth_motion_parms(cnt, synth);
+
+    if (mystreq(cnt->conf.synth_camera, "pattern")) {
+        synth_pattern(synth);
+    } else {
+        synth->clip = myfopen(cnt->conf.synth_camera, "rbe");
+        if (synth->clip == NULL) {
+            MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO
+                ,_("Unable to open the synthetic camera clip %s"), cnt->conf.synth_camera);
+            free(synth);
+            return -1;
+        }
+    }
+
+    cnt->synth = synth;
+    cnt->imgs.width = width;
+    cnt->imgs.height = height;
+    cnt->imgs.motionsize = width * height;
+    cnt->imgs.size_norm = synth->size;
+
+    MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+        ,_("Synthetic camera %s of %dx%d at %d fps")
+        ,cnt->conf.synth_camera, width, height, synth->framerate);
+
+    return 0;
+}
+
+/**
+ * synth_next
+ *  Wait until the next frame is due and put it into img_data.
+ *
+ * Returns
+ *     0  Success
+ *    -1  The clip can no longer be read
+ */
+int synth_next(struct context *cnt, struct image_data *img_data)
+{
+    struct synth_context *synth = cnt->synth;
+    long long now, delay;
+
+    if (synth == NULL) {
+        return -1;
+    }
+
+    now = synth_now();
+    if (synth->next_nsec == 0) {
+        synth->next_nsec = now;
+    }
+
+    if (now < synth->next_nsec) {
+        delay = synth->next_nsec - now;
+        SLEEP(delay / 1000000000LL, delay % 1000000000LL);
+    } else if (now - synth->next_nsec >= synth->frame_nsec) {
+        /* The frames due in the meantime are lost as on a camera */
+        synth->late += (now - synth->next_nsec) / synth->frame_nsec;
+        synth->frames += (now - synth->next_nsec) / synth->frame_nsec;
+        synth->next_nsec = now;
+    }
+    synth->next_nsec += synth->frame_nsec;
+
+    if (synth_frame(cnt, synth, vid_capture_image(cnt, img_data)) != 0) {
+        return -1;
+    }
+    synth->frames++;
+
+    gettimeofday(&img_data->timestamp_tv, NULL);
+
+    return 0;
+}
+
+void synth_cleanup(struct context *cnt)
+{
+    if (cnt->synth == NULL) {
+        return;
+    }
+
+    if (cnt->synth->clip != NULL) {
+        myfclose(cnt->synth->clip);
+    }
+    free(cnt->synth->pattern);
+    free(cnt->synth);
+    cnt->synth = NULL;
+}
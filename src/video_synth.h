@@ -0,0 +1,49 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  video_synth.h
+ *    Headers associated with functions in the video_synth.c module.
+ */
+
+#ifndef _INCLUDE_VIDEO_SYNTH_H
+#define _INCLUDE_VIDEO_SYNTH_H
+
+struct synth_context {
+    FILE               *clip;           /* Looped clip, NULL for the pattern */
+    unsigned char      *pattern;        /* Background of the generated frames */
+    int                 width;
+    int                 height;
+    int                 size;           /* Bytes of a YUV420P frame */
+    int                 framerate;
+    long long           frame_nsec;     /* Time between frames at framerate */
+    long long           next_nsec;      /* Monotonic time the next frame is due */
+    unsigned long       frames;
+    unsigned long       late;           /* Frames lost as the camera was read too late */
+    int                 motion_on;      /* Seconds with the moving box */
+    int                 motion_off;     /* Seconds without the moving box */
+    int                 box_size;
+    int                 box_x;
+    int                 box_y;
+    int                 box_dx;
+    int                 box_dy;
+};
+
+int synth_start(struct context *cnt);
+int synth_next(struct context *cnt, struct image_data *img_data);
+void synth_cleanup(struct context *cnt);
+
+#endif /* _INCLUDE_VIDEO_SYNTH_H */
@@ -31,6 +31,7 @@
 #include "video_common.h"
 #include "video_v4l2.h"
 #include <sys/mman.h>
+#include <poll.h>
 
 
 #ifdef HAVE_V4L2
@@ -77,6 +78,8 @@ typedef struct {
     video_buff *buffers;
 
     s32 pframe;
+    u32 memory;                         /* V4L2_MEMORY_MMAP or V4L2_MEMORY_USERPTR */
+    int userptr_swap;                   /* Bool for swapping user pointer buffers with the ring */
 
     u32 ctrl_flags;
     volatile unsigned int *finish;      /* End the thread */
@@ -1131,10 +1134,15 @@ static int v4l2_mmap_queue(struct video_dev *curdev, int indx)
     memset(planes, 0, sizeof planes);
 
     vid_source->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    vid_source->buf.memory = V4L2_MEMORY_MMAP;
+    vid_source->buf.memory = vid_source->memory;
     vid_source->buf.index = indx;
-    vid_source->buf.length = VIDEO_MAX_PLANES;
-    vid_source->buf.m.planes = planes;
+    if (vid_source->memory == V4L2_MEMORY_USERPTR) {
+        vid_source->buf.m.userptr = (unsigned long)vid_source->buffers[indx].ptr;
+        vid_source->buf.length = vid_source->buffers[indx].size;
+    } else {
+        vid_source->buf.length = VIDEO_MAX_PLANES;
+        vid_source->buf.m.planes = planes;
+    }
 
     if (xioctl(vid_source, VIDIOC_QBUF, &vid_source->buf) == -1) {
         MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO, "VIDIOC_QBUF");
@@ -1144,16 +1152,146 @@ static int v4l2_mmap_queue(struct video_dev *curdev, int indx)
 
 }
 
-static int v4l2_mmap_set(struct video_dev *curdev)
+static void v4l2_userptr_release(struct video_dev *curdev)
+{
+    src_v4l2_t *vid_source = (src_v4l2_t *) curdev->v4l2_private;
+    int indx;
+
+    if (vid_source->buffers != NULL) {
+        for (indx = 0; indx < curdev->buffer_count; indx++) {
+            free(vid_source->buffers[indx].ptr);
+        }
+        free(vid_source->buffers);
+        vid_source->buffers = NULL;
+    }
+
+    /* Release the driver queue so the mmap buffers can be requested */
+    memset(&vid_source->req, 0, sizeof(struct v4l2_requestbuffers));
+    vid_source->req.count = 0;
+    vid_source->req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    vid_source->req.memory = V4L2_MEMORY_USERPTR;
+    xioctl(vid_source, VIDIOC_REQBUFS, &vid_source->req);
+
+    curdev->buffer_count = 0;
+    vid_source->memory = V4L2_MEMORY_MMAP;
+    vid_source->userptr_swap = FALSE;
+}
+
+/**
+ * v4l2_userptr_set
+ *  When requested with the userptr video_params item, use buffers allocated
+ *  here instead of the driver mmap buffers for YUV420 devices.  Captured
+ *  buffers are then swapped with the image ring instead of being copied.
+ *  Returns -1 when the mmap buffers should be used instead.
+ */
+static int v4l2_userptr_set(struct context *cnt, struct video_dev *curdev)
+{
+    src_v4l2_t *vid_source = (src_v4l2_t *) curdev->v4l2_private;
+    enum v4l2_buf_type type;
+    int indx, use_userptr;
+    size_t size;
+    void *ptr;
+
+    use_userptr = FALSE;
+    for (indx = 0; indx < cnt->vdev->params_count; indx++) {
+        if (mystreq(cnt->vdev->params_array[indx].param_name, "userptr")) {
+            use_userptr = atoi(cnt->vdev->params_array[indx].param_value);
+        }
+    }
+    if (!use_userptr) {
+        return -1;
+    }
+
+    if (curdev->pixfmt_src != V4L2_PIX_FMT_YUV420) {
+        MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+            ,_("userptr is only used with the YUV420 palette"));
+        return -1;
+    }
+
+    /* Swapped buffers must hold a full unpadded image of the ring */
+    size = (size_t)((curdev->width * curdev->height * 3) / 2);
+    if ((vid_source->dst_fmt.fmt.pix.sizeimage > size) ||
+        ((vid_source->dst_fmt.fmt.pix.bytesperline != 0) &&
+         ((int)vid_source->dst_fmt.fmt.pix.bytesperline != curdev->width))) {
+        MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+            ,_("Device image is padded, userptr is not used"));
+        return -1;
+    }
+
+    memset(&vid_source->req, 0, sizeof(struct v4l2_requestbuffers));
+    vid_source->req.count = MMAP_BUFFERS;
+    vid_source->req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    vid_source->req.memory = V4L2_MEMORY_USERPTR;
+
+    if (xioctl(vid_source, VIDIOC_REQBUFS, &vid_source->req) == -1) {
+        MOTION_LOG(NTC, TYPE_VIDEO, SHOW_ERRNO
+            ,_("Device does not support user pointer buffers"));
+        vid_source->memory = V4L2_MEMORY_MMAP;
+        return -1;
+    }
+
+    vid_source->memory = V4L2_MEMORY_USERPTR;
+    curdev->buffer_count = vid_source->req.count;
+    if (curdev->buffer_count < MIN_MMAP_BUFFERS) {
+        curdev->buffer_count = 0;
+        v4l2_userptr_release(curdev);
+        return -1;
+    }
+
+    vid_source->buffers = calloc(curdev->buffer_count, sizeof(video_buff));
+    if (!vid_source->buffers) {
+        curdev->buffer_count = 0;
+        v4l2_userptr_release(curdev);
+        return -1;
+    }
+
+    for (indx = 0; indx < curdev->buffer_count; indx++) {
+        if (posix_memalign(&ptr, (size_t)sysconf(_SC_PAGESIZE), size) != 0) {
+            MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO, _("Out of memory."));
+            v4l2_userptr_release(curdev);
+            return -1;
+        }
+        vid_source->buffers[indx].ptr = ptr;
+        vid_source->buffers[indx].size = size;
+        if (v4l2_mmap_queue(curdev, indx) != 0) {
+            v4l2_userptr_release(curdev);
+            return -1;
+        }
+    }
+
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(vid_source, VIDIOC_STREAMON, &type) == -1) {
+        MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO
+            ,_("Error starting stream. VIDIOC_STREAMON"));
+        v4l2_userptr_release(curdev);
+        return -1;
+    }
+
+    vid_source->userptr_swap = TRUE;
+
+    MOTION_LOG(NTC, TYPE_VIDEO, NO_ERRNO
+        ,_("Using %d user pointer buffers"), curdev->buffer_count);
+
+    return 0;
+}
+
+static int v4l2_mmap_set(struct context *cnt, struct video_dev *curdev)
 {
     int retcd, indx;
     src_v4l2_t *vid_source = (src_v4l2_t *) curdev->v4l2_private;
     enum v4l2_buf_type type;
 
+    vid_source->memory = V4L2_MEMORY_MMAP;
+    vid_source->userptr_swap = FALSE;
+
     if (!(vid_source->cap.capabilities & V4L2_CAP_STREAMING)) {
         return -1;
     }
 
+    if (v4l2_userptr_set(cnt, curdev) == 0) {
+        return 0;
+    }
+
     retcd = v4l2_mmap_request(curdev);
     if (retcd != 0) {
         return retcd;
@@ -1193,33 +1331,68 @@ static int v4l2_imgs_set(struct context *cnt, struct video_dev *curdev)
 
 }
 
+/**
+ * v4l2_pix_change
+ *  Convert the captured buffer into the YUV420P image dest.  For the common
+ *  formats a plain rotation is done during the conversion, in which case
+ *  rotated is set and the frame must not be passed to rotate_map again.
+ */
 static int v4l2_pix_change(struct context *cnt, struct video_dev *curdev
-    , uint8_t *dest)
+    , uint8_t *dest, int *rotated)
 {
-    int retcd, width, height;
+    int retcd, width, height, deg;
     src_v4l2_t *vid_source = (src_v4l2_t *) curdev->v4l2_private;
     video_buff *src;
 
-    width = cnt->imgs.width;
-    height = cnt->imgs.height;
+    /* NOTE: Since this is a capture, we need to use capture dimensions. */
+    if (cnt->imgs.detect_scale > 1) {
+        width = cnt->rotate_data.capture_width_high;
+        height = cnt->rotate_data.capture_height_high;
+    } else {
+        width = cnt->rotate_data.capture_width_norm;
+        height = cnt->rotate_data.capture_height_norm;
+    }
     src = &vid_source->buffers[vid_source->buf.index];
 
+    deg = rotate_fused(cnt);
+    *rotated = FALSE;
+
     /*The FALLTHROUGH is a special comment required by compiler.*/
     switch (curdev->pixfmt_src) {
     case V4L2_PIX_FMT_RGB24:
-        vid_rgb24toyuv420p(dest, src->ptr, width, height);
+        if (deg) {
+            vid_rgb24toyuv420p_rot(dest, src->ptr, width, height, deg);
+            *rotated = TRUE;
+        } else {
+            vid_rgb24toyuv420p(dest, src->ptr, width, height);
+        }
         return 0;
     case V4L2_PIX_FMT_UYVY:
-        vid_uyvyto420p(dest, src->ptr, width, height);
+        if (deg) {
+            vid_yuv422to420p_rot(dest, src->ptr, width, height, deg, TRUE);
+            *rotated = TRUE;
+        } else {
+            vid_uyvyto420p(dest, src->ptr, width, height);
+        }
         return 0;
     case V4L2_PIX_FMT_YUYV:
-        vid_yuv422to420p(dest, src->ptr, width, height);
+        if (deg) {
+            vid_yuv422to420p_rot(dest, src->ptr, width, height, deg, FALSE);
+            *rotated = TRUE;
+        } else {
+            vid_yuv422to420p(dest, src->ptr, width, height);
+        }
         return 0;
     case V4L2_PIX_FMT_YUV422P:
         vid_yuv422pto420p(dest, src->ptr, width, height);
         return 0;
     case V4L2_PIX_FMT_YUV420:
-        memcpy(dest, src->ptr, cnt->imgs.size_norm);
+        if (deg) {
+            vid_yuv420p_rot(dest, src->ptr, width, height, deg);
+            *rotated = TRUE;
+        } else {
+            memcpy(dest, src->ptr, vid_capture_size(cnt));
+        }
         return 0;
 
     case V4L2_PIX_FMT_PJPG:
@@ -1239,34 +1412,123 @@ static int v4l2_pix_change(struct context *cnt, struct video_dev *curdev
         /*FALLTHROUGH*/
     case V4L2_PIX_FMT_SBGGR8:    /* bayer */
         vid_bayer2rgb24(cnt->imgs.common_buffer, src->ptr, width, height);
-        vid_rgb24toyuv420p(dest, cnt->imgs.common_buffer, width, height);
-        return 0;
+        break;
 
     case V4L2_PIX_FMT_SPCA561:
         /*FALLTHROUGH*/
     case V4L2_PIX_FMT_SN9C10X:
         vid_sonix_decompress(dest, src->ptr, width, height);
         vid_bayer2rgb24(cnt->imgs.common_buffer, dest, width, height);
-        vid_rgb24toyuv420p(dest, cnt->imgs.common_buffer, width, height);
-        return 0;
+        break;
 
     case V4L2_PIX_FMT_Y10:
         vid_y10torgb24(cnt->imgs.common_buffer, src->ptr, width, height, 2);
-        vid_rgb24toyuv420p(dest, cnt->imgs.common_buffer, width, height);
-        return 0;
+        break;
     case V4L2_PIX_FMT_Y12:
         vid_y10torgb24(cnt->imgs.common_buffer, src->ptr, width, height, 4);
-        vid_rgb24toyuv420p(dest, cnt->imgs.common_buffer, width, height);
-        return 0;
+        break;
     case V4L2_PIX_FMT_GREY:
-        vid_greytoyuv420p(dest, src->ptr, width, height);
+        if (deg) {
+            vid_greytoyuv420p_rot(dest, src->ptr, width, height, deg);
+            *rotated = TRUE;
+        } else {
+            vid_greytoyuv420p(dest, src->ptr, width, height);
+        }
         return 0;
     default:
-        retcd = -1;
+        return -1;
+    }
 
+    /* The formats above that were first converted to RGB24 */
+    if (deg) {
+        vid_rgb24toyuv420p_rot(dest, cnt->imgs.common_buffer, width, height, deg);
+        *rotated = TRUE;
+    } else {
+        vid_rgb24toyuv420p(dest, cnt->imgs.common_buffer, width, height);
     }
 
-    return -1;
+    return 0;
+}
+
+/**
+ * v4l2_userptr_requeue
+ *  Give the last captured user pointer buffer back to the driver.  The buffer
+ *  may have come from the image ring, so when the driver rejects it a buffer
+ *  of our own is queued instead and the ring images are copied from then on.
+ */
+static int v4l2_userptr_requeue(struct video_dev *curdev)
+{
+    src_v4l2_t *vid_source = (src_v4l2_t *) curdev->v4l2_private;
+    video_buff *buf;
+    void *ptr;
+
+    buf = &vid_source->buffers[vid_source->buf.index];
+    vid_source->buf.m.userptr = (unsigned long)buf->ptr;
+    vid_source->buf.length = buf->size;
+
+    if (xioctl(vid_source, VIDIOC_QBUF, &vid_source->buf) != -1) {
+        return 0;
+    }
+
+    if (!vid_source->userptr_swap) {
+        MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO, "VIDIOC_QBUF");
+        return -1;
+    }
+
+    MOTION_LOG(WRN, TYPE_VIDEO, SHOW_ERRNO
+        ,_("Device rejected an image buffer, images will be copied"));
+    vid_source->userptr_swap = FALSE;
+
+    if (posix_memalign(&ptr, (size_t)sysconf(_SC_PAGESIZE), buf->size) != 0) {
+        MOTION_LOG(ERR, TYPE_VIDEO, NO_ERRNO, _("Out of memory."));
+        return -1;
+    }
+    free(buf->ptr);
+    buf->ptr = ptr;
+    vid_source->buf.m.userptr = (unsigned long)buf->ptr;
+
+    if (xioctl(vid_source, VIDIOC_QBUF, &vid_source->buf) == -1) {
+        MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO, "VIDIOC_QBUF");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * v4l2_userptr_swap
+ *  Hand the captured buffer to the image ring and keep the buffer of the ring
+ *  slot being overwritten.  That buffer is queued back to the driver on the
+ *  next capture.  Returns FALSE when the image must be copied instead.
+ */
+static int v4l2_userptr_swap(struct context *cnt, struct video_dev *curdev
+    , struct image_data *img_data)
+{
+    src_v4l2_t *vid_source = (src_v4l2_t *) curdev->v4l2_private;
+    video_buff *buf;
+    unsigned char *tmp;
+
+    /* Devices shared by round robin cameras keep their own buffers */
+    if ((vid_source->memory != V4L2_MEMORY_USERPTR) ||
+        (!vid_source->userptr_swap) || (curdev->usage_count != 1)) {
+        return FALSE;
+    }
+
+    /* The normal image is made from the captured one with detect_scale */
+    if (cnt->imgs.detect_scale > 1) {
+        return FALSE;
+    }
+
+    buf = &vid_source->buffers[vid_source->buf.index];
+    if (buf->size != (size_t)cnt->imgs.size_norm) {
+        return FALSE;
+    }
+
+    tmp = img_data->image_norm;
+    img_data->image_norm = buf->ptr;
+    buf->ptr = tmp;
+
+    return TRUE;
 }
 
 static int v4l2_capture(struct video_dev *curdev)
@@ -1286,9 +1548,15 @@ static int v4l2_capture(struct video_dev *curdev)
     pthread_sigmask(SIG_BLOCK, &set, &old);
 
     if (vid_source->pframe >= 0) {
-        retcd = xioctl(vid_source, VIDIOC_QBUF, &vid_source->buf);
+        if (vid_source->memory == V4L2_MEMORY_USERPTR) {
+            retcd = v4l2_userptr_requeue(curdev);
+        } else {
+            retcd = xioctl(vid_source, VIDIOC_QBUF, &vid_source->buf);
+            if (retcd == -1) {
+                MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO, "VIDIOC_QBUF");
+            }
+        }
         if (retcd == -1) {
-            MOTION_LOG(ERR, TYPE_VIDEO, SHOW_ERRNO, "VIDIOC_QBUF");
             pthread_sigmask(SIG_UNBLOCK, &old, NULL);
             return retcd;
         }
@@ -1297,7 +1565,7 @@ static int v4l2_capture(struct video_dev *curdev)
     memset(&vid_source->buf, 0, sizeof(struct v4l2_buffer));
     memset(planes, 0, sizeof planes);
     vid_source->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    vid_source->buf.memory = V4L2_MEMORY_MMAP;
+    vid_source->buf.memory = vid_source->memory;
     vid_source->buf.bytesused = 0;
     vid_source->buf.length = VIDEO_MAX_PLANES;
     vid_source->buf.m.planes = planes;
@@ -1317,6 +1585,36 @@ static int v4l2_capture(struct video_dev *curdev)
     return 0;
 }
 
+/**
+ * v4l2_capture_newest
+ *  At the idle framerate take the newest of the frames the driver has
+ *  filled since the last capture, so the frame is not one that waited in
+ *  the driver for the idle interval.  Devices shared by round robin
+ *  cameras are left alone.
+ */
+static int v4l2_capture_newest(struct context *cnt, struct video_dev *curdev)
+{
+    struct pollfd pfd;
+    int retcd, indx;
+
+    retcd = v4l2_capture(curdev);
+    if (!cnt->idle || (curdev->usage_count != 1)) {
+        return retcd;
+    }
+
+    pfd.fd = curdev->fd_device;
+    pfd.events = POLLIN;
+    for (indx = 0; (retcd == 0) && (indx < VIDEO_MAX_FRAME); indx++) {
+        pfd.revents = 0;
+        if ((poll(&pfd, 1, 0) != 1) || !(pfd.revents & POLLIN)) {
+            break;
+        }
+        retcd = v4l2_capture(curdev);
+    }
+
+    return retcd;
+}
+
 static int v4l2_device_init(struct context *cnt, struct video_dev *curdev)
 {
 
@@ -1482,7 +1780,11 @@ static void v4l2_device_cleanup(struct video_dev *curdev)
 
     if (vid_source->buffers != NULL) {
         for (indx = 0; indx < vid_source->req.count; indx++) {
-            munmap(vid_source->buffers[indx].ptr, vid_source->buffers[indx].size);
+            if (vid_source->memory == V4L2_MEMORY_USERPTR) {
+                free(vid_source->buffers[indx].ptr);
+            } else {
+                munmap(vid_source->buffers[indx].ptr, vid_source->buffers[indx].size);
+            }
         }
         free(vid_source->buffers);
         vid_source->buffers = NULL;
@@ -1690,7 +1992,7 @@ int v4l2_start(struct context *cnt)
             retcd = v4l2_ctrls_set(cnt, curdev);
         }
         if (retcd == 0) {
-            retcd = v4l2_mmap_set(curdev);
+            retcd = v4l2_mmap_set(cnt, curdev);
         }
         if (retcd == 0) {
             retcd = v4l2_imgs_set(cnt, curdev);
@@ -1800,7 +2102,7 @@ void v4l2_cleanup(struct context *cnt)
 int v4l2_next(struct context *cnt, struct image_data *img_data)
 {
     #ifdef HAVE_V4L2
-        int retcd = -2;
+        int retcd = -2, rotated;
         struct config *conf = &cnt->conf;
         struct video_dev *dev;
 
@@ -1826,10 +2128,11 @@ int v4l2_next(struct context *cnt, struct image_data *img_data)
 
         v4l2_device_select(cnt, dev);
 
-        retcd = v4l2_capture(dev);
+        retcd = v4l2_capture_newest(cnt, dev);
 
-        if (retcd == 0) {
-            retcd = v4l2_pix_change(cnt, dev, img_data->image_norm);
+        rotated = FALSE;
+        if ((retcd == 0) && !v4l2_userptr_swap(cnt, dev, img_data)) {
+            retcd = v4l2_pix_change(cnt, dev, vid_capture_image(cnt, img_data), &rotated);
         }
 
         if (--dev->frames <= 0) {
@@ -1837,7 +2140,7 @@ int v4l2_next(struct context *cnt, struct image_data *img_data)
             dev->frames = 0;
             pthread_mutex_unlock(&dev->mutex);
         }
-        if (retcd == 0) {
+        if ((retcd == 0) && !rotated) {
             rotate_map(cnt, img_data);
         }
 
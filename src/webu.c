@@ -53,6 +53,7 @@
 #include "webu_text.h"
 #include "webu_stream.h"
 #include "webu_status.h"
+#include "cluster.h"
 #include "translate.h"
 
 static mymhd_retcd webu_mhd_send(struct webui_ctx *webui, int ctrl);
@@ -68,6 +69,7 @@ struct mhdstart_ctx {
     int                     mhd_opt_nbr;
     unsigned int            mhd_flags;
     int                     ipv6;
+    int                     pool;           /* Shared stream daemon with a thread pool */
     struct sockaddr_in      lpbk_ipv4;
     struct sockaddr_in6     lpbk_ipv6;
 };
@@ -116,8 +118,21 @@ static void webu_context_init(struct context **cntlst, struct context *cnt, stru
     webui->lang_full     = mymalloc(6);         /* lang code, e.g US_en */
     webui->resp_size     = WEBUI_LEN_RESP * 10; /* The size of the resp_page buffer.  May get adjusted */
     webui->resp_used     = 0;                   /* How many bytes used so far in resp_page*/
+    webui->resp_gzip     = FALSE;               /* resp_page is text rather than gzip data */
+    webui->resp_notmodified = FALSE;
+    webui->resp_etag[0]  = '\0';                /* No ETag unless answered from the cache */
+    webui->post_data     = NULL;                /* Body of a POST request */
+    webui->post_used     = 0;
     webui->stream_pos    = 0;                   /* Stream position of image being sent */
     webui->stream_fps    = 1;                   /* Stream rate */
+    webui->stream_buf    = NULL;                /* Image being sent on the stream */
+    webui->stream_head_len = 0;
+    webui->stream_pooled = FALSE;
+    webui->stream_next   = NULL;
+    webui->stream_wait   = NULL;
+    webui->stream_waited = FALSE;
+    webui->stream_seq    = 0;
+    webui->stream_scaled = -1;
     webui->resp_page     = mymalloc(webui->resp_size);      /* The response being constructed */
     webui->cntlst        = cntlst;  /* The list of context's for all cameras */
     webui->cnt           = cnt;     /* The context pointer for a single camera */
@@ -163,6 +178,7 @@ static void webu_context_null(struct webui_ctx *webui)
     webui->lang          = NULL;
     webui->lang_full     = NULL;
     webui->resp_page     = NULL;
+    webui->stream_buf    = NULL;
     webui->connection    = NULL;
     webui->auth_user     = NULL;
     webui->auth_pass     = NULL;
@@ -171,6 +187,7 @@ static void webu_context_null(struct webui_ctx *webui)
     webui->auth_realm    = NULL;
     webui->clientip      = NULL;
     webui->text_eol      = NULL;
+    webui->post_data     = NULL;
 
     return;
 }
@@ -204,6 +221,7 @@ static void webu_context_free(struct webui_ctx *webui)
     webu_context_free_var(webui->auth_realm);
     webu_context_free_var(webui->clientip);
     webu_context_free_var(webui->text_eol);
+    webu_context_free_var(webui->post_data);
 
     webu_context_null(webui);
 
@@ -237,39 +255,36 @@ static void webu_badreq(struct webui_ctx *webui)
     }
 }
 
-void webu_write(struct webui_ctx *webui, const char *buf)
+void webu_write_len(struct webui_ctx *webui, const char *buf, size_t len)
 {
     /* Copy the buf data to our response buffer.  If the response buffer is not large enough to
-     * accept our new data coming in, then expand it in chunks of 10
+     * accept our new data coming in, then double it so a long page is only copied a few times.
+     * The response is kept terminated for the pages sent as strings.
      */
-    int      resp_len;
-    char    *temp_resp;
     size_t   temp_size;
 
-    resp_len = strlen(buf);
-
     temp_size = webui->resp_size;
-    while ((resp_len + webui->resp_used) > temp_size) {
-        temp_size = temp_size + (WEBUI_LEN_RESP * 10);
+    while ((len + webui->resp_used + 1) > temp_size) {
+        temp_size = temp_size * 2;
     }
 
     if (temp_size > webui->resp_size) {
-        temp_resp = mymalloc(webui->resp_size);
-        memcpy(temp_resp, webui->resp_page, webui->resp_size);
-        free(webui->resp_page);
-        webui->resp_page = mymalloc(temp_size);
-        memset(webui->resp_page,'\0',temp_size);
-        memcpy(webui->resp_page, temp_resp, webui->resp_size);
+        webui->resp_page = myrealloc(webui->resp_page, temp_size, "webu_write");
         webui->resp_size = temp_size;
-        free(temp_resp);
     }
 
-    memcpy(webui->resp_page + webui->resp_used, buf, resp_len);
-    webui->resp_used = webui->resp_used + resp_len;
+    memcpy(webui->resp_page + webui->resp_used, buf, len);
+    webui->resp_used = webui->resp_used + len;
+    webui->resp_page[webui->resp_used] = '\0';
 
     return;
 }
 
+void webu_write(struct webui_ctx *webui, const char *buf)
+{
+    webu_write_len(webui, buf, strlen(buf));
+}
+
 static void webu_parms_edit(struct webui_ctx *webui)
 {
 
@@ -567,6 +582,9 @@ void webu_process_action(struct webui_ctx *webui)
      */
     int indx;
 
+    /* The status answered from the cache may change */
+    webu_status_invalidate();
+
     indx = 0;
     if (mystreq(webui->uri_cmd2,"makemovie") ||
         mystreq(webui->uri_cmd2,"eventend")) {
@@ -601,7 +619,7 @@ void webu_process_action(struct webui_ctx *webui)
         if (webui->thread_nbr == 0) {
             MOTION_LOG(NTC, TYPE_STREAM, NO_ERRNO, _("Restarting all threads"));
             webui->cntlst[0]->webcontrol_finish = TRUE;
-            kill(getpid(),SIGHUP);
+            motion_restart_all();
         } else {
             MOTION_LOG(NTC, TYPE_STREAM, NO_ERRNO,
                 _("Restarting thread %d"),webui->thread_nbr);
@@ -690,34 +708,25 @@ static int webu_process_config_set(struct webui_ctx *webui)
      * get the new parameter name so we can check its webcontrol_parms level
      */
     snprintf(temp_name, WEBUI_LEN_PARM, "%s", webui->uri_parm1);
-    indx=0;
-    while (dep_config_params[indx].name != NULL) {
-        if (mystreq(dep_config_params[indx].name,webui->uri_parm1)) {
-            snprintf(temp_name, WEBUI_LEN_PARM, "%s", dep_config_params[indx].newname);
-            break;
-        }
-        indx++;
+    indx = conf_dep_lookup(webui->uri_parm1);
+    if (indx >= 0) {
+        snprintf(temp_name, WEBUI_LEN_PARM, "%s", dep_config_params[indx].newname);
     }
     /* Ignore any request to change an option that is designated above the
      * webcontrol_parms level.
      */
-    indx=0;
-    while (config_params[indx].param_name != NULL) {
-        if (((webui->thread_nbr != 0) && (config_params[indx].main_thread)) ||
-            (config_params[indx].webui_level > webui->cntlst[0]->conf.webcontrol_parms) ||
-            (config_params[indx].webui_level == WEBUI_LEVEL_NEVER) ) {
-            indx++;
-            continue;
-        }
-        if (mystreq(temp_name, config_params[indx].param_name)) {
-            break;
-        }
-        indx++;
-    }
-    /* If we found the parm, assign it.  If the loop above did not find the parm
+    indx = conf_param_lookup(temp_name);
+    if ((indx >= 0) &&
+        (((webui->thread_nbr != 0) && (config_params[indx].main_thread)) ||
+         (config_params[indx].webui_level > webui->cntlst[0]->conf.webcontrol_parms) ||
+         (config_params[indx].webui_level == WEBUI_LEVEL_NEVER) ||
+         mystrne(temp_name, config_params[indx].param_name))) {
+        indx = -1;
+    }
+    /* If we found the parm, assign it.  If the lookup above did not find the parm
      * then we ignore the request
      */
-    if (config_params[indx].param_name != NULL) {
+    if (indx >= 0) {
         if (strlen(webui->uri_parm1) > 0) {
             /* This is legacy assumption on the pointers being sequential
              * We send in the original parm name so it will trigger the depreciated warnings
@@ -763,6 +772,9 @@ int webu_process_config(struct webui_ctx *webui)
     if ((mystreq(webui->uri_cmd1,"config")) &&
         (mystreq(webui->uri_cmd2,"set"))) {
         retcd = webu_process_config_set(webui);
+        if (retcd == 0) {
+            webu_status_invalidate();
+        }
 
     } else if ((mystreq(webui->uri_cmd1,"config")) &&
                (mystreq(webui->uri_cmd2,"get"))) {
@@ -790,7 +802,7 @@ int webu_process_track(struct webui_ctx *webui)
     int retcd;
 
     if (mystreq(webui->uri_cmd2, "center")) {
-        webui->cntlst[webui->thread_nbr]->moved = track_center(webui->cntlst[webui->thread_nbr], 0, 1, 0, 0);
+        track_center(webui->cntlst[webui->thread_nbr], 0, 1, 0, 0);
         retcd = 0;
     } else if (mystreq(webui->uri_cmd2, "set")) {
         if (mystreq(webui->uri_parm1, "pan")) {
@@ -798,7 +810,7 @@ int webu_process_track(struct webui_ctx *webui)
             cent.height = webui->cntlst[webui->thread_nbr]->imgs.height;
             cent.x = atoi(webui->uri_value1);
             cent.y = 0;
-            webui->cntlst[webui->thread_nbr]->moved = track_move(webui->cntlst[webui->thread_nbr]
+            track_move(webui->cntlst[webui->thread_nbr]
                 ,webui->cntlst[webui->thread_nbr]->video_dev
                 ,&cent, &webui->cntlst[webui->thread_nbr]->imgs, 1);
 
@@ -806,12 +818,12 @@ int webu_process_track(struct webui_ctx *webui)
             cent.height = webui->cntlst[webui->thread_nbr]->imgs.height;
             cent.x = 0;
             cent.y = atoi(webui->uri_value2);
-            webui->cntlst[webui->thread_nbr]->moved = track_move(webui->cntlst[webui->thread_nbr]
+            track_move(webui->cntlst[webui->thread_nbr]
                 ,webui->cntlst[webui->thread_nbr]->video_dev
                 ,&cent, &webui->cntlst[webui->thread_nbr]->imgs, 1);
             retcd = 0;
         } else if (mystrceq(webui->uri_parm1, "x")) {
-            webui->cntlst[webui->thread_nbr]->moved = track_center(webui->cntlst[webui->thread_nbr]
+            track_center(webui->cntlst[webui->thread_nbr]
                 , webui->cntlst[webui->thread_nbr]->video_dev, 1
                 , atoi(webui->uri_value1), atoi(webui->uri_value2));
             retcd = 0;
@@ -1307,14 +1319,30 @@ static mymhd_retcd webu_mhd_send(struct webui_ctx *webui, int ctrl)
     mymhd_retcd retcd;
     struct MHD_Response *response;
     int indx;
+    size_t len;
+
+    /* The client already has the cached response, see webu_status_main */
+    len = webui->resp_gzip ? webui->resp_used : strlen(webui->resp_page);
+    if (webui->resp_notmodified) {
+        len = 0;
+    }
 
-    response = MHD_create_response_from_buffer (strlen(webui->resp_page)
+    response = MHD_create_response_from_buffer (len
         ,(void *)webui->resp_page, MHD_RESPMEM_PERSISTENT);
     if (!response) {
         MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO, _("Invalid response"));
         return MHD_NO;
     }
 
+    if (webui->resp_etag[0] != '\0') {
+        MHD_add_response_header (response, MHD_HTTP_HEADER_ETAG, webui->resp_etag);
+        MHD_add_response_header (response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-cache");
+        MHD_add_response_header (response, MHD_HTTP_HEADER_VARY, "Accept-Encoding");
+    }
+    if (webui->resp_gzip) {
+        MHD_add_response_header (response, MHD_HTTP_HEADER_CONTENT_ENCODING, "gzip");
+    }
+
     if (webui->cnt != NULL) {
         if (ctrl) {
             for (indx = 0; indx < webui->cnt->webcontrol_headers->params_count; indx++) {
@@ -1328,7 +1356,9 @@ static mymhd_retcd webu_mhd_send(struct webui_ctx *webui, int ctrl)
                         , webui->cnt->webcontrol_headers->params_array[indx].param_value);
                 }
             }
-            if (webui->cnt->conf.webcontrol_interface == 1) {
+            if (webui->cnct_type == WEBUI_CNCT_TRACE) {
+                MHD_add_response_header (response, MHD_HTTP_HEADER_CONTENT_TYPE, "application/json");
+            } else if (webui->cnt->conf.webcontrol_interface == 1) {
                 MHD_add_response_header (response, MHD_HTTP_HEADER_CONTENT_TYPE, "text/plain;");
             } else {
                 MHD_add_response_header (response, MHD_HTTP_HEADER_CONTENT_TYPE, "text/html");
@@ -1346,20 +1376,100 @@ static mymhd_retcd webu_mhd_send(struct webui_ctx *webui, int ctrl)
                 }
             }
             if ((webui->cnct_type == WEBUI_CNCT_STATUS_LIST) ||
-                (webui->cnct_type == WEBUI_CNCT_STATUS_ONE)) {
+                (webui->cnct_type == WEBUI_CNCT_STATUS_ONE) ||
+                (webui->cnct_type == WEBUI_CNCT_EVENTS) ||
+                (webui->cnct_type == WEBUI_CNCT_CLUSTER)) {
                 MHD_add_response_header (response, MHD_HTTP_HEADER_CONTENT_TYPE, "application/json");
+            } else if (webui->cnct_type == WEBUI_CNCT_METRICS) {
+                MHD_add_response_header (response, MHD_HTTP_HEADER_CONTENT_TYPE
+                    , "text/plain; version=0.0.4");
+            } else if (webui->cnct_type == WEBUI_CNCT_CLUSTER_BEAT) {
+                MHD_add_response_header (response, MHD_HTTP_HEADER_CONTENT_TYPE, "text/plain");
             } else {
                 MHD_add_response_header (response, MHD_HTTP_HEADER_CONTENT_TYPE, "text/html");
             }
         }
     }
 
-    retcd = MHD_queue_response (webui->connection, MHD_HTTP_OK, response);
+    if (webui->resp_notmodified) {
+        retcd = MHD_queue_response (webui->connection, MHD_HTTP_NOT_MODIFIED, response);
+    } else {
+        retcd = MHD_queue_response (webui->connection, MHD_HTTP_OK, response);
+    }
+    MHD_destroy_response (response);
+
+    return retcd;
+}
+
+static mymhd_retcd webu_mhd_redirect(struct webui_ctx *webui, const char *location)
+{
+    /* Send the client to the node of the cluster which runs the camera */
+    mymhd_retcd retcd;
+    struct MHD_Response *response;
+
+    response = MHD_create_response_from_buffer (0, (void *)"", MHD_RESPMEM_PERSISTENT);
+    if (!response) {
+        MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO, _("Invalid response"));
+        return MHD_NO;
+    }
+    MHD_add_response_header (response, MHD_HTTP_HEADER_LOCATION, location);
+
+    retcd = MHD_queue_response (webui->connection, MHD_HTTP_FOUND, response);
     MHD_destroy_response (response);
 
     return retcd;
 }
 
+static int webu_post_append(struct webui_ctx *webui, const char *data, size_t size)
+{
+    /* Keep the body of a POST request, NUL terminated */
+    if ((webui->post_used + size) >= CLUSTER_BEAT_MAX) {
+        return -1;
+    }
+    webui->post_data = myrealloc(webui->post_data, webui->post_used + size + 1
+        , "webu_post_append");
+    memcpy(webui->post_data + webui->post_used, data, size);
+    webui->post_used += size;
+    webui->post_data[webui->post_used] = '\0';
+
+    return 0;
+}
+
+static void webu_answer_strm_scaled(struct webui_ctx *webui)
+{
+    /* Find the scaled stream of the width requested.  Only the widths of
+     * stream_scaled are served.
+     * /{camid}/scaled/{width} or /scaled/{width} on a camera port
+     */
+    const char *width;
+    int indx;
+
+    if (mystreq(webui->uri_camid,"scaled")) {
+        width = webui->uri_cmd1;
+    } else {
+        width = webui->uri_cmd2;
+    }
+
+    webui->cnct_type = WEBUI_CNCT_UNKNOWN;
+    for (indx = 0; indx < webui->cnt->stream_scaled_count; indx++) {
+        if (webui->cnt->stream_scaled[indx].width_conf == atoi(width)) {
+            webui->stream_scaled = indx;
+            webui->cnct_type = WEBUI_CNCT_SCALED;
+            break;
+        }
+    }
+
+}
+
+/* Whether the last segment of the uri is name, with or without a query */
+static int webu_answer_strm_query(const char *segment, const char *name)
+{
+    size_t len = strlen(name);
+
+    return (strncmp(segment, name, len) == 0) &&
+        ((segment[len] == '\0') || (segment[len] == '?'));
+}
+
 static void webu_answer_strm_type(struct webui_ctx *webui)
 {
     /* Assign the type of stream that is being answered*/
@@ -1385,6 +1495,14 @@ static void webu_answer_strm_type(struct webui_ctx *webui)
                mystreq(webui->uri_camid,"current")) {
         webui->cnct_type = WEBUI_CNCT_STATIC;
 
+    } else if (mystreq(webui->uri_cmd1,"scaled") ||
+               mystreq(webui->uri_camid,"scaled")) {
+        webu_answer_strm_scaled(webui);
+
+    } else if (mystreq(webui->uri_cmd1,"hls") ||
+               mystreq(webui->uri_camid,"hls")) {
+        webui->cnct_type = WEBUI_CNCT_HLS;
+
     } else if (mystreq(webui->uri_camid, "cameras.json") &&
                strlen(webui->uri_cmd1) == 0) {
         webui->cnct_type = WEBUI_CNCT_STATUS_LIST;
@@ -1401,6 +1519,31 @@ static void webu_answer_strm_type(struct webui_ctx *webui)
                strlen(webui->uri_cmd2) == 0) {
         webui->cnct_type = WEBUI_CNCT_STATUS_ONE;
 
+    } else if (mystreq(webui->uri_camid, "metrics") &&
+               strlen(webui->uri_cmd1) == 0) {
+        webui->cnct_type = WEBUI_CNCT_METRICS;
+
+    } else if (mystreq(webui->uri_cmd1, "metrics") &&
+               strlen(webui->uri_cmd2) == 0) {
+        webui->cnct_type = WEBUI_CNCT_METRICS;
+
+    } else if (webu_answer_strm_query(webui->uri_camid, "events.json") &&
+               strlen(webui->uri_cmd1) == 0) {
+        webui->cnct_type = WEBUI_CNCT_EVENTS;
+
+    } else if (webu_answer_strm_query(webui->uri_cmd1, "events.json") &&
+               strlen(webui->uri_cmd2) == 0) {
+        webui->cnct_type = WEBUI_CNCT_EVENTS;
+
+    } else if (mystreq(webui->uri_camid, "cluster.json") &&
+               strlen(webui->uri_cmd1) == 0) {
+        webui->cnct_type = WEBUI_CNCT_CLUSTER;
+
+    } else if (mystreq(webui->uri_camid, "cluster") &&
+               mystreq(webui->uri_cmd1, "heartbeat") &&
+               strlen(webui->uri_cmd2) == 0) {
+        webui->cnct_type = WEBUI_CNCT_CLUSTER_BEAT;
+
     } else if ((strlen(webui->uri_camid) > 0) &&
                (strlen(webui->uri_cmd1) == 0)) {
         webui->cnct_type = WEBUI_CNCT_FULL;
@@ -1411,6 +1554,36 @@ static void webu_answer_strm_type(struct webui_ctx *webui)
 
 }
 
+static int webu_answer_strm_route(struct webui_ctx *webui, char *location, size_t size)
+{
+    /* Whether the request is for a camera which another node of the cluster
+     * runs.  The status of all cameras is answered by the coordinator itself.
+     */
+    char url[CLUSTER_URL_LEN];
+
+    if ((webui->cnct_type == WEBUI_CNCT_STATUS_LIST) ||
+        (webui->cnct_type == WEBUI_CNCT_STATUS_ONE) ||
+        (webui->cnct_type == WEBUI_CNCT_METRICS) ||
+        (webui->cnct_type == WEBUI_CNCT_CLUSTER) ||
+        (webui->cnct_type == WEBUI_CNCT_CLUSTER_BEAT) ||
+        ((webui->cnct_type == WEBUI_CNCT_EVENTS) && (webui->thread_nbr == 0))) {
+        return FALSE;
+    }
+
+    if (!cluster_route(webui->cnt, url, sizeof(url))) {
+        return FALSE;
+    }
+
+    if (webui->cntlst != NULL) {
+        snprintf(location, size, "%s%s", url, webui->url);
+    } else {
+        /* A camera port, the node serves the camera on its stream_port */
+        snprintf(location, size, "%s/%d%s", url, webui->cnt->camera_id, webui->url);
+    }
+
+    return TRUE;
+}
+
 static mymhd_retcd webu_answer_ctrl(void *cls, struct MHD_Connection *connection
             , const char *url, const char *method, const char *version
             , const char *upload_data, size_t *upload_data_size, void **ptr)
@@ -1478,8 +1651,12 @@ static mymhd_retcd webu_answer_ctrl(void *cls, struct MHD_Connection *connection
 
     MOTION_LOG(INF,TYPE_ALL, NO_ERRNO, _("Connection from: %s"),webui->clientip);
 
-    if ((webui->cntlst[0]->conf.webcontrol_interface == 1) ||
-        (webui->cntlst[0]->conf.webcontrol_interface == 2)) {
+    if (mystreq(webui->uri_camid, "trace.json") ||
+        mystreq(webui->uri_cmd1, "trace.json")) {
+        webui->cnct_type = WEBUI_CNCT_TRACE;
+        webu_status_trace(webui);
+    } else if ((webui->cntlst[0]->conf.webcontrol_interface == 1) ||
+               (webui->cntlst[0]->conf.webcontrol_interface == 2)) {
         webu_text_main(webui);
     } else {
         webu_html_main(webui);
@@ -1501,21 +1678,35 @@ static mymhd_retcd webu_answer_strm(void *cls, struct MHD_Connection *connection
     /* Answer the request for all the streams*/
     mymhd_retcd retcd;
     struct webui_ctx *webui = *ptr;
+    char location[WEBUI_LEN_URLI + CLUSTER_URL_LEN + 16];
+    int first, beat;
 
     /* Eliminate compiler warnings */
     (void)cls;
     (void)url;
     (void)version;
-    (void)upload_data;
-    (void)upload_data_size;
 
-    /* Per docs, this is called twice and we should process the second call */
-    if (webui->mhd_first) {
+    /* The heartbeats of the nodes of a cluster are posted, see cluster.c */
+    beat = (mystreq(method, "POST") && mystreq(webui->uri_camid, "cluster"));
+
+    /* Per docs, this is called twice and we should process the second call.
+     * A heartbeat is authenticated on the first call, before its body is sent.
+     */
+    first = webui->mhd_first;
+    if (first) {
         webui->mhd_first = FALSE;
-        return MHD_YES;
+        if (!beat) {
+            return MHD_YES;
+        }
     }
 
-    if (mystrne(method, "GET")) {
+    if (beat) {
+        if (!cluster_coordinator()) {
+            MOTION_LOG(NTC, TYPE_STREAM, NO_ERRNO
+                ,_("Heartbeat posted to a node which is not a coordinator"));
+            return MHD_NO;
+        }
+    } else if (mystrne(method, "GET")) {
         MOTION_LOG(NTC, TYPE_STREAM, NO_ERRNO ,_("Invalid Method requested: %s"),method);
         return MHD_NO;
     }
@@ -1542,9 +1733,13 @@ static mymhd_retcd webu_answer_strm(void *cls, struct MHD_Connection *connection
     }
 
     /* Do not answer a request until the motion loop has completed at least once.
-     * Required for the Motioneye application
+     * Required for the Motioneye application.  The cluster requests and the
+     * cameras run by other nodes do not wait for an image of this node.
     */
-    if (webui->cnt->passflag == 0) {
+    if ((webui->cnt->passflag == 0) &&
+        !mystreq(webui->uri_camid, "cluster.json") &&
+        !mystreq(webui->uri_camid, "cluster") &&
+        !cluster_route(webui->cnt, NULL, 0)) {
         MOTION_LOG(DBG, TYPE_STREAM, NO_ERRNO, _("Stream picture is not ready yet"));
         return MHD_NO;
     }
@@ -1565,21 +1760,53 @@ static mymhd_retcd webu_answer_strm(void *cls, struct MHD_Connection *connection
 
     webu_failauth_reset(webui);
 
+    if (beat) {
+        if (first) {
+            return MHD_YES;
+        }
+        if (*upload_data_size > 0) {
+            if (webu_post_append(webui, upload_data, *upload_data_size) != 0) {
+                MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO, _("Heartbeat is too large"));
+                return MHD_NO;
+            }
+            *upload_data_size = 0;
+            return MHD_YES;
+        }
+    }
+
     MOTION_LOG(INF,TYPE_ALL, NO_ERRNO, _("Connection from: %s"),webui->clientip);
 
     webu_answer_strm_type(webui);
 
     retcd = 0;
-    if ((webui->cnct_type == WEBUI_CNCT_STATUS_LIST) ||
-        (webui->cnct_type == WEBUI_CNCT_STATUS_ONE)) {
+    if (webu_answer_strm_route(webui, location, sizeof(location))) {
+        retcd = webu_mhd_redirect(webui, location);
+        /* No stream connection was counted for webu_mhd_deinit */
+        webui->cnct_type = WEBUI_CNCT_UNKNOWN;
+    } else if ((webui->cnct_type == WEBUI_CNCT_STATUS_LIST) ||
+        (webui->cnct_type == WEBUI_CNCT_STATUS_ONE) ||
+        (webui->cnct_type == WEBUI_CNCT_METRICS) ||
+        (webui->cnct_type == WEBUI_CNCT_EVENTS)) {
         webu_status_main(webui);
         retcd = webu_mhd_send(webui, FALSE);
+    } else if (webui->cnct_type == WEBUI_CNCT_CLUSTER) {
+        cluster_webu_status(webui);
+        retcd = webu_mhd_send(webui, FALSE);
+    } else if (webui->cnct_type == WEBUI_CNCT_CLUSTER_BEAT) {
+        cluster_webu_beat(webui);
+        retcd = webu_mhd_send(webui, FALSE);
     } else if (webui->cnct_type == WEBUI_CNCT_STATIC) {
         retcd = webu_stream_static(webui);
         if (retcd == MHD_NO) {
             webu_badreq(webui);
             retcd = webu_mhd_send(webui, FALSE);
         }
+    } else if (webui->cnct_type == WEBUI_CNCT_HLS) {
+        retcd = webu_stream_hls(webui);
+        if (retcd == MHD_NO) {
+            webu_badreq(webui);
+            retcd = webu_mhd_send(webui, FALSE);
+        }
     } else if (webui->cnct_type != WEBUI_CNCT_UNKNOWN) {
         retcd = webu_stream_mjpeg(webui);
         if (retcd == MHD_NO) {
@@ -1640,6 +1867,19 @@ static void *webu_mhd_init(void *cls, const char *uri, struct MHD_Connection *co
     return webui;
 }
 
+static void *webu_mhd_init_pool(void *cls, const char *uri, struct MHD_Connection *connection)
+{
+    /* The init for the shared stream daemon.  Its threads serve many connections
+     * so the streams are paced by suspending the connection instead of sleeping.
+     */
+    struct webui_ctx *webui;
+
+    webui = webu_mhd_init(cls, uri, connection);
+    webui->stream_pooled = TRUE;
+
+    return webui;
+}
+
 static void *webu_mhd_init_one(void *cls, const char *uri, struct MHD_Connection *connection)
 {
     /* This function initializes all the webui variables as we are getting a request.  This
@@ -1711,6 +1951,16 @@ static void webu_mhd_deinit(void *cls, struct MHD_Connection *connection
             webui->cnt->stream_norm.cnct_count--;
         pthread_mutex_unlock(&webui->cnt->mutex_stream);
 
+    } else if (webui->cnct_type == WEBUI_CNCT_SCALED ) {
+        pthread_mutex_lock(&webui->cnt->mutex_stream);
+            webui->cnt->stream_scaled[webui->stream_scaled].strm.cnct_count--;
+        pthread_mutex_unlock(&webui->cnt->mutex_stream);
+
+    }
+
+    if (webui->stream_buf != NULL) {
+        webu_stream_unref(webui->cnt, webui->stream_buf);
+        webui->stream_buf = NULL;
     }
 
     webu_context_free(webui);
@@ -1933,6 +2183,11 @@ static void webu_mhd_opts_init(struct mhdstart_ctx *mhdst)
         mhdst->mhd_ops[mhdst->mhd_opt_nbr].value = (intptr_t)webu_mhd_init_one;
         mhdst->mhd_ops[mhdst->mhd_opt_nbr].ptr_value = mhdst->cnt[mhdst->indxthrd];
         mhdst->mhd_opt_nbr++;
+    } else if (mhdst->pool) {
+        mhdst->mhd_ops[mhdst->mhd_opt_nbr].option = MHD_OPTION_URI_LOG_CALLBACK;
+        mhdst->mhd_ops[mhdst->mhd_opt_nbr].value = (intptr_t)webu_mhd_init_pool;
+        mhdst->mhd_ops[mhdst->mhd_opt_nbr].ptr_value = mhdst->cnt;
+        mhdst->mhd_opt_nbr++;
     } else {
         mhdst->mhd_ops[mhdst->mhd_opt_nbr].option = MHD_OPTION_URI_LOG_CALLBACK;
         mhdst->mhd_ops[mhdst->mhd_opt_nbr].value = (intptr_t)webu_mhd_init;
@@ -2060,6 +2315,18 @@ static void webu_mhd_opts_tls(struct mhdstart_ctx *mhdst)
 
 }
 
+static void webu_mhd_opts_pool(struct mhdstart_ctx *mhdst)
+{
+    /* Set the MHD option for the threads of the shared stream daemon */
+    if (mhdst->pool) {
+        mhdst->mhd_ops[mhdst->mhd_opt_nbr].option = MHD_OPTION_THREAD_POOL_SIZE;
+        mhdst->mhd_ops[mhdst->mhd_opt_nbr].value = (unsigned int)mhdst->cnt[0]->conf.stream_threads;
+        mhdst->mhd_ops[mhdst->mhd_opt_nbr].ptr_value = NULL;
+        mhdst->mhd_opt_nbr++;
+    }
+
+}
+
 static void webu_mhd_opts(struct mhdstart_ctx *mhdst)
 {
     /* Set all the options we need based upon the motion configuration parameters*/
@@ -2078,6 +2345,8 @@ static void webu_mhd_opts(struct mhdstart_ctx *mhdst)
 
     webu_mhd_opts_tls(mhdst);
 
+    webu_mhd_opts_pool(mhdst);
+
     mhdst->mhd_ops[mhdst->mhd_opt_nbr].option = MHD_OPTION_END;
     mhdst->mhd_ops[mhdst->mhd_opt_nbr].value = 0;
     mhdst->mhd_ops[mhdst->mhd_opt_nbr].ptr_value = NULL;
@@ -2089,7 +2358,15 @@ static void webu_mhd_flags(struct mhdstart_ctx *mhdst)
 {
 
     /* This sets the MHD startup flags based upon what user put into configuration */
-    mhdst->mhd_flags = MHD_USE_THREAD_PER_CONNECTION;
+    if (mhdst->pool) {
+        #if MHD_VERSION >= 0x00095300
+            mhdst->mhd_flags = MHD_USE_EPOLL_INTERNAL_THREAD | MHD_ALLOW_SUSPEND_RESUME;
+        #else
+            mhdst->mhd_flags = MHD_USE_EPOLL_INTERNALLY | MHD_USE_SUSPEND_RESUME;
+        #endif
+    } else {
+        mhdst->mhd_flags = MHD_USE_THREAD_PER_CONNECTION;
+    }
 
     if (mhdst->ipv6) {
         mhdst->mhd_flags = mhdst->mhd_flags | MHD_USE_DUAL_STACK;
@@ -2119,6 +2396,7 @@ static void webu_start_ctrl(struct context **cnt)
     mhdst.tls_cert = webu_mhd_loadfile(cnt[0]->conf.webcontrol_cert);
     mhdst.tls_key  = webu_mhd_loadfile(cnt[0]->conf.webcontrol_key);
     mhdst.ctrl = TRUE;
+    mhdst.pool = FALSE;
     mhdst.indxthrd = 0;
     mhdst.cnt = cnt;
     mhdst.ipv6 = cnt[0]->conf.webcontrol_ipv6;
@@ -2216,10 +2494,32 @@ static void webu_start_strm(struct context **cnt)
     snprintf(cnt[0]->webstream_digest_rand
         ,sizeof(cnt[0]->webstream_digest_rand),"%d",randnbr);
 
+    /* All the cameras are served on the stream port of motion.conf by one daemon */
+    mhdst.pool = FALSE;
+    if (cnt[0]->conf.stream_threads > 0) {
+        if (cnt[0]->conf.stream_port == 0) {
+            MOTION_LOG(NTC, TYPE_STREAM, NO_ERRNO
+                ,_("stream_threads requires stream_port in motion.conf"));
+        } else if (webu_stream_pool_start() == 0) {
+            mhdst.pool = TRUE;
+        }
+    }
+
     while (cnt[mhdst.indxthrd] != NULL) {
         cnt[mhdst.indxthrd]->webstream_daemon = NULL;
-        if (cnt[mhdst.indxthrd]->conf.stream_port != 0 ) {
-            if (mhdst.indxthrd == 0) {
+        if ((mhdst.pool) && (mhdst.indxthrd != 0)) {
+            MOTION_LOG(NTC, TYPE_STREAM, NO_ERRNO
+                ,_("Camera %d stream is on port/camera_id %d/%d")
+                ,cnt[mhdst.indxthrd]->camera_id
+                ,cnt[0]->conf.stream_port
+                ,cnt[mhdst.indxthrd]->camera_id);
+        } else if (cnt[mhdst.indxthrd]->conf.stream_port != 0 ) {
+            if ((mhdst.indxthrd == 0) && (mhdst.pool)) {
+                MOTION_LOG(NTC, TYPE_STREAM, NO_ERRNO
+                    ,_("Starting all camera streams on port %d with %d threads")
+                    ,cnt[mhdst.indxthrd]->conf.stream_port
+                    ,cnt[mhdst.indxthrd]->conf.stream_threads);
+            } else if (mhdst.indxthrd == 0) {
                 MOTION_LOG(NTC, TYPE_STREAM, NO_ERRNO
                     ,_("Starting all camera streams on port %d")
                     ,cnt[mhdst.indxthrd]->conf.stream_port);
@@ -2254,6 +2554,11 @@ static void webu_start_strm(struct context **cnt)
                 MOTION_LOG(NTC, TYPE_STREAM, NO_ERRNO
                     ,_("Unable to start stream for camera %d")
                     ,cnt[mhdst.indxthrd]->camera_id);
+                if ((mhdst.indxthrd == 0) && (mhdst.pool)) {
+                    /* The other cameras are then served on their own ports */
+                    webu_stream_pool_stop();
+                    mhdst.pool = FALSE;
+                }
             } else {
                 webu_strm_ntc(cnt,mhdst.indxthrd);
             }
@@ -2379,6 +2684,14 @@ void webu_stop(struct context **cnt)
         MHD_stop_daemon (cnt[0]->webcontrol_daemon);
     }
 
+    /* The suspended streams of the shared daemon must end before it stops */
+    indxthrd = 0;
+    while (cnt[indxthrd] != NULL) {
+        cnt[indxthrd]->webcontrol_finish = TRUE;
+        indxthrd++;
+    }
+    webu_stream_pool_stop();
+
     indxthrd = 0;
     while (cnt[indxthrd] != NULL) {
         if (cnt[indxthrd]->webstream_daemon != NULL) {
@@ -27,7 +27,7 @@
 #define WEBUI_LEN_PARM 512          /* Parameters specified */
 #define WEBUI_LEN_URLI 512          /* Maximum URL permitted */
 #define WEBUI_LEN_RESP 1024         /* Initial response size */
-#define WEBUI_MHD_OPTS 10           /* Maximum number of options permitted for MHD */
+#define WEBUI_MHD_OPTS 12           /* Maximum number of options permitted for MHD */
 #define WEBUI_LEN_LNK  15           /* Maximum length for chars in strminfo */
 
 enum WEBUI_CNCT{
@@ -39,6 +39,13 @@ enum WEBUI_CNCT{
   WEBUI_CNCT_STATIC      = 5,
   WEBUI_CNCT_STATUS_LIST = 6,
   WEBUI_CNCT_STATUS_ONE  = 7,
+  WEBUI_CNCT_SCALED      = 8,
+  WEBUI_CNCT_HLS         = 9,
+  WEBUI_CNCT_METRICS     = 10,
+  WEBUI_CNCT_TRACE       = 11,
+  WEBUI_CNCT_EVENTS      = 12,
+  WEBUI_CNCT_CLUSTER     = 13,
+  WEBUI_CNCT_CLUSTER_BEAT = 14,
   WEBUI_CNCT_UNKNOWN     = 99
 };
 
@@ -73,9 +80,24 @@ struct webui_ctx {
     char            *resp_page;        /* The response that will be sent */
     size_t          resp_size;         /* The allocated size of the response */
     size_t          resp_used;         /* The amount of the response page used */
+    int             resp_gzip;         /* resp_page holds resp_used bytes of gzip data */
+    int             resp_notmodified;  /* Answer 304 as the client has the resp_etag response */
+    char            resp_etag[24];     /* ETag of a cached response, empty for none */
+    char            *post_data;        /* Body of a POST request, NULL for none */
+    size_t          post_used;         /* Bytes of post_data */
     uint64_t        stream_pos;        /* Stream position of sent image */
+    struct stream_buffer *stream_buf;  /* Shared image being sent on the stream */
+    char            stream_head[80];   /* Multipart header for the image being sent */
+    size_t          stream_head_len;   /* Length of stream_head */
     int             stream_fps;        /* Stream rate per second */
     struct timeval  time_last;         /* Keep track of processing time for stream thread*/
+    int             stream_pooled;     /* Served by the threads of the shared stream daemon */
+    struct timeval  stream_due;        /* Time the suspended stream is resumed */
+    struct webui_ctx *stream_next;     /* Next suspended stream */
+    struct stream_data *stream_wait;   /* Stream whose next image resumes the connection */
+    int             stream_waited;     /* Suspended for the next image before this one */
+    unsigned long   stream_seq;        /* Number of the image sent last */
+    int             stream_scaled;     /* Index of the scaled stream in cnt->stream_scaled */
     int             mhd_first;         /* Boolean for whether it is the first connection*/
 
     struct MHD_Connection  *connection; /* The MHD connection value from the client */
@@ -90,5 +112,6 @@ void webu_process_action(struct webui_ctx *webui);
 int webu_process_config(struct webui_ctx *webui);
 int webu_process_track(struct webui_ctx *webui);
 void webu_write(struct webui_ctx *webui, const char *buf);
+void webu_write_len(struct webui_ctx *webui, const char *buf, size_t len);
 
 #endif
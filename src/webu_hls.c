@@ -0,0 +1,617 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *    webu_hls.c
+ *
+ *    HLS live stream of the pass-through packets of a network camera.
+ *
+ *    The compressed packets kept in the packet array of the camera are
+ *    remuxed into fragmented MP4 on the motion loop without any decode or
+ *    encode.  Each segment starts on a key frame and the last HLS_SEGMENTS
+ *    of them are held in memory for the stream daemon together with the
+ *    init segment.  The remux only runs while a client has asked for the
+ *    playlist or a segment within the last HLS_IDLE_SEC seconds.
+ *
+ *    Functional naming scheme
+ *    webu_hls*         - All functions in this module
+ *    webu_hls_mux*     - Remux of the packets on the motion loop
+ *    webu_hls_get      - Copy of a playlist or segment for the stream daemon
+ */
+
+#include "translate.h"
+#include "motion.h"
+#include "util.h"
+#include "logger.h"
+#include "netcam.h"
+#include "netcam_rtsp.h"
+#include "ffmpeg.h"
+#include "webu_hls.h"
+
+#define HLS_SEGMENTS     6      /* Segments listed in the playlist */
+#define HLS_SEGMENT_MIN  1      /* Minimum seconds of a segment before it is cut at a key frame */
+#define HLS_IDLE_SEC     30     /* Seconds without a request before the remux stops */
+#define HLS_IOBUF        32768  /* Size of the buffer of the muxer output */
+
+#if (MYFFVER >= 57083)
+
+struct webu_hls_seg {
+    unsigned char  *data;
+    size_t          len;
+    int64_t         seq;            /* Media sequence number of the segment */
+    double          duration;       /* Seconds */
+};
+
+struct webu_hls {
+    pthread_mutex_t      mutex;         /* Protects the items shared with the stream daemon */
+    time_t               request_time;  /* Time of the last request for the stream */
+    unsigned char       *init;          /* The ftyp and moov of the stream */
+    size_t               init_len;
+    struct webu_hls_seg  segs[HLS_SEGMENTS];
+    int64_t              seq_next;      /* Sequence number of the next segment */
+
+    /* The rest is only used on the motion loop */
+    AVFormatContext     *oc;
+    AVStream            *strm;
+    unsigned char       *out;           /* Muxer output not yet published */
+    size_t               out_len;
+    size_t               out_alloc;
+    struct packet_item  *pkts;          /* Packets taken from the camera for the remux */
+    int                  pkts_size;
+    int64_t              idnbr;         /* idnbr of the last packet taken, 0 before the first */
+    int64_t              last_pts;
+    int                  frames;        /* Packets written since the muxer was opened */
+    int                  waitkey;       /* Boolean for whether to skip packets up to a key frame */
+    int                  failed;        /* Boolean for whether the muxer could not be opened */
+    struct timeval       start_tv;      /* Time of the first packet and of pts zero */
+    struct timeval       seg_tv;        /* Time of the first packet of the current segment */
+};
+
+#if (MYFFVER >= 61000)
+static int webu_hls_mux_output(void *opaque, const uint8_t *buf, int buf_size)
+#else
+static int webu_hls_mux_output(void *opaque, uint8_t *buf, int buf_size)
+#endif
+{
+    /* Collect the output of the muxer until it is published */
+    struct webu_hls *hls = opaque;
+
+    if ((hls->out_len + buf_size) > hls->out_alloc) {
+        hls->out_alloc = (hls->out_len + buf_size) * 2;
+        hls->out = myrealloc(hls->out, hls->out_alloc, "webu_hls_mux_output");
+    }
+    memcpy(hls->out + hls->out_len, buf, buf_size);
+    hls->out_len += buf_size;
+
+    return buf_size;
+}
+
+static void webu_hls_mux_reset(struct webu_hls *hls)
+{
+    int indx;
+
+    pthread_mutex_lock(&hls->mutex);
+        free(hls->init);
+        hls->init = NULL;
+        hls->init_len = 0;
+        for (indx = 0; indx < HLS_SEGMENTS; indx++) {
+            free(hls->segs[indx].data);
+            hls->segs[indx].data = NULL;
+            hls->segs[indx].len = 0;
+        }
+    pthread_mutex_unlock(&hls->mutex);
+
+    free(hls->out);
+    hls->out = NULL;
+    hls->out_len = 0;
+    hls->out_alloc = 0;
+    hls->idnbr = 0;
+    hls->frames = 0;
+    hls->last_pts = 0;
+    hls->waitkey = TRUE;
+}
+
+static void webu_hls_mux_close(struct webu_hls *hls)
+{
+    if (hls->oc == NULL) {
+        return;
+    }
+
+    if (hls->frames > 0) {
+        av_write_trailer(hls->oc);
+        MOTION_LOG(INF, TYPE_STREAM, NO_ERRNO, _("HLS stream stopped"));
+    }
+    if (hls->oc->pb != NULL) {
+        av_freep(&hls->oc->pb->buffer);
+        avio_context_free(&hls->oc->pb);
+    }
+    avformat_free_context(hls->oc);
+    hls->oc = NULL;
+    hls->strm = NULL;
+
+    webu_hls_mux_reset(hls);
+}
+
+static int webu_hls_mux_open(struct webu_hls *hls, struct rtsp_context *rtsp_data)
+{
+    AVDictionary *opts;
+    AVStream *stream_in;
+    unsigned char *iobuf;
+    char errstr[128];
+    int retcd;
+
+    webu_hls_mux_reset(hls);
+
+    retcd = avformat_alloc_output_context2(&hls->oc, NULL, "mp4", NULL);
+    if ((retcd < 0) || (hls->oc == NULL)) {
+        MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO, _("Could not allocate the HLS muxer"));
+        return -1;
+    }
+
+    pthread_mutex_lock(&rtsp_data->mutex_transfer);
+        if (rtsp_data->transfer_format == NULL) {
+            pthread_mutex_unlock(&rtsp_data->mutex_transfer);
+            MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO, _("Camera stream not available for HLS"));
+            return -1;
+        }
+        stream_in = rtsp_data->transfer_format->streams[0];
+        hls->strm = avformat_new_stream(hls->oc, NULL);
+        if (hls->strm == NULL) {
+            pthread_mutex_unlock(&rtsp_data->mutex_transfer);
+            MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO, _("Could not alloc stream"));
+            return -1;
+        }
+        retcd = avcodec_parameters_copy(hls->strm->codecpar, stream_in->codecpar);
+    pthread_mutex_unlock(&rtsp_data->mutex_transfer);
+    if (retcd < 0) {
+        MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO, _("Unable to copy codec parameters"));
+        return -1;
+    }
+    hls->strm->codecpar->codec_tag = 0;
+    hls->strm->time_base = (AVRational){1, 90000};
+
+    iobuf = av_malloc(HLS_IOBUF);
+    hls->oc->pb = avio_alloc_context(iobuf, HLS_IOBUF, 1, hls
+        , NULL, &webu_hls_mux_output, NULL);
+    if (hls->oc->pb == NULL) {
+        av_free(iobuf);
+        MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO, _("Could not allocate the HLS output"));
+        return -1;
+    }
+    hls->oc->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    /* Fragments are only cut when asked for so each segment starts on a key frame */
+    opts = NULL;
+    av_dict_set(&opts, "movflags", "empty_moov+default_base_moof+frag_custom", 0);
+    retcd = avformat_write_header(hls->oc, &opts);
+    av_dict_free(&opts);
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO
+            ,_("Could not write the HLS header %s"), errstr);
+        return -1;
+    }
+    avio_flush(hls->oc->pb);
+
+    pthread_mutex_lock(&hls->mutex);
+        hls->init = hls->out;
+        hls->init_len = hls->out_len;
+    pthread_mutex_unlock(&hls->mutex);
+    hls->out = NULL;
+    hls->out_len = 0;
+    hls->out_alloc = 0;
+
+    MOTION_LOG(INF, TYPE_STREAM, NO_ERRNO, _("HLS stream started"));
+
+    return 0;
+}
+
+/* Publish everything written since the last key frame as the newest segment */
+static void webu_hls_mux_segment(struct webu_hls *hls, struct timeval *tv_end)
+{
+    struct webu_hls_seg *seg;
+    char errstr[128];
+    int retcd;
+
+    retcd = av_write_frame(hls->oc, NULL);
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO
+            ,_("Error while writing HLS fragment: %s"), errstr);
+    }
+    avio_flush(hls->oc->pb);
+
+    pthread_mutex_lock(&hls->mutex);
+        seg = &hls->segs[hls->seq_next % HLS_SEGMENTS];
+        free(seg->data);
+        seg->data = hls->out;
+        seg->len = hls->out_len;
+        seg->seq = hls->seq_next++;
+        seg->duration = (tv_end->tv_sec - hls->seg_tv.tv_sec) +
+            ((tv_end->tv_usec - hls->seg_tv.tv_usec) / 1000000.0);
+    pthread_mutex_unlock(&hls->mutex);
+
+    hls->out = NULL;
+    hls->out_len = 0;
+    hls->out_alloc = 0;
+    hls->seg_tv = *tv_end;
+}
+
+static void webu_hls_mux_packet(struct webu_hls *hls, struct packet_item *item)
+{
+    AVPacket *pkt = item->packet;
+    int64_t pts_interval, pts;
+    char errstr[128];
+    int retcd;
+
+    if (hls->waitkey) {
+        if (!item->iskey) {
+            av_packet_unref(pkt);
+            return;
+        }
+        hls->waitkey = FALSE;
+        if (hls->frames == 0) {
+            hls->start_tv = item->timestamp_tv;
+            hls->seg_tv = item->timestamp_tv;
+        }
+    }
+
+    pts_interval = ((1000000L * (item->timestamp_tv.tv_sec - hls->start_tv.tv_sec)) +
+        item->timestamp_tv.tv_usec - hls->start_tv.tv_usec);
+    pts = av_rescale_q(pts_interval, (AVRational){1, 1000000L}, hls->strm->time_base);
+    if ((hls->frames > 0) && (pts <= hls->last_pts)) {
+        av_packet_unref(pkt);
+        return;
+    }
+
+    if (item->iskey && (hls->frames > 0) &&
+        ((item->timestamp_tv.tv_sec - hls->seg_tv.tv_sec) >= HLS_SEGMENT_MIN)) {
+        webu_hls_mux_segment(hls, &item->timestamp_tv);
+    }
+
+    pkt->pts = pts;
+    pkt->dts = pts;
+    if (hls->frames > 0) {
+        pkt->duration = pts - hls->last_pts;
+    }
+    pkt->stream_index = 0;
+    pkt->pos = -1;
+
+    retcd = av_write_frame(hls->oc, pkt);
+    av_packet_unref(pkt);
+    if (retcd < 0) {
+        av_strerror(retcd, errstr, sizeof(errstr));
+        MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO
+            ,_("Error while writing HLS packet: %s"), errstr);
+        return;
+    }
+
+    hls->last_pts = pts;
+    hls->frames++;
+}
+
+static void webu_hls_mux_grow(struct webu_hls *hls, int need)
+{
+    int indx, newsize;
+
+    if (need <= hls->pkts_size) {
+        return;
+    }
+
+    newsize = need * 2;
+    hls->pkts = myrealloc(hls->pkts
+        , newsize * sizeof(struct packet_item), "webu_hls_mux_grow");
+    for (indx = hls->pkts_size; indx < newsize; indx++) {
+        hls->pkts[indx].packet = my_packet_alloc(NULL);
+        hls->pkts[indx].idnbr = 0;
+        hls->pkts[indx].iskey = FALSE;
+    }
+    hls->pkts_size = newsize;
+}
+
+static void webu_hls_mux_packets(struct webu_hls *hls, struct rtsp_context *rtsp_data)
+{
+    struct packet_item *item;
+    int64_t idnbr, idnbr_first, idnbr_last;
+    int indx, count;
+
+    /* Only references to the packets are taken under the lock as in
+     * the pass-through of the movies.
+     */
+    count = 0;
+    pthread_mutex_lock(&rtsp_data->mutex_pktarray);
+        if (rtsp_data->pktarray_index < 0) {
+            pthread_mutex_unlock(&rtsp_data->mutex_pktarray);
+            return;
+        }
+
+        idnbr_last = rtsp_data->pktarray[rtsp_data->pktarray_index].idnbr;
+        idnbr_first = idnbr_last - rtsp_data->pktarray_size + 1;
+        if (idnbr_first < 1) {
+            idnbr_first = 1;
+        }
+
+        if (hls->idnbr == 0) {
+            /* Start at the most recent key frame so the first segment comes quickly */
+            idnbr = idnbr_first;
+            for (indx = 0; indx < rtsp_data->pktarray_size; indx++) {
+                item = ffmpeg_passthru_item(rtsp_data, idnbr_last - indx);
+                if ((item != NULL) && item->iskey) {
+                    idnbr = idnbr_last - indx;
+                    break;
+                }
+            }
+        } else {
+            idnbr = hls->idnbr + 1;
+            if (idnbr < idnbr_first) {
+                /* Packets were lost so the stream resumes at the next key frame */
+                idnbr = idnbr_first;
+                hls->waitkey = TRUE;
+            }
+        }
+
+        for (; idnbr <= idnbr_last; idnbr++) {
+            item = ffmpeg_passthru_item(rtsp_data, idnbr);
+            if ((item == NULL) || (item->packet->size <= 0)) {
+                continue;
+            }
+            webu_hls_mux_grow(hls, count + 1);
+            if (my_copy_packet(hls->pkts[count].packet, item->packet) < 0) {
+                continue;
+            }
+            hls->pkts[count].idnbr = idnbr;
+            hls->pkts[count].iskey = item->iskey;
+            hls->pkts[count].timestamp_tv = item->timestamp_tv;
+            count++;
+        }
+        hls->idnbr = idnbr_last;
+    pthread_mutex_unlock(&rtsp_data->mutex_pktarray);
+
+    for (indx = 0; indx < count; indx++) {
+        webu_hls_mux_packet(hls, &hls->pkts[indx]);
+    }
+}
+
+/** webu_hls_put
+ *  Called on the motion loop for each image.  Remux the packets that
+ *  arrived from the camera since the last call while the stream is viewed.
+ */
+void webu_hls_put(struct context *cnt)
+{
+    struct webu_hls *hls = cnt->hls;
+    struct rtsp_context *rtsp_data;
+    int active;
+
+    if (hls == NULL) {
+        return;
+    }
+
+    if (cnt->imgs.size_high > 0) {
+        rtsp_data = cnt->rtsp_high;
+    } else {
+        rtsp_data = cnt->rtsp;
+    }
+
+    pthread_mutex_lock(&hls->mutex);
+        active = ((time(NULL) - hls->request_time) < HLS_IDLE_SEC);
+    pthread_mutex_unlock(&hls->mutex);
+
+    if ((!active) || (rtsp_data == NULL) || (!rtsp_data->keep_packets) ||
+        (rtsp_data->status == RTSP_NOTCONNECTED) ||
+        (rtsp_data->status == RTSP_RECONNECTING)) {
+        webu_hls_mux_close(hls);
+        if (!active) {
+            hls->failed = FALSE;
+        }
+        return;
+    }
+
+    if (hls->failed) {
+        return;
+    }
+
+    if (hls->oc == NULL) {
+        if (webu_hls_mux_open(hls, rtsp_data) < 0) {
+            MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO
+                ,_("HLS stream is not available for this camera"));
+            webu_hls_mux_close(hls);
+            hls->failed = TRUE;
+            return;
+        }
+    }
+
+    webu_hls_mux_packets(hls, rtsp_data);
+}
+
+/* Build the live playlist.  Requires the hls mutex */
+static char *webu_hls_playlist(struct webu_hls *hls, size_t *len)
+{
+    struct webu_hls_seg *seg;
+    char *resp;
+    size_t resp_size, resp_used;
+    int64_t seq, seq_first;
+    int target;
+
+    seq_first = hls->seq_next - HLS_SEGMENTS;
+    if (seq_first < 0) {
+        seq_first = 0;
+    }
+
+    target = HLS_SEGMENT_MIN;
+    for (seq = seq_first; seq < hls->seq_next; seq++) {
+        seg = &hls->segs[seq % HLS_SEGMENTS];
+        if ((seg->data != NULL) && ((int)(seg->duration + 0.999) > target)) {
+            target = (int)(seg->duration + 0.999);
+        }
+    }
+
+    resp_size = 256 + (HLS_SEGMENTS * 64);
+    resp = mymalloc(resp_size);
+    resp_used = snprintf(resp, resp_size
+        , "#EXTM3U\n"
+          "#EXT-X-VERSION:7\n"
+          "#EXT-X-TARGETDURATION:%d\n"
+          "#EXT-X-MEDIA-SEQUENCE:%lld\n"
+          "#EXT-X-INDEPENDENT-SEGMENTS\n"
+          "#EXT-X-MAP:URI=\"init.mp4\"\n"
+        , target, (long long)seq_first);
+
+    for (seq = seq_first; seq < hls->seq_next; seq++) {
+        seg = &hls->segs[seq % HLS_SEGMENTS];
+        if (seg->data == NULL) {
+            continue;
+        }
+        resp_used += snprintf(resp + resp_used, resp_size - resp_used
+            , "#EXTINF:%.3f,\n%lld.m4s\n", seg->duration, (long long)seg->seq);
+    }
+
+    *len = resp_used;
+
+    return resp;
+}
+
+/** webu_hls_get
+ *  Return a copy of the playlist, init segment or media segment named by file
+ *  for the stream daemon or NULL when it is not available.  The caller frees
+ *  the copy.  Each request keeps the remux running for HLS_IDLE_SEC.
+ */
+char *webu_hls_get(struct context *cnt, const char *file, size_t *len, const char **mime)
+{
+    struct webu_hls *hls = cnt->hls;
+    struct webu_hls_seg *seg;
+    char *resp;
+    long long seq;
+    char chk;
+
+    if (hls == NULL) {
+        return NULL;
+    }
+
+    resp = NULL;
+    pthread_mutex_lock(&hls->mutex);
+        hls->request_time = time(NULL);
+
+        if (mystreq(file, "stream.m3u8")) {
+            /* An empty playlist tells the player to reload until the first segment */
+            if (hls->init != NULL) {
+                resp = webu_hls_playlist(hls, len);
+            } else {
+                resp = mystrdup("#EXTM3U\n#EXT-X-VERSION:7\n#EXT-X-TARGETDURATION:1\n");
+                *len = strlen(resp);
+            }
+            *mime = "application/vnd.apple.mpegurl";
+
+        } else if (mystreq(file, "init.mp4")) {
+            if (hls->init != NULL) {
+                resp = mymalloc(hls->init_len);
+                memcpy(resp, hls->init, hls->init_len);
+                *len = hls->init_len;
+                *mime = "video/mp4";
+            }
+
+        } else if ((sscanf(file, "%lld.m4%c", &seq, &chk) == 2) &&
+                   (chk == 's') && (seq >= 0)) {
+            seg = &hls->segs[seq % HLS_SEGMENTS];
+            if ((seg->data != NULL) && (seg->seq == seq)) {
+                resp = mymalloc(seg->len);
+                memcpy(resp, seg->data, seg->len);
+                *len = seg->len;
+                *mime = "video/iso.segment";
+            }
+        }
+    pthread_mutex_unlock(&hls->mutex);
+
+    return resp;
+}
+
+void webu_hls_init(struct context *cnt)
+{
+    struct webu_hls *hls;
+
+    cnt->hls = NULL;
+
+    if (!cnt->conf.stream_hls) {
+        return;
+    }
+
+    if (cnt->camera_type != CAMERA_TYPE_RTSP) {
+        MOTION_LOG(WRN, TYPE_STREAM, NO_ERRNO
+            ,_("stream_hls requires a network camera with a rtsp or similar netcam_url"));
+        return;
+    }
+
+    hls = mymalloc(sizeof(struct webu_hls));
+    memset(hls, 0, sizeof(struct webu_hls));
+    pthread_mutex_init(&hls->mutex, NULL);
+    hls->waitkey = TRUE;
+
+    cnt->hls = hls;
+}
+
+void webu_hls_deinit(struct context *cnt)
+{
+    struct webu_hls *hls = cnt->hls;
+    int indx;
+
+    if (hls == NULL) {
+        return;
+    }
+
+    webu_hls_mux_close(hls);
+
+    for (indx = 0; indx < hls->pkts_size; indx++) {
+        my_packet_free(hls->pkts[indx].packet);
+    }
+    free(hls->pkts);
+
+    pthread_mutex_destroy(&hls->mutex);
+    free(hls);
+
+    cnt->hls = NULL;
+}
+
+#else /* No FFmpeg or it is too old */
+
+void webu_hls_put(struct context *cnt)
+{
+    (void)cnt;
+}
+
+char *webu_hls_get(struct context *cnt, const char *file, size_t *len, const char **mime)
+{
+    (void)cnt;
+    (void)file;
+    (void)len;
+    (void)mime;
+    return NULL;
+}
+
+void webu_hls_init(struct context *cnt)
+{
+    cnt->hls = NULL;
+
+    if (cnt->conf.stream_hls) {
+        MOTION_LOG(WRN, TYPE_STREAM, NO_ERRNO
+            ,_("stream_hls requires Motion to be built with a recent FFmpeg"));
+    }
+}
+
+void webu_hls_deinit(struct context *cnt)
+{
+    (void)cnt;
+}
+
+#endif
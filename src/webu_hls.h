@@ -0,0 +1,30 @@
+/*   This file is part of Motion.
+ *
+ *   Motion is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Motion is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Motion.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  webu_hls.h
+ *    Headers associated with functions in the webu_hls.c module.
+ */
+
+#ifndef _INCLUDE_WEBU_HLS_H_
+#define _INCLUDE_WEBU_HLS_H_
+
+void webu_hls_init(struct context *cnt);
+void webu_hls_deinit(struct context *cnt);
+void webu_hls_put(struct context *cnt);
+char *webu_hls_get(struct context *cnt, const char *file, size_t *len, const char **mime);
+
+#endif
@@ -426,6 +426,7 @@ static void webu_html_h3desc(struct webui_ctx *webui)
             "  </div>\n"
             ,_("All Cameras")
             ,(!webui->cntlst[0]->running)? _("Not running") :
+                (webui->cntlst[0]->connecting)? _("Connecting"):
                 (webui->cntlst[0]->lost_connection)? _("Lost connection"):
                 (webui->cntlst[0]->pause)? _("Paused"):_("Active")
             );
@@ -842,6 +843,7 @@ static void webu_html_script_camera_thread(struct webui_ctx *webui)
                 ,_("Camera")
                 , webui->cntlst[indx]->camera_id
                 ,(!webui->cntlst[indx]->running)? _("Not running") :
+                 (webui->cntlst[indx]->connecting)? _("Connecting"):
                  (webui->cntlst[indx]->lost_connection)? _("Lost connection"):
                  (webui->cntlst[indx]->pause)? _("Paused"):_("Active")
              );
@@ -851,6 +853,7 @@ static void webu_html_script_camera_thread(struct webui_ctx *webui)
                 " class='header-center' >%s (%s)</h3>\"\n"
                 , webui->cntlst[indx]->conf.camera_name
                 ,(!webui->cntlst[indx]->running)? _("Not running") :
+                 (webui->cntlst[indx]->connecting)? _("Connecting"):
                  (webui->cntlst[indx]->lost_connection)? _("Lost connection"):
                  (webui->cntlst[indx]->pause)? _("Paused"):_("Active")
                 );
@@ -17,16 +17,38 @@
 /*
  *    webu_status.c
  *
- *    Status reports in JSON format via stream HTTP endpoint.
+ *    Status reports in JSON format via stream HTTP endpoint, the
+ *    events of the event index, the metrics page in the Prometheus text
+ *    format and the trace of the threads in the Chrome trace format for
+ *    the webcontrol.
+ *
+ *    The camera status and the metrics are polled by dashboards, often many
+ *    times a second for all the cameras.  They are cached for the second
+ *    they were made in, as their times are in seconds, and dropped earlier
+ *    by webu_status_invalidate when a web action or config change may have
+ *    changed them.  The cached body carries an ETag so a client with the
+ *    same answer gets a 304, and the gzip form is compressed once.
  *
  */
 
 #include <ctype.h>
 #include <inttypes.h>
 
+#include "translate.h"
 #include "motion.h"
 #include "webu.h"
 #include "webu_status.h"
+#include "logger.h"
+#include "util.h"
+#include "framepool.h"
+#include "metrics.h"
+#include "spawner.h"
+#include "trace.h"
+#include "eventidx.h"
+#include "cluster.h"
+#ifdef HAVE_ZLIB
+    #include <zlib.h>
+#endif
 
 /* Conservatively encode characters in an array as a JSON string */
 static void webu_json_write_string(struct webui_ctx *webui, const char *str)
@@ -168,6 +190,12 @@ static void webu_json_cam_status_single(struct webui_ctx *webui, struct context
         { "connectionlosttime", cnt->connectionlosttime },
         { NULL, 0 },
     }, *cur_timestamp;
+    struct cluster_report report;
+    int clustered, remote;
+
+    /* The cameras run by other nodes of a cluster are as they reported */
+    clustered = cluster_report(cnt, &report);
+    remote = clustered && report.remote;
 
     snprintf(buf, sizeof(buf), "{\"id\": %d, \"name\": ", cnt->camera_id);
 
@@ -185,16 +213,37 @@ static void webu_json_cam_status_single(struct webui_ctx *webui, struct context
              ", \"fps\": %u"
              ", \"missing_frame_counter\": %u"
              ", \"running\": %u"
+             ", \"connecting\": %u"
              ", \"lost_connection\": %u"
+             ", \"frame_pool_bytes\": %lu"
+             ", \"frame_pool_budget\": %lu"
+             ", \"database_queue\": %d"
+             ", \"database_dropped\": %lu"
+             ", \"database_latency_ms\": %ld"
              , cnt->imgs.width
              , cnt->imgs.height
-             , cnt->lastrate
+             , remote ? (unsigned int)report.fps : cnt->lastrate
              , cnt->missing_frame_counter
-             , cnt->running
-             , cnt->lost_connection);
+             , remote ? (unsigned int)report.running : (unsigned int)cnt->running
+             , cnt->connecting
+             , cnt->lost_connection
+             , (unsigned long)cnt->framepool_bytes
+             , (unsigned long)framepool_budget()
+             , cnt->dbse_pending
+             , cnt->dbse_dropped
+             , cnt->dbse_latency / 1000);
 
     webu_write(webui, buf);
 
+    if (clustered) {
+        webu_write(webui, ", \"node\": ");
+        if (report.node[0] == '\0') {
+            webu_write(webui, "null");
+        } else {
+            webu_json_write_string(webui, report.node);
+        }
+    }
+
     webu_write(webui, ", \"currenttime\": ");
     webu_json_write_timestamp(webui, cnt->currenttime);
     webu_write(webui, ", \"currenttime_iso8601\": ");
@@ -232,6 +281,551 @@ static void webu_status_one(struct webui_ctx *webui)
     webu_status_write_list(webui, "camera_status", webu_json_cam_status_single);
 }
 
+/* Write the HELP and TYPE lines of a metric */
+static void webu_metrics_header(struct webui_ctx *webui, const char *name
+        , const char *type, const char *help)
+{
+    char buf[WEBUI_LEN_RESP];
+
+    snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    webu_write(webui, buf);
+}
+
+/* Write the stage histograms of one camera */
+static void webu_metrics_hist(struct webui_ctx *webui, struct context *cnt
+        , struct metrics_hist *hist)
+{
+    char buf[WEBUI_LEN_RESP];
+    unsigned long cumulative;
+    int indx, bucket;
+
+    for (indx = 0; indx < METRICS_STAGES; indx++) {
+        cumulative = 0;
+        for (bucket = 0; bucket < METRICS_BUCKETS; bucket++) {
+            cumulative += hist->bucket[indx][bucket];
+            snprintf(buf, sizeof(buf)
+                , "motion_stage_seconds_bucket{camera=\"%d\",stage=\"%s\",le=\"%g\"} %lu\n"
+                , cnt->camera_id, metrics_stage_name(indx)
+                , (double)metrics_bucket_usec[bucket] / 1000000.0, cumulative);
+            webu_write(webui, buf);
+        }
+        snprintf(buf, sizeof(buf)
+            , "motion_stage_seconds_bucket{camera=\"%d\",stage=\"%s\",le=\"+Inf\"} %lu\n"
+              "motion_stage_seconds_sum{camera=\"%d\",stage=\"%s\"} %.6f\n"
+              "motion_stage_seconds_count{camera=\"%d\",stage=\"%s\"} %lu\n"
+            , cnt->camera_id, metrics_stage_name(indx), hist->count[indx]
+            , cnt->camera_id, metrics_stage_name(indx)
+            , (double)hist->sum_usec[indx] / 1000000.0
+            , cnt->camera_id, metrics_stage_name(indx), hist->count[indx]);
+        webu_write(webui, buf);
+    }
+}
+
+/* Write one value of a metric for each of the cameras */
+static void webu_metrics_values(struct webui_ctx *webui, struct context **cams
+        , struct metrics_hist *hists, int cam_count, const char *name
+        , const char *type, const char *help
+        , unsigned long (*value)(struct context *, struct metrics_hist *))
+{
+    char buf[WEBUI_LEN_RESP];
+    int indx;
+
+    webu_metrics_header(webui, name, type, help);
+    for (indx = 0; indx < cam_count; indx++) {
+        snprintf(buf, sizeof(buf), "%s{camera=\"%d\"} %lu\n"
+            , name, cams[indx]->camera_id, value(cams[indx], &hists[indx]));
+        webu_write(webui, buf);
+    }
+}
+
+static unsigned long webu_metrics_frames(struct context *cnt, struct metrics_hist *hist)
+{
+    (void)cnt;
+    return hist->frames;
+}
+
+static unsigned long webu_metrics_missed(struct context *cnt, struct metrics_hist *hist)
+{
+    (void)cnt;
+    return hist->frames_missed;
+}
+
+static unsigned long webu_metrics_decode(struct context *cnt, struct metrics_hist *hist)
+{
+    (void)cnt;
+    return hist->decode_errors;
+}
+
+static unsigned long webu_metrics_dropped(struct context *cnt, struct metrics_hist *hist)
+{
+    (void)cnt;
+    return hist->stream_dropped;
+}
+
+static unsigned long webu_metrics_stalls(struct context *cnt, struct metrics_hist *hist)
+{
+    (void)cnt;
+    return hist->capture_stalls;
+}
+
+static unsigned long webu_metrics_capdepth(struct context *cnt, struct metrics_hist *hist)
+{
+    (void)cnt;
+    return (unsigned long)hist->capture_depth;
+}
+
+static unsigned long webu_metrics_ringused(struct context *cnt, struct metrics_hist *hist)
+{
+    (void)cnt;
+    return (unsigned long)hist->ring_used;
+}
+
+static unsigned long webu_metrics_ringsize(struct context *cnt, struct metrics_hist *hist)
+{
+    (void)cnt;
+    return (unsigned long)hist->ring_size;
+}
+
+static unsigned long webu_metrics_fps(struct context *cnt, struct metrics_hist *hist)
+{
+    (void)hist;
+    return (unsigned long)cnt->lastrate;
+}
+
+static unsigned long webu_metrics_dbqueue(struct context *cnt, struct metrics_hist *hist)
+{
+    (void)hist;
+    return (unsigned long)cnt->dbse_pending;
+}
+
+static unsigned long webu_metrics_dbdropped(struct context *cnt, struct metrics_hist *hist)
+{
+    (void)hist;
+    return cnt->dbse_dropped;
+}
+
+/** webu_status_metrics
+ *  The metrics page in the Prometheus text format.  The histograms are
+ *  copied from each camera first so that the lines of a metric are
+ *  written together as the format requires.
+ */
+static void webu_status_metrics(struct webui_ctx *webui)
+{
+    struct context **cams;
+    struct metrics_hist *hists;
+    char buf[WEBUI_LEN_RESP];
+    int indx, indx_st, cam_count;
+
+    if (webui->thread_nbr == 0) {
+        if (webui->cam_threads == 1) {
+            indx_st = 0;
+        } else {
+            indx_st = 1;
+        }
+    } else {
+        indx_st = -1;
+    }
+
+    if (indx_st == -1) {
+        cam_count = 1;
+    } else {
+        cam_count = webui->cam_threads - indx_st;
+    }
+    cams = mymalloc(cam_count * sizeof(struct context *));
+    hists = mymalloc(cam_count * sizeof(struct metrics_hist));
+
+    for (indx = 0; indx < cam_count; indx++) {
+        if (indx_st == -1) {
+            cams[indx] = webui->cnt;
+        } else {
+            cams[indx] = webui->cntlst[indx_st + indx];
+        }
+        metrics_snapshot(cams[indx], &hists[indx]);
+    }
+
+    webu_metrics_header(webui, "motion_stage_seconds", "histogram"
+        , "Time taken by each stage of the motion loop per frame.");
+    for (indx = 0; indx < cam_count; indx++) {
+        webu_metrics_hist(webui, cams[indx], &hists[indx]);
+    }
+
+    webu_metrics_values(webui, cams, hists, cam_count, "motion_frames_total"
+        , "counter", "Frames processed by the motion loop.", webu_metrics_frames);
+    webu_metrics_values(webui, cams, hists, cam_count, "motion_frames_missed_total"
+        , "counter", "Frames the camera did not deliver.", webu_metrics_missed);
+    webu_metrics_values(webui, cams, hists, cam_count, "motion_decode_errors_total"
+        , "counter", "Packets rejected by the network camera decoder.", webu_metrics_decode);
+    webu_metrics_values(webui, cams, hists, cam_count, "motion_stream_dropped_total"
+        , "counter", "Stream images dropped by the stream encoder.", webu_metrics_dropped);
+    webu_metrics_values(webui, cams, hists, cam_count, "motion_capture_stalls_total"
+        , "counter", "Times the capture thread waited on a full queue.", webu_metrics_stalls);
+    webu_metrics_values(webui, cams, hists, cam_count, "motion_capture_queue_depth"
+        , "gauge", "Frames waiting in the capture queue.", webu_metrics_capdepth);
+    webu_metrics_values(webui, cams, hists, cam_count, "motion_ring_used"
+        , "gauge", "Images held in the pre-capture ring.", webu_metrics_ringused);
+    webu_metrics_values(webui, cams, hists, cam_count, "motion_ring_size"
+        , "gauge", "Size of the pre-capture ring.", webu_metrics_ringsize);
+    webu_metrics_values(webui, cams, hists, cam_count, "motion_fps"
+        , "gauge", "Frames per second of the last second.", webu_metrics_fps);
+    webu_metrics_values(webui, cams, hists, cam_count, "motion_database_queue_depth"
+        , "gauge", "Queries waiting for the database thread.", webu_metrics_dbqueue);
+    webu_metrics_values(webui, cams, hists, cam_count, "motion_database_dropped_total"
+        , "counter", "Queries dropped on a full database queue.", webu_metrics_dbdropped);
+
+    webu_metrics_header(webui, "motion_hook_queue_bytes", "gauge"
+        , "Bytes of commands waiting for the command spawner.");
+    snprintf(buf, sizeof(buf), "motion_hook_queue_bytes %d\n", spawner_pending());
+    webu_write(webui, buf);
+
+    webu_metrics_header(webui, "motion_log_dropped_total", "counter"
+        , "Log messages dropped on a full log buffer.");
+    snprintf(buf, sizeof(buf), "motion_log_dropped_total %lu\n", log_dropped());
+    webu_write(webui, buf);
+
+    free(hists);
+    free(cams);
+}
+
+struct webu_trace_ctx {
+    struct webui_ctx   *webui;
+    int                 first;
+};
+
+/* Write the events of one thread of the trace */
+static void webu_trace_thread(void *arg, int tid, const char *threadname
+        , struct trace_event *events, int count)
+{
+    struct webu_trace_ctx *trace_ctx = arg;
+    struct webui_ctx *webui = trace_ctx->webui;
+    char buf[WEBUI_LEN_RESP];
+    int indx;
+
+    snprintf(buf, sizeof(buf)
+        , "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d"
+          ", \"args\": {\"name\": "
+        , trace_ctx->first ? "" : ",\n", tid);
+    trace_ctx->first = FALSE;
+    webu_write(webui, buf);
+    webu_json_write_string(webui, threadname);
+    webu_write(webui, "}}");
+
+    for (indx = 0; indx < count; indx++) {
+        snprintf(buf, sizeof(buf)
+            , ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d"
+              ", \"ts\": %lld, \"dur\": %ld}"
+            , events[indx].name, tid, events[indx].ts_usec, events[indx].dur_usec);
+        webu_write(webui, buf);
+    }
+}
+
+/** webu_status_trace
+ *  The spans recorded by the threads in the Chrome trace format that can
+ *  be opened in Perfetto.
+ */
+void webu_status_trace(struct webui_ctx *webui)
+{
+    struct webu_trace_ctx trace_ctx;
+
+    trace_ctx.webui = webui;
+    trace_ctx.first = TRUE;
+
+    webu_write(webui, "{\"traceEvents\": [\n");
+    trace_collect(webu_trace_thread, &trace_ctx);
+    webu_write(webui, "\n], \"displayTimeUnit\": \"ms\"}\n");
+}
+
+struct webu_events_ctx {
+    struct webui_ctx   *webui;
+    int                 first;
+};
+
+/* Name of the FTYPE of a file of an event */
+static const char *webu_events_ftype(int ftype)
+{
+    switch (ftype) {
+    case FTYPE_IMAGE:           return "picture";
+    case FTYPE_IMAGE_SNAPSHOT:  return "snapshot";
+    case FTYPE_IMAGE_MOTION:    return "picture_motion";
+    case FTYPE_MPEG:            return "movie";
+    case FTYPE_MPEG_MOTION:     return "movie_motion";
+    case FTYPE_MPEG_TIMELAPSE:  return "timelapse";
+    default:                    return "other";
+    }
+}
+
+/* Write one event found in the index */
+static void webu_events_single(void *arg, const struct eventidx_record *rec
+        , char *paths)
+{
+    struct webu_events_ctx *events_ctx = arg;
+    struct webui_ctx *webui = events_ctx->webui;
+    char buf[WEBUI_LEN_RESP];
+    char *pos, *path;
+    int ftype, first;
+
+    webu_write(webui, events_ctx->first ? "{\"id\": " : ", {\"id\": ");
+    events_ctx->first = FALSE;
+    webu_json_write_string(webui, rec->eventid);
+
+    snprintf(buf, sizeof(buf)
+        , ", \"event\": %d, \"start\": %" PRId64 ", \"end\": %" PRId64
+          ", \"frames\": %d, \"diffs_max\": %d, \"bytes\": %" PRId64
+          ", \"box\": {\"minx\": %d, \"miny\": %d, \"maxx\": %d, \"maxy\": %d}"
+          ", \"files\": ["
+        , rec->event_nr, rec->start, rec->end, rec->frames, rec->diffs_max, rec->bytes
+        , rec->minx, rec->miny, rec->maxx, rec->maxy);
+    webu_write(webui, buf);
+
+    first = TRUE;
+    pos = paths;
+    while ((path = eventidx_path_next(&pos, &ftype)) != NULL) {
+        webu_write(webui, first ? "{\"type\": \"" : ", {\"type\": \"");
+        first = FALSE;
+        webu_write(webui, webu_events_ftype(ftype));
+        webu_write(webui, "\", \"path\": ");
+        webu_json_write_string(webui, path);
+        webu_write(webui, "}");
+    }
+
+    webu_write(webui, "]}");
+}
+
+/* Write the events of a camera in the time range asked for */
+static void webu_json_cam_events_single(struct webui_ctx *webui, struct context *cnt)
+{
+    struct webu_events_ctx events_ctx;
+    const char *value;
+    char buf[WEBUI_LEN_RESP];
+    time_t from, to;
+    int limit;
+
+    from = 0;
+    to = 0;
+    limit = 0;
+    value = MHD_lookup_connection_value(webui->connection, MHD_GET_ARGUMENT_KIND, "from");
+    if (value != NULL) {
+        from = (time_t)strtoll(value, NULL, 10);
+    }
+    value = MHD_lookup_connection_value(webui->connection, MHD_GET_ARGUMENT_KIND, "to");
+    if (value != NULL) {
+        to = (time_t)strtoll(value, NULL, 10);
+    }
+    value = MHD_lookup_connection_value(webui->connection, MHD_GET_ARGUMENT_KIND, "limit");
+    if (value != NULL) {
+        limit = atoi(value);
+    }
+
+    snprintf(buf, sizeof(buf), "{\"id\": %d, \"events\": [", cnt->camera_id);
+    webu_write(webui, buf);
+
+    events_ctx.webui = webui;
+    events_ctx.first = TRUE;
+    if (eventidx_query(cnt, from, to, limit, webu_events_single, &events_ctx) < 0) {
+        webu_write(webui, "], \"indexed\": false}");
+    } else {
+        webu_write(webui, "], \"indexed\": true}");
+    }
+}
+
+/** webu_status_events
+ *  The events in the index of the cameras which overlap the time range of
+ *  the from and to parameters, as seconds since the epoch.  limit is the
+ *  most events answered for each camera.
+ *  /{camid}/events.json?from={time}&to={time}&limit={count}
+ */
+static void webu_status_events(struct webui_ctx *webui)
+{
+    webu_status_write_list(webui, "cameras", webu_json_cam_events_single);
+    if (webui->thread_nbr != 0) {
+        webu_write(webui, "\n");
+    }
+}
+
+/* Answers kept by the cache and the smallest body worth compressing */
+#define WEBU_CACHE_SIZE     16
+#define WEBU_CACHE_GZIP_MIN 1024
+
+struct webu_cache_entry {
+    const struct context    *cnt;
+    enum WEBUI_CNCT         cnct_type;
+    int                     thread_nbr;
+    unsigned long           version;        /* webu_cache.version when made */
+    time_t                  made;           /* Second the answer was made in, 0 for unused */
+    unsigned long           used;           /* webu_cache.tick when last answered */
+    char                    etag[24];
+    char                    *body;
+    size_t                  body_len;
+    size_t                  body_alloc;
+    unsigned char           *gzip;          /* The gzip form of body, once asked for */
+    size_t                  gzip_len;
+    int                     gzip_done;
+};
+
+static struct {
+    pthread_mutex_t         mutex;
+    unsigned long           version;
+    unsigned long           tick;
+    struct webu_cache_entry entry[WEBU_CACHE_SIZE];
+} webu_cache = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/** webu_status_invalidate
+ *  Drop the cached answers, the config or the state of a camera changed.
+ */
+void webu_status_invalidate(void)
+{
+    pthread_mutex_lock(&webu_cache.mutex);
+        webu_cache.version++;
+    pthread_mutex_unlock(&webu_cache.mutex);
+}
+
+/* Entry of the answer asked for by webui, the oldest one is reused when not found */
+static struct webu_cache_entry *webu_cache_find(struct webui_ctx *webui)
+{
+    struct webu_cache_entry *entry, *oldest;
+    int indx;
+
+    oldest = &webu_cache.entry[0];
+    for (indx = 0; indx < WEBU_CACHE_SIZE; indx++) {
+        entry = &webu_cache.entry[indx];
+        if ((entry->made != 0) && (entry->cnt == webui->cnt) &&
+            (entry->cnct_type == webui->cnct_type) &&
+            (entry->thread_nbr == webui->thread_nbr)) {
+            return entry;
+        }
+        if (entry->used < oldest->used) {
+            oldest = entry;
+        }
+    }
+
+    oldest->cnt = webui->cnt;
+    oldest->cnct_type = webui->cnct_type;
+    oldest->thread_nbr = webui->thread_nbr;
+    oldest->made = 0;
+
+    return oldest;
+}
+
+/* Make the answer of entry with the writer of the page and keep a copy of it */
+static void webu_cache_make(struct webui_ctx *webui, struct webu_cache_entry *entry
+        , void (*writer)(struct webui_ctx *), time_t now)
+{
+    uint64_t hash;
+    size_t indx;
+
+    webui->resp_used = 0;
+    webui->resp_page[0] = '\0';
+    writer(webui);
+
+    if (webui->resp_used + 1 > entry->body_alloc) {
+        entry->body_alloc = webui->resp_used + 1;
+        entry->body = myrealloc(entry->body, entry->body_alloc, "webu_cache_make");
+    }
+    memcpy(entry->body, webui->resp_page, webui->resp_used + 1);
+    entry->body_len = webui->resp_used;
+
+    /* FNV-1a of the body so an unchanged answer keeps its ETag across seconds */
+    hash = 14695981039346656037ULL;
+    for (indx = 0; indx < entry->body_len; indx++) {
+        hash = (hash ^ (unsigned char)entry->body[indx]) * 1099511628211ULL;
+    }
+    snprintf(entry->etag, sizeof(entry->etag), "\"%016" PRIx64 "\"", hash);
+
+    entry->gzip_done = FALSE;
+    entry->version = webu_cache.version;
+    entry->made = now;
+}
+
+#ifdef HAVE_ZLIB
+/* Compress the body of entry to its gzip form, gzip_len is left 0 on failure */
+static void webu_cache_gzip(struct webu_cache_entry *entry)
+{
+    z_stream strm;
+    size_t bound;
+
+    entry->gzip_done = TRUE;
+    entry->gzip_len = 0;
+
+    memset(&strm, 0, sizeof(strm));
+    /* 16 added to the window bits asks for the gzip header and trailer */
+    if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8
+            , Z_DEFAULT_STRATEGY) != Z_OK) {
+        MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO, _("Unable to compress the status"));
+        return;
+    }
+
+    bound = deflateBound(&strm, entry->body_len);
+    free(entry->gzip);
+    entry->gzip = mymalloc(bound);
+
+    strm.next_in = (unsigned char *)entry->body;
+    strm.avail_in = entry->body_len;
+    strm.next_out = entry->gzip;
+    strm.avail_out = bound;
+    if (deflate(&strm, Z_FINISH) == Z_STREAM_END) {
+        entry->gzip_len = bound - strm.avail_out;
+    }
+    deflateEnd(&strm);
+}
+#endif /* HAVE_ZLIB */
+
+/* Whether the client accepts a gzip answer */
+static int webu_cache_accept_gzip(struct webui_ctx *webui)
+{
+    const char *accept;
+
+    accept = MHD_lookup_connection_value(webui->connection
+        , MHD_HEADER_KIND, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+
+    return ((accept != NULL) && (strstr(accept, "gzip") != NULL));
+}
+
+/** webu_status_cached
+ *  Answer the page of writer from the cache, making it when the cached
+ *  one is from an older second or was invalidated.  The answers are made
+ *  under the lock so the clients polling at the same time share one.
+ */
+static void webu_status_cached(struct webui_ctx *webui, void (*writer)(struct webui_ctx *))
+{
+    struct webu_cache_entry *entry;
+    const char *match;
+    time_t now;
+
+    match = MHD_lookup_connection_value(webui->connection
+        , MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_NONE_MATCH);
+    now = time(NULL);
+
+    pthread_mutex_lock(&webu_cache.mutex);
+        entry = webu_cache_find(webui);
+        if ((entry->made != now) || (entry->version != webu_cache.version)) {
+            webu_cache_make(webui, entry, writer, now);
+        }
+        entry->used = ++webu_cache.tick;
+
+        snprintf(webui->resp_etag, sizeof(webui->resp_etag), "%s", entry->etag);
+        webui->resp_used = 0;
+
+        if ((match != NULL) &&
+            ((strstr(match, entry->etag) != NULL) || mystreq(match, "*"))) {
+            webui->resp_notmodified = TRUE;
+        } else if ((entry->body_len >= WEBU_CACHE_GZIP_MIN) && webu_cache_accept_gzip(webui)) {
+            #ifdef HAVE_ZLIB
+                if (!entry->gzip_done) {
+                    webu_cache_gzip(entry);
+                }
+                if (entry->gzip_len > 0) {
+                    webu_write_len(webui, (const char *)entry->gzip, entry->gzip_len);
+                    webui->resp_gzip = TRUE;
+                }
+            #endif /* HAVE_ZLIB */
+        }
+        if (!webui->resp_notmodified && !webui->resp_gzip) {
+            webu_write_len(webui, entry->body, entry->body_len);
+        }
+    pthread_mutex_unlock(&webu_cache.mutex);
+}
+
 static void webu_status_badreq(struct webui_ctx *webui)
 {
     webu_write(webui, "{ \"error\": \"Server did not understand the request\" }");
@@ -241,11 +835,19 @@ void webu_status_main(struct webui_ctx *webui)
 {
     switch (webui->cnct_type) {
     case WEBUI_CNCT_STATUS_LIST:
-        webu_status_list(webui);
+        webu_status_cached(webui, webu_status_list);
         break;
 
     case WEBUI_CNCT_STATUS_ONE:
-        webu_status_one(webui);
+        webu_status_cached(webui, webu_status_one);
+        break;
+
+    case WEBUI_CNCT_METRICS:
+        webu_status_cached(webui, webu_status_metrics);
+        break;
+
+    case WEBUI_CNCT_EVENTS:
+        webu_status_events(webui);
         break;
 
     default:
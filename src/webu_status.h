@@ -23,5 +23,7 @@
 #define _INCLUDE_WEBU_STATUS_H_
 
 void webu_status_main(struct webui_ctx *webui);
+void webu_status_invalidate(void);
+void webu_status_trace(struct webui_ctx *webui);
 
 #endif
@@ -23,7 +23,10 @@
  *    webu_stream*      - All functions in this module
  *    webu_stream_mjpeg*    - Create the motion-jpeg stream for the user
  *    webu_stream_static*   - Create the static jpg image for the user.
+ *    webu_stream_hls       - Send a playlist or segment of the HLS stream
  *    webu_stream_checks    - Edit/validate request from user
+ *    webu_stream_*buf      - Shared image buffers written by the motion loop
+ *    webu_stream_pool*     - Pacing of the streams on the shared stream daemon
  */
 
 #include "motion.h"
@@ -31,27 +34,176 @@
 #include "logger.h"
 #include "webu.h"
 #include "webu_stream.h"
+#include "webu_hls.h"
 #include "translate.h"
 
-static void webu_stream_mjpeg_checkbuffers(struct webui_ctx *webui)
+/*
+ * The threads of the shared stream daemon serve many connections each so a
+ * stream must not sleep until its next image is due.  The connection is
+ * suspended instead and kept on this list until a single pacing thread
+ * resumes it at the due time or, when it waits for a new image, as soon as
+ * webu_stream_putbuf publishes one.
+ */
+static struct {
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+    pthread_t           thread_id;
+    int                 running;
+    int                 finish;
+    struct webui_ctx    *list;          /* Suspended connections */
+} webu_stream_pool = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER
+};
+
+/* Must be called with mutex_stream held */
+static void webu_stream_unref_locked(struct stream_buffer *buf)
 {
-    /* Allocate buffers if needed */
-    if (webui->resp_size < (size_t)webui->cnt->imgs.size_norm) {
-        if (webui->resp_page   != NULL) {
-            free(webui->resp_page);
+    struct stream_data *strm = buf->strm;
+
+    buf->ref_count--;
+    if (buf->ref_count > 0) {
+        return;
+    }
+
+    if (strm->spare == NULL) {
+        strm->spare = buf;
+    } else {
+        free(buf->jpeg_data);
+        free(buf);
+    }
+}
+
+/* Resume the suspended connections of the shared daemon waiting for a new image of strm */
+static void webu_stream_pool_wake(struct stream_data *strm)
+{
+    struct webui_ctx *webui;
+    int found;
+
+    if (!webu_stream_pool.running) {
+        return;
+    }
+
+    found = FALSE;
+    pthread_mutex_lock(&webu_stream_pool.mutex);
+        for (webui = webu_stream_pool.list; webui != NULL; webui = webui->stream_next) {
+            if (webui->stream_wait == strm) {
+                timerclear(&webui->stream_due);
+                found = TRUE;
+            }
         }
-        webui->resp_page   = mymalloc(webui->cnt->imgs.size_norm);
-        memset(webui->resp_page,'\0',webui->cnt->imgs.size_norm);
-        webui->resp_size = webui->cnt->imgs.size_norm;
-        webui->resp_used = 0;
+        if (found) {
+            pthread_cond_signal(&webu_stream_pool.cond);
+        }
+    pthread_mutex_unlock(&webu_stream_pool.mutex);
+}
+
+/**
+ * webu_stream_getbuf
+ *   Return a buffer for the motion loop to encode the next image of strm into.
+ *   The buffer is not visible to the connections until webu_stream_putbuf.
+ */
+struct stream_buffer *webu_stream_getbuf(struct context *cnt, struct stream_data *strm)
+{
+    struct stream_buffer *buf;
+
+    pthread_mutex_lock(&cnt->mutex_stream);
+        buf = strm->spare;
+        strm->spare = NULL;
+    pthread_mutex_unlock(&cnt->mutex_stream);
+
+    /* A buffer released after a restart may be for another image size */
+    if ((buf != NULL) && (buf->alloc_size < cnt->imgs.size_norm)) {
+        free(buf->jpeg_data);
+        free(buf);
+        buf = NULL;
+    }
+
+    if (buf == NULL) {
+        buf = mymalloc(sizeof(struct stream_buffer));
+        buf->jpeg_data = mymalloc(cnt->imgs.size_norm);
+        buf->alloc_size = cnt->imgs.size_norm;
+        buf->strm = strm;
     }
+    buf->jpeg_size = 0;
+    buf->ref_count = 0;
 
+    return buf;
 }
 
-static void webu_stream_mjpeg_delay(struct webui_ctx *webui)
+/**
+ * webu_stream_putbuf
+ *   Publish buf as the latest image of strm.  The lock only covers the
+ *   pointer swap.  Connections still sending the previous image keep it
+ *   until they release it.
+ */
+void webu_stream_putbuf(struct context *cnt, struct stream_data *strm, struct stream_buffer *buf)
 {
-    /* Sleep required time to get to the user requested frame
-     * rate for the stream
+    pthread_mutex_lock(&cnt->mutex_stream);
+        buf->ref_count = 1;
+        if (strm->jpeg != NULL) {
+            webu_stream_unref_locked(strm->jpeg);
+        }
+        strm->jpeg = buf;
+        strm->seq++;
+        pthread_cond_broadcast(&cnt->cond_stream);
+    pthread_mutex_unlock(&cnt->mutex_stream);
+
+    webu_stream_pool_wake(strm);
+}
+
+void webu_stream_unref(struct context *cnt, struct stream_buffer *buf)
+{
+    pthread_mutex_lock(&cnt->mutex_stream);
+        webu_stream_unref_locked(buf);
+    pthread_mutex_unlock(&cnt->mutex_stream);
+}
+
+/**
+ * webu_stream_freebufs
+ *   Release the images of strm when the camera stops.  A connection still
+ *   holding the latest image parks it as the spare when it is done, which
+ *   the next start of the camera or the shutdown frees.
+ */
+void webu_stream_freebufs(struct context *cnt, struct stream_data *strm)
+{
+    pthread_mutex_lock(&cnt->mutex_stream);
+        if (strm->jpeg != NULL) {
+            webu_stream_unref_locked(strm->jpeg);
+            strm->jpeg = NULL;
+        }
+        if (strm->spare != NULL) {
+            free(strm->spare->jpeg_data);
+            free(strm->spare);
+            strm->spare = NULL;
+        }
+    pthread_mutex_unlock(&cnt->mutex_stream);
+}
+
+/* Take a reference on the latest image of strm, NULL if there is none yet.
+ * seq is set to the number of that image when given.
+ */
+static struct stream_buffer *webu_stream_ref(struct context *cnt, struct stream_data *strm
+            , unsigned long *seq)
+{
+    struct stream_buffer *buf;
+
+    pthread_mutex_lock(&cnt->mutex_stream);
+        buf = strm->jpeg;
+        if (buf != NULL) {
+            buf->ref_count++;
+        }
+        if (seq != NULL) {
+            *seq = strm->seq;
+        }
+    pthread_mutex_unlock(&cnt->mutex_stream);
+
+    return buf;
+}
+
+static long webu_stream_mjpeg_wait(struct webui_ctx *webui)
+{
+    /* Return the nanoseconds still to wait to get to the user requested
+     * frame rate for the stream
      */
 
     long   stream_rate;
@@ -74,68 +226,281 @@ static void webu_stream_mjpeg_delay(struct webui_ctx *webui)
 
     if (webui->stream_fps >= 1) {
         stream_rate = ( (1000000000 / webui->stream_fps) - stream_delay);
-        if ((stream_rate > 0) && (stream_rate < 1000000000)) {
-            SLEEP(0,stream_rate);
-        } else if (stream_rate == 1000000000) {
-            SLEEP(1,0);
+        if ((stream_rate > 0) && (stream_rate <= 1000000000)) {
+            return stream_rate;
         }
     }
-    gettimeofday(&webui->time_last, NULL);
 
+    return 0;
 }
 
-static void webu_stream_mjpeg_getimg(struct webui_ctx *webui)
+static void webu_stream_mjpeg_delay(struct webui_ctx *webui)
 {
-    long jpeg_size;
-    char resp_head[80];
-    int  header_len;
-    struct stream_data *local_stream;
+    /* Sleep required time to get to the user requested frame
+     * rate for the stream
+     */
+    long   stream_rate;
 
-    memset(webui->resp_page, '\0', webui->resp_size);
+    stream_rate = webu_stream_mjpeg_wait(webui);
+    if (stream_rate == 1000000000) {
+        SLEEP(1,0);
+    } else if (stream_rate > 0) {
+        SLEEP(0,stream_rate);
+    }
 
-    /* Assign to a local pointer the stream we want */
+}
+
+static struct stream_data *webu_stream_local(struct webui_ctx *webui)
+{
+    /* Return the stream of the camera the connection is viewing */
     if (webui->cnct_type == WEBUI_CNCT_FULL) {
-        local_stream = &webui->cnt->stream_norm;
+        return &webui->cnt->stream_norm;
 
     } else if (webui->cnct_type == WEBUI_CNCT_SUB) {
-        local_stream = &webui->cnt->stream_sub;
+        return &webui->cnt->stream_sub;
 
     } else if (webui->cnct_type == WEBUI_CNCT_MOTION) {
-        local_stream = &webui->cnt->stream_motion;
+        return &webui->cnt->stream_motion;
 
     } else if (webui->cnct_type == WEBUI_CNCT_SOURCE) {
-        local_stream = &webui->cnt->stream_source;
+        return &webui->cnt->stream_source;
 
-    } else {
+    } else if (webui->cnct_type == WEBUI_CNCT_SCALED) {
+        return &webui->cnt->stream_scaled[webui->stream_scaled].strm;
+
+    }
+
+    return NULL;
+}
+
+static void webu_stream_mjpeg_next(struct webui_ctx *webui)
+{
+    /* Wait for the motion loop to publish an image newer than the one sent
+     * last.  After a second without one the current image is sent again.
+     * Waits only once so that the broadcast when the camera stops ends it.
+     */
+    struct stream_data *strm;
+    struct timespec ts;
+    struct timeval tv;
+
+    strm = webu_stream_local(webui);
+    if (strm == NULL) {
         return;
     }
 
-    /* Copy jpg from the motion loop thread */
+    gettimeofday(&tv, NULL);
+    ts.tv_sec = tv.tv_sec + 1;
+    ts.tv_nsec = tv.tv_usec * 1000;
+
     pthread_mutex_lock(&webui->cnt->mutex_stream);
-        if ((!webui->cnt->detecting_motion) && (webui->cnt->conf.stream_motion)) {
-            webui->stream_fps = 1;
-        } else {
-            webui->stream_fps = webui->cnt->conf.stream_maxrate;
+        if ((strm->seq == webui->stream_seq) && !webui->cnt->webcontrol_finish) {
+            pthread_cond_timedwait(&webui->cnt->cond_stream, &webui->cnt->mutex_stream, &ts);
+        }
+    pthread_mutex_unlock(&webui->cnt->mutex_stream);
+
+}
+
+static int webu_stream_pool_suspend(struct webui_ctx *webui, long wait
+            , struct stream_data *strm)
+{
+    /* Suspend the connection until the pacing thread resumes it after wait ns.
+     * When strm is given the connection is resumed as soon as a new image is
+     * published and is not suspended at all when there already is one.  The
+     * image is checked with the pool lock held so webu_stream_pool_wake
+     * can not miss it.  The connection is suspended before it is on the list
+     * so the pacing thread can never resume a connection that is not
+     * suspended yet.
+     */
+    struct timeval time_curr;
+    int newer;
+
+    gettimeofday(&time_curr, NULL);
+    webui->stream_due.tv_sec = time_curr.tv_sec + (wait / 1000000000L);
+    webui->stream_due.tv_usec = time_curr.tv_usec + ((wait % 1000000000L) / 1000);
+    if (webui->stream_due.tv_usec >= 1000000) {
+        webui->stream_due.tv_sec++;
+        webui->stream_due.tv_usec -= 1000000;
+    }
+
+    pthread_mutex_lock(&webu_stream_pool.mutex);
+        if (webu_stream_pool.finish || !webu_stream_pool.running) {
+            pthread_mutex_unlock(&webu_stream_pool.mutex);
+            return FALSE;
         }
-        if (local_stream->jpeg_data == NULL) {
+        if (strm != NULL) {
+            pthread_mutex_lock(&webui->cnt->mutex_stream);
+                newer = (strm->seq != webui->stream_seq);
             pthread_mutex_unlock(&webui->cnt->mutex_stream);
-            return;
+            if (newer) {
+                pthread_mutex_unlock(&webu_stream_pool.mutex);
+                return FALSE;
+            }
         }
-        jpeg_size = local_stream->jpeg_size;
-        header_len = snprintf(resp_head, 80
-            ,"--BoundaryString\r\n"
-            "Content-type: image/jpeg\r\n"
-            "Content-Length: %9ld\r\n\r\n"
-            ,jpeg_size);
-        memcpy(webui->resp_page, resp_head, header_len);
-        memcpy(webui->resp_page + header_len
-            ,local_stream->jpeg_data
-            ,jpeg_size);
-        /* Copy in the terminator after the jpg data at the end*/
-        memcpy(webui->resp_page + header_len + jpeg_size,"\r\n",2);
-        webui->resp_used = header_len + jpeg_size + 2;
-    pthread_mutex_unlock(&webui->cnt->mutex_stream);
+        webui->stream_wait = strm;
+        MHD_suspend_connection(webui->connection);
+        webui->stream_next = webu_stream_pool.list;
+        webu_stream_pool.list = webui;
+        pthread_cond_signal(&webu_stream_pool.cond);
+    pthread_mutex_unlock(&webu_stream_pool.mutex);
+
+    return TRUE;
+}
+
+static void *webu_stream_pool_handler(void *arg)
+{
+    /* Resume the suspended connections as their next image becomes due */
+    struct webui_ctx **prev, *webui;
+    struct timeval time_curr, time_next;
+    struct timespec ts;
+    int waiting;
+
+    (void)arg;
+
+    util_threadname_set("sp", 0, NULL);
+
+    pthread_mutex_lock(&webu_stream_pool.mutex);
+        while (!webu_stream_pool.finish) {
+            gettimeofday(&time_curr, NULL);
+            waiting = FALSE;
+            prev = &webu_stream_pool.list;
+            while (*prev != NULL) {
+                webui = *prev;
+                if (timercmp(&webui->stream_due, &time_curr, <=)) {
+                    *prev = webui->stream_next;
+                    webui->stream_next = NULL;
+                    webui->stream_wait = NULL;
+                    MHD_resume_connection(webui->connection);
+                    continue;
+                }
+                if (!waiting || timercmp(&webui->stream_due, &time_next, <)) {
+                    time_next = webui->stream_due;
+                    waiting = TRUE;
+                }
+                prev = &webui->stream_next;
+            }
+
+            if (waiting) {
+                ts.tv_sec = time_next.tv_sec;
+                ts.tv_nsec = time_next.tv_usec * 1000;
+                pthread_cond_timedwait(&webu_stream_pool.cond, &webu_stream_pool.mutex, &ts);
+            } else {
+                pthread_cond_wait(&webu_stream_pool.cond, &webu_stream_pool.mutex);
+            }
+        }
+    pthread_mutex_unlock(&webu_stream_pool.mutex);
+
+    pthread_exit(NULL);
+}
+
+int webu_stream_pool_start(void)
+{
+    /* Start the pacing thread for the shared stream daemon */
+    webu_stream_pool.finish = FALSE;
+    webu_stream_pool.list = NULL;
+
+    if (pthread_create(&webu_stream_pool.thread_id, NULL, &webu_stream_pool_handler, NULL) != 0) {
+        MOTION_LOG(ERR, TYPE_STREAM, SHOW_ERRNO, _("Unable to start the stream pacing thread"));
+        return -1;
+    }
+    webu_stream_pool.running = TRUE;
+
+    return 0;
+}
 
+void webu_stream_pool_stop(void)
+{
+    /* Resume every suspended connection so they can see the finish flag, then
+     * stop the pacing thread.  MHD requires this before the daemon is stopped.
+     */
+    struct webui_ctx *webui;
+
+    if (!webu_stream_pool.running) {
+        return;
+    }
+
+    pthread_mutex_lock(&webu_stream_pool.mutex);
+        webu_stream_pool.finish = TRUE;
+        while (webu_stream_pool.list != NULL) {
+            webui = webu_stream_pool.list;
+            webu_stream_pool.list = webui->stream_next;
+            webui->stream_next = NULL;
+            webui->stream_wait = NULL;
+            MHD_resume_connection(webui->connection);
+        }
+        pthread_cond_signal(&webu_stream_pool.cond);
+    pthread_mutex_unlock(&webu_stream_pool.mutex);
+
+    pthread_join(webu_stream_pool.thread_id, NULL);
+    webu_stream_pool.running = FALSE;
+}
+
+static void webu_stream_mjpeg_getimg(struct webui_ctx *webui)
+{
+    struct stream_data *local_stream;
+
+    /* Assign to a local pointer the stream we want */
+    local_stream = webu_stream_local(webui);
+    if (local_stream == NULL) {
+        return;
+    }
+
+    if ((!webui->cnt->detecting_motion) && (webui->cnt->conf.stream_motion)) {
+        webui->stream_fps = 1;
+    } else {
+        webui->stream_fps = webui->cnt->conf.stream_maxrate;
+    }
+
+    /* Drop the image sent last and share the latest one from the motion loop */
+    if (webui->stream_buf != NULL) {
+        webu_stream_unref(webui->cnt, webui->stream_buf);
+    }
+    webui->stream_buf = webu_stream_ref(webui->cnt, local_stream, &webui->stream_seq);
+    if (webui->stream_buf == NULL) {
+        return;
+    }
+
+    webui->stream_head_len = snprintf(webui->stream_head, sizeof(webui->stream_head)
+        ,"--BoundaryString\r\n"
+        "Content-type: image/jpeg\r\n"
+        "Content-Length: %9ld\r\n\r\n"
+        ,webui->stream_buf->jpeg_size);
+
+    /* The terminator is sent after the jpg data at the end */
+    webui->resp_used = webui->stream_head_len + webui->stream_buf->jpeg_size + 2;
+
+}
+
+static size_t webu_stream_mjpeg_copy(struct webui_ctx *webui, char *buf, size_t max)
+{
+    /* Copy up to max bytes of the header, jpg and terminator from stream_pos */
+    const char *src[3];
+    size_t len[3], pos, sent, cpy;
+    int indx;
+
+    src[0] = webui->stream_head;
+    len[0] = webui->stream_head_len;
+    src[1] = (const char *)webui->stream_buf->jpeg_data;
+    len[1] = webui->stream_buf->jpeg_size;
+    src[2] = "\r\n";
+    len[2] = 2;
+
+    pos = webui->stream_pos;
+    sent = 0;
+    for (indx = 0; (indx < 3) && (sent < max); indx++) {
+        if (pos >= len[indx]) {
+            pos -= len[indx];
+            continue;
+        }
+        cpy = len[indx] - pos;
+        if (cpy > (max - sent)) {
+            cpy = max - sent;
+        }
+        memcpy(buf + sent, src[indx] + pos, cpy);
+        sent += cpy;
+        pos = 0;
+    }
+
+    return sent;
 }
 
 static ssize_t webu_stream_mjpeg_response (void *cls, uint64_t pos, char *buf, size_t max)
@@ -143,12 +508,14 @@ static ssize_t webu_stream_mjpeg_response (void *cls, uint64_t pos, char *buf, s
     /* This is the callback response function for MHD streams.  It is kept "open" and
      * in process during the entire time that the user has the stream open in the web
      * browser.  We sleep the requested amount of time between fetching images to match
-     * the user configuration parameters.  This function may be called multiple times for
+     * the user configuration parameters and then wait until the motion loop publishes
+     * an image newer than the one sent last.  This function may be called multiple times for
      * a single image so we can write what we can to the buffer and pick up remaining bytes
      * to send based upon the stream position
      */
     struct webui_ctx *webui = cls;
     size_t sent_bytes;
+    long wait;
 
     (void)pos;  /*Remove compiler warning */
 
@@ -158,7 +525,24 @@ static ssize_t webu_stream_mjpeg_response (void *cls, uint64_t pos, char *buf, s
 
     if ((webui->stream_pos == 0) || (webui->resp_used == 0)) {
 
-        webu_stream_mjpeg_delay(webui);
+        if (webui->stream_pooled) {
+            wait = webu_stream_mjpeg_wait(webui);
+            if ((wait > 0) && webu_stream_pool_suspend(webui, wait, NULL)) {
+                return 0;
+            }
+            /* The image is sent when the wait for a new one ends either way */
+            if (!webui->stream_waited) {
+                webui->stream_waited = TRUE;
+                if (webu_stream_pool_suspend(webui, 1000000000L, webu_stream_local(webui))) {
+                    return 0;
+                }
+            }
+            webui->stream_waited = FALSE;
+        } else {
+            webu_stream_mjpeg_delay(webui);
+            webu_stream_mjpeg_next(webui);
+        }
+        gettimeofday(&webui->time_last, NULL);
 
         webui->stream_pos = 0;
         webui->resp_used = 0;
@@ -166,17 +550,16 @@ static ssize_t webu_stream_mjpeg_response (void *cls, uint64_t pos, char *buf, s
         webu_stream_mjpeg_getimg(webui);
 
         if (webui->resp_used == 0) {
+            /* No image yet, check again in a frame time */
+            if (webui->stream_pooled) {
+                wait = webu_stream_mjpeg_wait(webui);
+                webu_stream_pool_suspend(webui, (wait > 0) ? wait : 100000000L, NULL);
+            }
             return 0;
         }
     }
 
-    if ((webui->resp_used - webui->stream_pos) > max) {
-        sent_bytes = max;
-    } else {
-        sent_bytes = webui->resp_used - webui->stream_pos;
-    }
-
-    memcpy(buf, webui->resp_page + webui->stream_pos, sent_bytes);
+    sent_bytes = webu_stream_mjpeg_copy(webui, buf, max);
 
     webui->stream_pos = webui->stream_pos + sent_bytes;
     if (webui->stream_pos >= webui->resp_used) {
@@ -187,28 +570,6 @@ static ssize_t webu_stream_mjpeg_response (void *cls, uint64_t pos, char *buf, s
 
 }
 
-static void webu_stream_static_getimg(struct webui_ctx *webui)
-{
-    /* Obtain the current image, compress it to a JPG and put into webui->resp_page
-     * for MHD to send back to user
-     */
-    webui->resp_used = 0;
-
-    memset(webui->resp_page, '\0', webui->resp_size);
-
-    pthread_mutex_lock(&webui->cnt->mutex_stream);
-        if (webui->cnt->stream_norm.jpeg_data == NULL) {
-            pthread_mutex_unlock(&webui->cnt->mutex_stream);
-            return;
-        }
-        memcpy(webui->resp_page
-            ,webui->cnt->stream_norm.jpeg_data
-            ,webui->cnt->stream_norm.jpeg_size);
-        webui->resp_used = webui->cnt->stream_norm.jpeg_size;
-    pthread_mutex_unlock(&webui->cnt->mutex_stream);
-
-}
-
 static int webu_stream_checks(struct webui_ctx *webui)
 {
     /* Perform edits to determine whether the user specified a valid URL
@@ -242,7 +603,9 @@ static int webu_stream_checks(struct webui_ctx *webui)
     }
 
     /* Thread numbers are not used for context specific ports. */
-    if ((webui->cntlst == NULL) && (strlen(webui->uri_cmd1) > 0)) {
+    if ((webui->cntlst == NULL) && (strlen(webui->uri_cmd1) > 0) &&
+        (webui->cnct_type != WEBUI_CNCT_SCALED) &&
+        (webui->cnct_type != WEBUI_CNCT_HLS)) {
         MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO
             , _("Bad URL for a camera specific port: %s"),webui->url);
         return -1;
@@ -275,6 +638,12 @@ static void webu_stream_cnct_count(struct webui_ctx *webui)
             cnct_count = webui->cnt->stream_source.cnct_count;
         pthread_mutex_unlock(&webui->cnt->mutex_stream);
 
+    } else if (webui->cnct_type == WEBUI_CNCT_SCALED) {
+        pthread_mutex_lock(&webui->cnt->mutex_stream);
+            webui->cnt->stream_scaled[webui->stream_scaled].strm.cnct_count++;
+            cnct_count = webui->cnt->stream_scaled[webui->stream_scaled].strm.cnct_count;
+        pthread_mutex_unlock(&webui->cnt->mutex_stream);
+
     } else {
         /* Stream, Static */
         pthread_mutex_lock(&webui->cnt->mutex_stream);
@@ -283,9 +652,11 @@ static void webu_stream_cnct_count(struct webui_ctx *webui)
         pthread_mutex_unlock(&webui->cnt->mutex_stream);
     }
 
-    if (cnct_count == 1) {
+    if ((cnct_count == 1) && !webui->stream_pooled) {
         /* This is the first connection so we need to wait half a sec
-         * so that the motion loop on the other thread can update image
+         * so that the motion loop on the other thread can update image.
+         * The threads of the shared daemon may not sleep so the stream
+         * there waits for the first image by itself.
          */
         SLEEP(0,500000000L);
     }
@@ -305,8 +676,6 @@ mymhd_retcd webu_stream_mjpeg(struct webui_ctx *webui)
 
     webu_stream_cnct_count(webui);
 
-    webu_stream_mjpeg_checkbuffers(webui);
-
     gettimeofday(&webui->time_last, NULL);
 
     response = MHD_create_response_from_callback (MHD_SIZE_UNKNOWN, 1024
@@ -351,17 +720,20 @@ mymhd_retcd webu_stream_static(struct webui_ctx *webui)
 
     webu_stream_cnct_count(webui);
 
-    webu_stream_mjpeg_checkbuffers(webui);
-
-    webu_stream_static_getimg(webui);
-
-    if (webui->resp_used == 0) {
+    /* MHD takes its own copy of the image so the reference is dropped right away */
+    webui->stream_buf = webu_stream_ref(webui->cnt, &webui->cnt->stream_norm, NULL);
+    if (webui->stream_buf == NULL) {
         MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO, _("Could not get image to stream."));
         return MHD_NO;
     }
+    webui->resp_used = webui->stream_buf->jpeg_size;
 
     response = MHD_create_response_from_buffer (webui->resp_used
-        ,(void *)webui->resp_page, MHD_RESPMEM_MUST_COPY);
+        ,(void *)webui->stream_buf->jpeg_data, MHD_RESPMEM_MUST_COPY);
+
+    webu_stream_unref(webui->cnt, webui->stream_buf);
+    webui->stream_buf = NULL;
+
     if (!response) {
         MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO, _("Invalid response"));
         return MHD_NO;
@@ -388,3 +760,63 @@ mymhd_retcd webu_stream_static(struct webui_ctx *webui)
 
     return retcd;
 }
+
+mymhd_retcd webu_stream_hls(struct webui_ctx *webui)
+{
+    /* Create the response for a playlist or segment of the HLS stream
+     * /{camid}/hls/{file} or /hls/{file} on a camera port
+     */
+    mymhd_retcd retcd;
+    struct MHD_Response *response;
+    const char *file, *mime;
+    char *resp;
+    size_t resp_len;
+    int indx;
+
+    if (webu_stream_checks(webui) == -1) {
+        return MHD_NO;
+    }
+
+    if (mystreq(webui->uri_camid,"hls")) {
+        file = webui->uri_cmd1;
+    } else {
+        file = webui->uri_cmd2;
+    }
+
+    resp = webu_hls_get(webui->cnt, file, &resp_len, &mime);
+    if (resp == NULL) {
+        MOTION_LOG(DBG, TYPE_STREAM, NO_ERRNO, _("HLS file not available: %s"), webui->url);
+        return MHD_NO;
+    }
+
+    response = MHD_create_response_from_buffer (resp_len
+        ,(void *)resp, MHD_RESPMEM_MUST_FREE);
+    if (!response) {
+        free(resp);
+        MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO, _("Invalid response"));
+        return MHD_NO;
+    }
+
+    for (indx = 0; indx < webui->cnt->stream_headers->params_count; indx++) {
+        retcd = MHD_add_response_header (response
+            , webui->cnt->stream_headers->params_array[indx].param_name
+            , webui->cnt->stream_headers->params_array[indx].param_value);
+        if (retcd == MHD_NO) {
+            MOTION_LOG(ERR, TYPE_STREAM, NO_ERRNO
+                , _("Error adding stream header %s %s")
+                , webui->cnt->stream_headers->params_array[indx].param_name
+                , webui->cnt->stream_headers->params_array[indx].param_value);
+        }
+    }
+
+    MHD_add_response_header (response, MHD_HTTP_HEADER_CONTENT_TYPE, mime);
+    /* The playlist changes with each segment */
+    if (mystreq(file, "stream.m3u8")) {
+        MHD_add_response_header (response, "Cache-Control", "no-cache");
+    }
+
+    retcd = MHD_queue_response (webui->connection, MHD_HTTP_OK, response);
+    MHD_destroy_response (response);
+
+    return retcd;
+}
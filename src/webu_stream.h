@@ -25,5 +25,13 @@
 
 mymhd_retcd webu_stream_mjpeg(struct webui_ctx *webui);
 mymhd_retcd webu_stream_static(struct webui_ctx *webui);
+mymhd_retcd webu_stream_hls(struct webui_ctx *webui);
+
+struct stream_buffer *webu_stream_getbuf(struct context *cnt, struct stream_data *strm);
+void webu_stream_putbuf(struct context *cnt, struct stream_data *strm, struct stream_buffer *buf);
+void webu_stream_unref(struct context *cnt, struct stream_buffer *buf);
+void webu_stream_freebufs(struct context *cnt, struct stream_data *strm);
+int webu_stream_pool_start(void);
+void webu_stream_pool_stop(void);
 
 #endif
@@ -351,16 +351,12 @@ static void webu_text_set_query(struct webui_ctx *webui)
 
     webu_text_camera_name(webui);
 
-    indx_parm = 0;
-    while (config_params[indx_parm].param_name != NULL) {
-
-        if ((config_params[indx_parm].webui_level > webui->cntlst[0]->conf.webcontrol_parms) ||
-            (config_params[indx_parm].webui_level == WEBUI_LEVEL_NEVER) ||
-            ((webui->thread_nbr != 0) && (config_params[indx_parm].main_thread != 0)) ||
-            (mystrne(webui->uri_parm1, config_params[indx_parm].param_name))) {
-            indx_parm++;
-            continue;
-        }
+    indx_parm = conf_param_lookup(webui->uri_parm1);
+    if ((indx_parm >= 0) &&
+        (config_params[indx_parm].webui_level <= webui->cntlst[0]->conf.webcontrol_parms) &&
+        (config_params[indx_parm].webui_level != WEBUI_LEVEL_NEVER) &&
+        ((webui->thread_nbr == 0) || (config_params[indx_parm].main_thread == 0)) &&
+        (mystreq(webui->uri_parm1, config_params[indx_parm].param_name))) {
 
         val_parm = config_params[indx_parm].print(webui->cntlst, NULL, indx_parm, webui->thread_nbr);
         if (val_parm == NULL) {
@@ -376,10 +372,6 @@ static void webu_text_set_query(struct webui_ctx *webui)
             ,val_parm
         );
         webu_write(webui, response);
-
-        break;
-
-        indx_parm++;
     }
 
     webu_text_trailer(webui);
@@ -922,69 +914,57 @@ void webu_text_get_query(struct webui_ctx *webui)
      * get the new parameter name so we can check its webcontrol_parms level
      */
     snprintf(temp_name, WEBUI_LEN_PARM, "%s", webui->uri_value1);
-    indx_parm=0;
-    while (dep_config_params[indx_parm].name != NULL) {
-        if (mystreq(dep_config_params[indx_parm].name, webui->uri_value1)) {
-            snprintf(temp_name, WEBUI_LEN_PARM, "%s", dep_config_params[indx_parm].newname);
-            break;
-        }
-        indx_parm++;
+    indx_parm = conf_dep_lookup(webui->uri_value1);
+    if (indx_parm >= 0) {
+        snprintf(temp_name, WEBUI_LEN_PARM, "%s", dep_config_params[indx_parm].newname);
     }
 
-    indx_parm = 0;
-    while (config_params[indx_parm].param_name != NULL) {
-
-        if ((config_params[indx_parm].webui_level > webui->cntlst[0]->conf.webcontrol_parms) ||
-            (config_params[indx_parm].webui_level == WEBUI_LEVEL_NEVER) ||
-            mystrne(webui->uri_parm1,"query") ||
-            mystrne(temp_name, config_params[indx_parm].param_name)) {
-            indx_parm++;
-            continue;
-        }
-
-        val_parm = config_params[indx_parm].print(webui->cntlst, NULL, indx_parm, webui->thread_nbr);
-        if (val_parm == NULL) {
-            val_parm = config_params[indx_parm].print(webui->cntlst, NULL, indx_parm, 0);
-        }
-
-        if (mystrne(webui->uri_value1, config_params[indx_parm].param_name)) {
-            MOTION_LOG(NTC, TYPE_STREAM, NO_ERRNO
-            , _("'%s' option is depreciated.  New option name is '%s'")
-            ,webui->uri_value1, config_params[indx_parm].param_name);
-        }
+    indx_parm = conf_param_lookup(temp_name);
+    if ((indx_parm < 0) ||
+        (config_params[indx_parm].webui_level > webui->cntlst[0]->conf.webcontrol_parms) ||
+        (config_params[indx_parm].webui_level == WEBUI_LEVEL_NEVER) ||
+        mystrne(webui->uri_parm1,"query") ||
+        mystrne(temp_name, config_params[indx_parm].param_name)) {
+        webu_text_badreq(webui);
+        return;
+    }
 
-        webu_text_header(webui);
+    val_parm = config_params[indx_parm].print(webui->cntlst, NULL, indx_parm, webui->thread_nbr);
+    if (val_parm == NULL) {
+        val_parm = config_params[indx_parm].print(webui->cntlst, NULL, indx_parm, 0);
+    }
 
-        webu_text_back(webui,"/config");
+    if (mystrne(webui->uri_value1, config_params[indx_parm].param_name)) {
+        MOTION_LOG(NTC, TYPE_STREAM, NO_ERRNO
+        , _("'%s' option is depreciated.  New option name is '%s'")
+        ,webui->uri_value1, config_params[indx_parm].param_name);
+    }
 
-        webu_text_camera_name(webui);
+    webu_text_header(webui);
 
-        if (webui->cntlst[0]->conf.webcontrol_interface == 2) {
-            snprintf(response, sizeof (response),
-                "<ul>\n"
-                "  <li>%s = %s </li>\n"
-                "</ul>\n"
-                ,config_params[indx_parm].param_name
-                ,val_parm
-            );
-        } else {
-            snprintf(response, sizeof (response),
-                "%s = %s %s\n"
-                "Done %s\n"
-                ,config_params[indx_parm].param_name
-                ,val_parm
-                ,webui->text_eol, webui->text_eol
-            );
-        }
-        webu_write(webui, response);
-        webu_text_trailer(webui);
+    webu_text_back(webui,"/config");
 
-        break;
-    }
+    webu_text_camera_name(webui);
 
-    if (config_params[indx_parm].param_name == NULL) {
-        webu_text_badreq(webui);
+    if (webui->cntlst[0]->conf.webcontrol_interface == 2) {
+        snprintf(response, sizeof (response),
+            "<ul>\n"
+            "  <li>%s = %s </li>\n"
+            "</ul>\n"
+            ,config_params[indx_parm].param_name
+            ,val_parm
+        );
+    } else {
+        snprintf(response, sizeof (response),
+            "%s = %s %s\n"
+            "Done %s\n"
+            ,config_params[indx_parm].param_name
+            ,val_parm
+            ,webui->text_eol, webui->text_eol
+        );
     }
+    webu_write(webui, response);
+    webu_text_trailer(webui);
 
 }
 
@@ -1055,6 +1035,7 @@ void webu_text_connection(struct webui_ctx *webui)
                 ,webui->cntlst[indx]->conf.camera_name ? " -- " : ""
                 ,webui->cntlst[indx]->conf.camera_name ? webui->cntlst[indx]->conf.camera_name : ""
                 ,(!webui->cntlst[indx]->running)? "NOT RUNNING" :
+                (webui->cntlst[indx]->connecting)? "Connecting":
                 (webui->cntlst[indx]->lost_connection)? "Lost connection": "Connection OK"
                 ,webui->text_eol
             );
@@ -1067,6 +1048,7 @@ void webu_text_connection(struct webui_ctx *webui)
             ,webui->cnt->conf.camera_name ? " -- " : ""
             ,webui->cnt->conf.camera_name ? webui->cnt->conf.camera_name : ""
             ,(!webui->cnt->running)? "NOT RUNNING" :
+             (webui->cnt->connecting)? "Connecting":
              (webui->cnt->lost_connection)? "Lost connection": "Connection OK"
             ,webui->text_eol
         );